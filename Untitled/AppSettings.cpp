@@ -9,8 +9,19 @@ float Turbidity = 2.0f;
 
 bool32 EnableTAA = false;
 bool32 EnableSky = false;
+bool32 EnableFrustumCulling = true;
+bool32 UseMeshBvh = true;
+bool32 EnableOcclusionCulling = true;
+bool32 EnableSoftwareOcclusion = false;
+bool32 AutoPickOccluders = true;
+int32_t MaxOccluders = 16;
+uint32_t SoftwareOccludedMeshes = 0;
+float SoftwareOcclusionMs = 0.0f;
+bool32 EnableSpotShadowCache = true;
+int32_t SpotShadowUpdateBudget = 0;
 uint64_t MaxLightClamp = 32;
 bool32 RenderLights = true;
+int32_t ClusterBinningMode = ClusterBinning_GPU;
 bool32 ComputeUVGradients = true;
 float Exposure = -14.0f;
 float BloomExposure = -4.0f;
@@ -18,6 +29,7 @@ float BloomMagnitude = 1.0f;
 float BloomBlurSigma = 2.5f;
 float CameraSpeed = 5.0f;
 glm::vec3 CameraPosition = glm::vec3(0);
+uint32_t SunShadowCasters[4] = {};
 bool32 ShowAlbedoMaps = false;
 bool32 ShowNormalMaps = false;
 bool32 ShowSpecular = false;
@@ -8,12 +8,17 @@ namespace AppSettings
 {
 static const uint64_t ClusterTileSize = 16;
 static const uint64_t NumZTiles = 16;
-static const uint64_t SpotLightElementsPerCluster = 1;
 
-static const uint64_t MaxSpotLights = 32;
+// Spot lights past this many are shaded without shadows, the clusters take any number of lights
+static const uint64_t MaxSpotLightShadows = 32;
 static const float SpotLightRange = 7.5000f;
+static const float PointLightRange = 5.0000f;
 static const float SpotShadowNearClip = 0.1000f;
 
+// Largest projected LOD error in pixels, the shadow maps get away with coarser levels
+static const float LodPixelError = 1.0f;
+static const float ShadowLodPixelError = 2.0f;
+
 extern glm::vec3 SunDirection;
 extern float SunSize;
 extern glm::vec3 GroundAlbedo;
@@ -21,8 +26,34 @@ extern float Turbidity;
 
 extern bool32 EnableTAA;
 extern bool32 EnableSky;
+extern bool32 EnableFrustumCulling;
+// Frustum culls the scene meshes through their BVH instead of testing every mesh
+extern bool32 UseMeshBvh;
+// Two phase depth pyramid culling of the GPU driven meshes and meshlets
+extern bool32 EnableOcclusionCulling;
+// CPU software rasterized occlusion culling of the meshes in the main camera frustum, opt-in
+// from the UI since it costs CPU time every frame
+extern bool32 EnableSoftwareOcclusion;
+// Off keeps the occluders picked last, to look around them from other places
+extern bool32 AutoPickOccluders;
+extern int32_t MaxOccluders;
+// Main camera meshes the software occlusion culled last frame and how long it took
+extern uint32_t SoftwareOccludedMeshes;
+extern float SoftwareOcclusionMs;
+extern bool32 EnableSpotShadowCache;
+// Stale spot shadow slices re-rendered per frame, 0 for all of them
+extern int32_t SpotShadowUpdateBudget;
 extern uint64_t MaxLightClamp;
 extern bool32 RenderLights;
+// Who fills the spot light cluster masks
+enum ClusterBinningModes : int32_t
+{
+  ClusterBinning_GPU = 0,
+  ClusterBinning_CPU,
+  // GPU passes, their result is read back and compared with the CPU one
+  ClusterBinning_GPUCheckedOnCPU,
+};
+extern int32_t ClusterBinningMode;
 extern bool32 ComputeUVGradients;
 extern float Exposure;
 extern float BloomExposure;
@@ -30,6 +61,8 @@ extern float BloomMagnitude;
 extern float BloomBlurSigma;
 extern float CameraSpeed;
 extern glm::vec3 CameraPosition;
+// Meshes drawn into each sun shadow cascade last frame
+extern uint32_t SunShadowCasters[4];
 extern bool32 ShowAlbedoMaps;
 extern bool32 ShowNormalMaps;
 extern bool32 ShowSpecular;
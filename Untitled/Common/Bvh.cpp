@@ -0,0 +1,1462 @@
+#include "Bvh.hpp"
+#include "Sampling.hpp"
+#include "Timer.hpp"
+#include "WorkerPool.hpp"
+
+#include <immintrin.h>
+
+//---------------------------------------------------------------------------//
+// Internal
+//---------------------------------------------------------------------------//
+static constexpr uint32_t NumBins = 16;
+
+// Deeper than this the binary tree is split at the median instead of by SAH, which bounds the
+// depth and so the traversal stacks
+static constexpr uint32_t MaxSahDepth = 48;
+static constexpr uint32_t MaxStackSize = 256;
+static constexpr uint32_t MaxPlanes = 16;
+
+// Primitives per job when the top splits are binned in parallel
+static constexpr uint32_t BinChunkSize = 16384;
+
+// Leaf boxes in the nodes grow by this fraction of their coordinates, and the plane offsets by
+// this fraction of themselves, so rounding in the 4 wide tests never drops a node holding a
+// primitive the per primitive test keeps
+static constexpr float BoundsSlack = 1e-5f;
+// Same for the cone test, whose distance to the axis loses more precision
+static constexpr float ConeSlack = 1e-3f;
+
+static constexpr uint32_t NoChild = UINT32_MAX;
+
+struct BuildNode
+{
+  glm::vec3 min;
+  glm::vec3 max;
+  uint32_t first;
+  uint32_t count;
+  // NoChild for leaves
+  uint32_t left;
+  uint32_t right;
+};
+
+// Bounds in SSE registers since growing them is most of the build
+struct BuildBounds
+{
+  __m128 min = _mm_set1_ps(FLT_MAX);
+  __m128 max = _mm_set1_ps(-FLT_MAX);
+
+  void grow(__m128 p_Min, __m128 p_Max)
+  {
+    min = _mm_min_ps(min, p_Min);
+    max = _mm_max_ps(max, p_Max);
+  }
+  void grow(const BuildBounds& p_Other) { grow(p_Other.min, p_Other.max); }
+};
+
+// Boxes and centroids of a range of primitives
+struct RangeBounds
+{
+  BuildBounds boxes;
+  BuildBounds centroids;
+
+  void grow(const RangeBounds& p_Other)
+  {
+    boxes.grow(p_Other.boxes);
+    centroids.grow(p_Other.centroids);
+  }
+};
+
+// Left uninitialized, small ranges use fewer bins and reset() only clears those
+struct Bins
+{
+  struct Bin
+  {
+    __m128 boxMin;
+    __m128 boxMax;
+    uint32_t count;
+  };
+
+  Bin bins[3][NumBins];
+  uint32_t numBins;
+
+  void reset(uint32_t p_NumBins)
+  {
+    numBins = p_NumBins;
+    for (uint32_t axis = 0; axis < 3; ++axis)
+      for (uint32_t bin = 0; bin < p_NumBins; ++bin)
+        bins[axis][bin] = {_mm_set1_ps(FLT_MAX), _mm_set1_ps(-FLT_MAX), 0};
+  }
+};
+
+// Primitive box, partitioned in place of an index so the top splits don't gather from all over
+// memory. Centroids are min + max, twice the center.
+struct alignas(16) PrimitiveRef
+{
+  float min[3];
+  uint32_t index;
+  float max[3];
+  uint32_t unused;
+
+  __m128 loadMin() const { return _mm_load_ps(min); }
+  __m128 loadMax() const { return _mm_load_ps(max); }
+  float centroid(uint32_t p_Axis) const { return min[p_Axis] + max[p_Axis]; }
+};
+
+struct BuildContext
+{
+  PrimitiveRef* refs;
+  // Same size as refs, ranges use the part at their own offset
+  PrimitiveRef* scratch;
+};
+
+// Range the top splits hand to a job, its node is filled in when the job's nodes are merged
+struct SubtreeTask
+{
+  uint32_t node;
+  uint32_t first;
+  uint32_t count;
+  uint32_t depth;
+  RangeBounds range;
+};
+//---------------------------------------------------------------------------//
+static glm::vec3 toVec3(__m128 p_Value)
+{
+  alignas(16) float values[4];
+  _mm_store_ps(values, p_Value);
+  return glm::vec3(values[0], values[1], values[2]);
+}
+//---------------------------------------------------------------------------//
+static float halfArea(const glm::vec3& p_Min, const glm::vec3& p_Max)
+{
+  const glm::vec3 size = p_Max - p_Min;
+  return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+//---------------------------------------------------------------------------//
+static float halfArea(const BuildBounds& p_Bounds)
+{
+  const __m128 size = _mm_sub_ps(p_Bounds.max, p_Bounds.min);
+  const __m128 rotated = _mm_shuffle_ps(size, size, _MM_SHUFFLE(3, 0, 2, 1));
+  const __m128 products = _mm_mul_ps(size, rotated);
+  return _mm_cvtss_f32(_mm_add_ss(
+      _mm_add_ss(products, _mm_shuffle_ps(products, products, _MM_SHUFFLE(1, 1, 1, 1))),
+      _mm_shuffle_ps(products, products, _MM_SHUFFLE(2, 2, 2, 2))));
+}
+//---------------------------------------------------------------------------//
+static __m128 select(__m128 p_Mask, __m128 p_A, __m128 p_B)
+{
+  return _mm_or_ps(_mm_and_ps(p_Mask, p_A), _mm_andnot_ps(p_Mask, p_B));
+}
+//---------------------------------------------------------------------------//
+static void
+runChunks(WorkerPool* p_Pool, uint32_t p_NumChunks, const WorkerPool::JobFunction& p_Job)
+{
+  if (p_Pool != nullptr)
+    p_Pool->parallelFor(p_NumChunks, p_Job);
+  else
+  {
+    for (uint32_t chunk = 0; chunk < p_NumChunks; ++chunk)
+      p_Job(chunk);
+  }
+}
+//---------------------------------------------------------------------------//
+static void
+computeRange(const BuildContext& p_Context, uint32_t p_First, uint32_t p_Last, RangeBounds& p_Range)
+{
+  for (uint32_t i = p_First; i < p_Last; ++i)
+  {
+    const __m128 boxMin = p_Context.refs[i].loadMin();
+    const __m128 boxMax = p_Context.refs[i].loadMax();
+    const __m128 centroid = _mm_add_ps(boxMin, boxMax);
+    p_Range.boxes.grow(boxMin, boxMax);
+    p_Range.centroids.grow(centroid, centroid);
+  }
+}
+//---------------------------------------------------------------------------//
+static uint32_t binIndex(float p_Centroid, float p_Min, float p_Scale, uint32_t p_NumBins)
+{
+  return std::min(uint32_t((p_Centroid - p_Min) * p_Scale), p_NumBins - 1);
+}
+//---------------------------------------------------------------------------//
+static void binRange(
+    const BuildContext& p_Context,
+    uint32_t p_First,
+    uint32_t p_Last,
+    const glm::vec3& p_Min,
+    const glm::vec3& p_Scale,
+    Bins& p_Bins)
+{
+  for (uint32_t i = p_First; i < p_Last; ++i)
+  {
+    const PrimitiveRef& ref = p_Context.refs[i];
+    const __m128 boxMin = ref.loadMin();
+    const __m128 boxMax = ref.loadMax();
+    for (uint32_t axis = 0; axis < 3; ++axis)
+    {
+      Bins::Bin& bin = p_Bins.bins[axis][binIndex(
+          ref.centroid(axis), p_Min[axis], p_Scale[axis], p_Bins.numBins)];
+      bin.boxMin = _mm_min_ps(bin.boxMin, boxMin);
+      bin.boxMax = _mm_max_ps(bin.boxMax, boxMax);
+      ++bin.count;
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// Sweeps the bins of every axis for the lowest SAH cost, returns false when no axis has
+// primitives on both sides of a bin border
+static bool findSplit(
+    const Bins& p_Bins,
+    const glm::vec3& p_Scale,
+    uint32_t& p_Axis,
+    uint32_t& p_Bin,
+    BuildBounds& p_Left,
+    BuildBounds& p_Right)
+{
+  const uint32_t numBins = p_Bins.numBins;
+  float bestCost = FLT_MAX;
+  for (uint32_t axis = 0; axis < 3; ++axis)
+  {
+    if (p_Scale[axis] <= 0.0f)
+      continue;
+
+    float rightAreas[NumBins];
+    uint32_t rightCounts[NumBins];
+    BuildBounds right;
+    uint32_t rightCount = 0;
+    for (uint32_t bin = numBins - 1; bin > 0; --bin)
+    {
+      right.grow(p_Bins.bins[axis][bin].boxMin, p_Bins.bins[axis][bin].boxMax);
+      rightCount += p_Bins.bins[axis][bin].count;
+      rightAreas[bin] = rightCount > 0 ? halfArea(right) : 0.0f;
+      rightCounts[bin] = rightCount;
+    }
+
+    BuildBounds left;
+    uint32_t leftCount = 0;
+    for (uint32_t bin = 1; bin < numBins; ++bin)
+    {
+      left.grow(p_Bins.bins[axis][bin - 1].boxMin, p_Bins.bins[axis][bin - 1].boxMax);
+      leftCount += p_Bins.bins[axis][bin - 1].count;
+      if (leftCount == 0 || rightCounts[bin] == 0)
+        continue;
+
+      const float cost = leftCount * halfArea(left) + rightCounts[bin] * rightAreas[bin];
+      if (cost < bestCost)
+      {
+        bestCost = cost;
+        p_Axis = axis;
+        p_Bin = bin;
+      }
+    }
+  }
+
+  if (bestCost == FLT_MAX)
+    return false;
+
+  for (uint32_t bin = 0; bin < numBins; ++bin)
+  {
+    const Bins::Bin& source = p_Bins.bins[p_Axis][bin];
+    (bin < p_Bin ? p_Left : p_Right).grow(source.boxMin, source.boxMax);
+  }
+  return true;
+}
+//---------------------------------------------------------------------------//
+// Reorders the range into its two halves and returns the size of the first. p_Pool bins large
+// ranges in parallel, the bins only hold min/max and counts so the result is the same.
+static uint32_t partitionRange(
+    const BuildContext& p_Context,
+    uint32_t p_First,
+    uint32_t p_Count,
+    uint32_t p_Depth,
+    const RangeBounds& p_Range,
+    WorkerPool* p_Pool,
+    RangeBounds& p_Left,
+    RangeBounds& p_Right)
+{
+  // Fewer bins for small ranges, where clearing and sweeping them would cost more than binning
+  const uint32_t numBins = std::min(std::max(p_Count / 4, 4u), NumBins);
+  const glm::vec3 centroidMin = toVec3(p_Range.centroids.min);
+  const glm::vec3 centroidSize = toVec3(p_Range.centroids.max) - centroidMin;
+  glm::vec3 scale = glm::vec3(0.0f);
+  for (uint32_t axis = 0; axis < 3; ++axis)
+    if (centroidSize[axis] >= 1e-30f)
+      scale[axis] = numBins / centroidSize[axis];
+
+  uint32_t axis = 0;
+  uint32_t bin = 0;
+  bool sahSplit = false;
+  if (p_Depth < MaxSahDepth && scale != glm::vec3(0.0f))
+  {
+    const uint32_t numChunks = (p_Count + BinChunkSize - 1) / BinChunkSize;
+    Bins bins;
+    bins.reset(numBins);
+    if (p_Pool != nullptr && numChunks > 1)
+    {
+      std::vector<Bins> chunkBins(numChunks);
+      p_Pool->parallelFor(numChunks, [&](uint32_t p_Chunk) {
+        const uint32_t first = p_First + p_Chunk * BinChunkSize;
+        const uint32_t last = std::min(first + BinChunkSize, p_First + p_Count);
+        chunkBins[p_Chunk].reset(numBins);
+        binRange(p_Context, first, last, centroidMin, scale, chunkBins[p_Chunk]);
+      });
+
+      for (const Bins& chunk : chunkBins)
+      {
+        for (uint32_t a = 0; a < 3; ++a)
+        {
+          for (uint32_t b = 0; b < numBins; ++b)
+          {
+            Bins::Bin& merged = bins.bins[a][b];
+            merged.boxMin = _mm_min_ps(merged.boxMin, chunk.bins[a][b].boxMin);
+            merged.boxMax = _mm_max_ps(merged.boxMax, chunk.bins[a][b].boxMax);
+            merged.count += chunk.bins[a][b].count;
+          }
+        }
+      }
+    }
+    else
+      binRange(p_Context, p_First, p_First + p_Count, centroidMin, scale, bins);
+
+    p_Left = RangeBounds();
+    p_Right = RangeBounds();
+    sahSplit = findSplit(bins, scale, axis, bin, p_Left.boxes, p_Right.boxes);
+  }
+
+  PrimitiveRef* first = p_Context.refs + p_First;
+  if (sahSplit)
+  {
+    // Stable and without branches, every ref is written to both sides and one of them advances.
+    // The bins only have the halves' boxes, their centroid bounds are gathered here.
+    PrimitiveRef* scratch = p_Context.scratch + p_First;
+    const __m128 lowest = _mm_set1_ps(-FLT_MAX);
+    const __m128 highest = _mm_set1_ps(FLT_MAX);
+    BuildBounds& leftCentroids = p_Left.centroids;
+    BuildBounds& rightCentroids = p_Right.centroids;
+    uint32_t leftCount = 0;
+    uint32_t rightCount = 0;
+    for (uint32_t i = 0; i < p_Count; ++i)
+    {
+      const PrimitiveRef ref = first[i];
+      const uint32_t left =
+          binIndex(ref.centroid(axis), centroidMin[axis], scale[axis], numBins) < bin;
+      first[leftCount] = ref;
+      scratch[rightCount] = ref;
+      leftCount += left;
+      rightCount += 1 - left;
+
+      // One side grows by the centroid, the other by an empty box
+      const __m128 centroid = _mm_add_ps(ref.loadMin(), ref.loadMax());
+      const __m128 leftMask = _mm_castsi128_ps(_mm_set1_epi32(-int32_t(left)));
+      leftCentroids.grow(select(leftMask, centroid, highest), select(leftMask, centroid, lowest));
+      rightCentroids.grow(select(leftMask, highest, centroid), select(leftMask, lowest, centroid));
+    }
+    memcpy(first + leftCount, scratch, rightCount * sizeof(PrimitiveRef));
+    return leftCount;
+  }
+
+  // Median of the widest centroid axis, or just halves when all centroids coincide
+  const uint32_t leftCount = p_Count / 2;
+  if (scale != glm::vec3(0.0f))
+  {
+    axis = centroidSize.x >= centroidSize.y && centroidSize.x >= centroidSize.z ? 0
+           : centroidSize.y >= centroidSize.z                                 ? 1
+                                                                              : 2;
+    std::nth_element(
+        first,
+        first + leftCount,
+        first + p_Count,
+        [axis](const PrimitiveRef& p_A, const PrimitiveRef& p_B) {
+          const float a = p_A.centroid(axis);
+          const float b = p_B.centroid(axis);
+          return a < b || (a == b && p_A.index < p_B.index);
+        });
+  }
+
+  p_Left = RangeBounds();
+  p_Right = RangeBounds();
+  computeRange(p_Context, p_First, p_First + leftCount, p_Left);
+  computeRange(p_Context, p_First + leftCount, p_First + p_Count, p_Right);
+  return leftCount;
+}
+//---------------------------------------------------------------------------//
+static uint32_t addBuildNode(
+    std::vector<BuildNode>& p_Nodes, uint32_t p_First, uint32_t p_Count, const RangeBounds& p_Range)
+{
+  p_Nodes.push_back(
+      {toVec3(p_Range.boxes.min), toVec3(p_Range.boxes.max), p_First, p_Count, NoChild, NoChild});
+  return uint32_t(p_Nodes.size() - 1);
+}
+//---------------------------------------------------------------------------//
+static uint32_t buildSubtree(
+    const BuildContext& p_Context,
+    uint32_t p_First,
+    uint32_t p_Count,
+    uint32_t p_Depth,
+    const RangeBounds& p_Range,
+    std::vector<BuildNode>& p_Nodes)
+{
+  const uint32_t nodeIdx = addBuildNode(p_Nodes, p_First, p_Count, p_Range);
+  if (p_Count <= Bvh::MaxLeafSize)
+    return nodeIdx;
+
+  RangeBounds left;
+  RangeBounds right;
+  const uint32_t leftCount =
+      partitionRange(p_Context, p_First, p_Count, p_Depth, p_Range, nullptr, left, right);
+
+  const uint32_t leftIdx = buildSubtree(p_Context, p_First, leftCount, p_Depth + 1, left, p_Nodes);
+  const uint32_t rightIdx = buildSubtree(
+      p_Context, p_First + leftCount, p_Count - leftCount, p_Depth + 1, right, p_Nodes);
+  p_Nodes[nodeIdx].left = leftIdx;
+  p_Nodes[nodeIdx].right = rightIdx;
+  return nodeIdx;
+}
+//---------------------------------------------------------------------------//
+// Splits ranges larger than p_SubtreeSize with parallel binning and leaves the rest to jobs
+static uint32_t buildTop(
+    const BuildContext& p_Context,
+    uint32_t p_First,
+    uint32_t p_Count,
+    uint32_t p_Depth,
+    const RangeBounds& p_Range,
+    uint32_t p_SubtreeSize,
+    WorkerPool* p_Pool,
+    std::vector<BuildNode>& p_Nodes,
+    std::vector<SubtreeTask>& p_Tasks)
+{
+  const uint32_t nodeIdx = addBuildNode(p_Nodes, p_First, p_Count, p_Range);
+  if (p_Count <= p_SubtreeSize)
+  {
+    p_Tasks.push_back({nodeIdx, p_First, p_Count, p_Depth, p_Range});
+    return nodeIdx;
+  }
+
+  RangeBounds left;
+  RangeBounds right;
+  const uint32_t leftCount =
+      partitionRange(p_Context, p_First, p_Count, p_Depth, p_Range, p_Pool, left, right);
+
+  const uint32_t leftIdx = buildTop(
+      p_Context, p_First, leftCount, p_Depth + 1, left, p_SubtreeSize, p_Pool, p_Nodes, p_Tasks);
+  const uint32_t rightIdx = buildTop(
+      p_Context,
+      p_First + leftCount,
+      p_Count - leftCount,
+      p_Depth + 1,
+      right,
+      p_SubtreeSize,
+      p_Pool,
+      p_Nodes,
+      p_Tasks);
+  p_Nodes[nodeIdx].left = leftIdx;
+  p_Nodes[nodeIdx].right = rightIdx;
+  return nodeIdx;
+}
+//---------------------------------------------------------------------------//
+// Pulls up the largest grandchildren until a node has 4 children, keeping them in order so every
+// node still covers a contiguous range of primitives. Nodes are written depth first.
+static uint32_t collapseNode(
+    const std::vector<BuildNode>& p_BuildNodes,
+    uint32_t p_BuildNode,
+    std::vector<BvhNode>& p_Nodes,
+    std::vector<uint32_t>& p_NodeFirst)
+{
+  const BuildNode& buildNode = p_BuildNodes[p_BuildNode];
+  uint32_t slots[4] = {p_BuildNode};
+  uint32_t numSlots = 1;
+  if (buildNode.left != NoChild)
+  {
+    slots[0] = buildNode.left;
+    slots[1] = buildNode.right;
+    numSlots = 2;
+    while (numSlots < 4)
+    {
+      uint32_t open = numSlots;
+      float openArea = -1.0f;
+      for (uint32_t slot = 0; slot < numSlots; ++slot)
+      {
+        const BuildNode& child = p_BuildNodes[slots[slot]];
+        const float area = halfArea(child.min, child.max);
+        if (child.left != NoChild && area > openArea)
+        {
+          open = slot;
+          openArea = area;
+        }
+      }
+      if (open == numSlots)
+        break;
+
+      const BuildNode& opened = p_BuildNodes[slots[open]];
+      for (uint32_t slot = numSlots; slot > open + 1; --slot)
+        slots[slot] = slots[slot - 1];
+      slots[open] = opened.left;
+      slots[open + 1] = opened.right;
+      ++numSlots;
+    }
+  }
+
+  const uint32_t nodeIdx = uint32_t(p_Nodes.size());
+  p_Nodes.push_back(BvhNode{});
+  p_NodeFirst.push_back(buildNode.first);
+  for (uint32_t slot = 0; slot < numSlots; ++slot)
+  {
+    const BuildNode& child = p_BuildNodes[slots[slot]];
+    const uint32_t childIdx = child.left == NoChild
+                                  ? Bvh::LeafFlag | child.first
+                                  : collapseNode(p_BuildNodes, slots[slot], p_Nodes, p_NodeFirst);
+    p_Nodes[nodeIdx].child[slot] = childIdx;
+    p_Nodes[nodeIdx].count[slot] = child.count;
+  }
+  return nodeIdx;
+}
+//---------------------------------------------------------------------------//
+static void
+setSlotBounds(BvhNode& p_Node, uint32_t p_Slot, const glm::vec3& p_Min, const glm::vec3& p_Max)
+{
+  p_Node.minX[p_Slot] = p_Min.x;
+  p_Node.minY[p_Slot] = p_Min.y;
+  p_Node.minZ[p_Slot] = p_Min.z;
+  p_Node.maxX[p_Slot] = p_Max.x;
+  p_Node.maxY[p_Slot] = p_Max.y;
+  p_Node.maxZ[p_Slot] = p_Max.z;
+}
+//---------------------------------------------------------------------------//
+static glm::vec3 boxCenter(const CullingBounds& p_Bounds, uint32_t p_Idx)
+{
+  return glm::vec3(p_Bounds.centerX[p_Idx], p_Bounds.centerY[p_Idx], p_Bounds.centerZ[p_Idx]);
+}
+//---------------------------------------------------------------------------//
+static glm::vec3 boxExtent(const CullingBounds& p_Bounds, uint32_t p_Idx)
+{
+  return glm::vec3(p_Bounds.extentX[p_Idx], p_Bounds.extentY[p_Idx], p_Bounds.extentZ[p_Idx]);
+}
+//---------------------------------------------------------------------------//
+// Same expression as the frustum culling's scalar path, so the leaves keep exactly the boxes
+// FrustumCulling::cull() keeps
+static bool testBoxPlanes(
+    const CullingBounds& p_Bounds, uint32_t p_Idx, const glm::vec4* p_Planes, uint32_t p_NumPlanes)
+{
+  for (uint32_t i = 0; i < p_NumPlanes; ++i)
+  {
+    const glm::vec4& plane = p_Planes[i];
+    const float distance = plane.x * p_Bounds.centerX[p_Idx] + plane.y * p_Bounds.centerY[p_Idx] +
+                           plane.z * p_Bounds.centerZ[p_Idx] + plane.w;
+    const float radius = std::abs(plane.x) * p_Bounds.extentX[p_Idx] +
+                         std::abs(plane.y) * p_Bounds.extentY[p_Idx] +
+                         std::abs(plane.z) * p_Bounds.extentZ[p_Idx];
+    if (distance + radius < 0.0f)
+      return false;
+  }
+  return true;
+}
+//---------------------------------------------------------------------------//
+// Bounding sphere against a cone capped by the plane at p_Range along the axis
+static bool testSphereCone(
+    const glm::vec3& p_Center,
+    float p_Radius,
+    const glm::vec3& p_Apex,
+    const glm::vec3& p_Direction,
+    float p_Range,
+    float p_CosAngle,
+    float p_SinAngle)
+{
+  const glm::vec3 toCenter = p_Center - p_Apex;
+  const float lengthSquared = glm::dot(toCenter, toCenter);
+  const float alongAxis = glm::dot(toCenter, p_Direction);
+  const float toAxis = std::sqrt(std::max(lengthSquared - alongAxis * alongAxis, 0.0f));
+  const float toCone = p_CosAngle * toAxis - alongAxis * p_SinAngle;
+  return toCone <= p_Radius && alongAxis <= p_Radius + p_Range && alongAxis >= -p_Radius;
+}
+//---------------------------------------------------------------------------//
+// Slab test, p_Distance is where the ray enters the box or 0 when it starts inside
+static bool intersectRayBox(
+    const glm::vec3& p_Origin,
+    const glm::vec3& p_InvDirection,
+    const glm::vec3& p_Min,
+    const glm::vec3& p_Max,
+    float p_MaxDistance,
+    float& p_Distance)
+{
+  const glm::vec3 t0 = (p_Min - p_Origin) * p_InvDirection;
+  const glm::vec3 t1 = (p_Max - p_Origin) * p_InvDirection;
+  const glm::vec3 tNear = glm::min(t0, t1);
+  const glm::vec3 tFar = glm::max(t0, t1);
+  const float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+  const float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, p_MaxDistance));
+  p_Distance = enter;
+  return enter <= exit;
+}
+//---------------------------------------------------------------------------//
+// Direction components of 0 would make infinities and NaNs in the slab tests
+static glm::vec3 safeInverse(const glm::vec3& p_Direction)
+{
+  glm::vec3 inverse;
+  for (uint32_t axis = 0; axis < 3; ++axis)
+  {
+    const float d = p_Direction[axis];
+    inverse[axis] = 1.0f / (std::abs(d) >= 1e-20f ? d : std::copysign(1e-20f, d));
+  }
+  return inverse;
+}
+//---------------------------------------------------------------------------//
+static uint32_t validSlots(const BvhNode& p_Node)
+{
+  const __m128i count = _mm_load_si128(reinterpret_cast<const __m128i*>(p_Node.count));
+  return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(count, _mm_setzero_si128())));
+}
+//---------------------------------------------------------------------------//
+// Node visitors for Bvh::traverse(): testNode() returns the slots to visit and the ones fully
+// inside, testPrimitive() is the exact test for the boxes of partially visited leaves
+struct PlanesVisitor
+{
+  __m128 planeX[MaxPlanes];
+  __m128 planeY[MaxPlanes];
+  __m128 planeZ[MaxPlanes];
+  __m128 planeW[MaxPlanes];
+  __m128 absX[MaxPlanes];
+  __m128 absY[MaxPlanes];
+  __m128 absZ[MaxPlanes];
+  __m128 slack[MaxPlanes];
+  const glm::vec4* planes;
+  uint32_t numPlanes;
+
+  PlanesVisitor(const glm::vec4* p_Planes, uint32_t p_NumPlanes)
+      : planes(p_Planes), numPlanes(p_NumPlanes)
+  {
+    assert(p_NumPlanes <= MaxPlanes);
+    for (uint32_t i = 0; i < p_NumPlanes; ++i)
+    {
+      const glm::vec4& plane = p_Planes[i];
+      planeX[i] = _mm_set1_ps(plane.x);
+      planeY[i] = _mm_set1_ps(plane.y);
+      planeZ[i] = _mm_set1_ps(plane.z);
+      planeW[i] = _mm_set1_ps(plane.w);
+      absX[i] = _mm_set1_ps(std::abs(plane.x));
+      absY[i] = _mm_set1_ps(std::abs(plane.y));
+      absZ[i] = _mm_set1_ps(std::abs(plane.z));
+      slack[i] = _mm_set1_ps(std::abs(plane.w) * BoundsSlack);
+    }
+  }
+
+  uint32_t testNode(const BvhNode& p_Node, uint32_t& p_InsideMask) const
+  {
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 minX = _mm_load_ps(p_Node.minX);
+    const __m128 minY = _mm_load_ps(p_Node.minY);
+    const __m128 minZ = _mm_load_ps(p_Node.minZ);
+    const __m128 maxX = _mm_load_ps(p_Node.maxX);
+    const __m128 maxY = _mm_load_ps(p_Node.maxY);
+    const __m128 maxZ = _mm_load_ps(p_Node.maxZ);
+    const __m128 centerX = _mm_mul_ps(_mm_add_ps(minX, maxX), half);
+    const __m128 centerY = _mm_mul_ps(_mm_add_ps(minY, maxY), half);
+    const __m128 centerZ = _mm_mul_ps(_mm_add_ps(minZ, maxZ), half);
+    const __m128 extentX = _mm_mul_ps(_mm_sub_ps(maxX, minX), half);
+    const __m128 extentY = _mm_mul_ps(_mm_sub_ps(maxY, minY), half);
+    const __m128 extentZ = _mm_mul_ps(_mm_sub_ps(maxZ, minZ), half);
+
+    const __m128 zero = _mm_setzero_ps();
+    __m128 outside = zero;
+    __m128 crossing = zero;
+    for (uint32_t i = 0; i < numPlanes; ++i)
+    {
+      const __m128 distance = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(planeX[i], centerX), _mm_mul_ps(planeY[i], centerY)),
+          _mm_add_ps(_mm_mul_ps(planeZ[i], centerZ), planeW[i]));
+      const __m128 radius = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(absX[i], extentX), _mm_mul_ps(absY[i], extentY)),
+          _mm_add_ps(_mm_mul_ps(absZ[i], extentZ), slack[i]));
+      outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+      crossing = _mm_or_ps(crossing, _mm_cmplt_ps(_mm_sub_ps(distance, radius), zero));
+    }
+
+    p_InsideMask = ~uint32_t(_mm_movemask_ps(crossing)) & 0xf;
+    return ~uint32_t(_mm_movemask_ps(outside)) & 0xf;
+  }
+
+  bool testPrimitive(const CullingBounds& p_Bounds, uint32_t p_Idx) const
+  {
+    return testBoxPlanes(p_Bounds, p_Idx, planes, numPlanes);
+  }
+};
+//---------------------------------------------------------------------------//
+struct ConeVisitor
+{
+  glm::vec3 apex;
+  glm::vec3 direction;
+  float range;
+  float cosAngle;
+  float sinAngle;
+
+  uint32_t testNode(const BvhNode& p_Node, uint32_t& p_InsideMask) const
+  {
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 minX = _mm_load_ps(p_Node.minX);
+    const __m128 minY = _mm_load_ps(p_Node.minY);
+    const __m128 minZ = _mm_load_ps(p_Node.minZ);
+    const __m128 maxX = _mm_load_ps(p_Node.maxX);
+    const __m128 maxY = _mm_load_ps(p_Node.maxY);
+    const __m128 maxZ = _mm_load_ps(p_Node.maxZ);
+    const __m128 extentX = _mm_mul_ps(_mm_sub_ps(maxX, minX), half);
+    const __m128 extentY = _mm_mul_ps(_mm_sub_ps(maxY, minY), half);
+    const __m128 extentZ = _mm_mul_ps(_mm_sub_ps(maxZ, minZ), half);
+    const __m128 toCenterX =
+        _mm_sub_ps(_mm_mul_ps(_mm_add_ps(minX, maxX), half), _mm_set1_ps(apex.x));
+    const __m128 toCenterY =
+        _mm_sub_ps(_mm_mul_ps(_mm_add_ps(minY, maxY), half), _mm_set1_ps(apex.y));
+    const __m128 toCenterZ =
+        _mm_sub_ps(_mm_mul_ps(_mm_add_ps(minZ, maxZ), half), _mm_set1_ps(apex.z));
+
+    const __m128 lengthSquared = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(toCenterX, toCenterX), _mm_mul_ps(toCenterY, toCenterY)),
+        _mm_mul_ps(toCenterZ, toCenterZ));
+    const __m128 alongAxis = _mm_add_ps(
+        _mm_add_ps(
+            _mm_mul_ps(toCenterX, _mm_set1_ps(direction.x)),
+            _mm_mul_ps(toCenterY, _mm_set1_ps(direction.y))),
+        _mm_mul_ps(toCenterZ, _mm_set1_ps(direction.z)));
+    const __m128 toAxis = _mm_sqrt_ps(_mm_max_ps(
+        _mm_sub_ps(lengthSquared, _mm_mul_ps(alongAxis, alongAxis)), _mm_setzero_ps()));
+    const __m128 toCone = _mm_sub_ps(
+        _mm_mul_ps(_mm_set1_ps(cosAngle), toAxis), _mm_mul_ps(alongAxis, _mm_set1_ps(sinAngle)));
+
+    const __m128 radius = _mm_add_ps(
+        _mm_sqrt_ps(_mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(extentX, extentX), _mm_mul_ps(extentY, extentY)),
+            _mm_mul_ps(extentZ, extentZ))),
+        _mm_mul_ps(_mm_sqrt_ps(lengthSquared), _mm_set1_ps(ConeSlack)));
+    const __m128 outside = _mm_or_ps(
+        _mm_cmpgt_ps(toCone, radius),
+        _mm_or_ps(
+            _mm_cmpgt_ps(alongAxis, _mm_add_ps(radius, _mm_set1_ps(range))),
+            _mm_cmplt_ps(_mm_add_ps(alongAxis, radius), _mm_setzero_ps())));
+
+    // The node's sphere doesn't hold its boxes' spheres, every leaf is tested
+    p_InsideMask = 0;
+    return ~uint32_t(_mm_movemask_ps(outside)) & 0xf;
+  }
+
+  bool testPrimitive(const CullingBounds& p_Bounds, uint32_t p_Idx) const
+  {
+    return testSphereCone(
+        boxCenter(p_Bounds, p_Idx),
+        glm::length(boxExtent(p_Bounds, p_Idx)),
+        apex,
+        direction,
+        range,
+        cosAngle,
+        sinAngle);
+  }
+};
+//---------------------------------------------------------------------------//
+// Public API
+//---------------------------------------------------------------------------//
+void Bvh::build(const CullingBounds& p_Bounds, WorkerPool* p_Pool)
+{
+  const uint32_t numPrimitives = p_Bounds.count();
+  assert(numPrimitives < LeafFlag);
+
+  m_Nodes.clear();
+  m_NodeFirst.clear();
+  m_Primitives.resize(numPrimitives);
+  if (numPrimitives == 0)
+  {
+    m_LeafBounds = CullingBounds();
+    return;
+  }
+
+  std::vector<PrimitiveRef> refs(numPrimitives);
+  std::vector<PrimitiveRef> scratch(numPrimitives);
+  const uint32_t numChunks = (numPrimitives + BinChunkSize - 1) / BinChunkSize;
+  std::vector<RangeBounds> chunkRanges(numChunks);
+  BuildContext context = {refs.data(), scratch.data()};
+  runChunks(p_Pool, numChunks, [&](uint32_t p_Chunk) {
+    const uint32_t first = p_Chunk * BinChunkSize;
+    const uint32_t last = std::min(first + BinChunkSize, numPrimitives);
+    for (uint32_t i = first; i < last; ++i)
+    {
+      const glm::vec3 center = boxCenter(p_Bounds, i);
+      const glm::vec3 extent = boxExtent(p_Bounds, i);
+      const glm::vec3 boxMin = center - extent;
+      const glm::vec3 boxMax = center + extent;
+      refs[i] = {{boxMin.x, boxMin.y, boxMin.z}, i, {boxMax.x, boxMax.y, boxMax.z}, 0};
+    }
+    computeRange(context, first, last, chunkRanges[p_Chunk]);
+  });
+
+  RangeBounds range;
+  for (const RangeBounds& chunkRange : chunkRanges)
+    range.grow(chunkRange);
+
+  // Depends on the primitive count only, so the tree doesn't depend on the number of threads
+  const uint32_t subtreeSize = std::max(numPrimitives / 64, 1024u);
+  std::vector<BuildNode> buildNodes;
+  std::vector<SubtreeTask> tasks;
+  buildTop(context, 0, numPrimitives, 0, range, subtreeSize, p_Pool, buildNodes, tasks);
+
+  std::vector<std::vector<BuildNode>> subtrees(tasks.size());
+  runChunks(p_Pool, uint32_t(tasks.size()), [&](uint32_t p_Task) {
+    const SubtreeTask& task = tasks[p_Task];
+    subtrees[p_Task].reserve(task.count);
+    buildSubtree(context, task.first, task.count, task.depth, task.range, subtrees[p_Task]);
+  });
+
+  // The job roots replace their placeholders, the rest of their nodes go to the end
+  for (uint32_t i = 0; i < tasks.size(); ++i)
+  {
+    const uint32_t offset = uint32_t(buildNodes.size()) - 1;
+    const auto remap = [offset](uint32_t p_Child) {
+      return p_Child == NoChild ? NoChild : p_Child + offset;
+    };
+    for (uint32_t j = 0; j < subtrees[i].size(); ++j)
+    {
+      BuildNode node = subtrees[i][j];
+      node.left = remap(node.left);
+      node.right = remap(node.right);
+      if (j == 0)
+        buildNodes[tasks[i].node] = node;
+      else
+        buildNodes.push_back(node);
+    }
+  }
+
+  m_Nodes.reserve(buildNodes.size() / 2 + 1);
+  m_NodeFirst.reserve(buildNodes.size() / 2 + 1);
+  collapseNode(buildNodes, 0, m_Nodes, m_NodeFirst);
+
+  for (uint32_t i = 0; i < numPrimitives; ++i)
+    m_Primitives[i] = refs[i].index;
+  refit(p_Bounds);
+}
+//---------------------------------------------------------------------------//
+void Bvh::refit(const CullingBounds& p_Bounds)
+{
+  assert(p_Bounds.count() == numPrimitives());
+
+  const uint32_t numPrimitives = this->numPrimitives();
+  std::vector<float>* leafArrays[] = {
+      &m_LeafBounds.centerX,
+      &m_LeafBounds.centerY,
+      &m_LeafBounds.centerZ,
+      &m_LeafBounds.extentX,
+      &m_LeafBounds.extentY,
+      &m_LeafBounds.extentZ};
+  const std::vector<float>* arrays[] = {
+      &p_Bounds.centerX,
+      &p_Bounds.centerY,
+      &p_Bounds.centerZ,
+      &p_Bounds.extentX,
+      &p_Bounds.extentY,
+      &p_Bounds.extentZ};
+  for (uint32_t a = 0; a < arrayCount32(arrays); ++a)
+  {
+    std::vector<float>& leafArray = *leafArrays[a];
+    const std::vector<float>& array = *arrays[a];
+    leafArray.resize(numPrimitives);
+    for (uint32_t i = 0; i < numPrimitives; ++i)
+      leafArray[i] = array[m_Primitives[i]];
+  }
+
+  refitNodes();
+}
+//---------------------------------------------------------------------------//
+void Bvh::refitNodes()
+{
+  // Children come after their parents
+  for (uint32_t nodeIdx = numNodes(); nodeIdx-- > 0;)
+  {
+    BvhNode& node = m_Nodes[nodeIdx];
+    for (uint32_t slot = 0; slot < 4 && node.count[slot] > 0; ++slot)
+    {
+      glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+      glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
+      const uint32_t child = node.child[slot];
+      if ((child & LeafFlag) != 0)
+      {
+        const uint32_t first = child & ~LeafFlag;
+        for (uint32_t i = first; i < first + node.count[slot]; ++i)
+        {
+          const glm::vec3 center = boxCenter(m_LeafBounds, i);
+          const glm::vec3 extent = boxExtent(m_LeafBounds, i);
+          boundsMin = glm::min(boundsMin, center - extent);
+          boundsMax = glm::max(boundsMax, center + extent);
+        }
+
+        const glm::vec3 slack = glm::max(glm::abs(boundsMin), glm::abs(boundsMax)) * BoundsSlack;
+        boundsMin -= slack;
+        boundsMax += slack;
+      }
+      else
+      {
+        const BvhNode& childNode = m_Nodes[child];
+        for (uint32_t c = 0; c < 4 && childNode.count[c] > 0; ++c)
+        {
+          boundsMin = glm::min(
+              boundsMin, glm::vec3(childNode.minX[c], childNode.minY[c], childNode.minZ[c]));
+          boundsMax = glm::max(
+              boundsMax, glm::vec3(childNode.maxX[c], childNode.maxY[c], childNode.maxZ[c]));
+        }
+      }
+      setSlotBounds(node, slot, boundsMin, boundsMax);
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+template <typename Visitor>
+uint32_t Bvh::traverse(const Visitor& p_Visitor, uint32_t* p_Visible) const
+{
+  if (m_Nodes.empty())
+    return 0;
+
+  uint32_t stack[MaxStackSize];
+  uint32_t stackSize = 0;
+  stack[stackSize++] = 0;
+
+  uint32_t numVisible = 0;
+  while (stackSize > 0)
+  {
+    const BvhNode& node = m_Nodes[stack[--stackSize]];
+    uint32_t insideMask = 0;
+    const uint32_t visitMask = p_Visitor.testNode(node, insideMask) & validSlots(node);
+    for (uint32_t slot = 0; slot < 4; ++slot)
+    {
+      if ((visitMask & (1u << slot)) == 0)
+        continue;
+
+      const uint32_t child = node.child[slot];
+      const bool leaf = (child & LeafFlag) != 0;
+      const uint32_t first = leaf ? child & ~LeafFlag : m_NodeFirst[child];
+      const uint32_t last = first + node.count[slot];
+      if ((insideMask & (1u << slot)) != 0)
+      {
+        for (uint32_t i = first; i < last; ++i)
+          p_Visible[numVisible++] = m_Primitives[i];
+      }
+      else if (leaf)
+      {
+        for (uint32_t i = first; i < last; ++i)
+          if (p_Visitor.testPrimitive(m_LeafBounds, i))
+            p_Visible[numVisible++] = m_Primitives[i];
+      }
+      else
+      {
+        assert(stackSize < MaxStackSize);
+        stack[stackSize++] = child;
+      }
+    }
+  }
+  return numVisible;
+}
+//---------------------------------------------------------------------------//
+uint32_t Bvh::cullFrustum(const Frustum& p_Frustum, uint32_t* p_Visible) const
+{
+  return cullPlanes(p_Frustum.planes, arrayCount32(p_Frustum.planes), p_Visible);
+}
+//---------------------------------------------------------------------------//
+uint32_t
+Bvh::cullPlanes(const glm::vec4* p_Planes, uint32_t p_NumPlanes, uint32_t* p_Visible) const
+{
+  return traverse(PlanesVisitor(p_Planes, p_NumPlanes), p_Visible);
+}
+//---------------------------------------------------------------------------//
+uint32_t Bvh::cullCone(
+    const glm::vec3& p_Apex,
+    const glm::vec3& p_Direction,
+    float p_Range,
+    float p_HalfAngle,
+    uint32_t* p_Visible) const
+{
+  assert(p_HalfAngle >= 0.0f && p_HalfAngle < glm::half_pi<float>());
+
+  ConeVisitor visitor;
+  visitor.apex = p_Apex;
+  visitor.direction = p_Direction;
+  visitor.range = p_Range;
+  visitor.cosAngle = std::cos(p_HalfAngle);
+  visitor.sinAngle = std::sin(p_HalfAngle);
+  return traverse(visitor, p_Visible);
+}
+//---------------------------------------------------------------------------//
+bool Bvh::raycast(
+    const glm::vec3& p_Origin,
+    const glm::vec3& p_Direction,
+    float p_MaxDistance,
+    uint32_t& p_Primitive,
+    float& p_Distance) const
+{
+  if (m_Nodes.empty())
+    return false;
+
+  const glm::vec3 invDirection = safeInverse(p_Direction);
+  const __m128 originX = _mm_set1_ps(p_Origin.x);
+  const __m128 originY = _mm_set1_ps(p_Origin.y);
+  const __m128 originZ = _mm_set1_ps(p_Origin.z);
+  const __m128 invX = _mm_set1_ps(invDirection.x);
+  const __m128 invY = _mm_set1_ps(invDirection.y);
+  const __m128 invZ = _mm_set1_ps(invDirection.z);
+
+  struct StackEntry
+  {
+    uint32_t node;
+    float distance;
+  };
+  StackEntry stack[MaxStackSize];
+  uint32_t stackSize = 0;
+  stack[stackSize++] = {0, 0.0f};
+
+  float nearest = p_MaxDistance;
+  bool hit = false;
+  while (stackSize > 0)
+  {
+    const StackEntry entry = stack[--stackSize];
+    if (entry.distance > nearest)
+      continue;
+
+    const BvhNode& node = m_Nodes[entry.node];
+    const __m128 t0X = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minX), originX), invX);
+    const __m128 t0Y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minY), originY), invY);
+    const __m128 t0Z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minZ), originZ), invZ);
+    const __m128 t1X = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxX), originX), invX);
+    const __m128 t1Y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxY), originY), invY);
+    const __m128 t1Z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxZ), originZ), invZ);
+    const __m128 enter = _mm_max_ps(
+        _mm_max_ps(_mm_min_ps(t0X, t1X), _mm_min_ps(t0Y, t1Y)),
+        _mm_max_ps(_mm_min_ps(t0Z, t1Z), _mm_setzero_ps()));
+    const __m128 exit = _mm_min_ps(
+        _mm_min_ps(_mm_max_ps(t0X, t1X), _mm_max_ps(t0Y, t1Y)),
+        _mm_min_ps(_mm_max_ps(t0Z, t1Z), _mm_set1_ps(nearest)));
+    const uint32_t hitMask = _mm_movemask_ps(_mm_cmple_ps(enter, exit)) & validSlots(node);
+
+    alignas(16) float enterDistances[4];
+    _mm_store_ps(enterDistances, enter);
+
+    // Leaves right away, inner children pushed farthest first so the nearest is visited next
+    StackEntry children[4];
+    uint32_t numChildren = 0;
+    for (uint32_t slot = 0; slot < 4; ++slot)
+    {
+      if ((hitMask & (1u << slot)) == 0)
+        continue;
+
+      const uint32_t child = node.child[slot];
+      if ((child & LeafFlag) != 0)
+      {
+        const uint32_t first = child & ~LeafFlag;
+        for (uint32_t i = first; i < first + node.count[slot]; ++i)
+        {
+          const glm::vec3 center = boxCenter(m_LeafBounds, i);
+          const glm::vec3 extent = boxExtent(m_LeafBounds, i);
+          float distance = 0.0f;
+          if (intersectRayBox(
+                  p_Origin, invDirection, center - extent, center + extent, nearest, distance) &&
+              (hit == false || distance < nearest))
+          {
+            nearest = distance;
+            p_Primitive = m_Primitives[i];
+            hit = true;
+          }
+        }
+      }
+      else
+      {
+        uint32_t insert = numChildren++;
+        for (; insert > 0 && children[insert - 1].distance < enterDistances[slot]; --insert)
+          children[insert] = children[insert - 1];
+        children[insert] = {child, enterDistances[slot]};
+      }
+    }
+
+    for (uint32_t i = 0; i < numChildren; ++i)
+    {
+      assert(stackSize < MaxStackSize);
+      stack[stackSize++] = children[i];
+    }
+  }
+
+  if (hit)
+    p_Distance = nearest;
+  return hit;
+}
+//---------------------------------------------------------------------------//
+// Validation and benchmark
+//---------------------------------------------------------------------------//
+// Random boxes like the frustum culling tests use, with every 16th box on one of 3 shared centers
+// so the builder sees coincident centroids too
+static void
+makeRandomBounds(Random& p_Rng, uint32_t p_Count, float p_WorldSize, CullingBounds& p_Bounds)
+{
+  std::vector<glm::vec3> aabbMins(p_Count);
+  std::vector<glm::vec3> aabbMaxs(p_Count);
+  for (uint32_t i = 0; i < p_Count; ++i)
+  {
+    const glm::vec3 center =
+        (i % 16 == 0) ? glm::vec3(float(i % 3) * 10.0f, 5.0f, -20.0f)
+                      : (glm::vec3(p_Rng.RandomFloat2(), p_Rng.RandomFloat()) - 0.5f) * p_WorldSize;
+    const float size = p_Rng.RandomFloat();
+    const glm::vec3 extent =
+        glm::vec3(p_Rng.RandomFloat2(), p_Rng.RandomFloat()) * (size * size * 10.0f);
+    aabbMins[i] = center - extent;
+    aabbMaxs[i] = center + extent;
+  }
+  p_Bounds.init(aabbMins.data(), aabbMaxs.data(), p_Count);
+}
+//---------------------------------------------------------------------------//
+static glm::vec3 randomPoint(Random& p_Rng, float p_Size)
+{
+  return (glm::vec3(p_Rng.RandomFloat2(), p_Rng.RandomFloat()) - 0.5f) * p_Size;
+}
+//---------------------------------------------------------------------------//
+static glm::vec3 randomDirection(Random& p_Rng)
+{
+  glm::vec3 direction;
+  do
+    direction = randomPoint(p_Rng, 2.0f);
+  while (glm::dot(direction, direction) < 1e-4f || glm::dot(direction, direction) > 1.0f);
+  return glm::normalize(direction);
+}
+//---------------------------------------------------------------------------//
+// Camera at a random point looking towards another, stored like the camera classes do it
+static glm::mat4 makeRandomViewProjection(Random& p_Rng, float p_WorldSize, bool p_Orthographic)
+{
+  const glm::vec3 eye = randomPoint(p_Rng, p_WorldSize * 0.5f);
+  const glm::vec3 target = randomPoint(p_Rng, p_WorldSize * 0.5f);
+  const glm::mat4 view = glm::lookAtLH(eye, target, glm::vec3(0.0f, 1.0f, 0.0f));
+
+  const glm::mat4 projection =
+      p_Orthographic
+          ? glm::orthoLH_ZO(-40.0f, 40.0f, -25.0f, 25.0f, 0.1f, 150.0f)
+          : glm::perspectiveFovLH_ZO(glm::radians(60.0f), 1920.0f, 1080.0f, 0.1f, 150.0f);
+  return glm::transpose(view) * glm::transpose(projection);
+}
+//---------------------------------------------------------------------------//
+// Sorts the BVH's result and compares it with the ascending reference
+static bool sameResult(
+    std::vector<uint32_t>& p_Result,
+    uint32_t p_Count,
+    const uint32_t* p_Reference,
+    uint32_t p_ReferenceCount)
+{
+  std::sort(p_Result.begin(), p_Result.begin() + p_Count);
+  return p_Count == p_ReferenceCount &&
+         std::equal(p_Result.begin(), p_Result.begin() + p_Count, p_Reference);
+}
+//---------------------------------------------------------------------------//
+// Every primitive in exactly one leaf, the ranges match the leaves, and every slot's box holds
+// what is below it
+static bool validateTree(const Bvh& p_Bvh, const CullingBounds& p_Bounds)
+{
+  const std::vector<BvhNode>& nodes = p_Bvh.nodes();
+  const std::vector<uint32_t>& primitives = p_Bvh.primitives();
+  std::vector<uint32_t> seen(p_Bounds.count(), 0);
+  for (uint32_t primitive : primitives)
+    ++seen[primitive];
+  bool valid = std::all_of(seen.begin(), seen.end(), [](uint32_t p_Seen) { return p_Seen == 1; });
+
+  uint32_t numLeafPrimitives = 0;
+  for (uint32_t nodeIdx = 0; nodeIdx < nodes.size(); ++nodeIdx)
+  {
+    const BvhNode& node = nodes[nodeIdx];
+    for (uint32_t slot = 0; slot < 4 && node.count[slot] > 0; ++slot)
+    {
+      const glm::vec3 slotMin = glm::vec3(node.minX[slot], node.minY[slot], node.minZ[slot]);
+      const glm::vec3 slotMax = glm::vec3(node.maxX[slot], node.maxY[slot], node.maxZ[slot]);
+      const uint32_t child = node.child[slot];
+      if ((child & Bvh::LeafFlag) != 0)
+      {
+        const uint32_t first = child & ~Bvh::LeafFlag;
+        valid = valid && node.count[slot] <= Bvh::MaxLeafSize;
+        numLeafPrimitives += node.count[slot];
+        for (uint32_t i = first; i < first + node.count[slot]; ++i)
+        {
+          const glm::vec3 center = boxCenter(p_Bounds, primitives[i]);
+          const glm::vec3 extent = boxExtent(p_Bounds, primitives[i]);
+          valid = valid && glm::all(glm::lessThanEqual(slotMin, center - extent)) &&
+                  glm::all(glm::greaterThanEqual(slotMax, center + extent));
+        }
+      }
+      else
+      {
+        const BvhNode& childNode = nodes[child];
+        uint32_t childCount = 0;
+        valid = valid && child > nodeIdx;
+        for (uint32_t c = 0; c < 4 && childNode.count[c] > 0; ++c)
+        {
+          childCount += childNode.count[c];
+          valid = valid && slotMin.x <= childNode.minX[c] && slotMin.y <= childNode.minY[c] &&
+                  slotMin.z <= childNode.minZ[c] && slotMax.x >= childNode.maxX[c] &&
+                  slotMax.y >= childNode.maxY[c] && slotMax.z >= childNode.maxZ[c];
+        }
+        valid = valid && childCount == node.count[slot];
+      }
+    }
+  }
+  return valid && numLeafPrimitives == p_Bounds.count();
+}
+//---------------------------------------------------------------------------//
+bool Bvh::validate(uint32_t p_NumBoxes)
+{
+  assert(p_NumBoxes > 0);
+
+  Random rng;
+  rng.SetSeed(2468);
+
+  const float worldSize = 200.0f;
+  CullingBounds bounds;
+  makeRandomBounds(rng, p_NumBoxes, worldSize, bounds);
+
+  // Serial and threaded builds are the same tree
+  Bvh bvh;
+  bvh.build(bounds, nullptr);
+  Bvh threaded;
+  threaded.build(bounds, &getWorkerPool());
+  bool sameBuild =
+      bvh.m_Primitives == threaded.m_Primitives && bvh.m_NodeFirst == threaded.m_NodeFirst &&
+      bvh.numNodes() == threaded.numNodes() &&
+      memcmp(bvh.m_Nodes.data(), threaded.m_Nodes.data(), bvh.numNodes() * sizeof(BvhNode)) == 0;
+  bool validTree = validateTree(bvh, bounds);
+
+  std::vector<uint32_t> reference(bounds.count());
+  std::vector<uint32_t> result(bounds.count());
+  bool validFrustum = true;
+  bool validCone = true;
+  bool validRay = true;
+  uint64_t numVisibleTotal = 0;
+  uint32_t numRayHits = 0;
+  for (uint32_t pass = 0; pass < 2; ++pass)
+  {
+    // Moves every box a bit and refits for the second pass
+    if (pass == 1)
+    {
+      for (uint32_t i = 0; i < bounds.count(); ++i)
+      {
+        const glm::vec3 offset = randomPoint(rng, 8.0f);
+        bounds.centerX[i] += offset.x;
+        bounds.centerY[i] += offset.y;
+        bounds.centerZ[i] += offset.z;
+        bounds.extentX[i] *= 0.5f + rng.RandomFloat();
+      }
+      bvh.refit(bounds);
+      validTree = validTree && validateTree(bvh, bounds);
+    }
+
+    for (uint32_t camera = 0; camera < 16; ++camera)
+    {
+      const glm::mat4 viewProjection = makeRandomViewProjection(rng, worldSize, (camera & 1) != 0);
+      const Frustum frustum = FrustumCulling::extractFrustum(viewProjection);
+
+      uint32_t numReference = FrustumCulling::cullScalar(bounds, frustum, reference.data());
+      uint32_t numResult = bvh.cullFrustum(frustum, result.data());
+      validFrustum = validFrustum && sameResult(result, numResult, reference.data(), numReference);
+      numVisibleTotal += numReference;
+
+      // The side planes only, like a shadow cascade that reaches back to every caster
+      numReference = 0;
+      for (uint32_t i = 0; i < bounds.count(); ++i)
+        if (testBoxPlanes(bounds, i, frustum.planes, 4))
+          reference[numReference++] = i;
+      numResult = bvh.cullPlanes(frustum.planes, 4, result.data());
+      validFrustum = validFrustum && sameResult(result, numResult, reference.data(), numReference);
+    }
+
+    for (uint32_t cone = 0; cone < 16; ++cone)
+    {
+      const glm::vec3 apex = randomPoint(rng, worldSize);
+      const glm::vec3 direction = randomDirection(rng);
+      const float range = 10.0f + rng.RandomFloat() * 60.0f;
+      const float halfAngle = glm::radians(5.0f + rng.RandomFloat() * 70.0f);
+      const uint32_t numResult = bvh.cullCone(apex, direction, range, halfAngle, result.data());
+      std::sort(result.begin(), result.begin() + numResult);
+
+      // Nothing the linear sphere test culls, and every box holding a point inside the cone
+      uint32_t numReference = 0;
+      for (uint32_t i = 0; i < bounds.count(); ++i)
+      {
+        if (testSphereCone(
+                boxCenter(bounds, i),
+                glm::length(boxExtent(bounds, i)),
+                apex,
+                direction,
+                range,
+                std::cos(halfAngle),
+                std::sin(halfAngle)))
+          reference[numReference++] = i;
+      }
+      validCone = validCone && std::includes(
+                                   reference.begin(),
+                                   reference.begin() + numReference,
+                                   result.begin(),
+                                   result.begin() + numResult);
+
+      for (uint32_t sample = 0; sample < 64; ++sample)
+      {
+        const glm::vec3 side = glm::normalize(glm::cross(direction, randomDirection(rng)));
+        const float angle = halfAngle * 0.95f * rng.RandomFloat();
+        const glm::vec3 point =
+            apex + (direction * std::cos(angle) + side * std::sin(angle)) * range * 0.95f *
+                       rng.RandomFloat();
+        for (uint32_t i = 0; i < bounds.count(); ++i)
+        {
+          const glm::vec3 offset = glm::abs(point - boxCenter(bounds, i));
+          if (glm::all(glm::lessThanEqual(offset, boxExtent(bounds, i))))
+          {
+            validCone = validCone &&
+                        std::binary_search(result.begin(), result.begin() + numResult, i);
+          }
+        }
+      }
+    }
+
+    for (uint32_t ray = 0; ray < 256; ++ray)
+    {
+      const glm::vec3 origin = randomPoint(rng, worldSize);
+      glm::vec3 direction = randomDirection(rng);
+      // Axis aligned rays too, for the clamped inverse directions
+      if (ray % 8 == 0)
+        direction = glm::vec3(0.0f, 0.0f, 1.0f);
+
+      const glm::vec3 invDirection = safeInverse(direction);
+      const float maxDistance = 100.0f;
+      float nearest = maxDistance;
+      bool referenceHit = false;
+      for (uint32_t i = 0; i < bounds.count(); ++i)
+      {
+        const glm::vec3 center = boxCenter(bounds, i);
+        const glm::vec3 extent = boxExtent(bounds, i);
+        float distance = 0.0f;
+        if (intersectRayBox(
+                origin, invDirection, center - extent, center + extent, maxDistance, distance) &&
+            distance <= nearest)
+        {
+          nearest = distance;
+          referenceHit = true;
+        }
+      }
+
+      uint32_t primitive = 0;
+      float distance = 0.0f;
+      const bool hit = bvh.raycast(origin, direction, maxDistance, primitive, distance);
+      validRay = validRay && hit == referenceHit && (hit == false || distance == nearest);
+      numRayHits += hit ? 1 : 0;
+    }
+  }
+
+  const bool valid = sameBuild && validTree && validFrustum && validCone && validRay;
+  writeLog(
+      "Bvh::validate: %u boxes, %u nodes, %.1f%% visible, %u/512 rays hit, build %s, tree %s, "
+      "frustum %s, cone %s, ray %s",
+      bounds.count(),
+      bvh.numNodes(),
+      100.0 * numVisibleTotal / (double(bounds.count()) * 32),
+      numRayHits,
+      sameBuild ? "ok" : "FAILED",
+      validTree ? "ok" : "FAILED",
+      validFrustum ? "ok" : "FAILED",
+      validCone ? "ok" : "FAILED",
+      validRay ? "ok" : "FAILED");
+
+  return valid;
+}
+//---------------------------------------------------------------------------//
+void Bvh::benchmark(uint32_t p_MaxBoxes)
+{
+  Random rng;
+  rng.SetSeed(97531);
+
+  Timer timer;
+  timer.init();
+
+  const uint32_t numQueries = 64;
+  const uint32_t counts[] = {10000, 100000, 1000000};
+  for (uint32_t count : counts)
+  {
+    if (count > p_MaxBoxes)
+      break;
+
+    // Same density at every size, the cameras see about as many boxes
+    const float worldSize = 200.0f * std::cbrt(count / 10000.0f);
+    CullingBounds bounds;
+    makeRandomBounds(rng, count, worldSize, bounds);
+    std::vector<uint32_t> visible(count);
+
+    Bvh bvh;
+    timer.update();
+    bvh.build(bounds, nullptr);
+    timer.update();
+    const double serialBuild = timer.m_DeltaMillisecondsD;
+
+    timer.update();
+    bvh.build(bounds, &getWorkerPool());
+    timer.update();
+    const double threadedBuild = timer.m_DeltaMillisecondsD;
+
+    for (uint32_t i = 0; i < count; ++i)
+      bounds.centerY[i] += rng.RandomFloat();
+    timer.update();
+    bvh.refit(bounds);
+    timer.update();
+    const double refit = timer.m_DeltaMillisecondsD;
+
+    Frustum frustums[numQueries];
+    for (Frustum& frustum : frustums)
+    {
+      frustum =
+          FrustumCulling::extractFrustum(makeRandomViewProjection(rng, worldSize * 0.5f, false));
+    }
+
+    uint64_t numVisible = 0;
+    timer.update();
+    for (const Frustum& frustum : frustums)
+      numVisible += FrustumCulling::cull(bounds, frustum, visible.data());
+    timer.update();
+    const double linearQuery = timer.m_DeltaMillisecondsD / numQueries;
+
+    timer.update();
+    for (const Frustum& frustum : frustums)
+      bvh.cullFrustum(frustum, visible.data());
+    timer.update();
+    const double frustumQuery = timer.m_DeltaMillisecondsD / numQueries;
+
+    uint64_t numInCones = 0;
+    timer.update();
+    for (uint32_t i = 0; i < numQueries; ++i)
+    {
+      numInCones += bvh.cullCone(
+          randomPoint(rng, worldSize),
+          randomDirection(rng),
+          30.0f,
+          glm::radians(30.0f),
+          visible.data());
+    }
+    timer.update();
+    const double coneQuery = timer.m_DeltaMillisecondsD / numQueries;
+
+    const uint32_t numRays = 16384;
+    uint32_t numHits = 0;
+    timer.update();
+    for (uint32_t i = 0; i < numRays; ++i)
+    {
+      uint32_t primitive = 0;
+      float distance = 0.0f;
+      numHits += bvh.raycast(
+          randomPoint(rng, worldSize), randomDirection(rng), 1000.0f, primitive, distance);
+    }
+    timer.update();
+    const double raysPerSecond = numRays / (timer.m_DeltaMillisecondsD / 1000.0);
+
+    writeLog(
+        "Bvh::benchmark: %u boxes, %u nodes, build %.2f ms (%.2f ms threaded), refit %.2f ms, "
+        "frustum %.3f ms vs linear %.3f ms (%u visible), cone %.3f ms (%u), %.2f Mrays/s "
+        "(%u%% hit)",
+        count,
+        bvh.numNodes(),
+        serialBuild,
+        threadedBuild,
+        refit,
+        frustumQuery,
+        linearQuery,
+        uint32_t(numVisible / numQueries),
+        coneQuery,
+        uint32_t(numInCones / numQueries),
+        raysPerSecond / 1e6,
+        100 * numHits / numRays);
+  }
+}
+//---------------------------------------------------------------------------//
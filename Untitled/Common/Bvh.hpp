@@ -0,0 +1,96 @@
+#pragma once
+
+#include "FrustumCulling.hpp"
+
+struct WorkerPool;
+
+//---------------------------------------------------------------------------//
+// Four children per node with their boxes in structure-of-arrays layout, so one SSE register
+// holds a box component of all four. Two cache lines per node.
+struct alignas(64) BvhNode
+{
+  float minX[4];
+  float minY[4];
+  float minZ[4];
+  float maxX[4];
+  float maxY[4];
+  float maxZ[4];
+  // Node index of an inner child, Bvh::LeafFlag | first primitive of a leaf
+  uint32_t child[4];
+  // Primitives below the child, 0 for an empty slot
+  uint32_t count[4];
+};
+static_assert(sizeof(BvhNode) == 128);
+//---------------------------------------------------------------------------//
+// Bounding volume hierarchy over the boxes of a CullingBounds (meshes or instances), for
+// frustum, convex volume, cone and ray queries that don't touch most of the boxes.
+//
+// build() is a binned SAH build of a binary tree, the top splits bin in parallel and the
+// subtrees below them are built in parallel, then the binary tree is collapsed into 4 wide nodes
+// stored depth first. The result doesn't depend on the thread count. refit() keeps the topology
+// and only recomputes the boxes, for boxes that moved but not too far.
+//
+// Every node's primitives are a contiguous range of primitives(), so a node fully inside a query
+// volume is added without looking at its boxes.
+//---------------------------------------------------------------------------//
+struct Bvh
+{
+  static constexpr uint32_t LeafFlag = 0x80000000u;
+  static constexpr uint32_t MaxLeafSize = 4;
+
+  // p_Pool null builds on the calling thread
+  void build(const CullingBounds& p_Bounds, WorkerPool* p_Pool);
+  // p_Bounds has the same boxes as in build(), moved
+  void refit(const CullingBounds& p_Bounds);
+
+  // Same boxes as FrustumCulling::cull(), in BVH order instead of ascending. p_Visible needs room
+  // for numPrimitives() indices.
+  uint32_t cullFrustum(const Frustum& p_Frustum, uint32_t* p_Visible) const;
+  // Boxes not fully outside one of the inward pointing planes, e.g. a shadow cascade's volume
+  uint32_t
+  cullPlanes(const glm::vec4* p_Planes, uint32_t p_NumPlanes, uint32_t* p_Visible) const;
+  // Boxes the cone may touch, tested with bounding spheres of the boxes and of the nodes so
+  // every box the cone touches is in there. p_Direction is normalized, p_HalfAngle in radians
+  // and below 90 degrees.
+  uint32_t cullCone(
+      const glm::vec3& p_Apex,
+      const glm::vec3& p_Direction,
+      float p_Range,
+      float p_HalfAngle,
+      uint32_t* p_Visible) const;
+  // Nearest box along the ray within p_MaxDistance, for picking. p_Distance is 0 when the ray
+  // starts inside the box.
+  bool raycast(
+      const glm::vec3& p_Origin,
+      const glm::vec3& p_Direction,
+      float p_MaxDistance,
+      uint32_t& p_Primitive,
+      float& p_Distance) const;
+
+  uint32_t numNodes() const { return uint32_t(m_Nodes.size()); }
+  uint32_t numPrimitives() const { return uint32_t(m_Primitives.size()); }
+  const std::vector<BvhNode>& nodes() const { return m_Nodes; }
+  // Indices into the built CullingBounds in leaf order
+  const std::vector<uint32_t>& primitives() const { return m_Primitives; }
+
+  // Headless checks on synthetic scenes: serial and threaded builds identical, every box in one
+  // leaf inside its parents, and the queries against linear scans before and after a refit.
+  // Results go to the debug output.
+  static bool validate(uint32_t p_NumBoxes = 20000);
+  // Headless timings of build, refit and the queries on 10k boxes up to p_MaxBoxes, next to the
+  // linear frustum culling
+  static void benchmark(uint32_t p_MaxBoxes = 1000000);
+
+private:
+  template <typename Visitor>
+  uint32_t traverse(const Visitor& p_Visitor, uint32_t* p_Visible) const;
+
+  void refitNodes();
+
+  std::vector<BvhNode> m_Nodes;
+  // First primitive below every node
+  std::vector<uint32_t> m_NodeFirst;
+  std::vector<uint32_t> m_Primitives;
+  // Boxes of the primitives in leaf order
+  CullingBounds m_LeafBounds;
+};
@@ -90,7 +90,7 @@ public:
   void SetLookAt(const glm::vec3& eye, const glm::vec3& lookAt, const glm::vec3& up)
   {
     view = glm::transpose(glm::lookAtLH(eye, lookAt, up));
-    world = glm::transpose(glm::inverse(view));
+    world = glm::inverse(view);
     position = eye;
     orientation = glm::quat(world);
 
@@ -0,0 +1,947 @@
+#include "ClusterBinning.hpp"
+#include "Camera.hpp"
+#include "Sampling.hpp"
+#include "Timer.hpp"
+#include "WorkerPool.hpp"
+
+#include <bit>
+
+//---------------------------------------------------------------------------//
+// Conservative rasterization may cover up to 1/256 of a pixel (a tile here) past the triangle and
+// the vertices snap to 1/256 of a pixel, the covered area is grown by both
+static const float TileEpsilon = 1.0f / 128.0f;
+
+// Lights projected per job, a few dozen lights aren't worth waking the pool
+static const uint32_t FootprintBatchSize = 64;
+
+// Point lights moved to view space per job, a lot cheaper than projecting a cone
+static const uint32_t ViewSphereBatchSize = 256;
+
+//---------------------------------------------------------------------------//
+// Projection
+//---------------------------------------------------------------------------//
+// Per job storage reused across the lights of a batch
+struct ConeScratch
+{
+  std::vector<glm::vec4> clipPositions;
+  std::vector<glm::vec2> points;
+  std::vector<glm::vec2> hull;
+};
+//---------------------------------------------------------------------------//
+static float cross2D(const glm::vec2& p_A, const glm::vec2& p_B, const glm::vec2& p_C)
+{
+  return (p_B.x - p_A.x) * (p_C.y - p_A.y) - (p_B.y - p_A.y) * (p_C.x - p_A.x);
+}
+//---------------------------------------------------------------------------//
+// Convex hull of p_Points with Andrew's monotone chain, p_Points gets sorted
+static void convexHull(std::vector<glm::vec2>& p_Points, std::vector<glm::vec2>& p_Hull)
+{
+  std::sort(p_Points.begin(), p_Points.end(), [](const glm::vec2& p_A, const glm::vec2& p_B) {
+    return p_A.x < p_B.x || (p_A.x == p_B.x && p_A.y < p_B.y);
+  });
+
+  const size_t numPoints = p_Points.size();
+  if (numPoints < 3)
+  {
+    p_Hull = p_Points;
+    return;
+  }
+
+  p_Hull.resize(2 * numPoints);
+  size_t numHull = 0;
+
+  // Lower then upper chain
+  for (size_t i = 0; i < numPoints; ++i)
+  {
+    while (numHull >= 2 && cross2D(p_Hull[numHull - 2], p_Hull[numHull - 1], p_Points[i]) <= 0.0f)
+      --numHull;
+    p_Hull[numHull++] = p_Points[i];
+  }
+  const size_t lowerSize = numHull + 1;
+  for (size_t i = numPoints - 1; i > 0; --i)
+  {
+    while (numHull >= lowerSize &&
+           cross2D(p_Hull[numHull - 2], p_Hull[numHull - 1], p_Points[i - 1]) <= 0.0f)
+      --numHull;
+    p_Hull[numHull++] = p_Points[i - 1];
+  }
+
+  // The last point is the first one again
+  p_Hull.resize(numHull - 1);
+}
+//---------------------------------------------------------------------------//
+// Outline of the light's bounding cone on the tile grid, in tiles with Y pointing down like the
+// viewport of the cluster passes. Returns false for cones behind the near plane.
+static bool projectCone(
+    const ClusterGrid& p_Grid,
+    const std::vector<glm::vec3>& p_ConeVertices,
+    const ClusterBounds& p_Bounds,
+    ConeScratch& p_Scratch)
+{
+  const glm::mat3 rotation = p_Bounds.Orientation.ToMat3(); // glm so mat * vec
+
+  bool anyBehind = false;
+  p_Scratch.clipPositions.clear();
+  for (const glm::vec3& vertex : p_ConeVertices)
+  {
+    const glm::vec3 coneVert = rotation * (vertex * p_Bounds.Scale) + p_Bounds.Position;
+    const glm::vec4 clipPos = glm::vec4(coneVert, 1.0f) * p_Grid.viewProjection;
+    p_Scratch.clipPositions.push_back(clipPos);
+    anyBehind = anyBehind || clipPos.z < 0.0f;
+  }
+
+  const glm::vec2 tileScale = glm::vec2(0.5f * p_Grid.numXTiles, -0.5f * p_Grid.numYTiles);
+  const glm::vec2 tileOffset = glm::vec2(0.5f * p_Grid.numXTiles, 0.5f * p_Grid.numYTiles);
+  auto addPoint = [&](const glm::vec4& p_ClipPos) {
+    p_Scratch.points.push_back(glm::vec2(p_ClipPos) / p_ClipPos.w * tileScale + tileOffset);
+  };
+
+  p_Scratch.points.clear();
+  const std::vector<glm::vec4>& clipPositions = p_Scratch.clipPositions;
+  for (const glm::vec4& clipPos : clipPositions)
+    if (clipPos.z >= 0.0f)
+      addPoint(clipPos);
+
+  // The near clipped cone is the hull of the vertices in front and of the points where the
+  // segments between every vertex in front and every vertex behind cross the near plane
+  if (anyBehind)
+  {
+    for (size_t i = 0; i < clipPositions.size(); ++i)
+    {
+      for (size_t j = i + 1; j < clipPositions.size(); ++j)
+      {
+        const glm::vec4& a = clipPositions[i];
+        const glm::vec4& b = clipPositions[j];
+        if ((a.z >= 0.0f) == (b.z >= 0.0f))
+          continue;
+
+        const float t = a.z / (a.z - b.z);
+        glm::vec4 crossing = a + (b - a) * t;
+        crossing.z = 0.0f;
+        addPoint(crossing);
+      }
+    }
+  }
+
+  if (p_Scratch.points.empty())
+    return false;
+
+  convexHull(p_Scratch.points, p_Scratch.hull);
+  return true;
+}
+//---------------------------------------------------------------------------//
+// X range of the convex polygon p_Hull between p_MinY and p_MaxY, false when it doesn't get there
+static bool hullRowRange(
+    const std::vector<glm::vec2>& p_Hull, float p_MinY, float p_MaxY, float& p_MinX, float& p_MaxX)
+{
+  p_MinX = FLT_MAX;
+  p_MaxX = -FLT_MAX;
+
+  // The polygon is convex, its widest part in the row is on the edges clipped to the row
+  const size_t numHull = p_Hull.size();
+  for (size_t i = 0; i < numHull; ++i)
+  {
+    const glm::vec2& a = p_Hull[i];
+    const glm::vec2& b = p_Hull[(i + 1) % numHull];
+
+    float t0 = 0.0f;
+    float t1 = 1.0f;
+    const float dy = b.y - a.y;
+    if (dy == 0.0f)
+    {
+      if (a.y < p_MinY || a.y > p_MaxY)
+        continue;
+    }
+    else
+    {
+      const float tMin = (p_MinY - a.y) / dy;
+      const float tMax = (p_MaxY - a.y) / dy;
+      t0 = std::max(t0, std::min(tMin, tMax));
+      t1 = std::min(t1, std::max(tMin, tMax));
+      if (t0 > t1)
+        continue;
+    }
+
+    const float x0 = a.x + (b.x - a.x) * t0;
+    const float x1 = a.x + (b.x - a.x) * t1;
+    p_MinX = std::min(p_MinX, std::min(x0, x1));
+    p_MaxX = std::max(p_MaxX, std::max(x0, x1));
+  }
+
+  return p_MinX <= p_MaxX;
+}
+//---------------------------------------------------------------------------//
+// ClusterBinner
+//---------------------------------------------------------------------------//
+ClusterGrid ClusterBinner::makeGrid(
+    const CameraBase& p_Camera,
+    uint32_t p_NumXTiles,
+    uint32_t p_NumYTiles,
+    uint32_t p_NumZTiles,
+    uint32_t p_ElementsPerCluster)
+{
+  ClusterGrid grid;
+  grid.view = p_Camera.ViewMatrix();
+  grid.projection = p_Camera.ProjectionMatrix();
+  grid.viewProjection = p_Camera.ViewProjectionMatrix();
+  grid.nearClip = p_Camera.NearClip();
+  grid.farClip = p_Camera.FarClip();
+  grid.numXTiles = p_NumXTiles;
+  grid.numYTiles = p_NumYTiles;
+  grid.numZTiles = p_NumZTiles;
+  grid.elementsPerCluster = p_ElementsPerCluster;
+  return grid;
+}
+//---------------------------------------------------------------------------//
+void ClusterBinner::prepare(const ClusterGrid& p_Grid, uint32_t p_NumLights)
+{
+  assert(p_Grid.numXTiles <= UINT16_MAX);
+  assert(p_NumLights <= p_Grid.elementsPerCluster * 32);
+
+  m_Footprints.resize(p_NumLights);
+  m_Spans.resize(uint64_t(p_NumLights) * p_Grid.numYTiles * 2);
+}
+//---------------------------------------------------------------------------//
+void ClusterBinner::computeFootprints(
+    const ClusterGrid& p_Grid,
+    const std::vector<glm::vec3>& p_ConeVertices,
+    const ClusterBounds* p_Bounds,
+    const uint8_t* p_IntersectsCamera,
+    uint32_t p_First,
+    uint32_t p_Count)
+{
+  const uint32_t numXTiles = p_Grid.numXTiles;
+  const uint32_t numYTiles = p_Grid.numYTiles;
+
+  ConeScratch scratch;
+  for (uint32_t i = p_First; i < p_First + p_Count; ++i)
+  {
+    Footprint& footprint = m_Footprints[i];
+    footprint = Footprint();
+
+    // Same Z range the cluster pixel shaders clamp to
+    const ClusterBounds& bounds = p_Bounds[i];
+    const uint32_t minZ = p_IntersectsCamera[i] ? 0 : bounds.ZBounds.x;
+    const uint32_t maxZ = std::min<uint32_t>(bounds.ZBounds.y, p_Grid.numZTiles - 1);
+    if (minZ > maxZ || projectCone(p_Grid, p_ConeVertices, bounds, scratch) == false)
+      continue;
+
+    float minY = FLT_MAX;
+    float maxY = -FLT_MAX;
+    for (const glm::vec2& point : scratch.hull)
+    {
+      minY = std::min(minY, point.y);
+      maxY = std::max(maxY, point.y);
+    }
+    if (maxY + TileEpsilon < 0.0f || minY - TileEpsilon >= float(numYTiles))
+      continue;
+
+    const uint32_t firstRow = uint32_t(std::max(minY - TileEpsilon, 0.0f));
+    const uint32_t lastRow = uint32_t(std::min(maxY + TileEpsilon, float(numYTiles - 1)));
+
+    uint16_t* spans = &m_Spans[uint64_t(i) * numYTiles * 2];
+    uint32_t firstCovered = UINT32_MAX;
+    uint32_t lastCovered = 0;
+    for (uint32_t y = firstRow; y <= lastRow; ++y)
+    {
+      spans[y * 2] = 1;
+      spans[y * 2 + 1] = 0;
+
+      float minX = 0.0f;
+      float maxX = 0.0f;
+      if (hullRowRange(scratch.hull, y - TileEpsilon, y + 1.0f + TileEpsilon, minX, maxX) ==
+              false ||
+          maxX + TileEpsilon < 0.0f || minX - TileEpsilon >= float(numXTiles))
+        continue;
+
+      spans[y * 2] = uint16_t(std::max(minX - TileEpsilon, 0.0f));
+      spans[y * 2 + 1] = uint16_t(std::min(maxX + TileEpsilon, float(numXTiles - 1)));
+      firstCovered = std::min(firstCovered, y);
+      lastCovered = y;
+    }
+    if (firstCovered > lastCovered)
+      continue;
+
+    footprint.minY = firstCovered;
+    footprint.maxY = lastCovered;
+    footprint.minZ = minZ;
+    footprint.maxZ = maxZ;
+  }
+}
+//---------------------------------------------------------------------------//
+void ClusterBinner::writeSlice(
+    const ClusterGrid& p_Grid, uint32_t p_Z, uint32_t p_NumLights, uint32_t* p_Mask) const
+{
+  const uint32_t numXTiles = p_Grid.numXTiles;
+  const uint32_t numYTiles = p_Grid.numYTiles;
+  const uint32_t elementsPerCluster = p_Grid.elementsPerCluster;
+
+  // Z is the outermost index, so a slice is one block of the mask
+  const uint64_t sliceSize = uint64_t(numXTiles) * numYTiles * elementsPerCluster;
+  uint32_t* slice = p_Mask + p_Z * sliceSize;
+  memset(slice, 0, sliceSize * sizeof(uint32_t));
+
+  for (uint32_t i = 0; i < p_NumLights; ++i)
+  {
+    const Footprint& footprint = m_Footprints[i];
+    if (p_Z < footprint.minZ || p_Z > footprint.maxZ)
+      continue;
+
+    const uint32_t elemIdx = i / 32;
+    const uint32_t mask = 1u << (i % 32);
+    const uint16_t* spans = &m_Spans[uint64_t(i) * numYTiles * 2];
+    for (uint32_t y = footprint.minY; y <= footprint.maxY; ++y)
+    {
+      uint32_t* row = slice + uint64_t(y) * numXTiles * elementsPerCluster + elemIdx;
+      for (uint32_t x = spans[y * 2]; x <= spans[y * 2 + 1]; ++x)
+        row[x * elementsPerCluster] |= mask;
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+void ClusterBinner::bin(
+    const ClusterGrid& p_Grid,
+    const std::vector<glm::vec3>& p_ConeVertices,
+    const ClusterBounds* p_Bounds,
+    const uint8_t* p_IntersectsCamera,
+    uint32_t p_NumLights,
+    uint32_t* p_Mask)
+{
+  prepare(p_Grid, p_NumLights);
+
+  WorkerPool& pool = getWorkerPool();
+  const uint32_t numBatches = (p_NumLights + FootprintBatchSize - 1) / FootprintBatchSize;
+  pool.parallelFor(numBatches, [&](uint32_t p_Batch) {
+    const uint32_t first = p_Batch * FootprintBatchSize;
+    computeFootprints(
+        p_Grid,
+        p_ConeVertices,
+        p_Bounds,
+        p_IntersectsCamera,
+        first,
+        std::min<uint32_t>(FootprintBatchSize, p_NumLights - first));
+  });
+
+  // Every job owns its slice, no atomics needed
+  pool.parallelFor(p_Grid.numZTiles, [&](uint32_t p_Z) {
+    writeSlice(p_Grid, p_Z, p_NumLights, p_Mask);
+  });
+}
+//---------------------------------------------------------------------------//
+void ClusterBinner::binSingleThreaded(
+    const ClusterGrid& p_Grid,
+    const std::vector<glm::vec3>& p_ConeVertices,
+    const ClusterBounds* p_Bounds,
+    const uint8_t* p_IntersectsCamera,
+    uint32_t p_NumLights,
+    uint32_t* p_Mask)
+{
+  prepare(p_Grid, p_NumLights);
+  computeFootprints(p_Grid, p_ConeVertices, p_Bounds, p_IntersectsCamera, 0, p_NumLights);
+  for (uint32_t z = 0; z < p_Grid.numZTiles; ++z)
+    writeSlice(p_Grid, z, p_NumLights, p_Mask);
+}
+//---------------------------------------------------------------------------//
+ClusterBinningStats ClusterBinner::compare(
+    const uint32_t* p_Reference, const uint32_t* p_Mask, uint64_t p_NumElements)
+{
+  ClusterBinningStats stats;
+  for (uint64_t i = 0; i < p_NumElements; ++i)
+  {
+    stats.NumReferenceBits += std::popcount(p_Reference[i]);
+    stats.NumMissing += std::popcount(p_Reference[i] & ~p_Mask[i]);
+    stats.NumExtra += std::popcount(p_Mask[i] & ~p_Reference[i]);
+  }
+  return stats;
+}
+//---------------------------------------------------------------------------//
+// Validation and benchmark
+//---------------------------------------------------------------------------//
+// Lights in a 40 unit box around the origin, most of them on screen for the cameras below
+static void makeRandomLights(Random& p_Rng, uint32_t p_Count, SpotLightBounds& p_Lights)
+{
+  p_Lights.resize(p_Count);
+  for (uint32_t i = 0; i < p_Count; ++i)
+  {
+    const glm::vec3 position =
+        (glm::vec3(p_Rng.RandomFloat2(), p_Rng.RandomFloat()) - 0.5f) * 40.0f;
+    const glm::quat rotation = glm::normalize(glm::quat(
+        p_Rng.RandomFloat() - 0.5f,
+        p_Rng.RandomFloat() - 0.5f,
+        p_Rng.RandomFloat() - 0.5f,
+        p_Rng.RandomFloat() - 0.5f));
+    Quaternion orientation;
+    orientation = rotation;
+
+    // The cone mesh opens along +Z
+    const glm::vec3 direction = rotation * glm::vec3(0.0f, 0.0f, 1.0f);
+    const float angle = 0.3f + p_Rng.RandomFloat() * 1.2f;
+    const float range = 1.0f + p_Rng.RandomFloat() * 7.0f;
+    p_Lights.set(i, position, direction, orientation, angle, range, 1.0f);
+  }
+}
+//---------------------------------------------------------------------------//
+// 1080p camera somewhere among the lights
+static void makeRandomCamera(Random& p_Rng, PerspectiveCamera& p_Camera)
+{
+  const glm::vec3 eye = (glm::vec3(p_Rng.RandomFloat2(), p_Rng.RandomFloat()) - 0.5f) * 40.0f;
+  const glm::vec3 target = (glm::vec3(p_Rng.RandomFloat2(), p_Rng.RandomFloat()) - 0.5f) * 40.0f;
+
+  p_Camera.Initialize(16.0f / 9.0f, glm::quarter_pi<float>(), 0.1f, 100.0f, 1920.0f);
+  p_Camera.SetLookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f));
+}
+//---------------------------------------------------------------------------//
+// Within p_Epsilon of a tile boundary, where rounding may pick either tile
+static bool isNearTileBoundary(float p_Tile, float p_Epsilon)
+{
+  return std::abs(p_Tile - std::round(p_Tile)) < p_Epsilon;
+}
+//---------------------------------------------------------------------------//
+bool ClusterBinner::validate(uint32_t p_NumLights)
+{
+  assert(p_NumLights > 0);
+
+  Random rng;
+  rng.SetSeed(9753);
+
+  const uint32_t numSides = 16;
+  const std::vector<glm::vec3> coneVertices = LightBounds::makeConeVertices(numSides);
+
+  SpotLightBounds lights;
+  makeRandomLights(rng, p_NumLights, lights);
+
+  // 16 pixel tiles at 1080p
+  const uint32_t numXTiles = 120;
+  const uint32_t numYTiles = 68;
+  const uint32_t numZTiles = 16;
+  const uint32_t elementsPerCluster = (p_NumLights + 31) / 32;
+
+  std::vector<ClusterBounds> bounds(p_NumLights);
+  std::vector<uint8_t> intersects(p_NumLights);
+  std::vector<uint32_t> mask;
+  std::vector<uint32_t> singleThreadedMask;
+
+  const float epsilon = 1e-3f;
+  const uint32_t numSamplesPerLight = 64;
+  bool valid = true;
+  uint32_t numViews = 0;
+  uint64_t numSamples = 0;
+  uint64_t numMissed = 0;
+  uint64_t numMarked = 0;
+  ClusterBinner binner;
+  for (uint32_t v = 0; v < 8; ++v, ++numViews)
+  {
+    PerspectiveCamera camera;
+    makeRandomCamera(rng, camera);
+
+    LightBounds::compute(
+        lights,
+        LightBounds::makeView(camera, numZTiles),
+        coneVertices,
+        p_NumLights,
+        bounds.data(),
+        intersects.data());
+
+    const ClusterGrid grid =
+        makeGrid(camera, numXTiles, numYTiles, numZTiles, elementsPerCluster);
+    mask.assign(grid.numElements(), 0xFFFFFFFF);
+    singleThreadedMask.assign(grid.numElements(), 0);
+    binner.bin(grid, coneVertices, bounds.data(), intersects.data(), p_NumLights, mask.data());
+    binner.binSingleThreaded(
+        grid,
+        coneVertices,
+        bounds.data(),
+        intersects.data(),
+        p_NumLights,
+        singleThreadedMask.data());
+
+    // Same footprints, the slices only split differently
+    valid = valid && mask == singleThreadedMask;
+    numMarked += compare(mask.data(), mask.data(), mask.size()).NumReferenceBits;
+
+    // Points in the tetrahedra of the tip, the base center and two neighbouring ring vertices
+    // the cone is made of, every other one on the side of the cone
+    for (uint32_t i = 0; i < p_NumLights; ++i)
+    {
+      const ClusterBounds& light = bounds[i];
+      const glm::mat3 rotation = light.Orientation.ToMat3();
+      for (uint32_t s = 0; s < numSamplesPerLight; ++s)
+      {
+        const uint32_t side = rng.RandomUint() % numSides;
+        glm::vec4 weights = glm::vec4(rng.RandomFloat2(), rng.RandomFloat2());
+        if (s & 1)
+          weights.y = 0.0f;
+        weights /= weights.x + weights.y + weights.z + weights.w;
+
+        const glm::vec3 vertex = weights.x * coneVertices[0] + weights.y * coneVertices[1] +
+                                 weights.z * coneVertices[2 + side] +
+                                 weights.w * coneVertices[2 + (side + 1) % numSides];
+        const glm::vec3 position = rotation * (vertex * light.Scale) + light.Position;
+        const glm::vec4 clipPos = glm::vec4(position, 1.0f) * grid.viewProjection;
+        if (clipPos.z < 0.0f || clipPos.z > clipPos.w || std::abs(clipPos.x) > clipPos.w ||
+            std::abs(clipPos.y) > clipPos.w)
+          continue;
+
+        // W is the view space depth
+        const float tileX = (clipPos.x / clipPos.w * 0.5f + 0.5f) * numXTiles;
+        const float tileY = (0.5f - clipPos.y / clipPos.w * 0.5f) * numYTiles;
+        const float tileZ =
+            saturate((clipPos.w - grid.nearClip) / (grid.farClip - grid.nearClip)) * numZTiles;
+        if (isNearTileBoundary(tileX, epsilon) || isNearTileBoundary(tileY, epsilon) ||
+            isNearTileBoundary(tileZ, epsilon))
+          continue;
+
+        const uint32_t x = std::min<uint32_t>(uint32_t(tileX), numXTiles - 1);
+        const uint32_t y = std::min<uint32_t>(uint32_t(tileY), numYTiles - 1);
+        const uint32_t z = std::min<uint32_t>(uint32_t(tileZ), numZTiles - 1);
+        const uint64_t clusterIndex = (uint64_t(z) * numYTiles + y) * numXTiles + x;
+        ++numSamples;
+        if ((mask[clusterIndex * elementsPerCluster + i / 32] & (1u << (i % 32))) == 0)
+          ++numMissed;
+      }
+    }
+  }
+  valid = valid && numMissed == 0 && numSamples > 0;
+
+  writeLog(
+      "ClusterBinner::validate: %u lights, %u views, %llu samples on screen, %llu outside the "
+      "mask, %.1f clusters marked per light, %s",
+      p_NumLights,
+      numViews,
+      numSamples,
+      numMissed,
+      double(numMarked) / (double(p_NumLights) * numViews),
+      valid ? "passed" : "FAILED");
+
+  return valid;
+}
+//---------------------------------------------------------------------------//
+void ClusterBinner::benchmark(uint32_t p_NumIterations)
+{
+  assert(p_NumIterations > 0);
+
+  Random rng;
+  rng.SetSeed(8642);
+
+  const std::vector<glm::vec3> coneVertices = LightBounds::makeConeVertices(16);
+  PerspectiveCamera camera;
+  makeRandomCamera(rng, camera);
+  const LightBoundsView view = LightBounds::makeView(camera, 16);
+
+  Timer timer;
+  timer.init();
+
+  // The mask grows with the lights, 1k lights are 16MB at 1080p
+  ClusterBinner binner;
+  const uint32_t counts[] = {32, 256, 1024};
+  for (uint32_t count : counts)
+  {
+    SpotLightBounds lights;
+    makeRandomLights(rng, count, lights);
+    std::vector<ClusterBounds> bounds(count);
+    std::vector<uint8_t> intersects(count);
+    LightBounds::compute(lights, view, coneVertices, count, bounds.data(), intersects.data());
+
+    const ClusterGrid grid = makeGrid(camera, 120, 68, 16, (count + 31) / 32);
+    std::vector<uint32_t> mask(grid.numElements());
+
+    double milliseconds[2] = {};
+    for (uint32_t path = 0; path < 2; ++path)
+    {
+      timer.update();
+      for (uint32_t iteration = 0; iteration < p_NumIterations; ++iteration)
+      {
+        if (path == 0)
+          binner.binSingleThreaded(
+              grid, coneVertices, bounds.data(), intersects.data(), count, mask.data());
+        else
+          binner.bin(grid, coneVertices, bounds.data(), intersects.data(), count, mask.data());
+      }
+      timer.update();
+      milliseconds[path] = timer.m_DeltaMillisecondsD / p_NumIterations;
+    }
+
+    writeLog(
+        "ClusterBinner::benchmark: %u lights, single thread %.4f ms, %u threads %.4f ms (%.1fx)",
+        count,
+        milliseconds[0],
+        getWorkerPool().numThreads(),
+        milliseconds[1],
+        milliseconds[0] / milliseconds[1]);
+  }
+}
+//---------------------------------------------------------------------------//
+// Point lights
+//---------------------------------------------------------------------------//
+// View space box of the froxel between the tile boundaries p_X and p_X + 1, p_Y and p_Y + 1 (Y
+// counted from the bottom) and the slice depths p_Z0 and p_Z1. It's the box of the truncated
+// pyramid, its corners are on the far or near face depending on the side of the view axis.
+static void froxelBox(
+    const std::vector<float>& p_XSlopes,
+    const std::vector<float>& p_YSlopes,
+    uint32_t p_X,
+    uint32_t p_Y,
+    float p_Z0,
+    float p_Z1,
+    glm::vec3& p_Min,
+    glm::vec3& p_Max)
+{
+  const float x0 = p_XSlopes[p_X];
+  const float x1 = p_XSlopes[p_X + 1];
+  const float y0 = p_YSlopes[p_Y];
+  const float y1 = p_YSlopes[p_Y + 1];
+  p_Min = glm::vec3(std::min(x0 * p_Z0, x0 * p_Z1), std::min(y0 * p_Z0, y0 * p_Z1), p_Z0);
+  p_Max = glm::vec3(std::max(x1 * p_Z0, x1 * p_Z1), std::max(y1 * p_Z0, y1 * p_Z1), p_Z1);
+}
+//---------------------------------------------------------------------------//
+static bool sphereTouchesBox(
+    const glm::vec3& p_Center, float p_Radius, const glm::vec3& p_Min, const glm::vec3& p_Max)
+{
+  const glm::vec3 offset = p_Center - glm::clamp(p_Center, p_Min, p_Max);
+  return glm::dot(offset, offset) <= p_Radius * p_Radius;
+}
+//---------------------------------------------------------------------------//
+// Tiles [p_First, p_Last] of an axis whose froxel bounds between the depths p_Z0 and p_Z1 get
+// within p_Reach of p_Center, false when none do. Both bounds of a tile grow with its boundary
+// slopes, so the range is found with two binary searches.
+static bool candidateTiles(
+    const std::vector<float>& p_Slopes,
+    float p_Z0,
+    float p_Z1,
+    float p_Center,
+    float p_Reach,
+    uint32_t& p_First,
+    uint32_t& p_Last)
+{
+  const float lower = p_Center - p_Reach;
+  const float upper = p_Center + p_Reach;
+
+  // The upper bound of tile i comes from slope i + 1, the lower one from slope i
+  const auto firstUpper = std::partition_point(
+      p_Slopes.begin() + 1, p_Slopes.end(), [&](float p_Slope) {
+        return std::max(p_Slope * p_Z0, p_Slope * p_Z1) < lower;
+      });
+  const auto lastLower =
+      std::partition_point(p_Slopes.begin(), p_Slopes.end() - 1, [&](float p_Slope) {
+        return std::min(p_Slope * p_Z0, p_Slope * p_Z1) <= upper;
+      });
+
+  p_First = uint32_t(firstUpper - (p_Slopes.begin() + 1));
+  const uint32_t numBelowUpper = uint32_t(lastLower - p_Slopes.begin());
+  if (numBelowUpper == 0 || p_First >= numBelowUpper)
+    return false;
+
+  p_Last = numBelowUpper - 1;
+  return true;
+}
+//---------------------------------------------------------------------------//
+// PointLightBinner
+//---------------------------------------------------------------------------//
+void PointLightBinner::prepare(const ClusterGrid& p_Grid, uint32_t p_NumLights)
+{
+  assert(p_NumLights <= p_Grid.elementsPerCluster * 32);
+  assert(p_Grid.nearClip > 0.0f);
+
+  // Tile boundaries on the far plane, the visualizer gets its view bounds the same way
+  const glm::mat4 invProjection = glm::inverse(p_Grid.projection);
+  m_XSlopes.resize(p_Grid.numXTiles + 1);
+  for (uint32_t i = 0; i <= p_Grid.numXTiles; ++i)
+  {
+    const float ndc = -1.0f + 2.0f * i / p_Grid.numXTiles;
+    const glm::vec3 farPos = _transformVec3Mat4(glm::vec3(ndc, 0.0f, 1.0f), invProjection);
+    m_XSlopes[i] = farPos.x / farPos.z;
+  }
+  m_YSlopes.resize(p_Grid.numYTiles + 1);
+  for (uint32_t i = 0; i <= p_Grid.numYTiles; ++i)
+  {
+    const float ndc = -1.0f + 2.0f * i / p_Grid.numYTiles;
+    const glm::vec3 farPos = _transformVec3Mat4(glm::vec3(0.0f, ndc, 1.0f), invProjection);
+    m_YSlopes[i] = farPos.y / farPos.z;
+  }
+
+  // Linear slices like the shading passes
+  m_SliceDepths.resize(p_Grid.numZTiles + 1);
+  const float clipRange = p_Grid.farClip - p_Grid.nearClip;
+  for (uint32_t i = 0; i <= p_Grid.numZTiles; ++i)
+    m_SliceDepths[i] = p_Grid.nearClip + clipRange * i / p_Grid.numZTiles;
+
+  m_Spheres.resize(p_NumLights);
+}
+//---------------------------------------------------------------------------//
+void PointLightBinner::computeViewSpheres(
+    const ClusterGrid& p_Grid, const glm::vec4* p_Spheres, uint32_t p_First, uint32_t p_Count)
+{
+  for (uint32_t i = p_First; i < p_First + p_Count; ++i)
+  {
+    ViewSphere& sphere = m_Spheres[i];
+    sphere.center = glm::vec3(glm::vec4(glm::vec3(p_Spheres[i]), 1.0f) * p_Grid.view);
+    sphere.radius = p_Spheres[i].w;
+    sphere.reach = sphere.radius * 1.001f + 1e-4f;
+
+    // The slice depths are a slope of one at every depth
+    if (candidateTiles(
+            m_SliceDepths, 1.0f, 1.0f, sphere.center.z, sphere.reach, sphere.minZ, sphere.maxZ) ==
+        false)
+    {
+      sphere.minZ = 1;
+      sphere.maxZ = 0;
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+void PointLightBinner::writeSlice(
+    const ClusterGrid& p_Grid, uint32_t p_Z, uint32_t p_NumLights, uint32_t* p_Mask) const
+{
+  const uint32_t numXTiles = p_Grid.numXTiles;
+  const uint32_t numYTiles = p_Grid.numYTiles;
+  const uint32_t elementsPerCluster = p_Grid.elementsPerCluster;
+
+  const uint64_t sliceSize = uint64_t(numXTiles) * numYTiles * elementsPerCluster;
+  uint32_t* slice = p_Mask + p_Z * sliceSize;
+  memset(slice, 0, sliceSize * sizeof(uint32_t));
+
+  const float z0 = m_SliceDepths[p_Z];
+  const float z1 = m_SliceDepths[p_Z + 1];
+  for (uint32_t i = 0; i < p_NumLights; ++i)
+  {
+    const ViewSphere& sphere = m_Spheres[i];
+    if (p_Z < sphere.minZ || p_Z > sphere.maxZ)
+      continue;
+
+    uint32_t minX = 0;
+    uint32_t maxX = 0;
+    uint32_t minY = 0;
+    uint32_t maxY = 0;
+    if (candidateTiles(m_XSlopes, z0, z1, sphere.center.x, sphere.reach, minX, maxX) == false ||
+        candidateTiles(m_YSlopes, z0, z1, sphere.center.y, sphere.reach, minY, maxY) == false)
+      continue;
+
+    const uint32_t elemIdx = i / 32;
+    const uint32_t mask = 1u << (i % 32);
+    for (uint32_t y = minY; y <= maxY; ++y)
+    {
+      // Rows of the mask go down from the top of the screen
+      uint32_t* row =
+          slice + uint64_t(numYTiles - 1 - y) * numXTiles * elementsPerCluster + elemIdx;
+      for (uint32_t x = minX; x <= maxX; ++x)
+      {
+        glm::vec3 boxMin;
+        glm::vec3 boxMax;
+        froxelBox(m_XSlopes, m_YSlopes, x, y, z0, z1, boxMin, boxMax);
+        if (sphereTouchesBox(sphere.center, sphere.radius, boxMin, boxMax))
+          row[x * elementsPerCluster] |= mask;
+      }
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+void PointLightBinner::bin(
+    const ClusterGrid& p_Grid, const glm::vec4* p_Spheres, uint32_t p_NumLights, uint32_t* p_Mask)
+{
+  prepare(p_Grid, p_NumLights);
+
+  WorkerPool& pool = getWorkerPool();
+  const uint32_t numBatches = (p_NumLights + ViewSphereBatchSize - 1) / ViewSphereBatchSize;
+  pool.parallelFor(numBatches, [&](uint32_t p_Batch) {
+    const uint32_t first = p_Batch * ViewSphereBatchSize;
+    computeViewSpheres(
+        p_Grid, p_Spheres, first, std::min<uint32_t>(ViewSphereBatchSize, p_NumLights - first));
+  });
+
+  // Every job owns its slice, no atomics needed
+  pool.parallelFor(p_Grid.numZTiles, [&](uint32_t p_Z) {
+    writeSlice(p_Grid, p_Z, p_NumLights, p_Mask);
+  });
+}
+//---------------------------------------------------------------------------//
+void PointLightBinner::binBruteForce(
+    const ClusterGrid& p_Grid, const glm::vec4* p_Spheres, uint32_t p_NumLights, uint32_t* p_Mask)
+{
+  prepare(p_Grid, p_NumLights);
+  memset(p_Mask, 0, p_Grid.numElements() * sizeof(uint32_t));
+
+  std::vector<glm::vec3> centers(p_NumLights);
+  for (uint32_t i = 0; i < p_NumLights; ++i)
+    centers[i] = glm::vec3(glm::vec4(glm::vec3(p_Spheres[i]), 1.0f) * p_Grid.view);
+
+  const uint32_t numXTiles = p_Grid.numXTiles;
+  const uint32_t numYTiles = p_Grid.numYTiles;
+  for (uint32_t z = 0; z < p_Grid.numZTiles; ++z)
+  {
+    for (uint32_t y = 0; y < numYTiles; ++y)
+    {
+      for (uint32_t x = 0; x < numXTiles; ++x)
+      {
+        glm::vec3 boxMin;
+        glm::vec3 boxMax;
+        froxelBox(
+            m_XSlopes, m_YSlopes, x, y, m_SliceDepths[z], m_SliceDepths[z + 1], boxMin, boxMax);
+
+        // Y counts from the bottom here
+        const uint64_t clusterIndex =
+            (uint64_t(z) * numYTiles + (numYTiles - 1 - y)) * numXTiles + x;
+        uint32_t* cluster = p_Mask + clusterIndex * p_Grid.elementsPerCluster;
+        for (uint32_t i = 0; i < p_NumLights; ++i)
+          if (sphereTouchesBox(centers[i], p_Spheres[i].w, boxMin, boxMax))
+            cluster[i / 32] |= 1u << (i % 32);
+      }
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// Point lights in the same box as the spot lights, up to AppSettings::PointLightRange
+static void makeRandomSpheres(Random& p_Rng, uint32_t p_Count, std::vector<glm::vec4>& p_Spheres)
+{
+  p_Spheres.resize(p_Count);
+  for (uint32_t i = 0; i < p_Count; ++i)
+  {
+    const glm::vec3 position =
+        (glm::vec3(p_Rng.RandomFloat2(), p_Rng.RandomFloat()) - 0.5f) * 40.0f;
+    p_Spheres[i] = glm::vec4(position, 0.5f + p_Rng.RandomFloat() * 4.5f);
+  }
+}
+//---------------------------------------------------------------------------//
+bool PointLightBinner::validate(uint32_t p_NumLights)
+{
+  assert(p_NumLights > 0);
+
+  Random rng;
+  rng.SetSeed(4242);
+
+  std::vector<glm::vec4> spheres;
+  makeRandomSpheres(rng, p_NumLights, spheres);
+
+  // 16 pixel tiles at 720p, the brute force path tests every light in every froxel
+  const uint32_t numXTiles = 80;
+  const uint32_t numYTiles = 45;
+  const uint32_t numZTiles = 16;
+  const uint32_t elementsPerCluster = (p_NumLights + 31) / 32;
+
+  std::vector<uint32_t> mask;
+  std::vector<uint32_t> reference;
+
+  const float epsilon = 1e-3f;
+  const uint32_t numSamplesPerLight = 16;
+  bool valid = true;
+  uint32_t numViews = 0;
+  uint64_t numSamples = 0;
+  uint64_t numMissed = 0;
+  ClusterBinningStats stats;
+  PointLightBinner binner;
+  for (uint32_t v = 0; v < 2; ++v, ++numViews)
+  {
+    PerspectiveCamera camera;
+    makeRandomCamera(rng, camera);
+
+    const ClusterGrid grid =
+        ClusterBinner::makeGrid(camera, numXTiles, numYTiles, numZTiles, elementsPerCluster);
+    mask.assign(grid.numElements(), 0xFFFFFFFF);
+    reference.assign(grid.numElements(), 0xFFFFFFFF);
+    binner.bin(grid, spheres.data(), p_NumLights, mask.data());
+    binner.binBruteForce(grid, spheres.data(), p_NumLights, reference.data());
+
+    const ClusterBinningStats viewStats =
+        ClusterBinner::compare(reference.data(), mask.data(), mask.size());
+    stats.NumReferenceBits += viewStats.NumReferenceBits;
+    stats.NumMissing += viewStats.NumMissing;
+    stats.NumExtra += viewStats.NumExtra;
+
+    // Points inside the spheres land in marked clusters, in case both paths share a mistake
+    for (uint32_t i = 0; i < p_NumLights; ++i)
+    {
+      for (uint32_t s = 0; s < numSamplesPerLight; ++s)
+      {
+        glm::vec3 offset;
+        do
+          offset = (glm::vec3(rng.RandomFloat2(), rng.RandomFloat()) - 0.5f) * 2.0f;
+        while (glm::dot(offset, offset) > 1.0f);
+
+        const glm::vec3 position = glm::vec3(spheres[i]) + offset * spheres[i].w;
+        const glm::vec4 clipPos = glm::vec4(position, 1.0f) * grid.viewProjection;
+        if (clipPos.z < 0.0f || clipPos.z > clipPos.w || std::abs(clipPos.x) > clipPos.w ||
+            std::abs(clipPos.y) > clipPos.w)
+          continue;
+
+        const float tileX = (clipPos.x / clipPos.w * 0.5f + 0.5f) * numXTiles;
+        const float tileY = (0.5f - clipPos.y / clipPos.w * 0.5f) * numYTiles;
+        const float tileZ =
+            saturate((clipPos.w - grid.nearClip) / (grid.farClip - grid.nearClip)) * numZTiles;
+        if (isNearTileBoundary(tileX, epsilon) || isNearTileBoundary(tileY, epsilon) ||
+            isNearTileBoundary(tileZ, epsilon))
+          continue;
+
+        const uint32_t x = std::min<uint32_t>(uint32_t(tileX), numXTiles - 1);
+        const uint32_t y = std::min<uint32_t>(uint32_t(tileY), numYTiles - 1);
+        const uint32_t z = std::min<uint32_t>(uint32_t(tileZ), numZTiles - 1);
+        const uint64_t clusterIndex = (uint64_t(z) * numYTiles + y) * numXTiles + x;
+        ++numSamples;
+        if ((mask[clusterIndex * elementsPerCluster + i / 32] & (1u << (i % 32))) == 0)
+          ++numMissed;
+      }
+    }
+  }
+  valid = stats.NumMissing == 0 && stats.NumExtra == 0 && numMissed == 0 && numSamples > 0;
+
+  writeLog(
+      "PointLightBinner::validate: %u lights, %u views, %llu bits in the brute force masks, "
+      "%llu missing, %llu extra, %llu samples on screen, %llu outside the mask, %s",
+      p_NumLights,
+      numViews,
+      stats.NumReferenceBits,
+      stats.NumMissing,
+      stats.NumExtra,
+      numSamples,
+      numMissed,
+      valid ? "passed" : "FAILED");
+
+  return valid;
+}
+//---------------------------------------------------------------------------//
+void PointLightBinner::benchmark(uint32_t p_NumIterations)
+{
+  assert(p_NumIterations > 0);
+
+  Random rng;
+  rng.SetSeed(1357);
+
+  PerspectiveCamera camera;
+  makeRandomCamera(rng, camera);
+
+  Timer timer;
+  timer.init();
+
+  PointLightBinner binner;
+  const uint32_t counts[] = {256, 1024, 4096};
+  for (uint32_t count : counts)
+  {
+    std::vector<glm::vec4> spheres;
+    makeRandomSpheres(rng, count, spheres);
+
+    const ClusterGrid grid = ClusterBinner::makeGrid(camera, 120, 68, 16, (count + 31) / 32);
+    std::vector<uint32_t> mask(grid.numElements());
+
+    double milliseconds[2] = {};
+    for (uint32_t path = 0; path < 2; ++path)
+    {
+      timer.update();
+      for (uint32_t iteration = 0; iteration < p_NumIterations; ++iteration)
+      {
+        if (path == 0)
+          binner.binBruteForce(grid, spheres.data(), count, mask.data());
+        else
+          binner.bin(grid, spheres.data(), count, mask.data());
+      }
+      timer.update();
+      milliseconds[path] = timer.m_DeltaMillisecondsD / p_NumIterations;
+    }
+
+    writeLog(
+        "PointLightBinner::benchmark: %u lights, brute force %.4f ms, %u threads %.4f ms (%.1fx)",
+        count,
+        milliseconds[0],
+        getWorkerPool().numThreads(),
+        milliseconds[1],
+        milliseconds[0] / milliseconds[1]);
+  }
+}
+//---------------------------------------------------------------------------//
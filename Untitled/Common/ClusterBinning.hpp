@@ -0,0 +1,159 @@
+#pragma once
+
+#include "LightBounds.hpp"
+
+//---------------------------------------------------------------------------//
+// Cluster grid a light mask is laid out for, indexed like Clusters.hlsl:
+// ((z * NumXYTiles) + (y * NumXTiles) + x) * ElementsPerCluster + light / 32
+struct ClusterGrid
+{
+  // CameraBase matrices, stored transposed
+  glm::mat4 view;
+  glm::mat4 projection;
+  glm::mat4 viewProjection;
+  float nearClip = 0.0f;
+  float farClip = 0.0f;
+  uint32_t numXTiles = 0;
+  uint32_t numYTiles = 0;
+  uint32_t numZTiles = 0;
+  uint32_t elementsPerCluster = 0;
+
+  uint64_t numElements() const
+  {
+    return uint64_t(numXTiles) * numYTiles * numZTiles * elementsPerCluster;
+  }
+};
+//---------------------------------------------------------------------------//
+// Bits of a mask compared against a reference one
+struct ClusterBinningStats
+{
+  uint64_t NumReferenceBits = 0;
+  // Set in the reference only, none for a conservative mask
+  uint64_t NumMissing = 0;
+  // Set in the mask only
+  uint64_t NumExtra = 0;
+};
+//---------------------------------------------------------------------------//
+// CPU version of the cluster passes in Clusters.hlsl. A light marks every XY tile its projected
+// bounding cone overlaps, from ClusterBounds::ZBounds.x (or the first Z tile for lights
+// intersecting the camera) to ZBounds.y. The GPU rasterizes the same cone with conservative
+// rasterization and marks a subset of that Z range, so the mask is a superset of the GPU's one.
+//---------------------------------------------------------------------------//
+struct ClusterBinner
+{
+  // Fill p_Mask (p_Grid.numElements() words) for the first p_NumLights lights of p_Bounds and
+  // p_IntersectsCamera, as computed by LightBounds. The lights are projected in batches across
+  // the worker pool, then each Z slice of the mask is written by one job.
+  void bin(
+      const ClusterGrid& p_Grid,
+      const std::vector<glm::vec3>& p_ConeVertices,
+      const ClusterBounds* p_Bounds,
+      const uint8_t* p_IntersectsCamera,
+      uint32_t p_NumLights,
+      uint32_t* p_Mask);
+
+  // Same result on the calling thread only
+  void binSingleThreaded(
+      const ClusterGrid& p_Grid,
+      const std::vector<glm::vec3>& p_ConeVertices,
+      const ClusterBounds* p_Bounds,
+      const uint8_t* p_IntersectsCamera,
+      uint32_t p_NumLights,
+      uint32_t* p_Mask);
+
+  static ClusterGrid makeGrid(
+      const CameraBase& p_Camera,
+      uint32_t p_NumXTiles,
+      uint32_t p_NumYTiles,
+      uint32_t p_NumZTiles,
+      uint32_t p_ElementsPerCluster);
+
+  static ClusterBinningStats
+  compare(const uint32_t* p_Reference, const uint32_t* p_Mask, uint64_t p_NumElements);
+
+  // Headless check of the mask against points sampled inside the light cones, every cluster
+  // holding a sample must be marked. Results go to the debug output.
+  static bool validate(uint32_t p_NumLights = 1000);
+
+  // Headless timing of both paths for 32, 256 and 1024 lights
+  static void benchmark(uint32_t p_NumIterations = 16);
+
+private:
+  // Tiles a light covers, its X range of each covered row is in m_Spans
+  struct Footprint
+  {
+    uint32_t minY = 1;
+    uint32_t maxY = 0;
+    uint32_t minZ = 1;
+    uint32_t maxZ = 0;
+  };
+
+  void prepare(const ClusterGrid& p_Grid, uint32_t p_NumLights);
+  void computeFootprints(
+      const ClusterGrid& p_Grid,
+      const std::vector<glm::vec3>& p_ConeVertices,
+      const ClusterBounds* p_Bounds,
+      const uint8_t* p_IntersectsCamera,
+      uint32_t p_First,
+      uint32_t p_Count);
+  void writeSlice(const ClusterGrid& p_Grid, uint32_t p_Z, uint32_t p_NumLights, uint32_t* p_Mask)
+      const;
+
+  std::vector<Footprint> m_Footprints;
+  // First and last X tile of every tile row, 2 * numYTiles per light
+  std::vector<uint16_t> m_Spans;
+};
+//---------------------------------------------------------------------------//
+// Bins point lights into the froxels of a cluster grid. A light marks every froxel whose view
+// space bounding box its sphere touches, the same test the brute force path runs for every froxel.
+// Each light only visits the slices, columns and rows around its sphere, so the cost is linear in
+// the light count.
+//---------------------------------------------------------------------------//
+struct PointLightBinner
+{
+  // Fill p_Mask (p_Grid.numElements() words) for the first p_NumLights spheres, world space
+  // center in xyz and radius in w. The spheres are moved to view space in batches across the
+  // worker pool, then each Z slice of the mask is written by one job.
+  void bin(
+      const ClusterGrid& p_Grid,
+      const glm::vec4* p_Spheres,
+      uint32_t p_NumLights,
+      uint32_t* p_Mask);
+
+  // Every light against every froxel on the calling thread, the reference for bin()
+  void binBruteForce(
+      const ClusterGrid& p_Grid,
+      const glm::vec4* p_Spheres,
+      uint32_t p_NumLights,
+      uint32_t* p_Mask);
+
+  // Headless check of bin() against binBruteForce() and against points sampled inside the
+  // spheres. Results go to the debug output.
+  static bool validate(uint32_t p_NumLights = 4096);
+
+  // Headless timing of both paths for 256, 1024 and 4096 lights
+  static void benchmark(uint32_t p_NumIterations = 4);
+
+private:
+  struct ViewSphere
+  {
+    glm::vec3 center;
+    float radius = 0.0f;
+    // Grown a bit so the candidate searches never drop a froxel the exact test keeps
+    float reach = 0.0f;
+    uint32_t minZ = 1;
+    uint32_t maxZ = 0;
+  };
+
+  void prepare(const ClusterGrid& p_Grid, uint32_t p_NumLights);
+  void computeViewSpheres(
+      const ClusterGrid& p_Grid, const glm::vec4* p_Spheres, uint32_t p_First, uint32_t p_Count);
+  void writeSlice(const ClusterGrid& p_Grid, uint32_t p_Z, uint32_t p_NumLights, uint32_t* p_Mask)
+      const;
+
+  // View space x / z and y / z of the tile boundaries, ascending, and the depth of the slice ones
+  std::vector<float> m_XSlopes;
+  std::vector<float> m_YSlopes;
+  std::vector<float> m_SliceDepths;
+  std::vector<ViewSphere> m_Spheres;
+};
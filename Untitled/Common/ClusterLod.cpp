@@ -0,0 +1,669 @@
+#include "ClusterLod.hpp"
+#include "meshoptimizer/meshoptimizer.h"
+#include "MappedFile.hpp"
+#include "Timer.hpp"
+#include "WorkerPool.hpp"
+
+#include <unordered_map>
+
+namespace ClusterLod
+{
+
+//---------------------------------------------------------------------------//
+// Internal
+//---------------------------------------------------------------------------//
+// Layout: ClusterLodFileHeader followed by the cluster and index sections. Bump the version
+// whenever the layout or the builder changes.
+static constexpr uint32_t FileMagic = 0x444F4C43; // 'CLOD'
+static constexpr uint32_t FileVersion = 1;
+
+struct ClusterLodFileHeader
+{
+  uint32_t Magic;
+  uint32_t Version;
+  uint64_t CacheKey;
+  uint64_t FileSize;
+
+  uint32_t VertexCount;
+  uint32_t LevelCount;
+  uint64_t NumClusters;
+  uint64_t NumIndices;
+
+  uint64_t ClustersOffset;
+  uint64_t IndicesOffset;
+};
+//---------------------------------------------------------------------------//
+// Result of simplifying one group of clusters
+struct GroupResult
+{
+  ClusterLodBounds bounds;
+  // Cluster index lists of the next level, empty when the group couldn't be simplified
+  std::vector<std::vector<uint32_t>> clusters;
+};
+//---------------------------------------------------------------------------//
+static const float* positionsOf(const MeshVertex* p_Vertices) { return &p_Vertices[0].Position.x; }
+//---------------------------------------------------------------------------//
+// Splits triangles into clusters with the meshlet limits, p_Indices index p_Positions
+static void splitIntoClusters(
+    const uint32_t* p_Indices,
+    size_t p_IndexCount,
+    const float* p_Positions,
+    size_t p_VertexCount,
+    size_t p_VertexStride,
+    const ClusterLodSettings& p_Settings,
+    std::vector<std::vector<uint32_t>>& p_Clusters)
+{
+  const size_t maxMeshlets =
+      meshopt_buildMeshletsBound(p_IndexCount, p_Settings.maxVertices, p_Settings.maxTriangles);
+  std::vector<meshopt_Meshlet> meshlets(maxMeshlets);
+  std::vector<uint32_t> meshletVertices(maxMeshlets * p_Settings.maxVertices);
+  std::vector<uint8_t> meshletTriangles(maxMeshlets * p_Settings.maxTriangles * 3);
+
+  const size_t meshletCount = meshopt_buildMeshlets(
+      meshlets.data(),
+      meshletVertices.data(),
+      meshletTriangles.data(),
+      p_Indices,
+      p_IndexCount,
+      p_Positions,
+      p_VertexCount,
+      p_VertexStride,
+      p_Settings.maxVertices,
+      p_Settings.maxTriangles,
+      0.0f);
+
+  for (size_t i = 0; i < meshletCount; ++i)
+  {
+    const meshopt_Meshlet& meshlet = meshlets[i];
+    std::vector<uint32_t>& cluster = p_Clusters.emplace_back();
+    cluster.resize(meshlet.triangle_count * 3);
+    for (uint32_t j = 0; j < meshlet.triangle_count * 3; ++j)
+      cluster[j] =
+          meshletVertices[meshlet.vertex_offset + meshletTriangles[meshlet.triangle_offset + j]];
+  }
+}
+//---------------------------------------------------------------------------//
+// Conservative sphere around a set of spheres
+static ClusterLodBounds mergeBounds(const ClusterLodBounds* p_Bounds, size_t p_Count)
+{
+  glm::vec3 minPos = glm::vec3(FLT_MAX);
+  glm::vec3 maxPos = glm::vec3(-FLT_MAX);
+  for (size_t i = 0; i < p_Count; ++i)
+  {
+    minPos = glm::min(minPos, p_Bounds[i].center - glm::vec3(p_Bounds[i].radius));
+    maxPos = glm::max(maxPos, p_Bounds[i].center + glm::vec3(p_Bounds[i].radius));
+  }
+
+  ClusterLodBounds merged = {};
+  merged.center = (minPos + maxPos) * 0.5f;
+  for (size_t i = 0; i < p_Count; ++i)
+  {
+    merged.radius = std::max(
+        merged.radius, glm::length(p_Bounds[i].center - merged.center) + p_Bounds[i].radius);
+    merged.error = std::max(merged.error, p_Bounds[i].error);
+  }
+  return merged;
+}
+//---------------------------------------------------------------------------//
+static uint32_t spreadBits10(uint32_t p_Value)
+{
+  p_Value &= 0x3FF;
+  p_Value = (p_Value | (p_Value << 16)) & 0x030000FF;
+  p_Value = (p_Value | (p_Value << 8)) & 0x0300F00F;
+  p_Value = (p_Value | (p_Value << 4)) & 0x030C30C3;
+  p_Value = (p_Value | (p_Value << 2)) & 0x09249249;
+  return p_Value;
+}
+//---------------------------------------------------------------------------//
+// Groups clusters that share the most vertices, seeds are taken in Morton order of the cluster
+// centers so the groups stay compact. Returns the group members in p_Groups.
+static void groupClusters(
+    const ClusterLodHierarchy& p_Hierarchy,
+    const std::vector<uint32_t>& p_Pending,
+    uint32_t p_GroupSize,
+    std::vector<std::vector<uint32_t>>& p_Groups)
+{
+  const uint32_t count = uint32_t(p_Pending.size());
+
+  // Cluster adjacency weighted by shared vertices
+  std::vector<std::pair<uint32_t, uint32_t>> vertexClusters;
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    const ClusterLodCluster& cluster = p_Hierarchy.clusters[p_Pending[i]];
+    const uint32_t* first = p_Hierarchy.indices.data() + cluster.indexOffset;
+    std::vector<uint32_t> clusterVertices(first, first + cluster.indexCount);
+    std::sort(clusterVertices.begin(), clusterVertices.end());
+    clusterVertices.erase(
+        std::unique(clusterVertices.begin(), clusterVertices.end()), clusterVertices.end());
+    for (uint32_t vertex : clusterVertices)
+      vertexClusters.emplace_back(vertex, i);
+  }
+  std::sort(vertexClusters.begin(), vertexClusters.end());
+
+  std::vector<std::pair<uint32_t, uint32_t>> links;
+  for (size_t runStart = 0; runStart < vertexClusters.size();)
+  {
+    size_t runEnd = runStart + 1;
+    while (runEnd < vertexClusters.size() &&
+           vertexClusters[runEnd].first == vertexClusters[runStart].first)
+      ++runEnd;
+    for (size_t a = runStart; a < runEnd; ++a)
+      for (size_t b = runStart; b < runEnd; ++b)
+        if (a != b)
+          links.emplace_back(vertexClusters[a].second, vertexClusters[b].second);
+    runStart = runEnd;
+  }
+  std::sort(links.begin(), links.end());
+
+  // Per cluster (neighbour, shared vertices)
+  std::vector<std::vector<std::pair<uint32_t, uint32_t>>> neighbours(count);
+  for (size_t i = 0; i < links.size();)
+  {
+    size_t j = i + 1;
+    while (j < links.size() && links[j] == links[i])
+      ++j;
+    neighbours[links[i].first].emplace_back(links[i].second, uint32_t(j - i));
+    i = j;
+  }
+
+  // Seed order
+  glm::vec3 minCenter = glm::vec3(FLT_MAX);
+  glm::vec3 maxCenter = glm::vec3(-FLT_MAX);
+  for (uint32_t clusterIdx : p_Pending)
+  {
+    minCenter = glm::min(minCenter, p_Hierarchy.clusters[clusterIdx].self.center);
+    maxCenter = glm::max(maxCenter, p_Hierarchy.clusters[clusterIdx].self.center);
+  }
+  const glm::vec3 extent = glm::max(maxCenter - minCenter, glm::vec3(1e-6f));
+
+  std::vector<std::pair<uint32_t, uint32_t>> seeds(count);
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    const ClusterLodCluster& cluster = p_Hierarchy.clusters[p_Pending[i]];
+    const glm::uvec3 cell = glm::uvec3((cluster.self.center - minCenter) / extent * 1023.0f);
+    seeds[i].first =
+        spreadBits10(cell.x) | (spreadBits10(cell.y) << 1) | (spreadBits10(cell.z) << 2);
+    seeds[i].second = i;
+  }
+  std::sort(seeds.begin(), seeds.end());
+
+  // Grow every group from its seed with the best connected free neighbour
+  std::vector<bool> grouped(count, false);
+  for (const std::pair<uint32_t, uint32_t>& seed : seeds)
+  {
+    if (grouped[seed.second])
+      continue;
+
+    std::vector<uint32_t> members = {seed.second};
+    grouped[seed.second] = true;
+    while (members.size() < p_GroupSize)
+    {
+      uint32_t best = UINT32_MAX;
+      uint32_t bestShared = 0;
+      for (uint32_t member : members)
+      {
+        for (const std::pair<uint32_t, uint32_t>& neighbour : neighbours[member])
+        {
+          if (grouped[neighbour.first] == false && neighbour.second > bestShared)
+          {
+            best = neighbour.first;
+            bestShared = neighbour.second;
+          }
+        }
+      }
+      if (best == UINT32_MAX)
+        break;
+
+      members.push_back(best);
+      grouped[best] = true;
+    }
+
+    std::vector<uint32_t>& group = p_Groups.emplace_back();
+    for (uint32_t member : members)
+      group.push_back(p_Pending[member]);
+  }
+}
+//---------------------------------------------------------------------------//
+// Simplifies the merged triangles of a group with its border locked and splits the result into
+// the clusters of the next level. Works on a compacted copy of the group's vertices so the cost
+// doesn't depend on the size of the whole mesh.
+static void simplifyGroup(
+    const ClusterLodHierarchy& p_Hierarchy,
+    const MeshVertex* p_Vertices,
+    const std::vector<uint32_t>& p_Group,
+    const ClusterLodSettings& p_Settings,
+    GroupResult& p_Result)
+{
+  std::vector<ClusterLodBounds> childBounds;
+  std::vector<uint32_t> localIndices;
+  std::vector<uint32_t> globalVertices;
+  std::unordered_map<uint32_t, uint32_t> localVertices;
+  for (uint32_t clusterIdx : p_Group)
+  {
+    const ClusterLodCluster& cluster = p_Hierarchy.clusters[clusterIdx];
+    childBounds.push_back(cluster.self);
+    for (uint32_t i = 0; i < cluster.indexCount; ++i)
+    {
+      const uint32_t vertex = p_Hierarchy.indices[cluster.indexOffset + i];
+      auto inserted = localVertices.emplace(vertex, uint32_t(globalVertices.size()));
+      if (inserted.second)
+        globalVertices.push_back(vertex);
+      localIndices.push_back(inserted.first->second);
+    }
+  }
+
+  std::vector<glm::vec3> positions(globalVertices.size());
+  for (size_t i = 0; i < globalVertices.size(); ++i)
+    positions[i] = p_Vertices[globalVertices[i]].Position;
+
+  const size_t targetCount = size_t(localIndices.size() / 3 * p_Settings.simplifyRatio) * 3;
+  std::vector<uint32_t> simplified(localIndices.size());
+  float relativeError = 0.0f;
+  simplified.resize(meshopt_simplify(
+      simplified.data(),
+      localIndices.data(),
+      localIndices.size(),
+      &positions[0].x,
+      positions.size(),
+      sizeof(glm::vec3),
+      targetCount,
+      1.0f,
+      meshopt_SimplifyLockBorder,
+      &relativeError));
+
+  p_Result.bounds = mergeBounds(childBounds.data(), childBounds.size());
+  p_Result.clusters.clear();
+  if (simplified.size() > localIndices.size() * p_Settings.stuckRatio)
+    return;
+
+  // Never smaller than the children's error so the cut is monotonic along every DAG path
+  const float error =
+      relativeError * meshopt_simplifyScale(&positions[0].x, positions.size(), sizeof(glm::vec3));
+  p_Result.bounds.error = std::max(p_Result.bounds.error, error);
+
+  splitIntoClusters(
+      simplified.data(),
+      simplified.size(),
+      &positions[0].x,
+      positions.size(),
+      sizeof(glm::vec3),
+      p_Settings,
+      p_Result.clusters);
+  for (std::vector<uint32_t>& cluster : p_Result.clusters)
+    for (uint32_t& index : cluster)
+      index = globalVertices[index];
+}
+//---------------------------------------------------------------------------//
+static uint32_t appendCluster(
+    ClusterLodHierarchy& p_Hierarchy,
+    const std::vector<uint32_t>& p_Indices,
+    uint32_t p_Level,
+    const ClusterLodBounds& p_Self)
+{
+  ClusterLodCluster cluster = {};
+  cluster.indexOffset = uint32_t(p_Hierarchy.indices.size());
+  cluster.indexCount = uint32_t(p_Indices.size());
+  cluster.level = p_Level;
+  cluster.self = p_Self;
+  cluster.parent = p_Self;
+  cluster.parent.error = FLT_MAX;
+
+  p_Hierarchy.indices.insert(p_Hierarchy.indices.end(), p_Indices.begin(), p_Indices.end());
+  p_Hierarchy.clusters.push_back(cluster);
+  return uint32_t(p_Hierarchy.clusters.size() - 1);
+}
+//---------------------------------------------------------------------------//
+// Screen-space size of an object-space error, in pixels
+static float projectedError(const ClusterLodBounds& p_Bounds, const ClusterLodView& p_View)
+{
+  if (p_Bounds.error == FLT_MAX)
+    return FLT_MAX;
+  if (p_View.orthographic)
+    return p_Bounds.error * p_View.projectionScale;
+
+  const float distance = std::max(
+      glm::length(p_Bounds.center - p_View.cameraPosition) - p_Bounds.radius, p_View.nearClip);
+  return p_Bounds.error * p_View.projectionScale / distance;
+}
+//---------------------------------------------------------------------------//
+// Public API
+//---------------------------------------------------------------------------//
+void build(
+    const MeshVertex* p_Vertices,
+    uint32_t p_VertexCount,
+    const uint32_t* p_Indices,
+    uint32_t p_IndexCount,
+    const ClusterLodSettings& p_Settings,
+    ClusterLodHierarchy& p_Output)
+{
+  assert(p_IndexCount % 3 == 0);
+  assert(p_Settings.maxVertices <= 255 && p_Settings.maxTriangles <= 512);
+
+  p_Output = ClusterLodHierarchy();
+  p_Output.vertexCount = p_VertexCount;
+  if (p_IndexCount == 0)
+    return;
+
+  std::vector<std::vector<uint32_t>> levelClusters;
+  splitIntoClusters(
+      p_Indices,
+      p_IndexCount,
+      positionsOf(p_Vertices),
+      p_VertexCount,
+      sizeof(MeshVertex),
+      p_Settings,
+      levelClusters);
+
+  std::vector<uint32_t> pending;
+  for (const std::vector<uint32_t>& indices : levelClusters)
+  {
+    const meshopt_Bounds bounds = meshopt_computeClusterBounds(
+        indices.data(), indices.size(), positionsOf(p_Vertices), p_VertexCount, sizeof(MeshVertex));
+
+    ClusterLodBounds self = {};
+    self.center = glm::vec3(bounds.center[0], bounds.center[1], bounds.center[2]);
+    self.radius = bounds.radius;
+    pending.push_back(appendCluster(p_Output, indices, 0, self));
+  }
+  p_Output.levelCount = 1;
+
+  while (pending.size() > 1 && p_Output.levelCount < p_Settings.maxLevels)
+  {
+    std::vector<std::vector<uint32_t>> groups;
+    groupClusters(p_Output, pending, p_Settings.groupSize, groups);
+
+    std::vector<GroupResult> results(groups.size());
+    getWorkerPool().parallelFor(uint32_t(groups.size()), [&](uint32_t p_GroupIdx) {
+      simplifyGroup(p_Output, p_Vertices, groups[p_GroupIdx], p_Settings, results[p_GroupIdx]);
+    });
+
+    // Stuck groups keep their clusters as roots
+    const uint32_t level = p_Output.levelCount;
+    pending.clear();
+    for (size_t groupIdx = 0; groupIdx < groups.size(); ++groupIdx)
+    {
+      const GroupResult& result = results[groupIdx];
+      if (result.clusters.empty())
+        continue;
+
+      for (uint32_t child : groups[groupIdx])
+        p_Output.clusters[child].parent = result.bounds;
+      for (const std::vector<uint32_t>& indices : result.clusters)
+        pending.push_back(appendCluster(p_Output, indices, level, result.bounds));
+    }
+
+    if (pending.empty())
+      break;
+    p_Output.levelCount++;
+  }
+}
+//---------------------------------------------------------------------------//
+void build(const Mesh& p_Mesh, const ClusterLodSettings& p_Settings, ClusterLodHierarchy& p_Output)
+{
+  std::vector<uint32_t> indices(p_Mesh.NumIndices());
+  for (uint32_t i = 0; i < p_Mesh.NumIndices(); ++i)
+    indices[i] = p_Mesh.Index(i);
+
+  build(
+      p_Mesh.Vertices(),
+      p_Mesh.NumVertices(),
+      indices.data(),
+      uint32_t(indices.size()),
+      p_Settings,
+      p_Output);
+}
+//---------------------------------------------------------------------------//
+ClusterLodView makeView(const CameraBase& p_Camera, float p_ViewportHeight, float p_PixelError)
+{
+  // Projection matrices are stored transposed, [1][1] is the y scale either way
+  ClusterLodView view = {};
+  view.cameraPosition = p_Camera.Position();
+  view.projectionScale = p_Camera.ProjectionMatrix()[1][1] * p_ViewportHeight * 0.5f;
+  view.nearClip = p_Camera.NearClip();
+  view.pixelError = p_PixelError;
+  view.orthographic = p_Camera.IsOrthographic();
+  return view;
+}
+//---------------------------------------------------------------------------//
+uint64_t selectCut(
+    const ClusterLodHierarchy& p_Hierarchy,
+    const ClusterLodView& p_View,
+    std::vector<uint32_t>& p_SelectedClusters)
+{
+  uint64_t numTriangles = 0;
+  for (uint32_t i = 0; i < uint32_t(p_Hierarchy.clusters.size()); ++i)
+  {
+    const ClusterLodCluster& cluster = p_Hierarchy.clusters[i];
+    if (projectedError(cluster.self, p_View) <= p_View.pixelError &&
+        projectedError(cluster.parent, p_View) > p_View.pixelError)
+    {
+      p_SelectedClusters.push_back(i);
+      numTriangles += cluster.indexCount / 3;
+    }
+  }
+  return numTriangles;
+}
+//---------------------------------------------------------------------------//
+bool save(const wchar_t* p_FilePath, const ClusterLodHierarchy& p_Hierarchy, uint64_t p_Key)
+{
+  ClusterLodFileHeader header = {};
+  header.Magic = FileMagic;
+  header.Version = FileVersion;
+  header.CacheKey = p_Key;
+  header.VertexCount = p_Hierarchy.vertexCount;
+  header.LevelCount = p_Hierarchy.levelCount;
+  header.NumClusters = p_Hierarchy.clusters.size();
+  header.NumIndices = p_Hierarchy.indices.size();
+
+  std::vector<uint8_t> blob;
+  appendBlobSection(blob, &header, 1);
+  header.ClustersOffset =
+      appendBlobSection(blob, p_Hierarchy.clusters.data(), p_Hierarchy.clusters.size());
+  header.IndicesOffset =
+      appendBlobSection(blob, p_Hierarchy.indices.data(), p_Hierarchy.indices.size());
+  blob.resize(alignUp<uint64_t>(blob.size(), BlobSectionAlignment));
+
+  header.FileSize = blob.size();
+  memcpy(blob.data(), &header, sizeof(header));
+
+  if (writeDataToFile(p_FilePath, blob.data(), blob.size()) == false)
+  {
+    writeLog("Failed to write cluster LOD file '%ls'", p_FilePath);
+    return false;
+  }
+  return true;
+}
+//---------------------------------------------------------------------------//
+bool load(const wchar_t* p_FilePath, uint64_t p_Key, ClusterLodHierarchy& p_Hierarchy)
+{
+  MappedFile file;
+  if (file.init(p_FilePath) == false)
+    return false;
+
+  const ClusterLodFileHeader& header = *file.at<ClusterLodFileHeader>(0);
+  bool valid = file.m_Size >= sizeof(ClusterLodFileHeader) && header.Magic == FileMagic &&
+               header.Version == FileVersion && header.FileSize == file.m_Size &&
+               (p_Key == 0 || header.CacheKey == p_Key) &&
+               file.containsSection(
+                   header.ClustersOffset, sizeof(ClusterLodCluster), header.NumClusters) &&
+               file.containsSection(header.IndicesOffset, sizeof(uint32_t), header.NumIndices);
+  if (valid == false)
+    return false;
+
+  const ClusterLodCluster* clusters = file.at<ClusterLodCluster>(header.ClustersOffset);
+  const uint32_t* indices = file.at<uint32_t>(header.IndicesOffset);
+  for (uint64_t i = 0; valid && i < header.NumClusters; ++i)
+    valid = uint64_t(clusters[i].indexOffset) + clusters[i].indexCount <= header.NumIndices;
+  for (uint64_t i = 0; valid && i < header.NumIndices; ++i)
+    valid = indices[i] < header.VertexCount;
+  if (valid == false)
+    return false;
+
+  p_Hierarchy.clusters.assign(clusters, clusters + header.NumClusters);
+  p_Hierarchy.indices.assign(indices, indices + header.NumIndices);
+  p_Hierarchy.vertexCount = header.VertexCount;
+  p_Hierarchy.levelCount = header.LevelCount;
+  return true;
+}
+//---------------------------------------------------------------------------//
+// Validation
+//---------------------------------------------------------------------------//
+// Edges used by a single triangle, sorted. A cut without cracks has the same open edges as the
+// source mesh.
+static std::vector<uint64_t> openEdges(const uint32_t* p_Indices, size_t p_IndexCount)
+{
+  std::vector<uint64_t> edges;
+  edges.reserve(p_IndexCount);
+  for (size_t tri = 0; tri < p_IndexCount; tri += 3)
+  {
+    for (uint32_t corner = 0; corner < 3; ++corner)
+    {
+      const uint32_t a = p_Indices[tri + corner];
+      const uint32_t b = p_Indices[tri + (corner + 1) % 3];
+      edges.push_back((uint64_t(std::min(a, b)) << 32) | std::max(a, b));
+    }
+  }
+  std::sort(edges.begin(), edges.end());
+
+  std::vector<uint64_t> open;
+  for (size_t i = 0; i < edges.size();)
+  {
+    size_t j = i + 1;
+    while (j < edges.size() && edges[j] == edges[i])
+      ++j;
+    if (j - i == 1)
+      open.push_back(edges[i]);
+    i = j;
+  }
+  return open;
+}
+//---------------------------------------------------------------------------//
+bool validate(const wchar_t* p_TempFilePath, uint32_t p_GridSize)
+{
+  assert(p_GridSize > 1);
+
+  const float cellSize = 0.1f;
+  std::vector<MeshVertex> vertices(Mesh::GridVertexCount(p_GridSize));
+  std::vector<uint32_t> indices(Mesh::GridIndexCount(p_GridSize));
+  std::vector<uint8_t> gridIndices(
+      Mesh::GridIndexCount(p_GridSize) *
+      Mesh::IndexSize(Mesh::IndexTypeForVertexCount(vertices.size())));
+
+  Mesh mesh;
+  mesh.InitGrid(p_GridSize, cellSize, 0, vertices.data(), gridIndices.data());
+  mesh.InitCommon(vertices.data(), gridIndices.data(), 0, 0, 0, 0);
+  for (uint32_t i = 0; i < uint32_t(indices.size()); ++i)
+    indices[i] = mesh.Index(i);
+
+  // Rolling hills like Model::ValidateLodGeneration()
+  const float extent = (p_GridSize - 1) * cellSize;
+  for (MeshVertex& vertex : vertices)
+    vertex.Position.y = 0.05f * extent * std::sin(vertex.Position.x * 6.0f / extent) *
+                        std::cos(vertex.Position.z * 4.0f / extent);
+
+  Timer timer;
+  timer.init();
+
+  ClusterLodSettings settings;
+  ClusterLodHierarchy hierarchy;
+  build(
+      vertices.data(),
+      uint32_t(vertices.size()),
+      indices.data(),
+      uint32_t(indices.size()),
+      settings,
+      hierarchy);
+
+  timer.update();
+  const double buildMs = timer.m_DeltaMillisecondsD;
+
+  // Error and bounds never shrink towards the roots
+  bool valid = hierarchy.levelCount > 1;
+  uint32_t numRoots = 0;
+  for (const ClusterLodCluster& cluster : hierarchy.clusters)
+  {
+    valid = valid && (cluster.level > 0 || cluster.self.error == 0.0f);
+    if (cluster.parent.error == FLT_MAX)
+    {
+      numRoots++;
+      continue;
+    }
+
+    const float slack = 1e-4f * extent;
+    valid = valid && cluster.parent.error >= cluster.self.error &&
+            glm::length(cluster.parent.center - cluster.self.center) + cluster.self.radius <=
+                cluster.parent.radius + slack;
+  }
+
+  // 60 degree vertical field of view on a 1080 pixel viewport, looking down at the center
+  ClusterLodView view = {};
+  view.projectionScale = 1.0f / std::tan(glm::radians(30.0f)) * 1080.0f * 0.5f;
+  view.nearClip = 0.1f;
+  view.pixelError = 1.0f;
+  view.orthographic = false;
+
+  const std::vector<uint64_t> sourceOpenEdges = openEdges(indices.data(), indices.size());
+  const float distances[] = {0.25f, 1.0f, 4.0f, 16.0f, 64.0f};
+  uint64_t prevTriangles = UINT64_MAX;
+  for (float distance : distances)
+  {
+    view.cameraPosition = glm::vec3(0.0f, distance * extent, 0.0f);
+
+    std::vector<uint32_t> selected;
+    const uint64_t numTriangles = selectCut(hierarchy, view, selected);
+
+    std::vector<uint32_t> cutIndices;
+    for (uint32_t clusterIdx : selected)
+    {
+      const ClusterLodCluster& cluster = hierarchy.clusters[clusterIdx];
+      cutIndices.insert(
+          cutIndices.end(),
+          hierarchy.indices.begin() + cluster.indexOffset,
+          hierarchy.indices.begin() + cluster.indexOffset + cluster.indexCount);
+    }
+    const bool watertight = openEdges(cutIndices.data(), cutIndices.size()) == sourceOpenEdges;
+
+    valid = valid && watertight && numTriangles > 0 && numTriangles <= prevTriangles;
+    prevTriangles = numTriangles;
+
+    writeLog(
+        "ClusterLod::validate: distance %.2f, %zu clusters, %llu of %zu triangles, %s",
+        distance * extent,
+        selected.size(),
+        numTriangles,
+        indices.size() / 3,
+        watertight ? "watertight" : "CRACKED");
+  }
+  // The far cut has to actually be coarse
+  valid = valid && prevTriangles * 4 < indices.size() / 3;
+
+  ClusterLodHierarchy loaded;
+  const uint64_t key = hashValue(p_GridSize, hashValue(settings, 0));
+  const bool roundTrip = save(p_TempFilePath, hierarchy, key) &&
+                         load(p_TempFilePath, key, loaded) &&
+                         loaded.vertexCount == hierarchy.vertexCount &&
+                         loaded.levelCount == hierarchy.levelCount &&
+                         loaded.indices == hierarchy.indices &&
+                         loaded.clusters.size() == hierarchy.clusters.size() &&
+                         memcmp(
+                             loaded.clusters.data(),
+                             hierarchy.clusters.data(),
+                             sizeof(ClusterLodCluster) * hierarchy.clusters.size()) == 0;
+  DeleteFileW(p_TempFilePath);
+  valid = valid && roundTrip;
+
+  writeLog(
+      "ClusterLod::validate: %zu triangles, %u levels, %zu clusters, %u roots, build %.2f ms, "
+      "round trip %s, %s",
+      indices.size() / 3,
+      hierarchy.levelCount,
+      hierarchy.clusters.size(),
+      numRoots,
+      buildMs,
+      roundTrip ? "ok" : "failed",
+      valid ? "passed" : "FAILED");
+
+  return valid;
+}
+//---------------------------------------------------------------------------//
+} // namespace ClusterLod
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "Camera.hpp"
+#include "Model.hpp"
+
+//---------------------------------------------------------------------------//
+// Hierarchical cluster LOD: level 0 is the mesh split into meshlet sized clusters, every
+// following level groups neighbouring clusters, simplifies each group to half its triangles with
+// the group border locked and splits the result into clusters again. The clusters form a DAG,
+// selecting every cluster whose own error is small enough but whose parent's error is not gives
+// a crack-free cut for any view.
+// Nothing draws from the hierarchy yet, GpuDrivenRenderer still uses its level 0 meshlets.
+//---------------------------------------------------------------------------//
+struct ClusterLodBounds
+{
+  glm::vec3 center;
+  float radius;
+  // Object-space simplification error, FLT_MAX for clusters that are never replaced
+  float error;
+};
+//---------------------------------------------------------------------------//
+struct ClusterLodCluster
+{
+  // Triangles in ClusterLodHierarchy::indices, they index the source mesh vertices
+  uint32_t indexOffset;
+  uint32_t indexCount;
+  uint32_t level;
+  uint32_t padding;
+
+  // Group this cluster was created from (zero error at level 0) and the group that replaces it.
+  // Both are shared by all clusters of a group, which is what keeps the cut consistent.
+  ClusterLodBounds self;
+  ClusterLodBounds parent;
+};
+//---------------------------------------------------------------------------//
+struct ClusterLodHierarchy
+{
+  std::vector<ClusterLodCluster> clusters;
+  std::vector<uint32_t> indices;
+  uint32_t vertexCount = 0;
+  uint32_t levelCount = 0;
+};
+//---------------------------------------------------------------------------//
+struct ClusterLodSettings
+{
+  // Same limits as the meshlets of GpuDrivenRenderer
+  uint32_t maxVertices = 64;
+  uint32_t maxTriangles = 124;
+  // Clusters merged into a group before simplifying
+  uint32_t groupSize = 8;
+  // Triangles kept per simplification, groups that can't get below stuckRatio become roots
+  float simplifyRatio = 0.5f;
+  float stuckRatio = 0.85f;
+  uint32_t maxLevels = 16;
+};
+//---------------------------------------------------------------------------//
+// View parameters for the cut selection
+struct ClusterLodView
+{
+  glm::vec3 cameraPosition;
+  // Pixels per object-space unit, at distance one for perspective projections
+  float projectionScale;
+  float nearClip;
+  float pixelError;
+  bool orthographic;
+};
+//---------------------------------------------------------------------------//
+namespace ClusterLod
+{
+
+// CPU-only, usable without a device
+void build(
+    const MeshVertex* p_Vertices,
+    uint32_t p_VertexCount,
+    const uint32_t* p_Indices,
+    uint32_t p_IndexCount,
+    const ClusterLodSettings& p_Settings,
+    ClusterLodHierarchy& p_Output);
+// Builds from level 0 of a mesh
+void build(const Mesh& p_Mesh, const ClusterLodSettings& p_Settings, ClusterLodHierarchy& p_Output);
+
+ClusterLodView
+makeView(const CameraBase& p_Camera, float p_ViewportHeight, float p_PixelError = 1.0f);
+
+// Reference cut selection, appends the selected cluster indices and returns their triangle count
+uint64_t selectCut(
+    const ClusterLodHierarchy& p_Hierarchy,
+    const ClusterLodView& p_View,
+    std::vector<uint32_t>& p_SelectedClusters);
+
+bool save(const wchar_t* p_FilePath, const ClusterLodHierarchy& p_Hierarchy, uint64_t p_Key);
+bool load(const wchar_t* p_FilePath, uint64_t p_Key, ClusterLodHierarchy& p_Hierarchy);
+
+// Builds the hierarchy of a p_GridSize x p_GridSize heightfield and checks the DAG bounds, that
+// cuts from several distances are watertight and get cheaper with distance, and the serializer
+// round trip. Results go to the debug output.
+bool validate(const wchar_t* p_TempFilePath, uint32_t p_GridSize = 256);
+
+} // namespace ClusterLod
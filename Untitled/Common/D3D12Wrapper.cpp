@@ -2501,7 +2501,11 @@ void ReadbackBuffer::init(uint64_t size)
 }
 void ReadbackBuffer::deinit()
 {
+  if (Resource == nullptr)
+    return;
+
   Resource->Release();
+  Resource = nullptr;
   Size = 0;
 }
 void* ReadbackBuffer::map()
@@ -2524,8 +2528,11 @@ void RenderTexture::init(const RenderTextureInit& p_Init)
 {
   deinit();
 
+  assert(p_Init.NumMips > 0);
+  assert(p_Init.NumMips == 1 || p_Init.ArraySize == 1);
+
   D3D12_RESOURCE_DESC textureDesc = {};
-  textureDesc.MipLevels = 1;
+  textureDesc.MipLevels = uint16_t(p_Init.NumMips);
   textureDesc.Format = p_Init.Format;
   textureDesc.Width = uint32_t(p_Init.Width);
   textureDesc.Height = uint32_t(p_Init.Height);
@@ -2560,7 +2567,7 @@ void RenderTexture::init(const RenderTextureInit& p_Init)
   m_Texture.Width = uint32_t(p_Init.Width);
   m_Texture.Height = uint32_t(p_Init.Height);
   m_Texture.Depth = 1;
-  m_Texture.NumMips = 1;
+  m_Texture.NumMips = uint32_t(p_Init.NumMips);
   m_Texture.ArraySize = uint32_t(p_Init.ArraySize);
   m_Texture.Format = p_Init.Format;
   m_Texture.Cubemap = false;
@@ -2593,6 +2600,24 @@ void RenderTexture::init(const RenderTextureInit& p_Init)
   {
     m_UAV = UAVDescriptorHeap.AllocatePersistent().Handles[0];
     g_Device->CreateUnorderedAccessView(m_Texture.Resource, nullptr, nullptr, m_UAV);
+
+    if (p_Init.NumMips > 1)
+    {
+      m_MipUAVs.resize(p_Init.NumMips);
+      m_MipUAVs[0] = m_UAV;
+
+      D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+      uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
+      uavDesc.Format = p_Init.Format;
+
+      for (uint64_t i = 1; i < p_Init.NumMips; ++i)
+      {
+        uavDesc.Texture2D.MipSlice = uint32_t(i);
+
+        m_MipUAVs[i] = UAVDescriptorHeap.AllocatePersistent().Handles[0];
+        g_Device->CreateUnorderedAccessView(m_Texture.Resource, nullptr, &uavDesc, m_MipUAVs[i]);
+      }
+    }
   }
 }
 void RenderTexture::deinit()
@@ -2602,6 +2627,9 @@ void RenderTexture::deinit()
   for (uint64_t i = 0; i < m_ArrayRTVs.size(); ++i)
     RTVDescriptorHeap.FreePersistent(m_ArrayRTVs[i]);
   m_ArrayRTVs.clear();
+  for (uint64_t i = 1; i < m_MipUAVs.size(); ++i)
+    UAVDescriptorHeap.FreePersistent(m_MipUAVs[i]);
+  m_MipUAVs.clear();
   m_Texture.deinit();
 }
 
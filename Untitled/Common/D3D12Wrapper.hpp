@@ -844,6 +844,8 @@ struct RenderTextureInit
   DXGI_FORMAT Format = DXGI_FORMAT_UNKNOWN;
   uint64_t MSAASamples = 1;
   uint64_t ArraySize = 1;
+  // Only mip 0 gets render target views, the others are written through m_MipUAVs
+  uint64_t NumMips = 1;
   bool CreateUAV = false;
   D3D12_RESOURCE_STATES InitialState = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE;
   const wchar_t* Name = nullptr;
@@ -854,6 +856,8 @@ struct RenderTexture
   D3D12_CPU_DESCRIPTOR_HANDLE m_RTV = {};
   D3D12_CPU_DESCRIPTOR_HANDLE m_UAV = {};
   std::vector<D3D12_CPU_DESCRIPTOR_HANDLE> m_ArrayRTVs;
+  // One UAV per mip when there is more than one, m_UAV is mip 0
+  std::vector<D3D12_CPU_DESCRIPTOR_HANDLE> m_MipUAVs;
   uint32_t m_MSAASamples = 0;
   uint32_t m_MSAAQuality = 0;
 
@@ -882,6 +886,7 @@ struct RenderTexture
   uint32_t srv() const { return m_Texture.SRV; }
   uint64_t width() const { return m_Texture.Width; }
   uint64_t height() const { return m_Texture.Height; }
+  uint64_t numMips() const { return m_Texture.NumMips; }
   DXGI_FORMAT format() const { return m_Texture.Format; }
   ID3D12Resource* resource() const { return m_Texture.Resource; }
   uint64_t subResourceIndex(uint64_t p_MipLevel, uint64_t p_ArraySlice) const
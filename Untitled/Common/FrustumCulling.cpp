@@ -0,0 +1,450 @@
+#include "FrustumCulling.hpp"
+#include "Model.hpp"
+#include "Sampling.hpp"
+#include "Timer.hpp"
+
+#include <immintrin.h>
+#include <intrin.h>
+
+//---------------------------------------------------------------------------//
+// CullingBounds
+//---------------------------------------------------------------------------//
+void CullingBounds::init(const std::vector<Mesh>& p_Meshes)
+{
+  std::vector<glm::vec3> aabbMins(p_Meshes.size());
+  std::vector<glm::vec3> aabbMaxs(p_Meshes.size());
+  for (uint64_t i = 0; i < p_Meshes.size(); ++i)
+  {
+    aabbMins[i] = p_Meshes[i].AABBMin();
+    aabbMaxs[i] = p_Meshes[i].AABBMax();
+  }
+  init(aabbMins.data(), aabbMaxs.data(), uint32_t(p_Meshes.size()));
+}
+//---------------------------------------------------------------------------//
+void CullingBounds::init(const glm::vec3* p_AabbMins, const glm::vec3* p_AabbMaxs, uint32_t p_Count)
+{
+  centerX.resize(p_Count);
+  centerY.resize(p_Count);
+  centerZ.resize(p_Count);
+  extentX.resize(p_Count);
+  extentY.resize(p_Count);
+  extentZ.resize(p_Count);
+  for (uint32_t i = 0; i < p_Count; ++i)
+  {
+    const glm::vec3 center = (p_AabbMins[i] + p_AabbMaxs[i]) * 0.5f;
+    const glm::vec3 extent = (p_AabbMaxs[i] - p_AabbMins[i]) * 0.5f;
+    centerX[i] = center.x;
+    centerY[i] = center.y;
+    centerZ[i] = center.z;
+    extentX[i] = extent.x;
+    extentY[i] = extent.y;
+    extentZ[i] = extent.z;
+  }
+}
+//---------------------------------------------------------------------------//
+namespace FrustumCulling
+{
+
+//---------------------------------------------------------------------------//
+// Internal
+//---------------------------------------------------------------------------//
+// Signed distance of the box's closest corner to the plane, negative means the box is fully
+// outside. The SIMD paths evaluate the same expression in the same order so they match the
+// scalar reference bit for bit.
+static float boxPlaneMargin(const CullingBounds& p_Bounds, uint32_t p_Idx, const glm::vec4& p_Plane)
+{
+  const float distance = p_Plane.x * p_Bounds.centerX[p_Idx] +
+                         p_Plane.y * p_Bounds.centerY[p_Idx] +
+                         p_Plane.z * p_Bounds.centerZ[p_Idx] + p_Plane.w;
+  const float radius = std::abs(p_Plane.x) * p_Bounds.extentX[p_Idx] +
+                       std::abs(p_Plane.y) * p_Bounds.extentY[p_Idx] +
+                       std::abs(p_Plane.z) * p_Bounds.extentZ[p_Idx];
+  return distance + radius;
+}
+//---------------------------------------------------------------------------//
+static bool isBoxVisible(const CullingBounds& p_Bounds, uint32_t p_Idx, const Frustum& p_Frustum)
+{
+  for (const glm::vec4& plane : p_Frustum.planes)
+    if (boxPlaneMargin(p_Bounds, p_Idx, plane) < 0.0f)
+      return false;
+  return true;
+}
+//---------------------------------------------------------------------------//
+// Scalar tail of the SIMD paths
+static uint32_t cullRange(
+    const CullingBounds& p_Bounds,
+    const Frustum& p_Frustum,
+    uint32_t p_First,
+    uint32_t* p_Visible,
+    uint32_t p_NumVisible)
+{
+  for (uint32_t i = p_First; i < p_Bounds.count(); ++i)
+    if (isBoxVisible(p_Bounds, i, p_Frustum))
+      p_Visible[p_NumVisible++] = i;
+  return p_NumVisible;
+}
+//---------------------------------------------------------------------------//
+// Public API
+//---------------------------------------------------------------------------//
+Frustum extractFrustum(const glm::mat4& p_ViewProjection)
+{
+  // Gribb/Hartmann with a [0, w] depth range
+  const glm::vec4& row0 = p_ViewProjection[0];
+  const glm::vec4& row1 = p_ViewProjection[1];
+  const glm::vec4& row2 = p_ViewProjection[2];
+  const glm::vec4& row3 = p_ViewProjection[3];
+
+  Frustum frustum;
+  frustum.planes[0] = row3 + row0; // Left
+  frustum.planes[1] = row3 - row0; // Right
+  frustum.planes[2] = row3 + row1; // Bottom
+  frustum.planes[3] = row3 - row1; // Top
+  frustum.planes[4] = row2;        // Near
+  frustum.planes[5] = row3 - row2; // Far
+
+  for (glm::vec4& plane : frustum.planes)
+    plane /= glm::length(glm::vec3(plane));
+  return frustum;
+}
+//---------------------------------------------------------------------------//
+bool testBox(const Frustum& p_Frustum, const glm::vec3& p_Center, const glm::vec3& p_Extent)
+{
+  for (const glm::vec4& plane : p_Frustum.planes)
+  {
+    const float distance = glm::dot(glm::vec3(plane), p_Center) + plane.w;
+    const float radius = glm::dot(glm::abs(glm::vec3(plane)), p_Extent);
+    if (distance + radius < 0.0f)
+      return false;
+  }
+  return true;
+}
+//---------------------------------------------------------------------------//
+uint32_t cullScalar(const CullingBounds& p_Bounds, const Frustum& p_Frustum, uint32_t* p_Visible)
+{
+  return cullRange(p_Bounds, p_Frustum, 0, p_Visible, 0);
+}
+//---------------------------------------------------------------------------//
+uint32_t cullSSE(const CullingBounds& p_Bounds, const Frustum& p_Frustum, uint32_t* p_Visible)
+{
+  const __m128 signMask = _mm_set1_ps(-0.0f);
+  const __m128 zero = _mm_setzero_ps();
+
+  __m128 planeX[6];
+  __m128 planeY[6];
+  __m128 planeZ[6];
+  __m128 planeW[6];
+  __m128 absPlaneX[6];
+  __m128 absPlaneY[6];
+  __m128 absPlaneZ[6];
+  for (uint32_t p = 0; p < 6; ++p)
+  {
+    planeX[p] = _mm_set1_ps(p_Frustum.planes[p].x);
+    planeY[p] = _mm_set1_ps(p_Frustum.planes[p].y);
+    planeZ[p] = _mm_set1_ps(p_Frustum.planes[p].z);
+    planeW[p] = _mm_set1_ps(p_Frustum.planes[p].w);
+    absPlaneX[p] = _mm_andnot_ps(signMask, planeX[p]);
+    absPlaneY[p] = _mm_andnot_ps(signMask, planeY[p]);
+    absPlaneZ[p] = _mm_andnot_ps(signMask, planeZ[p]);
+  }
+
+  const uint32_t count = p_Bounds.count();
+  const uint32_t simdCount = count & ~3u;
+  uint32_t numVisible = 0;
+  for (uint32_t i = 0; i < simdCount; i += 4)
+  {
+    const __m128 centerX = _mm_loadu_ps(&p_Bounds.centerX[i]);
+    const __m128 centerY = _mm_loadu_ps(&p_Bounds.centerY[i]);
+    const __m128 centerZ = _mm_loadu_ps(&p_Bounds.centerZ[i]);
+    const __m128 extentX = _mm_loadu_ps(&p_Bounds.extentX[i]);
+    const __m128 extentY = _mm_loadu_ps(&p_Bounds.extentY[i]);
+    const __m128 extentZ = _mm_loadu_ps(&p_Bounds.extentZ[i]);
+
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (uint32_t p = 0; p < 6; ++p)
+    {
+      __m128 distance = _mm_mul_ps(planeX[p], centerX);
+      distance = _mm_add_ps(distance, _mm_mul_ps(planeY[p], centerY));
+      distance = _mm_add_ps(distance, _mm_mul_ps(planeZ[p], centerZ));
+      distance = _mm_add_ps(distance, planeW[p]);
+
+      __m128 radius = _mm_mul_ps(absPlaneX[p], extentX);
+      radius = _mm_add_ps(radius, _mm_mul_ps(absPlaneY[p], extentY));
+      radius = _mm_add_ps(radius, _mm_mul_ps(absPlaneZ[p], extentZ));
+
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+    }
+
+    // Branchless compaction, the slot is only kept when the lane is visible
+    const uint32_t mask = uint32_t(_mm_movemask_ps(inside));
+    for (uint32_t lane = 0; lane < 4; ++lane)
+    {
+      p_Visible[numVisible] = i + lane;
+      numVisible += (mask >> lane) & 1;
+    }
+  }
+
+  return cullRange(p_Bounds, p_Frustum, simdCount, p_Visible, numVisible);
+}
+//---------------------------------------------------------------------------//
+uint32_t cullAVX(const CullingBounds& p_Bounds, const Frustum& p_Frustum, uint32_t* p_Visible)
+{
+  const __m256 signMask = _mm256_set1_ps(-0.0f);
+  const __m256 zero = _mm256_setzero_ps();
+
+  __m256 planeX[6];
+  __m256 planeY[6];
+  __m256 planeZ[6];
+  __m256 planeW[6];
+  __m256 absPlaneX[6];
+  __m256 absPlaneY[6];
+  __m256 absPlaneZ[6];
+  for (uint32_t p = 0; p < 6; ++p)
+  {
+    planeX[p] = _mm256_set1_ps(p_Frustum.planes[p].x);
+    planeY[p] = _mm256_set1_ps(p_Frustum.planes[p].y);
+    planeZ[p] = _mm256_set1_ps(p_Frustum.planes[p].z);
+    planeW[p] = _mm256_set1_ps(p_Frustum.planes[p].w);
+    absPlaneX[p] = _mm256_andnot_ps(signMask, planeX[p]);
+    absPlaneY[p] = _mm256_andnot_ps(signMask, planeY[p]);
+    absPlaneZ[p] = _mm256_andnot_ps(signMask, planeZ[p]);
+  }
+
+  const uint32_t count = p_Bounds.count();
+  const uint32_t simdCount = count & ~7u;
+  uint32_t numVisible = 0;
+  for (uint32_t i = 0; i < simdCount; i += 8)
+  {
+    const __m256 centerX = _mm256_loadu_ps(&p_Bounds.centerX[i]);
+    const __m256 centerY = _mm256_loadu_ps(&p_Bounds.centerY[i]);
+    const __m256 centerZ = _mm256_loadu_ps(&p_Bounds.centerZ[i]);
+    const __m256 extentX = _mm256_loadu_ps(&p_Bounds.extentX[i]);
+    const __m256 extentY = _mm256_loadu_ps(&p_Bounds.extentY[i]);
+    const __m256 extentZ = _mm256_loadu_ps(&p_Bounds.extentZ[i]);
+
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (uint32_t p = 0; p < 6; ++p)
+    {
+      __m256 distance = _mm256_mul_ps(planeX[p], centerX);
+      distance = _mm256_add_ps(distance, _mm256_mul_ps(planeY[p], centerY));
+      distance = _mm256_add_ps(distance, _mm256_mul_ps(planeZ[p], centerZ));
+      distance = _mm256_add_ps(distance, planeW[p]);
+
+      __m256 radius = _mm256_mul_ps(absPlaneX[p], extentX);
+      radius = _mm256_add_ps(radius, _mm256_mul_ps(absPlaneY[p], extentY));
+      radius = _mm256_add_ps(radius, _mm256_mul_ps(absPlaneZ[p], extentZ));
+
+      inside =
+          _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_GE_OQ));
+    }
+
+    const uint32_t mask = uint32_t(_mm256_movemask_ps(inside));
+    for (uint32_t lane = 0; lane < 8; ++lane)
+    {
+      p_Visible[numVisible] = i + lane;
+      numVisible += (mask >> lane) & 1;
+    }
+  }
+
+  return cullRange(p_Bounds, p_Frustum, simdCount, p_Visible, numVisible);
+}
+//---------------------------------------------------------------------------//
+bool isAVXSupported()
+{
+  static const bool supported = []() {
+    int cpuInfo[4] = {};
+    __cpuid(cpuInfo, 1);
+    const bool osxsave = (cpuInfo[2] & (1 << 27)) != 0;
+    const bool avx = (cpuInfo[2] & (1 << 28)) != 0;
+    // The OS has to save the YMM registers
+    return osxsave && avx && (_xgetbv(0) & 0x6) == 0x6;
+  }();
+  return supported;
+}
+//---------------------------------------------------------------------------//
+uint32_t cull(const CullingBounds& p_Bounds, const Frustum& p_Frustum, uint32_t* p_Visible)
+{
+  if (isAVXSupported())
+    return cullAVX(p_Bounds, p_Frustum, p_Visible);
+  return cullSSE(p_Bounds, p_Frustum, p_Visible);
+}
+//---------------------------------------------------------------------------//
+// Validation
+//---------------------------------------------------------------------------//
+// Boxes scattered around the origin with a mix of sizes, like the pieces of a scene
+static void makeRandomBounds(Random& p_Rng, uint32_t p_Count, CullingBounds& p_Bounds)
+{
+  std::vector<glm::vec3> aabbMins(p_Count);
+  std::vector<glm::vec3> aabbMaxs(p_Count);
+  for (uint32_t i = 0; i < p_Count; ++i)
+  {
+    const glm::vec3 center =
+        (glm::vec3(p_Rng.RandomFloat2(), p_Rng.RandomFloat()) - 0.5f) * 200.0f;
+    const float size = p_Rng.RandomFloat();
+    const glm::vec3 extent =
+        glm::vec3(p_Rng.RandomFloat2(), p_Rng.RandomFloat()) * (size * size * 10.0f);
+    aabbMins[i] = center - extent;
+    aabbMaxs[i] = center + extent;
+  }
+  p_Bounds.init(aabbMins.data(), aabbMaxs.data(), p_Count);
+}
+//---------------------------------------------------------------------------//
+// Camera looking from a random point towards another, stored like the camera classes do it
+static glm::mat4 makeRandomViewProjection(Random& p_Rng, bool p_Orthographic)
+{
+  const glm::vec3 eye = (glm::vec3(p_Rng.RandomFloat2(), p_Rng.RandomFloat()) - 0.5f) * 100.0f;
+  const glm::vec3 target = (glm::vec3(p_Rng.RandomFloat2(), p_Rng.RandomFloat()) - 0.5f) * 100.0f;
+  const glm::mat4 view = glm::lookAtLH(eye, target, glm::vec3(0.0f, 1.0f, 0.0f));
+
+  const glm::mat4 projection =
+      p_Orthographic
+          ? glm::orthoLH_ZO(-40.0f, 40.0f, -25.0f, 25.0f, 0.1f, 150.0f)
+          : glm::perspectiveFovLH_ZO(glm::radians(60.0f), 1920.0f, 1080.0f, 0.1f, 150.0f);
+  return glm::transpose(view) * glm::transpose(projection);
+}
+//---------------------------------------------------------------------------//
+// Box fully outside a plane when all 8 corners are
+static bool isBoxVisibleCorners(
+    const CullingBounds& p_Bounds, uint32_t p_Idx, const Frustum& p_Frustum, float p_Epsilon)
+{
+  const glm::vec3 center =
+      glm::vec3(p_Bounds.centerX[p_Idx], p_Bounds.centerY[p_Idx], p_Bounds.centerZ[p_Idx]);
+  const glm::vec3 extent =
+      glm::vec3(p_Bounds.extentX[p_Idx], p_Bounds.extentY[p_Idx], p_Bounds.extentZ[p_Idx]);
+  for (const glm::vec4& plane : p_Frustum.planes)
+  {
+    bool anyInside = false;
+    for (uint32_t corner = 0; corner < 8; ++corner)
+    {
+      const glm::vec3 sign = glm::vec3(
+          (corner & 1) ? 1.0f : -1.0f, (corner & 2) ? 1.0f : -1.0f, (corner & 4) ? 1.0f : -1.0f);
+      anyInside |= glm::dot(glm::vec3(plane), center + sign * extent) + plane.w >= -p_Epsilon;
+    }
+    if (anyInside == false)
+      return false;
+  }
+  return true;
+}
+//---------------------------------------------------------------------------//
+bool validate(uint32_t p_NumBoxes)
+{
+  assert(p_NumBoxes > 0);
+
+  Random rng;
+  rng.SetSeed(4321);
+
+  // Odd count so the scalar tails run too
+  CullingBounds bounds;
+  makeRandomBounds(rng, p_NumBoxes | 7, bounds);
+
+  std::vector<uint32_t> reference(bounds.count());
+  std::vector<uint32_t> visible(bounds.count());
+  const float epsilon = 1e-3f;
+  bool valid = true;
+  uint32_t numCameras = 0;
+  uint64_t numVisibleTotal = 0;
+  for (uint32_t camera = 0; camera < 32; ++camera, ++numCameras)
+  {
+    const glm::mat4 viewProjection = makeRandomViewProjection(rng, (camera & 1) != 0);
+    const Frustum frustum = extractFrustum(viewProjection);
+
+    // The planes agree with the clip space test the vertex shaders see
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+      const glm::vec3 point =
+          (glm::vec3(rng.RandomFloat2(), rng.RandomFloat()) - 0.5f) * 200.0f;
+      const glm::vec4 clip = glm::vec4(point, 1.0f) * viewProjection;
+      const bool clipInside = clip.w > 0.0f && std::abs(clip.x) <= clip.w &&
+                              std::abs(clip.y) <= clip.w && clip.z >= 0.0f && clip.z <= clip.w;
+
+      float minDistance = FLT_MAX;
+      for (const glm::vec4& plane : frustum.planes)
+        minDistance = std::min(minDistance, glm::dot(glm::vec3(plane), point) + plane.w);
+      valid = valid && (std::abs(minDistance) < epsilon || clipInside == (minDistance >= 0.0f));
+    }
+
+    const uint32_t numReference = cullScalar(bounds, frustum, reference.data());
+    for (uint32_t i = 0, r = 0; i < bounds.count(); ++i)
+    {
+      const bool culled = r == numReference || reference[r] != i;
+      if (culled == false)
+        ++r;
+
+      // The plane test is conservative, only boxes very close to a plane may differ
+      if (culled == isBoxVisibleCorners(bounds, i, frustum, -epsilon) &&
+          culled == isBoxVisibleCorners(bounds, i, frustum, epsilon))
+        valid = false;
+    }
+
+    const uint32_t numSSE = cullSSE(bounds, frustum, visible.data());
+    valid = valid && numSSE == numReference &&
+            std::equal(reference.begin(), reference.begin() + numReference, visible.begin());
+
+    if (isAVXSupported())
+    {
+      const uint32_t numAVX = cullAVX(bounds, frustum, visible.data());
+      valid = valid && numAVX == numReference &&
+              std::equal(reference.begin(), reference.begin() + numReference, visible.begin());
+    }
+
+    numVisibleTotal += numReference;
+  }
+
+  writeLog(
+      "FrustumCulling::validate: %u boxes, %u cameras, %.1f%% visible, AVX %s, %s",
+      bounds.count(),
+      numCameras,
+      100.0 * numVisibleTotal / (double(bounds.count()) * numCameras),
+      isAVXSupported() ? "tested" : "not supported",
+      valid ? "passed" : "FAILED");
+
+  return valid;
+}
+//---------------------------------------------------------------------------//
+void benchmark(uint32_t p_NumIterations)
+{
+  assert(p_NumIterations > 0);
+
+  Random rng;
+  rng.SetSeed(8765);
+
+  const glm::mat4 viewProjection = makeRandomViewProjection(rng, false);
+  const Frustum frustum = extractFrustum(viewProjection);
+
+  Timer timer;
+  timer.init();
+
+  const uint32_t counts[] = {10000, 100000, 1000000};
+  for (uint32_t count : counts)
+  {
+    CullingBounds bounds;
+    makeRandomBounds(rng, count, bounds);
+    std::vector<uint32_t> visible(count);
+
+    using CullFunction = uint32_t (*)(const CullingBounds&, const Frustum&, uint32_t*);
+    const CullFunction functions[] = {cullScalar, cullSSE, cullAVX};
+    const uint32_t numFunctions = isAVXSupported() ? 3 : 2;
+    double milliseconds[3] = {};
+    uint32_t numVisible = 0;
+    for (uint32_t f = 0; f < numFunctions; ++f)
+    {
+      timer.update();
+      for (uint32_t iteration = 0; iteration < p_NumIterations; ++iteration)
+        numVisible = functions[f](bounds, frustum, visible.data());
+      timer.update();
+      milliseconds[f] = timer.m_DeltaMillisecondsD / p_NumIterations;
+    }
+
+    writeLog(
+        "FrustumCulling::benchmark: %u boxes, %u visible, scalar %.3f ms, SSE %.3f ms (%.1fx), "
+        "AVX %.3f ms (%.1fx)",
+        count,
+        numVisible,
+        milliseconds[0],
+        milliseconds[1],
+        milliseconds[0] / milliseconds[1],
+        milliseconds[2],
+        milliseconds[2] > 0.0 ? milliseconds[0] / milliseconds[2] : 0.0);
+  }
+}
+//---------------------------------------------------------------------------//
+} // namespace FrustumCulling
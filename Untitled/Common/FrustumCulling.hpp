@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Utility.hpp"
+
+class Mesh;
+
+//---------------------------------------------------------------------------//
+// Normalized planes pointing inwards, a point p is inside when
+// dot(plane.xyz, p) + plane.w >= 0 holds for all of them
+struct Frustum
+{
+  glm::vec4 planes[6];
+};
+//---------------------------------------------------------------------------//
+// Axis-aligned boxes in structure-of-arrays layout (center and half extent per axis), so the
+// SIMD paths load one component of 4 or 8 boxes at a time
+struct CullingBounds
+{
+  std::vector<float> centerX;
+  std::vector<float> centerY;
+  std::vector<float> centerZ;
+  std::vector<float> extentX;
+  std::vector<float> extentY;
+  std::vector<float> extentZ;
+
+  // Mesh::AABBMin()/AABBMax() of every mesh, Mesh::m_BoundingSphere is only filled in on the
+  // GpuDrivenRenderer's copies so the boxes are the only bounds available here
+  void init(const std::vector<Mesh>& p_Meshes);
+  void init(const glm::vec3* p_AabbMins, const glm::vec3* p_AabbMaxs, uint32_t p_Count);
+
+  uint32_t count() const { return uint32_t(centerX.size()); }
+};
+//---------------------------------------------------------------------------//
+namespace FrustumCulling
+{
+
+// Planes of a CameraBase::ViewProjectionMatrix(), which is stored transposed so its columns are
+// the rows of the clip space transform. Works for perspective and orthographic projections.
+Frustum extractFrustum(const glm::mat4& p_ViewProjection);
+
+// Single box given by center and half extent, same test as the batched paths
+bool testBox(const Frustum& p_Frustum, const glm::vec3& p_Center, const glm::vec3& p_Extent);
+
+// Write the indices of the boxes that aren't fully outside one of the planes to p_Visible in
+// ascending order and return how many there are. p_Visible needs room for count() indices.
+uint32_t cullScalar(const CullingBounds& p_Bounds, const Frustum& p_Frustum, uint32_t* p_Visible);
+uint32_t cullSSE(const CullingBounds& p_Bounds, const Frustum& p_Frustum, uint32_t* p_Visible);
+uint32_t cullAVX(const CullingBounds& p_Bounds, const Frustum& p_Frustum, uint32_t* p_Visible);
+
+// AVX when the CPU and OS support it, SSE otherwise
+uint32_t cull(const CullingBounds& p_Bounds, const Frustum& p_Frustum, uint32_t* p_Visible);
+bool isAVXSupported();
+
+// Headless comparison of the SIMD paths with the scalar reference, and of the scalar reference
+// with a box corner test, on random boxes and cameras. Results go to the debug output.
+bool validate(uint32_t p_NumBoxes = 100000);
+
+// Headless timing of the three paths on 10k to 1M random boxes
+void benchmark(uint32_t p_NumIterations = 16);
+
+} // namespace FrustumCulling
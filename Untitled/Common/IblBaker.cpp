@@ -0,0 +1,732 @@
+#include "IblBaker.hpp"
+#include "Half.hpp"
+#include "Sampling.hpp"
+#include "Timer.hpp"
+#include "WorkerPool.hpp"
+
+//---------------------------------------------------------------------------//
+// Internal
+//---------------------------------------------------------------------------//
+// Cube map rows a job grabs at a time
+static constexpr uint32_t RowGranularity = 2;
+// Rougher than alpha 0 so the GGX pdf stays finite
+static constexpr float MinAlpha = 0.001f;
+
+// A GGX sample in the tangent frame of N = V, the same for every texel of a mip
+struct PrefilterSample
+{
+  glm::vec3 direction;
+  // n.l
+  float weight;
+  // Source mip the sample reads
+  float lod;
+};
+//---------------------------------------------------------------------------//
+static uint32_t fullMipCount(uint32_t p_Resolution)
+{
+  uint32_t count = 1;
+  while ((p_Resolution >> count) != 0)
+    ++count;
+  return count;
+}
+//---------------------------------------------------------------------------//
+static const glm::vec4&
+texel(const TextureData<glm::vec4>& p_Mip, uint32_t p_Face, uint32_t p_X, uint32_t p_Y)
+{
+  return p_Mip.Texels[(p_Face * p_Mip.Height + p_Y) * p_Mip.Width + p_X];
+}
+//---------------------------------------------------------------------------//
+// Relative solid angle of a texel, as in ProjectCubemapToSH()
+static float texelWeight(uint32_t p_X, uint32_t p_Y, uint32_t p_Resolution)
+{
+  const float u = ((p_X + 0.5f) / p_Resolution) * 2.0f - 1.0f;
+  const float v = ((p_Y + 0.5f) / p_Resolution) * 2.0f - 1.0f;
+  const float temp = 1.0f + u * u + v * v;
+  return 4.0f / (std::sqrt(temp) * temp);
+}
+//---------------------------------------------------------------------------//
+// Inverse of mapXYSToDirection(), to continuous texel coordinates of the face
+static void directionToTexel(
+    const glm::vec3& p_Direction,
+    uint32_t p_Resolution,
+    uint32_t& p_Face,
+    float& p_X,
+    float& p_Y)
+{
+  const glm::vec3 a = glm::abs(p_Direction);
+  float u;
+  float v;
+  float ma;
+  if (a.x >= a.y && a.x >= a.z)
+  {
+    ma = a.x;
+    p_Face = p_Direction.x > 0.0f ? 0 : 1;
+    u = p_Direction.x > 0.0f ? -p_Direction.z : p_Direction.z;
+    v = p_Direction.y;
+  }
+  else if (a.y >= a.z)
+  {
+    ma = a.y;
+    p_Face = p_Direction.y > 0.0f ? 2 : 3;
+    u = p_Direction.x;
+    v = p_Direction.y > 0.0f ? -p_Direction.z : p_Direction.z;
+  }
+  else
+  {
+    ma = a.z;
+    p_Face = p_Direction.z > 0.0f ? 4 : 5;
+    u = p_Direction.z > 0.0f ? p_Direction.x : -p_Direction.x;
+    v = p_Direction.y;
+  }
+
+  u /= ma;
+  v /= ma;
+  p_X = (u + 1.0f) * 0.5f * p_Resolution - 0.5f;
+  p_Y = (1.0f - v) * 0.5f * p_Resolution - 0.5f;
+}
+//---------------------------------------------------------------------------//
+// Bilinear within the face, clamped to its edges
+static glm::vec3
+sampleFace(const TextureData<glm::vec4>& p_Mip, uint32_t p_Face, float p_X, float p_Y)
+{
+  const float maxCoordinate = float(p_Mip.Width - 1);
+  const float x = _clamp(p_X, 0.0f, maxCoordinate);
+  const float y = _clamp(p_Y, 0.0f, maxCoordinate);
+  const uint32_t x0 = uint32_t(x);
+  const uint32_t y0 = uint32_t(y);
+  const uint32_t x1 = std::min(x0 + 1, p_Mip.Width - 1);
+  const uint32_t y1 = std::min(y0 + 1, p_Mip.Width - 1);
+  const float fx = x - float(x0);
+  const float fy = y - float(y0);
+
+  const glm::vec3 top = glm::mix(
+      glm::vec3(texel(p_Mip, p_Face, x0, y0)), glm::vec3(texel(p_Mip, p_Face, x1, y0)), fx);
+  const glm::vec3 bottom = glm::mix(
+      glm::vec3(texel(p_Mip, p_Face, x0, y1)), glm::vec3(texel(p_Mip, p_Face, x1, y1)), fx);
+  return glm::mix(top, bottom, fy);
+}
+//---------------------------------------------------------------------------//
+static glm::vec3 sampleCube(
+    const std::vector<TextureData<glm::vec4>>& p_Mips,
+    const glm::vec3& p_Direction,
+    float p_Lod)
+{
+  const uint32_t mip0 = std::min(uint32_t(p_Lod), uint32_t(p_Mips.size() - 1));
+  const uint32_t mip1 = std::min(mip0 + 1, uint32_t(p_Mips.size() - 1));
+  const float fraction = p_Lod - float(mip0);
+
+  uint32_t face;
+  float x;
+  float y;
+  directionToTexel(p_Direction, p_Mips[mip0].Width, face, x, y);
+  const glm::vec3 color0 = sampleFace(p_Mips[mip0], face, x, y);
+  if (mip1 == mip0 || fraction <= 0.0f)
+    return color0;
+
+  directionToTexel(p_Direction, p_Mips[mip1].Width, face, x, y);
+  return glm::mix(color0, sampleFace(p_Mips[mip1], face, x, y), fraction);
+}
+//---------------------------------------------------------------------------//
+// 2x2 box filter of every face
+static void downsample(const TextureData<glm::vec4>& p_Source, TextureData<glm::vec4>& p_Mip)
+{
+  const uint32_t resolution = std::max(p_Source.Width / 2, 1u);
+  const uint32_t last = p_Source.Width - 1;
+  p_Mip.init(resolution, resolution, 6);
+  for (uint32_t face = 0; face < 6; ++face)
+  {
+    for (uint32_t y = 0; y < resolution; ++y)
+    {
+      for (uint32_t x = 0; x < resolution; ++x)
+      {
+        const uint32_t x0 = std::min(x * 2, last);
+        const uint32_t y0 = std::min(y * 2, last);
+        const uint32_t x1 = std::min(x * 2 + 1, last);
+        const uint32_t y1 = std::min(y * 2 + 1, last);
+        p_Mip.Texels[(face * resolution + y) * resolution + x] =
+            (texel(p_Source, face, x0, y0) + texel(p_Source, face, x1, y0) +
+             texel(p_Source, face, x0, y1) + texel(p_Source, face, x1, y1)) *
+            0.25f;
+      }
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// Any unit vector's tangent frame, GGX is isotropic
+static glm::mat3 tangentFrame(const glm::vec3& p_Normal)
+{
+  const glm::vec3 up =
+      std::abs(p_Normal.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+  const glm::vec3 tangent = glm::normalize(glm::cross(up, p_Normal));
+  return glm::mat3(tangent, glm::cross(p_Normal, tangent), p_Normal);
+}
+//---------------------------------------------------------------------------//
+static void makePrefilterSamples(
+    float p_Roughness,
+    uint32_t p_NumSamples,
+    uint32_t p_SourceResolution,
+    uint32_t p_NumSourceMips,
+    std::vector<PrefilterSample>& p_Samples)
+{
+  const float alpha = std::max(p_Roughness * p_Roughness, MinAlpha);
+  const glm::vec3 n = glm::vec3(0.0f, 0.0f, 1.0f);
+  const float texelSolidAngle = 4.0f * Pi / (6.0f * p_SourceResolution * p_SourceResolution);
+
+  p_Samples.clear();
+  for (uint32_t i = 0; i < p_NumSamples; ++i)
+  {
+    const glm::vec2 u = Hammersley2D(i, p_NumSamples);
+    const glm::vec3 l = SampleDirectionGGX(n, n, alpha, glm::mat3(1.0f), u.x, u.y);
+    if (l.z <= 0.0f)
+      continue;
+
+    // The mip whose texels cover the sample's solid angle (GPU Gems 3, chapter 20). The extra
+    // mip of bias suggested there blurs the sun of a sky well past the GGX lobe.
+    const glm::vec3 h = glm::normalize(n + l);
+    const float pdf = SampleDirectionGGX_PDF(n, h, n, alpha);
+    const float sampleSolidAngle = 1.0f / (p_NumSamples * pdf);
+    const float lod = 0.5f * std::log2(sampleSolidAngle / texelSolidAngle);
+
+    PrefilterSample sample;
+    sample.direction = l;
+    sample.weight = l.z;
+    sample.lod = _clamp(lod, 0.0f, float(p_NumSourceMips - 1));
+    p_Samples.push_back(sample);
+  }
+}
+//---------------------------------------------------------------------------//
+static void prefilterRow(
+    const std::vector<TextureData<glm::vec4>>& p_Source,
+    const std::vector<PrefilterSample>& p_Samples,
+    uint32_t p_Face,
+    uint32_t p_Y,
+    TextureData<glm::vec4>& p_Mip)
+{
+  const uint32_t resolution = p_Mip.Width;
+  for (uint32_t x = 0; x < resolution; ++x)
+  {
+    const glm::vec3 n = mapXYSToDirection(x, p_Y, p_Face, resolution, resolution);
+    const glm::mat3 tangentToWorld = tangentFrame(n);
+
+    glm::vec3 sum = glm::vec3(0.0f);
+    float weightSum = 0.0f;
+    for (const PrefilterSample& sample : p_Samples)
+    {
+      sum += sampleCube(p_Source, tangentToWorld * sample.direction, sample.lod) * sample.weight;
+      weightSum += sample.weight;
+    }
+
+    p_Mip.Texels[(p_Face * resolution + p_Y) * resolution + x] =
+        glm::vec4(sum / std::max(weightSum, 1e-6f), 1.0f);
+  }
+}
+//---------------------------------------------------------------------------//
+static void runJobs(uint32_t p_Count, const WorkerPool::JobFunction& p_Job, WorkerPool* p_Pool)
+{
+  if (p_Pool != nullptr)
+  {
+    p_Pool->parallelFor(p_Count, p_Job, RowGranularity);
+    return;
+  }
+  for (uint32_t i = 0; i < p_Count; ++i)
+    p_Job(i);
+}
+//---------------------------------------------------------------------------//
+// Mips of a cube map DDS converted to RGBA32F
+static bool loadFloatCubeMap(const wchar_t* p_FilePath, DirectX::ScratchImage& p_Image)
+{
+  DirectX::ScratchImage image;
+  if (FAILED(DirectX::LoadFromDDSFile(p_FilePath, DirectX::DDS_FLAGS_NONE, nullptr, image)))
+  {
+    writeLog("Failed to load cube map '%ls'", p_FilePath);
+    return false;
+  }
+
+  const DirectX::TexMetadata& metadata = image.GetMetadata();
+  if (metadata.IsCubemap() == false || metadata.arraySize != 6 ||
+      metadata.width != metadata.height)
+  {
+    writeLog("'%ls' isn't a single square cube map", p_FilePath);
+    return false;
+  }
+
+  const DXGI_FORMAT format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+  HRESULT result = S_OK;
+  if (metadata.format == format)
+  {
+    p_Image = std::move(image);
+  }
+  else if (DirectX::IsCompressed(metadata.format))
+  {
+    result = DirectX::Decompress(
+        image.GetImages(), image.GetImageCount(), metadata, format, p_Image);
+  }
+  else
+  {
+    result = DirectX::Convert(
+        image.GetImages(),
+        image.GetImageCount(),
+        metadata,
+        format,
+        DirectX::TEX_FILTER_DEFAULT,
+        DirectX::TEX_THRESHOLD_DEFAULT,
+        p_Image);
+  }
+
+  if (FAILED(result))
+  {
+    writeLog("Failed to convert cube map '%ls'", p_FilePath);
+    return false;
+  }
+  return true;
+}
+//---------------------------------------------------------------------------//
+static void
+readMip(const DirectX::ScratchImage& p_Image, uint32_t p_Mip, TextureData<glm::vec4>& p_Data)
+{
+  const uint32_t resolution = uint32_t(p_Image.GetMetadata().width >> p_Mip);
+  p_Data.init(resolution, resolution, 6);
+  for (uint32_t face = 0; face < 6; ++face)
+  {
+    const DirectX::Image* image = p_Image.GetImage(p_Mip, face, 0);
+    for (uint32_t y = 0; y < resolution; ++y)
+    {
+      memcpy(
+          &p_Data.Texels[(face * resolution + y) * resolution],
+          image->pixels + y * image->rowPitch,
+          resolution * sizeof(glm::vec4));
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// IblBaker
+//---------------------------------------------------------------------------//
+void IblBaker::bake(
+    const TextureData<glm::vec4>& p_Source,
+    const IblBakeSettings& p_Settings,
+    WorkerPool* p_Pool)
+{
+  assert(p_Source.NumSlices == 6 && p_Source.Width == p_Source.Height && p_Source.Width > 0);
+
+  // Box filtered source mips for the samples to read from
+  const uint32_t numSourceMips = fullMipCount(p_Source.Width);
+  std::vector<TextureData<glm::vec4>> source(numSourceMips);
+  source[0] = p_Source;
+  for (uint32_t mip = 1; mip < numSourceMips; ++mip)
+    downsample(source[mip - 1], source[mip]);
+
+  const uint32_t numMips = _clamp(p_Settings.NumMips, 1u, numSourceMips);
+  m_Mips.resize(numMips);
+  m_Mips[0] = p_Source;
+
+  // One job per row of a face of a prefiltered mip
+  std::vector<std::vector<PrefilterSample>> samples(numMips);
+  std::vector<uint32_t> firstRows(numMips + 1, 0);
+  for (uint32_t mip = 1; mip < numMips; ++mip)
+  {
+    const uint32_t resolution = std::max(p_Source.Width >> mip, 1u);
+    m_Mips[mip].init(resolution, resolution, 6);
+    const float roughness = float(mip) / float(numMips - 1);
+    makePrefilterSamples(
+        roughness, p_Settings.NumSamples, p_Source.Width, numSourceMips, samples[mip]);
+    firstRows[mip + 1] = firstRows[mip] + resolution * 6;
+  }
+
+  WorkerPool::JobFunction prefilter = [&](uint32_t p_Row) {
+    uint32_t mip = 1;
+    while (p_Row >= firstRows[mip + 1])
+      ++mip;
+    const uint32_t row = p_Row - firstRows[mip];
+    const uint32_t resolution = m_Mips[mip].Width;
+    prefilterRow(source, samples[mip], row / resolution, row % resolution, m_Mips[mip]);
+  };
+  runJobs(firstRows[numMips], prefilter, p_Pool);
+
+  projectIrradiance(p_Pool);
+}
+//---------------------------------------------------------------------------//
+void IblBaker::init(
+    const wchar_t* p_FilePath,
+    const TextureData<glm::vec4>& p_Source,
+    const IblBakeSettings& p_Settings,
+    WorkerPool* p_Pool)
+{
+  const uint32_t expectedMips = _clamp(p_Settings.NumMips, 1u, fullMipCount(p_Source.Width));
+  if (fileExists(p_FilePath) && load(p_FilePath, p_Pool) && resolution() == p_Source.Width &&
+      numMips() == expectedMips)
+    return;
+
+  Timer timer;
+  timer.init();
+  timer.update();
+  bake(p_Source, p_Settings, p_Pool);
+  timer.update();
+  writeLog("Baked IBL '%ls' in %.1f ms", p_FilePath, timer.m_DeltaMillisecondsD);
+
+  save(p_FilePath);
+}
+//---------------------------------------------------------------------------//
+void IblBaker::deinit()
+{
+  m_Mips.clear();
+  m_SH = SH9Color();
+  m_IrradianceH4 = H4Color();
+}
+//---------------------------------------------------------------------------//
+bool IblBaker::save(const wchar_t* p_FilePath) const
+{
+  assert(valid());
+
+  DirectX::ScratchImage image;
+  if (FAILED(image.InitializeCube(
+          DXGI_FORMAT_R16G16B16A16_FLOAT, resolution(), resolution(), 1, numMips())))
+  {
+    writeLog("Failed to write IBL '%ls'", p_FilePath);
+    return false;
+  }
+
+  for (uint32_t mip = 0; mip < numMips(); ++mip)
+  {
+    const TextureData<glm::vec4>& data = m_Mips[mip];
+    for (uint32_t face = 0; face < 6; ++face)
+    {
+      const DirectX::Image* faceImage = image.GetImage(mip, face, 0);
+      for (uint32_t y = 0; y < data.Height; ++y)
+      {
+        Half4* row = reinterpret_cast<Half4*>(faceImage->pixels + y * faceImage->rowPitch);
+        for (uint32_t x = 0; x < data.Width; ++x)
+          row[x] = Half4(texel(data, face, x, y));
+      }
+    }
+  }
+
+  if (FAILED(DirectX::SaveToDDSFile(
+          image.GetImages(),
+          image.GetImageCount(),
+          image.GetMetadata(),
+          DirectX::DDS_FLAGS_NONE,
+          p_FilePath)))
+  {
+    writeLog("Failed to write IBL '%ls'", p_FilePath);
+    return false;
+  }
+  return true;
+}
+//---------------------------------------------------------------------------//
+bool IblBaker::load(const wchar_t* p_FilePath, WorkerPool* p_Pool)
+{
+  DirectX::ScratchImage image;
+  if (loadFloatCubeMap(p_FilePath, image) == false)
+    return false;
+
+  m_Mips.resize(image.GetMetadata().mipLevels);
+  for (uint32_t mip = 0; mip < numMips(); ++mip)
+    readMip(image, mip, m_Mips[mip]);
+
+  projectIrradiance(p_Pool);
+  return true;
+}
+//---------------------------------------------------------------------------//
+void IblBaker::projectIrradiance(WorkerPool* p_Pool)
+{
+  m_SH = ProjectCubemapToSH(m_Mips[0], p_Pool);
+
+  // Cosine convolved, then per channel to the H-basis
+  SH9 irradiance[3];
+  for (uint64_t i = 0; i < 9; ++i)
+  {
+    const float cosineLobe = i == 0 ? CosineA0 : (i < 4 ? CosineA1 : CosineA2);
+    for (uint32_t channel = 0; channel < 3; ++channel)
+      irradiance[channel].Coefficients[i] = m_SH.Coefficients[i][channel] * cosineLobe;
+  }
+  for (uint32_t channel = 0; channel < 3; ++channel)
+  {
+    const H4 h4 = ConvertToH4(irradiance[channel]);
+    for (uint64_t i = 0; i < 4; ++i)
+      m_IrradianceH4.Coefficients[i][channel] = h4.Coefficients[i];
+  }
+}
+//---------------------------------------------------------------------------//
+bool IblBaker::loadCubeMap(const wchar_t* p_FilePath, TextureData<glm::vec4>& p_CubeMap)
+{
+  DirectX::ScratchImage image;
+  if (loadFloatCubeMap(p_FilePath, image) == false)
+    return false;
+
+  readMip(image, 0, p_CubeMap);
+  return true;
+}
+//---------------------------------------------------------------------------//
+void IblBaker::convertCubeMap(
+    const Half4* p_Texels,
+    uint32_t p_Resolution,
+    TextureData<glm::vec4>& p_CubeMap)
+{
+  p_CubeMap.init(p_Resolution, p_Resolution, 6);
+  for (size_t i = 0; i < p_CubeMap.Texels.size(); ++i)
+    p_CubeMap.Texels[i] = glm::vec4(p_Texels[i].ToFloat3(), 1.0f);
+}
+//---------------------------------------------------------------------------//
+//---------------------------------------------------------------------------//
+// Validation
+//---------------------------------------------------------------------------//
+static constexpr uint32_t TestResolution = 64;
+static constexpr uint32_t NumTestTexels = 48;
+
+// A sky gradient over a dark ground and a soft sun, smooth enough for the brute force sums over
+// the texels to converge at the smallest roughness
+static glm::vec3 testRadiance(const glm::vec3& p_Direction)
+{
+  const glm::vec3 sunDirection = glm::normalize(glm::vec3(0.4f, 0.5f, 0.3f));
+  const glm::vec3 ground = glm::vec3(0.10f, 0.08f, 0.05f);
+  const glm::vec3 sky = glm::vec3(0.3f, 0.5f, 1.0f) * (0.5f + 0.5f * std::max(p_Direction.y, 0.0f));
+  const float horizon = saturate(p_Direction.y * 10.0f + 0.5f);
+  const float sun = std::exp(60.0f * (glm::dot(p_Direction, sunDirection) - 1.0f));
+  return glm::mix(ground, sky, horizon) + glm::vec3(20.0f, 16.0f, 12.0f) * sun;
+}
+//---------------------------------------------------------------------------//
+static void makeTestCubeMap(uint32_t p_Resolution, TextureData<glm::vec4>& p_CubeMap)
+{
+  p_CubeMap.init(p_Resolution, p_Resolution, 6);
+  for (uint32_t face = 0; face < 6; ++face)
+  {
+    for (uint32_t y = 0; y < p_Resolution; ++y)
+    {
+      for (uint32_t x = 0; x < p_Resolution; ++x)
+      {
+        const glm::vec3 dir = mapXYSToDirection(x, y, face, p_Resolution, p_Resolution);
+        p_CubeMap.Texels[(face * p_Resolution + y) * p_Resolution + x] =
+            glm::vec4(testRadiance(dir), 1.0f);
+      }
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// The integral the prefiltered texels estimate: radiance weighted by D(h) * n.l over the sphere,
+// summed over every source texel
+static glm::vec3 bruteForcePrefilter(
+    const TextureData<glm::vec4>& p_Source,
+    const glm::vec3& p_Normal,
+    float p_Roughness)
+{
+  const double alpha = std::max(p_Roughness * p_Roughness, MinAlpha);
+  const double alpha2 = alpha * alpha;
+  glm::dvec3 sum = glm::dvec3(0.0);
+  double weightSum = 0.0;
+  for (uint32_t face = 0; face < 6; ++face)
+  {
+    for (uint32_t y = 0; y < p_Source.Height; ++y)
+    {
+      for (uint32_t x = 0; x < p_Source.Width; ++x)
+      {
+        const glm::vec3 dir = mapXYSToDirection(x, y, face, p_Source.Width, p_Source.Height);
+        const double nDotL = glm::dot(p_Normal, dir);
+        if (nDotL <= 0.0)
+          continue;
+
+        const double nDotH = glm::dot(p_Normal, glm::normalize(p_Normal + dir));
+        const double d = alpha2 / (Pi * square(nDotH * nDotH * (alpha2 - 1.0) + 1.0));
+        const double weight = d * nDotL * texelWeight(x, y, p_Source.Width);
+        sum += glm::dvec3(texel(p_Source, face, x, y)) * weight;
+        weightSum += weight;
+      }
+    }
+  }
+  return glm::vec3(sum / weightSum);
+}
+//---------------------------------------------------------------------------//
+// Cosine weighted sum over every source texel
+static glm::vec3
+bruteForceIrradiance(const TextureData<glm::vec4>& p_Source, const glm::vec3& p_Normal)
+{
+  glm::dvec3 sum = glm::dvec3(0.0);
+  double weightSum = 0.0;
+  for (uint32_t face = 0; face < 6; ++face)
+  {
+    for (uint32_t y = 0; y < p_Source.Height; ++y)
+    {
+      for (uint32_t x = 0; x < p_Source.Width; ++x)
+      {
+        const glm::vec3 dir = mapXYSToDirection(x, y, face, p_Source.Width, p_Source.Height);
+        const double nDotL = std::max(double(glm::dot(p_Normal, dir)), 0.0);
+        const double weight = texelWeight(x, y, p_Source.Width);
+        sum += glm::dvec3(texel(p_Source, face, x, y)) * (nDotL * weight);
+        weightSum += weight;
+      }
+    }
+  }
+  return glm::vec3(sum * (4.0 * Pi / weightSum));
+}
+//---------------------------------------------------------------------------//
+// Error relative to the brightest channel of the expected color
+static float relativeError(const glm::vec3& p_Value, const glm::vec3& p_Expected)
+{
+  const glm::vec3 error = glm::abs(p_Value - p_Expected);
+  const float peak = std::max(std::max(p_Expected.x, p_Expected.y), std::max(p_Expected.z, 1e-6f));
+  return std::max(std::max(error.x, error.y), error.z) / peak;
+}
+//---------------------------------------------------------------------------//
+bool IblBaker::validate()
+{
+  bool passed = true;
+  Random rng;
+  rng.SetSeed(9753);
+
+  TextureData<glm::vec4> source;
+  makeTestCubeMap(TestResolution, source);
+
+  IblBaker baker;
+  baker.bake(source, IblBakeSettings(), &getWorkerPool());
+
+  // Results don't depend on the pool
+  IblBaker serialBaker;
+  serialBaker.bake(source, IblBakeSettings(), nullptr);
+  for (uint32_t mip = 0; mip < baker.numMips(); ++mip)
+  {
+    if (baker.mip(mip).Texels != serialBaker.mip(mip).Texels)
+    {
+      writeLog("IblBaker::validate: mip %u differs on the pool", mip);
+      passed = false;
+    }
+  }
+
+  // Random texels of every prefiltered mip against the brute force sums
+  for (uint32_t mip = 1; mip < baker.numMips(); ++mip)
+  {
+    const TextureData<glm::vec4>& data = baker.mip(mip);
+    const float roughness = float(mip) / float(baker.numMips() - 1);
+    float maxError = 0.0f;
+    float sumError = 0.0f;
+    for (uint32_t i = 0; i < NumTestTexels; ++i)
+    {
+      const uint32_t face = rng.RandomUint() % 6;
+      const uint32_t x = rng.RandomUint() % data.Width;
+      const uint32_t y = rng.RandomUint() % data.Height;
+      const glm::vec3 n = mapXYSToDirection(x, y, face, data.Width, data.Height);
+      const glm::vec3 expected = bruteForcePrefilter(source, n, roughness);
+      const float error = relativeError(glm::vec3(texel(data, face, x, y)), expected);
+      maxError = std::max(maxError, error);
+      sumError += error;
+    }
+
+    // Reading the samples from box filtered mips blurs the sun a bit differently than the exact
+    // lobe, a few texels next to it are off by around 10%
+    const bool mipPassed = sumError / NumTestTexels < 0.05f && maxError < 0.15f;
+    passed &= mipPassed;
+    writeLog(
+        "IblBaker::validate: %s, mip %u (%ux%u, roughness %.2f) error mean %.4f max %.4f",
+        mipPassed ? "passed" : "FAILED",
+        mip,
+        data.Width,
+        data.Height,
+        roughness,
+        sumError / NumTestTexels,
+        maxError);
+  }
+
+  // SH against the serial projection, and its irradiance against the brute force cosine sums
+  const SH9Color serialSH = ProjectCubemapToSH(source, nullptr);
+  const float shPeak = std::max(std::max(serialSH[0].x, serialSH[0].y), serialSH[0].z);
+  float maxSHError = 0.0f;
+  for (uint64_t i = 0; i < 9; ++i)
+  {
+    const glm::vec3 error = glm::abs(baker.sh()[i] - serialSH[i]);
+    maxSHError = std::max(maxSHError, std::max(std::max(error.x, error.y), error.z) / shPeak);
+  }
+
+  // Relative to the brightest irradiance, nine coefficients can't follow the sun into the dim
+  // directions facing away from it. The H4 only covers the +z hemisphere with four.
+  H4 h4[3];
+  for (uint32_t channel = 0; channel < 3; ++channel)
+    for (uint64_t i = 0; i < 4; ++i)
+      h4[channel].Coefficients[i] = baker.irradianceH4().Coefficients[i][channel];
+
+  float maxIrradianceError = 0.0f;
+  float maxH4Error = 0.0f;
+  float maxIrradiance = 0.0f;
+  for (uint32_t i = 0; i < NumTestTexels; ++i)
+  {
+    glm::vec3 n = SampleDirectionSphere(rng.RandomFloat(), rng.RandomFloat());
+    n.z = i % 2 == 0 ? std::abs(n.z) : n.z;
+    const glm::vec3 expected = bruteForceIrradiance(source, n);
+    maxIrradiance = std::max(maxIrradiance, std::max(std::max(expected.x, expected.y), expected.z));
+
+    const glm::vec3 error = glm::abs(EvalSH9Irradiance(n, baker.sh()) - expected);
+    maxIrradianceError =
+        std::max(maxIrradianceError, std::max(std::max(error.x, error.y), error.z));
+    if (n.z > 0.0f)
+    {
+      for (uint32_t channel = 0; channel < 3; ++channel)
+        maxH4Error = std::max(maxH4Error, std::abs(EvalH4(h4[channel], n) - expected[channel]));
+    }
+  }
+  maxIrradianceError /= maxIrradiance;
+  maxH4Error /= maxIrradiance;
+
+  const bool shPassed = maxSHError < 1e-4f && maxIrradianceError < 0.05f && maxH4Error < 0.2f;
+  passed &= shPassed;
+  writeLog(
+      "IblBaker::validate: %s, SH error %.6f, SH irradiance error max %.4f, H4 irradiance error "
+      "max %.4f",
+      shPassed ? "passed" : "FAILED",
+      maxSHError,
+      maxIrradianceError,
+      maxH4Error);
+  return passed;
+}
+//---------------------------------------------------------------------------//
+void IblBaker::benchmark()
+{
+  Timer timer;
+  timer.init();
+
+  const uint32_t resolutions[] = {64, 128};
+  for (uint32_t resolution : resolutions)
+  {
+    TextureData<glm::vec4> source;
+    makeTestCubeMap(resolution, source);
+
+    IblBaker baker;
+    timer.update();
+    baker.bake(source, IblBakeSettings(), nullptr);
+    timer.update();
+    const double serialTime = timer.m_DeltaMillisecondsD;
+
+    timer.update();
+    baker.bake(source, IblBakeSettings(), &getWorkerPool());
+    timer.update();
+    const double threadedTime = timer.m_DeltaMillisecondsD;
+
+    timer.update();
+    const SH9Color sh = ProjectCubemapToSH(source, &getWorkerPool());
+    timer.update();
+    const double shTime = timer.m_DeltaMillisecondsD;
+
+    // Brute force over every source texel for a few texels, extrapolated to the whole chain
+    uint32_t numTexels = 0;
+    for (uint32_t mip = 1; mip < baker.numMips(); ++mip)
+      numTexels += baker.mip(mip).Width * baker.mip(mip).Height * 6;
+    const uint32_t numBruteForce = 16;
+    glm::vec3 sum = sh[0];
+    timer.update();
+    for (uint32_t i = 0; i < numBruteForce; ++i)
+      sum += bruteForcePrefilter(source, mapXYSToDirection(i, 0, 4, numBruteForce, 1), 0.5f);
+    timer.update();
+    const double bruteForceTime = timer.m_DeltaMillisecondsD / numBruteForce * numTexels;
+
+    writeLog(
+        "IblBaker::benchmark: %ux%u, %u mips, %u samples, %.1f ms, on %u threads %.1f ms, SH %.2f "
+        "ms, brute force about %.0f ms (%.0fx) [%f]",
+        resolution,
+        resolution,
+        baker.numMips(),
+        IblBakeSettings().NumSamples,
+        serialTime,
+        getWorkerPool().numThreads(),
+        threadedTime,
+        shTime,
+        bruteForceTime,
+        bruteForceTime / threadedTime,
+        sum.x);
+  }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "Model.hpp"
+#include "SphericalHarmonics.hpp"
+
+struct Half4;
+struct WorkerPool;
+
+//---------------------------------------------------------------------------//
+struct IblBakeSettings
+{
+  // Mips of the specular cube map, clamped to the full chain of the source
+  uint32_t NumMips = 6;
+  // GGX samples per texel of the rough mips
+  uint32_t NumSamples = 256;
+};
+//---------------------------------------------------------------------------//
+// Environment lighting baked on the CPU from any radiance cube map (the sky's or a DDS): a mip
+// chain of GGX prefiltered radiance for split sum specular, and the SH9 and H4 irradiance.
+//
+// Mip m holds perceptual roughness m / (NumMips - 1), GGX alpha is its square, and mip 0 is the
+// source itself. Texels are prefiltered assuming N = V = R, so every texel importance samples the
+// same GGX directions (Hammersley2D() and SampleDirectionGGX()) in its own tangent frame. Each
+// sample reads the source mip whose texels cover the sample's solid angle 1 / (N * pdf), which
+// lets a few hundred samples stand in for the whole source a plain sum would read.
+// Faces are filtered on their own, there's no filtering across the seams.
+//
+// Rows of every face and mip are spread over the worker pool and the result doesn't depend on
+// the thread count. The mips are cached as an RGBA16F cube map DDS, the SH are projected again
+// from mip 0 when it's loaded.
+//---------------------------------------------------------------------------//
+struct IblBaker
+{
+  // p_Pool null bakes on the calling thread
+  void bake(
+      const TextureData<glm::vec4>& p_Source,
+      const IblBakeSettings& p_Settings,
+      WorkerPool* p_Pool);
+  // Loads p_FilePath when it holds p_Source's resolution and the mips asked for, or bakes and
+  // writes it there. Name the file after the source, a changed source isn't detected.
+  void init(
+      const wchar_t* p_FilePath,
+      const TextureData<glm::vec4>& p_Source,
+      const IblBakeSettings& p_Settings,
+      WorkerPool* p_Pool);
+  void deinit();
+
+  bool save(const wchar_t* p_FilePath) const;
+  bool load(const wchar_t* p_FilePath, WorkerPool* p_Pool);
+
+  bool valid() const { return m_Mips.empty() == false; }
+  uint32_t resolution() const { return m_Mips.empty() ? 0 : m_Mips[0].Width; }
+  uint32_t numMips() const { return uint32_t(m_Mips.size()); }
+  const TextureData<glm::vec4>& mip(uint32_t p_Mip) const { return m_Mips[p_Mip]; }
+
+  // Radiance SH, for EvalSH9Irradiance() like SkyCache::sh
+  const SH9Color& sh() const { return m_SH; }
+  // Irradiance in the H-basis, i.e. over the hemisphere around +z
+  const H4Color& irradianceH4() const { return m_IrradianceH4; }
+
+  // Mip 0 of a cube map DDS in any format, as float
+  static bool loadCubeMap(const wchar_t* p_FilePath, TextureData<glm::vec4>& p_CubeMap);
+  // E.g. the texels of SkyCache::Compute()
+  static void
+  convertCubeMap(const Half4* p_Texels, uint32_t p_Resolution, TextureData<glm::vec4>& p_CubeMap);
+
+  // Headless checks of the prefiltered mips and the SH against brute force sums over the source.
+  // Results go to the debug output.
+  static bool validate();
+  // Headless timings of the bake and the SH projection next to brute force
+  static void benchmark();
+
+private:
+  void projectIrradiance(WorkerPool* p_Pool);
+
+  std::vector<TextureData<glm::vec4>> m_Mips;
+  SH9Color m_SH;
+  H4Color m_IrradianceH4;
+};
@@ -84,6 +84,26 @@ static void renderInternal()
 
     ImGui::Checkbox("Enable Sky", (bool*)&AppSettings::EnableSky);
 
+    ImGui::Checkbox("Enable Frustum Culling", (bool*)&AppSettings::EnableFrustumCulling);
+    ImGui::Checkbox("Use Mesh BVH", (bool*)&AppSettings::UseMeshBvh);
+    ImGui::Checkbox("Enable Occlusion Culling", (bool*)&AppSettings::EnableOcclusionCulling);
+    ImGui::Checkbox("Enable Software Occlusion", (bool*)&AppSettings::EnableSoftwareOcclusion);
+    ImGui::Checkbox("Auto Pick Occluders", (bool*)&AppSettings::AutoPickOccluders);
+    ImGui::SliderInt("Max Occluders", &AppSettings::MaxOccluders, 1, 64);
+
+    ImGui::Checkbox("Cache Spot Light Shadows", (bool*)&AppSettings::EnableSpotShadowCache);
+    ImGui::SliderInt("Spot Shadow Update Budget", &AppSettings::SpotShadowUpdateBudget, 0, 8);
+
+    ImGui::Text("Cluster Binning:");
+    ImGui::RadioButton("GPU", &AppSettings::ClusterBinningMode, AppSettings::ClusterBinning_GPU);
+    ImGui::SameLine();
+    ImGui::RadioButton("CPU", &AppSettings::ClusterBinningMode, AppSettings::ClusterBinning_CPU);
+    ImGui::SameLine();
+    ImGui::RadioButton(
+        "GPU, Checked On CPU",
+        &AppSettings::ClusterBinningMode,
+        AppSettings::ClusterBinning_GPUCheckedOnCPU);
+
     // Fog options:
     ImGui::Separator();
     if (ImGui::CollapsingHeader("Volumetric Fog", ImGuiTreeNodeFlags_DefaultOpen))
@@ -160,6 +180,20 @@ static void renderInternal()
         AppSettings::CameraPosition.y,
         AppSettings::CameraPosition.z);
 
+    if (AppSettings::EnableSky)
+      ImGui::Text(
+          "Sun shadow casters: %u / %u / %u / %u",
+          AppSettings::SunShadowCasters[0],
+          AppSettings::SunShadowCasters[1],
+          AppSettings::SunShadowCasters[2],
+          AppSettings::SunShadowCasters[3]);
+
+    if (AppSettings::EnableSoftwareOcclusion)
+      ImGui::Text(
+          "Software occluded meshes: %u (%.3f ms)",
+          AppSettings::SoftwareOccludedMeshes,
+          AppSettings::SoftwareOcclusionMs);
+
     ImGui::Text(
         "Application average %.3f ms/frame (%.1f FPS)",
         1000.0f / ImGui::GetIO().Framerate,
@@ -0,0 +1,579 @@
+#include "LightBounds.hpp"
+#include "Camera.hpp"
+#include "Sampling.hpp"
+#include "Timer.hpp"
+#include "WorkerPool.hpp"
+
+#include <immintrin.h>
+
+//---------------------------------------------------------------------------//
+// SpotLightBounds
+//---------------------------------------------------------------------------//
+void SpotLightBounds::resize(uint32_t p_Count)
+{
+  positionX.resize(p_Count);
+  positionY.resize(p_Count);
+  positionZ.resize(p_Count);
+  directionX.resize(p_Count);
+  directionY.resize(p_Count);
+  directionZ.resize(p_Count);
+  orientationX.resize(p_Count);
+  orientationY.resize(p_Count);
+  orientationZ.resize(p_Count);
+  orientationW.resize(p_Count);
+  radius.resize(p_Count);
+  range.resize(p_Count);
+  cosHalfAngle.resize(p_Count);
+  tanHalfAngle.resize(p_Count);
+}
+//---------------------------------------------------------------------------//
+void SpotLightBounds::set(
+    uint32_t p_Idx,
+    const glm::vec3& p_Position,
+    const glm::vec3& p_Direction,
+    const Quaternion& p_Orientation,
+    float p_Angle,
+    float p_Range,
+    float p_ScaleCorrection)
+{
+  positionX[p_Idx] = p_Position.x;
+  positionY[p_Idx] = p_Position.y;
+  positionZ[p_Idx] = p_Position.z;
+  directionX[p_Idx] = p_Direction.x;
+  directionY[p_Idx] = p_Direction.y;
+  directionZ[p_Idx] = p_Direction.z;
+  orientationX[p_Idx] = p_Orientation.x;
+  orientationY[p_Idx] = p_Orientation.y;
+  orientationZ[p_Idx] = p_Orientation.z;
+  orientationW[p_Idx] = p_Orientation.w;
+  radius[p_Idx] = std::tan(p_Angle / 2.0f) * p_Range * p_ScaleCorrection;
+  range[p_Idx] = p_Range;
+  cosHalfAngle[p_Idx] = std::cos(p_Angle * 0.5f);
+  tanHalfAngle[p_Idx] = std::sin(p_Angle * 0.5f) / cosHalfAngle[p_Idx];
+}
+//---------------------------------------------------------------------------//
+namespace LightBounds
+{
+//---------------------------------------------------------------------------//
+LightBoundsView makeView(const CameraBase& p_Camera, uint32_t p_NumZTiles)
+{
+  LightBoundsView view;
+  view.view = p_Camera.ViewMatrix();
+  view.nearClip = p_Camera.NearClip();
+  view.farClip = p_Camera.FarClip();
+  view.numZTiles = p_NumZTiles;
+
+  // Come up with a bounding sphere that surrounds the near clipping plane. We'll test this sphere
+  // for intersection with the spotlight's bounding cone and use that to over-estimate if the
+  // bounding geometry will end up getting clipped by the camera's near clipping plane
+  view.nearClipCenter = p_Camera.Position() + view.nearClip * p_Camera.Forward();
+  const glm::mat4 invViewProjection = glm::inverse(p_Camera.ViewProjectionMatrix());
+  const glm::vec3 nearTopRight =
+      _transformVec3Mat4(glm::vec3(1.0f, 1.0f, 0.0f), invViewProjection);
+  view.nearClipRadius = glm::length(nearTopRight - view.nearClipCenter);
+
+  return view;
+}
+//---------------------------------------------------------------------------//
+// Scalar reference
+//---------------------------------------------------------------------------//
+// View space Z range of the light's bounding cone from its vertices
+static void coneDepthRange(
+    const SpotLightBounds& p_Lights,
+    uint32_t p_Idx,
+    const LightBoundsView& p_View,
+    const std::vector<glm::vec3>& p_ConeVertices,
+    float& p_MinZ,
+    float& p_MaxZ)
+{
+  const glm::vec3 position =
+      glm::vec3(p_Lights.positionX[p_Idx], p_Lights.positionY[p_Idx], p_Lights.positionZ[p_Idx]);
+  const glm::vec3 scale =
+      glm::vec3(p_Lights.radius[p_Idx], p_Lights.radius[p_Idx], p_Lights.range[p_Idx]);
+  const Quaternion orientation = Quaternion(
+      p_Lights.orientationX[p_Idx],
+      p_Lights.orientationY[p_Idx],
+      p_Lights.orientationZ[p_Idx],
+      p_Lights.orientationW[p_Idx]);
+  const glm::mat3 rotation = orientation.ToMat3(); // glm so mat * vec
+
+  p_MinZ = FLT_MAX;
+  p_MaxZ = -FLT_MAX;
+  for (const glm::vec3& vertex : p_ConeVertices)
+  {
+    const glm::vec3 coneVert = rotation * (vertex * scale) + position;
+    const float vertZ = _transformVec3Mat4(coneVert, p_View.view).z;
+    p_MinZ = std::min(p_MinZ, vertZ);
+    p_MaxZ = std::max(p_MaxZ, vertZ);
+  }
+}
+//---------------------------------------------------------------------------//
+static glm::uvec2 depthToZTiles(float p_MinZ, float p_MaxZ, const LightBoundsView& p_View)
+{
+  const float zRange = p_View.farClip - p_View.nearClip;
+  const float minZ = saturate((p_MinZ - p_View.nearClip) / zRange);
+  const float maxZ = saturate((p_MaxZ - p_View.nearClip) / zRange);
+
+  return glm::uvec2(
+      uint32_t(minZ * p_View.numZTiles),
+      std::min<uint32_t>(uint32_t(maxZ * p_View.numZTiles), p_View.numZTiles - 1));
+}
+//---------------------------------------------------------------------------//
+// Sphere around the near plane against the capped cone of the light, negative when they
+// intersect. The distance past the cap is returned when the sphere is beyond it.
+static float nearClipDistance(
+    const SpotLightBounds& p_Lights, uint32_t p_Idx, const LightBoundsView& p_View)
+{
+  const glm::vec3 position =
+      glm::vec3(p_Lights.positionX[p_Idx], p_Lights.positionY[p_Idx], p_Lights.positionZ[p_Idx]);
+  const glm::vec3 direction = glm::vec3(
+      p_Lights.directionX[p_Idx], p_Lights.directionY[p_Idx], p_Lights.directionZ[p_Idx]);
+  const float capDistance = p_Lights.range[p_Idx] + p_View.nearClipRadius;
+
+  const glm::vec3 v = p_View.nearClipCenter - position;
+  const float a = glm::dot(v, direction);
+  if (a > capDistance)
+    return a - capDistance;
+
+  const float b = a * p_Lights.tanHalfAngle[p_Idx];
+  // Clamped, rounding can push it below zero for spheres on the axis
+  const float c = std::sqrt(std::max(glm::dot(v, v) - a * a, 0.0f));
+  const float e = (c - b) * p_Lights.cosHalfAngle[p_Idx];
+  return e - p_View.nearClipRadius;
+}
+//---------------------------------------------------------------------------//
+static ClusterBounds makeBounds(
+    const SpotLightBounds& p_Lights, uint32_t p_Idx, const glm::uvec2& p_ZBounds)
+{
+  ClusterBounds bounds;
+  bounds.Position =
+      glm::vec3(p_Lights.positionX[p_Idx], p_Lights.positionY[p_Idx], p_Lights.positionZ[p_Idx]);
+  bounds.Orientation = Quaternion(
+      p_Lights.orientationX[p_Idx],
+      p_Lights.orientationY[p_Idx],
+      p_Lights.orientationZ[p_Idx],
+      p_Lights.orientationW[p_Idx]);
+  bounds.Scale = glm::vec3(p_Lights.radius[p_Idx], p_Lights.radius[p_Idx], p_Lights.range[p_Idx]);
+  bounds.ZBounds = p_ZBounds;
+  return bounds;
+}
+//---------------------------------------------------------------------------//
+void computeScalar(
+    const SpotLightBounds& p_Lights,
+    const LightBoundsView& p_View,
+    const std::vector<glm::vec3>& p_ConeVertices,
+    uint32_t p_First,
+    uint32_t p_Count,
+    ClusterBounds* p_Bounds,
+    uint8_t* p_IntersectsCamera)
+{
+  assert(p_First + p_Count <= p_Lights.count());
+
+  for (uint32_t i = p_First; i < p_First + p_Count; ++i)
+  {
+    float minZ = 0.0f;
+    float maxZ = 0.0f;
+    coneDepthRange(p_Lights, i, p_View, p_ConeVertices, minZ, maxZ);
+
+    p_Bounds[i] = makeBounds(p_Lights, i, depthToZTiles(minZ, maxZ, p_View));
+    p_IntersectsCamera[i] = nearClipDistance(p_Lights, i, p_View) < 0.0f ? 1 : 0;
+  }
+}
+//---------------------------------------------------------------------------//
+// SSE
+//---------------------------------------------------------------------------//
+// The view is affine, so the Z of a cone vertex v is linear in v:
+//   z = dot(viewZ, R * (S * v) + P) + viewZ.w = dot(S * (R^T * viewZ), v) + dot(viewZ, P) + viewZ.w
+// which leaves 3 multiply-adds per vertex once the per light terms are known
+void computeSSE(
+    const SpotLightBounds& p_Lights,
+    const LightBoundsView& p_View,
+    const std::vector<glm::vec3>& p_ConeVertices,
+    uint32_t p_First,
+    uint32_t p_Count,
+    ClusterBounds* p_Bounds,
+    uint8_t* p_IntersectsCamera)
+{
+  assert(p_First + p_Count <= p_Lights.count());
+
+  const glm::vec4 viewZ = p_View.view[2];
+  const __m128 viewZX = _mm_set1_ps(viewZ.x);
+  const __m128 viewZY = _mm_set1_ps(viewZ.y);
+  const __m128 viewZZ = _mm_set1_ps(viewZ.z);
+  const __m128 viewZW = _mm_set1_ps(viewZ.w);
+  const __m128 nearClip = _mm_set1_ps(p_View.nearClip);
+  const __m128 zRange = _mm_set1_ps(p_View.farClip - p_View.nearClip);
+  const __m128 numZTiles = _mm_set1_ps(float(p_View.numZTiles));
+  const __m128 lastZTile = _mm_set1_ps(float(p_View.numZTiles - 1));
+  const __m128 sphereX = _mm_set1_ps(p_View.nearClipCenter.x);
+  const __m128 sphereY = _mm_set1_ps(p_View.nearClipCenter.y);
+  const __m128 sphereZ = _mm_set1_ps(p_View.nearClipCenter.z);
+  const __m128 sphereRadius = _mm_set1_ps(p_View.nearClipRadius);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 two = _mm_set1_ps(2.0f);
+
+  const uint32_t end = p_First + p_Count;
+  const uint32_t simdEnd = p_First + (p_Count & ~3u);
+  for (uint32_t i = p_First; i < simdEnd; i += 4)
+  {
+    const __m128 px = _mm_loadu_ps(&p_Lights.positionX[i]);
+    const __m128 py = _mm_loadu_ps(&p_Lights.positionY[i]);
+    const __m128 pz = _mm_loadu_ps(&p_Lights.positionZ[i]);
+    const __m128 qx = _mm_loadu_ps(&p_Lights.orientationX[i]);
+    const __m128 qy = _mm_loadu_ps(&p_Lights.orientationY[i]);
+    const __m128 qz = _mm_loadu_ps(&p_Lights.orientationZ[i]);
+    const __m128 qw = _mm_loadu_ps(&p_Lights.orientationW[i]);
+    const __m128 radius = _mm_loadu_ps(&p_Lights.radius[i]);
+    const __m128 range = _mm_loadu_ps(&p_Lights.range[i]);
+
+    // Columns of the rotation, same terms as glm::mat3_cast
+    const __m128 xx = _mm_mul_ps(qx, qx);
+    const __m128 yy = _mm_mul_ps(qy, qy);
+    const __m128 zz = _mm_mul_ps(qz, qz);
+    const __m128 xy = _mm_mul_ps(qx, qy);
+    const __m128 xz = _mm_mul_ps(qx, qz);
+    const __m128 yz = _mm_mul_ps(qy, qz);
+    const __m128 wx = _mm_mul_ps(qw, qx);
+    const __m128 wy = _mm_mul_ps(qw, qy);
+    const __m128 wz = _mm_mul_ps(qw, qz);
+
+    const __m128 r00 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz)));
+    const __m128 r01 = _mm_mul_ps(two, _mm_add_ps(xy, wz));
+    const __m128 r02 = _mm_mul_ps(two, _mm_sub_ps(xz, wy));
+    const __m128 r10 = _mm_mul_ps(two, _mm_sub_ps(xy, wz));
+    const __m128 r11 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz)));
+    const __m128 r12 = _mm_mul_ps(two, _mm_add_ps(yz, wx));
+    const __m128 r20 = _mm_mul_ps(two, _mm_add_ps(xz, wy));
+    const __m128 r21 = _mm_mul_ps(two, _mm_sub_ps(yz, wx));
+    const __m128 r22 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy)));
+
+    // Per light slope and offset of the vertex Z
+    const __m128 slopeX = _mm_mul_ps(
+        radius,
+        _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(r00, viewZX), _mm_mul_ps(r01, viewZY)),
+            _mm_mul_ps(r02, viewZZ)));
+    const __m128 slopeY = _mm_mul_ps(
+        radius,
+        _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(r10, viewZX), _mm_mul_ps(r11, viewZY)),
+            _mm_mul_ps(r12, viewZZ)));
+    const __m128 slopeZ = _mm_mul_ps(
+        range,
+        _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(r20, viewZX), _mm_mul_ps(r21, viewZY)),
+            _mm_mul_ps(r22, viewZZ)));
+    const __m128 offset = _mm_add_ps(
+        _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(px, viewZX), _mm_mul_ps(py, viewZY)), _mm_mul_ps(pz, viewZZ)),
+        viewZW);
+
+    __m128 minZ = _mm_set1_ps(FLT_MAX);
+    __m128 maxZ = _mm_set1_ps(-FLT_MAX);
+    for (const glm::vec3& vertex : p_ConeVertices)
+    {
+      const __m128 vertZ = _mm_add_ps(
+          _mm_add_ps(
+              _mm_add_ps(
+                  _mm_mul_ps(slopeX, _mm_set1_ps(vertex.x)),
+                  _mm_mul_ps(slopeY, _mm_set1_ps(vertex.y))),
+              _mm_mul_ps(slopeZ, _mm_set1_ps(vertex.z))),
+          offset);
+      minZ = _mm_min_ps(minZ, vertZ);
+      maxZ = _mm_max_ps(maxZ, vertZ);
+    }
+
+    minZ = _mm_min_ps(_mm_max_ps(_mm_div_ps(_mm_sub_ps(minZ, nearClip), zRange), zero), one);
+    maxZ = _mm_min_ps(_mm_max_ps(_mm_div_ps(_mm_sub_ps(maxZ, nearClip), zRange), zero), one);
+    // Truncating min(z, last) is the same as clamping the truncated tile
+    alignas(16) uint32_t minTiles[4];
+    alignas(16) uint32_t maxTiles[4];
+    _mm_store_si128(
+        reinterpret_cast<__m128i*>(minTiles), _mm_cvttps_epi32(_mm_mul_ps(minZ, numZTiles)));
+    _mm_store_si128(
+        reinterpret_cast<__m128i*>(maxTiles),
+        _mm_cvttps_epi32(_mm_min_ps(_mm_mul_ps(maxZ, numZTiles), lastZTile)));
+
+    // Near clip sphere against the cone, see nearClipDistance()
+    const __m128 vx = _mm_sub_ps(sphereX, px);
+    const __m128 vy = _mm_sub_ps(sphereY, py);
+    const __m128 vz = _mm_sub_ps(sphereZ, pz);
+    const __m128 a = _mm_add_ps(
+        _mm_add_ps(
+            _mm_mul_ps(vx, _mm_loadu_ps(&p_Lights.directionX[i])),
+            _mm_mul_ps(vy, _mm_loadu_ps(&p_Lights.directionY[i]))),
+        _mm_mul_ps(vz, _mm_loadu_ps(&p_Lights.directionZ[i])));
+    const __m128 beyondCap = _mm_cmpgt_ps(a, _mm_add_ps(range, sphereRadius));
+    const __m128 b = _mm_mul_ps(a, _mm_loadu_ps(&p_Lights.tanHalfAngle[i]));
+    const __m128 lengthSq =
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+    const __m128 c = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(lengthSq, _mm_mul_ps(a, a)), zero));
+    const __m128 e = _mm_mul_ps(_mm_sub_ps(c, b), _mm_loadu_ps(&p_Lights.cosHalfAngle[i]));
+    const int intersectMask =
+        _mm_movemask_ps(_mm_andnot_ps(beyondCap, _mm_cmplt_ps(e, sphereRadius)));
+
+    for (uint32_t lane = 0; lane < 4; ++lane)
+    {
+      p_Bounds[i + lane] =
+          makeBounds(p_Lights, i + lane, glm::uvec2(minTiles[lane], maxTiles[lane]));
+      p_IntersectsCamera[i + lane] = uint8_t((intersectMask >> lane) & 1);
+    }
+  }
+
+  computeScalar(
+      p_Lights, p_View, p_ConeVertices, simdEnd, end - simdEnd, p_Bounds, p_IntersectsCamera);
+}
+//---------------------------------------------------------------------------//
+void compute(
+    const SpotLightBounds& p_Lights,
+    const LightBoundsView& p_View,
+    const std::vector<glm::vec3>& p_ConeVertices,
+    uint32_t p_NumLights,
+    ClusterBounds* p_Bounds,
+    uint8_t* p_IntersectsCamera)
+{
+  // Small enough batches to spread 1k lights, a few hundred lights aren't worth waking the pool
+  const uint32_t batchSize = 256;
+  const uint32_t numBatches = (p_NumLights + batchSize - 1) / batchSize;
+  getWorkerPool().parallelFor(numBatches, [&](uint32_t p_Batch) {
+    const uint32_t first = p_Batch * batchSize;
+    computeSSE(
+        p_Lights,
+        p_View,
+        p_ConeVertices,
+        first,
+        std::min<uint32_t>(batchSize, p_NumLights - first),
+        p_Bounds,
+        p_IntersectsCamera);
+  });
+}
+//---------------------------------------------------------------------------//
+uint32_t buildInstanceList(
+    const uint8_t* p_IntersectsCamera, uint32_t p_NumLights, uint32_t* p_Instances)
+{
+  uint32_t numIntersecting = 0;
+  for (uint32_t i = 0; i < p_NumLights; ++i)
+    if (p_IntersectsCamera[i])
+      p_Instances[numIntersecting++] = i;
+
+  uint32_t offset = numIntersecting;
+  for (uint32_t i = 0; i < p_NumLights; ++i)
+    if (p_IntersectsCamera[i] == 0)
+      p_Instances[offset++] = i;
+
+  return numIntersecting;
+}
+//---------------------------------------------------------------------------//
+// Validation and benchmark
+//---------------------------------------------------------------------------//
+std::vector<glm::vec3> makeConeVertices(uint32_t p_NumSides)
+{
+  std::vector<glm::vec3> vertices;
+  vertices.push_back(glm::vec3(0.0f, 0.0f, 0.0f));
+  vertices.push_back(glm::vec3(0.0f, 0.0f, 1.0f));
+  for (uint32_t i = 0; i < p_NumSides; ++i)
+  {
+    const float angle = (i / float(p_NumSides)) * 2.0f * Pi;
+    vertices.push_back(glm::vec3(std::cos(angle), std::sin(angle), 1.0f));
+  }
+  return vertices;
+}
+//---------------------------------------------------------------------------//
+static void makeRandomLights(Random& p_Rng, uint32_t p_Count, SpotLightBounds& p_Lights)
+{
+  p_Lights.resize(p_Count);
+  for (uint32_t i = 0; i < p_Count; ++i)
+  {
+    const glm::vec3 position =
+        (glm::vec3(p_Rng.RandomFloat2(), p_Rng.RandomFloat()) - 0.5f) * 100.0f;
+    const glm::quat rotation = glm::normalize(glm::quat(
+        p_Rng.RandomFloat() - 0.5f,
+        p_Rng.RandomFloat() - 0.5f,
+        p_Rng.RandomFloat() - 0.5f,
+        p_Rng.RandomFloat() - 0.5f));
+    Quaternion orientation;
+    orientation = rotation;
+
+    // The cone mesh opens along +Z
+    const glm::vec3 direction = rotation * glm::vec3(0.0f, 0.0f, 1.0f);
+    const float angle = 0.3f + p_Rng.RandomFloat() * 1.2f;
+    const float range = 1.0f + p_Rng.RandomFloat() * 14.0f;
+    p_Lights.set(i, position, direction, orientation, angle, range, 1.0f);
+  }
+}
+//---------------------------------------------------------------------------//
+static LightBoundsView makeRandomView(Random& p_Rng)
+{
+  const glm::vec3 eye = (glm::vec3(p_Rng.RandomFloat2(), p_Rng.RandomFloat()) - 0.5f) * 100.0f;
+  const glm::vec3 target = (glm::vec3(p_Rng.RandomFloat2(), p_Rng.RandomFloat()) - 0.5f) * 100.0f;
+
+  PerspectiveCamera camera;
+  camera.Initialize(16.0f / 9.0f, glm::quarter_pi<float>(), 0.1f, 100.0f, 1920.0f);
+  camera.SetLookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f));
+  return makeView(camera, 16);
+}
+//---------------------------------------------------------------------------//
+// Tile index p_Z falls in is within p_Epsilon of the next or previous one
+static bool isNearTileBoundary(float p_Z, const LightBoundsView& p_View, float p_Epsilon)
+{
+  const float zRange = p_View.farClip - p_View.nearClip;
+  const float tile = saturate((p_Z - p_View.nearClip) / zRange) * p_View.numZTiles;
+  return std::abs(tile - std::round(tile)) < p_Epsilon;
+}
+//---------------------------------------------------------------------------//
+bool validate(uint32_t p_NumLights)
+{
+  assert(p_NumLights > 0);
+
+  Random rng;
+  rng.SetSeed(2468);
+
+  // Odd count so the scalar tails run too
+  SpotLightBounds lights;
+  makeRandomLights(rng, p_NumLights | 3, lights);
+  const std::vector<glm::vec3> coneVertices = makeConeVertices(16);
+  const uint32_t numLights = lights.count();
+
+  std::vector<ClusterBounds> reference(numLights);
+  std::vector<ClusterBounds> bounds(numLights);
+  std::vector<ClusterBounds> parallelBounds(numLights);
+  std::vector<uint8_t> referenceIntersects(numLights);
+  std::vector<uint8_t> intersects(numLights);
+  std::vector<uint8_t> parallelIntersects(numLights);
+  std::vector<uint32_t> instances(numLights);
+
+  const float epsilon = 1e-3f;
+  bool valid = true;
+  uint32_t numViews = 0;
+  uint64_t numIntersectingTotal = 0;
+  uint64_t numRoundingDifferences = 0;
+  for (uint32_t v = 0; v < 32; ++v, ++numViews)
+  {
+    const LightBoundsView view = makeRandomView(rng);
+
+    computeScalar(
+        lights, view, coneVertices, 0, numLights, reference.data(), referenceIntersects.data());
+    computeSSE(lights, view, coneVertices, 0, numLights, bounds.data(), intersects.data());
+    compute(
+        lights, view, coneVertices, numLights, parallelBounds.data(), parallelIntersects.data());
+
+    for (uint32_t i = 0; i < numLights; ++i)
+    {
+      const ClusterBounds& ref = reference[i];
+      const ClusterBounds& sse = bounds[i];
+      valid = valid && ref.Position == sse.Position && ref.Scale == sse.Scale &&
+              ref.Orientation.x == sse.Orientation.x && ref.Orientation.y == sse.Orientation.y &&
+              ref.Orientation.z == sse.Orientation.z && ref.Orientation.w == sse.Orientation.w;
+
+      // The SSE path sums the vertex Z in a different order, so the tiles may only differ by one
+      // where the depth is right on a tile boundary
+      if (ref.ZBounds != sse.ZBounds)
+      {
+        float minZ = 0.0f;
+        float maxZ = 0.0f;
+        coneDepthRange(lights, i, view, coneVertices, minZ, maxZ);
+        const bool minValid = ref.ZBounds.x == sse.ZBounds.x ||
+                              (glm::max(ref.ZBounds.x, sse.ZBounds.x) -
+                                       glm::min(ref.ZBounds.x, sse.ZBounds.x) ==
+                                   1 &&
+                               isNearTileBoundary(minZ, view, epsilon));
+        const bool maxValid = ref.ZBounds.y == sse.ZBounds.y ||
+                              (glm::max(ref.ZBounds.y, sse.ZBounds.y) -
+                                       glm::min(ref.ZBounds.y, sse.ZBounds.y) ==
+                                   1 &&
+                               isNearTileBoundary(maxZ, view, epsilon));
+        valid = valid && minValid && maxValid;
+        ++numRoundingDifferences;
+      }
+      if (referenceIntersects[i] != intersects[i])
+      {
+        valid = valid && std::abs(nearClipDistance(lights, i, view)) < epsilon;
+        ++numRoundingDifferences;
+      }
+
+      // Same batches of the same function
+      valid = valid && parallelBounds[i].ZBounds == sse.ZBounds &&
+              parallelIntersects[i] == intersects[i];
+    }
+
+    // Intersecting lights first, every light once
+    const uint32_t numIntersecting =
+        buildInstanceList(referenceIntersects.data(), numLights, instances.data());
+    std::vector<uint8_t> seen(numLights, 0);
+    for (uint32_t i = 0; i < numLights; ++i)
+    {
+      const uint32_t light = instances[i];
+      valid = valid && light < numLights && seen[light] == 0 &&
+              referenceIntersects[light] == (i < numIntersecting ? 1 : 0);
+      if (light < numLights)
+        seen[light] = 1;
+    }
+
+    numIntersectingTotal += numIntersecting;
+  }
+
+  writeLog(
+      "LightBounds::validate: %u lights, %u views, %.2f%% intersecting the near plane, "
+      "%llu results off by a rounding error, %s",
+      numLights,
+      numViews,
+      100.0 * numIntersectingTotal / (double(numLights) * numViews),
+      numRoundingDifferences,
+      valid ? "passed" : "FAILED");
+
+  return valid;
+}
+//---------------------------------------------------------------------------//
+void benchmark(uint32_t p_NumIterations)
+{
+  assert(p_NumIterations > 0);
+
+  Random rng;
+  rng.SetSeed(1357);
+
+  const std::vector<glm::vec3> coneVertices = makeConeVertices(16);
+  const LightBoundsView view = makeRandomView(rng);
+
+  Timer timer;
+  timer.init();
+
+  const uint32_t counts[] = {32, 1000, 10000};
+  for (uint32_t count : counts)
+  {
+    SpotLightBounds lights;
+    makeRandomLights(rng, count, lights);
+    std::vector<ClusterBounds> bounds(count);
+    std::vector<uint8_t> intersects(count);
+
+    double milliseconds[3] = {};
+    for (uint32_t path = 0; path < 3; ++path)
+    {
+      timer.update();
+      for (uint32_t iteration = 0; iteration < p_NumIterations; ++iteration)
+      {
+        if (path == 0)
+          computeScalar(lights, view, coneVertices, 0, count, bounds.data(), intersects.data());
+        else if (path == 1)
+          computeSSE(lights, view, coneVertices, 0, count, bounds.data(), intersects.data());
+        else
+          compute(lights, view, coneVertices, count, bounds.data(), intersects.data());
+      }
+      timer.update();
+      milliseconds[path] = timer.m_DeltaMillisecondsD / p_NumIterations;
+    }
+
+    writeLog(
+        "LightBounds::benchmark: %u lights, scalar %.4f ms, SSE %.4f ms (%.1fx), "
+        "SSE on %u threads %.4f ms (%.1fx)",
+        count,
+        milliseconds[0],
+        milliseconds[1],
+        milliseconds[0] / milliseconds[1],
+        getWorkerPool().numThreads(),
+        milliseconds[2],
+        milliseconds[0] / milliseconds[2]);
+  }
+}
+//---------------------------------------------------------------------------//
+} // namespace LightBounds
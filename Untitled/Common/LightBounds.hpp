@@ -0,0 +1,117 @@
+#pragma once
+
+#include "Utility.hpp"
+#include "Quaternion.hpp"
+
+class CameraBase;
+
+//---------------------------------------------------------------------------//
+// Transform of a light's bounding cone and the range of Z tiles it covers, same layout as the
+// ClusterBounds struct in Clusters.hlsl
+struct ClusterBounds
+{
+  glm::vec3 Position;
+  Quaternion Orientation;
+  glm::vec3 Scale;
+  glm::uvec2 ZBounds;
+};
+//---------------------------------------------------------------------------//
+// Spot light cones in structure-of-arrays layout, so the SIMD path loads one component of 4
+// lights at a time. Set once at load, only the Z tiles and the near clip test depend on the camera.
+struct SpotLightBounds
+{
+  std::vector<float> positionX;
+  std::vector<float> positionY;
+  std::vector<float> positionZ;
+  // Cone axis pointing away from the tip
+  std::vector<float> directionX;
+  std::vector<float> directionY;
+  std::vector<float> directionZ;
+  std::vector<float> orientationX;
+  std::vector<float> orientationY;
+  std::vector<float> orientationZ;
+  std::vector<float> orientationW;
+  // Base radius and height of the bounding cone, its ClusterBounds::Scale
+  std::vector<float> radius;
+  std::vector<float> range;
+  std::vector<float> cosHalfAngle;
+  std::vector<float> tanHalfAngle;
+
+  void resize(uint32_t p_Count);
+
+  // p_Angle is the full cone angle, p_ScaleCorrection widens the base so the polygonal cone
+  // encloses the round one
+  void set(
+      uint32_t p_Idx,
+      const glm::vec3& p_Position,
+      const glm::vec3& p_Direction,
+      const Quaternion& p_Orientation,
+      float p_Angle,
+      float p_Range,
+      float p_ScaleCorrection);
+
+  uint32_t count() const { return uint32_t(positionX.size()); }
+};
+//---------------------------------------------------------------------------//
+// What the bounds depend on from the camera
+struct LightBoundsView
+{
+  // CameraBase::ViewMatrix(), stored transposed
+  glm::mat4 view;
+  float nearClip = 0.0f;
+  float farClip = 0.0f;
+  // Sphere around the near clipping plane, lights touching it are drawn with back faces only
+  glm::vec3 nearClipCenter;
+  float nearClipRadius = 0.0f;
+  uint32_t numZTiles = 0;
+};
+//---------------------------------------------------------------------------//
+namespace LightBounds
+{
+
+LightBoundsView makeView(const CameraBase& p_Camera, uint32_t p_NumZTiles);
+
+// Fill p_Bounds and p_IntersectsCamera for the lights [p_First, p_First + p_Count), both indexed
+// by light. p_ConeVertices are the vertices of the unit cone drawn for every light.
+void computeScalar(
+    const SpotLightBounds& p_Lights,
+    const LightBoundsView& p_View,
+    const std::vector<glm::vec3>& p_ConeVertices,
+    uint32_t p_First,
+    uint32_t p_Count,
+    ClusterBounds* p_Bounds,
+    uint8_t* p_IntersectsCamera);
+void computeSSE(
+    const SpotLightBounds& p_Lights,
+    const LightBoundsView& p_View,
+    const std::vector<glm::vec3>& p_ConeVertices,
+    uint32_t p_First,
+    uint32_t p_Count,
+    ClusterBounds* p_Bounds,
+    uint8_t* p_IntersectsCamera);
+
+// SSE path for the first p_NumLights lights, split across the worker pool
+void compute(
+    const SpotLightBounds& p_Lights,
+    const LightBoundsView& p_View,
+    const std::vector<glm::vec3>& p_ConeVertices,
+    uint32_t p_NumLights,
+    ClusterBounds* p_Bounds,
+    uint8_t* p_IntersectsCamera);
+
+// Instance order of the cluster passes: the lights intersecting the camera first, then the
+// others, both ascending. Returns the number of intersecting lights.
+uint32_t buildInstanceList(
+    const uint8_t* p_IntersectsCamera, uint32_t p_NumLights, uint32_t* p_Instances);
+
+// Same cone as makeConeGeometry() in Model.cpp: tip, base center and the base ring
+std::vector<glm::vec3> makeConeVertices(uint32_t p_NumSides);
+
+// Headless comparison of the SSE and parallel paths with the scalar reference on random lights
+// and cameras. Results go to the debug output.
+bool validate(uint32_t p_NumLights = 10000);
+
+// Headless timing of the three paths for 32, 1k and 10k lights
+void benchmark(uint32_t p_NumIterations = 64);
+
+} // namespace LightBounds
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "Utility.hpp"
+
+// Sections of the binary cache files start at this alignment so they can be used in place
+static constexpr uint64_t BlobSectionAlignment = 16;
+
+//---------------------------------------------------------------------------//
+// Read-only memory mapping of a whole file. The view stays valid until deinit(),
+// so callers can point straight into it instead of copying into std::vectors.
+//---------------------------------------------------------------------------//
+struct MappedFile
+{
+  MappedFile() {}
+  ~MappedFile() { deinit(); }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool init(const wchar_t* p_FilePath)
+  {
+    deinit();
+
+    m_File = CreateFileW(
+        p_FilePath,
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS,
+        nullptr);
+    if (m_File == INVALID_HANDLE_VALUE)
+    {
+      m_File = nullptr;
+      return false;
+    }
+
+    LARGE_INTEGER fileSize = {};
+    if (GetFileSizeEx(m_File, &fileSize) == FALSE || fileSize.QuadPart == 0)
+    {
+      deinit();
+      return false;
+    }
+
+    m_Mapping = CreateFileMappingW(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_Mapping == nullptr)
+    {
+      deinit();
+      return false;
+    }
+
+    m_Data = reinterpret_cast<const uint8_t*>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+    if (m_Data == nullptr)
+    {
+      deinit();
+      return false;
+    }
+
+    m_Size = uint64_t(fileSize.QuadPart);
+    return true;
+  }
+  void deinit()
+  {
+    if (m_Data != nullptr)
+      UnmapViewOfFile(m_Data);
+    if (m_Mapping != nullptr)
+      CloseHandle(m_Mapping);
+    if (m_File != nullptr)
+      CloseHandle(m_File);
+
+    m_Data = nullptr;
+    m_Mapping = nullptr;
+    m_File = nullptr;
+    m_Size = 0;
+  }
+
+  bool isMapped() const { return m_Data != nullptr; }
+
+  template <typename T> const T* at(uint64_t p_Offset) const
+  {
+    assert(p_Offset <= m_Size);
+    return reinterpret_cast<const T*>(m_Data + p_Offset);
+  }
+
+  // Validates a section read from an untrusted header
+  bool containsSection(uint64_t p_Offset, uint64_t p_ElemSize, uint64_t p_Count) const
+  {
+    return (p_Offset % BlobSectionAlignment) == 0 && p_Offset <= m_Size &&
+           p_Count <= (m_Size - p_Offset) / p_ElemSize;
+  }
+
+  const uint8_t* m_Data = nullptr;
+  uint64_t m_Size = 0;
+
+private:
+  HANDLE m_File = nullptr;
+  HANDLE m_Mapping = nullptr;
+};
+//---------------------------------------------------------------------------//
+// Appends p_Count elements at the next aligned offset and returns that offset, p_Data may be null
+// to only reserve the space
+template <typename T>
+inline uint64_t appendBlobSection(std::vector<uint8_t>& p_Blob, const T* p_Data, uint64_t p_Count)
+{
+  const uint64_t offset = alignUp<uint64_t>(p_Blob.size(), BlobSectionAlignment);
+  p_Blob.resize(offset + sizeof(T) * p_Count);
+  if (p_Data != nullptr && p_Count > 0)
+    memcpy(p_Blob.data() + offset, p_Data, sizeof(T) * p_Count);
+  return offset;
+}
+//---------------------------------------------------------------------------//
+// Writes p_Size bytes to a temporary file and then moves it over p_FilePath, so a
+// reader never maps a half-written file
+inline bool writeDataToFile(const wchar_t* p_FilePath, const void* p_Data, uint64_t p_Size)
+{
+  std::wstring tempPath = std::wstring(p_FilePath) + L".tmp";
+
+  HANDLE file = CreateFileW(
+      tempPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(p_Data);
+  uint64_t written = 0;
+  bool success = true;
+  while (success && written < p_Size)
+  {
+    DWORD chunkSize = DWORD(std::min<uint64_t>(p_Size - written, 64ull * 1024 * 1024));
+    DWORD chunkWritten = 0;
+    success = WriteFile(file, bytes + written, chunkSize, &chunkWritten, nullptr) != FALSE;
+    written += chunkWritten;
+  }
+  CloseHandle(file);
+
+  if (success == false)
+  {
+    DeleteFileW(tempPath.c_str());
+    return false;
+  }
+
+  return MoveFileExW(tempPath.c_str(), p_FilePath, MOVEFILE_REPLACE_EXISTING) != FALSE;
+}
+//---------------------------------------------------------------------------//
+// Size and last write time of a file, used for cache invalidation
+inline bool getFileStamp(const wchar_t* p_FilePath, uint64_t& p_Size, uint64_t& p_WriteTime)
+{
+  WIN32_FILE_ATTRIBUTE_DATA attributes = {};
+  if (GetFileAttributesExW(p_FilePath, GetFileExInfoStandard, &attributes) == FALSE)
+    return false;
+
+  p_Size = (uint64_t(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+  p_WriteTime = (uint64_t(attributes.ftLastWriteTime.dwHighDateTime) << 32) |
+                attributes.ftLastWriteTime.dwLowDateTime;
+  return true;
+}
+//---------------------------------------------------------------------------//
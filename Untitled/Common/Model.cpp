@@ -1,4 +1,10 @@
 #include "Model.hpp"
+#include "Camera.hpp"
+#include "Sampling.hpp"
+#include "Timer.hpp"
+#include "WorkerPool.hpp"
+
+#include "meshoptimizer/meshoptimizer.h"
 
 
 #ifdef _DEBUG
@@ -250,18 +256,13 @@ void loadMaterialResources(
 //---------------------------------------------------------------------------//
 // Init from loaded files
 void Mesh::InitFromAssimpMesh(
-    const aiMesh& assimpMesh, float sceneScale, MeshVertex* dstVertices, uint16_t* dstIndices)
+    const aiMesh& assimpMesh, float sceneScale, MeshVertex* dstVertices, void* dstIndices)
 {
   numVertices = assimpMesh.mNumVertices;
   numIndices = assimpMesh.mNumFaces * 3;
 
-  indexType = IndexType::Index16Bit;
-  if (numVertices > 0xFFFF)
-  {
-    assert(false && "32-bit indices not currently supported");
-    // indexSize = 4;
-    // indexType = IndexType::Index32Bit;
-  }
+  // Only meshes that can't be addressed with 16 bits pay for 32-bit indices
+  indexType = IndexTypeForVertexCount(numVertices);
 
   if (assimpMesh.HasPositions())
   {
@@ -310,11 +311,25 @@ void Mesh::InitFromAssimpMesh(
 
   // Copy the index data
   const uint64_t numTriangles = assimpMesh.mNumFaces;
-  for (uint64_t triIdx = 0; triIdx < numTriangles; ++triIdx)
+  if (indexType == IndexType::Index32Bit)
+  {
+    uint32_t* dstIndices32 = reinterpret_cast<uint32_t*>(dstIndices);
+    for (uint64_t triIdx = 0; triIdx < numTriangles; ++triIdx)
+    {
+      dstIndices32[triIdx * 3 + 0] = assimpMesh.mFaces[triIdx].mIndices[0];
+      dstIndices32[triIdx * 3 + 1] = assimpMesh.mFaces[triIdx].mIndices[1];
+      dstIndices32[triIdx * 3 + 2] = assimpMesh.mFaces[triIdx].mIndices[2];
+    }
+  }
+  else
   {
-    dstIndices[triIdx * 3 + 0] = uint16_t(assimpMesh.mFaces[triIdx].mIndices[0]);
-    dstIndices[triIdx * 3 + 1] = uint16_t(assimpMesh.mFaces[triIdx].mIndices[1]);
-    dstIndices[triIdx * 3 + 2] = uint16_t(assimpMesh.mFaces[triIdx].mIndices[2]);
+    uint16_t* dstIndices16 = reinterpret_cast<uint16_t*>(dstIndices);
+    for (uint64_t triIdx = 0; triIdx < numTriangles; ++triIdx)
+    {
+      dstIndices16[triIdx * 3 + 0] = uint16_t(assimpMesh.mFaces[triIdx].mIndices[0]);
+      dstIndices16[triIdx * 3 + 1] = uint16_t(assimpMesh.mFaces[triIdx].mIndices[1]);
+      dstIndices16[triIdx * 3 + 2] = uint16_t(assimpMesh.mFaces[triIdx].mIndices[2]);
+    }
   }
 
   meshParts.resize(1);
@@ -325,6 +340,224 @@ void Mesh::InitFromAssimpMesh(
   part.VertexCount = numVertices;
   part.MaterialIdx = assimpMesh.mMaterialIndex;
 }
+
+// FIFO size for the ACMR/ATVR numbers, a generic value rather than a specific GPU
+static constexpr uint32_t AnalyzeCacheSize = 16;
+// Allowed ACMR increase when reordering for overdraw
+static constexpr float OverdrawThreshold = 1.05f;
+
+template <typename T>
+static MeshOptimizationStats analyzeMeshRange(
+    const MeshVertex* vertexData, uint32_t numVertices, const T* indexData, uint32_t numIndices)
+{
+  const meshopt_VertexCacheStatistics cacheStats =
+      meshopt_analyzeVertexCache(indexData, numIndices, numVertices, AnalyzeCacheSize, 0, 0);
+  const meshopt_OverdrawStatistics overdrawStats = meshopt_analyzeOverdraw(
+      indexData, numIndices, &vertexData[0].Position.x, numVertices, sizeof(MeshVertex));
+  const meshopt_VertexFetchStatistics fetchStats =
+      meshopt_analyzeVertexFetch(indexData, numIndices, numVertices, sizeof(MeshVertex));
+
+  MeshOptimizationStats stats;
+  stats.NumVertices = numVertices;
+  stats.NumTriangles = numIndices / 3;
+  stats.VerticesTransformed = cacheStats.vertices_transformed;
+  stats.PixelsCovered = overdrawStats.pixels_covered;
+  stats.PixelsShaded = overdrawStats.pixels_shaded;
+  stats.BytesFetched = fetchStats.bytes_fetched;
+  return stats;
+}
+
+template <typename T>
+static void optimizeMeshRange(
+    MeshVertex* vertexData,
+    uint32_t numVertices,
+    T* indexData,
+    uint32_t numIndices,
+    const std::vector<MeshPart>& parts)
+{
+  // Triangles stay within their part so the part ranges remain valid
+  for (const MeshPart& part : parts)
+  {
+    T* partIndices = indexData + part.IndexStart;
+    meshopt_optimizeVertexCache(partIndices, partIndices, part.IndexCount, numVertices);
+    meshopt_optimizeOverdraw(
+        partIndices,
+        partIndices,
+        part.IndexCount,
+        &vertexData[0].Position.x,
+        numVertices,
+        sizeof(MeshVertex),
+        OverdrawThreshold);
+  }
+
+  // Referenced vertices are compacted to the front in first-use order. The tail keeps stale
+  // copies that no index points at; it is dead data, kept only so the vertex count and with it
+  // the ranges of the following meshes don't move
+  meshopt_optimizeVertexFetch(
+      vertexData, indexData, numIndices, vertexData, numVertices, sizeof(MeshVertex));
+}
+
+void Mesh::Optimize(
+    MeshVertex* vertexData,
+    void* indexData,
+    MeshOptimizationStats* statsBefore,
+    MeshOptimizationStats* statsAfter)
+{
+  if (statsBefore != nullptr)
+    *statsBefore = Analyze(vertexData, indexData);
+
+  if (indexType == IndexType::Index32Bit)
+    optimizeMeshRange(
+        vertexData, numVertices, reinterpret_cast<uint32_t*>(indexData), numIndices, meshParts);
+  else
+    optimizeMeshRange(
+        vertexData, numVertices, reinterpret_cast<uint16_t*>(indexData), numIndices, meshParts);
+
+  if (statsAfter != nullptr)
+    *statsAfter = Analyze(vertexData, indexData);
+}
+
+MeshOptimizationStats Mesh::Analyze(const MeshVertex* vertexData, const void* indexData) const
+{
+  if (indexType == IndexType::Index32Bit)
+    return analyzeMeshRange(
+        vertexData, numVertices, reinterpret_cast<const uint32_t*>(indexData), numIndices);
+  return analyzeMeshRange(
+      vertexData, numVertices, reinterpret_cast<const uint16_t*>(indexData), numIndices);
+}
+
+// Every level is simplified from level 0, so its error is measured against the full resolution
+// part. Borders stay locked to avoid cracks between neighbouring meshes on different levels.
+template <typename T>
+static void simplifyMeshPart(
+    const MeshVertex* vertexData,
+    uint32_t numVertices,
+    const T* indexData,
+    const ModelLoadSettings& settings,
+    uint32_t firstLodIndex,
+    MeshPart& part,
+    std::vector<T>& lodIndices)
+{
+  const uint32_t numLods = std::min<uint32_t>(settings.NumLods, MaxMeshLods);
+  const float errorScale =
+      meshopt_simplifyScale(&vertexData[0].Position.x, numVertices, sizeof(MeshVertex));
+
+  const T* partIndices = indexData + part.IndexStart;
+  std::vector<T> simplified(part.IndexCount);
+  std::vector<uint8_t> referenced(numVertices);
+  part.NumLods = 1;
+  for (uint32_t lod = 1; lod < numLods; ++lod)
+  {
+    const size_t targetCount = size_t(part.IndexCount * settings.LodTargetRatios[lod]) / 3 * 3;
+    float error = 0.0f;
+    const size_t count = meshopt_simplify(
+        simplified.data(),
+        partIndices,
+        part.IndexCount,
+        &vertexData[0].Position.x,
+        numVertices,
+        sizeof(MeshVertex),
+        targetCount,
+        settings.LodMaxErrors[lod],
+        meshopt_SimplifyLockBorder,
+        &error);
+
+    // The error bound stopped the simplifier before it got anywhere
+    if (count == 0 || count >= part.LodCount(lod - 1))
+      break;
+
+    meshopt_optimizeVertexCache(simplified.data(), simplified.data(), count, numVertices);
+
+    uint32_t numReferenced = 0;
+    std::fill(referenced.begin(), referenced.end(), uint8_t(0));
+    for (size_t i = 0; i < count; ++i)
+    {
+      numReferenced += referenced[simplified[i]] == 0;
+      referenced[simplified[i]] = 1;
+    }
+
+    part.LodIndexStart[lod] = firstLodIndex + uint32_t(lodIndices.size());
+    part.LodIndexCount[lod] = uint32_t(count);
+    part.LodVertexCount[lod] = numReferenced;
+    part.LodError[lod] = error * errorScale;
+    part.NumLods = lod + 1;
+    lodIndices.insert(lodIndices.end(), simplified.begin(), simplified.begin() + count);
+  }
+}
+
+template <typename T>
+static void simplifyMeshParts(
+    const MeshVertex* vertexData,
+    uint32_t numVertices,
+    const T* indexData,
+    uint32_t numIndices,
+    const ModelLoadSettings& settings,
+    std::vector<MeshPart>& parts,
+    std::vector<uint8_t>& lodData)
+{
+  std::vector<T> lodIndices;
+  for (MeshPart& part : parts)
+    simplifyMeshPart(vertexData, numVertices, indexData, settings, numIndices, part, lodIndices);
+
+  lodData.resize(lodIndices.size() * sizeof(T));
+  if (lodIndices.empty() == false)
+    memcpy(lodData.data(), lodIndices.data(), lodData.size());
+}
+
+void Mesh::GenerateLods(
+    const MeshVertex* vertexData,
+    const void* indexData,
+    const ModelLoadSettings& settings,
+    std::vector<uint8_t>& lodData)
+{
+  if (indexType == IndexType::Index32Bit)
+    simplifyMeshParts(
+        vertexData,
+        numVertices,
+        reinterpret_cast<const uint32_t*>(indexData),
+        numIndices,
+        settings,
+        meshParts,
+        lodData);
+  else
+    simplifyMeshParts(
+        vertexData,
+        numVertices,
+        reinterpret_cast<const uint16_t*>(indexData),
+        numIndices,
+        settings,
+        meshParts,
+        lodData);
+
+  numLodIndices = uint32_t(lodData.size() / IndexSize());
+}
+
+uint32_t Mesh::SelectLod(
+    uint64_t partIdx, const CameraBase& camera, float viewportHeight, float maxPixelError) const
+{
+  assert(partIdx < meshParts.size());
+  const MeshPart& part = meshParts[partIdx];
+  if (part.NumLods <= 1)
+    return 0;
+
+  // Pixels covered by one object-space unit, perspective projections scale it by the distance
+  // to the bounding sphere of the mesh
+  float pixelsPerUnit = camera.ProjectionMatrix()[1][1] * viewportHeight * 0.5f;
+  if (camera.IsOrthographic() == false)
+  {
+    const glm::vec3 center = (aabbMin + aabbMax) * 0.5f;
+    const float radius = glm::length(aabbMax - aabbMin) * 0.5f;
+    const float distance = glm::length(center - camera.Position()) - radius;
+    pixelsPerUnit /= std::max(distance, camera.NearClip());
+  }
+
+  for (uint32_t lod = part.NumLods - 1; lod > 0; --lod)
+  {
+    if (part.LodError[lod] * pixelsPerUnit <= maxPixelError)
+      return lod;
+  }
+  return 0;
+}
 static const uint64_t NumBoxVerts = 24;
 static const uint64_t NumBoxIndices = 36;
 
@@ -628,13 +861,77 @@ void Mesh::InitPlane(
   part.MaterialIdx = materialIdx;
 }
 
+void Mesh::InitGrid(
+    uint32_t gridSize,
+    float cellSize,
+    uint32_t materialIdx,
+    MeshVertex* dstVertices,
+    void* dstIndices)
+{
+  assert(gridSize > 1);
+
+  numVertices = uint32_t(GridVertexCount(gridSize));
+  numIndices = uint32_t(GridIndexCount(gridSize));
+  indexType = IndexTypeForVertexCount(numVertices);
+
+  const float halfExtent = (gridSize - 1) * cellSize * 0.5f;
+  const float uvScale = 1.0f / (gridSize - 1);
+  for (uint32_t z = 0; z < gridSize; ++z)
+  {
+    for (uint32_t x = 0; x < gridSize; ++x)
+    {
+      dstVertices[z * gridSize + x] = MeshVertex(
+          glm::vec3(x * cellSize - halfExtent, 0.0f, z * cellSize - halfExtent),
+          glm::vec3(0.0f, 1.0f, 0.0f),
+          glm::vec2(x * uvScale, z * uvScale),
+          glm::vec3(1.0f, 0.0f, 0.0f),
+          glm::vec3(0.0f, 0.0f, -1.0f));
+    }
+  }
+
+  uint64_t iIdx = 0;
+  for (uint32_t z = 0; z + 1 < gridSize; ++z)
+  {
+    for (uint32_t x = 0; x + 1 < gridSize; ++x)
+    {
+      const uint32_t quad[6] = {
+          z * gridSize + x,
+          (z + 1) * gridSize + x,
+          (z + 1) * gridSize + x + 1,
+          (z + 1) * gridSize + x + 1,
+          z * gridSize + x + 1,
+          z * gridSize + x};
+      for (uint32_t corner = 0; corner < 6; ++corner, ++iIdx)
+      {
+        if (indexType == IndexType::Index32Bit)
+          reinterpret_cast<uint32_t*>(dstIndices)[iIdx] = quad[corner];
+        else
+          reinterpret_cast<uint16_t*>(dstIndices)[iIdx] = uint16_t(quad[corner]);
+      }
+    }
+  }
+  assert(iIdx == numIndices);
+
+  aabbMin = glm::vec3(-halfExtent, 0.0f, -halfExtent);
+  aabbMax = glm::vec3(halfExtent, 0.0f, halfExtent);
+
+  meshParts.resize(1);
+  MeshPart& part = meshParts[0];
+  part.IndexStart = 0;
+  part.IndexCount = numIndices;
+  part.VertexStart = 0;
+  part.VertexCount = numVertices;
+  part.MaterialIdx = materialIdx;
+}
+
 void Mesh::InitCommon(
     const MeshVertex* p_Vertices,
-    const uint16_t* p_Indices,
+    const void* p_Indices,
     uint64_t p_VbAddress,
     uint64_t p_IbAddress,
     uint64_t p_VtxOffset,
-    uint64_t p_IdxOffset)
+    uint64_t p_IdxOffset,
+    uint32_t p_VertexStride)
 {
   assert(meshParts.size() > 0);
 
@@ -644,11 +941,11 @@ void Mesh::InitCommon(
   idxOffset = uint32_t(p_IdxOffset);
 
   vbView.BufferLocation = p_VbAddress;
-  vbView.SizeInBytes = sizeof(MeshVertex) * numVertices;
-  vbView.StrideInBytes = sizeof(MeshVertex);
+  vbView.SizeInBytes = p_VertexStride * numVertices;
+  vbView.StrideInBytes = p_VertexStride;
 
   ibView.Format = IndexBufferFormat();
-  ibView.SizeInBytes = IndexSize() * numIndices;
+  ibView.SizeInBytes = IndexSize() * NumStoredIndices();
   ibView.BufferLocation = p_IbAddress;
 }
 
@@ -656,6 +953,7 @@ void Mesh::Shutdown()
 {
   numVertices = 0;
   numIndices = 0;
+  numLodIndices = 0;
   meshParts.clear();
   vertices = nullptr;
   indices = nullptr;
@@ -697,7 +995,111 @@ static const wchar_t* SponzaRoughnessMaps[] = {
 
 void Model::CreateWithAssimp(ID3D12Device* dev, const ModelLoadSettings& settings)
 {
+  ImportWithAssimp(settings);
+
+  loadMaterialResources(dev, meshMaterials, fileDirectory, settings.ForceSRGB, materialTextures);
+
+  CreateBuffers();
+
+  writeLog("Finished loading scene '%ls'", settings.FilePath);
+}
+
+void Model::PackVertices(
+    const MeshVertex* vertexData, uint64_t numVertices, std::vector<uint8_t>& packed) const
+{
+  assert(vertexFormat != VertexFormat::Standard);
+  packed.resize(numVertices * VertexStride(vertexFormat));
+
+  // Mesh by mesh, quantized positions are relative to each mesh AABB
+  uint64_t vtxOffset = 0;
+  for (const Mesh& mesh : meshes)
+  {
+    const MeshVertex* src = vertexData + vtxOffset;
+    if (vertexFormat == VertexFormat::Packed)
+    {
+      PackedMeshVertex* dst = reinterpret_cast<PackedMeshVertex*>(packed.data()) + vtxOffset;
+      for (uint32_t i = 0; i < mesh.NumVertices(); ++i)
+        dst[i] = packMeshVertex(src[i]);
+    }
+    else
+    {
+      glm::vec3 scale;
+      glm::vec3 offset;
+      PositionQuantization(mesh, scale, offset);
+
+      QuantizedMeshVertex* dst =
+          reinterpret_cast<QuantizedMeshVertex*>(packed.data()) + vtxOffset;
+      for (uint32_t i = 0; i < mesh.NumVertices(); ++i)
+        dst[i] = quantizeMeshVertex(src[i], scale, offset);
+    }
+
+    vtxOffset += mesh.NumVertices();
+  }
+  assert(vtxOffset == numVertices);
+}
+
+// Merges vertices that only differ in their shading attributes, then reorders for the vertex
+// cache again since the merged indices reference fewer vertices. Every level of every part is
+// processed on its own so the ranges stay valid.
+template <typename T>
+static void buildDepthIndexRange(const Mesh& mesh, const MeshVertex* vertices, const T* src, T* dst)
+{
+  for (const MeshPart& part : mesh.MeshParts())
+  {
+    for (uint32_t lod = 0; lod < part.NumLods; ++lod)
+    {
+      const uint32_t start = part.LodStart(lod);
+      const uint32_t count = part.LodCount(lod);
+      meshopt_generateShadowIndexBuffer(
+          dst + start,
+          src + start,
+          count,
+          &vertices[0].Position,
+          mesh.NumVertices(),
+          sizeof(glm::vec3),
+          sizeof(MeshVertex));
+      meshopt_optimizeVertexCache(dst + start, dst + start, count, mesh.NumVertices());
+    }
+  }
+}
 
+void Model::BuildDepthIndices(
+    const MeshVertex* vertexData,
+    const uint8_t* indexData,
+    uint64_t indexDataSize,
+    std::vector<uint8_t>& depthIndices) const
+{
+  // Padding between ranges is copied as is
+  depthIndices.assign(indexData, indexData + indexDataSize);
+
+  uint64_t vtxOffset = 0;
+  uint64_t ibOffset = 0;
+  for (const Mesh& mesh : meshes)
+  {
+    ibOffset = AlignIndexOffset(ibOffset, mesh.IndexBufferType());
+    const MeshVertex* meshVertices = vertexData + vtxOffset;
+
+    if (mesh.IndexBufferType() == IndexType::Index32Bit)
+      buildDepthIndexRange(
+          mesh,
+          meshVertices,
+          reinterpret_cast<const uint32_t*>(indexData + ibOffset),
+          reinterpret_cast<uint32_t*>(depthIndices.data() + ibOffset));
+    else
+      buildDepthIndexRange(
+          mesh,
+          meshVertices,
+          reinterpret_cast<const uint16_t*>(indexData + ibOffset),
+          reinterpret_cast<uint16_t*>(depthIndices.data() + ibOffset));
+
+    vtxOffset += mesh.NumVertices();
+    ibOffset += uint64_t(mesh.NumStoredIndices()) * mesh.IndexSize();
+  }
+  assert(ibOffset <= indexDataSize);
+}
+
+void Model::ImportWithAssimp(const ModelLoadSettings& settings)
+{
   const wchar_t* filePath = settings.FilePath;
   assert(filePath != nullptr);
   if (fileExists(filePath) == false)
@@ -721,6 +1123,8 @@ void Model::CreateWithAssimp(ID3D12Device* dev, const ModelLoadSettings& setting
 
   fileDirectory = getDirectoryFromFilePath(filePath);
   forceSRGB = settings.ForceSRGB;
+  vertexFormat = VertexFormatFromSettings(settings);
+  optimizeDepthIndices = settings.OptimizeDepthIndices;
 
   // Grab the lights before we process the scene
   spotLights.resize(scene->mNumLights);
@@ -761,9 +1165,17 @@ void Model::CreateWithAssimp(ID3D12Device* dev, const ModelLoadSettings& setting
     }
     else if (srcLight.mType == aiLightSource_POINT)
     {
-      PointLight& dstLight = pointLights[numPointLights++];
-      dstLight.Position = convertVector(srcLight.mPosition);
-      dstLight.Intensity = convertColor(srcLight.mColorDiffuse);
+      ModelPointLight& dstLight = pointLights[numPointLights++];
+
+      // The light's position is relative to its node, MakeLeftHanded only runs below
+      aiVector3D position = srcLight.mPosition;
+      for (const aiNode* node = scene->mRootNode->FindNode(srcLight.mName); node != nullptr;
+           node = node->mParent)
+        position = node->mTransformation * position;
+
+      dstLight.Position = convertVector(position) * settings.SceneScale;
+      dstLight.Position.z *= -1.0f;
+      dstLight.Intensity = convertColor(srcLight.mColorDiffuse) * FP16Scale;
     }
   }
 
@@ -818,33 +1230,47 @@ void Model::CreateWithAssimp(ID3D12Device* dev, const ModelLoadSettings& setting
           getFileName(strToWideStr(metallicMapPath.C_Str()).c_str());
   }
 
-  loadMaterialResources(dev, meshMaterials, fileDirectory, settings.ForceSRGB, materialTextures);
-
   aabbMin = glm::vec3(maxFloat);
   aabbMax = glm::vec3(-maxFloat);
 
-  // Initialize the meshes
+  // Initialize the meshes, each one gets its own index width (see Model::AlignIndexOffset())
   const uint64_t numMeshes = scene->mNumMeshes;
   uint64_t numVertices = 0;
-  uint64_t numIndices = 0;
+  uint64_t indexDataSize = 0;
+  bool any32Bit = false;
   for (uint64_t i = 0; i < numMeshes; ++i)
   {
     const aiMesh& assimpMesh = *scene->mMeshes[i];
+    const IndexType indexType = Mesh::IndexTypeForVertexCount(assimpMesh.mNumVertices);
 
     numVertices += assimpMesh.mNumVertices;
-    numIndices += assimpMesh.mNumFaces * 3;
+    indexDataSize = AlignIndexOffset(indexDataSize, indexType);
+    indexDataSize += uint64_t(assimpMesh.mNumFaces) * 3 * Mesh::IndexSize(indexType);
+    any32Bit |= indexType == IndexType::Index32Bit;
   }
 
+  // The index buffer is viewed as 32-bit elements as soon as one mesh needs them
+  if (any32Bit)
+    indexDataSize = alignUp<uint64_t>(indexDataSize, sizeof(uint32_t));
+
   vertices.resize(numVertices);
-  indices.resize(numIndices);
+  indices.assign(indexDataSize, 0);
 
   meshes.resize(numMeshes);
+  std::vector<uint64_t> vertexOffsets(numMeshes);
+  std::vector<uint64_t> indexOffsets(numMeshes);
   uint64_t vtxOffset = 0;
-  uint64_t idxOffset = 0;
+  uint64_t ibOffset = 0;
   for (uint64_t i = 0; i < numMeshes; ++i)
   {
+    const aiMesh& assimpMesh = *scene->mMeshes[i];
+    ibOffset =
+        AlignIndexOffset(ibOffset, Mesh::IndexTypeForVertexCount(assimpMesh.mNumVertices));
+    vertexOffsets[i] = vtxOffset;
+    indexOffsets[i] = ibOffset;
+
     meshes[i].InitFromAssimpMesh(
-        *scene->mMeshes[i], settings.SceneScale, &vertices[vtxOffset], &indices[idxOffset]);
+        assimpMesh, settings.SceneScale, &vertices[vtxOffset], &indices[ibOffset]);
 
     aabbMin.x = std::min(aabbMin.x, meshes[i].AABBMin().x);
     aabbMin.y = std::min(aabbMin.y, meshes[i].AABBMin().y);
@@ -855,24 +1281,1422 @@ void Model::CreateWithAssimp(ID3D12Device* dev, const ModelLoadSettings& setting
     aabbMax.z = std::max(aabbMax.z, meshes[i].AABBMax().z);
 
     vtxOffset += meshes[i].NumVertices();
-    idxOffset += meshes[i].NumIndices();
+    ibOffset += uint64_t(meshes[i].NumIndices()) * meshes[i].IndexSize();
   }
 
-  CreateBuffers();
+  // Meshes own disjoint ranges of the vertex and index data, so they are optimized in parallel
+  if (settings.OptimizeMeshes)
+  {
+    Timer timer;
+    timer.init();
+
+    std::vector<MeshOptimizationStats> statsBefore(numMeshes);
+    std::vector<MeshOptimizationStats> statsAfter(numMeshes);
+    getWorkerPool().parallelFor(uint32_t(numMeshes), [&](uint32_t i) {
+      meshes[i].Optimize(
+          &vertices[vertexOffsets[i]], &indices[indexOffsets[i]], &statsBefore[i], &statsAfter[i]);
+    });
+
+    timer.update();
 
-  writeLog("Finished loading scene '%ls'", filePath);
+    MeshOptimizationStats before;
+    MeshOptimizationStats after;
+    for (uint64_t i = 0; i < numMeshes; ++i)
+    {
+      before.add(statsBefore[i]);
+      after.add(statsAfter[i]);
+    }
+
+    writeLog(
+        "Optimized %llu meshes (%llu triangles) in %.2f ms: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, "
+        "overdraw %.3f -> %.3f, overfetch %.3f -> %.3f",
+        numMeshes,
+        after.NumTriangles,
+        timer.m_DeltaMillisecondsD,
+        before.ACMR(),
+        after.ACMR(),
+        before.ATVR(),
+        after.ATVR(),
+        before.Overdraw(),
+        after.Overdraw(),
+        before.Overfetch(),
+        after.Overfetch());
+  }
+
+  if (settings.NumLods > 1)
+    GenerateLods(settings);
 }
 
-void Model::CreateFromMeshData(ID3D12Device* dev, const wchar_t* filePath)
+void Model::GenerateLods(const ModelLoadSettings& settings)
 {
-  if (fileExists(filePath) == false)
-    throw std::exception("Model file does not exist");
+  Timer timer;
+  timer.init();
+
+  // Layout before, with only level 0 in the index data
+  const uint64_t numMeshes = meshes.size();
+  std::vector<uint64_t> vertexOffsets(numMeshes);
+  std::vector<uint64_t> indexOffsets(numMeshes);
+  uint64_t vtxOffset = 0;
+  uint64_t ibOffset = 0;
+  for (uint64_t i = 0; i < numMeshes; ++i)
+  {
+    assert(meshes[i].NumStoredIndices() == meshes[i].NumIndices());
+    ibOffset = AlignIndexOffset(ibOffset, meshes[i].IndexBufferType());
+    vertexOffsets[i] = vtxOffset;
+    indexOffsets[i] = ibOffset;
+    vtxOffset += meshes[i].NumVertices();
+    ibOffset += uint64_t(meshes[i].NumIndices()) * meshes[i].IndexSize();
+  }
+
+  std::vector<std::vector<uint8_t>> lodData(numMeshes);
+  getWorkerPool().parallelFor(uint32_t(numMeshes), [&](uint32_t i) {
+    meshes[i].GenerateLods(
+        &vertices[vertexOffsets[i]], &indices[indexOffsets[i]], settings, lodData[i]);
+  });
+
+  // Every mesh's range becomes level 0 followed by its coarser levels
+  std::vector<uint8_t> lodIndices;
+  bool any32Bit = false;
+  uint64_t numTriangles[MaxMeshLods] = {};
+  for (uint64_t i = 0; i < numMeshes; ++i)
+  {
+    const Mesh& mesh = meshes[i];
+    const uint64_t levelZeroBytes = uint64_t(mesh.NumIndices()) * mesh.IndexSize();
+    const uint64_t offset = AlignIndexOffset(lodIndices.size(), mesh.IndexBufferType());
+    lodIndices.resize(offset + levelZeroBytes + lodData[i].size());
+    memcpy(&lodIndices[offset], &indices[indexOffsets[i]], levelZeroBytes);
+    if (lodData[i].empty() == false)
+      memcpy(&lodIndices[offset + levelZeroBytes], lodData[i].data(), lodData[i].size());
+    any32Bit |= mesh.IndexBufferType() == IndexType::Index32Bit;
+
+    for (const MeshPart& part : mesh.MeshParts())
+      for (uint32_t lod = 0; lod < part.NumLods; ++lod)
+        numTriangles[lod] += part.LodCount(lod) / 3;
+  }
+
+  if (any32Bit)
+    lodIndices.resize(alignUp<uint64_t>(lodIndices.size(), sizeof(uint32_t)));
+  indices.swap(lodIndices);
+
+  timer.update();
+  writeLog(
+      "Generated LODs in %.2f ms, triangles per level: %llu, %llu, %llu, %llu",
+      timer.m_DeltaMillisecondsD,
+      numTriangles[0],
+      numTriangles[1],
+      numTriangles[2],
+      numTriangles[3]);
+  static_assert(MaxMeshLods == 4);
+}
+
+//---------------------------------------------------------------------------//
+// Baked scene cache
+//---------------------------------------------------------------------------//
+// Layout: BakedSceneHeader followed by the sections it points to, every section starts at a
+// BlobSectionAlignment aligned offset so the mapped view can be used in place. Bump
+// BakedSceneVersion whenever the layout or anything that feeds the imported data (post-process
+// flags, MeshVertex) changes, old files are then rejected and rebuilt.
+//
+// Compressed scenes store every mesh's vertices and indices as meshoptimizer codec streams, the
+// streams are packed back to back in the vertex and index sections in mesh order.
+
+static constexpr uint32_t BakedSceneMagic = 0x4E435342; // 'BSCN'
+static constexpr uint32_t BakedSceneVersion = 6;
+
+enum class GeometryEncoding : uint32_t
+{
+  Raw,
+  Meshopt,
+  // Vertex floats additionally went through meshopt_encodeFilterExp()
+  MeshoptExpFilter,
+};
+
+struct BakedSceneHeader
+{
+  uint32_t Magic;
+  uint32_t Version;
+  uint64_t CacheKey;
+  uint64_t FileSize;
+
+  uint32_t VertexStride;
+  uint32_t ForceSRGB;
+  uint32_t NumMeshes;
+  uint32_t NumMeshParts;
+  uint32_t NumMaterials;
+  uint32_t NumSpotLights;
+  uint32_t NumPointLights;
+  uint32_t GeometryEncoding;
+
+  uint64_t NumVertices;
+  uint64_t IndexDataSize;
+  uint64_t NumStringChars;
+  // Sizes of the vertex and index sections when the geometry is encoded
+  uint64_t EncodedVertexDataSize;
+  uint64_t EncodedIndexDataSize;
+
+  glm::vec3 AABBMin;
+  glm::vec3 AABBMax;
+
+  uint64_t MeshesOffset;
+  uint64_t MeshPartsOffset;
+  uint64_t MaterialsOffset;
+  uint64_t SpotLightsOffset;
+  uint64_t PointLightsOffset;
+  uint64_t StringsOffset;
+  uint64_t VerticesOffset;
+  uint64_t IndicesOffset;
+};
+
+// Index ranges are laid out like the index buffer, see Model::AlignIndexOffset()
+struct BakedMesh
+{
+  uint32_t NumVertices;
+  uint32_t NumIndices;
+  uint32_t NumLodIndices;
+  uint32_t IndexType;
+  uint32_t FirstMeshPart;
+  uint32_t NumMeshParts;
+  uint32_t EncodedVertexBytes;
+  uint32_t EncodedIndexBytes;
+  glm::vec3 AABBMin;
+  glm::vec3 AABBMax;
+};
+
+// Texture names live in a shared wchar_t table
+struct BakedMaterial
+{
+  uint32_t NameOffsets[uint64_t(MaterialTextures::Count)];
+  uint32_t NameLengths[uint64_t(MaterialTextures::Count)];
+};
+
+static_assert(std::is_trivially_copyable_v<MeshVertex>);
+static_assert(std::is_trivially_copyable_v<MeshPart>);
+static_assert(std::is_trivially_copyable_v<ModelSpotLight>);
+static_assert(std::is_trivially_copyable_v<ModelPointLight>);
+
+// The exponential filter treats a vertex as a vector of floats
+static_assert(sizeof(MeshVertex) == 14 * sizeof(float));
+
+// Codec streams of one mesh, the index stream covers level 0 and the LODs. Each level is a
+// triangle list, so the whole range is one for the index codec. The codec may rotate the corners
+// of a triangle, order and winding stay the same.
+static void encodeMeshGeometry(
+    const Mesh& mesh,
+    uint32_t mantissaBits,
+    std::vector<uint8_t>& encodedVertices,
+    std::vector<uint8_t>& encodedIndices)
+{
+  const MeshVertex* vertexData = mesh.Vertices();
+  std::vector<MeshVertex> filtered;
+  if (mantissaBits > 0)
+  {
+    assert(mantissaBits <= 24);
+    filtered.resize(mesh.NumVertices());
+    meshopt_encodeFilterExp(
+        filtered.data(),
+        mesh.NumVertices(),
+        sizeof(MeshVertex),
+        int(mantissaBits),
+        &mesh.Vertices()[0].Position.x,
+        meshopt_EncodeExpSeparate);
+    vertexData = filtered.data();
+  }
+
+  encodedVertices.resize(meshopt_encodeVertexBufferBound(mesh.NumVertices(), sizeof(MeshVertex)));
+  encodedVertices.resize(meshopt_encodeVertexBuffer(
+      encodedVertices.data(),
+      encodedVertices.size(),
+      vertexData,
+      mesh.NumVertices(),
+      sizeof(MeshVertex)));
+
+  std::vector<uint32_t> indices32(mesh.NumStoredIndices());
+  for (uint32_t i = 0; i < mesh.NumStoredIndices(); ++i)
+    indices32[i] = mesh.Index(i);
+
+  encodedIndices.resize(meshopt_encodeIndexBufferBound(indices32.size(), mesh.NumVertices()));
+  encodedIndices.resize(meshopt_encodeIndexBuffer(
+      encodedIndices.data(), encodedIndices.size(), indices32.data(), indices32.size()));
+}
+
+// Decodes the streams of encodeMeshGeometry(), fails on malformed streams
+static bool decodeMeshGeometry(
+    const uint8_t* encodedVertices,
+    uint64_t encodedVertexBytes,
+    const uint8_t* encodedIndices,
+    uint64_t encodedIndexBytes,
+    uint32_t numVertices,
+    uint32_t numIndices,
+    IndexType indexType,
+    GeometryEncoding encoding,
+    MeshVertex* dstVertices,
+    void* dstIndices)
+{
+  if (meshopt_decodeVertexBuffer(
+          dstVertices, numVertices, sizeof(MeshVertex), encodedVertices, encodedVertexBytes) != 0)
+    return false;
+  if (encoding == GeometryEncoding::MeshoptExpFilter)
+    meshopt_decodeFilterExp(dstVertices, numVertices, sizeof(MeshVertex));
+
+  return meshopt_decodeIndexBuffer(
+             dstIndices,
+             numIndices,
+             Mesh::IndexSize(indexType),
+             encodedIndices,
+             encodedIndexBytes) == 0;
+}
+
+uint64_t Model::ComputeCacheKey(const ModelLoadSettings& settings)
+{
+  assert(settings.FilePath != nullptr);
+
+  uint64_t fileSize = 0;
+  uint64_t writeTime = 0;
+  if (getFileStamp(settings.FilePath, fileSize, writeTime) == false)
+    return 0;
+
+  const std::wstring path = settings.FilePath;
+  uint64_t key = hashBytes(path.data(), path.size() * sizeof(wchar_t));
+  key = hashValue(fileSize, key);
+  key = hashValue(writeTime, key);
+  key = hashValue(BakedSceneVersion, key);
+  key = hashValue(uint32_t(sizeof(MeshVertex)), key);
+  key = hashValue(settings.SceneScale, key);
+  key = hashValue(uint8_t(settings.ForceSRGB), key);
+  key = hashValue(uint8_t(settings.MergeMeshes), key);
+  key = hashValue(uint8_t(settings.OptimizeMeshes), key);
+  key = hashValue(settings.NumLods, key);
+  key = hashBytes(settings.LodTargetRatios, sizeof(settings.LodTargetRatios), key);
+  key = hashBytes(settings.LodMaxErrors, sizeof(settings.LodMaxErrors), key);
+  key = hashValue(uint8_t(settings.CompressGeometry), key);
+  key = hashValue(settings.CompressGeometry ? settings.CompressionMantissaBits : 0u, key);
+
+  // Zero is reserved for "don't check the key"
+  return key != 0 ? key : 1;
+}
+
+std::wstring Model::CachePath(const ModelLoadSettings& settings)
+{
+  assert(settings.FilePath != nullptr);
+  return std::wstring(settings.FilePath) + L".bakedscene";
+}
+
+bool Model::SaveMeshData(
+    const wchar_t* filePath,
+    uint64_t cacheKey,
+    bool compressGeometry,
+    uint32_t compressionMantissaBits) const
+{
+  assert(meshes.size() > 0);
+
+  const uint32_t numMeshes = uint32_t(meshes.size());
+  std::vector<std::vector<uint8_t>> encodedVertices(compressGeometry ? numMeshes : 0);
+  std::vector<std::vector<uint8_t>> encodedIndices(compressGeometry ? numMeshes : 0);
+  if (compressGeometry)
+  {
+    getWorkerPool().parallelFor(numMeshes, [&](uint32_t meshIdx) {
+      encodeMeshGeometry(
+          meshes[meshIdx],
+          compressionMantissaBits,
+          encodedVertices[meshIdx],
+          encodedIndices[meshIdx]);
+    });
+  }
+
+  std::vector<BakedMesh> bakedMeshes(meshes.size());
+  std::vector<MeshPart> bakedParts;
+  uint64_t numVertices = 0;
+  uint64_t indexDataSize = 0;
+  bool any32Bit = false;
+  for (uint64_t i = 0; i < meshes.size(); ++i)
+  {
+    const Mesh& mesh = meshes[i];
+    BakedMesh& bakedMesh = bakedMeshes[i];
+    bakedMesh.NumVertices = mesh.NumVertices();
+    bakedMesh.NumIndices = mesh.NumIndices();
+    bakedMesh.NumLodIndices = mesh.NumStoredIndices() - mesh.NumIndices();
+    bakedMesh.IndexType = uint32_t(mesh.IndexBufferType());
+    bakedMesh.FirstMeshPart = uint32_t(bakedParts.size());
+    bakedMesh.NumMeshParts = uint32_t(mesh.NumMeshParts());
+    bakedMesh.EncodedVertexBytes = compressGeometry ? uint32_t(encodedVertices[i].size()) : 0;
+    bakedMesh.EncodedIndexBytes = compressGeometry ? uint32_t(encodedIndices[i].size()) : 0;
+    bakedMesh.AABBMin = mesh.AABBMin();
+    bakedMesh.AABBMax = mesh.AABBMax();
+    bakedParts.insert(bakedParts.end(), mesh.MeshParts().begin(), mesh.MeshParts().end());
+    numVertices += mesh.NumVertices();
+    indexDataSize = AlignIndexOffset(indexDataSize, mesh.IndexBufferType());
+    indexDataSize += uint64_t(mesh.NumStoredIndices()) * mesh.IndexSize();
+    any32Bit |= mesh.IndexBufferType() == IndexType::Index32Bit;
+  }
+  if (any32Bit)
+    indexDataSize = alignUp<uint64_t>(indexDataSize, sizeof(uint32_t));
+
+  std::vector<BakedMaterial> bakedMaterials(meshMaterials.size());
+  std::vector<wchar_t> strings;
+  for (uint64_t i = 0; i < meshMaterials.size(); ++i)
+  {
+    for (uint64_t texType = 0; texType < uint64_t(MaterialTextures::Count); ++texType)
+    {
+      const std::wstring& name = meshMaterials[i].TextureNames[texType];
+      bakedMaterials[i].NameOffsets[texType] = uint32_t(strings.size());
+      bakedMaterials[i].NameLengths[texType] = uint32_t(name.length());
+      strings.insert(strings.end(), name.begin(), name.end());
+    }
+  }
+
+  BakedSceneHeader header = {};
+  header.Magic = BakedSceneMagic;
+  header.Version = BakedSceneVersion;
+  header.CacheKey = cacheKey;
+  header.VertexStride = sizeof(MeshVertex);
+  header.ForceSRGB = forceSRGB ? 1 : 0;
+  header.NumMeshes = uint32_t(bakedMeshes.size());
+  header.NumMeshParts = uint32_t(bakedParts.size());
+  header.NumMaterials = uint32_t(bakedMaterials.size());
+  header.NumSpotLights = uint32_t(spotLights.size());
+  header.NumPointLights = uint32_t(pointLights.size());
+  header.GeometryEncoding = uint32_t(GeometryEncoding::Raw);
+  if (compressGeometry)
+  {
+    header.GeometryEncoding = uint32_t(
+        compressionMantissaBits > 0 ? GeometryEncoding::MeshoptExpFilter
+                                    : GeometryEncoding::Meshopt);
+  }
+  header.NumVertices = numVertices;
+  header.IndexDataSize = indexDataSize;
+  header.NumStringChars = strings.size();
+  header.AABBMin = aabbMin;
+  header.AABBMax = aabbMax;
+
+  std::vector<uint8_t> blob;
+  appendBlobSection(blob, &header, 1);
+  header.MeshesOffset = appendBlobSection(blob, bakedMeshes.data(), bakedMeshes.size());
+  header.MeshPartsOffset = appendBlobSection(blob, bakedParts.data(), bakedParts.size());
+  header.MaterialsOffset = appendBlobSection(blob, bakedMaterials.data(), bakedMaterials.size());
+  header.SpotLightsOffset = appendBlobSection(blob, spotLights.data(), spotLights.size());
+  header.PointLightsOffset = appendBlobSection(blob, pointLights.data(), pointLights.size());
+  header.StringsOffset = appendBlobSection(blob, strings.data(), strings.size());
+
+  if (compressGeometry)
+  {
+    for (const std::vector<uint8_t>& encoded : encodedVertices)
+      header.EncodedVertexDataSize += encoded.size();
+    for (const std::vector<uint8_t>& encoded : encodedIndices)
+      header.EncodedIndexDataSize += encoded.size();
+
+    header.VerticesOffset =
+        appendBlobSection<uint8_t>(blob, nullptr, header.EncodedVertexDataSize);
+    header.IndicesOffset = appendBlobSection<uint8_t>(blob, nullptr, header.EncodedIndexDataSize);
+    blob.resize(alignUp<uint64_t>(blob.size(), BlobSectionAlignment));
+
+    uint64_t vertexBytes = 0;
+    uint64_t indexBytes = 0;
+    for (uint32_t i = 0; i < numMeshes; ++i)
+    {
+      memcpy(
+          blob.data() + header.VerticesOffset + vertexBytes,
+          encodedVertices[i].data(),
+          encodedVertices[i].size());
+      memcpy(
+          blob.data() + header.IndicesOffset + indexBytes,
+          encodedIndices[i].data(),
+          encodedIndices[i].size());
+      vertexBytes += encodedVertices[i].size();
+      indexBytes += encodedIndices[i].size();
+    }
+  }
+  else
+  {
+    header.VerticesOffset = appendBlobSection<MeshVertex>(blob, nullptr, numVertices);
+    header.IndicesOffset = appendBlobSection<uint8_t>(blob, nullptr, indexDataSize);
+    blob.resize(alignUp<uint64_t>(blob.size(), BlobSectionAlignment));
+
+    // Gather through the meshes so this also works for models that were mapped from a cache
+    uint64_t vtxOffset = 0;
+    uint64_t ibOffset = 0;
+    for (const Mesh& mesh : meshes)
+    {
+      ibOffset = AlignIndexOffset(ibOffset, mesh.IndexBufferType());
+      memcpy(
+          blob.data() + header.VerticesOffset + vtxOffset * sizeof(MeshVertex),
+          mesh.Vertices(),
+          mesh.NumVertices() * sizeof(MeshVertex));
+      memcpy(
+          blob.data() + header.IndicesOffset + ibOffset,
+          mesh.Indices(),
+          uint64_t(mesh.NumStoredIndices()) * mesh.IndexSize());
+      vtxOffset += mesh.NumVertices();
+      ibOffset += uint64_t(mesh.NumStoredIndices()) * mesh.IndexSize();
+    }
+  }
+
+  header.FileSize = blob.size();
+  memcpy(blob.data(), &header, sizeof(header));
+
+  if (writeDataToFile(filePath, blob.data(), blob.size()) == false)
+  {
+    writeLog("Failed to write baked scene '%ls'", filePath);
+    return false;
+  }
+
+  return true;
+}
+
+// True when every index points at one of the mesh's numVertices vertices
+template <typename T>
+static bool indicesInRange(const T* indexData, uint64_t numIndices, uint64_t numVertices)
+{
+  for (uint64_t i = 0; i < numIndices; ++i)
+  {
+    if (indexData[i] >= numVertices)
+      return false;
+  }
+  return true;
+}
+
+bool Model::MapMeshData(const wchar_t* filePath, uint64_t cacheKey)
+{
+  if (bakedFile.init(filePath) == false)
+    return false;
+
+  const uint64_t size = bakedFile.m_Size;
+  const BakedSceneHeader& header = *bakedFile.at<BakedSceneHeader>(0);
+
+  bool valid = size >= sizeof(BakedSceneHeader) && header.Magic == BakedSceneMagic &&
+               header.Version == BakedSceneVersion && header.FileSize == size &&
+               header.VertexStride == sizeof(MeshVertex) &&
+               header.GeometryEncoding <= uint32_t(GeometryEncoding::MeshoptExpFilter) &&
+               (cacheKey == 0 || header.CacheKey == cacheKey);
+  const GeometryEncoding encoding = GeometryEncoding(valid ? header.GeometryEncoding : 0);
+  const bool encoded = encoding != GeometryEncoding::Raw;
+
+  valid = valid && header.NumMeshes > 0 &&
+          bakedFile.containsSection(header.MeshesOffset, sizeof(BakedMesh), header.NumMeshes) &&
+          bakedFile.containsSection(
+              header.MeshPartsOffset, sizeof(MeshPart), header.NumMeshParts) &&
+          bakedFile.containsSection(
+              header.MaterialsOffset, sizeof(BakedMaterial), header.NumMaterials) &&
+          bakedFile.containsSection(
+              header.SpotLightsOffset, sizeof(ModelSpotLight), header.NumSpotLights) &&
+          bakedFile.containsSection(
+              header.PointLightsOffset, sizeof(ModelPointLight), header.NumPointLights) &&
+          bakedFile.containsSection(header.StringsOffset, sizeof(wchar_t), header.NumStringChars);
+  if (encoded)
+  {
+    valid = valid &&
+            bakedFile.containsSection(
+                header.VerticesOffset, sizeof(uint8_t), header.EncodedVertexDataSize) &&
+            bakedFile.containsSection(
+                header.IndicesOffset, sizeof(uint8_t), header.EncodedIndexDataSize);
+  }
+  else
+  {
+    valid = valid &&
+            bakedFile.containsSection(
+                header.VerticesOffset, sizeof(MeshVertex), header.NumVertices) &&
+            bakedFile.containsSection(header.IndicesOffset, sizeof(uint8_t), header.IndexDataSize);
+  }
+
+  if (valid == false)
+  {
+    bakedFile.deinit();
+    return false;
+  }
+
+  const BakedMesh* bakedMeshes = bakedFile.at<BakedMesh>(header.MeshesOffset);
+  const MeshPart* bakedParts = bakedFile.at<MeshPart>(header.MeshPartsOffset);
+  const BakedMaterial* bakedMaterials = bakedFile.at<BakedMaterial>(header.MaterialsOffset);
+  const wchar_t* strings = bakedFile.at<wchar_t>(header.StringsOffset);
+  const MeshVertex* vertexData = bakedFile.at<MeshVertex>(header.VerticesOffset);
+  const uint8_t* indexData = bakedFile.at<uint8_t>(header.IndicesOffset);
+
+  // Validate the per-mesh ranges before pointing anything at them
+  uint64_t totalVertices = 0;
+  uint64_t totalIndexBytes = 0;
+  uint64_t totalEncodedVertexBytes = 0;
+  uint64_t totalEncodedIndexBytes = 0;
+  for (uint32_t i = 0; i < header.NumMeshes; ++i)
+  {
+    const BakedMesh& bakedMesh = bakedMeshes[i];
+    valid = valid && bakedMesh.IndexType <= uint32_t(IndexType::Index32Bit) &&
+            uint64_t(bakedMesh.FirstMeshPart) + bakedMesh.NumMeshParts <= header.NumMeshParts;
+    if (valid == false)
+      break;
+
+    // Every level of every part has to stay inside the mesh's range
+    const uint64_t numStoredIndices = uint64_t(bakedMesh.NumIndices) + bakedMesh.NumLodIndices;
+    for (uint32_t p = 0; valid && p < bakedMesh.NumMeshParts; ++p)
+    {
+      const MeshPart& part = bakedParts[bakedMesh.FirstMeshPart + p];
+      valid = part.NumLods >= 1 && part.NumLods <= MaxMeshLods;
+      for (uint32_t lod = 0; valid && lod < part.NumLods; ++lod)
+        valid = uint64_t(part.LodStart(lod)) + part.LodCount(lod) <= numStoredIndices;
+    }
+    if (valid == false)
+      break;
+
+    const IndexType indexType = IndexType(bakedMesh.IndexType);
+    totalVertices += bakedMesh.NumVertices;
+    totalIndexBytes = AlignIndexOffset(totalIndexBytes, indexType);
+    totalIndexBytes += numStoredIndices * Mesh::IndexSize(indexType);
+    totalEncodedVertexBytes += bakedMesh.EncodedVertexBytes;
+    totalEncodedIndexBytes += bakedMesh.EncodedIndexBytes;
+  }
+  if (encoded)
+  {
+    valid = valid && totalEncodedVertexBytes <= header.EncodedVertexDataSize &&
+            totalEncodedIndexBytes <= header.EncodedIndexDataSize;
+  }
+  for (uint32_t i = 0; i < header.NumMaterials; ++i)
+    for (uint64_t texType = 0; texType < uint64_t(MaterialTextures::Count); ++texType)
+      valid = valid && uint64_t(bakedMaterials[i].NameOffsets[texType]) +
+                               bakedMaterials[i].NameLengths[texType] <=
+                           header.NumStringChars;
+
+  if (valid == false || totalVertices != header.NumVertices ||
+      totalIndexBytes > header.IndexDataSize)
+  {
+    bakedFile.deinit();
+    return false;
+  }
+
+  // Compressed geometry is decoded into the model's own arrays, one mesh per job
+  if (encoded)
+  {
+    std::vector<uint64_t> vertexOffsets(header.NumMeshes);
+    std::vector<uint64_t> indexOffsets(header.NumMeshes);
+    std::vector<uint64_t> encodedVertexOffsets(header.NumMeshes);
+    std::vector<uint64_t> encodedIndexOffsets(header.NumMeshes);
+    uint64_t vtxOffset = 0;
+    uint64_t ibOffset = 0;
+    uint64_t encodedVtxOffset = 0;
+    uint64_t encodedIbOffset = 0;
+    for (uint32_t i = 0; i < header.NumMeshes; ++i)
+    {
+      const BakedMesh& bakedMesh = bakedMeshes[i];
+      const IndexType indexType = IndexType(bakedMesh.IndexType);
+      ibOffset = AlignIndexOffset(ibOffset, indexType);
+      vertexOffsets[i] = vtxOffset;
+      indexOffsets[i] = ibOffset;
+      encodedVertexOffsets[i] = encodedVtxOffset;
+      encodedIndexOffsets[i] = encodedIbOffset;
+
+      vtxOffset += bakedMesh.NumVertices;
+      ibOffset += (uint64_t(bakedMesh.NumIndices) + bakedMesh.NumLodIndices) *
+                  Mesh::IndexSize(indexType);
+      encodedVtxOffset += bakedMesh.EncodedVertexBytes;
+      encodedIbOffset += bakedMesh.EncodedIndexBytes;
+    }
+
+    vertices.resize(header.NumVertices);
+    indices.assign(header.IndexDataSize, 0);
+    const uint8_t* encodedVertices = bakedFile.at<uint8_t>(header.VerticesOffset);
+    const uint8_t* encodedIndices = bakedFile.at<uint8_t>(header.IndicesOffset);
+    std::atomic<bool> decoded = true;
+    getWorkerPool().parallelFor(header.NumMeshes, [&](uint32_t meshIdx) {
+      const BakedMesh& bakedMesh = bakedMeshes[meshIdx];
+      if (decodeMeshGeometry(
+              encodedVertices + encodedVertexOffsets[meshIdx],
+              bakedMesh.EncodedVertexBytes,
+              encodedIndices + encodedIndexOffsets[meshIdx],
+              bakedMesh.EncodedIndexBytes,
+              bakedMesh.NumVertices,
+              bakedMesh.NumIndices + bakedMesh.NumLodIndices,
+              IndexType(bakedMesh.IndexType),
+              encoding,
+              &vertices[vertexOffsets[meshIdx]],
+              &indices[indexOffsets[meshIdx]]) == false)
+        decoded = false;
+    });
+
+    if (decoded == false)
+    {
+      vertices.clear();
+      indices.clear();
+      bakedFile.deinit();
+      return false;
+    }
+
+    vertexData = vertices.data();
+    indexData = indices.data();
+  }
+
+  // The CPU side (meshlets, LODs, software occlusion) indexes the vertices directly, so a stale
+  // or corrupt file can't be allowed to point past a mesh's own vertices
+  {
+    std::vector<uint64_t> indexOffsets(header.NumMeshes);
+    uint64_t ibOffset = 0;
+    for (uint32_t i = 0; i < header.NumMeshes; ++i)
+    {
+      const IndexType indexType = IndexType(bakedMeshes[i].IndexType);
+      ibOffset = AlignIndexOffset(ibOffset, indexType);
+      indexOffsets[i] = ibOffset;
+      ibOffset += (uint64_t(bakedMeshes[i].NumIndices) + bakedMeshes[i].NumLodIndices) *
+                  Mesh::IndexSize(indexType);
+    }
+
+    std::atomic<bool> inRange = true;
+    getWorkerPool().parallelFor(header.NumMeshes, [&](uint32_t meshIdx) {
+      const BakedMesh& bakedMesh = bakedMeshes[meshIdx];
+      const uint8_t* meshIndices = indexData + indexOffsets[meshIdx];
+      const uint64_t numIndices = uint64_t(bakedMesh.NumIndices) + bakedMesh.NumLodIndices;
+      bool meshInRange = false;
+      if (IndexType(bakedMesh.IndexType) == IndexType::Index32Bit)
+      {
+        const uint32_t* indices32 = reinterpret_cast<const uint32_t*>(meshIndices);
+        meshInRange = indicesInRange(indices32, numIndices, bakedMesh.NumVertices);
+      }
+      else
+      {
+        const uint16_t* indices16 = reinterpret_cast<const uint16_t*>(meshIndices);
+        meshInRange = indicesInRange(indices16, numIndices, bakedMesh.NumVertices);
+      }
+      if (meshInRange == false)
+        inRange = false;
+    });
+
+    if (inRange == false)
+    {
+      writeLog("Baked scene '%ls' has out of range indices", filePath);
+      vertices.clear();
+      indices.clear();
+      bakedFile.deinit();
+      return false;
+    }
+  }
 
   fileDirectory = getDirectoryFromFilePath(filePath);
+  forceSRGB = header.ForceSRGB != 0;
+  aabbMin = header.AABBMin;
+  aabbMax = header.AABBMax;
+
+  spotLights.assign(
+      bakedFile.at<ModelSpotLight>(header.SpotLightsOffset),
+      bakedFile.at<ModelSpotLight>(header.SpotLightsOffset) + header.NumSpotLights);
+  pointLights.assign(
+      bakedFile.at<ModelPointLight>(header.PointLightsOffset),
+      bakedFile.at<ModelPointLight>(header.PointLightsOffset) + header.NumPointLights);
+
+  meshMaterials.resize(header.NumMaterials);
+  for (uint32_t i = 0; i < header.NumMaterials; ++i)
+  {
+    for (uint64_t texType = 0; texType < uint64_t(MaterialTextures::Count); ++texType)
+    {
+      const wchar_t* name = strings + bakedMaterials[i].NameOffsets[texType];
+      meshMaterials[i].TextureNames[texType].assign(name, bakedMaterials[i].NameLengths[texType]);
+    }
+  }
 
-  CreateBuffers();
+  meshes.resize(header.NumMeshes);
+  uint64_t vtxOffset = 0;
+  uint64_t ibOffset = 0;
+  for (uint32_t i = 0; i < header.NumMeshes; ++i)
+  {
+    const BakedMesh& bakedMesh = bakedMeshes[i];
+    Mesh& mesh = meshes[i];
+    mesh.numVertices = bakedMesh.NumVertices;
+    mesh.numIndices = bakedMesh.NumIndices;
+    mesh.numLodIndices = bakedMesh.NumLodIndices;
+    mesh.indexType = IndexType(bakedMesh.IndexType);
+    mesh.aabbMin = bakedMesh.AABBMin;
+    mesh.aabbMax = bakedMesh.AABBMax;
+    mesh.meshParts.assign(
+        bakedParts + bakedMesh.FirstMeshPart,
+        bakedParts + bakedMesh.FirstMeshPart + bakedMesh.NumMeshParts);
+
+    // Same pointers InitCommon() sets up later, so the CPU side is usable without a device
+    ibOffset = AlignIndexOffset(ibOffset, mesh.indexType);
+    mesh.vertices = vertexData + vtxOffset;
+    mesh.indices = indexData + ibOffset;
+
+    vtxOffset += bakedMesh.NumVertices;
+    ibOffset += uint64_t(mesh.NumStoredIndices()) * mesh.IndexSize();
+  }
+
+  // Everything needed was copied or decoded out of the file
+  if (encoded)
+    bakedFile.deinit();
+
+  return true;
+}
+
+void Model::ReleaseMeshData()
+{
+  for (uint64_t i = 0; i < meshes.size(); ++i)
+    meshes[i].Shutdown();
+  meshes.clear();
+  meshMaterials.clear();
+  spotLights.clear();
+  pointLights.clear();
+  vertices.clear();
+  indices.clear();
+  bakedFile.deinit();
+}
 
+void Model::CreateBuffersFromMeshData()
+{
+  if (bakedFile.isMapped() == false)
+  {
+    CreateBuffers();
+    return;
+  }
+
+  const BakedSceneHeader& header = *bakedFile.at<BakedSceneHeader>(0);
+  CreateBuffers(
+      bakedFile.at<MeshVertex>(header.VerticesOffset),
+      header.NumVertices,
+      bakedFile.at<uint8_t>(header.IndicesOffset),
+      header.IndexDataSize);
+}
+
+void Model::CreateFromMeshData(ID3D12Device* dev, const wchar_t* filePath, VertexFormat format)
+{
+  if (fileExists(filePath) == false)
+    throw std::exception("Model file does not exist");
+
+  if (MapMeshData(filePath, 0) == false)
+    throw std::exception("Baked scene file is invalid or from an older version");
+
+  vertexFormat = format;
   loadMaterialResources(dev, meshMaterials, fileDirectory, forceSRGB, materialTextures);
+  CreateBuffersFromMeshData();
+
+  writeLog("Finished loading baked scene '%ls'", filePath);
+}
+
+void Model::CreateWithCache(ID3D12Device* dev, const ModelLoadSettings& settings)
+{
+  const uint64_t cacheKey = ComputeCacheKey(settings);
+  const std::wstring cachePath = CachePath(settings);
+
+  if (cacheKey != 0 && MapMeshData(cachePath.c_str(), cacheKey))
+  {
+    // Textures are resolved relative to the source asset
+    fileDirectory = getDirectoryFromFilePath(settings.FilePath);
+    vertexFormat = VertexFormatFromSettings(settings);
+    optimizeDepthIndices = settings.OptimizeDepthIndices;
+    loadMaterialResources(dev, meshMaterials, fileDirectory, forceSRGB, materialTextures);
+    CreateBuffersFromMeshData();
+
+    writeLog("Loaded scene '%ls' from cache '%ls'", settings.FilePath, cachePath.c_str());
+    return;
+  }
+
+  writeLog("No valid scene cache at '%ls', importing with Assimp", cachePath.c_str());
+  CreateWithAssimp(dev, settings);
+
+  if (cacheKey != 0)
+  {
+    SaveMeshData(
+        cachePath.c_str(),
+        cacheKey,
+        settings.CompressGeometry,
+        settings.CompressionMantissaBits);
+  }
+}
+
+bool Model::LoadMeshData(const ModelLoadSettings& settings)
+{
+  assert(settings.FilePath != nullptr);
+
+  const uint64_t cacheKey = ComputeCacheKey(settings);
+  if (cacheKey == 0)
+  {
+    writeLog("LoadMeshData: can't read '%ls'", settings.FilePath);
+    return false;
+  }
+
+  if (MapMeshData(CachePath(settings).c_str(), cacheKey) == false)
+    ImportWithAssimp(settings);
+  return meshes.empty() == false;
+}
+
+void Model::ReportMeshOptimization(const ModelLoadSettings& settings)
+{
+  assert(settings.FilePath != nullptr);
+  if (fileExists(settings.FilePath) == false)
+  {
+    writeLog("ReportMeshOptimization: can't read '%ls'", settings.FilePath);
+    return;
+  }
+
+  // The stats are logged by the import itself
+  ModelLoadSettings optimizeSettings = settings;
+  optimizeSettings.OptimizeMeshes = true;
+
+  Model model;
+  model.ImportWithAssimp(optimizeSettings);
+  model.ReleaseMeshData();
+}
+
+void Model::BenchmarkLoad(const ModelLoadSettings& settings, uint32_t numIterations)
+{
+  assert(numIterations > 0);
+
+  const uint64_t cacheKey = ComputeCacheKey(settings);
+  const std::wstring cachePath = CachePath(settings);
+  if (cacheKey == 0)
+  {
+    writeLog("BenchmarkLoad: can't read '%ls'", settings.FilePath);
+    return;
+  }
+
+  Timer timer;
+  timer.init();
+
+  // Checksum over the geometry so both paths actually touch every page of the data
+  auto checksumModel = [](const Model& model) {
+    uint64_t checksum = 0;
+    for (const Mesh& mesh : model.meshes)
+    {
+      checksum = hashBytes(mesh.Vertices(), sizeof(MeshVertex) * mesh.NumVertices(), checksum);
+      const uint64_t indexBytes = uint64_t(mesh.IndexSize()) * mesh.NumIndices();
+      checksum = hashBytes(mesh.Indices(), indexBytes, checksum);
+    }
+    return checksum;
+  };
+
+  double assimpMs = 0.0;
+  uint64_t assimpChecksum = 0;
+  for (uint32_t i = 0; i < numIterations; ++i)
+  {
+    Model model;
+    timer.update();
+    model.ImportWithAssimp(settings);
+    assimpChecksum = checksumModel(model);
+    timer.update();
+    assimpMs += timer.m_DeltaMillisecondsD;
+
+    if (i == 0 &&
+        model.SaveMeshData(
+            cachePath.c_str(),
+            cacheKey,
+            settings.CompressGeometry,
+            settings.CompressionMantissaBits) == false)
+    {
+      model.ReleaseMeshData();
+      return;
+    }
+    model.ReleaseMeshData();
+  }
+
+  double cacheMs = 0.0;
+  uint64_t cacheChecksum = 0;
+  for (uint32_t i = 0; i < numIterations; ++i)
+  {
+    Model model;
+    timer.update();
+    const bool mapped = model.MapMeshData(cachePath.c_str(), cacheKey);
+    cacheChecksum = mapped ? checksumModel(model) : 0;
+    timer.update();
+    cacheMs += timer.m_DeltaMillisecondsD;
+    model.ReleaseMeshData();
+
+    if (mapped == false)
+    {
+      writeLog("BenchmarkLoad: failed to map '%ls'", cachePath.c_str());
+      return;
+    }
+  }
+
+  writeLog(
+      "BenchmarkLoad '%ls': Assimp %.2f ms, mapped cache %.2f ms (avg of %u), data %s",
+      settings.FilePath,
+      assimpMs / numIterations,
+      cacheMs / numIterations,
+      numIterations,
+      assimpChecksum == cacheChecksum ? "matches" : "MISMATCH");
+}
+
+bool Model::ValidateWideIndices(const wchar_t* tempFilePath, uint32_t gridSize)
+{
+  assert(tempFilePath != nullptr && gridSize > 1);
+
+  Timer timer;
+  timer.init();
+
+  // A 16-bit box followed by the grid, laid out the same way ImportWithAssimp() does it
+  const uint64_t numGridVertices = Mesh::GridVertexCount(gridSize);
+  const IndexType gridIndexType = Mesh::IndexTypeForVertexCount(numGridVertices);
+  const uint64_t boxIndexBytes = NumBoxIndices * sizeof(uint16_t);
+  const uint64_t gridIndexOffset = AlignIndexOffset(boxIndexBytes, gridIndexType);
+  const uint64_t gridIndexBytes =
+      Mesh::GridIndexCount(gridSize) * Mesh::IndexSize(gridIndexType);
+
+  Model model;
+  model.vertices.resize(NumBoxVerts + numGridVertices);
+  model.indices.assign(alignUp<uint64_t>(gridIndexOffset + gridIndexBytes, 4), 0);
+  model.meshes.resize(2);
+  model.meshes[0].InitBox(
+      glm::vec3(1.0f),
+      glm::vec3(0.0f),
+      glm::quat(0, 0, 0, 1),
+      0,
+      model.vertices.data(),
+      reinterpret_cast<uint16_t*>(model.indices.data()));
+  model.meshes[1].InitGrid(
+      gridSize, 0.1f, 0, &model.vertices[NumBoxVerts], &model.indices[gridIndexOffset]);
+
+  // No device, so only the CPU pointers are set up
+  model.meshes[0].InitCommon(model.vertices.data(), model.indices.data(), 0, 0, 0, 0);
+  model.meshes[1].InitCommon(
+      &model.vertices[NumBoxVerts],
+      &model.indices[gridIndexOffset],
+      0,
+      0,
+      NumBoxVerts,
+      gridIndexOffset / Mesh::IndexSize(gridIndexType));
+  model.aabbMin = glm::min(model.meshes[0].AABBMin(), model.meshes[1].AABBMin());
+  model.aabbMax = glm::max(model.meshes[0].AABBMax(), model.meshes[1].AABBMax());
+  timer.update();
+  const double generateMs = timer.m_DeltaMillisecondsD;
+
+  bool valid = model.meshes[0].IndexBufferType() == IndexType::Index16Bit &&
+               model.meshes[1].IndexBufferType() == gridIndexType;
+
+  // Round trip through the baked format, which is where the per-mesh widths are persisted
+  Model loaded;
+  valid = valid && model.SaveMeshData(tempFilePath, 1) && loaded.MapMeshData(tempFilePath, 1);
+  timer.update();
+  const double bakeMs = timer.m_DeltaMillisecondsD;
+
+  uint32_t maxIndex = 0;
+  for (uint64_t meshIdx = 0; valid && meshIdx < model.meshes.size(); ++meshIdx)
+  {
+    const Mesh& src = model.meshes[meshIdx];
+    const Mesh& dst = loaded.meshes[meshIdx];
+    valid = dst.IndexBufferType() == src.IndexBufferType() &&
+            dst.NumIndices() == src.NumIndices() && dst.NumVertices() == src.NumVertices();
+
+    for (uint64_t i = 0; valid && i < src.NumIndices(); ++i)
+    {
+      const uint32_t index = src.Index(i);
+      valid = index < src.NumVertices() && dst.Index(i) == index;
+      maxIndex = std::max(maxIndex, index);
+    }
+  }
+
+  // Every vertex of the grid is referenced, so the widest index must have survived
+  valid = valid && maxIndex == numGridVertices - 1;
+
+  loaded.ReleaseMeshData();
+  model.ReleaseMeshData();
+  DeleteFileW(tempFilePath);
+
+  writeLog(
+      "ValidateWideIndices: %llu vertices, %u-bit indices, generate %.2f ms, bake %.2f ms, %s",
+      numGridVertices,
+      Mesh::IndexSize(gridIndexType) * 8,
+      generateMs,
+      bakeMs,
+      valid ? "passed" : "FAILED");
+
+  return valid;
+}
+
+// Largest vertical distance between the grid vertices and the triangles in [start, start + count)
+// of a heightfield grid mesh, every grid vertex has to be covered by a triangle. Small folds
+// cover a vertex more than once, the closest triangle counts then.
+static float measureHeightfieldError(
+    const Mesh& mesh, uint32_t gridSize, uint32_t start, uint32_t count, bool& covered)
+{
+  const MeshVertex* vertices = mesh.Vertices();
+  std::vector<float> vertexErrors(mesh.NumVertices(), maxFloat);
+  for (uint32_t tri = start; tri < start + count; tri += 3)
+  {
+    const uint32_t idx[3] = {mesh.Index(tri), mesh.Index(tri + 1), mesh.Index(tri + 2)};
+    glm::ivec2 corners[3];
+    for (uint32_t c = 0; c < 3; ++c)
+      corners[c] = glm::ivec2(idx[c] % gridSize, idx[c] / gridSize);
+
+    const int32_t area = (corners[1].x - corners[0].x) * (corners[2].y - corners[0].y) -
+                         (corners[2].x - corners[0].x) * (corners[1].y - corners[0].y);
+    if (area == 0)
+      continue;
+
+    const glm::ivec2 minCorner = glm::min(glm::min(corners[0], corners[1]), corners[2]);
+    const glm::ivec2 maxCorner = glm::max(glm::max(corners[0], corners[1]), corners[2]);
+    for (int32_t z = minCorner.y; z <= maxCorner.y; ++z)
+    {
+      for (int32_t x = minCorner.x; x <= maxCorner.x; ++x)
+      {
+        // Barycentrics in grid units, exact for points on the edges
+        const int32_t w0 = (corners[1].x - x) * (corners[2].y - z) -
+                           (corners[2].x - x) * (corners[1].y - z);
+        const int32_t w1 = (corners[2].x - x) * (corners[0].y - z) -
+                           (corners[0].x - x) * (corners[2].y - z);
+        const int32_t w2 = area - w0 - w1;
+        if ((area > 0 && (w0 < 0 || w1 < 0 || w2 < 0)) ||
+            (area < 0 && (w0 > 0 || w1 > 0 || w2 > 0)))
+          continue;
+
+        const float height = (w0 * vertices[idx[0]].Position.y + w1 * vertices[idx[1]].Position.y +
+                              w2 * vertices[idx[2]].Position.y) /
+                             float(area);
+        const uint32_t vertexIdx = uint32_t(z) * gridSize + uint32_t(x);
+        vertexErrors[vertexIdx] =
+            std::min(vertexErrors[vertexIdx], std::abs(height - vertices[vertexIdx].Position.y));
+      }
+    }
+  }
+
+  const float maxError = *std::max_element(vertexErrors.begin(), vertexErrors.end());
+  covered = maxError != maxFloat;
+  return maxError;
+}
+
+bool Model::ValidateLodGeneration(uint32_t gridSize)
+{
+  assert(gridSize > 1);
+
+  Timer timer;
+  timer.init();
+
+  const uint64_t numGridVertices = Mesh::GridVertexCount(gridSize);
+  const IndexType gridIndexType = Mesh::IndexTypeForVertexCount(numGridVertices);
+  const uint64_t gridIndexBytes =
+      Mesh::GridIndexCount(gridSize) * Mesh::IndexSize(gridIndexType);
+  const float cellSize = 0.1f;
+
+  Model model;
+  model.vertices.resize(numGridVertices);
+  model.indices.assign(alignUp<uint64_t>(gridIndexBytes, 4), 0);
+  model.meshes.resize(1);
+  Mesh& mesh = model.meshes[0];
+  mesh.InitGrid(gridSize, cellSize, 0, model.vertices.data(), model.indices.data());
+
+  // Rolling hills, smooth enough for the coarse levels to drop most of the triangles
+  const float extent = (gridSize - 1) * cellSize;
+  mesh.aabbMin = glm::vec3(maxFloat);
+  mesh.aabbMax = glm::vec3(-maxFloat);
+  for (MeshVertex& vertex : model.vertices)
+  {
+    vertex.Position.y = 0.05f * extent * std::sin(vertex.Position.x * 6.0f / extent) *
+                        std::cos(vertex.Position.z * 4.0f / extent);
+    mesh.aabbMin = glm::min(mesh.aabbMin, vertex.Position);
+    mesh.aabbMax = glm::max(mesh.aabbMax, vertex.Position);
+  }
+
+  ModelLoadSettings settings;
+  settings.NumLods = MaxMeshLods;
+  model.GenerateLods(settings);
+  mesh.InitCommon(model.vertices.data(), model.indices.data(), 0, 0, 0, 0);
+  timer.update();
+  const double generateMs = timer.m_DeltaMillisecondsD;
+
+  // Bounds are relative to the extent the simplifier measures with. The quadric error is an
+  // estimate of the distance to the original surface, so the measured one gets some slack.
+  const float errorScale = meshopt_simplifyScale(
+      &model.vertices[0].Position.x, numGridVertices, sizeof(MeshVertex));
+  const float measuredSlack = 1.5f;
+
+  const MeshPart& part = mesh.MeshParts()[0];
+  bool valid = part.NumLods == MaxMeshLods;
+  for (uint32_t lod = 1; valid && lod < part.NumLods; ++lod)
+  {
+    const uint32_t count = part.LodCount(lod);
+    const uint32_t targetCount = uint32_t(part.IndexCount * settings.LodTargetRatios[lod]);
+    const float bound = settings.LodMaxErrors[lod] * errorScale;
+
+    bool covered = false;
+    const float measured =
+        measureHeightfieldError(mesh, gridSize, part.LodStart(lod), count, covered);
+
+    valid = count % 3 == 0 && count < part.LodCount(lod - 1) && count <= targetCount &&
+            uint64_t(part.LodStart(lod)) + count <= mesh.NumStoredIndices() &&
+            part.LodVertices(lod) > 0 && part.LodVertices(lod) <= part.LodVertices(lod - 1) &&
+            part.LodError[lod] <= bound && measured <= bound * measuredSlack && covered;
+
+    writeLog(
+        "ValidateLodGeneration: level %u, %u of %u triangles (target %u), error %f, measured %f, "
+        "bound %f",
+        lod,
+        count / 3,
+        part.IndexCount / 3,
+        targetCount / 3,
+        part.LodError[lod],
+        measured,
+        bound);
+  }
+
+  model.ReleaseMeshData();
+
+  writeLog(
+      "ValidateLodGeneration: %llu vertices, generate %.2f ms, %s",
+      numGridVertices,
+      generateMs,
+      valid ? "passed" : "FAILED");
+
+  return valid;
+}
+
+bool Model::ValidateVertexPacking(uint32_t numVertices)
+{
+  assert(numVertices > 0);
+
+  Random rng;
+  rng.SetSeed(1234);
+
+  // One mesh worth of random vertices, the AABB has a flat axis like the floor planes do
+  Mesh mesh;
+  mesh.aabbMin = glm::vec3(-10.0f, 0.0f, -50.0f);
+  mesh.aabbMax = glm::vec3(10.0f, 0.0f, 50.0f);
+
+  std::vector<MeshVertex> vertices(numVertices);
+  for (MeshVertex& v : vertices)
+  {
+    const glm::vec3 t = glm::vec3(rng.RandomFloat2(), rng.RandomFloat());
+    v.Position = glm::mix(mesh.aabbMin, mesh.aabbMax, t);
+    v.Normal = SampleDirectionSphere(rng.RandomFloat(), rng.RandomFloat());
+    const glm::vec3 up = SampleDirectionSphere(rng.RandomFloat(), rng.RandomFloat());
+    v.Tangent = glm::cross(v.Normal, up);
+    if (glm::length(v.Tangent) < 0.01f)
+      v.Tangent = glm::cross(v.Normal, glm::vec3(glm::abs(v.Normal.x) < 0.5f ? 1.0f : 0.0f, 1, 0));
+    v.Tangent = glm::normalize(v.Tangent);
+    v.Bitangent = glm::cross(v.Normal, v.Tangent) * (rng.RandomFloat() < 0.5f ? -1.0f : 1.0f);
+    v.UV = (rng.RandomFloat2() - 0.5f) * 16.0f;
+  }
+
+  glm::vec3 scale;
+  glm::vec3 offset;
+  PositionQuantization(mesh, scale, offset);
+
+  // Octahedral snorm16 normals and snorm8 tangents, with some headroom over the measured error
+  const float maxNormalError = 0.0002f;
+  const float maxTangentError = 0.02f;
+  const float maxBitangentError = maxNormalError + maxTangentError;
+  const float positionStep = glm::max(scale.x, glm::max(scale.y, scale.z)) / 65535.0f;
+
+  // atan2 instead of acos, which has no precision left for angles this small
+  auto angle = [](const glm::vec3& a, const glm::vec3& b) {
+    return glm::atan(glm::length(glm::cross(a, b)), glm::dot(a, b));
+  };
+
+  float normalError = 0.0f;
+  float tangentError = 0.0f;
+  float bitangentError = 0.0f;
+  float uvError = 0.0f;
+  float positionError = 0.0f;
+  bool valid = true;
+  for (const MeshVertex& v : vertices)
+  {
+    const MeshVertex packed = unpackMeshVertex(packMeshVertex(v));
+    const MeshVertex quantized =
+        unpackMeshVertex(quantizeMeshVertex(v, scale, offset), scale, offset);
+
+    for (const MeshVertex* decoded : {&packed, &quantized})
+    {
+      normalError = glm::max(normalError, angle(v.Normal, decoded->Normal));
+      tangentError = glm::max(tangentError, angle(v.Tangent, decoded->Tangent));
+      bitangentError = glm::max(bitangentError, angle(v.Bitangent, decoded->Bitangent));
+
+      // Half floats round to 11 significant bits
+      const glm::vec2 uvDelta = glm::abs(v.UV - decoded->UV);
+      const glm::vec2 uvBound = glm::abs(v.UV) * (1.0f / 2048.0f) + 1e-7f;
+      valid = valid && uvDelta.x <= uvBound.x && uvDelta.y <= uvBound.y;
+      uvError = glm::max(uvError, glm::max(uvDelta.x, uvDelta.y));
+    }
+
+    valid = valid && packed.Position == v.Position;
+    const glm::vec3 positionDelta = glm::abs(v.Position - quantized.Position);
+    positionError = glm::max(
+        positionError, glm::max(positionDelta.x, glm::max(positionDelta.y, positionDelta.z)));
+  }
+
+  valid = valid && normalError <= maxNormalError && tangentError <= maxTangentError &&
+          bitangentError <= maxBitangentError && positionError <= positionStep * 0.5f + 1e-5f;
+
+  // A zero and a denormal tangent frame have to come back as +z rather than NaN
+  for (const float length : {0.0f, 1e-30f})
+  {
+    MeshVertex v = vertices[0];
+    v.Normal = glm::vec3(length, 0.0f, 0.0f);
+    v.Tangent = glm::vec3(0.0f, -length, 0.0f);
+    v.Bitangent = glm::vec3(0.0f);
+
+    const MeshVertex packed = unpackMeshVertex(packMeshVertex(v));
+    const MeshVertex quantized =
+        unpackMeshVertex(quantizeMeshVertex(v, scale, offset), scale, offset);
+    for (const MeshVertex* decoded : {&packed, &quantized})
+    {
+      valid = valid && decoded->Normal == glm::vec3(0.0f, 0.0f, 1.0f) &&
+              decoded->Tangent == glm::vec3(0.0f, 0.0f, 1.0f);
+    }
+  }
+
+  writeLog(
+      "ValidateVertexPacking: %u vertices, %u -> %u / %u bytes, max error normal %.4f deg, "
+      "tangent %.3f deg, bitangent %.3f deg, uv %.2e, position %.2e, %s",
+      numVertices,
+      VertexStride(VertexFormat::Standard),
+      VertexStride(VertexFormat::Packed),
+      VertexStride(VertexFormat::Quantized),
+      glm::degrees(normalError),
+      glm::degrees(tangentError),
+      glm::degrees(bitangentError),
+      uvError,
+      positionError,
+      valid ? "passed" : "FAILED");
+
+  return valid;
+}
+
+bool Model::BenchmarkGeometryCodec(const ModelLoadSettings& settings, uint32_t numIterations)
+{
+  assert(settings.FilePath != nullptr && numIterations > 0);
+  if (fileExists(settings.FilePath) == false)
+  {
+    writeLog("BenchmarkGeometryCodec: can't read '%ls'", settings.FilePath);
+    return false;
+  }
+
+  Model model;
+  model.ImportWithAssimp(settings);
+
+  const uint32_t mantissaBits = settings.CompressionMantissaBits;
+  const GeometryEncoding encoding =
+      mantissaBits > 0 ? GeometryEncoding::MeshoptExpFilter : GeometryEncoding::Meshopt;
+  const uint32_t numMeshes = uint32_t(model.meshes.size());
+
+  Timer timer;
+  timer.init();
+
+  std::vector<std::vector<uint8_t>> encodedVertices(numMeshes);
+  std::vector<std::vector<uint8_t>> encodedIndices(numMeshes);
+  getWorkerPool().parallelFor(numMeshes, [&](uint32_t meshIdx) {
+    encodeMeshGeometry(
+        model.meshes[meshIdx], mantissaBits, encodedVertices[meshIdx], encodedIndices[meshIdx]);
+  });
+
+  timer.update();
+  const double encodeMs = timer.m_DeltaMillisecondsD;
+
+  // Decoded copies use the index buffer layout
+  std::vector<uint64_t> vertexOffsets(numMeshes);
+  std::vector<uint64_t> indexOffsets(numMeshes);
+  uint64_t numVertices = 0;
+  uint64_t indexDataSize = 0;
+  uint64_t encodedVertexBytes = 0;
+  uint64_t encodedIndexBytes = 0;
+  uint64_t numTriangles = 0;
+  for (uint32_t i = 0; i < numMeshes; ++i)
+  {
+    const Mesh& mesh = model.meshes[i];
+    indexDataSize = AlignIndexOffset(indexDataSize, mesh.IndexBufferType());
+    vertexOffsets[i] = numVertices;
+    indexOffsets[i] = indexDataSize;
+    numVertices += mesh.NumVertices();
+    indexDataSize += uint64_t(mesh.NumStoredIndices()) * mesh.IndexSize();
+    encodedVertexBytes += encodedVertices[i].size();
+    encodedIndexBytes += encodedIndices[i].size();
+    numTriangles += mesh.NumStoredIndices() / 3;
+  }
+
+  std::vector<MeshVertex> decodedVertices(numVertices);
+  std::vector<uint8_t> decodedIndices(indexDataSize);
+  std::atomic<bool> decoded = true;
+  auto decodeMesh = [&](uint32_t meshIdx) {
+    const Mesh& mesh = model.meshes[meshIdx];
+    if (decodeMeshGeometry(
+            encodedVertices[meshIdx].data(),
+            encodedVertices[meshIdx].size(),
+            encodedIndices[meshIdx].data(),
+            encodedIndices[meshIdx].size(),
+            mesh.NumVertices(),
+            mesh.NumStoredIndices(),
+            mesh.IndexBufferType(),
+            encoding,
+            &decodedVertices[vertexOffsets[meshIdx]],
+            &decodedIndices[indexOffsets[meshIdx]]) == false)
+      decoded = false;
+  };
+
+  timer.update();
+  for (uint32_t iteration = 0; iteration < numIterations; ++iteration)
+    for (uint32_t i = 0; i < numMeshes; ++i)
+      decodeMesh(i);
+  timer.update();
+  const double serialMs = timer.m_DeltaMillisecondsD / numIterations;
+
+  for (uint32_t iteration = 0; iteration < numIterations; ++iteration)
+    getWorkerPool().parallelFor(numMeshes, decodeMesh);
+  timer.update();
+  const double parallelMs = timer.m_DeltaMillisecondsD / numIterations;
+
+  // The index codec may rotate the corners of a triangle but keeps the triangle order and
+  // winding. Unfiltered vertices round trip exactly, the exponential filter keeps
+  // mantissaBits - 1 bits of magnitude per float.
+  bool valid = decoded;
+  float maxRelativeError = 0.0f;
+  for (uint32_t i = 0; valid && i < numMeshes; ++i)
+  {
+    const Mesh& mesh = model.meshes[i];
+    const IndexType indexType = mesh.IndexBufferType();
+    const uint8_t* meshIndices = &decodedIndices[indexOffsets[i]];
+    auto decodedIndex = [&](uint32_t idx) {
+      return indexType == IndexType::Index32Bit
+                 ? reinterpret_cast<const uint32_t*>(meshIndices)[idx]
+                 : reinterpret_cast<const uint16_t*>(meshIndices)[idx];
+    };
+    for (uint32_t tri = 0; valid && tri < mesh.NumStoredIndices(); tri += 3)
+    {
+      bool matches = false;
+      for (uint32_t rotation = 0; rotation < 3; ++rotation)
+      {
+        matches |= decodedIndex(tri) == mesh.Index(tri + rotation) &&
+                   decodedIndex(tri + 1) == mesh.Index(tri + (rotation + 1) % 3) &&
+                   decodedIndex(tri + 2) == mesh.Index(tri + (rotation + 2) % 3);
+      }
+      valid = matches;
+    }
+
+    const float* source = &mesh.Vertices()[0].Position.x;
+    const float* result = &decodedVertices[vertexOffsets[i]].Position.x;
+    const uint64_t numFloats = uint64_t(mesh.NumVertices()) * sizeof(MeshVertex) / sizeof(float);
+    if (mantissaBits == 0)
+    {
+      valid = valid && memcmp(source, result, numFloats * sizeof(float)) == 0;
+      continue;
+    }
+
+    const float errorBound = std::ldexp(1.0f, 1 - int(mantissaBits));
+    for (uint64_t f = 0; f < numFloats; ++f)
+    {
+      const float error = std::abs(source[f] - result[f]);
+      const float relativeError = source[f] != 0.0f ? error / std::abs(source[f]) : error;
+      valid = valid && relativeError <= errorBound;
+      maxRelativeError = std::max(maxRelativeError, relativeError);
+    }
+  }
+
+  const double rawBytes = double(numVertices * sizeof(MeshVertex) + indexDataSize);
+  const double mb = 1.0 / (1024.0 * 1024.0);
+  writeLog(
+      "BenchmarkGeometryCodec '%ls': %u meshes, vertices %.2f -> %.2f MB, indices %.2f -> %.2f MB "
+      "(%.2f bytes/triangle), %.1f%% of the raw size, encode %.2f ms",
+      settings.FilePath,
+      numMeshes,
+      numVertices * sizeof(MeshVertex) * mb,
+      encodedVertexBytes * mb,
+      indexDataSize * mb,
+      encodedIndexBytes * mb,
+      numTriangles > 0 ? double(encodedIndexBytes) / numTriangles : 0.0,
+      100.0 * (encodedVertexBytes + encodedIndexBytes) / rawBytes,
+      encodeMs);
+  writeLog(
+      "BenchmarkGeometryCodec: decode %.2f ms (%.2f GB/s) serial, %.2f ms (%.2f GB/s) on %u "
+      "threads, %u mantissa bits, max relative error %.2e, %s",
+      serialMs,
+      rawBytes / (serialMs * 1.0e6),
+      parallelMs,
+      rawBytes / (parallelMs * 1.0e6),
+      getWorkerPool().numThreads(),
+      mantissaBits,
+      maxRelativeError,
+      valid ? "passed" : "FAILED");
+
+  model.ReleaseMeshData();
+  return valid;
 }
 
 // Procedural generation
@@ -892,10 +2716,11 @@ void Model::GenerateBoxScene(
   loadMaterialResources(dev, meshMaterials, L"..\\Content\\Textures\\", false, materialTextures);
 
   vertices.resize(NumBoxVerts);
-  indices.resize(NumBoxIndices);
+  indices.resize(NumBoxIndices * sizeof(uint16_t));
+  uint16_t* indexData = reinterpret_cast<uint16_t*>(indices.data());
 
   meshes.resize(1);
-  meshes[0].InitBox(dimensions, position, orientation, 0, vertices.data(), indices.data());
+  meshes[0].InitBox(dimensions, position, orientation, 0, vertices.data(), indexData);
 
   CreateBuffers();
 }
@@ -909,7 +2734,8 @@ void Model::GenerateBoxTestScene(ID3D12Device* dev)
   loadMaterialResources(dev, meshMaterials, L"..\\Content\\Textures\\", false, materialTextures);
 
   vertices.resize(NumBoxVerts * 2);
-  indices.resize(NumBoxIndices * 2);
+  indices.resize(NumBoxIndices * 2 * sizeof(uint16_t));
+  uint16_t* indexData = reinterpret_cast<uint16_t*>(indices.data());
 
   meshes.resize(2);
   meshes[0].InitBox(
@@ -918,14 +2744,14 @@ void Model::GenerateBoxTestScene(ID3D12Device* dev)
       glm::quat(0, 0, 0, 1),
       0,
       vertices.data(),
-      indices.data());
+      indexData);
   meshes[1].InitBox(
       glm::vec3(10.0f, 0.25f, 10.0f),
       glm::vec3(0.0f),
       glm::quat(0, 0, 0, 1),
       0,
       &vertices[NumBoxVerts],
-      &indices[NumBoxIndices]);
+      indexData + NumBoxIndices);
 
   CreateBuffers();
 }
@@ -945,10 +2771,11 @@ void Model::GeneratePlaneScene(
   loadMaterialResources(dev, meshMaterials, L"..\\Content\\Textures\\", false, materialTextures);
 
   vertices.resize(NumPlaneVerts);
-  indices.resize(NumPlaneIndices);
+  indices.resize(NumPlaneIndices * sizeof(uint16_t));
+  uint16_t* indexData = reinterpret_cast<uint16_t*>(indices.data());
 
   meshes.resize(1);
-  meshes[0].InitPlane(dimensions, position, orientation, 0, vertices.data(), indices.data());
+  meshes[0].InitPlane(dimensions, position, orientation, 0, vertices.data(), indexData);
 
   CreateBuffers();
 }
@@ -968,11 +2795,16 @@ void Model::Shutdown()
   materialTextures.clear();
   fileDirectory = L"";
   forceSRGB = false;
+  vertexFormat = VertexFormat::Standard;
+  optimizeDepthIndices = false;
 
   vertexBuffer.deinit();
   indexBuffer.deinit();
+  positionBuffer.deinit();
+  depthIndexBuffer.deinit();
   vertices.clear();
   indices.clear();
+  bakedFile.deinit();
 }
 
 void makeConeGeometry(
@@ -3,11 +3,14 @@
 #pragma once
 
 #include "D3D12Wrapper.hpp"
+#include "MappedFile.hpp"
 
 #include <assert.h>
 #include <string>
 #include <vector>
 
+#include "glm/gtc/packing.hpp"
+
 // DirectX Tex
 #include "..\\Externals\\DirectXTex July 2017\\Include\\DirectXTex.h"
 
@@ -49,6 +52,113 @@ struct MeshVertex
   }
 };
 
+// Octahedral mapping of a unit vector to [-1, 1]^2, decoded the same way in Mesh.hlsl.
+// Degenerate vectors (e.g. the zero tangents of meshes without UVs) map to +z.
+inline glm::vec2 octEncode(const glm::vec3& n)
+{
+  const float l1 = glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+  if (!(l1 > 1e-20f))
+    return glm::vec2(0.0f, 0.0f);
+
+  const glm::vec3 p = n / l1;
+  if (p.z >= 0.0f)
+    return glm::vec2(p.x, p.y);
+
+  return glm::vec2(
+      (1.0f - glm::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f),
+      (1.0f - glm::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+}
+inline glm::vec3 octDecode(const glm::vec2& e)
+{
+  glm::vec3 n = glm::vec3(e.x, e.y, 1.0f - glm::abs(e.x) - glm::abs(e.y));
+  const float t = glm::max(-n.z, 0.0f);
+  n.x += n.x >= 0.0f ? -t : t;
+  n.y += n.y >= 0.0f ? -t : t;
+  return glm::normalize(n);
+}
+
+// Compact vertex layouts for the vertex buffer, the CPU side always keeps MeshVertex.
+// The tangent frame is an octahedral normal, an octahedral tangent and the bitangent sign.
+struct PackedMeshVertex
+{
+  glm::vec3 Position;
+  uint32_t Normal;  // R16G16_SNORM, octahedral
+  uint32_t Tangent; // R8G8B8A8_SNORM, octahedral xy and bitangent sign in z
+  uint32_t UV;      // R16G16_FLOAT
+};
+
+// Same as PackedMeshVertex with positions as R16G16B16A16_UNORM within the mesh AABB
+struct QuantizedMeshVertex
+{
+  uint16_t Position[4];
+  uint32_t Normal;
+  uint32_t Tangent;
+  uint32_t UV;
+};
+
+static_assert(sizeof(PackedMeshVertex) == 24);
+static_assert(sizeof(QuantizedMeshVertex) == 20);
+
+inline uint32_t packTangentFrame(const MeshVertex& v, uint32_t& packedNormal)
+{
+  packedNormal = glm::packSnorm2x16(octEncode(v.Normal));
+
+  const float bitangentSign = glm::dot(glm::cross(v.Normal, v.Tangent), v.Bitangent) < 0.0f
+                                  ? -1.0f
+                                  : 1.0f;
+  return glm::packSnorm4x8(glm::vec4(octEncode(v.Tangent), bitangentSign, 0.0f));
+}
+inline void unpackTangentFrame(uint32_t packedNormal, uint32_t packedTangent, MeshVertex& v)
+{
+  const glm::vec4 tangent = glm::unpackSnorm4x8(packedTangent);
+  v.Normal = octDecode(glm::unpackSnorm2x16(packedNormal));
+  v.Tangent = octDecode(glm::vec2(tangent));
+  v.Bitangent = glm::normalize(glm::cross(v.Normal, v.Tangent)) * (tangent.z < 0.0f ? -1.0f : 1.0f);
+}
+
+inline PackedMeshVertex packMeshVertex(const MeshVertex& v)
+{
+  PackedMeshVertex packed;
+  packed.Position = v.Position;
+  packed.Tangent = packTangentFrame(v, packed.Normal);
+  packed.UV = glm::packHalf2x16(v.UV);
+  return packed;
+}
+inline MeshVertex unpackMeshVertex(const PackedMeshVertex& packed)
+{
+  MeshVertex v;
+  v.Position = packed.Position;
+  unpackTangentFrame(packed.Normal, packed.Tangent, v);
+  v.UV = glm::unpackHalf2x16(packed.UV);
+  return v;
+}
+
+// Positions are stored as offset + quantized * scale, see Model::PositionQuantization()
+inline QuantizedMeshVertex
+quantizeMeshVertex(const MeshVertex& v, const glm::vec3& scale, const glm::vec3& offset)
+{
+  QuantizedMeshVertex quantized;
+  for (uint32_t i = 0; i < 3; ++i)
+  {
+    const float q = scale[i] > 0.0f ? (v.Position[i] - offset[i]) / scale[i] : 0.0f;
+    quantized.Position[i] = glm::packUnorm1x16(q);
+  }
+  quantized.Position[3] = 0;
+  quantized.Tangent = packTangentFrame(v, quantized.Normal);
+  quantized.UV = glm::packHalf2x16(v.UV);
+  return quantized;
+}
+inline MeshVertex unpackMeshVertex(
+    const QuantizedMeshVertex& quantized, const glm::vec3& scale, const glm::vec3& offset)
+{
+  MeshVertex v;
+  for (uint32_t i = 0; i < 3; ++i)
+    v.Position[i] = offset[i] + glm::unpackUnorm1x16(quantized.Position[i]) * scale[i];
+  unpackTangentFrame(quantized.Normal, quantized.Tangent, v);
+  v.UV = glm::unpackHalf2x16(quantized.UV);
+  return v;
+}
+
 enum class MaterialTextures
 {
   Albedo = 0,
@@ -73,6 +183,9 @@ struct MeshMaterial
   }
 };
 
+// Levels of detail per mesh part, including the full resolution level 0
+static constexpr uint32_t MaxMeshLods = 4;
+
 struct MeshPart
 {
   uint32_t VertexStart;
@@ -81,7 +194,37 @@ struct MeshPart
   uint32_t IndexCount;
   uint32_t MaterialIdx;
 
-  MeshPart() : VertexStart(0), VertexCount(0), IndexStart(0), IndexCount(0), MaterialIdx(0) {}
+  // Coarser levels generated at import (see Model::GenerateLods()), level 0 is IndexStart and
+  // IndexCount so entry 0 of the arrays is unused. Starts are relative to Mesh::IndexOffset()
+  // like IndexStart, errors are object-space distances. The levels share the part's vertices,
+  // LodVertexCount is how many distinct ones a level still references.
+  uint32_t NumLods;
+  uint32_t LodIndexStart[MaxMeshLods];
+  uint32_t LodIndexCount[MaxMeshLods];
+  uint32_t LodVertexCount[MaxMeshLods];
+  float LodError[MaxMeshLods];
+
+  MeshPart()
+      : VertexStart(0), VertexCount(0), IndexStart(0), IndexCount(0), MaterialIdx(0), NumLods(1),
+        LodIndexStart(), LodIndexCount(), LodVertexCount(), LodError()
+  {
+  }
+
+  uint32_t LodStart(uint32_t lod) const
+  {
+    assert(lod < NumLods);
+    return lod == 0 ? IndexStart : LodIndexStart[lod];
+  }
+  uint32_t LodCount(uint32_t lod) const
+  {
+    assert(lod < NumLods);
+    return lod == 0 ? IndexCount : LodIndexCount[lod];
+  }
+  uint32_t LodVertices(uint32_t lod) const
+  {
+    assert(lod < NumLods);
+    return lod == 0 ? VertexCount : LodVertexCount[lod];
+  }
 };
 
 enum class IndexType
@@ -141,6 +284,68 @@ static const D3D12_INPUT_ELEMENT_DESC StandardInputElements[5] = {
      0},
 };
 
+// Layout of the model's vertex buffer, picked with ModelLoadSettings
+enum class VertexFormat : uint32_t
+{
+  Standard = 0, // MeshVertex
+  Packed,       // PackedMeshVertex
+  Quantized,    // QuantizedMeshVertex
+
+  Count
+};
+
+static const D3D12_INPUT_ELEMENT_DESC PackedInputElements[4] = {
+    {"POSITION",
+     0,
+     DXGI_FORMAT_R32G32B32_FLOAT,
+     0,
+     0,
+     D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA,
+     0},
+    {"NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0},
+    {"TANGENT",
+     0,
+     DXGI_FORMAT_R8G8B8A8_SNORM,
+     0,
+     16,
+     D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA,
+     0},
+    {"UV", 0, DXGI_FORMAT_R16G16_FLOAT, 0, 20, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0},
+};
+
+static const D3D12_INPUT_ELEMENT_DESC QuantizedInputElements[4] = {
+    {"POSITION",
+     0,
+     DXGI_FORMAT_R16G16B16A16_UNORM,
+     0,
+     0,
+     D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA,
+     0},
+    {"NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, 8, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0},
+    {"TANGENT",
+     0,
+     DXGI_FORMAT_R8G8B8A8_SNORM,
+     0,
+     12,
+     D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA,
+     0},
+    {"UV", 0, DXGI_FORMAT_R16G16_FLOAT, 0, 16, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0},
+};
+
+// Layout of Model::PositionBuffer(), used by the depth-only passes
+static const D3D12_INPUT_ELEMENT_DESC PositionOnlyInputElements[1] = {
+    {"POSITION",
+     0,
+     DXGI_FORMAT_R32G32B32_FLOAT,
+     0,
+     0,
+     D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA,
+     0},
+};
+
+struct ModelLoadSettings;
+class CameraBase;
+
 struct MaterialTexture
 {
   std::wstring Name;
@@ -156,12 +361,45 @@ struct ModelSpotLight
   glm::vec2 AngularAttenuation;
 };
 
-struct PointLight
+struct ModelPointLight
 {
   glm::vec3 Position;
   glm::vec3 Intensity;
 };
 
+// Raw counts from the meshoptimizer analyzers, kept as sums so meshes can be accumulated
+struct MeshOptimizationStats
+{
+  uint64_t NumVertices = 0;
+  uint64_t NumTriangles = 0;
+  uint64_t VerticesTransformed = 0;
+  uint64_t PixelsCovered = 0;
+  uint64_t PixelsShaded = 0;
+  uint64_t BytesFetched = 0;
+
+  void add(const MeshOptimizationStats& other)
+  {
+    NumVertices += other.NumVertices;
+    NumTriangles += other.NumTriangles;
+    VerticesTransformed += other.VerticesTransformed;
+    PixelsCovered += other.PixelsCovered;
+    PixelsShaded += other.PixelsShaded;
+    BytesFetched += other.BytesFetched;
+  }
+
+  // Average cache miss ratio, transformed vertices per triangle (0.5 best, 3 worst)
+  float ACMR() const { return NumTriangles > 0 ? float(VerticesTransformed) / NumTriangles : 0.0f; }
+  // Average transformed vertex ratio, transformed vertices per vertex (1 best)
+  float ATVR() const { return NumVertices > 0 ? float(VerticesTransformed) / NumVertices : 0.0f; }
+  // Shaded pixels per covered pixel (1 best)
+  float Overdraw() const { return PixelsCovered > 0 ? float(PixelsShaded) / PixelsCovered : 0.0f; }
+  // Fetched vertex bytes per vertex byte (1 best)
+  float Overfetch() const
+  {
+    return NumVertices > 0 ? float(BytesFetched) / (NumVertices * sizeof(MeshVertex)) : 0.0f;
+  }
+};
+
 class Mesh
 {
   friend class Model;
@@ -172,9 +410,37 @@ public:
     //assert(numVertices == 0);
   }
 
-  // Init from loaded files
+  // Init from loaded files, dstIndices is written with IndexTypeForVertexCount() of the mesh
   void InitFromAssimpMesh(
-      const aiMesh& assimpMesh, float sceneScale, MeshVertex* dstVertices, uint16_t* dstIndices);
+      const aiMesh& assimpMesh, float sceneScale, MeshVertex* dstVertices, void* dstIndices);
+
+  // Reorders the triangles of every part for the post-transform cache and then for overdraw,
+  // and the vertices in first-use order for fetch locality. The data is the mesh's range written
+  // by InitFromAssimpMesh(), stats are measured before and after when requested.
+  void Optimize(
+      MeshVertex* vertexData,
+      void* indexData,
+      MeshOptimizationStats* statsBefore = nullptr,
+      MeshOptimizationStats* statsAfter = nullptr);
+
+  // Measures the mesh's range with the meshoptimizer analyzers
+  MeshOptimizationStats Analyze(const MeshVertex* vertexData, const void* indexData) const;
+
+  // Simplifies every part with the LOD settings, lodData receives the coarser levels in the
+  // mesh's index width, they are stored right after the level 0 indices
+  void GenerateLods(
+      const MeshVertex* vertexData,
+      const void* indexData,
+      const ModelLoadSettings& settings,
+      std::vector<uint8_t>& lodData);
+
+  // Coarsest level of a part whose error projects to at most maxPixelError pixels, the error is
+  // measured at the point of the mesh bounds closest to the camera
+  uint32_t SelectLod(
+      uint64_t partIdx,
+      const CameraBase& camera,
+      float viewportHeight,
+      float maxPixelError) const;
 
   // Procedural generation
   void InitBox(
@@ -193,13 +459,28 @@ public:
       MeshVertex* dstVertices,
       uint16_t* dstIndices);
 
+  // Flat gridSize x gridSize vertex grid on the XZ plane, dstIndices is written with
+  // IndexTypeForVertexCount() so large grids exercise 32-bit indices
+  void InitGrid(
+      uint32_t gridSize,
+      float cellSize,
+      uint32_t materialIdx,
+      MeshVertex* dstVertices,
+      void* dstIndices);
+  static uint64_t GridVertexCount(uint32_t gridSize) { return uint64_t(gridSize) * gridSize; }
+  static uint64_t GridIndexCount(uint32_t gridSize)
+  {
+    return gridSize > 1 ? uint64_t(gridSize - 1) * (gridSize - 1) * 6 : 0;
+  }
+
   void InitCommon(
       const MeshVertex* vertices,
-      const uint16_t* indices,
+      const void* indices,
       uint64_t vbAddress,
       uint64_t ibAddress,
       uint64_t vtxOffset,
-      uint64_t idxOffset);
+      uint64_t idxOffset,
+      uint32_t vertexStride = sizeof(MeshVertex));
 
   void Shutdown();
 
@@ -209,15 +490,32 @@ public:
 
   uint32_t NumVertices() const { return numVertices; }
   uint32_t NumIndices() const { return numIndices; }
+  // Level 0 followed by the coarser levels, this is the mesh's range in the index data
+  uint32_t NumStoredIndices() const { return numIndices + numLodIndices; }
   uint32_t VertexOffset() const { return vtxOffset; }
   uint32_t IndexOffset() const { return idxOffset; }
 
-  IndexType IndexBufferType() const { return IndexType::Index16Bit; }
-  DXGI_FORMAT IndexBufferFormat() const { return DXGI_FORMAT_R16_UINT; }
-  uint32_t IndexSize() const { return 2; }
+  IndexType IndexBufferType() const { return indexType; }
+  DXGI_FORMAT IndexBufferFormat() const { return IndexFormat(indexType); }
+  uint32_t IndexSize() const { return IndexSize(indexType); }
 
   const MeshVertex* Vertices() const { return vertices; }
-  const uint16_t* Indices() const { return indices; }
+  const void* Indices() const { return indices; }
+  const uint16_t* Indices16() const
+  {
+    assert(indexType == IndexType::Index16Bit);
+    return reinterpret_cast<const uint16_t*>(indices);
+  }
+  const uint32_t* Indices32() const
+  {
+    assert(indexType == IndexType::Index32Bit);
+    return reinterpret_cast<const uint32_t*>(indices);
+  }
+  uint32_t Index(uint64_t idx) const
+  {
+    assert(idx < NumStoredIndices());
+    return indexType == IndexType::Index32Bit ? Indices32()[idx] : Indices16()[idx];
+  }
 
   const D3D12_VERTEX_BUFFER_VIEW* VBView() const { return &vbView; }
   const D3D12_INDEX_BUFFER_VIEW* IBView() const { return &ibView; }
@@ -225,6 +523,17 @@ public:
   const glm::vec3& AABBMin() const { return aabbMin; }
   const glm::vec3& AABBMax() const { return aabbMax; }
 
+  // Narrowest index width that can address numVertices
+  static IndexType IndexTypeForVertexCount(uint64_t numVertices)
+  {
+    return numVertices > 0xFFFF ? IndexType::Index32Bit : IndexType::Index16Bit;
+  }
+  static uint32_t IndexSize(IndexType type) { return type == IndexType::Index32Bit ? 4 : 2; }
+  static DXGI_FORMAT IndexFormat(IndexType type)
+  {
+    return type == IndexType::Index32Bit ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_R16_UINT;
+  }
+
   static const char* InputElementTypeString(InputElementType elemType)
   {
     static const char* ElemStrings[] = {
@@ -256,13 +565,14 @@ protected:
 
   uint32_t numVertices = 0;
   uint32_t numIndices = 0;
+  uint32_t numLodIndices = 0;
   uint32_t vtxOffset = 0;
   uint32_t idxOffset = 0;
 
   IndexType indexType = IndexType::Index16Bit;
 
   const MeshVertex* vertices = nullptr;
-  const uint16_t* indices = nullptr;
+  const void* indices = nullptr;
 
   D3D12_VERTEX_BUFFER_VIEW vbView = {};
   D3D12_INDEX_BUFFER_VIEW ibView = {};
@@ -278,6 +588,31 @@ struct ModelLoadSettings
   float SceneScale = 1.0f;
   bool ForceSRGB = false;
   bool MergeMeshes = true;
+
+  // Compact vertex buffer layout (PackedMeshVertex), QuantizePositions also stores positions
+  // as 16-bit values within the mesh AABB (QuantizedMeshVertex)
+  bool PackVertices = false;
+  bool QuantizePositions = false;
+
+  // Runs Mesh::Optimize() on every imported mesh and logs the stats before and after
+  bool OptimizeMeshes = false;
+
+  // Levels of detail per mesh part, 1 disables the simplification. Level i keeps about
+  // LodTargetRatios[i] of the level 0 triangles with an error of at most LodMaxErrors[i] relative
+  // to the mesh extent, levels that don't remove triangles anymore are dropped.
+  uint32_t NumLods = 1;
+  float LodTargetRatios[MaxMeshLods] = {1.0f, 0.5f, 0.25f, 0.125f};
+  float LodMaxErrors[MaxMeshLods] = {0.0f, 0.005f, 0.01f, 0.02f};
+
+  // Builds a second index buffer for the depth passes where vertices sharing a position are
+  // merged, so the position stream gets better post-transform cache reuse
+  bool OptimizeDepthIndices = false;
+
+  // Stores the geometry of the baked scene cache with the meshoptimizer vertex and index codecs,
+  // it's decoded in parallel when the cache is loaded. CompressionMantissaBits > 0 also runs the
+  // vertex floats through the lossy exponential filter, keeping that many mantissa bits.
+  bool CompressGeometry = false;
+  uint32_t CompressionMantissaBits = 0;
 };
 
 class Model
@@ -288,7 +623,55 @@ public:
   // Loading from file formats
   void CreateWithAssimp(ID3D12Device* dev, const ModelLoadSettings& settings);
 
-  void CreateFromMeshData(ID3D12Device* dev, const wchar_t* filePath);
+  // Loads from a baked scene file (see BakedSceneHeader in Model.cpp), the vertex and index
+  // buffers are created straight from the memory-mapped file
+  void CreateFromMeshData(
+      ID3D12Device* dev,
+      const wchar_t* filePath,
+      VertexFormat format = VertexFormat::Standard);
+
+  // Uses the baked scene cache next to the source file when its key matches the source file and
+  // settings, otherwise imports with Assimp and (re)writes the cache
+  void CreateWithCache(ID3D12Device* dev, const ModelLoadSettings& settings);
+  // CPU-only counterpart of CreateWithCache() for headless tools: maps the cache when its key
+  // matches, otherwise imports with Assimp without writing it. No GPU resources are created.
+  bool LoadMeshData(const ModelLoadSettings& settings);
+
+  // Writes the imported geometry, materials and lights in the baked scene format, see
+  // ModelLoadSettings::CompressGeometry for the compression parameters
+  bool SaveMeshData(
+      const wchar_t* filePath,
+      uint64_t cacheKey,
+      bool compressGeometry = false,
+      uint32_t compressionMantissaBits = 0) const;
+
+  static uint64_t ComputeCacheKey(const ModelLoadSettings& settings);
+  static std::wstring CachePath(const ModelLoadSettings& settings);
+
+  // Headless comparison of the Assimp import with the mapped cache (no GPU work), results go to
+  // the debug output
+  static void BenchmarkLoad(const ModelLoadSettings& settings, uint32_t numIterations = 4);
+
+  // Headless check of mixed 16/32-bit index data: bakes a gridSize x gridSize grid next to a
+  // box, maps it back and compares every index, results go to the debug output
+  static bool ValidateWideIndices(const wchar_t* tempFilePath, uint32_t gridSize = 1024);
+
+  // Headless import with OptimizeMeshes forced on, the ACMR/ATVR, overdraw and overfetch
+  // before and after go to the debug output
+  static void ReportMeshOptimization(const ModelLoadSettings& settings);
+
+  // Headless check of the LOD chain on a displaced gridSize x gridSize grid: triangle counts
+  // have to shrink and the reported and measured errors have to stay within the bounds
+  static bool ValidateLodGeneration(uint32_t gridSize = 256);
+
+  // Headless check of the packed vertex formats: encodes random vertices, decodes them again
+  // and compares the errors against the bounds of each encoding
+  static bool ValidateVertexPacking(uint32_t numVertices = 1 << 16);
+
+  // Headless round trip of the imported meshes through the geometry codecs with the compression
+  // settings, checks the decoded data and logs the sizes and the serial and parallel decode
+  // throughput
+  static bool BenchmarkGeometryCodec(const ModelLoadSettings& settings, uint32_t numIterations = 8);
 
   // Procedural generation
   void GenerateBoxScene(
@@ -320,11 +703,35 @@ public:
   const std::vector<MaterialTexture*>& MaterialTextures() const { return materialTextures; }
 
   const std::vector<ModelSpotLight>& SpotLights() const { return spotLights; }
-  const std::vector<PointLight>& PointLights() const { return pointLights; }
+  const std::vector<ModelPointLight>& PointLights() const { return pointLights; }
 
   const StructuredBuffer& VertexBuffer() const { return vertexBuffer; }
   const FormattedBuffer& IndexBuffer() const { return indexBuffer; }
 
+  // Meshes pick their own index width, so the index buffer holds a mix of 16 and 32-bit ranges.
+  // This views the whole buffer with the given width, Mesh::IndexOffset() is in the mesh's width.
+  D3D12_INDEX_BUFFER_VIEW IndexBufferView(IndexType type) const
+  {
+    return IndexBufferView(indexBuffer, type);
+  }
+
+  // Tightly packed float3 object-space positions, same vertex order as VertexBuffer()
+  const StructuredBuffer& PositionBuffer() const { return positionBuffer; }
+
+  // Index buffer for the depth-only passes, shares the layout and mesh offsets of the main index
+  // buffer and falls back to it when OptimizeDepthIndices is off
+  D3D12_INDEX_BUFFER_VIEW DepthIndexBufferView(IndexType type) const
+  {
+    return IndexBufferView(depthIndexBuffer.NumElements > 0 ? depthIndexBuffer : indexBuffer, type);
+  }
+
+  // Byte offset of a mesh's indices given the end of the previous mesh, keeps every range
+  // aligned to its own index size
+  static uint64_t AlignIndexOffset(uint64_t byteOffset, IndexType type)
+  {
+    return alignUp<uint64_t>(byteOffset, Mesh::IndexSize(type));
+  }
+
   const std::wstring& FileDirectory() const { return fileDirectory; }
 
   static const D3D12_INPUT_ELEMENT_DESC* InputElements() { return StandardInputElements; }
@@ -334,57 +741,183 @@ public:
     return static_cast<uint64_t>(arrayCount32(StandardInputElements));
   }
 
+  // Layout of VertexBuffer(), the meshes keep pointing at MeshVertex data on the CPU side
+  VertexFormat VertexBufferFormat() const { return vertexFormat; }
+
+  static const D3D12_INPUT_ELEMENT_DESC* InputElements(VertexFormat format)
+  {
+    if (format == VertexFormat::Packed)
+      return PackedInputElements;
+    if (format == VertexFormat::Quantized)
+      return QuantizedInputElements;
+    return StandardInputElements;
+  }
+  static uint32_t NumInputElements(VertexFormat format)
+  {
+    if (format == VertexFormat::Packed)
+      return arrayCount32(PackedInputElements);
+    if (format == VertexFormat::Quantized)
+      return arrayCount32(QuantizedInputElements);
+    return arrayCount32(StandardInputElements);
+  }
+  static uint32_t VertexStride(VertexFormat format)
+  {
+    if (format == VertexFormat::Packed)
+      return sizeof(PackedMeshVertex);
+    if (format == VertexFormat::Quantized)
+      return sizeof(QuantizedMeshVertex);
+    return sizeof(MeshVertex);
+  }
+  static const D3D12_INPUT_ELEMENT_DESC* DepthInputElements() { return PositionOnlyInputElements; }
+  static uint32_t NumDepthInputElements() { return arrayCount32(PositionOnlyInputElements); }
+
+  static VertexFormat VertexFormatFromSettings(const ModelLoadSettings& settings)
+  {
+    if (settings.PackVertices == false)
+      return VertexFormat::Standard;
+    return settings.QuantizePositions ? VertexFormat::Quantized : VertexFormat::Packed;
+  }
+
+  // Quantized positions are offset + unorm16 * scale, with the box being the mesh AABB
+  static void PositionQuantization(const Mesh& mesh, glm::vec3& scale, glm::vec3& offset)
+  {
+    offset = mesh.AABBMin();
+    scale = mesh.AABBMax() - mesh.AABBMin();
+  }
+
 protected:
+  // CPU-only parts of the loaders, the GPU resources are created afterwards
+  void ImportWithAssimp(const ModelLoadSettings& settings);
+  bool MapMeshData(const wchar_t* filePath, uint64_t cacheKey);
+  void ReleaseMeshData();
+  // Creates the buffers of a model loaded with MapMeshData()
+  void CreateBuffersFromMeshData();
+
+  // Runs Mesh::GenerateLods() on the imported meshes and moves the index data to the layout
+  // with every mesh's coarser levels after its level 0
+  void GenerateLods(const ModelLoadSettings& settings);
+
+  // Converts vertexData to vertexFormat for the vertex buffer
+  void PackVertices(
+      const MeshVertex* vertexData, uint64_t numVertices, std::vector<uint8_t>& packed) const;
+
+  // Position-only index order for the depth passes, laid out like indexData
+  void BuildDepthIndices(
+      const MeshVertex* vertexData,
+      const uint8_t* indexData,
+      uint64_t indexDataSize,
+      std::vector<uint8_t>& depthIndices) const;
+
+  static D3D12_INDEX_BUFFER_VIEW IndexBufferView(const FormattedBuffer& buffer, IndexType type)
+  {
+    D3D12_INDEX_BUFFER_VIEW ibView = {};
+    ibView.BufferLocation = buffer.GPUAddress;
+    ibView.SizeInBytes = uint32_t(buffer.Stride * buffer.NumElements);
+    ibView.Format = Mesh::IndexFormat(type);
+    return ibView;
+  }
+
   void CreateBuffers()
+  {
+    CreateBuffers(vertices.data(), vertices.size(), indices.data(), indices.size());
+  }
+  // indexData holds the indices of every mesh laid out with AlignIndexOffset()
+  void CreateBuffers(
+      const MeshVertex* vertexData,
+      uint64_t numVertices,
+      const uint8_t* indexData,
+      uint64_t indexDataSize)
   {
     assert(meshes.size() > 0);
 
+    const uint32_t vertexStride = VertexStride(vertexFormat);
+    std::vector<uint8_t> packedVertices;
+    if (vertexFormat != VertexFormat::Standard)
+      PackVertices(vertexData, numVertices, packedVertices);
+
     StructuredBufferInit sbInit;
-    sbInit.Stride = sizeof(MeshVertex);
-    sbInit.NumElements = vertices.size();
+    sbInit.Stride = vertexStride;
+    sbInit.NumElements = numVertices;
 
-    sbInit.InitData = vertices.data();
+    sbInit.InitData =
+        packedVertices.empty() ? static_cast<const void*>(vertexData) : packedVertices.data();
     vertexBuffer.init(sbInit);
 
+    // Depth passes only read positions, keep them in their own stream
+    std::vector<glm::vec3> positions(numVertices);
+    for (uint64_t i = 0; i < numVertices; ++i)
+      positions[i] = vertexData[i].Position;
+
+    sbInit.Stride = sizeof(glm::vec3);
+    sbInit.InitData = positions.data();
+    positionBuffer.init(sbInit);
+
+    // Only switch the buffer to 32-bit elements when a mesh needs it, so 16-bit only models keep
+    // the exact same buffer as before
+    bool any32Bit = false;
+    for (const Mesh& mesh : meshes)
+      any32Bit |= mesh.IndexBufferType() == IndexType::Index32Bit;
+
     FormattedBufferInit fbInit;
-    fbInit.Format = DXGI_FORMAT_R16_UINT;
-    fbInit.NumElements = indices.size();
-    fbInit.InitData = indices.data();
+    fbInit.Format = any32Bit ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_R16_UINT;
+    fbInit.NumElements = indexDataSize / (any32Bit ? 4 : 2);
+    fbInit.InitData = indexData;
+    assert(fbInit.NumElements * (any32Bit ? 4 : 2) == indexDataSize);
     indexBuffer.init(fbInit);
 
+    if (optimizeDepthIndices)
+    {
+      std::vector<uint8_t> depthIndices;
+      BuildDepthIndices(vertexData, indexData, indexDataSize, depthIndices);
+      fbInit.InitData = depthIndices.data();
+      depthIndexBuffer.init(fbInit);
+    }
+
     uint64_t vtxOffset = 0;
-    uint64_t idxOffset = 0;
+    uint64_t ibOffset = 0;
     const uint64_t numMeshes = meshes.size();
     for (uint64_t i = 0; i < numMeshes; ++i)
     {
-      uint64_t vbOffset = vtxOffset * sizeof(MeshVertex);
-      uint64_t ibOffset = idxOffset * sizeof(uint16_t);
-      meshes[i].InitCommon(
-          &vertices[vtxOffset],
-          &indices[idxOffset],
+      Mesh& mesh = meshes[i];
+      ibOffset = AlignIndexOffset(ibOffset, mesh.IndexBufferType());
+
+      uint64_t vbOffset = vtxOffset * vertexStride;
+      mesh.InitCommon(
+          vertexData + vtxOffset,
+          indexData + ibOffset,
           vertexBuffer.m_GpuAddress + vbOffset,
           indexBuffer.GPUAddress + ibOffset,
           vtxOffset,
-          idxOffset);
+          ibOffset / mesh.IndexSize(),
+          vertexStride);
 
-      vtxOffset += meshes[i].NumVertices();
-      idxOffset += meshes[i].NumIndices();
+      vtxOffset += mesh.NumVertices();
+      ibOffset += uint64_t(mesh.NumStoredIndices()) * mesh.IndexSize();
     }
   }
 
   std::vector<Mesh> meshes;
   std::vector<MeshMaterial> meshMaterials;
   std::vector<ModelSpotLight> spotLights;
-  std::vector<PointLight> pointLights;
+  std::vector<ModelPointLight> pointLights;
   std::wstring fileDirectory;
   bool forceSRGB = false;
+  VertexFormat vertexFormat = VertexFormat::Standard;
+  bool optimizeDepthIndices = false;
   glm::vec3 aabbMin;
   glm::vec3 aabbMax;
 
   StructuredBuffer vertexBuffer;
   FormattedBuffer indexBuffer;
+  StructuredBuffer positionBuffer;
+  FormattedBuffer depthIndexBuffer;
   std::vector<MeshVertex> vertices;
-  std::vector<uint16_t> indices;
+  // Raw index data, every mesh uses its own index width (see AlignIndexOffset())
+  std::vector<uint8_t> indices;
+
+  // Backing storage for meshes loaded from a baked scene, the meshes point into it. Compressed
+  // scenes are decoded into vertices and indices instead and the file is unmapped.
+  MappedFile bakedFile;
 
   std::vector<MaterialTexture*> materialTextures;
 };
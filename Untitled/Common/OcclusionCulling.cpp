@@ -0,0 +1,630 @@
+#include "OcclusionCulling.hpp"
+#include "Camera.hpp"
+#include "Sampling.hpp"
+#include "Timer.hpp"
+
+namespace OcclusionCulling
+{
+
+//---------------------------------------------------------------------------//
+// Internal
+//---------------------------------------------------------------------------//
+static uint32_t nextPowerOfTwo(uint32_t p_Value)
+{
+  uint32_t result = 1;
+  while (result < p_Value)
+    result <<= 1;
+  return result;
+}
+//---------------------------------------------------------------------------//
+// Smallest mip whose texels span at least p_NumPixels pixels, firstbithigh(p_NumPixels - 1) in
+// the shader
+static uint32_t mipForSpan(uint32_t p_NumPixels)
+{
+  uint32_t mip = 0;
+  while ((2u << mip) < p_NumPixels)
+    ++mip;
+  return mip;
+}
+//---------------------------------------------------------------------------//
+static float deviceDepth(const glm::mat4& p_Projection, float p_ViewDepth)
+{
+  const glm::vec4 clip = glm::vec4(0.0f, 0.0f, p_ViewDepth, 1.0f) * p_Projection;
+  return clip.z / clip.w;
+}
+//---------------------------------------------------------------------------//
+// View space tangents of a circle (center p_C, radius p_R) in the plane of one screen axis and
+// the view direction, returned as the lowest and highest x / z of the two
+static glm::vec2 tangentSlopes(float p_C, float p_Z, float p_R)
+{
+  const float t = std::sqrt(std::max(p_C * p_C + p_Z * p_Z - p_R * p_R, 0.0f));
+  const float slope0 = (p_C * t - p_Z * p_R) / (p_Z * t + p_C * p_R);
+  const float slope1 = (p_C * t + p_Z * p_R) / (p_Z * t - p_C * p_R);
+  return glm::vec2(std::min(slope0, slope1), std::max(slope0, slope1));
+}
+//---------------------------------------------------------------------------//
+static OcclusionView makeView(
+    const glm::mat4& p_View,
+    const glm::mat4& p_Projection,
+    float p_NearClip,
+    uint32_t p_Width,
+    uint32_t p_Height)
+{
+  OcclusionView view;
+  view.view = p_View;
+  view.projection = p_Projection;
+  view.frustum = FrustumCulling::extractFrustum(p_View * p_Projection);
+  view.nearClip = p_NearClip;
+  view.width = p_Width;
+  view.height = p_Height;
+  return view;
+}
+//---------------------------------------------------------------------------//
+// Public API
+//---------------------------------------------------------------------------//
+uint32_t pyramidSize(uint32_t p_DepthSize)
+{
+  return nextPowerOfTwo(std::max((p_DepthSize + 1) / 2, 1u));
+}
+//---------------------------------------------------------------------------//
+uint32_t pyramidMipCount(uint32_t p_Width, uint32_t p_Height)
+{
+  uint32_t numMips = 1;
+  while ((std::max(p_Width, p_Height) >> numMips) > 0)
+    ++numMips;
+  return numMips;
+}
+//---------------------------------------------------------------------------//
+void buildDepthPyramid(
+    const float* p_Depth, uint32_t p_Width, uint32_t p_Height, DepthPyramid& p_Pyramid)
+{
+  assert(p_Depth != nullptr && p_Width > 0 && p_Height > 0);
+
+  p_Pyramid.depthWidth = p_Width;
+  p_Pyramid.depthHeight = p_Height;
+  p_Pyramid.width = pyramidSize(p_Width);
+  p_Pyramid.height = pyramidSize(p_Height);
+  p_Pyramid.numMips = pyramidMipCount(p_Pyramid.width, p_Pyramid.height);
+
+  uint64_t numTexels = 0;
+  p_Pyramid.mipOffsets.resize(p_Pyramid.numMips);
+  for (uint32_t mip = 0; mip < p_Pyramid.numMips; ++mip)
+  {
+    p_Pyramid.mipOffsets[mip] = numTexels;
+    numTexels += uint64_t(p_Pyramid.mipWidth(mip)) * p_Pyramid.mipHeight(mip);
+  }
+  p_Pyramid.texels.resize(numTexels);
+
+  // Mip 0 reads the depth buffer, pixels past its edges are 0
+  float* dst = p_Pyramid.texels.data();
+  for (uint32_t y = 0; y < p_Pyramid.height; ++y)
+  {
+    for (uint32_t x = 0; x < p_Pyramid.width; ++x)
+    {
+      float maxDepth = 0.0f;
+      for (uint32_t sy = y * 2; sy < std::min(y * 2 + 2, p_Height); ++sy)
+        for (uint32_t sx = x * 2; sx < std::min(x * 2 + 2, p_Width); ++sx)
+          maxDepth = std::max(maxDepth, p_Depth[uint64_t(sy) * p_Width + sx]);
+      dst[uint64_t(y) * p_Pyramid.width + x] = maxDepth;
+    }
+  }
+
+  // The others read the mip above, clamped once an axis is down to 1 texel
+  for (uint32_t mip = 1; mip < p_Pyramid.numMips; ++mip)
+  {
+    const float* src = p_Pyramid.texels.data() + p_Pyramid.mipOffsets[mip - 1];
+    const uint32_t srcWidth = p_Pyramid.mipWidth(mip - 1);
+    const uint32_t srcHeight = p_Pyramid.mipHeight(mip - 1);
+    dst = p_Pyramid.texels.data() + p_Pyramid.mipOffsets[mip];
+    for (uint32_t y = 0; y < p_Pyramid.mipHeight(mip); ++y)
+    {
+      const uint64_t row0 = uint64_t(y * 2) * srcWidth;
+      const uint64_t row1 = uint64_t(std::min(y * 2 + 1, srcHeight - 1)) * srcWidth;
+      for (uint32_t x = 0; x < p_Pyramid.mipWidth(mip); ++x)
+      {
+        const uint32_t x0 = x * 2;
+        const uint32_t x1 = std::min(x * 2 + 1, srcWidth - 1);
+        dst[uint64_t(y) * p_Pyramid.mipWidth(mip) + x] = std::max(
+            std::max(src[row0 + x0], src[row0 + x1]), std::max(src[row1 + x0], src[row1 + x1]));
+      }
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+OcclusionView makeView(const CameraBase& p_Camera, uint32_t p_Width, uint32_t p_Height)
+{
+  return makeView(
+      p_Camera.ViewMatrix(), p_Camera.ProjectionMatrix(), p_Camera.NearClip(), p_Width, p_Height);
+}
+//---------------------------------------------------------------------------//
+bool projectSphere(
+    const OcclusionView& p_View,
+    const glm::vec4& p_Sphere,
+    glm::vec4& p_PixelRect,
+    float& p_NearestDepth)
+{
+  const glm::vec3 center = glm::vec3(glm::vec4(glm::vec3(p_Sphere), 1.0f) * p_View.view);
+  const float radius = p_Sphere.w;
+  if (center.z - radius < p_View.nearClip)
+    return false;
+
+  // Slopes to NDC through the projection so off-center projections work too
+  const glm::vec2 slopesX = tangentSlopes(center.x, center.z, radius);
+  const glm::vec2 slopesY = tangentSlopes(center.y, center.z, radius);
+  const glm::vec4 clipMinX = glm::vec4(slopesX.x, 0.0f, 1.0f, 1.0f) * p_View.projection;
+  const glm::vec4 clipMaxX = glm::vec4(slopesX.y, 0.0f, 1.0f, 1.0f) * p_View.projection;
+  const glm::vec4 clipMinY = glm::vec4(0.0f, slopesY.x, 1.0f, 1.0f) * p_View.projection;
+  const glm::vec4 clipMaxY = glm::vec4(0.0f, slopesY.y, 1.0f, 1.0f) * p_View.projection;
+
+  // NDC y points up, pixel rows go down
+  const float width = float(p_View.width);
+  const float height = float(p_View.height);
+  p_PixelRect.x = (clipMinX.x / clipMinX.w * 0.5f + 0.5f) * width;
+  p_PixelRect.z = (clipMaxX.x / clipMaxX.w * 0.5f + 0.5f) * width;
+  p_PixelRect.y = (0.5f - clipMaxY.y / clipMaxY.w * 0.5f) * height;
+  p_PixelRect.w = (0.5f - clipMinY.y / clipMinY.w * 0.5f) * height;
+  p_PixelRect = glm::clamp(p_PixelRect, glm::vec4(0.0f), glm::vec4(width, height, width, height));
+
+  p_NearestDepth = deviceDepth(p_View.projection, center.z - radius);
+  return true;
+}
+//---------------------------------------------------------------------------//
+bool isSphereInFrustum(const Frustum& p_Frustum, const glm::vec4& p_Sphere)
+{
+  for (const glm::vec4& plane : p_Frustum.planes)
+    if (glm::dot(glm::vec3(plane), glm::vec3(p_Sphere)) + plane.w < -p_Sphere.w)
+      return false;
+  return true;
+}
+//---------------------------------------------------------------------------//
+bool isSphereOccluded(
+    const DepthPyramid& p_Pyramid, const OcclusionView& p_View, const glm::vec4& p_Sphere)
+{
+  assert(p_Pyramid.depthWidth == p_View.width && p_Pyramid.depthHeight == p_View.height);
+
+  glm::vec4 rect;
+  float nearestDepth = 0.0f;
+  if (projectSphere(p_View, p_Sphere, rect, nearestDepth) == false)
+    return false;
+
+  const uint32_t minX = uint32_t(std::floor(rect.x));
+  const uint32_t minY = uint32_t(std::floor(rect.y));
+  const uint32_t maxX = uint32_t(std::ceil(rect.z));
+  const uint32_t maxY = uint32_t(std::ceil(rect.w));
+  if (minX >= maxX || minY >= maxY)
+    return false;
+
+  const uint32_t mip =
+      std::min(mipForSpan(std::max(maxX - minX, maxY - minY)), p_Pyramid.numMips - 1);
+  const uint32_t mipWidth = p_Pyramid.mipWidth(mip);
+  const uint32_t mipHeight = p_Pyramid.mipHeight(mip);
+
+  // At most 2x2 texels
+  float maxDepth = 0.0f;
+  for (uint32_t y = minY >> (mip + 1); y <= std::min((maxY - 1) >> (mip + 1), mipHeight - 1); ++y)
+    for (uint32_t x = minX >> (mip + 1); x <= std::min((maxX - 1) >> (mip + 1), mipWidth - 1); ++x)
+      maxDepth = std::max(maxDepth, p_Pyramid.load(mip, x, y));
+
+  return nearestDepth > maxDepth;
+}
+//---------------------------------------------------------------------------//
+bool isMeshVisible(
+    const OcclusionView& p_View,
+    const DepthPyramid* p_Previous,
+    const DepthPyramid* p_Current,
+    const glm::vec4& p_Sphere,
+    bool p_Late)
+{
+  if (isSphereInFrustum(p_View.frustum, p_Sphere) == false)
+    return false;
+
+  if (p_Late)
+  {
+    assert(p_Current != nullptr);
+    return isSphereOccluded(*p_Current, p_View, p_Sphere) == false;
+  }
+  return p_Previous == nullptr || isSphereOccluded(*p_Previous, p_View, p_Sphere) == false;
+}
+//---------------------------------------------------------------------------//
+bool isMeshletVisible(
+    const OcclusionView& p_View,
+    const DepthPyramid* p_Previous,
+    const DepthPyramid* p_Current,
+    const glm::vec4& p_Sphere,
+    bool p_Late,
+    bool p_MeshDrawnEarly)
+{
+  if (isMeshVisible(p_View, p_Previous, p_Current, p_Sphere, p_Late) == false)
+    return false;
+
+  // Drawn by the early pass unless it was occluded there
+  if (p_Late && p_MeshDrawnEarly)
+    return p_Previous != nullptr && isSphereOccluded(*p_Previous, p_View, p_Sphere);
+  return true;
+}
+//---------------------------------------------------------------------------//
+// Validation
+//---------------------------------------------------------------------------//
+// Screen space rectangles at a constant view depth, the occluders of the test scenes
+struct Wall
+{
+  glm::uvec4 rect;
+  float viewDepth;
+};
+//---------------------------------------------------------------------------//
+static void makeRandomWalls(
+    Random& p_Rng,
+    uint32_t p_Width,
+    uint32_t p_Height,
+    uint32_t p_Count,
+    std::vector<Wall>& p_Walls)
+{
+  p_Walls.resize(p_Count);
+  for (Wall& wall : p_Walls)
+  {
+    const glm::vec2 size = (p_Rng.RandomFloat2() * 0.4f + 0.1f) * glm::vec2(p_Width, p_Height);
+    const glm::vec2 origin = p_Rng.RandomFloat2() * glm::vec2(p_Width, p_Height) - size * 0.5f;
+    const glm::vec2 minCorner = glm::clamp(origin, glm::vec2(0.0f), glm::vec2(p_Width, p_Height));
+    const glm::vec2 maxCorner =
+        glm::clamp(origin + size, glm::vec2(0.0f), glm::vec2(p_Width, p_Height));
+    wall.rect = glm::uvec4(minCorner, maxCorner);
+    wall.viewDepth = 2.0f + p_Rng.RandomFloat() * 40.0f;
+  }
+}
+//---------------------------------------------------------------------------//
+static void drawWalls(
+    const OcclusionView& p_View, const std::vector<Wall>& p_Walls, std::vector<float>& p_Depth)
+{
+  for (const Wall& wall : p_Walls)
+  {
+    const float depth = deviceDepth(p_View.projection, wall.viewDepth);
+    for (uint32_t y = wall.rect.y; y < wall.rect.w; ++y)
+      for (uint32_t x = wall.rect.x; x < wall.rect.z; ++x)
+        p_Depth[uint64_t(y) * p_View.width + x] =
+            std::min(p_Depth[uint64_t(y) * p_View.width + x], depth);
+  }
+}
+//---------------------------------------------------------------------------//
+// Device depth of the first hit of the pixel center's ray with the sphere, or FLT_MAX
+static float raycastSphere(
+    const OcclusionView& p_View,
+    const glm::mat4& p_InverseProjection,
+    const glm::vec3& p_ViewCenter,
+    float p_Radius,
+    uint32_t p_X,
+    uint32_t p_Y)
+{
+  const glm::vec2 ndc = glm::vec2(
+      (p_X + 0.5f) / p_View.width * 2.0f - 1.0f, 1.0f - (p_Y + 0.5f) / p_View.height * 2.0f);
+  const glm::vec4 point = glm::vec4(ndc, 0.5f, 1.0f) * p_InverseProjection;
+  const glm::vec3 direction = glm::normalize(glm::vec3(point) / point.w);
+
+  const float b = glm::dot(direction, p_ViewCenter);
+  const float c = glm::dot(p_ViewCenter, p_ViewCenter) - p_Radius * p_Radius;
+  const float discriminant = b * b - c;
+  if (discriminant < 0.0f)
+    return FLT_MAX;
+
+  const float t = b - std::sqrt(discriminant);
+  return deviceDepth(p_View.projection, t * direction.z);
+}
+//---------------------------------------------------------------------------//
+// Calls p_Function(x, y, hitDepth) for every pixel center the sphere covers
+template <typename Function>
+static void forEachSpherePixel(
+    const OcclusionView& p_View,
+    const glm::mat4& p_InverseProjection,
+    const glm::vec4& p_Sphere,
+    Function p_Function)
+{
+  const glm::vec3 center = glm::vec3(glm::vec4(glm::vec3(p_Sphere), 1.0f) * p_View.view);
+  if (center.z - p_Sphere.w < p_View.nearClip)
+    return;
+
+  // The projected rectangle grown by a pixel so the ray casts decide on their own
+  glm::vec4 rect;
+  float nearestDepth = 0.0f;
+  projectSphere(p_View, p_Sphere, rect, nearestDepth);
+  const uint32_t minX = uint32_t(std::max(std::floor(rect.x) - 1.0f, 0.0f));
+  const uint32_t minY = uint32_t(std::max(std::floor(rect.y) - 1.0f, 0.0f));
+  const uint32_t maxX = std::min(uint32_t(std::ceil(rect.z)) + 1, p_View.width);
+  const uint32_t maxY = std::min(uint32_t(std::ceil(rect.w)) + 1, p_View.height);
+  for (uint32_t y = minY; y < maxY; ++y)
+  {
+    for (uint32_t x = minX; x < maxX; ++x)
+    {
+      const float hitDepth =
+          raycastSphere(p_View, p_InverseProjection, center, p_Sphere.w, x, y);
+      if (hitDepth != FLT_MAX)
+        p_Function(x, y, hitDepth);
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// Spheres in front of the camera, some of them poking through the near plane or the sides
+static glm::vec4 makeRandomSphere(Random& p_Rng, const glm::mat4& p_InverseView, float p_MaxRadius)
+{
+  const float viewDepth = 0.2f + p_Rng.RandomFloat() * 60.0f;
+  const glm::vec2 offset = (p_Rng.RandomFloat2() * 2.0f - 1.0f) * viewDepth * 0.8f;
+  const glm::vec3 center = glm::vec3(glm::vec4(offset, viewDepth, 1.0f) * p_InverseView);
+  const float size = p_Rng.RandomFloat();
+  return glm::vec4(center, 0.02f + size * size * p_MaxRadius);
+}
+//---------------------------------------------------------------------------//
+static OcclusionView makeRandomView(Random& p_Rng, uint32_t p_Width, uint32_t p_Height)
+{
+  const glm::vec3 eye = (glm::vec3(p_Rng.RandomFloat2(), p_Rng.RandomFloat()) - 0.5f) * 100.0f;
+  const glm::vec3 target = (glm::vec3(p_Rng.RandomFloat2(), p_Rng.RandomFloat()) - 0.5f) * 100.0f;
+  const glm::mat4 view = glm::lookAtLH(eye, target, glm::vec3(0.0f, 1.0f, 0.0f));
+  const float nearClip = 0.1f;
+  const glm::mat4 projection = glm::perspectiveFovLH_ZO(
+      glm::radians(70.0f), float(p_Width), float(p_Height), nearClip, 200.0f);
+  return makeView(
+      glm::transpose(view), glm::transpose(projection), nearClip, p_Width, p_Height);
+}
+//---------------------------------------------------------------------------//
+// Every texel against the maximum of the depth buffer pixels it covers
+static bool validatePyramid(Random& p_Rng, uint32_t p_Width, uint32_t p_Height)
+{
+  std::vector<float> depth(uint64_t(p_Width) * p_Height);
+  for (float& value : depth)
+    value = p_Rng.RandomFloat();
+
+  DepthPyramid pyramid;
+  buildDepthPyramid(depth.data(), p_Width, p_Height, pyramid);
+
+  bool valid = pyramid.width * 2 >= p_Width && pyramid.height * 2 >= p_Height &&
+               pyramid.mipWidth(pyramid.numMips - 1) == 1 &&
+               pyramid.mipHeight(pyramid.numMips - 1) == 1;
+  for (uint32_t mip = 0; mip < pyramid.numMips; ++mip)
+  {
+    for (uint32_t y = 0; y < pyramid.mipHeight(mip); ++y)
+    {
+      for (uint32_t x = 0; x < pyramid.mipWidth(mip); ++x)
+      {
+        float maxDepth = 0.0f;
+        const uint32_t maxSy = std::min((y + 1) << (mip + 1), p_Height);
+        const uint32_t maxSx = std::min((x + 1) << (mip + 1), p_Width);
+        for (uint32_t sy = y << (mip + 1); sy < maxSy; ++sy)
+          for (uint32_t sx = x << (mip + 1); sx < maxSx; ++sx)
+            maxDepth = std::max(maxDepth, depth[uint64_t(sy) * p_Width + sx]);
+        valid = valid && pyramid.load(mip, x, y) == maxDepth;
+      }
+    }
+  }
+  return valid;
+}
+//---------------------------------------------------------------------------//
+bool validate(uint32_t p_NumSpheres)
+{
+  assert(p_NumSpheres > 0);
+
+  Random rng;
+  rng.SetSeed(2468);
+
+  // Odd sizes so the texels past the edges and the clamped mips get tested
+  bool pyramidValid = validatePyramid(rng, 317, 181);
+  pyramidValid = validatePyramid(rng, 64, 64) && pyramidValid;
+  pyramidValid = validatePyramid(rng, 1, 7) && pyramidValid;
+
+  // Spheres against walls, a culled sphere must not have a pixel in front of the depth buffer
+  const uint32_t width = 333;
+  const uint32_t height = 197;
+  uint64_t numFalseCulls = 0;
+  uint64_t numCulled = 0;
+  uint64_t numHidden = 0;
+  for (uint32_t scene = 0; scene < 4; ++scene)
+  {
+    const OcclusionView view = makeRandomView(rng, width, height);
+    const glm::mat4 inverseView = glm::inverse(view.view);
+    const glm::mat4 inverseProjection = glm::inverse(view.projection);
+
+    std::vector<Wall> walls;
+    makeRandomWalls(rng, width, height, 6, walls);
+    std::vector<float> depth(uint64_t(width) * height, 1.0f);
+    drawWalls(view, walls, depth);
+
+    DepthPyramid pyramid;
+    buildDepthPyramid(depth.data(), width, height, pyramid);
+
+    for (uint32_t i = 0; i < p_NumSpheres / 4; ++i)
+    {
+      const glm::vec4 sphere = makeRandomSphere(rng, inverseView, 3.0f);
+      bool visible = false;
+      bool covered = false;
+      forEachSpherePixel(view, inverseProjection, sphere, [&](uint32_t x, uint32_t y, float d) {
+        covered = true;
+        visible = visible || d <= depth[uint64_t(y) * width + x];
+      });
+
+      const bool culled = isSphereOccluded(pyramid, view, sphere);
+      numCulled += culled ? 1 : 0;
+      numHidden += covered && visible == false ? 1 : 0;
+      numFalseCulls += culled && visible ? 1 : 0;
+    }
+  }
+
+  // Two phase culling of objects made of 4 meshlets, the previous pyramid has the walls moved.
+  // Every meshlet drawn at most once, and every one left out hidden by what got drawn.
+  uint64_t numMeshletsDrawnTwice = 0;
+  uint64_t numMeshletsLost = 0;
+  uint64_t numMeshletsEarly = 0;
+  uint64_t numMeshletsLate = 0;
+  uint64_t numMeshletsTotal = 0;
+  for (uint32_t frame = 0; frame < 8; ++frame)
+  {
+    const OcclusionView view = makeRandomView(rng, width, height);
+    const glm::mat4 inverseView = glm::inverse(view.view);
+    const glm::mat4 inverseProjection = glm::inverse(view.projection);
+
+    std::vector<Wall> walls;
+    makeRandomWalls(rng, width, height, 6, walls);
+    std::vector<Wall> previousWalls = walls;
+    for (Wall& wall : previousWalls)
+    {
+      const glm::ivec2 shift = glm::ivec2((rng.RandomFloat2() - 0.5f) * 60.0f);
+      wall.rect = glm::uvec4(glm::clamp(
+          glm::ivec4(wall.rect) + glm::ivec4(shift, shift),
+          glm::ivec4(0),
+          glm::ivec4(width, height, width, height)));
+      wall.viewDepth *= 0.5f + rng.RandomFloat();
+    }
+
+    std::vector<float> previousDepth(uint64_t(width) * height, 1.0f);
+    drawWalls(view, previousWalls, previousDepth);
+    DepthPyramid previous;
+    buildDepthPyramid(previousDepth.data(), width, height, previous);
+    // First frame has no pyramid yet
+    const DepthPyramid* previousPyramid = frame == 0 ? nullptr : &previous;
+
+    const uint32_t numObjects = std::max(p_NumSpheres / 64, 1u);
+    std::vector<glm::vec4> meshSpheres(numObjects);
+    std::vector<glm::vec4> meshletSpheres(numObjects * 4);
+    for (uint32_t i = 0; i < numObjects; ++i)
+    {
+      meshSpheres[i] = makeRandomSphere(rng, inverseView, 2.0f);
+      for (uint32_t m = 0; m < 4; ++m)
+      {
+        const float radius = meshSpheres[i].w * (0.2f + rng.RandomFloat() * 0.3f);
+        const glm::vec3 direction = SampleDirectionSphere(rng.RandomFloat(), rng.RandomFloat());
+        const glm::vec3 offset = direction * (meshSpheres[i].w - radius) * rng.RandomFloat();
+        meshletSpheres[i * 4 + m] = glm::vec4(glm::vec3(meshSpheres[i]) + offset, radius);
+      }
+    }
+
+    std::vector<float> depth(uint64_t(width) * height, 1.0f);
+    drawWalls(view, walls, depth);
+    auto drawSphere = [&](const glm::vec4& p_Sphere) {
+      forEachSpherePixel(view, inverseProjection, p_Sphere, [&](uint32_t x, uint32_t y, float d) {
+        float& pixel = depth[uint64_t(y) * width + x];
+        pixel = std::min(pixel, d);
+      });
+    };
+
+    std::vector<uint8_t> meshDrawnEarly(numObjects);
+    std::vector<uint8_t> meshletDrawCount(numObjects * 4);
+    for (uint32_t i = 0; i < numObjects; ++i)
+    {
+      meshDrawnEarly[i] = isMeshVisible(view, previousPyramid, nullptr, meshSpheres[i], false);
+      if (meshDrawnEarly[i] == 0)
+        continue;
+      for (uint32_t m = i * 4; m < i * 4 + 4; ++m)
+      {
+        if (isMeshletVisible(view, previousPyramid, nullptr, meshletSpheres[m], false, true))
+        {
+          drawSphere(meshletSpheres[m]);
+          ++meshletDrawCount[m];
+          ++numMeshletsEarly;
+        }
+      }
+    }
+
+    DepthPyramid current;
+    buildDepthPyramid(depth.data(), width, height, current);
+    for (uint32_t i = 0; i < numObjects; ++i)
+    {
+      if (isMeshVisible(view, previousPyramid, &current, meshSpheres[i], true) == false)
+        continue;
+      for (uint32_t m = i * 4; m < i * 4 + 4; ++m)
+      {
+        if (isMeshletVisible(
+                view, previousPyramid, &current, meshletSpheres[m], true, meshDrawnEarly[i] != 0))
+        {
+          drawSphere(meshletSpheres[m]);
+          ++meshletDrawCount[m];
+          ++numMeshletsLate;
+        }
+      }
+    }
+
+    for (uint32_t m = 0; m < numObjects * 4; ++m)
+    {
+      numMeshletsDrawnTwice += meshletDrawCount[m] > 1 ? 1 : 0;
+      if (meshletDrawCount[m] > 0)
+        continue;
+
+      bool visible = false;
+      const glm::vec4& sphere = meshletSpheres[m];
+      forEachSpherePixel(view, inverseProjection, sphere, [&](uint32_t x, uint32_t y, float d) {
+        visible = visible || d <= depth[uint64_t(y) * width + x];
+      });
+      numMeshletsLost += visible ? 1 : 0;
+    }
+    numMeshletsTotal += numObjects * 4;
+  }
+
+  const bool valid =
+      pyramidValid && numFalseCulls == 0 && numMeshletsDrawnTwice == 0 && numMeshletsLost == 0;
+  writeLog(
+      "OcclusionCulling::validate: pyramid %s, %u spheres, %llu culled of %llu hidden, %llu false "
+      "culls, meshlets %llu early + %llu late of %llu, %llu drawn twice, %llu lost, %s",
+      pyramidValid ? "matches" : "MISMATCH",
+      p_NumSpheres / 4 * 4,
+      numCulled,
+      numHidden,
+      numFalseCulls,
+      numMeshletsEarly,
+      numMeshletsLate,
+      numMeshletsTotal,
+      numMeshletsDrawnTwice,
+      numMeshletsLost,
+      valid ? "passed" : "FAILED");
+
+  return valid;
+}
+//---------------------------------------------------------------------------//
+void benchmark(uint32_t p_NumIterations)
+{
+  assert(p_NumIterations > 0);
+
+  Random rng;
+  rng.SetSeed(1357);
+
+  const uint32_t width = 1920;
+  const uint32_t height = 1080;
+  const OcclusionView view = makeRandomView(rng, width, height);
+  std::vector<Wall> walls;
+  makeRandomWalls(rng, width, height, 16, walls);
+  std::vector<float> depth(uint64_t(width) * height, 1.0f);
+  drawWalls(view, walls, depth);
+
+  const glm::mat4 inverseView = glm::inverse(view.view);
+  std::vector<glm::vec4> spheres(100000);
+  for (glm::vec4& sphere : spheres)
+    sphere = makeRandomSphere(rng, inverseView, 3.0f);
+
+  Timer timer;
+  timer.init();
+
+  DepthPyramid pyramid;
+  timer.update();
+  for (uint32_t iteration = 0; iteration < p_NumIterations; ++iteration)
+    buildDepthPyramid(depth.data(), width, height, pyramid);
+  timer.update();
+  const double buildMilliseconds = timer.m_DeltaMillisecondsD / p_NumIterations;
+
+  uint32_t numCulled = 0;
+  timer.update();
+  for (uint32_t iteration = 0; iteration < p_NumIterations; ++iteration)
+  {
+    numCulled = 0;
+    for (const glm::vec4& sphere : spheres)
+      numCulled += isSphereOccluded(pyramid, view, sphere) ? 1 : 0;
+  }
+  timer.update();
+  const double testMilliseconds = timer.m_DeltaMillisecondsD / p_NumIterations;
+
+  writeLog(
+      "OcclusionCulling::benchmark: %ux%u pyramid (%u mips) %.3f ms, %zu sphere tests %.3f ms "
+      "(%.1f ns each, %u culled)",
+      pyramid.width,
+      pyramid.height,
+      pyramid.numMips,
+      buildMilliseconds,
+      spheres.size(),
+      testMilliseconds,
+      testMilliseconds * 1e6 / spheres.size(),
+      numCulled);
+}
+//---------------------------------------------------------------------------//
+} // namespace OcclusionCulling
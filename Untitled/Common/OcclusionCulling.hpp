@@ -0,0 +1,102 @@
+#pragma once
+
+#include "FrustumCulling.hpp"
+
+class CameraBase;
+
+//---------------------------------------------------------------------------//
+// CPU copy of the depth pyramid (HZB) the GPU driven renderer builds, texel for texel. Mip 0 is
+// half the depth buffer rounded up to a power of two on each axis so every mip is exactly half
+// of the one above, and a texel holds the farthest depth of the 2x2 texels under it. Texel x of
+// mip m covers the pixels [x << (m + 1), (x + 1) << (m + 1)), the ones past the depth buffer
+// are 0 so they never raise the maximum.
+struct DepthPyramid
+{
+  uint32_t depthWidth = 0;
+  uint32_t depthHeight = 0;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t numMips = 0;
+  std::vector<uint64_t> mipOffsets;
+  std::vector<float> texels;
+
+  uint32_t mipWidth(uint32_t p_Mip) const { return std::max(width >> p_Mip, 1u); }
+  uint32_t mipHeight(uint32_t p_Mip) const { return std::max(height >> p_Mip, 1u); }
+  float load(uint32_t p_Mip, uint32_t p_X, uint32_t p_Y) const
+  {
+    return texels[mipOffsets[p_Mip] + uint64_t(p_Y) * mipWidth(p_Mip) + p_X];
+  }
+};
+//---------------------------------------------------------------------------//
+// Camera the culling runs for, the matrices are stored transposed like the camera classes do
+struct OcclusionView
+{
+  glm::mat4 view;
+  glm::mat4 projection;
+  Frustum frustum;
+  float nearClip = 0.0f;
+  uint32_t width = 0;
+  uint32_t height = 0;
+};
+//---------------------------------------------------------------------------//
+// Reference of the culling in Culling.hlsl and OcclusionCulling.hlsl. The early pass draws what
+// is visible against the last frame's pyramid, the pyramid is rebuilt from that depth and the
+// late pass draws what the new pyramid shows and the early pass skipped. The shaders run the
+// same math, so these decide the same for the same inputs.
+namespace OcclusionCulling
+{
+
+// Size of mip 0 for a depth buffer, the GPU texture is created with the same size
+uint32_t pyramidSize(uint32_t p_DepthSize);
+uint32_t pyramidMipCount(uint32_t p_Width, uint32_t p_Height);
+
+void buildDepthPyramid(
+    const float* p_Depth, uint32_t p_Width, uint32_t p_Height, DepthPyramid& p_Pyramid);
+
+OcclusionView makeView(const CameraBase& p_Camera, uint32_t p_Width, uint32_t p_Height);
+
+// Pixel rectangle [min, max) the world space sphere covers and the device depth of its nearest
+// point. False when the sphere reaches past the near plane, it can't be tested then.
+bool projectSphere(
+    const OcclusionView& p_View,
+    const glm::vec4& p_Sphere,
+    glm::vec4& p_PixelRect,
+    float& p_NearestDepth);
+
+bool isSphereInFrustum(const Frustum& p_Frustum, const glm::vec4& p_Sphere);
+
+// True when the pyramid is nearer than the sphere everywhere the sphere may cover. The mip is
+// picked so the rectangle spans at most 2x2 texels.
+bool isSphereOccluded(
+    const DepthPyramid& p_Pyramid, const OcclusionView& p_View, const glm::vec4& p_Sphere);
+
+// Mesh test of either pass, a mesh has to be inside the frustum and not occluded in the
+// previous frame's pyramid (early) or in the one built from the early pass depth (late).
+// p_Previous is null when there is no pyramid from the last frame yet, the early pass draws
+// everything in the frustum then. p_Current is only read by the late pass.
+bool isMeshVisible(
+    const OcclusionView& p_View,
+    const DepthPyramid* p_Previous,
+    const DepthPyramid* p_Current,
+    const glm::vec4& p_Sphere,
+    bool p_Late);
+
+// Meshlet test of either pass. The late pass draws the meshlets of meshes the early pass drew
+// too, p_MeshDrawnEarly limits it to the ones the early pass culled so none is drawn twice.
+bool isMeshletVisible(
+    const OcclusionView& p_View,
+    const DepthPyramid* p_Previous,
+    const DepthPyramid* p_Current,
+    const glm::vec4& p_Sphere,
+    bool p_Late,
+    bool p_MeshDrawnEarly);
+
+// Headless checks of the pyramid against the depth it was built from, of the sphere test
+// against ray cast spheres and of the two phase decisions on random scenes. Results go to the
+// debug output.
+bool validate(uint32_t p_NumSpheres = 20000);
+
+// Headless timing of the pyramid build at 1080p and of the sphere test
+void benchmark(uint32_t p_NumIterations = 16);
+
+} // namespace OcclusionCulling
@@ -0,0 +1,395 @@
+#include "SceneGraph.hpp"
+#include "Sampling.hpp"
+#include "Timer.hpp"
+#include "WorkerPool.hpp"
+
+//---------------------------------------------------------------------------//
+// Internal
+//---------------------------------------------------------------------------//
+// Nodes of one level a job updates, small levels run in one job
+static constexpr uint32_t NodesPerChunk = 1024;
+
+static glm::mat4 localMatrix(
+    const glm::vec3& p_Translation, const glm::quat& p_Rotation, const glm::vec3& p_Scale)
+{
+  const glm::mat3 rotation = glm::mat3_cast(p_Rotation);
+  return glm::mat4(
+      glm::vec4(rotation[0] * p_Scale.x, 0.0f),
+      glm::vec4(rotation[1] * p_Scale.y, 0.0f),
+      glm::vec4(rotation[2] * p_Scale.z, 0.0f),
+      glm::vec4(p_Translation, 1.0f));
+}
+//---------------------------------------------------------------------------//
+// SceneGraph
+//---------------------------------------------------------------------------//
+void SceneGraph::clear()
+{
+  m_Parents.clear();
+  m_LocalTranslations.clear();
+  m_LocalRotations.clear();
+  m_LocalScales.clear();
+  m_WorldMatrices.clear();
+  m_Dirty.clear();
+  m_WorldChanged.clear();
+  m_Depths.clear();
+  m_Levels.clear();
+  m_NumDirty = 0;
+}
+//---------------------------------------------------------------------------//
+void SceneGraph::reserve(uint32_t p_NumNodes)
+{
+  m_Parents.reserve(p_NumNodes);
+  m_LocalTranslations.reserve(p_NumNodes);
+  m_LocalRotations.reserve(p_NumNodes);
+  m_LocalScales.reserve(p_NumNodes);
+  m_WorldMatrices.reserve(p_NumNodes);
+  m_Dirty.reserve(p_NumNodes);
+  m_WorldChanged.reserve(p_NumNodes);
+  m_Depths.reserve(p_NumNodes);
+}
+//---------------------------------------------------------------------------//
+uint32_t SceneGraph::addNode(
+    uint32_t p_Parent,
+    const glm::vec3& p_Translation,
+    const glm::quat& p_Rotation,
+    const glm::vec3& p_Scale)
+{
+  assert(p_Parent == InvalidNode || p_Parent < numNodes());
+
+  const uint32_t node = numNodes();
+  const uint32_t depth = p_Parent == InvalidNode ? 0 : m_Depths[p_Parent] + 1;
+  m_Parents.push_back(p_Parent);
+  m_LocalTranslations.push_back(p_Translation);
+  m_LocalRotations.push_back(p_Rotation);
+  m_LocalScales.push_back(p_Scale);
+  m_WorldMatrices.push_back(glm::mat4(1.0f));
+  m_Dirty.push_back(1);
+  m_WorldChanged.push_back(0);
+  m_Depths.push_back(depth);
+
+  if (m_Levels.size() <= depth)
+    m_Levels.resize(depth + 1);
+  m_Levels[depth].push_back(node);
+
+  ++m_NumDirty;
+  return node;
+}
+//---------------------------------------------------------------------------//
+void SceneGraph::setLocalTransform(
+    uint32_t p_Node,
+    const glm::vec3& p_Translation,
+    const glm::quat& p_Rotation,
+    const glm::vec3& p_Scale)
+{
+  m_LocalTranslations[p_Node] = p_Translation;
+  m_LocalRotations[p_Node] = p_Rotation;
+  m_LocalScales[p_Node] = p_Scale;
+  m_NumDirty += m_Dirty[p_Node] == 0 ? 1 : 0;
+  m_Dirty[p_Node] = 1;
+}
+//---------------------------------------------------------------------------//
+void SceneGraph::setTranslation(uint32_t p_Node, const glm::vec3& p_Translation)
+{
+  setLocalTransform(p_Node, p_Translation, m_LocalRotations[p_Node], m_LocalScales[p_Node]);
+}
+//---------------------------------------------------------------------------//
+void SceneGraph::setRotation(uint32_t p_Node, const glm::quat& p_Rotation)
+{
+  setLocalTransform(p_Node, m_LocalTranslations[p_Node], p_Rotation, m_LocalScales[p_Node]);
+}
+//---------------------------------------------------------------------------//
+void SceneGraph::setScale(uint32_t p_Node, const glm::vec3& p_Scale)
+{
+  setLocalTransform(p_Node, m_LocalTranslations[p_Node], m_LocalRotations[p_Node], p_Scale);
+}
+//---------------------------------------------------------------------------//
+void SceneGraph::updateNode(uint32_t p_Node)
+{
+  const glm::mat4 local = localMatrix(
+      m_LocalTranslations[p_Node], m_LocalRotations[p_Node], m_LocalScales[p_Node]);
+  const uint32_t parent = m_Parents[p_Node];
+  m_WorldMatrices[p_Node] = parent == InvalidNode ? local : m_WorldMatrices[parent] * local;
+}
+//---------------------------------------------------------------------------//
+uint32_t SceneGraph::update(WorkerPool* p_Pool)
+{
+  if (m_NumDirty == 0)
+  {
+    std::fill(m_WorldChanged.begin(), m_WorldChanged.end(), uint8_t(0));
+    return 0;
+  }
+
+  // A level only reads the world matrices and change flags of the level above it
+  uint32_t numUpdated = 0;
+  for (const std::vector<uint32_t>& level : m_Levels)
+  {
+    const uint32_t numLevelNodes = uint32_t(level.size());
+    const uint32_t numChunks = (numLevelNodes + NodesPerChunk - 1) / NodesPerChunk;
+    m_ChunkUpdates.assign(numChunks, 0);
+
+    auto updateChunk = [&](uint32_t p_Chunk)
+    {
+      const uint32_t first = p_Chunk * NodesPerChunk;
+      const uint32_t last = std::min(first + NodesPerChunk, numLevelNodes);
+      uint32_t numChunkUpdated = 0;
+      for (uint32_t i = first; i < last; ++i)
+      {
+        const uint32_t node = level[i];
+        const uint32_t parent = m_Parents[node];
+        const bool changed =
+            m_Dirty[node] != 0 || (parent != InvalidNode && m_WorldChanged[parent] != 0);
+        m_WorldChanged[node] = changed ? 1 : 0;
+        if (changed)
+        {
+          updateNode(node);
+          m_Dirty[node] = 0;
+          ++numChunkUpdated;
+        }
+      }
+      m_ChunkUpdates[p_Chunk] = numChunkUpdated;
+    };
+
+    if (p_Pool != nullptr)
+      p_Pool->parallelFor(numChunks, updateChunk);
+    else
+    {
+      for (uint32_t chunk = 0; chunk < numChunks; ++chunk)
+        updateChunk(chunk);
+    }
+
+    for (uint32_t chunk = 0; chunk < numChunks; ++chunk)
+      numUpdated += m_ChunkUpdates[chunk];
+  }
+
+  m_NumDirty = 0;
+  return numUpdated;
+}
+//---------------------------------------------------------------------------//
+// Validation and benchmark
+//---------------------------------------------------------------------------//
+static void randomTransform(
+    Random& p_Rng, glm::vec3& p_Translation, glm::quat& p_Rotation, glm::vec3& p_Scale)
+{
+  p_Translation = (glm::vec3(p_Rng.RandomFloat2(), p_Rng.RandomFloat()) - 0.5f) * 4.0f;
+  const glm::vec3 axis = glm::vec3(p_Rng.RandomFloat2(), p_Rng.RandomFloat()) - 0.5f;
+  p_Rotation = glm::angleAxis(
+      p_Rng.RandomFloat() * 2.0f * Pi, glm::normalize(axis + glm::vec3(0.0f, 1e-3f, 0.0f)));
+  p_Scale = glm::vec3(0.8f) + glm::vec3(p_Rng.RandomFloat2(), p_Rng.RandomFloat()) * 0.4f;
+}
+//---------------------------------------------------------------------------//
+// A root per thousand nodes and then breadth first children, 1 to 6 per parent, the order a
+// loader flattening a hierarchy level by level would give. About 7 levels for 100k nodes.
+static void makeRandomGraph(Random& p_Rng, uint32_t p_NumNodes, SceneGraph& p_Graph)
+{
+  const uint32_t numRoots = std::max(p_NumNodes / 1000, 1u);
+  p_Graph.clear();
+  p_Graph.reserve(p_NumNodes);
+
+  uint32_t parent = SceneGraph::InvalidNode;
+  uint32_t numChildrenLeft = 0;
+  for (uint32_t node = 0; node < p_NumNodes; ++node)
+  {
+    if (node >= numRoots)
+    {
+      while (numChildrenLeft == 0)
+      {
+        parent = parent == SceneGraph::InvalidNode ? 0 : parent + 1;
+        numChildrenLeft = 1 + p_Rng.RandomUint() % 6;
+      }
+      --numChildrenLeft;
+    }
+
+    glm::vec3 translation;
+    glm::quat rotation;
+    glm::vec3 scale;
+    randomTransform(p_Rng, translation, rotation, scale);
+    p_Graph.addNode(parent, translation, rotation, scale);
+  }
+}
+//---------------------------------------------------------------------------//
+// World matrix composed up the parent chain, one node at a time
+static glm::mat4 referenceWorld(const SceneGraph& p_Graph, uint32_t p_Node)
+{
+  glm::mat4 world = glm::mat4(1.0f);
+  for (uint32_t node = p_Node; node != SceneGraph::InvalidNode; node = p_Graph.parent(node))
+    world = localMatrix(p_Graph.translation(node), p_Graph.rotation(node), p_Graph.scale(node)) *
+            world;
+  return world;
+}
+//---------------------------------------------------------------------------//
+bool SceneGraph::validate(uint32_t p_NumNodes)
+{
+  Random rng;
+  rng.SetSeed(8642);
+
+  WorkerPool& pool = getWorkerPool();
+
+  SceneGraph serial;
+  makeRandomGraph(rng, p_NumNodes, serial);
+  SceneGraph threaded = serial;
+
+  uint32_t numMismatches = 0;
+  uint32_t numWrongUpdates = 0;
+  uint32_t numPartialUpdated = 0;
+  float maxError = 0.0f;
+
+  auto check = [&](uint32_t p_NumSerialUpdated, uint32_t p_NumThreadedUpdated)
+  {
+    numMismatches += p_NumSerialUpdated != p_NumThreadedUpdated ? 1 : 0;
+    for (uint32_t node = 0; node < serial.numNodes(); ++node)
+    {
+      numMismatches += serial.worldMatrix(node) != threaded.worldMatrix(node) ? 1 : 0;
+      numMismatches += serial.worldChanged(node) != threaded.worldChanged(node) ? 1 : 0;
+
+      const glm::mat4 reference = referenceWorld(serial, node);
+      for (uint32_t column = 0; column < 4; ++column)
+      {
+        const glm::vec4 error = glm::abs(serial.worldMatrix(node)[column] - reference[column]) /
+                                glm::max(glm::abs(reference[column]), glm::vec4(1.0f));
+        maxError = std::max(maxError, glm::compMax(error));
+      }
+    }
+  };
+
+  // Everything is dirty after building
+  uint32_t numSerialUpdated = serial.update(nullptr);
+  uint32_t numThreadedUpdated = threaded.update(&pool);
+  numWrongUpdates += numSerialUpdated != p_NumNodes ? 1 : 0;
+  check(numSerialUpdated, numThreadedUpdated);
+
+  // Then a few random nodes, every node below them has to follow
+  for (uint32_t round = 0; round < 4; ++round)
+  {
+    std::vector<uint8_t> expected(p_NumNodes, 0);
+    for (uint32_t i = 0; i < p_NumNodes / 100; ++i)
+    {
+      const uint32_t node = rng.RandomUint() % p_NumNodes;
+      glm::vec3 translation;
+      glm::quat rotation;
+      glm::vec3 scale;
+      randomTransform(rng, translation, rotation, scale);
+      serial.setLocalTransform(node, translation, rotation, scale);
+      threaded.setLocalTransform(node, translation, rotation, scale);
+      expected[node] = 1;
+    }
+
+    // Parents come first, one pass spreads the flags down
+    uint32_t numExpected = 0;
+    for (uint32_t node = 0; node < p_NumNodes; ++node)
+    {
+      const uint32_t parent = serial.parent(node);
+      if (parent != InvalidNode && expected[parent] != 0)
+        expected[node] = 1;
+      numExpected += expected[node];
+    }
+
+    numSerialUpdated = serial.update(nullptr);
+    numThreadedUpdated = threaded.update(&pool);
+    numPartialUpdated += numSerialUpdated;
+    numWrongUpdates += numSerialUpdated != numExpected ? 1 : 0;
+    for (uint32_t node = 0; node < p_NumNodes; ++node)
+      numWrongUpdates += serial.worldChanged(node) != (expected[node] != 0) ? 1 : 0;
+    check(numSerialUpdated, numThreadedUpdated);
+  }
+
+  // Nothing dirty, nothing changes
+  numWrongUpdates += serial.update(nullptr) != 0 ? 1 : 0;
+  for (uint32_t node = 0; node < p_NumNodes; ++node)
+    numWrongUpdates += serial.worldChanged(node) ? 1 : 0;
+
+  const bool passed = numMismatches == 0 && numWrongUpdates == 0 && maxError < 1e-4f;
+  writeLog(
+      "SceneGraph::validate: %u nodes in %u levels, %u updated by 4 partial updates, "
+      "%u serial/threaded mismatches, %u wrong updates, max relative error %g, %s",
+      p_NumNodes,
+      serial.numLevels(),
+      numPartialUpdated,
+      numMismatches,
+      numWrongUpdates,
+      maxError,
+      passed ? "passed" : "FAILED");
+  return passed;
+}
+//---------------------------------------------------------------------------//
+void SceneGraph::benchmark(uint32_t p_NumNodes, uint32_t p_NumIterations)
+{
+  assert(p_NumIterations > 0);
+
+  Random rng;
+  rng.SetSeed(2222);
+
+  SceneGraph graph;
+  makeRandomGraph(rng, p_NumNodes, graph);
+
+  // Leaves of the tree, the nodes nothing is parented to
+  std::vector<uint8_t> hasChildren(p_NumNodes, 0);
+  for (uint32_t node = 0; node < p_NumNodes; ++node)
+  {
+    if (graph.parent(node) != InvalidNode)
+      hasChildren[graph.parent(node)] = 1;
+  }
+  std::vector<uint32_t> leaves;
+  for (uint32_t node = 0; node < p_NumNodes; ++node)
+  {
+    if (hasChildren[node] == 0)
+      leaves.push_back(node);
+  }
+
+  WorkerPool& pool = getWorkerPool();
+  Timer timer;
+  timer.init();
+
+  // Every node moved, 1% of the leaves moved, 1% of all the nodes moved with their subtrees
+  const char* caseNames[] = {"all nodes", "1% of the leaves", "1% of the nodes"};
+  for (uint32_t caseIdx = 0; caseIdx < arrayCount32(caseNames); ++caseIdx)
+  {
+    double milliseconds[2] = {};
+    uint64_t numUpdated = 0;
+    for (uint32_t threaded = 0; threaded < 2; ++threaded)
+    {
+      for (uint32_t iteration = 0; iteration < p_NumIterations; ++iteration)
+      {
+        const float offset = float(iteration) * 1e-3f;
+        if (caseIdx == 0)
+        {
+          for (uint32_t node = 0; node < p_NumNodes; ++node)
+            graph.setTranslation(node, graph.translation(node) + offset);
+        }
+        else if (caseIdx == 1)
+        {
+          for (uint32_t i = 0; i < uint32_t(leaves.size()) / 100; ++i)
+          {
+            const uint32_t node = leaves[rng.RandomUint() % leaves.size()];
+            graph.setTranslation(node, graph.translation(node) + offset);
+          }
+        }
+        else
+        {
+          for (uint32_t i = 0; i < p_NumNodes / 100; ++i)
+          {
+            const uint32_t node = rng.RandomUint() % p_NumNodes;
+            graph.setTranslation(node, graph.translation(node) + offset);
+          }
+        }
+
+        timer.update();
+        const uint32_t count = graph.update(threaded != 0 ? &pool : nullptr);
+        timer.update();
+        milliseconds[threaded] += timer.m_DeltaMillisecondsD;
+        numUpdated += threaded == 0 ? count : 0;
+      }
+    }
+
+    writeLog(
+        "SceneGraph::benchmark: %u nodes in %u levels, %s moved, %.0f updated, serial %.3f ms, "
+        "%u threads %.3f ms (%.1fx)",
+        p_NumNodes,
+        graph.numLevels(),
+        caseNames[caseIdx],
+        double(numUpdated) / p_NumIterations,
+        milliseconds[0] / p_NumIterations,
+        pool.numThreads(),
+        milliseconds[1] / p_NumIterations,
+        milliseconds[0] / milliseconds[1]);
+  }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Utility.hpp"
+
+struct WorkerPool;
+
+//---------------------------------------------------------------------------//
+// Transform hierarchy in structure-of-arrays layout, one array per local or world attribute and
+// all of them indexed by node. Parents are always added before their children and every node
+// is also listed under its depth, so update() can transform a whole depth level in parallel once
+// the level above it is done.
+//
+// Setting a local transform only marks the node dirty, update() recomputes the world matrices of
+// the dirty nodes and of everything below them. World matrices are column-major glm matrices,
+// world = parent world * translation * rotation * scale.
+//---------------------------------------------------------------------------//
+struct SceneGraph
+{
+  static constexpr uint32_t InvalidNode = UINT32_MAX;
+
+  void clear();
+  void reserve(uint32_t p_NumNodes);
+
+  // p_Parent has to exist already, InvalidNode adds a root. Returns the node index.
+  uint32_t addNode(
+      uint32_t p_Parent,
+      const glm::vec3& p_Translation = glm::vec3(0.0f),
+      const glm::quat& p_Rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f),
+      const glm::vec3& p_Scale = glm::vec3(1.0f));
+
+  void setLocalTransform(
+      uint32_t p_Node,
+      const glm::vec3& p_Translation,
+      const glm::quat& p_Rotation,
+      const glm::vec3& p_Scale);
+  void setTranslation(uint32_t p_Node, const glm::vec3& p_Translation);
+  void setRotation(uint32_t p_Node, const glm::quat& p_Rotation);
+  void setScale(uint32_t p_Node, const glm::vec3& p_Scale);
+
+  // Recomputes the world matrices of the dirty nodes and their subtrees, p_Pool null runs on the
+  // calling thread. Returns how many nodes got a new world matrix.
+  uint32_t update(WorkerPool* p_Pool);
+
+  uint32_t numNodes() const { return uint32_t(m_Parents.size()); }
+  uint32_t numLevels() const { return uint32_t(m_Levels.size()); }
+  uint32_t parent(uint32_t p_Node) const { return m_Parents[p_Node]; }
+  const glm::vec3& translation(uint32_t p_Node) const { return m_LocalTranslations[p_Node]; }
+  const glm::quat& rotation(uint32_t p_Node) const { return m_LocalRotations[p_Node]; }
+  const glm::vec3& scale(uint32_t p_Node) const { return m_LocalScales[p_Node]; }
+  const glm::mat4& worldMatrix(uint32_t p_Node) const { return m_WorldMatrices[p_Node]; }
+  const glm::mat4* worldMatrices() const { return m_WorldMatrices.data(); }
+
+  // Whether the last update() wrote the node's world matrix, to upload only what changed
+  bool worldChanged(uint32_t p_Node) const { return m_WorldChanged[p_Node] != 0; }
+
+  // Headless checks of the parallel update against the serial one and against world matrices
+  // composed up the parent chain of every node. Results go to the debug output.
+  static bool validate(uint32_t p_NumNodes = 20000);
+  // Headless timings of full and partial updates of a p_NumNodes node hierarchy, serial and
+  // threaded, written to the debug output
+  static void benchmark(uint32_t p_NumNodes = 100000, uint32_t p_NumIterations = 16);
+
+private:
+  void updateNode(uint32_t p_Node);
+
+  // Local
+  std::vector<uint32_t> m_Parents;
+  std::vector<glm::vec3> m_LocalTranslations;
+  std::vector<glm::quat> m_LocalRotations;
+  std::vector<glm::vec3> m_LocalScales;
+
+  // World
+  std::vector<glm::mat4> m_WorldMatrices;
+  std::vector<uint8_t> m_Dirty;
+  std::vector<uint8_t> m_WorldChanged;
+
+  // Nodes of every depth, roots first
+  std::vector<uint32_t> m_Depths;
+  std::vector<std::vector<uint32_t>> m_Levels;
+  std::vector<uint32_t> m_ChunkUpdates;
+  uint32_t m_NumDirty = 0;
+};
@@ -0,0 +1,241 @@
+#include "ShadowCache.hpp"
+#include "D3D12Wrapper.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+//---------------------------------------------------------------------------//
+void ShadowCache::init(uint32_t p_NumSlices)
+{
+  m_Slices.clear();
+  m_Slices.resize(p_NumSlices);
+  m_HasSettings = false;
+  m_Frame = 0;
+  m_Stats = ShadowCacheStats();
+  m_Stats.NumSlices = p_NumSlices;
+
+  invalidateAll();
+}
+//---------------------------------------------------------------------------//
+void ShadowCache::markDirty(Slice& p_Slice)
+{
+  if (p_Slice.dirty == false)
+    p_Slice.dirtyFrame = m_Frame;
+  p_Slice.dirty = true;
+}
+//---------------------------------------------------------------------------//
+void ShadowCache::setSliceCamera(uint32_t p_Slice, const glm::mat4& p_ViewProjection)
+{
+  Slice& slice = m_Slices[p_Slice];
+  if (slice.hasCamera && slice.viewProjection == p_ViewProjection)
+    return;
+
+  slice.viewProjection = p_ViewProjection;
+  slice.frustum = FrustumCulling::extractFrustum(p_ViewProjection);
+  slice.hasCamera = true;
+  markDirty(slice);
+}
+//---------------------------------------------------------------------------//
+void ShadowCache::casterMoved(
+    const glm::vec3& p_OldMin,
+    const glm::vec3& p_OldMax,
+    const glm::vec3& p_NewMin,
+    const glm::vec3& p_NewMax)
+{
+  const glm::vec3 oldCenter = (p_OldMin + p_OldMax) * 0.5f;
+  const glm::vec3 oldExtent = (p_OldMax - p_OldMin) * 0.5f;
+  const glm::vec3 newCenter = (p_NewMin + p_NewMax) * 0.5f;
+  const glm::vec3 newExtent = (p_NewMax - p_NewMin) * 0.5f;
+
+  for (Slice& slice : m_Slices)
+  {
+    // Slices without a camera are rendered from scratch once they get one
+    if (slice.hasCamera == false || slice.dirty)
+      continue;
+
+    if (FrustumCulling::testBox(slice.frustum, oldCenter, oldExtent) ||
+        FrustumCulling::testBox(slice.frustum, newCenter, newExtent))
+      markDirty(slice);
+  }
+}
+//---------------------------------------------------------------------------//
+void ShadowCache::setSettingsHash(uint64_t p_Hash)
+{
+  if (m_HasSettings && m_SettingsHash == p_Hash)
+    return;
+
+  m_SettingsHash = p_Hash;
+  m_HasSettings = true;
+  invalidateAll();
+}
+//---------------------------------------------------------------------------//
+void ShadowCache::invalidate(uint32_t p_Slice)
+{
+  Slice& slice = m_Slices[p_Slice];
+  slice.valid = false;
+  markDirty(slice);
+}
+//---------------------------------------------------------------------------//
+void ShadowCache::invalidateAll()
+{
+  for (uint32_t i = 0; i < uint32_t(m_Slices.size()); ++i)
+    invalidate(i);
+}
+//---------------------------------------------------------------------------//
+void ShadowCache::collectUpdates(uint32_t p_Budget, std::vector<uint32_t>& p_Slices)
+{
+  p_Slices.clear();
+
+  // Invalid slices first, then the budgeted ones oldest first (ties by slice index)
+  std::vector<uint32_t> stale;
+  for (uint32_t i = 0; i < uint32_t(m_Slices.size()); ++i)
+  {
+    const Slice& slice = m_Slices[i];
+    if (slice.hasCamera == false || slice.dirty == false)
+      continue;
+
+    if (slice.valid)
+      stale.push_back(i);
+    else
+      p_Slices.push_back(i);
+  }
+
+  std::stable_sort(stale.begin(), stale.end(), [this](uint32_t p_A, uint32_t p_B) {
+    return m_Slices[p_A].dirtyFrame < m_Slices[p_B].dirtyFrame;
+  });
+
+  const uint32_t numStale =
+      p_Budget == 0 ? uint32_t(stale.size()) : std::min<uint32_t>(p_Budget, uint32_t(stale.size()));
+  p_Slices.insert(p_Slices.end(), stale.begin(), stale.begin() + numStale);
+
+  for (uint32_t idx : p_Slices)
+  {
+    m_Slices[idx].renderedViewProjection = m_Slices[idx].viewProjection;
+    m_Slices[idx].dirty = false;
+    m_Slices[idx].valid = true;
+  }
+
+  m_Stats.NumUpdated = uint32_t(p_Slices.size());
+  m_Stats.NumDeferred = uint32_t(stale.size()) - numStale;
+
+  ++m_Frame;
+}
+//---------------------------------------------------------------------------//
+// Validation
+//---------------------------------------------------------------------------//
+// Spot light at p_Position looking straight down, stored transposed like the camera classes do
+static glm::mat4 makeSpotViewProjection(const glm::vec3& p_Position, float p_Fov)
+{
+  const glm::mat4 view =
+      glm::lookAtLH(p_Position, p_Position - glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0, 0, 1));
+  const glm::mat4 projection = glm::perspectiveFovLH_ZO(p_Fov, 1.0f, 1.0f, 0.1f, 7.5f);
+  return glm::transpose(view) * glm::transpose(projection);
+}
+//---------------------------------------------------------------------------//
+bool ShadowCache::validate()
+{
+  // Four lights 10 units apart along x, 5 units above the ground, and a slice that's never used
+  const uint32_t numLights = 4;
+  glm::vec3 lightPositions[numLights];
+  for (uint32_t i = 0; i < numLights; ++i)
+    lightPositions[i] = glm::vec3(i * 10.0f, 5.0f, 0.0f);
+  const float fov = 1.0f;
+
+  ShadowCache cache;
+  cache.init(numLights + 1);
+
+  bool valid = true;
+  uint32_t numFrames = 0;
+  std::vector<uint32_t> updates;
+  auto expectUpdates = [&](uint32_t p_Budget, std::vector<uint32_t> p_Expected) {
+    cache.collectUpdates(p_Budget, updates);
+    if (updates != p_Expected)
+    {
+      writeLog(
+          "ShadowCache::validate: frame %u updated %u slices, expected %u",
+          numFrames,
+          uint32_t(updates.size()),
+          uint32_t(p_Expected.size()));
+      valid = false;
+    }
+    ++numFrames;
+  };
+  auto setCameras = [&]() {
+    for (uint32_t i = 0; i < numLights; ++i)
+      cache.setSliceCamera(i, makeSpotViewProjection(lightPositions[i], fov));
+  };
+  // Unit box resting on the ground below x
+  auto boxMin = [](float p_X) { return glm::vec3(p_X - 0.5f, 0.0f, -0.5f); };
+  auto boxMax = [](float p_X) { return glm::vec3(p_X + 0.5f, 1.0f, 0.5f); };
+
+  // Everything renders once, whatever the budget
+  setCameras();
+  cache.setSettingsHash(1);
+  expectUpdates(1, {0, 1, 2, 3});
+
+  // Nothing changed, or the same matrices set again
+  expectUpdates(0, {});
+  setCameras();
+  expectUpdates(0, {});
+
+  // One light moved
+  lightPositions[1].y += 0.5f;
+  setCameras();
+  expectUpdates(0, {1});
+
+  // A caster moving below one light, then from under light 0 to under light 3
+  cache.casterMoved(boxMin(20.0f), boxMax(20.0f), boxMin(20.5f), boxMax(20.5f));
+  expectUpdates(0, {2});
+  cache.casterMoved(boxMin(0.0f), boxMax(0.0f), boxMin(30.0f), boxMax(30.0f));
+  expectUpdates(0, {0, 3});
+
+  // A caster moving between the lights, outside every cone, and one far behind them
+  cache.casterMoved(boxMin(5.0f), boxMax(5.0f), boxMin(15.0f), boxMax(15.0f));
+  cache.casterMoved(boxMin(100.0f), boxMax(100.0f), boxMin(200.0f), boxMax(200.0f));
+  expectUpdates(0, {});
+
+  // Budget of one: three lights move, then a fourth while the others wait. The waiting slices go
+  // first and in index order.
+  lightPositions[0].x += 1.0f;
+  lightPositions[2].x += 1.0f;
+  lightPositions[3].x += 1.0f;
+  setCameras();
+  expectUpdates(1, {0});
+  valid = valid && cache.stats().NumDeferred == 2 && cache.isDirty(2) && cache.isDirty(3);
+  lightPositions[1].x += 1.0f;
+  setCameras();
+  expectUpdates(1, {2});
+  // A slice that's already waiting keeps its place when it changes again
+  lightPositions[3].x += 1.0f;
+  setCameras();
+  expectUpdates(1, {3});
+  expectUpdates(1, {1});
+  expectUpdates(1, {});
+
+  // Two lights move with a budget of one. The deferred slice keeps the matrix it was rendered
+  // with until its update, the light's new one would sample stale depth.
+  const glm::mat4 renderedBeforeMove = makeSpotViewProjection(lightPositions[1], fov);
+  lightPositions[0].z += 1.0f;
+  lightPositions[1].z += 1.0f;
+  setCameras();
+  expectUpdates(1, {0});
+  valid = valid && cache.isDirty(1) &&
+          cache.renderedViewProjection(0) == makeSpotViewProjection(lightPositions[0], fov) &&
+          cache.renderedViewProjection(1) == renderedBeforeMove;
+  expectUpdates(1, {1});
+  valid =
+      valid && cache.renderedViewProjection(1) == makeSpotViewProjection(lightPositions[1], fov);
+
+  // New settings discard every slice, the budget doesn't apply to them
+  cache.setSettingsHash(2);
+  expectUpdates(1, {0, 1, 2, 3});
+
+  cache.invalidate(2);
+  expectUpdates(1, {2});
+
+  // The slice without a camera was never picked
+  valid = valid && cache.isValid(numLights) == false;
+
+  writeLog("ShadowCache::validate: %u scripted frames, %s", numFrames, valid ? "passed" : "FAILED");
+  return valid;
+}
+//---------------------------------------------------------------------------//
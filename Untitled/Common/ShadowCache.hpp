@@ -0,0 +1,83 @@
+#pragma once
+
+#include "FrustumCulling.hpp"
+
+//---------------------------------------------------------------------------//
+// Dirty tracking for the slices of a shadow map array, so shadows of static lights and geometry
+// are rendered once and reused. A slice gets dirty when the view-projection it's rendered with
+// changes, when a caster moves inside its frustum (before or after the move), or when the
+// settings every slice depends on change. CPU only, the caller renders the slices it's handed.
+//---------------------------------------------------------------------------//
+struct ShadowCacheStats
+{
+  uint32_t NumSlices = 0;
+  // Rendered this frame
+  uint32_t NumUpdated = 0;
+  // Still dirty after this frame because of the update budget
+  uint32_t NumDeferred = 0;
+};
+//---------------------------------------------------------------------------//
+struct ShadowCache
+{
+  // All slices start out invalid
+  void init(uint32_t p_NumSlices);
+
+  // Marks the slice dirty when the matrix differs from the one it was last given
+  void setSliceCamera(uint32_t p_Slice, const glm::mat4& p_ViewProjection);
+
+  // A caster moved or changed its bounds, the slices seeing either box get dirty.
+  // Casters that appear or disappear pass the same box twice.
+  void casterMoved(
+      const glm::vec3& p_OldMin,
+      const glm::vec3& p_OldMax,
+      const glm::vec3& p_NewMin,
+      const glm::vec3& p_NewMax);
+
+  // Hash of everything the depth of all slices depends on (map size, clip planes, LODs...),
+  // a different hash invalidates every slice
+  void setSettingsHash(uint64_t p_Hash);
+
+  void invalidate(uint32_t p_Slice);
+  void invalidateAll();
+
+  // Fills p_Slices with the slices to render this frame, which count as clean afterwards.
+  // Invalid slices have undefined contents and ignore the budget, the other dirty slices are
+  // taken in the order they got dirty, at most p_Budget of them (0 for no limit). Slices without
+  // a camera are never picked.
+  void collectUpdates(uint32_t p_Budget, std::vector<uint32_t>& p_Slices);
+
+  bool isDirty(uint32_t p_Slice) const { return m_Slices[p_Slice].dirty; }
+  bool isValid(uint32_t p_Slice) const { return m_Slices[p_Slice].valid; }
+  // The matrix the slice's contents were rendered with. It lags behind setSliceCamera() while
+  // the slice waits for its update, so this is the one to sample the slice with.
+  const glm::mat4& renderedViewProjection(uint32_t p_Slice) const
+  {
+    return m_Slices[p_Slice].renderedViewProjection;
+  }
+  const ShadowCacheStats& stats() const { return m_Stats; }
+
+  // Headless run of scripted light and caster movements, checking which slices get picked each
+  // frame. Results go to the debug output.
+  static bool validate();
+
+private:
+  struct Slice
+  {
+    glm::mat4 viewProjection;
+    glm::mat4 renderedViewProjection = glm::mat4(1.0f);
+    Frustum frustum;
+    // Frame the slice got dirty, kept while it waits for its update
+    uint64_t dirtyFrame = 0;
+    bool hasCamera = false;
+    bool valid = false;
+    bool dirty = false;
+  };
+
+  void markDirty(Slice& p_Slice);
+
+  std::vector<Slice> m_Slices;
+  uint64_t m_SettingsHash = 0;
+  bool m_HasSettings = false;
+  uint64_t m_Frame = 0;
+  ShadowCacheStats m_Stats;
+};
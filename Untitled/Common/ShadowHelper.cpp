@@ -2,6 +2,9 @@
 #include "Camera.hpp"
 
 #include "D3D12Wrapper.hpp"
+#include "Sampling.hpp"
+
+#include <immintrin.h>
 
 namespace ShadowHelper
 {
@@ -15,6 +18,133 @@ glm::mat4 ShadowScaleOffsetMatrix = glm::transpose(glm::mat4(
 
 static bool initialized = false;
 
+//---------------------------------------------------------------------------//
+// Caster culling internals
+//---------------------------------------------------------------------------//
+// Planes and skip thresholds of all cascades, shared by the SSE path and the scalar reference
+struct CascadeCullingSetup
+{
+  // The 4 side planes and the far plane, the near plane is dropped to extrude towards the light
+  glm::vec4 planes[NumCascades][5];
+  // Signed view depth of the main camera
+  glm::vec4 depthPlane;
+  // View depth gained per unit the shadow travels from the caster
+  float sweepScale[NumCascades];
+  // Casters whose shadow stays below this view depth are skipped, -FLT_MAX for cascade 0
+  float skipThreshold[NumCascades];
+};
+//---------------------------------------------------------------------------//
+static CascadeCullingSetup makeCullingSetup(
+    const glm::vec3& lightDir,
+    uint64_t shadowMapSize,
+    const CameraBase& camera,
+    const SunShadowConstantsBase& constants,
+    const OrthographicCamera* cascadeCameras)
+{
+  CascadeCullingSetup setup;
+
+  // The view matrix is stored transposed, its third column gives the view space z
+  setup.depthPlane = camera.ViewMatrix()[2];
+  setup.depthPlane /= glm::length(glm::vec3(setup.depthPlane));
+  const glm::vec3 depthNormal = glm::vec3(setup.depthPlane);
+  const glm::vec3 absDepthNormal = glm::abs(depthNormal);
+
+  // Shadows travel away from the light
+  const float sweepScale = std::max(glm::dot(-glm::normalize(lightDir), depthNormal), 0.0f);
+
+  for (uint64_t cascadeIdx = 0; cascadeIdx < NumCascades; ++cascadeIdx)
+  {
+    const OrthographicCamera& cascade = cascadeCameras[cascadeIdx];
+    const Frustum frustum = FrustumCulling::extractFrustum(cascade.ViewProjectionMatrix());
+    for (uint32_t p = 0; p < 4; ++p)
+      setup.planes[cascadeIdx][p] = frustum.planes[p];
+    setup.planes[cascadeIdx][4] = frustum.planes[5];
+
+    setup.sweepScale[cascadeIdx] = sweepScale;
+
+    if (cascadeIdx == 0)
+    {
+      setup.skipThreshold[cascadeIdx] = -FLT_MAX;
+      continue;
+    }
+
+    // Receivers next to the split filter over a few texels around them, growing the caster by
+    // the kernel (and a texel for the stabilization offset) in every axis covers those taps
+    const float texelSize = (cascade.MaxX() - cascade.MinX()) / shadowMapSize;
+    const float filterRadius = texelSize * (MaxShadowFilterSize * 0.5f + 1.0f);
+    setup.skipThreshold[cascadeIdx] =
+        constants.CascadeSplits[cascadeIdx - 1] -
+        filterRadius * (absDepthNormal.x + absDepthNormal.y + absDepthNormal.z);
+  }
+
+  return setup;
+}
+//---------------------------------------------------------------------------//
+// Same expression as the frustum culling, in the same order so the SSE path matches bit for bit
+static float boxPlaneMargin(const CullingBounds& bounds, uint32_t idx, const glm::vec4& plane)
+{
+  const float distance = plane.x * bounds.centerX[idx] + plane.y * bounds.centerY[idx] +
+                         plane.z * bounds.centerZ[idx] + plane.w;
+  const float radius = std::abs(plane.x) * bounds.extentX[idx] +
+                       std::abs(plane.y) * bounds.extentY[idx] +
+                       std::abs(plane.z) * bounds.extentZ[idx];
+  return distance + radius;
+}
+//---------------------------------------------------------------------------//
+static void cullCascadeBox(
+    const CascadeCullingSetup& setup,
+    const CullingBounds& bounds,
+    uint32_t idx,
+    uint32_t* const* casters,
+    uint32_t* numCasters,
+    uint32_t* numSkipped)
+{
+  // Largest view depth of the box
+  const float maxDepth = boxPlaneMargin(bounds, idx, setup.depthPlane);
+
+  for (uint64_t cascadeIdx = 0; cascadeIdx < NumCascades; ++cascadeIdx)
+  {
+    bool inside = true;
+    float farMargin = 0.0f;
+    for (uint32_t p = 0; p < 5; ++p)
+    {
+      farMargin = boxPlaneMargin(bounds, idx, setup.planes[cascadeIdx][p]);
+      inside &= farMargin >= 0.0f;
+    }
+    if (inside == false)
+      continue;
+
+    // The far plane faces the light, its margin is how far the shadow can still travel
+    const float shadowDepth = maxDepth + setup.sweepScale[cascadeIdx] * std::max(farMargin, 0.0f);
+    if (shadowDepth < setup.skipThreshold[cascadeIdx])
+      ++numSkipped[cascadeIdx];
+    else
+      casters[cascadeIdx][numCasters[cascadeIdx]++] = idx;
+  }
+}
+//---------------------------------------------------------------------------//
+static void beginCascadeCulling(
+    const CullingBounds& bounds,
+    std::vector<uint32_t>* casters,
+    uint32_t** casterPtrs,
+    SunShadowCullingStats& stats)
+{
+  stats = SunShadowCullingStats();
+  stats.NumMeshes = bounds.count();
+  for (uint64_t cascadeIdx = 0; cascadeIdx < NumCascades; ++cascadeIdx)
+  {
+    casters[cascadeIdx].resize(bounds.count());
+    casterPtrs[cascadeIdx] = casters[cascadeIdx].data();
+  }
+}
+//---------------------------------------------------------------------------//
+static void endCascadeCulling(std::vector<uint32_t>* casters, const SunShadowCullingStats& stats)
+{
+  for (uint64_t cascadeIdx = 0; cascadeIdx < NumCascades; ++cascadeIdx)
+    casters[cascadeIdx].resize(stats.NumCasters[cascadeIdx]);
+}
+//---------------------------------------------------------------------------//
+
 void init()
 {
   assert(initialized == false);
@@ -151,8 +281,7 @@ void prepareCascades(
       // Create a temporary view matrix for the light
       glm::vec3 lightCameraPos = frustumCenter;
       glm::vec3 lookAt = frustumCenter - lightDir;
-      glm::mat4 lightView =
-          glm::lookAtLH(lightCameraPos, lookAt, upDir);
+      glm::mat4 lightView = glm::transpose(glm::lookAtLH(lightCameraPos, lookAt, upDir));
 
       // Calculate an AABB around the frustum corners
       const float floatMax = std::numeric_limits<float>::max();
@@ -241,4 +370,327 @@ void prepareCascades(
   }
 }
 
+//---------------------------------------------------------------------------//
+void cullCascadeCastersScalar(
+    const CullingBounds& bounds,
+    const glm::vec3& lightDir,
+    uint64_t shadowMapSize,
+    const CameraBase& camera,
+    const SunShadowConstantsBase& constants,
+    const OrthographicCamera* cascadeCameras,
+    std::vector<uint32_t>* casters,
+    SunShadowCullingStats& stats)
+{
+  const CascadeCullingSetup setup =
+      makeCullingSetup(lightDir, shadowMapSize, camera, constants, cascadeCameras);
+
+  uint32_t* casterPtrs[NumCascades];
+  beginCascadeCulling(bounds, casters, casterPtrs, stats);
+
+  for (uint32_t i = 0; i < bounds.count(); ++i)
+    cullCascadeBox(setup, bounds, i, casterPtrs, stats.NumCasters, stats.NumSkipped);
+
+  endCascadeCulling(casters, stats);
+}
+//---------------------------------------------------------------------------//
+void cullCascadeCasters(
+    const CullingBounds& bounds,
+    const glm::vec3& lightDir,
+    uint64_t shadowMapSize,
+    const CameraBase& camera,
+    const SunShadowConstantsBase& constants,
+    const OrthographicCamera* cascadeCameras,
+    std::vector<uint32_t>* casters,
+    SunShadowCullingStats& stats)
+{
+  const CascadeCullingSetup setup =
+      makeCullingSetup(lightDir, shadowMapSize, camera, constants, cascadeCameras);
+
+  uint32_t* casterPtrs[NumCascades];
+  beginCascadeCulling(bounds, casters, casterPtrs, stats);
+
+  const __m128 signMask = _mm_set1_ps(-0.0f);
+  const __m128 zero = _mm_setzero_ps();
+
+  struct PlaneSSE
+  {
+    __m128 x, y, z, w;
+    __m128 absX, absY, absZ;
+  };
+  auto loadPlane = [&](const glm::vec4& plane) {
+    PlaneSSE result;
+    result.x = _mm_set1_ps(plane.x);
+    result.y = _mm_set1_ps(plane.y);
+    result.z = _mm_set1_ps(plane.z);
+    result.w = _mm_set1_ps(plane.w);
+    result.absX = _mm_andnot_ps(signMask, result.x);
+    result.absY = _mm_andnot_ps(signMask, result.y);
+    result.absZ = _mm_andnot_ps(signMask, result.z);
+    return result;
+  };
+
+  PlaneSSE planes[NumCascades][5];
+  __m128 sweepScale[NumCascades];
+  __m128 skipThreshold[NumCascades];
+  for (uint64_t cascadeIdx = 0; cascadeIdx < NumCascades; ++cascadeIdx)
+  {
+    for (uint32_t p = 0; p < 5; ++p)
+      planes[cascadeIdx][p] = loadPlane(setup.planes[cascadeIdx][p]);
+    sweepScale[cascadeIdx] = _mm_set1_ps(setup.sweepScale[cascadeIdx]);
+    skipThreshold[cascadeIdx] = _mm_set1_ps(setup.skipThreshold[cascadeIdx]);
+  }
+  const PlaneSSE depthPlane = loadPlane(setup.depthPlane);
+
+  const uint32_t count = bounds.count();
+  const uint32_t simdCount = count & ~3u;
+  for (uint32_t i = 0; i < simdCount; i += 4)
+  {
+    // Each group of 4 boxes is loaded once and tested against every cascade
+    const __m128 centerX = _mm_loadu_ps(&bounds.centerX[i]);
+    const __m128 centerY = _mm_loadu_ps(&bounds.centerY[i]);
+    const __m128 centerZ = _mm_loadu_ps(&bounds.centerZ[i]);
+    const __m128 extentX = _mm_loadu_ps(&bounds.extentX[i]);
+    const __m128 extentY = _mm_loadu_ps(&bounds.extentY[i]);
+    const __m128 extentZ = _mm_loadu_ps(&bounds.extentZ[i]);
+
+    auto margin = [&](const PlaneSSE& plane) {
+      __m128 distance = _mm_mul_ps(plane.x, centerX);
+      distance = _mm_add_ps(distance, _mm_mul_ps(plane.y, centerY));
+      distance = _mm_add_ps(distance, _mm_mul_ps(plane.z, centerZ));
+      distance = _mm_add_ps(distance, plane.w);
+
+      __m128 radius = _mm_mul_ps(plane.absX, extentX);
+      radius = _mm_add_ps(radius, _mm_mul_ps(plane.absY, extentY));
+      radius = _mm_add_ps(radius, _mm_mul_ps(plane.absZ, extentZ));
+      return _mm_add_ps(distance, radius);
+    };
+
+    const __m128 maxDepth = margin(depthPlane);
+
+    for (uint64_t cascadeIdx = 0; cascadeIdx < NumCascades; ++cascadeIdx)
+    {
+      __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+      __m128 farMargin = zero;
+      for (uint32_t p = 0; p < 5; ++p)
+      {
+        farMargin = margin(planes[cascadeIdx][p]);
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(farMargin, zero));
+      }
+
+      const __m128 shadowDepth =
+          _mm_add_ps(maxDepth, _mm_mul_ps(sweepScale[cascadeIdx], _mm_max_ps(farMargin, zero)));
+      const __m128 skip = _mm_cmplt_ps(shadowDepth, skipThreshold[cascadeIdx]);
+
+      const uint32_t keepMask = uint32_t(_mm_movemask_ps(_mm_andnot_ps(skip, inside)));
+      const uint32_t skipMask = uint32_t(_mm_movemask_ps(_mm_and_ps(skip, inside)));
+
+      // Branchless compaction, the slot is only kept when the lane is a caster
+      uint32_t* cascadeCasters = casterPtrs[cascadeIdx];
+      uint32_t numCasters = stats.NumCasters[cascadeIdx];
+      for (uint32_t lane = 0; lane < 4; ++lane)
+      {
+        cascadeCasters[numCasters] = i + lane;
+        numCasters += (keepMask >> lane) & 1;
+        stats.NumSkipped[cascadeIdx] += (skipMask >> lane) & 1;
+      }
+      stats.NumCasters[cascadeIdx] = numCasters;
+    }
+  }
+
+  for (uint32_t i = simdCount; i < count; ++i)
+    cullCascadeBox(setup, bounds, i, casterPtrs, stats.NumCasters, stats.NumSkipped);
+
+  endCascadeCulling(casters, stats);
+}
+//---------------------------------------------------------------------------//
+// Validation
+//---------------------------------------------------------------------------//
+static bool containsIndex(const std::vector<uint32_t>& indices, uint32_t idx)
+{
+  return std::binary_search(indices.begin(), indices.end(), idx);
+}
+//---------------------------------------------------------------------------//
+bool validateCascadeCulling(uint32_t numMeshes)
+{
+  assert(numMeshes > 0);
+
+  Random rng;
+  rng.SetSeed(2468);
+
+  const uint64_t shadowMapSize = 2048;
+  const float epsilon = 1e-3f;
+  const uint32_t numScenes = 16;
+
+  bool valid = true;
+  uint64_t numCastersTotal[NumCascades] = {};
+  uint64_t numSkippedTotal[NumCascades] = {};
+  uint64_t numMeshesTotal = 0;
+
+  for (uint32_t scene = 0; scene < numScenes; ++scene)
+  {
+    // Pieces of a 400 unit wide level, mostly flat with a few tall ones, odd count so the scalar
+    // tail runs too
+    const uint32_t count = numMeshes | 3;
+    std::vector<glm::vec3> aabbMins(count);
+    std::vector<glm::vec3> aabbMaxs(count);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      const glm::vec2 xz = (rng.RandomFloat2() - 0.5f) * 400.0f;
+      const float size = rng.RandomFloat();
+      const float height = (i % 16 == 0) ? 40.0f * rng.RandomFloat() : 4.0f * size;
+      const glm::vec3 extent = glm::vec3(
+          0.5f + 4.0f * size * rng.RandomFloat(), height, 0.5f + 4.0f * size * rng.RandomFloat());
+      aabbMins[i] = glm::vec3(xz.x, 0.0f, xz.y) - glm::vec3(extent.x, 0.0f, extent.z);
+      aabbMaxs[i] = glm::vec3(xz.x, 0.0f, xz.y) + extent;
+    }
+    CullingBounds bounds;
+    bounds.init(aabbMins.data(), aabbMaxs.data(), count);
+
+    const glm::vec3 eye =
+        glm::vec3((rng.RandomFloat() - 0.5f) * 200.0f, 2.0f + rng.RandomFloat() * 20.0f,
+                  (rng.RandomFloat() - 0.5f) * 200.0f);
+    const glm::vec3 target =
+        glm::vec3((rng.RandomFloat() - 0.5f) * 200.0f, 0.0f, (rng.RandomFloat() - 0.5f) * 200.0f);
+    PerspectiveCamera camera;
+    camera.Initialize(16.0f / 9.0f, 1.0f, 0.1f, 200.0f, 1920.0f);
+    camera.SetLookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f));
+    const glm::vec3 forward = glm::normalize(target - eye);
+
+    // Sun anywhere in the upper hemisphere, some scenes with a low sun for long shadows
+    const glm::vec2 u = rng.RandomFloat2();
+    const float elevation = (scene & 1) ? 0.15f + 0.2f * u.x : 0.3f + 1.2f * u.x;
+    const glm::vec3 lightDir = glm::vec3(
+        std::cos(elevation) * std::cos(u.y * 2.0f * Pi),
+        std::sin(elevation),
+        std::cos(elevation) * std::sin(u.y * 2.0f * Pi));
+
+    SunShadowConstantsBase constants;
+    OrthographicCamera cascadeCameras[NumCascades];
+    prepareCascades(lightDir, shadowMapSize, (scene & 2) == 0, camera, constants, cascadeCameras);
+
+    std::vector<uint32_t> casters[NumCascades];
+    std::vector<uint32_t> reference[NumCascades];
+    SunShadowCullingStats stats;
+    SunShadowCullingStats referenceStats;
+    cullCascadeCasters(
+        bounds, lightDir, shadowMapSize, camera, constants, cascadeCameras, casters, stats);
+    cullCascadeCastersScalar(
+        bounds,
+        lightDir,
+        shadowMapSize,
+        camera,
+        constants,
+        cascadeCameras,
+        reference,
+        referenceStats);
+
+    for (uint64_t cascadeIdx = 0; cascadeIdx < NumCascades; ++cascadeIdx)
+    {
+      valid = valid && casters[cascadeIdx] == reference[cascadeIdx] &&
+              stats.NumCasters[cascadeIdx] == referenceStats.NumCasters[cascadeIdx] &&
+              stats.NumSkipped[cascadeIdx] == referenceStats.NumSkipped[cascadeIdx];
+      numCastersTotal[cascadeIdx] += stats.NumCasters[cascadeIdx];
+      numSkippedTotal[cascadeIdx] += stats.NumSkipped[cascadeIdx];
+    }
+    numMeshesTotal += count;
+
+    for (uint64_t cascadeIdx = 0; cascadeIdx < NumCascades; ++cascadeIdx)
+    {
+      const OrthographicCamera& cascade = cascadeCameras[cascadeIdx];
+      const Frustum frustum = FrustumCulling::extractFrustum(cascade.ViewProjectionMatrix());
+      const float cascadeDepth = cascade.FarClip() - cascade.NearClip();
+
+      for (uint32_t i = 0; i < count; ++i)
+      {
+        const glm::vec3 center = (aabbMins[i] + aabbMaxs[i]) * 0.5f;
+        const glm::vec3 extent = (aabbMaxs[i] - aabbMins[i]) * 0.5f;
+        const bool isCaster = containsIndex(casters[cascadeIdx], i);
+
+        // Culled boxes have all corners outside one of the side or far planes
+        bool outside = false;
+        for (uint32_t p = 0; p < 6; ++p)
+        {
+          if (p == 4)
+            continue;
+          bool allOutside = true;
+          for (uint32_t corner = 0; corner < 8; ++corner)
+          {
+            const glm::vec3 sign = glm::vec3(
+                (corner & 1) ? 1.0f : -1.0f,
+                (corner & 2) ? 1.0f : -1.0f,
+                (corner & 4) ? 1.0f : -1.0f);
+            const glm::vec4& plane = frustum.planes[p];
+            allOutside &= glm::dot(glm::vec3(plane), center + sign * extent) + plane.w < epsilon;
+          }
+          outside |= allOutside;
+        }
+
+        if (isCaster == false && outside == false)
+        {
+          // Skipped, so the shadow has to stay in front of the previous split
+          if (cascadeIdx == 0)
+          {
+            valid = false;
+            continue;
+          }
+          for (uint32_t sample = 0; sample < 64; ++sample)
+          {
+            const glm::vec3 offset = glm::vec3(rng.RandomFloat2(), rng.RandomFloat()) * 2.0f - 1.0f;
+            const glm::vec3 shadowPoint =
+                center + offset * extent - lightDir * (rng.RandomFloat() * cascadeDepth * 2.0f);
+
+            // Only the part of the shadow inside this cascade can land on its receivers
+            float minDistance = FLT_MAX;
+            for (const glm::vec4& plane : frustum.planes)
+            {
+              const float distance = glm::dot(glm::vec3(plane), shadowPoint) + plane.w;
+              minDistance = std::min(minDistance, distance);
+            }
+            const float depth = glm::dot(shadowPoint - eye, forward);
+            const float split = constants.CascadeSplits[cascadeIdx - 1];
+            valid = valid && (minDistance < 0.0f || depth < split);
+          }
+        }
+      }
+
+      // A caster far behind the cascade's near plane, towards the light, still shadows its center
+      const glm::vec3 cascadeCenter =
+          cascade.Position() - lightDir * ((cascade.NearClip() + cascade.FarClip()) * 0.5f);
+      const glm::vec3 occluder = cascadeCenter + lightDir * (cascadeDepth * 4.0f);
+      const glm::vec3 occluderMin = occluder - 0.5f;
+      const glm::vec3 occluderMax = occluder + 0.5f;
+      CullingBounds occluderBounds;
+      occluderBounds.init(&occluderMin, &occluderMax, 1);
+
+      std::vector<uint32_t> occluderCasters[NumCascades];
+      SunShadowCullingStats occluderStats;
+      cullCascadeCasters(
+          occluderBounds,
+          lightDir,
+          shadowMapSize,
+          camera,
+          constants,
+          cascadeCameras,
+          occluderCasters,
+          occluderStats);
+      valid = valid && occluderStats.NumCasters[cascadeIdx] == 1;
+    }
+  }
+
+  writeLog(
+      "ShadowHelper::validateCascadeCulling: %u scenes, %.1f%% / %.1f%% / %.1f%% / %.1f%% casters "
+      "per cascade, %.1f%% / %.1f%% / %.1f%% skipped in cascades 1-3, %s",
+      numScenes,
+      100.0 * numCastersTotal[0] / numMeshesTotal,
+      100.0 * numCastersTotal[1] / numMeshesTotal,
+      100.0 * numCastersTotal[2] / numMeshesTotal,
+      100.0 * numCastersTotal[3] / numMeshesTotal,
+      100.0 * numSkippedTotal[1] / numMeshesTotal,
+      100.0 * numSkippedTotal[2] / numMeshesTotal,
+      100.0 * numSkippedTotal[3] / numMeshesTotal,
+      valid ? "passed" : "FAILED");
+
+  return valid;
+}
+//---------------------------------------------------------------------------//
 } // namespace ShadowHelper
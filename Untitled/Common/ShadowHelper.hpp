@@ -2,6 +2,7 @@
 
 #include "Utility.hpp"
 #include "Camera.hpp"
+#include "FrustumCulling.hpp"
 
 const uint64_t NumCascades = 4;
 const float MaxShadowFilterSize = 9.0f;
@@ -14,6 +15,17 @@ struct SunShadowConstantsBase
   glm::vec4 CascadeScales[NumCascades] = {glm::vec4(), glm::vec4(), glm::vec4(), glm::vec4()};
 };
 
+// Result of ShadowHelper::cullCascadeCasters
+struct SunShadowCullingStats
+{
+  uint32_t NumMeshes = 0;
+  // Meshes drawn into each cascade
+  uint32_t NumCasters[NumCascades] = {};
+  // Meshes inside a cascade's volume that were left out since every receiver they can shadow
+  // samples a finer cascade
+  uint32_t NumSkipped[NumCascades] = {};
+};
+
 struct SunShadowConstantsDepthMap
 {
   SunShadowConstantsBase Base;
@@ -39,4 +51,37 @@ void prepareCascades(
     SunShadowConstantsBase& constants,
     OrthographicCamera* cascadeCameras);
 
+// Shadow caster culling for all the cascades in one pass over the bounds, casters[cascadeIdx]
+// receives the mesh indices to draw into that cascade.
+// Each cascade volume loses its near plane, the sun shadow PSO doesn't clip depth so casters
+// between the light and the cascade still land in the map. A caster is left out of a coarser
+// cascade when its whole shadow, swept along the light up to that cascade's far plane and grown
+// by the filter footprint, lies in front of the previous split, where receivers pick a finer
+// cascade by view depth.
+void cullCascadeCasters(
+    const CullingBounds& bounds,
+    const glm::vec3& lightDir,
+    uint64_t shadowMapSize,
+    const CameraBase& camera,
+    const SunShadowConstantsBase& constants,
+    const OrthographicCamera* cascadeCameras,
+    std::vector<uint32_t>* casters,
+    SunShadowCullingStats& stats);
+
+// Scalar reference of cullCascadeCasters, which uses SSE
+void cullCascadeCastersScalar(
+    const CullingBounds& bounds,
+    const glm::vec3& lightDir,
+    uint64_t shadowMapSize,
+    const CameraBase& camera,
+    const SunShadowConstantsBase& constants,
+    const OrthographicCamera* cascadeCameras,
+    std::vector<uint32_t>* casters,
+    SunShadowCullingStats& stats);
+
+// Headless check on synthetic scenes: SSE against the scalar reference, culled casters really
+// outside the extruded volumes, casters behind the near planes kept, and the shadows of skipped
+// casters in front of the previous split. Results go to the debug output.
+bool validateCascadeCulling(uint32_t numMeshes = 20000);
+
 } // namespace ShadowHelper
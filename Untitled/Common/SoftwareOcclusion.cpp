@@ -0,0 +1,1102 @@
+#include "SoftwareOcclusion.hpp"
+#include "Camera.hpp"
+#include "Model.hpp"
+#include "Sampling.hpp"
+#include "Timer.hpp"
+#include "WorkerPool.hpp"
+
+#include <immintrin.h>
+
+//---------------------------------------------------------------------------//
+// Internal
+//---------------------------------------------------------------------------//
+static constexpr uint32_t TilePixels =
+    SoftwareOcclusionBuffer::TileWidth * SoftwareOcclusionBuffer::TileHeight;
+
+// Triangles one setup job takes at least, fewer jobs than this would spend more on the bins
+static constexpr uint32_t MinTrianglesPerJob = 512;
+
+// Clip space planes of D3D: near (z >= 0), left, right, bottom and top
+static const glm::vec4 ClipPlanes[] = {
+    glm::vec4(0.0f, 0.0f, 1.0f, 0.0f),
+    glm::vec4(1.0f, 0.0f, 0.0f, 1.0f),
+    glm::vec4(-1.0f, 0.0f, 0.0f, 1.0f),
+    glm::vec4(0.0f, 1.0f, 0.0f, 1.0f),
+    glm::vec4(0.0f, -1.0f, 0.0f, 1.0f),
+};
+static constexpr uint32_t NumClipPlanes = arrayCount32(ClipPlanes);
+static constexpr uint32_t MaxClippedVertices = 3 + NumClipPlanes;
+
+// Sutherland-Hodgman against the planes the triangle crosses, returns the vertex count of the
+// convex polygon left in p_Vertices
+static uint32_t clipPolygon(glm::vec4* p_Vertices, uint32_t p_NumVertices, uint32_t p_PlaneMask)
+{
+  glm::vec4 clipped[MaxClippedVertices];
+  for (uint32_t plane = 0; plane < NumClipPlanes && p_NumVertices >= 3; ++plane)
+  {
+    if ((p_PlaneMask & (1u << plane)) == 0)
+      continue;
+
+    uint32_t numClipped = 0;
+    for (uint32_t i = 0; i < p_NumVertices; ++i)
+    {
+      const glm::vec4& a = p_Vertices[i];
+      const glm::vec4& b = p_Vertices[(i + 1) % p_NumVertices];
+      const float distanceA = glm::dot(ClipPlanes[plane], a);
+      const float distanceB = glm::dot(ClipPlanes[plane], b);
+      if (distanceA >= 0.0f)
+        clipped[numClipped++] = a;
+      if ((distanceA >= 0.0f) != (distanceB >= 0.0f))
+        clipped[numClipped++] = glm::mix(a, b, distanceA / (distanceA - distanceB));
+    }
+
+    p_NumVertices = numClipped;
+    for (uint32_t i = 0; i < numClipped; ++i)
+      p_Vertices[i] = clipped[i];
+  }
+  return p_NumVertices;
+}
+//---------------------------------------------------------------------------//
+// Horizontal maximum of the 4 lanes
+static float maxLanes(__m128 p_Value)
+{
+  p_Value = _mm_max_ps(p_Value, _mm_shuffle_ps(p_Value, p_Value, _MM_SHUFFLE(2, 3, 0, 1)));
+  p_Value = _mm_max_ps(p_Value, _mm_shuffle_ps(p_Value, p_Value, _MM_SHUFFLE(1, 0, 3, 2)));
+  return _mm_cvtss_f32(p_Value);
+}
+//---------------------------------------------------------------------------//
+// SoftwareOcclusionBuffer
+//---------------------------------------------------------------------------//
+void SoftwareOcclusionBuffer::init(uint32_t p_Width, uint32_t p_Height)
+{
+  assert(p_Width > 0 && p_Height > 0);
+
+  m_Width = p_Width;
+  m_Height = p_Height;
+  m_NumTilesX = (p_Width + TileWidth - 1) / TileWidth;
+  m_NumTilesY = (p_Height + TileHeight - 1) / TileHeight;
+  m_Depth.assign(uint64_t(m_NumTilesX) * m_NumTilesY * TilePixels, 1.0f);
+  m_TileMaxDepth.assign(uint64_t(m_NumTilesX) * m_NumTilesY, 1.0f);
+  m_Bins.clear();
+}
+//---------------------------------------------------------------------------//
+void SoftwareOcclusionBuffer::rasterize(
+    const glm::mat4& p_ViewProjection,
+    const OccluderMesh* const* p_Occluders,
+    uint32_t p_NumOccluders,
+    WorkerPool* p_Pool)
+{
+  assert(m_Width > 0);
+
+  Timer timer;
+  timer.init();
+  timer.update();
+
+  m_ViewProjection = p_ViewProjection;
+
+  std::vector<uint32_t> triangleOffsets(p_NumOccluders + 1, 0);
+  for (uint32_t i = 0; i < p_NumOccluders; ++i)
+    triangleOffsets[i + 1] = triangleOffsets[i] + p_Occluders[i]->numTriangles();
+  const uint32_t numTriangles = triangleOffsets[p_NumOccluders];
+
+  // Each job bins a contiguous range of triangles, the tiles walk the bins in job order
+  const uint32_t numThreads = p_Pool != nullptr ? p_Pool->numThreads() : 1;
+  const uint32_t numJobs = std::max(
+      std::min((numTriangles + MinTrianglesPerJob - 1) / MinTrianglesPerJob, numThreads * 4), 1u);
+  const uint32_t numTiles = m_NumTilesX * m_NumTilesY;
+  if (m_Bins.size() < numJobs)
+    m_Bins.resize(numJobs);
+  for (uint32_t job = 0; job < numJobs; ++job)
+  {
+    m_Bins[job].triangles.clear();
+    m_Bins[job].tiles.resize(numTiles);
+    for (std::vector<uint32_t>& tile : m_Bins[job].tiles)
+      tile.clear();
+  }
+
+  auto setupJob = [&](uint32_t p_Job)
+  {
+    const uint32_t first = uint32_t(uint64_t(numTriangles) * p_Job / numJobs);
+    const uint32_t last = uint32_t(uint64_t(numTriangles) * (p_Job + 1) / numJobs);
+    setupTriangles(
+        p_ViewProjection,
+        p_Occluders,
+        triangleOffsets.data(),
+        p_NumOccluders,
+        first,
+        last,
+        m_Bins[p_Job]);
+  };
+  auto rasterizeJob = [&](uint32_t p_Tile) { rasterizeTile(p_Tile, numJobs); };
+
+  if (p_Pool != nullptr)
+  {
+    p_Pool->parallelFor(numJobs, setupJob);
+    p_Pool->parallelFor(numTiles, rasterizeJob);
+  }
+  else
+  {
+    for (uint32_t job = 0; job < numJobs; ++job)
+      setupJob(job);
+    for (uint32_t tile = 0; tile < numTiles; ++tile)
+      rasterizeJob(tile);
+  }
+
+  timer.update();
+
+  m_Stats = SoftwareOcclusionStats();
+  m_Stats.NumOccluders = p_NumOccluders;
+  m_Stats.NumTriangles = numTriangles;
+  for (uint32_t job = 0; job < numJobs; ++job)
+    m_Stats.NumTrianglesRasterized += uint32_t(m_Bins[job].triangles.size());
+  m_Stats.RasterizeMilliseconds = timer.m_DeltaMillisecondsD;
+}
+//---------------------------------------------------------------------------//
+void SoftwareOcclusionBuffer::setupTriangles(
+    const glm::mat4& p_ViewProjection,
+    const OccluderMesh* const* p_Occluders,
+    const uint32_t* p_TriangleOffsets,
+    uint32_t p_NumOccluders,
+    uint32_t p_First,
+    uint32_t p_Last,
+    Bin& p_Bin) const
+{
+  if (p_First >= p_Last)
+    return;
+
+  uint32_t occluderIdx = uint32_t(
+      std::upper_bound(p_TriangleOffsets, p_TriangleOffsets + p_NumOccluders + 1, p_First) -
+      p_TriangleOffsets - 1);
+
+  const float halfWidth = 0.5f * m_Width;
+  const float halfHeight = 0.5f * m_Height;
+  for (uint32_t triangle = p_First; triangle < p_Last; ++triangle)
+  {
+    while (triangle >= p_TriangleOffsets[occluderIdx + 1])
+      ++occluderIdx;
+
+    const OccluderMesh& occluder = *p_Occluders[occluderIdx];
+    const uint32_t* indices =
+        &occluder.indices[uint64_t(triangle - p_TriangleOffsets[occluderIdx]) * 3];
+
+    glm::vec4 vertices[MaxClippedVertices];
+    uint32_t outsideAll = (1u << NumClipPlanes) - 1;
+    uint32_t outsideAny = 0;
+    for (uint32_t i = 0; i < 3; ++i)
+    {
+      vertices[i] = glm::vec4(occluder.positions[indices[i]], 1.0f) * p_ViewProjection;
+
+      uint32_t outside = 0;
+      for (uint32_t plane = 0; plane < NumClipPlanes; ++plane)
+        outside |= glm::dot(ClipPlanes[plane], vertices[i]) < 0.0f ? 1u << plane : 0u;
+      outsideAll &= outside;
+      outsideAny |= outside;
+    }
+
+    // Fully outside one plane
+    if (outsideAll != 0)
+      continue;
+
+    const uint32_t numVertices = outsideAny != 0 ? clipPolygon(vertices, 3, outsideAny) : 3;
+    if (numVertices < 3)
+      continue;
+
+    glm::vec3 screen[MaxClippedVertices];
+    for (uint32_t i = 0; i < numVertices; ++i)
+    {
+      const float invW = 1.0f / vertices[i].w;
+      screen[i].x = (vertices[i].x * invW + 1.0f) * halfWidth;
+      screen[i].y = (1.0f - vertices[i].y * invW) * halfHeight;
+      screen[i].z = vertices[i].z * invW;
+    }
+
+    // Fan of the clipped polygon
+    for (uint32_t i = 2; i < numVertices; ++i)
+    {
+      const glm::vec3 fan[3] = {screen[0], screen[i - 1], screen[i]};
+      addTriangle(fan, p_Bin);
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+void SoftwareOcclusionBuffer::addTriangle(const glm::vec3 p_Vertices[3], Bin& p_Bin) const
+{
+  const glm::vec3& v0 = p_Vertices[0];
+  const glm::vec3& v1 = p_Vertices[1];
+  const glm::vec3& v2 = p_Vertices[2];
+
+  // Whole pixels inside the bounds, a pixel [x, x + 1) can only be fully inside from there
+  const float minX = std::min(std::min(v0.x, v1.x), v2.x);
+  const float maxX = std::max(std::max(v0.x, v1.x), v2.x);
+  const float minY = std::min(std::min(v0.y, v1.y), v2.y);
+  const float maxY = std::max(std::max(v0.y, v1.y), v2.y);
+
+  Triangle triangle;
+  triangle.minX = std::max(int32_t(std::ceil(minX)), 0);
+  triangle.minY = std::max(int32_t(std::ceil(minY)), 0);
+  triangle.maxX = std::min(int32_t(std::floor(maxX)) - 1, int32_t(m_Width) - 1);
+  triangle.maxY = std::min(int32_t(std::floor(maxY)) - 1, int32_t(m_Height) - 1);
+  if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+    return;
+
+  // Both facings are rasterized, the edges are flipped to be positive inside
+  const float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+  if (std::abs(area) < 1e-6f)
+    return;
+  const float sign = area > 0.0f ? 1.0f : -1.0f;
+
+  for (uint32_t i = 0; i < 3; ++i)
+  {
+    const glm::vec3& a = p_Vertices[i];
+    const glm::vec3& b = p_Vertices[(i + 1) % 3];
+    const float edgeA = (a.y - b.y) * sign;
+    const float edgeB = (b.x - a.x) * sign;
+    const float edgeC = (a.x * b.y - b.x * a.y) * sign;
+
+    // Evaluated at pixel centers, the whole pixel is inside when the center is half a pixel's
+    // extent along the edge normal inside
+    triangle.edgeA[i] = edgeA;
+    triangle.edgeB[i] = edgeB;
+    triangle.edgeC[i] = edgeC - 0.5f * (std::abs(edgeA) + std::abs(edgeB));
+  }
+
+  // Depth is affine in screen space, the farthest depth over a pixel is half a pixel's slope
+  // behind its center
+  const float invArea = 1.0f / area;
+  const float depthA = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) * invArea;
+  const float depthB = ((v1.x - v0.x) * (v2.z - v0.z) - (v2.x - v0.x) * (v1.z - v0.z)) * invArea;
+  triangle.depthA = depthA;
+  triangle.depthB = depthB;
+  triangle.depthC =
+      v0.z - depthA * v0.x - depthB * v0.y + 0.5f * (std::abs(depthA) + std::abs(depthB));
+
+  const uint32_t triangleIdx = uint32_t(p_Bin.triangles.size());
+  p_Bin.triangles.push_back(triangle);
+
+  const uint32_t firstTileX = uint32_t(triangle.minX) / TileWidth;
+  const uint32_t lastTileX = uint32_t(triangle.maxX) / TileWidth;
+  const uint32_t firstTileY = uint32_t(triangle.minY) / TileHeight;
+  const uint32_t lastTileY = uint32_t(triangle.maxY) / TileHeight;
+  for (uint32_t tileY = firstTileY; tileY <= lastTileY; ++tileY)
+  {
+    for (uint32_t tileX = firstTileX; tileX <= lastTileX; ++tileX)
+      p_Bin.tiles[tileY * m_NumTilesX + tileX].push_back(triangleIdx);
+  }
+}
+//---------------------------------------------------------------------------//
+void SoftwareOcclusionBuffer::rasterizeTile(uint32_t p_Tile, uint32_t p_NumBins)
+{
+  const int32_t tileX = int32_t(p_Tile % m_NumTilesX * TileWidth);
+  const int32_t tileY = int32_t(p_Tile / m_NumTilesX * TileHeight);
+  float* depth = &m_Depth[uint64_t(p_Tile) * TilePixels];
+
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 zero = _mm_setzero_ps();
+  for (uint32_t i = 0; i < TilePixels; i += 4)
+    _mm_storeu_ps(depth + i, one);
+
+  const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+  for (uint32_t bin = 0; bin < p_NumBins; ++bin)
+  {
+    const Bin& triangleBin = m_Bins[bin];
+    for (uint32_t triangleIdx : triangleBin.tiles[p_Tile])
+    {
+      const Triangle& triangle = triangleBin.triangles[triangleIdx];
+      const int32_t minX = std::max(triangle.minX, tileX) - tileX;
+      const int32_t maxX = std::min(triangle.maxX, tileX + int32_t(TileWidth) - 1) - tileX;
+      const int32_t minY = std::max(triangle.minY, tileY) - tileY;
+      const int32_t maxY = std::min(triangle.maxY, tileY + int32_t(TileHeight) - 1) - tileY;
+
+      const __m128 edgeA0 = _mm_set1_ps(triangle.edgeA[0]);
+      const __m128 edgeA1 = _mm_set1_ps(triangle.edgeA[1]);
+      const __m128 edgeA2 = _mm_set1_ps(triangle.edgeA[2]);
+      const __m128 depthA = _mm_set1_ps(triangle.depthA);
+
+      for (int32_t y = minY; y <= maxY; ++y)
+      {
+        const float pixelY = float(tileY + y) + 0.5f;
+        const __m128 row0 = _mm_set1_ps(triangle.edgeB[0] * pixelY + triangle.edgeC[0]);
+        const __m128 row1 = _mm_set1_ps(triangle.edgeB[1] * pixelY + triangle.edgeC[1]);
+        const __m128 row2 = _mm_set1_ps(triangle.edgeB[2] * pixelY + triangle.edgeC[2]);
+        const __m128 rowDepth = _mm_set1_ps(triangle.depthB * pixelY + triangle.depthC);
+
+        float* rowDepths = depth + y * TileWidth;
+        for (int32_t x = minX & ~3; x <= maxX; x += 4)
+        {
+          const __m128 pixelX = _mm_add_ps(_mm_set1_ps(float(tileX + x)), laneOffsets);
+          const __m128 edge0 = _mm_add_ps(_mm_mul_ps(edgeA0, pixelX), row0);
+          const __m128 edge1 = _mm_add_ps(_mm_mul_ps(edgeA1, pixelX), row1);
+          const __m128 edge2 = _mm_add_ps(_mm_mul_ps(edgeA2, pixelX), row2);
+          const __m128 inside = _mm_and_ps(
+              _mm_and_ps(_mm_cmpge_ps(edge0, zero), _mm_cmpge_ps(edge1, zero)),
+              _mm_cmpge_ps(edge2, zero));
+          if (_mm_movemask_ps(inside) == 0)
+            continue;
+
+          const __m128 triangleDepth =
+              _mm_min_ps(_mm_add_ps(_mm_mul_ps(depthA, pixelX), rowDepth), one);
+          const __m128 current = _mm_loadu_ps(rowDepths + x);
+          const __m128 nearest = _mm_min_ps(current, triangleDepth);
+          _mm_storeu_ps(
+              rowDepths + x,
+              _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+        }
+      }
+    }
+  }
+
+  // Only the pixels inside the viewport count, the rest of edge tiles stays at the far plane
+  const uint32_t width = std::min(uint32_t(m_Width - tileX), TileWidth);
+  const uint32_t height = std::min(uint32_t(m_Height - tileY), TileHeight);
+  float maxDepth = 0.0f;
+  if (width == TileWidth)
+  {
+    __m128 maxDepths = zero;
+    for (uint32_t i = 0; i < height * TileWidth; i += 4)
+      maxDepths = _mm_max_ps(maxDepths, _mm_loadu_ps(depth + i));
+    maxDepth = maxLanes(maxDepths);
+  }
+  else
+  {
+    for (uint32_t y = 0; y < height; ++y)
+    {
+      for (uint32_t x = 0; x < width; ++x)
+        maxDepth = std::max(maxDepth, depth[y * TileWidth + x]);
+    }
+  }
+  m_TileMaxDepth[p_Tile] = maxDepth;
+}
+//---------------------------------------------------------------------------//
+float SoftwareOcclusionBuffer::depth(uint32_t p_X, uint32_t p_Y) const
+{
+  assert(p_X < m_Width && p_Y < m_Height);
+  const uint32_t tile = (p_Y / TileHeight) * m_NumTilesX + p_X / TileWidth;
+  return m_Depth[uint64_t(tile) * TilePixels + (p_Y % TileHeight) * TileWidth + p_X % TileWidth];
+}
+//---------------------------------------------------------------------------//
+bool SoftwareOcclusionBuffer::isBoxOccluded(const glm::vec3& p_Min, const glm::vec3& p_Max) const
+{
+  float minX = FLT_MAX;
+  float maxX = -FLT_MAX;
+  float minY = FLT_MAX;
+  float maxY = -FLT_MAX;
+  float nearestDepth = FLT_MAX;
+  for (uint32_t corner = 0; corner < 8; ++corner)
+  {
+    const glm::vec3 position = glm::vec3(
+        (corner & 1) ? p_Max.x : p_Min.x,
+        (corner & 2) ? p_Max.y : p_Min.y,
+        (corner & 4) ? p_Max.z : p_Min.z);
+    const glm::vec4 clip = glm::vec4(position, 1.0f) * m_ViewProjection;
+    if (clip.z < 0.0f || clip.w <= 0.0f)
+      return false;
+
+    const float invW = 1.0f / clip.w;
+    const float x = (clip.x * invW + 1.0f) * 0.5f * m_Width;
+    const float y = (1.0f - clip.y * invW) * 0.5f * m_Height;
+    minX = std::min(minX, x);
+    maxX = std::max(maxX, x);
+    minY = std::min(minY, y);
+    maxY = std::max(maxY, y);
+    nearestDepth = std::min(nearestDepth, clip.z * invW);
+  }
+
+  // Every pixel the rectangle touches, the part off screen can't be seen anyway
+  const int32_t firstX = std::max(int32_t(std::floor(minX)), 0);
+  const int32_t firstY = std::max(int32_t(std::floor(minY)), 0);
+  const int32_t lastX = std::min(int32_t(std::ceil(maxX)) - 1, int32_t(m_Width) - 1);
+  const int32_t lastY = std::min(int32_t(std::ceil(maxY)) - 1, int32_t(m_Height) - 1);
+  if (firstX > lastX || firstY > lastY)
+    return false;
+
+  const __m128 nearest = _mm_set1_ps(nearestDepth);
+  const __m128i laneIndices = _mm_setr_epi32(0, 1, 2, 3);
+  for (uint32_t tileY = uint32_t(firstY) / TileHeight; tileY <= uint32_t(lastY) / TileHeight;
+       ++tileY)
+  {
+    for (uint32_t tileX = uint32_t(firstX) / TileWidth; tileX <= uint32_t(lastX) / TileWidth;
+         ++tileX)
+    {
+      const uint32_t tile = tileY * m_NumTilesX + tileX;
+      if (nearestDepth > m_TileMaxDepth[tile])
+        continue;
+
+      // Some of the tile is farther, look at the pixels the rectangle covers
+      const int32_t originX = int32_t(tileX * TileWidth);
+      const int32_t originY = int32_t(tileY * TileHeight);
+      const int32_t x0 = std::max(firstX, originX) - originX;
+      const int32_t x1 = std::min(lastX, originX + int32_t(TileWidth) - 1) - originX;
+      const int32_t y0 = std::max(firstY, originY) - originY;
+      const int32_t y1 = std::min(lastY, originY + int32_t(TileHeight) - 1) - originY;
+      const float* depth = &m_Depth[uint64_t(tile) * TilePixels];
+      for (int32_t y = y0; y <= y1; ++y)
+      {
+        for (int32_t x = x0 & ~3; x <= x1; x += 4)
+        {
+          const __m128i lanes = _mm_add_epi32(laneIndices, _mm_set1_epi32(x));
+          const __m128i inRange = _mm_andnot_si128(
+              _mm_cmplt_epi32(lanes, _mm_set1_epi32(x0)),
+              _mm_cmplt_epi32(lanes, _mm_set1_epi32(x1 + 1)));
+          const __m128 visible =
+              _mm_cmpge_ps(_mm_loadu_ps(depth + y * TileWidth + x), nearest);
+          if (_mm_movemask_ps(_mm_and_ps(visible, _mm_castsi128_ps(inRange))) != 0)
+            return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+//---------------------------------------------------------------------------//
+uint32_t SoftwareOcclusionBuffer::cullBoxes(
+    const CullingBounds& p_Bounds, uint32_t* p_Indices, uint32_t p_Count, WorkerPool* p_Pool)
+{
+  Timer timer;
+  timer.init();
+  timer.update();
+
+  m_Occluded.resize(p_Count);
+  auto testBox = [&](uint32_t p_Idx)
+  {
+    const uint32_t boxIdx = p_Indices[p_Idx];
+    const glm::vec3 center =
+        glm::vec3(p_Bounds.centerX[boxIdx], p_Bounds.centerY[boxIdx], p_Bounds.centerZ[boxIdx]);
+    const glm::vec3 extent =
+        glm::vec3(p_Bounds.extentX[boxIdx], p_Bounds.extentY[boxIdx], p_Bounds.extentZ[boxIdx]);
+    m_Occluded[p_Idx] = isBoxOccluded(center - extent, center + extent) ? 1 : 0;
+  };
+  if (p_Pool != nullptr)
+    p_Pool->parallelFor(p_Count, testBox, 64);
+  else
+  {
+    for (uint32_t i = 0; i < p_Count; ++i)
+      testBox(i);
+  }
+
+  uint32_t numVisible = 0;
+  for (uint32_t i = 0; i < p_Count; ++i)
+  {
+    if (m_Occluded[i] == 0)
+      p_Indices[numVisible++] = p_Indices[i];
+  }
+
+  timer.update();
+
+  m_Stats.NumTested = p_Count;
+  m_Stats.NumOccluded = p_Count - numVisible;
+  m_Stats.TestMilliseconds = timer.m_DeltaMillisecondsD;
+  return numVisible;
+}
+//---------------------------------------------------------------------------//
+namespace SoftwareOcclusion
+{
+
+//---------------------------------------------------------------------------//
+// Public API
+//---------------------------------------------------------------------------//
+void makeOccluder(const Mesh& p_Mesh, OccluderMesh& p_Occluder)
+{
+  p_Occluder.positions.resize(p_Mesh.NumVertices());
+  for (uint32_t i = 0; i < p_Mesh.NumVertices(); ++i)
+    p_Occluder.positions[i] = p_Mesh.Vertices()[i].Position;
+
+  p_Occluder.indices.clear();
+  for (const MeshPart& part : p_Mesh.MeshParts())
+  {
+    for (uint32_t i = 0; i < part.IndexCount; ++i)
+      p_Occluder.indices.push_back(p_Mesh.Index(part.IndexStart + i));
+  }
+}
+//---------------------------------------------------------------------------//
+float screenArea(const glm::mat4& p_ViewProjection, const glm::vec3& p_Min, const glm::vec3& p_Max)
+{
+  glm::vec2 minNdc = glm::vec2(FLT_MAX);
+  glm::vec2 maxNdc = glm::vec2(-FLT_MAX);
+  for (uint32_t corner = 0; corner < 8; ++corner)
+  {
+    const glm::vec3 position = glm::vec3(
+        (corner & 1) ? p_Max.x : p_Min.x,
+        (corner & 2) ? p_Max.y : p_Min.y,
+        (corner & 4) ? p_Max.z : p_Min.z);
+    const glm::vec4 clip = glm::vec4(position, 1.0f) * p_ViewProjection;
+    if (clip.z < 0.0f || clip.w <= 0.0f)
+      return 1.0f;
+
+    const glm::vec2 ndc = glm::vec2(clip) / clip.w;
+    minNdc = glm::min(minNdc, ndc);
+    maxNdc = glm::max(maxNdc, ndc);
+  }
+
+  minNdc = glm::clamp(minNdc, -1.0f, 1.0f);
+  maxNdc = glm::clamp(maxNdc, -1.0f, 1.0f);
+  return (maxNdc.x - minNdc.x) * (maxNdc.y - minNdc.y) * 0.25f;
+}
+//---------------------------------------------------------------------------//
+void selectOccluders(
+    const CullingBounds& p_Bounds,
+    const uint32_t* p_Candidates,
+    uint32_t p_NumCandidates,
+    const glm::mat4& p_ViewProjection,
+    uint32_t p_MaxOccluders,
+    float p_MinScreenArea,
+    std::vector<uint32_t>& p_Occluders)
+{
+  std::vector<std::pair<float, uint32_t>> areas;
+  areas.reserve(p_NumCandidates);
+  for (uint32_t i = 0; i < p_NumCandidates; ++i)
+  {
+    const uint32_t idx = p_Candidates[i];
+    const glm::vec3 center =
+        glm::vec3(p_Bounds.centerX[idx], p_Bounds.centerY[idx], p_Bounds.centerZ[idx]);
+    const glm::vec3 extent =
+        glm::vec3(p_Bounds.extentX[idx], p_Bounds.extentY[idx], p_Bounds.extentZ[idx]);
+    const float area = screenArea(p_ViewProjection, center - extent, center + extent);
+    if (area >= p_MinScreenArea)
+      areas.push_back({area, idx});
+  }
+
+  // Largest first, ties by index so the pick is stable from frame to frame
+  const uint32_t numOccluders = std::min(uint32_t(areas.size()), p_MaxOccluders);
+  std::partial_sort(
+      areas.begin(),
+      areas.begin() + numOccluders,
+      areas.end(),
+      [](const std::pair<float, uint32_t>& p_A, const std::pair<float, uint32_t>& p_B)
+      { return p_A.first != p_B.first ? p_A.first > p_B.first : p_A.second < p_B.second; });
+
+  p_Occluders.resize(numOccluders);
+  for (uint32_t i = 0; i < numOccluders; ++i)
+    p_Occluders[i] = areas[i].second;
+}
+//---------------------------------------------------------------------------//
+// Validation and benchmark
+//---------------------------------------------------------------------------//
+static void addQuad(
+    const glm::vec3& p_Corner,
+    const glm::vec3& p_Edge0,
+    const glm::vec3& p_Edge1,
+    OccluderMesh& p_Mesh)
+{
+  const uint32_t first = uint32_t(p_Mesh.positions.size());
+  p_Mesh.positions.push_back(p_Corner);
+  p_Mesh.positions.push_back(p_Corner + p_Edge0);
+  p_Mesh.positions.push_back(p_Corner + p_Edge0 + p_Edge1);
+  p_Mesh.positions.push_back(p_Corner + p_Edge1);
+  const uint32_t indices[] = {0, 1, 2, 0, 2, 3};
+  for (uint32_t index : indices)
+    p_Mesh.indices.push_back(first + index);
+}
+//---------------------------------------------------------------------------//
+// Box with every face split into p_Split x p_Split quads, like a building's walls
+static void addBox(
+    const glm::vec3& p_Min, const glm::vec3& p_Max, uint32_t p_Split, OccluderMesh& p_Mesh)
+{
+  const glm::vec3 size = p_Max - p_Min;
+  for (uint32_t axis = 0; axis < 3; ++axis)
+  {
+    const uint32_t axis0 = (axis + 1) % 3;
+    const uint32_t axis1 = (axis + 2) % 3;
+    glm::vec3 edge0 = glm::vec3(0.0f);
+    glm::vec3 edge1 = glm::vec3(0.0f);
+    edge0[axis0] = size[axis0] / p_Split;
+    edge1[axis1] = size[axis1] / p_Split;
+    for (uint32_t side = 0; side < 2; ++side)
+    {
+      for (uint32_t i = 0; i < p_Split; ++i)
+      {
+        for (uint32_t j = 0; j < p_Split; ++j)
+        {
+          glm::vec3 corner = p_Min + edge0 * float(i) + edge1 * float(j);
+          corner[axis] = side == 0 ? p_Min[axis] : p_Max[axis];
+          addQuad(corner, edge0, edge1, p_Mesh);
+        }
+      }
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+static glm::vec3 randomVec3(Random& p_Rng)
+{
+  return glm::vec3(p_Rng.RandomFloat2(), p_Rng.RandomFloat());
+}
+//---------------------------------------------------------------------------//
+static bool rayTriangle(
+    const glm::vec3& p_Origin,
+    const glm::vec3& p_Direction,
+    const glm::vec3& p_V0,
+    const glm::vec3& p_V1,
+    const glm::vec3& p_V2,
+    float& p_Distance)
+{
+  const glm::vec3 edge0 = p_V1 - p_V0;
+  const glm::vec3 edge1 = p_V2 - p_V0;
+  const glm::vec3 p = glm::cross(p_Direction, edge1);
+  const float determinant = glm::dot(edge0, p);
+  if (std::abs(determinant) < 1e-12f)
+    return false;
+
+  const float invDeterminant = 1.0f / determinant;
+  const glm::vec3 t = p_Origin - p_V0;
+  const float u = glm::dot(t, p) * invDeterminant;
+  if (u < 0.0f || u > 1.0f)
+    return false;
+  const glm::vec3 q = glm::cross(t, edge0);
+  const float v = glm::dot(p_Direction, q) * invDeterminant;
+  if (v < 0.0f || u + v > 1.0f)
+    return false;
+
+  p_Distance = glm::dot(edge1, q) * invDeterminant;
+  return p_Distance > 0.0f;
+}
+//---------------------------------------------------------------------------//
+static bool rayBox(
+    const glm::vec3& p_Origin,
+    const glm::vec3& p_Direction,
+    const glm::vec3& p_Min,
+    const glm::vec3& p_Max,
+    float& p_Distance)
+{
+  float nearDistance = 0.0f;
+  float farDistance = FLT_MAX;
+  for (uint32_t axis = 0; axis < 3; ++axis)
+  {
+    const float invDirection = 1.0f / p_Direction[axis];
+    float t0 = (p_Min[axis] - p_Origin[axis]) * invDirection;
+    float t1 = (p_Max[axis] - p_Origin[axis]) * invDirection;
+    if (t0 > t1)
+      std::swap(t0, t1);
+    nearDistance = std::max(nearDistance, t0);
+    farDistance = std::min(farDistance, t1);
+  }
+  p_Distance = nearDistance;
+  return nearDistance <= farDistance;
+}
+//---------------------------------------------------------------------------//
+// Nearest occluder hit along the ray, FLT_MAX on a miss
+static float raycastOccluders(
+    const glm::vec3& p_Origin, const glm::vec3& p_Direction, const OccluderMesh& p_Mesh)
+{
+  float nearest = FLT_MAX;
+  for (uint64_t i = 0; i < p_Mesh.indices.size(); i += 3)
+  {
+    float distance;
+    if (rayTriangle(
+            p_Origin,
+            p_Direction,
+            p_Mesh.positions[p_Mesh.indices[i]],
+            p_Mesh.positions[p_Mesh.indices[i + 1]],
+            p_Mesh.positions[p_Mesh.indices[i + 2]],
+            distance))
+      nearest = std::min(nearest, distance);
+  }
+  return nearest;
+}
+//---------------------------------------------------------------------------//
+// Random walls facing roughly towards the camera and random boxes, some behind the walls
+struct ValidationScene
+{
+  PerspectiveCamera camera;
+  OccluderMesh occluders;
+  std::vector<glm::vec3> boxMins;
+  std::vector<glm::vec3> boxMaxs;
+};
+static void makeValidationScene(
+    Random& p_Rng,
+    uint32_t p_Width,
+    uint32_t p_Height,
+    uint32_t p_NumBoxes,
+    ValidationScene& p_Scene)
+{
+  p_Scene.camera.Initialize(
+      float(p_Width) / p_Height, glm::radians(70.0f), 0.1f, 200.0f, float(p_Width));
+  const glm::vec3 eye = (randomVec3(p_Rng) - 0.5f) * 20.0f;
+  const glm::vec3 forward = glm::normalize(randomVec3(p_Rng) - 0.5f);
+  p_Scene.camera.SetLookAt(eye, eye + forward, glm::vec3(0.0f, 1.0f, 0.0f));
+
+  const glm::vec3 right = glm::normalize(glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), forward));
+  const glm::vec3 up = glm::cross(forward, right);
+
+  // Walls between 5 and 25 units away, a few cross the near plane or the screen edges
+  p_Scene.occluders = OccluderMesh();
+  for (uint32_t i = 0; i < 24; ++i)
+  {
+    const float distance = i < 2 ? 0.05f : 5.0f + p_Rng.RandomFloat() * 20.0f;
+    const glm::vec3 center = eye + forward * distance +
+                             right * (p_Rng.RandomFloat() - 0.5f) * 30.0f +
+                             up * (p_Rng.RandomFloat() - 0.5f) * 20.0f;
+    const glm::vec3 tilt = (randomVec3(p_Rng) - 0.5f) * 0.8f;
+    const glm::vec3 edge0 = glm::normalize(right + tilt) * (2.0f + p_Rng.RandomFloat() * 10.0f);
+    const glm::vec3 edge1 = glm::normalize(up - tilt) * (2.0f + p_Rng.RandomFloat() * 8.0f);
+    addQuad(center - (edge0 + edge1) * 0.5f, edge0, edge1, p_Scene.occluders);
+  }
+
+  p_Scene.boxMins.resize(p_NumBoxes);
+  p_Scene.boxMaxs.resize(p_NumBoxes);
+  for (uint32_t i = 0; i < p_NumBoxes; ++i)
+  {
+    const float distance = 1.0f + p_Rng.RandomFloat() * 60.0f;
+    const glm::vec3 center = eye + forward * distance +
+                             right * (p_Rng.RandomFloat() - 0.5f) * distance * 1.4f +
+                             up * (p_Rng.RandomFloat() - 0.5f) * distance;
+    const glm::vec3 extent = (randomVec3(p_Rng) + 0.05f) * 1.5f;
+    p_Scene.boxMins[i] = center - extent;
+    p_Scene.boxMaxs[i] = center + extent;
+  }
+}
+//---------------------------------------------------------------------------//
+// World space ray through a point of the viewport
+static void pixelRay(
+    const glm::mat4& p_InverseViewProjection,
+    uint32_t p_Width,
+    uint32_t p_Height,
+    float p_X,
+    float p_Y,
+    glm::vec3& p_Origin,
+    glm::vec3& p_Direction)
+{
+  const glm::vec2 ndc = glm::vec2(p_X / p_Width * 2.0f - 1.0f, 1.0f - p_Y / p_Height * 2.0f);
+  const glm::vec4 nearPoint = glm::vec4(ndc, 0.0f, 1.0f) * p_InverseViewProjection;
+  const glm::vec4 farPoint = glm::vec4(ndc, 1.0f, 1.0f) * p_InverseViewProjection;
+  p_Origin = glm::vec3(nearPoint) / nearPoint.w;
+  p_Direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - p_Origin);
+}
+//---------------------------------------------------------------------------//
+static float deviceDepth(const glm::mat4& p_ViewProjection, const glm::vec3& p_Position)
+{
+  const glm::vec4 clip = glm::vec4(p_Position, 1.0f) * p_ViewProjection;
+  return clip.z / clip.w;
+}
+//---------------------------------------------------------------------------//
+bool validate(uint32_t p_NumBoxes)
+{
+  Random rng;
+  rng.SetSeed(2468);
+
+  WorkerPool& pool = getWorkerPool();
+
+  // Ray samples per pixel axis, the pixel corners included
+  const uint32_t numSamples = 3;
+  const float sampleInset = 1e-3f;
+
+  uint32_t numScenes = 0;
+  uint32_t numCoveredPixels = 0;
+  uint32_t numFullyHitPixels = 0;
+  uint32_t numDepthErrors = 0;
+  uint32_t numThreadMismatches = 0;
+  uint32_t numHidden = 0;
+  uint32_t numCulled = 0;
+  uint32_t numFalseCulls = 0;
+
+  const glm::uvec2 sizes[] = {glm::uvec2(160, 90), glm::uvec2(203, 77), glm::uvec2(64, 64)};
+  for (const glm::uvec2& size : sizes)
+  {
+    for (uint32_t sceneIdx = 0; sceneIdx < 4; ++sceneIdx, ++numScenes)
+    {
+      ValidationScene scene;
+      makeValidationScene(rng, size.x, size.y, p_NumBoxes / 12, scene);
+      const glm::mat4& viewProjection = scene.camera.ViewProjectionMatrix();
+      const glm::mat4 inverseViewProjection = glm::inverse(viewProjection);
+
+      SoftwareOcclusionBuffer serial;
+      serial.init(size.x, size.y);
+      const OccluderMesh* occluders[] = {&scene.occluders};
+      serial.rasterize(viewProjection, occluders, 1, nullptr);
+
+      // Split in one occluder per wall so the threaded path gets several jobs and bins
+      std::vector<OccluderMesh> walls(scene.occluders.numTriangles() / 2);
+      std::vector<const OccluderMesh*> wallPointers(walls.size());
+      for (uint64_t i = 0; i < walls.size(); ++i)
+      {
+        walls[i].positions = scene.occluders.positions;
+        walls[i].indices.assign(
+            scene.occluders.indices.begin() + i * 6, scene.occluders.indices.begin() + i * 6 + 6);
+        wallPointers[i] = &walls[i];
+      }
+      SoftwareOcclusionBuffer threaded;
+      threaded.init(size.x, size.y);
+      threaded.rasterize(viewProjection, wallPointers.data(), uint32_t(walls.size()), &pool);
+
+      // A pixel holding a depth has to be covered everywhere, and nowhere nearer than that
+      for (uint32_t y = 0; y < size.y; ++y)
+      {
+        for (uint32_t x = 0; x < size.x; ++x)
+        {
+          const float depth = serial.depth(x, y);
+          numThreadMismatches += depth != threaded.depth(x, y) ? 1 : 0;
+
+          float farthestHit = 0.0f;
+          bool allHit = true;
+          for (uint32_t sample = 0; sample < numSamples * numSamples; ++sample)
+          {
+            const float u = float(sample % numSamples) / (numSamples - 1);
+            const float v = float(sample / numSamples) / (numSamples - 1);
+            glm::vec3 origin;
+            glm::vec3 direction;
+            pixelRay(
+                inverseViewProjection,
+                size.x,
+                size.y,
+                x + sampleInset + u * (1.0f - 2.0f * sampleInset),
+                y + sampleInset + v * (1.0f - 2.0f * sampleInset),
+                origin,
+                direction);
+            const float distance = raycastOccluders(origin, direction, scene.occluders);
+            if (distance == FLT_MAX)
+            {
+              allHit = false;
+              break;
+            }
+            farthestHit = std::max(
+                farthestHit, deviceDepth(viewProjection, origin + direction * distance));
+          }
+
+          numFullyHitPixels += allHit ? 1 : 0;
+          if (depth < 1.0f)
+          {
+            ++numCoveredPixels;
+            numDepthErrors += !allHit || farthestHit > depth + 1e-5f ? 1 : 0;
+          }
+        }
+      }
+
+      // Occluded boxes have to be hidden behind the walls for every ray that reaches them
+      std::vector<uint32_t> indices(scene.boxMins.size());
+      for (uint32_t i = 0; i < indices.size(); ++i)
+        indices[i] = i;
+      CullingBounds bounds;
+      bounds.init(scene.boxMins.data(), scene.boxMaxs.data(), uint32_t(indices.size()));
+      const uint32_t numVisible =
+          threaded.cullBoxes(bounds, indices.data(), uint32_t(indices.size()), &pool);
+      std::vector<uint8_t> visible(indices.size(), 0);
+      for (uint32_t i = 0; i < numVisible; ++i)
+        visible[indices[i]] = 1;
+
+      for (uint32_t box = 0; box < visible.size(); ++box)
+      {
+        const glm::vec3& boxMin = scene.boxMins[box];
+        const glm::vec3& boxMax = scene.boxMaxs[box];
+        const bool occluded = visible[box] == 0;
+        numThreadMismatches += occluded != serial.isBoxOccluded(boxMin, boxMax) ? 1 : 0;
+
+        // Rays through the pixels of the box's rectangle, on the full pixel grid
+        glm::vec2 minPixel = glm::vec2(FLT_MAX);
+        glm::vec2 maxPixel = glm::vec2(-FLT_MAX);
+        bool crossesNear = false;
+        for (uint32_t corner = 0; corner < 8; ++corner)
+        {
+          const glm::vec3 position = glm::vec3(
+              (corner & 1) ? boxMax.x : boxMin.x,
+              (corner & 2) ? boxMax.y : boxMin.y,
+              (corner & 4) ? boxMax.z : boxMin.z);
+          const glm::vec4 clip = glm::vec4(position, 1.0f) * viewProjection;
+          crossesNear = crossesNear || clip.z < 0.0f;
+          const glm::vec2 pixel = glm::vec2(
+              (clip.x / clip.w + 1.0f) * 0.5f * size.x, (1.0f - clip.y / clip.w) * 0.5f * size.y);
+          minPixel = glm::min(minPixel, pixel);
+          maxPixel = glm::max(maxPixel, pixel);
+        }
+        if (crossesNear)
+          continue;
+        minPixel = glm::max(glm::floor(minPixel), glm::vec2(0.0f));
+        maxPixel = glm::min(glm::ceil(maxPixel), glm::vec2(size));
+
+        bool hidden = true;
+        for (float y = minPixel.y; y < maxPixel.y && hidden; y += 0.5f)
+        {
+          for (float x = minPixel.x; x < maxPixel.x && hidden; x += 0.5f)
+          {
+            glm::vec3 origin;
+            glm::vec3 direction;
+            pixelRay(
+                inverseViewProjection, size.x, size.y, x + 0.25f, y + 0.25f, origin, direction);
+            float boxDistance;
+            if (rayBox(origin, direction, boxMin, boxMax, boxDistance))
+              hidden = raycastOccluders(origin, direction, scene.occluders) < boxDistance;
+          }
+        }
+
+        numHidden += hidden ? 1 : 0;
+        numCulled += occluded ? 1 : 0;
+        numFalseCulls += occluded && !hidden ? 1 : 0;
+      }
+    }
+  }
+
+  const bool passed = numDepthErrors == 0 && numThreadMismatches == 0 && numFalseCulls == 0;
+  writeLog(
+      "SoftwareOcclusion::validate: %u scenes, %u covered pixels of %u fully behind walls, "
+      "%u depth errors, %u serial/threaded mismatches, %u boxes culled of %u hidden, "
+      "%u false culls, %s",
+      numScenes,
+      numCoveredPixels,
+      numFullyHitPixels,
+      numDepthErrors,
+      numThreadMismatches,
+      numCulled,
+      numHidden,
+      numFalseCulls,
+      passed ? "passed" : "FAILED");
+  return passed;
+}
+//---------------------------------------------------------------------------//
+// Grid of buildings with props scattered over the streets and the roofs
+struct CityScene
+{
+  std::vector<OccluderMesh> buildings;
+  CullingBounds buildingBounds;
+  CullingBounds propBounds;
+};
+static void makeCityScene(Random& p_Rng, CityScene& p_Scene)
+{
+  const uint32_t numBlocks = 16;
+  const float blockSize = 20.0f;
+  const float streetWidth = 8.0f;
+  const float cityExtent = numBlocks * blockSize * 0.5f;
+
+  std::vector<glm::vec3> buildingMins;
+  std::vector<glm::vec3> buildingMaxs;
+  for (uint32_t blockZ = 0; blockZ < numBlocks; ++blockZ)
+  {
+    for (uint32_t blockX = 0; blockX < numBlocks; ++blockX)
+    {
+      const glm::vec3 origin =
+          glm::vec3(blockX * blockSize - cityExtent, 0.0f, blockZ * blockSize - cityExtent);
+      const float height = 8.0f + p_Rng.RandomFloat() * 40.0f;
+      const float halfStreet = streetWidth * 0.5f;
+      const glm::vec3 buildingMin = origin + glm::vec3(halfStreet, 0.0f, halfStreet);
+      const glm::vec3 buildingMax =
+          origin + glm::vec3(blockSize - halfStreet, height, blockSize - halfStreet);
+
+      p_Scene.buildings.emplace_back();
+      addBox(buildingMin, buildingMax, 4, p_Scene.buildings.back());
+      buildingMins.push_back(buildingMin);
+      buildingMaxs.push_back(buildingMax);
+    }
+  }
+  p_Scene.buildingBounds.init(
+      buildingMins.data(), buildingMaxs.data(), uint32_t(buildingMins.size()));
+
+  // Props on the ground all over the city, the ones inside buildings are hidden too
+  const uint32_t numProps = 50000;
+  std::vector<glm::vec3> propMins(numProps);
+  std::vector<glm::vec3> propMaxs(numProps);
+  for (uint32_t i = 0; i < numProps; ++i)
+  {
+    const glm::vec3 center = glm::vec3(
+        (p_Rng.RandomFloat() - 0.5f) * 2.0f * cityExtent,
+        p_Rng.RandomFloat() * 3.0f,
+        (p_Rng.RandomFloat() - 0.5f) * 2.0f * cityExtent);
+    const glm::vec3 extent = (randomVec3(p_Rng) + 0.1f) * 0.75f;
+    propMins[i] = center - extent;
+    propMaxs[i] = center + extent;
+  }
+  p_Scene.propBounds.init(propMins.data(), propMaxs.data(), numProps);
+}
+//---------------------------------------------------------------------------//
+void benchmark(uint32_t p_NumFramesPerPath)
+{
+  assert(p_NumFramesPerPath > 0);
+
+  Random rng;
+  rng.SetSeed(97531);
+
+  CityScene scene;
+  makeCityScene(rng, scene);
+
+  // 1080p at a quarter of the resolution
+  const uint32_t width = 480;
+  const uint32_t height = 270;
+  const uint32_t maxOccluders = 32;
+  const float minOccluderArea = 0.002f;
+
+  PerspectiveCamera camera;
+  camera.Initialize(float(width) / height, glm::radians(60.0f), 0.1f, 500.0f, float(width));
+
+  WorkerPool& pool = getWorkerPool();
+  SoftwareOcclusionBuffer buffer;
+  buffer.init(width, height);
+
+  const char* pathNames[] = {"street", "orbit", "flyover"};
+  for (uint32_t path = 0; path < arrayCount32(pathNames); ++path)
+  {
+    double serialMilliseconds = 0.0;
+    double threadedMilliseconds = 0.0;
+    double testMilliseconds = 0.0;
+    uint64_t numTriangles = 0;
+    uint64_t numInFrustum = 0;
+    uint64_t numCulled = 0;
+
+    std::vector<uint32_t> buildings(scene.buildingBounds.count());
+    std::vector<uint32_t> props(scene.propBounds.count());
+    std::vector<uint32_t> occluderIndices;
+    std::vector<const OccluderMesh*> occluders;
+    for (uint32_t frame = 0; frame < p_NumFramesPerPath; ++frame)
+    {
+      const float t = float(frame) / p_NumFramesPerPath;
+      glm::vec3 eye;
+      glm::vec3 target;
+      if (path == 0)
+      {
+        // Down the street between two block rows, looking ahead
+        eye = glm::vec3(-150.0f + t * 300.0f, 1.8f, -0.2f);
+        target = eye + glm::vec3(1.0f, 0.0f, 0.15f * std::sin(t * 6.0f));
+      }
+      else if (path == 1)
+      {
+        const float angle = t * 2.0f * Pi;
+        eye = glm::vec3(std::cos(angle), 0.0f, std::sin(angle)) * 120.0f + glm::vec3(0, 25.0f, 0);
+        target = glm::vec3(0.0f);
+      }
+      else
+      {
+        eye = glm::vec3(-160.0f + t * 320.0f, 90.0f, -160.0f + t * 320.0f);
+        target = eye + glm::vec3(1.0f, -0.6f, 1.0f);
+      }
+      camera.SetLookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f));
+      const glm::mat4& viewProjection = camera.ViewProjectionMatrix();
+      const Frustum frustum = FrustumCulling::extractFrustum(viewProjection);
+
+      const uint32_t numBuildings =
+          FrustumCulling::cull(scene.buildingBounds, frustum, buildings.data());
+      selectOccluders(
+          scene.buildingBounds,
+          buildings.data(),
+          numBuildings,
+          viewProjection,
+          maxOccluders,
+          minOccluderArea,
+          occluderIndices);
+      occluders.resize(occluderIndices.size());
+      for (uint64_t i = 0; i < occluderIndices.size(); ++i)
+        occluders[i] = &scene.buildings[occluderIndices[i]];
+
+      buffer.rasterize(viewProjection, occluders.data(), uint32_t(occluders.size()), nullptr);
+      serialMilliseconds += buffer.stats().RasterizeMilliseconds;
+      buffer.rasterize(viewProjection, occluders.data(), uint32_t(occluders.size()), &pool);
+      threadedMilliseconds += buffer.stats().RasterizeMilliseconds;
+      numTriangles += buffer.stats().NumTriangles;
+
+      const uint32_t numProps = FrustumCulling::cull(scene.propBounds, frustum, props.data());
+      buffer.cullBoxes(scene.propBounds, props.data(), numProps, &pool);
+      testMilliseconds += buffer.stats().TestMilliseconds;
+      numInFrustum += numProps;
+      numCulled += buffer.stats().NumOccluded;
+    }
+
+    writeLog(
+        "SoftwareOcclusion::benchmark: %s path, %ux%u, %.0f occluder triangles, rasterize %.3f ms "
+        "(%.3f ms on %u threads), test %.3f ms, %.1f%% of %.0f boxes in the frustum culled",
+        pathNames[path],
+        width,
+        height,
+        double(numTriangles) / p_NumFramesPerPath,
+        serialMilliseconds / p_NumFramesPerPath,
+        threadedMilliseconds / p_NumFramesPerPath,
+        pool.numThreads(),
+        testMilliseconds / p_NumFramesPerPath,
+        numInFrustum > 0 ? 100.0 * numCulled / numInFrustum : 0.0,
+        double(numInFrustum) / p_NumFramesPerPath);
+  }
+}
+//---------------------------------------------------------------------------//
+} // namespace SoftwareOcclusion
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "FrustumCulling.hpp"
+
+class Mesh;
+struct WorkerPool;
+
+//---------------------------------------------------------------------------//
+// World space triangles an occluder is rasterized with
+struct OccluderMesh
+{
+  std::vector<glm::vec3> positions;
+  std::vector<uint32_t> indices;
+
+  uint32_t numTriangles() const { return uint32_t(indices.size() / 3); }
+};
+//---------------------------------------------------------------------------//
+struct SoftwareOcclusionStats
+{
+  uint32_t NumOccluders = 0;
+  uint32_t NumTriangles = 0;
+  // After clipping, the clipped polygons are split into triangles again
+  uint32_t NumTrianglesRasterized = 0;
+  uint32_t NumTested = 0;
+  uint32_t NumOccluded = 0;
+  double RasterizeMilliseconds = 0.0;
+  double TestMilliseconds = 0.0;
+};
+//---------------------------------------------------------------------------//
+// Low resolution depth buffer for culling on the CPU, in the spirit of masked software
+// occlusion culling. Occluder triangles are clipped and set up in parallel, binned into the
+// 32x8 pixel tiles they touch, and the tiles are rasterized in parallel with SSE, 4 pixels at a
+// time. Every tile also keeps its farthest depth so most box tests end at the tile level.
+//
+// Depth is D3D device depth (0 near, 1 far). Both sides are conservative: a pixel is only
+// covered when the whole pixel is inside the triangle and holds the farthest depth the triangle
+// has over it, and a box is only occluded when its nearest point is behind every pixel its
+// screen rectangle touches.
+//---------------------------------------------------------------------------//
+struct SoftwareOcclusionBuffer
+{
+  static constexpr uint32_t TileWidth = 32;
+  static constexpr uint32_t TileHeight = 8;
+
+  // The storage is rounded up to whole tiles, the viewport is p_Width x p_Height
+  void init(uint32_t p_Width, uint32_t p_Height);
+
+  // Clears the buffer and rasterizes the occluders with p_ViewProjection, a CameraBase matrix
+  // (stored transposed). p_Pool null runs on the calling thread.
+  void rasterize(
+      const glm::mat4& p_ViewProjection,
+      const OccluderMesh* const* p_Occluders,
+      uint32_t p_NumOccluders,
+      WorkerPool* p_Pool);
+
+  // Against the last rasterize(), boxes crossing the near plane are never occluded
+  bool isBoxOccluded(const glm::vec3& p_Min, const glm::vec3& p_Max) const;
+
+  // Drops the occluded boxes from p_Indices (indices into p_Bounds, usually the frustum culling
+  // output) keeping the order of the rest, returns how many are left
+  uint32_t cullBoxes(
+      const CullingBounds& p_Bounds, uint32_t* p_Indices, uint32_t p_Count, WorkerPool* p_Pool);
+
+  float depth(uint32_t p_X, uint32_t p_Y) const;
+  float tileMaxDepth(uint32_t p_TileX, uint32_t p_TileY) const
+  {
+    return m_TileMaxDepth[p_TileY * m_NumTilesX + p_TileX];
+  }
+
+  uint32_t width() const { return m_Width; }
+  uint32_t height() const { return m_Height; }
+  uint32_t numTilesX() const { return m_NumTilesX; }
+  uint32_t numTilesY() const { return m_NumTilesY; }
+  const SoftwareOcclusionStats& stats() const { return m_Stats; }
+
+private:
+  // Edge functions are positive inside and already moved in by half a pixel's extent, the depth
+  // plane is already moved back by half a pixel's depth slope
+  struct Triangle
+  {
+    float edgeA[3];
+    float edgeB[3];
+    float edgeC[3];
+    float depthA;
+    float depthB;
+    float depthC;
+    int32_t minX;
+    int32_t minY;
+    int32_t maxX;
+    int32_t maxY;
+  };
+
+  // Triangles one setup job produced and the ones each tile got
+  struct Bin
+  {
+    std::vector<Triangle> triangles;
+    std::vector<std::vector<uint32_t>> tiles;
+  };
+
+  void setupTriangles(
+      const glm::mat4& p_ViewProjection,
+      const OccluderMesh* const* p_Occluders,
+      const uint32_t* p_TriangleOffsets,
+      uint32_t p_NumOccluders,
+      uint32_t p_First,
+      uint32_t p_Last,
+      Bin& p_Bin) const;
+  void addTriangle(const glm::vec3 p_Vertices[3], Bin& p_Bin) const;
+  void rasterizeTile(uint32_t p_Tile, uint32_t p_NumBins);
+
+  uint32_t m_Width = 0;
+  uint32_t m_Height = 0;
+  uint32_t m_NumTilesX = 0;
+  uint32_t m_NumTilesY = 0;
+
+  // Tile after tile, TileWidth x TileHeight row major depths each
+  std::vector<float> m_Depth;
+  std::vector<float> m_TileMaxDepth;
+  glm::mat4 m_ViewProjection = glm::mat4(1.0f);
+
+  std::vector<Bin> m_Bins;
+  std::vector<uint8_t> m_Occluded;
+  SoftwareOcclusionStats m_Stats;
+};
+//---------------------------------------------------------------------------//
+namespace SoftwareOcclusion
+{
+
+// Level 0 triangles of every part of the mesh, the scene meshes are already in world space
+void makeOccluder(const Mesh& p_Mesh, OccluderMesh& p_Occluder);
+
+// Fraction of the viewport the box's screen rectangle covers, 1 when it crosses the near plane
+float screenArea(const glm::mat4& p_ViewProjection, const glm::vec3& p_Min, const glm::vec3& p_Max);
+
+// Picks up to p_MaxOccluders of p_Candidates (indices into p_Bounds) covering at least
+// p_MinScreenArea of the viewport, largest first
+void selectOccluders(
+    const CullingBounds& p_Bounds,
+    const uint32_t* p_Candidates,
+    uint32_t p_NumCandidates,
+    const glm::mat4& p_ViewProjection,
+    uint32_t p_MaxOccluders,
+    float p_MinScreenArea,
+    std::vector<uint32_t>& p_Occluders);
+
+// Headless checks of the buffer depths and the box test against rays cast at the occluder
+// triangles, and of the threaded path against the serial one. Results go to the debug output.
+bool validate(uint32_t p_NumBoxes = 20000);
+
+// Headless walk of fixed camera paths through a generated city block scene, reporting the
+// rasterization and test times and how many of the boxes in the frustum get culled
+void benchmark(uint32_t p_NumFramesPerPath = 64);
+
+} // namespace SoftwareOcclusion
@@ -12,6 +12,9 @@
 #include "Utility.hpp"
 #include "D3D12Wrapper.hpp"
 
+template <typename T> struct TextureData;
+struct WorkerPool;
+
 // Constants
 static const float CosineA0 = 1.0f * Pi;
 static const float CosineA1 = (2.0f * Pi) / 3.0f;
@@ -194,6 +197,9 @@ struct ShaderSH9Color
 SH9 ProjectOntoSH9(const glm::vec3& dir);
 SH9Color ProjectOntoSH9Color(const glm::vec3& dir, const glm::vec3& color);
 glm::vec3 EvalSH9Irradiance(const glm::vec3& dir, const SH9Color& sh);
+// SH of the environment turned by rotation, i.e. the rotated SH at rotation * dir equals the
+// original at dir
+SH9Color RotateSH9Color(const SH9Color& sh, const glm::mat3& rotation);
 
 // H-basis functions
 H4 ProjectOntoH4(const glm::vec3& dir);
@@ -202,6 +208,12 @@ H4 ConvertToH4(const SH9& sh);
 
 // Lighting environment generation functions
 SH9Color ProjectCubemapToSH(const Texture& texture);
+// Same for a cube map already on the CPU, with its rows spread over pool (null projects on the
+// calling thread). The result doesn't depend on the thread count.
+SH9Color ProjectCubemapToSH(const TextureData<glm::vec4>& cubeMap, WorkerPool* pool);
+// Headless check of the projection on the pool against the serial one, and of its irradiance
+// against brute force cosine sums. Results go to the debug output.
+bool ValidateProjectCubemapToSH();
 
 // Constants
 static const H4 H4Identity = H4(std::sqrt(2.0f * 3.14159f), 0.0f, 0.0f, 0.0f);
@@ -328,6 +328,24 @@ template <typename T, U32 N> constexpr void setArrayToZero(T (&p_Array)[N])
   ::memset(p_Array, 0, N * sizeof(p_Array[0]));
 }
 //---------------------------------------------------------------------------//
+// 64-bit FNV-1a, pass the previous result as p_Seed to hash several ranges in sequence
+inline uint64_t
+hashBytes(const void* p_Data, uint64_t p_Size, uint64_t p_Seed = 14695981039346656037ull)
+{
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(p_Data);
+  uint64_t hash = p_Seed;
+  for (uint64_t i = 0; i < p_Size; ++i)
+  {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+template <typename T> inline uint64_t hashValue(const T& p_Value, uint64_t p_Seed)
+{
+  return hashBytes(&p_Value, sizeof(T), p_Seed);
+}
+//---------------------------------------------------------------------------//
 // Traces an error and convert the msg to a human-readable string
 inline void traceHr(const std::string& p_Msg, HRESULT p_Hr)
 {
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "Utility.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+
+//---------------------------------------------------------------------------//
+// Persistent pool of worker threads for data-parallel loops. parallelFor() blocks
+// until every index ran, the calling thread takes part in the work. Calls from
+// different threads are serialized and calls made from inside a job run inline.
+//---------------------------------------------------------------------------//
+struct WorkerPool
+{
+  using JobFunction = std::function<void(uint32_t p_Index)>;
+
+  WorkerPool() {}
+  ~WorkerPool() { deinit(); }
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  // p_NumWorkers = 0 picks one worker per hardware thread minus the caller
+  void init(uint32_t p_NumWorkers = 0)
+  {
+    deinit();
+
+    if (p_NumWorkers == 0)
+    {
+      const uint32_t hardwareThreads = std::thread::hardware_concurrency();
+      p_NumWorkers = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+    }
+
+    m_Quit = false;
+    m_Workers.reserve(p_NumWorkers);
+    for (uint32_t i = 0; i < p_NumWorkers; ++i)
+      m_Workers.emplace_back([this, generation = m_Generation]() { workerLoop(generation); });
+  }
+  void deinit()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      m_Quit = true;
+    }
+    m_WakeCondition.notify_all();
+    for (std::thread& worker : m_Workers)
+      worker.join();
+    m_Workers.clear();
+  }
+
+  // Threads that execute jobs, including the calling thread
+  uint32_t numThreads() const { return uint32_t(m_Workers.size()) + 1; }
+
+  // Runs p_Function(i) for i in [0, p_Count), p_Granularity indices are grabbed at a time
+  void parallelFor(uint32_t p_Count, const JobFunction& p_Function, uint32_t p_Granularity = 1)
+  {
+    if (p_Count == 0)
+      return;
+
+    if (m_Workers.empty() || t_InsideJob || p_Count <= p_Granularity)
+    {
+      for (uint32_t i = 0; i < p_Count; ++i)
+        p_Function(i);
+      return;
+    }
+
+    std::lock_guard<std::mutex> submitLock(m_SubmitMutex);
+
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      m_Function = &p_Function;
+      m_Count = p_Count;
+      m_Granularity = p_Granularity > 0 ? p_Granularity : 1;
+      m_NextIndex = 0;
+      m_ActiveWorkers = uint32_t(m_Workers.size());
+      ++m_Generation;
+    }
+    m_WakeCondition.notify_all();
+
+    runJobs();
+
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_DoneCondition.wait(lock, [this]() { return m_ActiveWorkers == 0; });
+    m_Function = nullptr;
+  }
+
+private:
+  void runJobs()
+  {
+    t_InsideJob = true;
+    for (;;)
+    {
+      const uint32_t first = m_NextIndex.fetch_add(m_Granularity);
+      if (first >= m_Count)
+        break;
+
+      const uint32_t last = std::min<uint32_t>(first + m_Granularity, m_Count);
+      for (uint32_t i = first; i < last; ++i)
+        (*m_Function)(i);
+    }
+    t_InsideJob = false;
+  }
+  void workerLoop(uint64_t p_Generation)
+  {
+    uint64_t seenGeneration = p_Generation;
+    for (;;)
+    {
+      {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_WakeCondition.wait(lock, [&]() { return m_Quit || m_Generation != seenGeneration; });
+        if (m_Quit)
+          return;
+        seenGeneration = m_Generation;
+      }
+
+      runJobs();
+
+      {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        --m_ActiveWorkers;
+      }
+      m_DoneCondition.notify_one();
+    }
+  }
+
+  std::vector<std::thread> m_Workers;
+  std::mutex m_SubmitMutex;
+  std::mutex m_Mutex;
+  std::condition_variable m_WakeCondition;
+  std::condition_variable m_DoneCondition;
+
+  const JobFunction* m_Function = nullptr;
+  uint32_t m_Count = 0;
+  uint32_t m_Granularity = 1;
+  std::atomic<uint32_t> m_NextIndex = 0;
+  uint32_t m_ActiveWorkers = 0;
+  uint64_t m_Generation = 0;
+  bool m_Quit = false;
+
+  static inline thread_local bool t_InsideJob = false;
+};
+//---------------------------------------------------------------------------//
+// Shared pool, created on first use
+inline WorkerPool& getWorkerPool()
+{
+  static WorkerPool pool;
+  static std::once_flag initFlag;
+  std::call_once(initFlag, []() { pool.init(); });
+  return pool;
+}
+//---------------------------------------------------------------------------//
@@ -3,6 +3,9 @@
 #include "d3dx12.h"
 #include "pix3.h"
 #include "../AppSettings.hpp"
+#include "OcclusionCulling.hpp"
+#include "Timer.hpp"
+#include "WorkerPool.hpp"
 
 /*
 * TODOS:
@@ -84,14 +87,22 @@ enum RootParams : uint32_t
   RootParam_Cbuffer,
   RootParam_UAVDescriptors,
   RootParam_AppSettings,
+  RootParam_DrawConstants,
 
   NumRootParams,
 };
 
+// Culling and depth pyramid UAVs, unused slots get a duplicate
+static constexpr uint32_t NumUAVDescriptors = 4;
+
+// Root constants of each indirect draw, the first two uints of GpuMeshDrawCommand
+static constexpr uint32_t NumDrawConstants = 2;
+
 enum RenderPass : uint32_t
 {
   RenderPass_GpuCulling,
   RenderPass_GbufferMeshlet,
+  RenderPass_DepthPyramid,
   
   NumRenderPasses,
 };
@@ -102,14 +113,38 @@ const extern uint32_t CBufferRegister;
 void bindCBufferCompute(ID3D12GraphicsCommandList* cmdList, uint32_t rootParameter);
 } // namespace AppSettings
 
+// UniformConstants in OcclusionCulling.hlsl
 struct Uniforms
 {
+  glm::mat4 ViewProjection;
+  glm::mat4 View;
+  glm::mat4 Projection;
+  glm::vec4 FrustumPlanes[6];
+
   float NearClip = 0.0f;
   float FarClip = 0.0f;
-  float Unused0;
-  float Unused1;
+  float ScreenWidth = 0.0f;
+  float ScreenHeight = 0.0f;
+
+  uint32_t DepthPyramidWidth = 0;
+  uint32_t DepthPyramidHeight = 0;
+  uint32_t DepthPyramidNumMips = 0;
+  uint32_t LateFlag = 0;
+
+  uint32_t PreviousDepthPyramidValid = 0;
+  uint32_t OcclusionCullingEnabled = 0;
+  uint32_t MeshInstanceCount = 0;
+  uint32_t depthBufferSrv = uint32_t(-1);
 
   uint32_t meshBufferSrv = uint32_t(-1);
+  uint32_t meshBoundsBufferSrv = uint32_t(-1);
+  uint32_t meshletBufferSrv = uint32_t(-1);
+  uint32_t meshletDataBufferSrv = uint32_t(-1);
+
+  uint32_t meshletVertexPositionBufferSrv = uint32_t(-1);
+  uint32_t previousDepthPyramidSrv = uint32_t(-1);
+  uint32_t currentDepthPyramidSrv = uint32_t(-1);
+  uint32_t meshInstanceBufferSrv = uint32_t(-1);
 };
 
 void GpuDrivenRenderer::init(ID3D12Device* p_Device, uint32_t p_Width, uint32_t p_Height)
@@ -117,11 +152,14 @@ void GpuDrivenRenderer::init(ID3D12Device* p_Device, uint32_t p_Width, uint32_t
   if (!m_Enabled)
     return;
 
+  m_Width = p_Width;
+  m_Height = p_Height;
+
   // Create root signature:
   {
     D3D12_DESCRIPTOR_RANGE1 uavRanges[1] = {};
     uavRanges[0].RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_UAV;
-    uavRanges[0].NumDescriptors = 2;
+    uavRanges[0].NumDescriptors = NumUAVDescriptors;
     uavRanges[0].BaseShaderRegister = 0;
     uavRanges[0].RegisterSpace = 0;
     uavRanges[0].OffsetInDescriptorsFromTableStart = 0;
@@ -163,6 +201,14 @@ void GpuDrivenRenderer::init(ID3D12Device* p_Device, uint32_t p_Width, uint32_t
     rootParameters[RootParam_AppSettings].Descriptor.RegisterSpace = 0;
     rootParameters[RootParam_AppSettings].Descriptor.ShaderRegister = AppSettings::CBufferRegister;
 
+    // Draw id and flags, set by the indirect draws and by the depth pyramid pass
+    rootParameters[RootParam_DrawConstants].ParameterType =
+        D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+    rootParameters[RootParam_DrawConstants].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+    rootParameters[RootParam_DrawConstants].Constants.RegisterSpace = 0;
+    rootParameters[RootParam_DrawConstants].Constants.ShaderRegister = 1;
+    rootParameters[RootParam_DrawConstants].Constants.Num32BitValues = NumDrawConstants;
+
     D3D12_STATIC_SAMPLER_DESC staticSamplers[5] = {};
     staticSamplers[0] =
         GetStaticSamplerState(SamplerState::Point, 0, 0, D3D12_SHADER_VISIBILITY_ALL);
@@ -188,30 +234,37 @@ void GpuDrivenRenderer::init(ID3D12Device* p_Device, uint32_t p_Width, uint32_t
 
   // Create the command signature used for indirect drawing.
   {
-    // Each command consists of an amplification/mesh shader call.
-    D3D12_INDIRECT_ARGUMENT_DESC argumentDescs[1] = {};
-    argumentDescs[0].Type = D3D12_INDIRECT_ARGUMENT_TYPE_DISPATCH_MESH;
+    // Each command sets the draw constants and makes an amplification/mesh shader call.
+    D3D12_INDIRECT_ARGUMENT_DESC argumentDescs[2] = {};
+    argumentDescs[0].Type = D3D12_INDIRECT_ARGUMENT_TYPE_CONSTANT;
+    argumentDescs[0].Constant.RootParameterIndex = RootParam_DrawConstants;
+    argumentDescs[0].Constant.DestOffsetIn32BitValues = 0;
+    argumentDescs[0].Constant.Num32BitValuesToSet = NumDrawConstants;
+    argumentDescs[1].Type = D3D12_INDIRECT_ARGUMENT_TYPE_DISPATCH_MESH;
+
+    static_assert(offsetof(GpuMeshDrawCommand, taskMeshArguments) == NumDrawConstants * 4);
 
     D3D12_COMMAND_SIGNATURE_DESC commandSignatureDesc = {};
     commandSignatureDesc.pArgumentDescs = argumentDescs;
     commandSignatureDesc.NumArgumentDescs = _countof(argumentDescs);
     commandSignatureDesc.ByteStride = sizeof(GpuMeshDrawCommand);
 
-#if 0 // if changing the root signature
+    // Root constants need the root signature
     p_Device->CreateCommandSignature(
         &commandSignatureDesc, m_RootSig, IID_PPV_ARGS(&m_CommandSignature));
     m_CommandSignature->SetName(L"GpuDrivenRenderer-CommandSignature");
-#endif
-    p_Device->CreateCommandSignature(
-        &commandSignatureDesc, nullptr, IID_PPV_ARGS(&m_CommandSignature));
-    m_CommandSignature->SetName(L"GpuDrivenRenderer-CommandSignature");
   }
 
+  createRenderTargets();
+}
+
+void GpuDrivenRenderer::createRenderTargets()
+{
   // Create depth buffer
   {
     DepthBufferInit dbInit;
-    dbInit.Width = p_Width;
-    dbInit.Height = p_Height;
+    dbInit.Width = m_Width;
+    dbInit.Height = m_Height;
     dbInit.Format = DXGI_FORMAT_D32_FLOAT;
     dbInit.MSAASamples = 1;
     dbInit.InitialState =
@@ -223,8 +276,8 @@ void GpuDrivenRenderer::init(ID3D12Device* p_Device, uint32_t p_Width, uint32_t
   // Create gbuffers:
   {
     RenderTextureInit rtInit;
-    rtInit.Width = p_Width;
-    rtInit.Height = p_Height;
+    rtInit.Width = m_Width;
+    rtInit.Height = m_Height;
     rtInit.Format = DXGI_FORMAT_R10G10B10A2_UNORM;
     rtInit.MSAASamples = 1;
     rtInit.ArraySize = 1;
@@ -235,8 +288,8 @@ void GpuDrivenRenderer::init(ID3D12Device* p_Device, uint32_t p_Width, uint32_t
   }
   {
     RenderTextureInit rtInit;
-    rtInit.Width = p_Width;
-    rtInit.Height = p_Height;
+    rtInit.Width = m_Width;
+    rtInit.Height = m_Height;
     rtInit.Format = DXGI_FORMAT_R16G16B16A16_SNORM;
     rtInit.MSAASamples = 1;
     rtInit.ArraySize = 1;
@@ -247,8 +300,8 @@ void GpuDrivenRenderer::init(ID3D12Device* p_Device, uint32_t p_Width, uint32_t
   }
   {
     RenderTextureInit rtInit;
-    rtInit.Width = p_Width;
-    rtInit.Height = p_Height;
+    rtInit.Width = m_Width;
+    rtInit.Height = m_Height;
     rtInit.Format = DXGI_FORMAT_R8_UINT;
     rtInit.MSAASamples = 1;
     rtInit.ArraySize = 1;
@@ -257,6 +310,36 @@ void GpuDrivenRenderer::init(ID3D12Device* p_Device, uint32_t p_Width, uint32_t
     rtInit.Name = L"GDR Material ID Target";
     m_MaterialIDTarget.init(rtInit);
   }
+
+  // Create depth pyramids, sized so every mip is exactly half the one above
+  {
+    RenderTextureInit rtInit;
+    rtInit.Width = OcclusionCulling::pyramidSize(m_Width);
+    rtInit.Height = OcclusionCulling::pyramidSize(m_Height);
+    rtInit.Format = DXGI_FORMAT_R32_FLOAT;
+    rtInit.MSAASamples = 1;
+    rtInit.ArraySize = 1;
+    rtInit.NumMips =
+        OcclusionCulling::pyramidMipCount(uint32_t(rtInit.Width), uint32_t(rtInit.Height));
+    rtInit.CreateUAV = true;
+    rtInit.InitialState = D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
+    rtInit.Name = L"GDR Depth Pyramid";
+    m_DepthPyramid.init(rtInit);
+
+    rtInit.Name = L"GDR Early Depth Pyramid";
+    m_EarlyDepthPyramid.init(rtInit);
+  }
+  m_DepthPyramidValid = false;
+}
+
+void GpuDrivenRenderer::onResize(uint32_t p_Width, uint32_t p_Height)
+{
+  if (!m_Enabled)
+    return;
+
+  m_Width = p_Width;
+  m_Height = p_Height;
+  createRenderTargets();
 }
 
 void GpuDrivenRenderer::deinit()
@@ -265,77 +348,91 @@ void GpuDrivenRenderer::deinit()
     return;
 
   m_DepthBuffer.deinit();
+  m_DepthPyramid.deinit();
+  m_EarlyDepthPyramid.deinit();
 
   // TODO:
   // Release all created resources and whatnot
   //
 }
 
-void GpuDrivenRenderer::addMeshes(std::vector<Mesh>& meshes)
-{
-  if (!m_Enabled)
-    return;
+// Meshlet builder limits, these also feed the meshlet cache key
+static constexpr size_t MeshletMaxVertices = 64;
+static constexpr size_t MeshletMaxTriangles = 124;
+static constexpr float MeshletConeWeight = 0.0f;
 
-  assert(0 == m_MeshletsVertexPositions.size());
-  assert(0 == m_MeshletsVertexData.size());
-  assert(0 == m_MeshletsData.size());
-  assert(0 == m_Meshlets.size());
-  assert(0 == m_Meshes.size());
-  assert(0 == m_MeshInstances.size());
+// Builds the meshlets of a single mesh and appends them to p_Output, all offsets are relative to
+// what p_Output already holds
+static void appendMeshMeshlets(const Mesh& mesh_, uint32_t p, MeshletBuildOutput& p_Output)
+{
+  p_Output.meshInfos.push_back(MeshletMeshInfo{});
+  MeshletMeshInfo& meshInfo = p_Output.meshInfos.back();
 
-  uint32_t totalMeshlets = 0;
-  for (uint32_t p = 0; p < meshes.size(); ++p)
+  // Bounding sphere:
   {
-    Mesh mesh_ = meshes[p];
-
-    // Bounding sphere:
-    {
-      glm::vec3 center = (mesh_.AABBMax() + mesh_.AABBMin());
-      center *= 0.5f;
-      float radius =
-          glm::max(glm::distance(mesh_.AABBMax(), center), glm::distance(mesh_.AABBMin(), center));
-      mesh_.m_BoundingSphere = glm::vec4(center, radius);
-    }
+    glm::vec3 center = (mesh_.AABBMax() + mesh_.AABBMin());
+    center *= 0.5f;
+    float radius =
+        glm::max(glm::distance(mesh_.AABBMax(), center), glm::distance(mesh_.AABBMin(), center));
+    meshInfo.boundingSphere = glm::vec4(center, radius);
+  }
 
-    // 1. Determine the maximum number of meshlets that could be generated for the mesh
-    const size_t maxVertices = 64;
-    const size_t maxTriangles = 124;
-    const float coneWeight = 0.0f;
-    const size_t maxMeshlets =
-        meshopt_buildMeshletsBound(mesh_.NumIndices(), maxVertices, maxTriangles);
-
-    // 2. Allocate memory for the vertices and indices arrays that describe the meshlets
-    std::vector<meshopt_Meshlet> localMeshlets;
-    localMeshlets.resize(maxMeshlets);
-
-    // list of vertex indices (4 bytes)
-    std::vector<uint32_t> meshletVertexIndices;
-    meshletVertexIndices.resize(maxMeshlets * maxVertices);
-
-    // list of triangle indices (1 byte)
-    std::vector<uint8_t> meshletTriangles;
-    meshletTriangles.resize(maxMeshlets * maxTriangles * 3);
-
-    // flatten vertex positions as a float array
-    const uint32_t numVertices = mesh_.NumVertices();
-    std::vector<float> flattenedVerts;
-    flattenedVerts.resize(numVertices * 3);
-    for (uint32_t i = 0; i < numVertices; ++i)
-    {
-      const MeshVertex* vertPtr = mesh_.Vertices();
-      flattenedVerts.at(i * 3) = vertPtr[i].Position.x;
-      flattenedVerts.at(i * 3 + 1) = vertPtr[i].Position.y;
-      flattenedVerts.at(i * 3 + 2) = vertPtr[i].Position.z;
-    }
+  // 1. Determine the maximum number of meshlets that could be generated for the mesh
+  const size_t maxVertices = MeshletMaxVertices;
+  const size_t maxTriangles = MeshletMaxTriangles;
+  const float coneWeight = MeshletConeWeight;
+  const size_t maxMeshlets =
+      meshopt_buildMeshletsBound(mesh_.NumIndices(), maxVertices, maxTriangles);
+
+  // 2. Allocate memory for the vertices and indices arrays that describe the meshlets
+  std::vector<meshopt_Meshlet> localMeshlets;
+  localMeshlets.resize(maxMeshlets);
+
+  // list of vertex indices (4 bytes)
+  std::vector<uint32_t> meshletVertexIndices;
+  meshletVertexIndices.resize(maxMeshlets * maxVertices);
+
+  // list of triangle indices (1 byte)
+  std::vector<uint8_t> meshletTriangles;
+  meshletTriangles.resize(maxMeshlets * maxTriangles * 3);
+
+  // flatten vertex positions as a float array
+  const uint32_t numVertices = mesh_.NumVertices();
+  std::vector<float> flattenedVerts;
+  flattenedVerts.resize(numVertices * 3);
+  for (uint32_t i = 0; i < numVertices; ++i)
+  {
+    const MeshVertex* vertPtr = mesh_.Vertices();
+    flattenedVerts.at(i * 3) = vertPtr[i].Position.x;
+    flattenedVerts.at(i * 3 + 1) = vertPtr[i].Position.y;
+    flattenedVerts.at(i * 3 + 2) = vertPtr[i].Position.z;
+  }
 
-    // 3. Generate meshlets
-    const size_t indexCount = mesh_.NumIndices();
-    const uint16_t* indices = mesh_.Indices();
-    size_t meshletCount = meshopt_buildMeshlets(
+  // 3. Generate meshlets, straight from the mesh's own index width
+  const size_t indexCount = mesh_.NumIndices();
+  size_t meshletCount = 0;
+  if (mesh_.IndexBufferType() == IndexType::Index32Bit)
+  {
+    meshletCount = meshopt_buildMeshlets(
+        localMeshlets.data(),
+        meshletVertexIndices.data(),
+        meshletTriangles.data(),
+        mesh_.Indices32(),
+        indexCount,
+        flattenedVerts.data(),
+        numVertices,
+        sizeof(glm::vec3),
+        maxVertices,
+        maxTriangles,
+        coneWeight);
+  }
+  else
+  {
+    meshletCount = meshopt_buildMeshlets(
         localMeshlets.data(),
         meshletVertexIndices.data(),
         meshletTriangles.data(),
-        indices,
+        mesh_.Indices16(),
         indexCount,
         flattenedVerts.data(),
         numVertices,
@@ -343,174 +440,678 @@ void GpuDrivenRenderer::addMeshes(std::vector<Mesh>& meshes)
         maxVertices,
         maxTriangles,
         coneWeight);
+  }
+
+  // Extract data
+  uint32_t meshletVertexOffset = static_cast<uint32_t>(p_Output.vertexPositions.size());
+  for (uint32_t v = 0; v < numVertices; ++v)
+  {
+    GpuMeshletVertexPosition meshletVertexPos{};
+
+    float x = flattenedVerts[v * 3 + 0];
+    float y = flattenedVerts[v * 3 + 1];
+    float z = flattenedVerts[v * 3 + 2];
 
-    mesh_.m_MeshletCount = static_cast<uint32_t>(meshletCount);
+    meshletVertexPos.position[0] = x;
+    meshletVertexPos.position[1] = y;
+    meshletVertexPos.position[2] = z;
 
-    // Extract data
-    uint32_t meshletVertexOffset = static_cast<uint32_t>(m_MeshletsVertexPositions.size());
-    for (uint32_t v = 0; v < numVertices; ++v)
+    p_Output.vertexPositions.push_back(meshletVertexPos);
+
+    GpuMeshletVertexData meshletVertexData{};
+
+    const MeshVertex* vertPtr = mesh_.Vertices();
+    // Normals
+    {
+      meshletVertexData.normal[0] = (vertPtr[v].Normal.x + 1.0f) * 127.0f;
+      meshletVertexData.normal[1] = (vertPtr[v].Normal.y + 1.0f) * 127.0f;
+      meshletVertexData.normal[2] = (vertPtr[v].Normal.z + 1.0f) * 127.0f;
+    }
+
+    // Tangents
     {
-      GpuMeshletVertexPosition meshletVertexPos{};
+      meshletVertexData.tangent[0] = (vertPtr[v].Tangent.x + 1.0f) * 127.0f;
+      meshletVertexData.tangent[1] = (vertPtr[v].Tangent.y + 1.0f) * 127.0f;
+      meshletVertexData.tangent[2] = (vertPtr[v].Tangent.z + 1.0f) * 127.0f;
+      meshletVertexData.tangent[3] = 0;
+      // meshletVertexData.tangent[3] = (vertPtr[v].Tangent.w + 1.0f) * 127.0f;
+    }
 
-      float x = flattenedVerts[v * 3 + 0];
-      float y = flattenedVerts[v * 3 + 1];
-      float z = flattenedVerts[v * 3 + 2];
+    meshletVertexData.uvCoords[0] = meshopt_quantizeHalf(vertPtr[v].UV.x);
+    meshletVertexData.uvCoords[1] = meshopt_quantizeHalf(vertPtr[v].UV.y);
 
-      meshletVertexPos.position[0] = x;
-      meshletVertexPos.position[1] = y;
-      meshletVertexPos.position[2] = z;
+    p_Output.vertexData.push_back(meshletVertexData);
+  }
 
-      m_MeshletsVertexPositions.push_back(meshletVertexPos);
+  // Cache meshlet offset
+  meshInfo.meshletOffset = static_cast<uint32_t>(p_Output.meshlets.size());
+  meshInfo.meshletCount = static_cast<uint32_t>(meshletCount);
+  meshInfo.meshletIndexCount = 0;
 
-      GpuMeshletVertexData meshletVertexData{};
+  // 5. Extract additional data (bounding sphere and cone) for each meshlet:
+  // Append meshlet data
+  for (uint32_t m = 0; m < meshletCount; ++m)
+  {
+    meshopt_Meshlet& localMeshlet = localMeshlets[m];
 
-      const MeshVertex* vertPtr = mesh_.Vertices();
-      // Normals
-      {
-        meshletVertexData.normal[0] = (vertPtr[v].Normal.x + 1.0f) * 127.0f;
-        meshletVertexData.normal[1] = (vertPtr[v].Normal.y + 1.0f) * 127.0f;
-        meshletVertexData.normal[2] = (vertPtr[v].Normal.z + 1.0f) * 127.0f;
-      }
+    meshopt_Bounds meshlet_bounds = meshopt_computeMeshletBounds(
+        meshletVertexIndices.data() + localMeshlet.vertex_offset,
+        meshletTriangles.data() + localMeshlet.triangle_offset,
+        localMeshlet.triangle_count,
+        flattenedVerts.data(),
+        numVertices,
+        sizeof(glm::vec3));
+
+    GpuMeshlet meshlet{};
+    meshlet.dataOffset = p_Output.meshletsData.size();
+    meshlet.vertexCount = localMeshlet.vertex_count;
+    meshlet.triangleCount = localMeshlet.triangle_count;
+
+    meshlet.center =
+        glm::vec3{meshlet_bounds.center[0], meshlet_bounds.center[1], meshlet_bounds.center[2]};
+    meshlet.radius = meshlet_bounds.radius;
+
+    meshlet.coneAxis[0] = meshlet_bounds.cone_axis_s8[0];
+    meshlet.coneAxis[1] = meshlet_bounds.cone_axis_s8[1];
+    meshlet.coneAxis[2] = meshlet_bounds.cone_axis_s8[2];
+
+    meshlet.coneCutoff = meshlet_bounds.cone_cutoff_s8;
+    meshlet.meshIndex = p;
+
+    // Resize data array
+    const uint32_t indexGroupCount = (localMeshlet.triangle_count * 3 + 3) / 4;
+    p_Output.meshletsData.reserve(
+        p_Output.meshletsData.size() + localMeshlet.vertex_count + indexGroupCount);
+
+    for (uint32_t i = 0; i < meshlet.vertexCount; ++i)
+    {
+      const uint32_t vertexIndex =
+          meshletVertexOffset + meshletVertexIndices[localMeshlet.vertex_offset + i];
+      p_Output.meshletsData.push_back(vertexIndex);
+    }
+
+    // Store indices as uint32
+    // NOTE(marco): we write 4 indices at at time, it will come in handy in the mesh shader
+    const uint32_t* indexGroups =
+        reinterpret_cast<const uint32_t*>(meshletTriangles.data() + localMeshlet.triangle_offset);
+    for (uint32_t i = 0; i < indexGroupCount; ++i)
+    {
+      const uint32_t index_group = indexGroups[i];
+      p_Output.meshletsData.push_back(index_group);
+    }
+
+    // Writing in group of fours can be problematic, if there are non multiple of 3
+    // indices a triangle can be shared between meshlets.
+    // We need to add some padding for that.
+    // This is visible only if we emulate meshlets (not using actual mesh shaders),
+    // so probably there are controls at driver level that avoid this problems when using mesh
+    // shaders. Check for the last 3 indices: if last one are two are zero, then add one or two
+    // groups of empty triangles.
+    uint32_t lastIndexGroup = indexGroups[indexGroupCount - 1];
+    uint32_t lastIndex = (lastIndexGroup >> 8) & 0xff;
+    uint32_t secondLastIndex = (lastIndexGroup >> 16) & 0xff;
+    uint32_t thirdLastIndex = (lastIndexGroup >> 24) & 0xff;
+    if (lastIndex != 0 && thirdLastIndex == 0)
+    {
 
-      // Tangents
+      if (secondLastIndex != 0)
       {
-        meshletVertexData.tangent[0] = (vertPtr[v].Tangent.x + 1.0f) * 127.0f;
-        meshletVertexData.tangent[1] = (vertPtr[v].Tangent.y + 1.0f) * 127.0f;
-        meshletVertexData.tangent[2] = (vertPtr[v].Tangent.z + 1.0f) * 127.0f;
-        meshletVertexData.tangent[3] = 0;
-        // meshletVertexData.tangent[3] = (vertPtr[v].Tangent.w + 1.0f) * 127.0f;
+        // Add a single index group of zeroes
+        p_Output.meshletsData.push_back(0);
+        meshlet.triangleCount++;
       }
 
-      meshletVertexData.uvCoords[0] = meshopt_quantizeHalf(vertPtr[v].UV.x);
-      meshletVertexData.uvCoords[1] = meshopt_quantizeHalf(vertPtr[v].UV.y);
+      meshlet.triangleCount++;
+      // Add another index group of zeroes
+      p_Output.meshletsData.push_back(0);
+    }
+
+    meshInfo.meshletIndexCount += meshlet.triangleCount * 3;
+
+    p_Output.meshlets.push_back(meshlet);
+
+    p_Output.meshletsIndexCount += indexGroupCount;
+  }
+
+  while (p_Output.meshlets.size() % 32)
+    p_Output.meshlets.push_back(GpuMeshlet());
+}
 
-      m_MeshletsVertexData.push_back(meshletVertexData);
+void GpuDrivenRenderer::buildMeshletsSerial(
+    const std::vector<Mesh>& p_Meshes, MeshletBuildOutput& p_Output)
+{
+  p_Output = MeshletBuildOutput();
+  for (uint32_t p = 0; p < p_Meshes.size(); ++p)
+    appendMeshMeshlets(p_Meshes[p], p, p_Output);
+}
+
+void GpuDrivenRenderer::buildMeshlets(
+    const std::vector<Mesh>& p_Meshes, MeshletBuildOutput& p_Output)
+{
+  p_Output = MeshletBuildOutput();
+
+  const uint32_t numMeshes = uint32_t(p_Meshes.size());
+  if (numMeshes == 0)
+    return;
+
+  WorkerPool& pool = getWorkerPool();
+
+  // 1. Build every mesh into its own output with zero based offsets, biggest meshes first so the
+  // long jobs don't end up at the tail
+  std::vector<MeshletBuildOutput> meshOutputs(numMeshes);
+  std::vector<uint32_t> buildOrder(numMeshes);
+  for (uint32_t p = 0; p < numMeshes; ++p)
+    buildOrder[p] = p;
+  std::sort(buildOrder.begin(), buildOrder.end(), [&](uint32_t a, uint32_t b) {
+    return p_Meshes[a].NumIndices() > p_Meshes[b].NumIndices();
+  });
+
+  pool.parallelFor(numMeshes, [&](uint32_t i) {
+    const uint32_t p = buildOrder[i];
+    appendMeshMeshlets(p_Meshes[p], p, meshOutputs[p]);
+  });
+
+  // 2. Prefix sums give every mesh its final place in the shared streams. The per mesh meshlet
+  // lists are already padded to 32, same as the serial builder.
+  struct MeshBases
+  {
+    uint32_t meshlet;
+    uint32_t data;
+    uint32_t vertex;
+  };
+  std::vector<MeshBases> bases(numMeshes);
+  uint64_t numMeshlets = 0;
+  uint64_t numData = 0;
+  uint64_t numVertices = 0;
+  for (uint32_t p = 0; p < numMeshes; ++p)
+  {
+    bases[p] = {uint32_t(numMeshlets), uint32_t(numData), uint32_t(numVertices)};
+    numMeshlets += meshOutputs[p].meshlets.size();
+    numData += meshOutputs[p].meshletsData.size();
+    numVertices += meshOutputs[p].vertexPositions.size();
+    p_Output.meshletsIndexCount += meshOutputs[p].meshletsIndexCount;
+  }
+  assert(numData <= UINT32_MAX && numVertices <= UINT32_MAX);
+
+  p_Output.meshlets.resize(numMeshlets);
+  p_Output.meshletsData.resize(numData);
+  p_Output.vertexPositions.resize(numVertices);
+  p_Output.vertexData.resize(numVertices);
+  p_Output.meshInfos.resize(numMeshes);
+
+  // 3. Scatter, every mesh writes a disjoint range so no locking is needed
+  pool.parallelFor(numMeshes, [&](uint32_t p) {
+    const MeshletBuildOutput& src = meshOutputs[p];
+    const MeshBases& base = bases[p];
+
+    MeshletMeshInfo meshInfo = src.meshInfos[0];
+    meshInfo.meshletOffset += base.meshlet;
+    p_Output.meshInfos[p] = meshInfo;
+
+    std::copy(
+        src.vertexPositions.begin(),
+        src.vertexPositions.end(),
+        p_Output.vertexPositions.begin() + base.vertex);
+    std::copy(
+        src.vertexData.begin(), src.vertexData.end(), p_Output.vertexData.begin() + base.vertex);
+    std::copy(
+        src.meshletsData.begin(),
+        src.meshletsData.end(),
+        p_Output.meshletsData.begin() + base.data);
+    std::copy(src.meshlets.begin(), src.meshlets.end(), p_Output.meshlets.begin() + base.meshlet);
+
+    // Rebase the real meshlets, the padding ones stay zeroed
+    for (uint32_t m = 0; m < src.meshInfos[0].meshletCount; ++m)
+    {
+      GpuMeshlet& meshlet = p_Output.meshlets[base.meshlet + m];
+      meshlet.dataOffset += base.data;
+      for (uint32_t v = 0; v < meshlet.vertexCount; ++v)
+        p_Output.meshletsData[meshlet.dataOffset + v] += base.vertex;
     }
+  });
+}
 
-    // Cache meshlet offset
-    mesh_.m_MeshletOffset = m_Meshlets.size();
-    mesh_.m_MeshletCount = meshletCount;
-    mesh_.m_MeshletIndexCount = 0;
+bool GpuDrivenRenderer::validateMeshletBuild(const std::vector<Mesh>& p_Meshes)
+{
+  MeshletBuildOutput serial;
+  MeshletBuildOutput parallel;
+
+  Timer timer;
+  timer.init();
+  buildMeshletsSerial(p_Meshes, serial);
+  timer.update();
+  const double serialMs = timer.m_DeltaMillisecondsD;
+  buildMeshlets(p_Meshes, parallel);
+  timer.update();
+  const double parallelMs = timer.m_DeltaMillisecondsD;
+
+  auto sameBytes = [](const auto& a, const auto& b) {
+    return a.size() == b.size() &&
+           (a.empty() || memcmp(a.data(), b.data(), sizeof(a[0]) * a.size()) == 0);
+  };
+  const bool identical = serial.meshletsIndexCount == parallel.meshletsIndexCount &&
+                         sameBytes(serial.meshlets, parallel.meshlets) &&
+                         sameBytes(serial.meshletsData, parallel.meshletsData) &&
+                         sameBytes(serial.vertexPositions, parallel.vertexPositions) &&
+                         sameBytes(serial.vertexData, parallel.vertexData) &&
+                         sameBytes(serial.meshInfos, parallel.meshInfos);
+
+  writeLog(
+      "validateMeshletBuild: %zu meshes, serial %.2f ms, parallel %.2f ms on %u threads, %s",
+      p_Meshes.size(),
+      serialMs,
+      parallelMs,
+      getWorkerPool().numThreads(),
+      identical ? "identical" : "MISMATCH");
+
+  return identical;
+}
 
-    // 5. Extract additional data (bounding sphere and cone) for each meshlet:
-    // Append meshlet data
-    for (uint32_t m = 0; m < meshletCount; ++m)
+bool GpuDrivenRenderer::validateWideIndexMeshlets(uint32_t p_GridSize)
+{
+  const uint64_t numVertices = Mesh::GridVertexCount(p_GridSize);
+  const IndexType indexType = Mesh::IndexTypeForVertexCount(numVertices);
+
+  std::vector<MeshVertex> vertices(numVertices);
+  std::vector<uint8_t> indices(Mesh::GridIndexCount(p_GridSize) * Mesh::IndexSize(indexType));
+
+  // CPU-only mesh, the buffer addresses are never used
+  std::vector<Mesh> meshes(1);
+  meshes[0].InitGrid(p_GridSize, 0.1f, 0, vertices.data(), indices.data());
+  meshes[0].InitCommon(vertices.data(), indices.data(), 0, 0, 0, 0);
+
+  Timer timer;
+  timer.init();
+  MeshletBuildOutput output;
+  buildMeshlets(meshes, output);
+  timer.update();
+
+  // The packed triangles are padded with all-zero ones, the grid itself has no degenerates
+  const MeshletMeshInfo& meshInfo = output.meshInfos[0];
+  uint64_t numTriangles = 0;
+  bool valid = meshes[0].IndexBufferType() == indexType;
+  for (uint32_t m = 0; m < meshInfo.meshletCount; ++m)
+  {
+    const GpuMeshlet& meshlet = output.meshlets[meshInfo.meshletOffset + m];
+    for (uint32_t v = 0; v < meshlet.vertexCount; ++v)
+      valid = valid && output.meshletsData[meshlet.dataOffset + v] < numVertices;
+
+    const uint32_t* indexGroups = &output.meshletsData[meshlet.dataOffset + meshlet.vertexCount];
+    auto localIndex = [indexGroups](uint32_t i) {
+      return (indexGroups[i / 4] >> (i % 4 * 8)) & 0xff;
+    };
+    for (uint32_t t = 0; t < meshlet.triangleCount; ++t)
     {
-      meshopt_Meshlet& localMeshlet = localMeshlets[m];
+      const uint32_t a = localIndex(t * 3 + 0);
+      const uint32_t b = localIndex(t * 3 + 1);
+      const uint32_t c = localIndex(t * 3 + 2);
+      if (a == b && b == c)
+        continue;
+
+      valid = valid && a < meshlet.vertexCount && b < meshlet.vertexCount &&
+              c < meshlet.vertexCount;
+      ++numTriangles;
+    }
+  }
+  valid = valid && numTriangles * 3 == meshes[0].NumIndices();
 
-      meshopt_Bounds meshlet_bounds = meshopt_computeMeshletBounds(
-          meshletVertexIndices.data() + localMeshlet.vertex_offset,
-          meshletTriangles.data() + localMeshlet.triangle_offset,
-          localMeshlet.triangle_count,
-          flattenedVerts.data(),
-          numVertices,
-          sizeof(glm::vec3));
+  writeLog(
+      "validateWideIndexMeshlets: %llu vertices, %u-bit indices, %u meshlets in %.2f ms, %s",
+      numVertices,
+      Mesh::IndexSize(indexType) * 8,
+      meshInfo.meshletCount,
+      timer.m_DeltaMillisecondsD,
+      valid ? "passed" : "FAILED");
 
-      GpuMeshlet meshlet{};
-      meshlet.dataOffset = m_MeshletsData.size();
-      meshlet.vertexCount = localMeshlet.vertex_count;
-      meshlet.triangleCount = localMeshlet.triangle_count;
+  return valid;
+}
 
-      meshlet.center =
-          glm::vec3{meshlet_bounds.center[0], meshlet_bounds.center[1], meshlet_bounds.center[2]};
-      meshlet.radius = meshlet_bounds.radius;
+//---------------------------------------------------------------------------//
+// Meshlet cache
+//---------------------------------------------------------------------------//
+// Layout: MeshletCacheHeader, one MeshletCacheMesh per source mesh, then the builder output
+// streams. A mesh is identified by a hash of its vertices, indices and AABB, all of them have
+// to match (in order) for the cache to be used. Bump MeshletCacheVersion when the builder or
+// the Gpu* layouts change.
 
-      meshlet.coneAxis[0] = meshlet_bounds.cone_axis_s8[0];
-      meshlet.coneAxis[1] = meshlet_bounds.cone_axis_s8[1];
-      meshlet.coneAxis[2] = meshlet_bounds.cone_axis_s8[2];
+static constexpr uint32_t MeshletCacheMagic = 0x4C48534D; // 'MSHL'
+static constexpr uint32_t MeshletCacheVersion = 1;
 
-      meshlet.coneCutoff = meshlet_bounds.cone_cutoff_s8;
-      meshlet.meshIndex = m_Meshes.size();
+struct MeshletCacheHeader
+{
+  uint32_t Magic;
+  uint32_t Version;
+  uint64_t BuilderKey;
+  uint64_t FileSize;
+
+  uint32_t NumMeshes;
+  uint32_t MeshletsIndexCount;
+  uint64_t NumMeshlets;
+  uint64_t NumMeshletsData;
+  uint64_t NumVertices;
+
+  uint64_t MeshesOffset;
+  uint64_t MeshletsOffset;
+  uint64_t MeshletsDataOffset;
+  uint64_t VertexPositionsOffset;
+  uint64_t VertexDataOffset;
+};
 
-      // Resize data array
-      const uint32_t indexGroupCount = (localMeshlet.triangle_count * 3 + 3) / 4;
-      m_MeshletsData.reserve(m_MeshletsData.size() + localMeshlet.vertex_count + indexGroupCount);
+struct MeshletCacheMesh
+{
+  uint64_t Hash;
+  uint64_t Padding;
+  MeshletMeshInfo Info;
+};
 
-      for (uint32_t i = 0; i < meshlet.vertexCount; ++i)
-      {
-        const uint32_t vertexIndex =
-            meshletVertexOffset + meshletVertexIndices[localMeshlet.vertex_offset + i];
-        m_MeshletsData.push_back(vertexIndex);
-      }
+static uint64_t computeMeshletBuilderKey()
+{
+  uint64_t key = hashValue(MeshletCacheVersion, 14695981039346656037ull);
+  key = hashValue(uint64_t(MeshletMaxVertices), key);
+  key = hashValue(uint64_t(MeshletMaxTriangles), key);
+  key = hashValue(MeshletConeWeight, key);
+  key = hashValue(uint32_t(sizeof(GpuMeshlet)), key);
+  key = hashValue(uint32_t(sizeof(GpuMeshletVertexPosition)), key);
+  key = hashValue(uint32_t(sizeof(GpuMeshletVertexData)), key);
+  return key;
+}
 
-      // Store indices as uint32
-      // NOTE(marco): we write 4 indices at at time, it will come in handy in the mesh shader
-      const uint32_t* indexGroups =
-          reinterpret_cast<const uint32_t*>(meshletTriangles.data() + localMeshlet.triangle_offset);
-      for (uint32_t i = 0; i < indexGroupCount; ++i)
-      {
-        const uint32_t index_group = indexGroups[i];
-        m_MeshletsData.push_back(index_group);
-      }
+// Checks that a cached mesh's meshlets and everything they index lie inside the cached streams,
+// so a truncated or stale file can't send the copies or the GPU out of bounds
+static bool validateCacheMesh(
+    const MeshletCacheHeader& p_Header,
+    const MeshletCacheMesh& p_Mesh,
+    uint32_t p_MeshIndex,
+    const GpuMeshlet* p_Meshlets,
+    const uint32_t* p_MeshletsData)
+{
+  const MeshletMeshInfo& info = p_Mesh.Info;
+  if (uint64_t(info.meshletOffset) + info.meshletCount > p_Header.NumMeshlets)
+    return false;
 
-      // Writing in group of fours can be problematic, if there are non multiple of 3
-      // indices a triangle can be shared between meshlets.
-      // We need to add some padding for that.
-      // This is visible only if we emulate meshlets (not using actual mesh shaders),
-      // so probably there are controls at driver level that avoid this problems when using mesh
-      // shaders. Check for the last 3 indices: if last one are two are zero, then add one or two
-      // groups of empty triangles.
-      uint32_t lastIndexGroup = indexGroups[indexGroupCount - 1];
-      uint32_t lastIndex = (lastIndexGroup >> 8) & 0xff;
-      uint32_t secondLastIndex = (lastIndexGroup >> 16) & 0xff;
-      uint32_t thirdLastIndex = (lastIndexGroup >> 24) & 0xff;
-      if (lastIndex != 0 && thirdLastIndex == 0)
-      {
+  for (uint32_t m = 0; m < info.meshletCount; ++m)
+  {
+    const GpuMeshlet& meshlet = p_Meshlets[info.meshletOffset + m];
+    const uint64_t indexGroupCount = (uint64_t(meshlet.triangleCount) * 3 + 3) / 4;
+    if (meshlet.meshIndex != p_MeshIndex ||
+        uint64_t(meshlet.dataOffset) + meshlet.vertexCount + indexGroupCount >
+            p_Header.NumMeshletsData)
+      return false;
+
+    for (uint32_t v = 0; v < meshlet.vertexCount; ++v)
+    {
+      if (p_MeshletsData[meshlet.dataOffset + v] >= p_Header.NumVertices)
+        return false;
+    }
+  }
+  return true;
+}
 
-        if (secondLastIndex != 0)
-        {
-          // Add a single index group of zeroes
-          m_MeshletsData.push_back(0);
-          meshlet.triangleCount++;
-        }
+static uint64_t computeMeshHash(const Mesh& p_Mesh)
+{
+  uint64_t hash = hashValue(p_Mesh.NumVertices(), 14695981039346656037ull);
+  hash = hashValue(p_Mesh.NumIndices(), hash);
+  hash = hashValue(p_Mesh.IndexBufferType(), hash);
+  hash = hashValue(p_Mesh.AABBMin(), hash);
+  hash = hashValue(p_Mesh.AABBMax(), hash);
+  hash = hashBytes(p_Mesh.Vertices(), sizeof(MeshVertex) * p_Mesh.NumVertices(), hash);
+  hash = hashBytes(p_Mesh.Indices(), p_Mesh.IndexSize() * p_Mesh.NumIndices(), hash);
+  return hash;
+}
 
-        meshlet.triangleCount++;
-        // Add another index group of zeroes
-        m_MeshletsData.push_back(0);
-      }
+bool GpuDrivenRenderer::saveMeshletCache(
+    const wchar_t* p_CachePath,
+    const std::vector<Mesh>& p_Meshes,
+    const MeshletBuildOutput& p_Output)
+{
+  assert(p_Meshes.size() == p_Output.meshInfos.size());
 
-      mesh_.m_MeshletIndexCount += meshlet.triangleCount * 3;
+  std::vector<MeshletCacheMesh> cacheMeshes(p_Meshes.size());
+  for (uint64_t i = 0; i < p_Meshes.size(); ++i)
+  {
+    cacheMeshes[i] = {};
+    cacheMeshes[i].Hash = computeMeshHash(p_Meshes[i]);
+    cacheMeshes[i].Info = p_Output.meshInfos[i];
+  }
 
-      m_Meshlets.push_back(meshlet);
+  MeshletCacheHeader header = {};
+  header.Magic = MeshletCacheMagic;
+  header.Version = MeshletCacheVersion;
+  header.BuilderKey = computeMeshletBuilderKey();
+  header.NumMeshes = uint32_t(p_Meshes.size());
+  header.MeshletsIndexCount = p_Output.meshletsIndexCount;
+  header.NumMeshlets = p_Output.meshlets.size();
+  header.NumMeshletsData = p_Output.meshletsData.size();
+  header.NumVertices = p_Output.vertexPositions.size();
+  assert(p_Output.vertexPositions.size() == p_Output.vertexData.size());
+
+  std::vector<uint8_t> blob;
+  appendBlobSection(blob, &header, 1);
+  header.MeshesOffset = appendBlobSection(blob, cacheMeshes.data(), cacheMeshes.size());
+  header.MeshletsOffset =
+      appendBlobSection(blob, p_Output.meshlets.data(), p_Output.meshlets.size());
+  header.MeshletsDataOffset =
+      appendBlobSection(blob, p_Output.meshletsData.data(), p_Output.meshletsData.size());
+  header.VertexPositionsOffset =
+      appendBlobSection(blob, p_Output.vertexPositions.data(), p_Output.vertexPositions.size());
+  header.VertexDataOffset =
+      appendBlobSection(blob, p_Output.vertexData.data(), p_Output.vertexData.size());
+  blob.resize(alignUp<uint64_t>(blob.size(), BlobSectionAlignment));
+
+  header.FileSize = blob.size();
+  memcpy(blob.data(), &header, sizeof(header));
+
+  if (writeDataToFile(p_CachePath, blob.data(), blob.size()) == false)
+  {
+    writeLog("Failed to write meshlet cache '%ls'", p_CachePath);
+    return false;
+  }
+  return true;
+}
 
-      m_MeshletsIndexCount += indexGroupCount;
+bool GpuDrivenRenderer::loadMeshletCache(
+    const wchar_t* p_CachePath, const std::vector<Mesh>& p_Meshes, MeshletBuildOutput& p_Output)
+{
+  MappedFile file;
+  if (file.init(p_CachePath) == false || file.m_Size < sizeof(MeshletCacheHeader))
+    return false;
+
+  const MeshletCacheHeader& header = *file.at<MeshletCacheHeader>(0);
+  bool valid = header.Magic == MeshletCacheMagic && header.Version == MeshletCacheVersion &&
+               header.BuilderKey == computeMeshletBuilderKey() && header.FileSize == file.m_Size &&
+               header.NumMeshes == p_Meshes.size();
+
+  valid = valid &&
+          file.containsSection(header.MeshesOffset, sizeof(MeshletCacheMesh), header.NumMeshes) &&
+          file.containsSection(header.MeshletsOffset, sizeof(GpuMeshlet), header.NumMeshlets) &&
+          file.containsSection(
+              header.MeshletsDataOffset, sizeof(uint32_t), header.NumMeshletsData) &&
+          file.containsSection(
+              header.VertexPositionsOffset,
+              sizeof(GpuMeshletVertexPosition),
+              header.NumVertices) &&
+          file.containsSection(
+              header.VertexDataOffset, sizeof(GpuMeshletVertexData), header.NumVertices);
+  if (valid == false)
+    return false;
+
+  const MeshletCacheMesh* cacheMeshes = file.at<MeshletCacheMesh>(header.MeshesOffset);
+  const GpuMeshlet* meshlets = file.at<GpuMeshlet>(header.MeshletsOffset);
+  const uint32_t* meshletsData = file.at<uint32_t>(header.MeshletsDataOffset);
+  for (uint32_t i = 0; i < header.NumMeshes; ++i)
+  {
+    if (cacheMeshes[i].Hash != computeMeshHash(p_Meshes[i]))
+      return false;
+    if (validateCacheMesh(header, cacheMeshes[i], i, meshlets, meshletsData) == false)
+    {
+      writeLog("Meshlet cache '%ls' has an out of bounds mesh %u, rebuilding", p_CachePath, i);
+      return false;
     }
+  }
 
-    mesh_.m_GpuMeshIndex = m_Meshes.size();
+  p_Output.meshInfos.resize(header.NumMeshes);
+  for (uint64_t i = 0; i < p_Meshes.size(); ++i)
+    p_Output.meshInfos[i] = cacheMeshes[i].Info;
 
-    // Add mesh with all data
-    m_Meshes.push_back(mesh_);
+  const GpuMeshletVertexPosition* vertexPositions =
+      file.at<GpuMeshletVertexPosition>(header.VertexPositionsOffset);
+  const GpuMeshletVertexData* vertexData =
+      file.at<GpuMeshletVertexData>(header.VertexDataOffset);
 
-    while (m_Meshlets.size() % 32)
-      m_Meshlets.push_back(GpuMeshlet());
+  p_Output.meshlets.assign(meshlets, meshlets + header.NumMeshlets);
+  p_Output.meshletsData.assign(meshletsData, meshletsData + header.NumMeshletsData);
+  p_Output.vertexPositions.assign(vertexPositions, vertexPositions + header.NumVertices);
+  p_Output.vertexData.assign(vertexData, vertexData + header.NumVertices);
+  p_Output.meshletsIndexCount = header.MeshletsIndexCount;
 
-    // mesh instances
+  return true;
+}
+
+void GpuDrivenRenderer::benchmarkMeshletCache(
+    const std::vector<Mesh>& p_Meshes, const wchar_t* p_CachePath, uint32_t p_NumIterations)
+{
+  assert(p_NumIterations > 0);
+
+  Timer timer;
+  timer.init();
+
+  MeshletBuildOutput built;
+  double buildMs = 0.0;
+  for (uint32_t i = 0; i < p_NumIterations; ++i)
+  {
+    timer.update();
+    buildMeshlets(p_Meshes, built);
+    timer.update();
+    buildMs += timer.m_DeltaMillisecondsD;
+  }
+
+  if (saveMeshletCache(p_CachePath, p_Meshes, built) == false)
+    return;
+
+  MeshletBuildOutput loaded;
+  double loadMs = 0.0;
+  for (uint32_t i = 0; i < p_NumIterations; ++i)
+  {
+    timer.update();
+    const bool success = loadMeshletCache(p_CachePath, p_Meshes, loaded);
+    timer.update();
+    loadMs += timer.m_DeltaMillisecondsD;
+
+    if (success == false)
     {
-      MeshInstance meshInstance{};
-      // Assign scene graph node index
-      meshInstance.sceneGraphNodeIndex = 0;
+      writeLog("benchmarkMeshletCache: failed to load '%ls'", p_CachePath);
+      return;
+    }
+  }
 
-      // glTF::MeshPrimitive& mesh_primitive = gltf_mesh.primitives[primitive_index];
+  const bool matches =
+      built.meshletsIndexCount == loaded.meshletsIndexCount &&
+      built.meshlets.size() == loaded.meshlets.size() &&
+      built.vertexPositions.size() == loaded.vertexPositions.size() &&
+      built.meshletsData == loaded.meshletsData &&
+      memcmp(
+          built.meshlets.data(),
+          loaded.meshlets.data(),
+          sizeof(GpuMeshlet) * built.meshlets.size()) == 0;
+
+  writeLog(
+      "benchmarkMeshletCache: %zu meshes, %zu meshlets, build %.2f ms, load %.2f ms (avg of %u), "
+      "data %s",
+      p_Meshes.size(),
+      built.meshlets.size(),
+      buildMs / p_NumIterations,
+      loadMs / p_NumIterations,
+      p_NumIterations,
+      matches ? "matches" : "MISMATCH");
+}
 
-      // Cache parent mesh
-      meshInstance.mesh = &meshes[p];
+void GpuDrivenRenderer::addMeshes(std::vector<Mesh>& meshes, const wchar_t* p_CachePath)
+{
+  if (!m_Enabled)
+    return;
 
-      // TODO(OM): Handle material per instance
+  assert(0 == m_MeshletsVertexPositions.size());
+  assert(0 == m_MeshletsVertexData.size());
+  assert(0 == m_MeshletsData.size());
+  assert(0 == m_Meshlets.size());
+  assert(0 == m_Meshes.size());
+  assert(0 == m_MeshInstances.size());
+
+  MeshletBuildOutput output;
+  if (p_CachePath == nullptr || loadMeshletCache(p_CachePath, meshes, output) == false)
+  {
+    buildMeshlets(meshes, output);
+    if (p_CachePath != nullptr)
+      saveMeshletCache(p_CachePath, meshes, output);
+  }
+
+  m_Meshlets = std::move(output.meshlets);
+  m_MeshletsVertexPositions = std::move(output.vertexPositions);
+  m_MeshletsVertexData = std::move(output.vertexData);
+  m_MeshletsData = std::move(output.meshletsData);
+  m_MeshletsIndexCount = output.meshletsIndexCount;
+
+  // The scene meshes are already in world space, their instances sit at the root unmoved
+  m_SceneGraph.clear();
+  m_SceneRootNode = m_SceneGraph.addNode(SceneGraph::InvalidNode);
+
+  uint32_t totalMeshlets = 0;
+  for (uint32_t p = 0; p < meshes.size(); ++p)
+  {
+    Mesh mesh_ = meshes[p];
 
-      // Cache gpu mesh instance index, used to retrieve data on gpu.
-      meshInstance.gpuMeshInstanceIndex = m_MeshInstances.size();
+    const MeshletMeshInfo& meshInfo = output.meshInfos[p];
+    mesh_.m_BoundingSphere = meshInfo.boundingSphere;
+    mesh_.m_MeshletOffset = meshInfo.meshletOffset;
+    mesh_.m_MeshletCount = meshInfo.meshletCount;
+    mesh_.m_MeshletIndexCount = meshInfo.meshletIndexCount;
+    mesh_.m_GpuMeshIndex = m_Meshes.size();
 
+    // Add mesh with all data
+    m_Meshes.push_back(mesh_);
+
+    // mesh instances
+    {
+      // TODO(OM): Handle material per instance
       // TODO(OM): Skinning
+      addInstance(uint32_t(p), m_SceneRootNode, glm::vec3(0.0f));
 
-      totalMeshlets += meshInstance.mesh->m_MeshletCount;
+      totalMeshlets += meshInfo.meshletCount;
 
       printf("Current total meshlet instances %u\n", totalMeshlets);
-
-      m_MeshInstances.push_back(meshInstance);
     }
   }
 }
 
+uint32_t GpuDrivenRenderer::addInstance(
+    uint32_t p_MeshIndex,
+    uint32_t p_ParentNode,
+    const glm::vec3& p_Translation,
+    const glm::quat& p_Rotation,
+    const glm::vec3& p_Scale)
+{
+  assert(p_MeshIndex < m_Meshes.size());
+  assert(m_MeshInstancesBuffer.resource() == nullptr);
+
+  MeshInstance meshInstance{};
+  meshInstance.meshIndex = p_MeshIndex;
+  meshInstance.sceneGraphNodeIndex = m_SceneGraph.addNode(
+      p_ParentNode != SceneGraph::InvalidNode ? p_ParentNode : m_SceneRootNode,
+      p_Translation,
+      p_Rotation,
+      p_Scale);
+
+  // Cache gpu mesh instance index, used to retrieve data on gpu.
+  meshInstance.gpuMeshInstanceIndex = uint32_t(m_MeshInstances.size());
+  m_MeshInstances.push_back(meshInstance);
+
+  GpuMeshInstanceData gpuInstance = {};
+  gpuInstance.meshIndex = p_MeshIndex;
+  m_GpuMeshInstances.push_back(gpuInstance);
+
+  return meshInstance.gpuMeshInstanceIndex;
+}
+
 void GpuDrivenRenderer::createResources(ID3D12Device2* p_Device)
 {
   if (!m_Enabled)
@@ -542,6 +1143,21 @@ void GpuDrivenRenderer::createResources(ID3D12Device2* p_Device)
         m_CullingShader);
   }
 
+  // Depth pyramid shader
+  {
+    std::wstring cullingShaderPath = ShaderPath + L"Shaders\\Culling.hlsl";
+    const D3D_SHADER_MACRO defines[] = {{"DEPTH_PYRAMID", "1"}, {NULL, NULL}};
+    compileShader(
+        "depth pyramid",
+        cullingShaderPath.c_str(),
+        arrayCountU8(defines),
+        defines,
+        compileFlags,
+        ShaderType::Compute,
+        "DepthPyramidCS",
+        m_DepthPyramidShader);
+  }
+
   // Gbuffer shaders
 
   //... add compiler support for mesh and task (just add DXC once and for all)
@@ -583,7 +1199,9 @@ void GpuDrivenRenderer::createResources(ID3D12Device2* p_Device)
         m_GbufferPixelShader);
   }
 
-  assert(m_CullingShader && m_GbufferTaskShader && m_GbufferMeshShader && m_GbufferPixelShader);
+  assert(
+      m_CullingShader && m_DepthPyramidShader && m_GbufferTaskShader && m_GbufferMeshShader &&
+      m_GbufferPixelShader);
 
   // Create psos
   m_PSOs.resize(NumRenderPasses);
@@ -598,6 +1216,17 @@ void GpuDrivenRenderer::createResources(ID3D12Device2* p_Device)
       m_PSOs[RenderPass_GpuCulling]->SetName(L"Gpu Culling PSO");
     }
 
+    // Depth pyramid PSO
+    {
+      D3D12_COMPUTE_PIPELINE_STATE_DESC psoDesc = {};
+      psoDesc.pRootSignature = m_RootSig;
+
+      psoDesc.CS = CD3DX12_SHADER_BYTECODE(m_DepthPyramidShader.GetInterfacePtr());
+      p_Device->CreateComputePipelineState(
+          &psoDesc, IID_PPV_ARGS(&m_PSOs[RenderPass_DepthPyramid]));
+      m_PSOs[RenderPass_DepthPyramid]->SetName(L"Depth Pyramid PSO");
+    }
+
     // Amplification/Mesh/Pixel shader PSO for gbuffer pass:
     {
       // TODO: Centralize this to match traditional renderer
@@ -702,27 +1331,32 @@ void GpuDrivenRenderer::createResources(ID3D12Device2* p_Device)
 
   // mesh bound
   {
+    std::vector<glm::vec4> meshBounds(m_Meshes.size());
+    for (uint64_t i = 0; i < m_Meshes.size(); ++i)
+      meshBounds[i] = m_Meshes[i].m_BoundingSphere;
+
     StructuredBufferInit sbInit;
     sbInit.Stride = sizeof(glm::vec4);
     sbInit.NumElements = m_Meshes.size();
     sbInit.Dynamic = false;
-    sbInit.CPUAccessible = false; // does it need to be host visible ?
+    sbInit.CPUAccessible = false;
+    sbInit.InitData = meshBounds.data();
     m_MeshBoundsBuffer.init(sbInit);
     m_MeshBoundsBuffer.resource()->SetName(L"mesh_bound_sb");
   }
 
-  // mesh instance
+  // mesh instance, rewritten every frame from m_GpuMeshInstances
   {
     StructuredBufferInit sbInit;
     sbInit.Stride = sizeof(GpuMeshInstanceData);
     sbInit.NumElements = m_MeshInstances.size();
-    sbInit.Dynamic = false;
-    sbInit.CPUAccessible = false; // does it need to be host visible ?
-    m_MeshBoundsBuffer.init(sbInit);
-    m_MeshBoundsBuffer.resource()->SetName(L"mesh_instances_sb");
+    sbInit.Dynamic = true;
+    sbInit.CPUAccessible = true;
+    m_MeshInstancesBuffer.init(sbInit);
+    m_MeshInstancesBuffer.resource()->SetName(L"mesh_instances_sb");
   }
 
-  // Create indirect buffers, dynamic (i.e., need multiple buffering)
+  // Create indirect buffers, written by the culling passes on the gpu
   {//{
    //   RenderTextureInit rtInit;
    //   rtInit.Width = p_Width;
@@ -742,9 +1376,10 @@ void GpuDrivenRenderer::createResources(ID3D12Device2* p_Device)
       StructuredBufferInit sbInit;
       sbInit.Stride = sizeof(GpuMeshDrawCommand);
       sbInit.NumElements = m_MeshInstances.size() * 2;
-      sbInit.Dynamic = true;
-      sbInit.InitialState = D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT;
+      sbInit.Dynamic = false;
+      sbInit.InitialState = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
       sbInit.CPUAccessible = false;
+      sbInit.CreateUAV = true;
       m_MeshTaskIndirectEarlyCommands.init(sbInit);
       m_MeshTaskIndirectEarlyCommands.resource()->SetName(L"early_draw_commands_sb");
     }
@@ -753,9 +1388,10 @@ void GpuDrivenRenderer::createResources(ID3D12Device2* p_Device)
       StructuredBufferInit sbInit;
       sbInit.Stride = sizeof(GpuMeshDrawCommand);
       sbInit.NumElements = m_MeshInstances.size() * 2;
-      sbInit.Dynamic = true;
-      sbInit.InitialState = D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT;
+      sbInit.Dynamic = false;
+      sbInit.InitialState = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
       sbInit.CPUAccessible = false;
+      sbInit.CreateUAV = true;
       m_MeshTaskIndirectCulledCommands.init(sbInit);
       m_MeshTaskIndirectCulledCommands.resource()->SetName(L"culled_draw_commands_sb");
     }
@@ -764,9 +1400,10 @@ void GpuDrivenRenderer::createResources(ID3D12Device2* p_Device)
       StructuredBufferInit sbInit;
       sbInit.Stride = sizeof(GpuMeshDrawCommand);
       sbInit.NumElements = m_MeshInstances.size() * 2;
-      sbInit.Dynamic = true;
-      sbInit.InitialState = D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT;
+      sbInit.Dynamic = false;
+      sbInit.InitialState = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
       sbInit.CPUAccessible = false;
+      sbInit.CreateUAV = true;
       m_MeshTaskIndirectLateCommands.init(sbInit);
       m_MeshTaskIndirectLateCommands.resource()->SetName(L"late_draw_commands_sb");
     }
@@ -798,19 +1435,7 @@ void GpuDrivenRenderer::createResources(ID3D12Device2* p_Device)
     {
       StructuredBufferInit sbInit;
       sbInit.Stride = sizeof(GpuMeshDrawCounts);
-      sbInit.NumElements = m_MeshInstances.size() * 2;
-      sbInit.Dynamic = false;
-      sbInit.InitialState = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
-      sbInit.CPUAccessible = false;
-      sbInit.CreateUAV = true;
-      m_MeshTaskIndirectCountEarly.init(sbInit);
-      m_MeshTaskIndirectCountEarly.resource()->SetName(L"early_mesh_count_sb");
-    }
-
-    {
-      StructuredBufferInit sbInit;
-      sbInit.Stride = sizeof(GpuMeshDrawCounts);
-      sbInit.NumElements = m_MeshInstances.size() * 2;
+      sbInit.NumElements = 1;
       sbInit.Dynamic = true;
       sbInit.InitialState = D3D12_RESOURCE_STATE_COPY_SOURCE;
       sbInit.CPUAccessible = true;
@@ -823,9 +1448,10 @@ void GpuDrivenRenderer::createResources(ID3D12Device2* p_Device)
       StructuredBufferInit sbInit;
       sbInit.Stride = sizeof(GpuMeshDrawCounts);
       sbInit.NumElements = 1;
-      sbInit.Dynamic = true;
-      sbInit.InitialState = D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT;
+      sbInit.Dynamic = false;
+      sbInit.InitialState = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
       sbInit.CPUAccessible = false;
+      sbInit.CreateUAV = true;
       m_MeshTaskIndirectCountLate.init(sbInit);
       m_MeshTaskIndirectCountLate.resource()->SetName(L"late_mesh_count_sb");
     }
@@ -962,6 +1588,21 @@ void GpuDrivenRenderer::uploadGpuData()
 
   }
 
+  // Instance transforms, only the instances whose node moved get new matrices. The buffer is
+  // versioned per frame so all of them are copied.
+  m_SceneGraph.update(&getWorkerPool());
+  for (uint64_t i = 0; i < m_MeshInstances.size(); ++i)
+  {
+    const uint32_t node = m_MeshInstances[i].sceneGraphNodeIndex;
+    if (m_SceneGraph.worldChanged(node))
+    {
+      m_GpuMeshInstances[i].world = m_SceneGraph.worldMatrix(node);
+      m_GpuMeshInstances[i].inverseWorld = glm::inverse(m_GpuMeshInstances[i].world);
+    }
+  }
+  if (m_GpuMeshInstances.empty() == false)
+    m_MeshInstancesBuffer.mapAndSetData(m_GpuMeshInstances.data(), m_GpuMeshInstances.size());
+
 
     /*
   struct alignas(16) GpuMaterialData
@@ -1024,270 +1665,365 @@ void GpuDrivenRenderer::uploadGpuData()
 
     */
 
-
-  // TODO: Upload gpu bound and instance data as well
-
 }
 
 void GpuDrivenRenderer::render(ID3D12GraphicsCommandList* p_CmdList, const RenderDesc& p_RenderDesc)
 {
-  if (!m_Enabled)
+  if (!m_Enabled || m_MeshInstances.empty() || p_RenderDesc.Camera == nullptr)
     return;
 
   PIXBeginEvent(p_CmdList, 0, "Gpu Driven Rendering");
 
+  // Two phase occlusion culling, see OcclusionCulling.hpp:
+  //  - early cull and draw of the meshes visible in last frame's depth pyramid
+  //  - pyramid from the early depth, late cull and draw of what it shows and the early pass missed
+  //  - pyramid from the final depth for the next frame
+  //
+  // TODO: point light shadow pass
+  const uint32_t numInstances = uint32_t(m_MeshInstances.size());
+  const CameraBase& camera = *p_RenderDesc.Camera;
 
-  // TODOS:
-  /*
-  * 
-  * CullingEarlyPass 
-  * for now just pass through
-  * 
-  * GBufferPass::prepare_draws aka gbuffer_pass_early
-  * GBufferPass::render
-  * LateGBufferPass::prepare_draws aka gbuffer_pass_late
-  * LateGBufferPass::render
-  * 
-  * 
-  * both use: draw_mesh_task_indirect_count
-  * 
-  * 
-  * 
-  * 
-  * 
-  * CullingEarlyPass
-  * CullingEarlyPass::prepare_draws aka mesh_occlusion_early_pass
-  * CullingEarlyPass::render and frustum culling
-  * 
-  * CullingLatePass
-  * CullingLatePass::prepare_draws aka mesh_occlusion_late_pass
-  * CullingLatePass::render
-  * 
-  * 
-  * meshlet_pointshadows_
-  * PointlightShadowPass::prepare_draws
-  * PointlightShadowPass::render
-  * 
-  * 
-  * handle resize
-  * RenderScene::on_resize
-  * 
-  * 
-  */
-
-
-  // =========================================================================================
-  // Gpu Culling
-  // =========================================================================================
-
-  PIXBeginEvent(p_CmdList, 0, "Gpu Culling");
-
+  // Reset mesh draw counts
   GpuMeshDrawCounts& meshDrawCounts = m_MeshDrawCounts;
-  meshDrawCounts.opaqueMeshVisibleCount = 0;
-  meshDrawCounts.opaqueMeshCulledCount = 0;
-  meshDrawCounts.transparentMeshVisibleCount = 0;
-  meshDrawCounts.transparentMeshCulledCount = 0;
-
-  meshDrawCounts.totalCount = m_MeshInstances.size();
-
-  // TODO: pass HiZ level aka depth_pyramid_texture_index, 
-  meshDrawCounts.depthPyramidTextureIndex = m_DepthBuffer.getSrv();
-  meshDrawCounts.lateFlag = 0;
-  meshDrawCounts.meshletIndexCount = 0;
-  meshDrawCounts.dispatchTaskX = 0;
+  meshDrawCounts = {};
+  meshDrawCounts.totalCount = numInstances;
+  meshDrawCounts.depthPyramidTextureIndex = m_DepthPyramid.srv();
   meshDrawCounts.dispatchTaskY = 1;
   meshDrawCounts.dispatchTaskZ = 1;
 
-  // Reset mesh draw counts
-  m_MeshCountBufferCpuVisible.mapAndSetData(&meshDrawCounts, m_MeshInstances.size() * 2);
-
-  //use a cbuffer to pass totalCount and depthMap id to gpu
-  //in vk sample, "mesh_task_indirect_count_early_sb" bound at slot "11" and "13" is a cbuffer
-  //update other resources accordingly
-
-  // Prepare count buffers for copy
-  {
-    D3D12_RESOURCE_BARRIER barriers[2] = {};
-    barriers[0].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-    barriers[0].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
-    barriers[0].Transition.pResource = m_MeshTaskIndirectCountEarly.resource();
-    barriers[0].Transition.StateBefore = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
-    barriers[0].Transition.StateAfter = D3D12_RESOURCE_STATE_COPY_DEST;
-    barriers[0].Transition.Subresource = 0;
-
-    barriers[1].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-    barriers[1].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
-    barriers[1].Transition.pResource = m_MeshCountBuffer.resource();
-    barriers[1].Transition.StateBefore = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
-    barriers[1].Transition.StateAfter = D3D12_RESOURCE_STATE_COPY_DEST;
-    barriers[1].Transition.Subresource = 0;
-
-    p_CmdList->ResourceBarrier(_countof(barriers), barriers);
-  }
-
-  // TODO: Maybe try clear UAV uint method ?
-  // Though it has some edge cases
-  // https://learn.microsoft.com/en-us/windows/win32/api/d3d12/nf-d3d12-id3d12graphicscommandlist-clearunorderedaccessviewuint
+  const MapResult countsUpload = m_MeshCountBufferCpuVisible.m_InternalBuffer.mapAndSetData(
+      &meshDrawCounts, sizeof(GpuMeshDrawCounts));
 
-  // p_CmdList->ClearUnorderedAccessViewUint(
+  m_MeshCountBuffer.transition(
+      p_CmdList, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST);
+  m_MeshTaskIndirectCountLate.transition(
+      p_CmdList, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST);
 
   p_CmdList->CopyBufferRegion(
       m_MeshCountBuffer.resource(),
       0,
-      m_MeshCountBufferCpuVisible.resource(),
-      0,
+      countsUpload.Resource,
+      countsUpload.ResourceOffset,
       sizeof(GpuMeshDrawCounts));
-
   p_CmdList->CopyBufferRegion(
-      m_MeshTaskIndirectCountEarly.resource(),
-      0,
-      m_MeshCountBufferCpuVisible.resource(),
+      m_MeshTaskIndirectCountLate.resource(),
       0,
-      m_MeshInstances.size() * 2 * sizeof(GpuMeshDrawCounts));
+      countsUpload.Resource,
+      countsUpload.ResourceOffset,
+      sizeof(GpuMeshDrawCounts));
 
-  // Prepare count and command buffer for write
+  m_MeshCountBuffer.transition(
+      p_CmdList, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+  m_MeshTaskIndirectCountLate.transition(
+      p_CmdList, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+
+  // Set constant buffers
+  const OcclusionView view = OcclusionCulling::makeView(camera, m_Width, m_Height);
+  Uniforms cdata = {};
+  cdata.ViewProjection = glm::transpose(camera.ViewProjectionMatrix());
+  cdata.View = glm::transpose(camera.ViewMatrix());
+  cdata.Projection = glm::transpose(camera.ProjectionMatrix());
+  for (uint32_t i = 0; i < 6; ++i)
+    cdata.FrustumPlanes[i] = view.frustum.planes[i];
+  cdata.NearClip = camera.NearClip();
+  cdata.FarClip = camera.FarClip();
+  cdata.ScreenWidth = float(m_Width);
+  cdata.ScreenHeight = float(m_Height);
+  cdata.DepthPyramidWidth = uint32_t(m_DepthPyramid.width());
+  cdata.DepthPyramidHeight = uint32_t(m_DepthPyramid.height());
+  cdata.DepthPyramidNumMips = uint32_t(m_DepthPyramid.numMips());
+  cdata.LateFlag = 0;
+  cdata.PreviousDepthPyramidValid = m_DepthPyramidValid ? 1 : 0;
+  cdata.OcclusionCullingEnabled = AppSettings::EnableOcclusionCulling ? 1 : 0;
+  cdata.MeshInstanceCount = numInstances;
+  cdata.depthBufferSrv = m_DepthBuffer.getSrv();
+  cdata.meshBufferSrv = m_MeshesBuffer.m_SrvIndex;
+  cdata.meshBoundsBufferSrv = m_MeshBoundsBuffer.m_SrvIndex;
+  cdata.meshletBufferSrv = m_MeshletsBuffer.m_SrvIndex;
+  cdata.meshletDataBufferSrv = m_MeshletsDataBuffer.m_SrvIndex;
+  cdata.meshletVertexPositionBufferSrv = m_MeshletsVertexPosBuffer.m_SrvIndex;
+  cdata.previousDepthPyramidSrv = m_DepthPyramid.srv();
+  cdata.currentDepthPyramidSrv = m_EarlyDepthPyramid.srv();
+  cdata.meshInstanceBufferSrv = m_MeshInstancesBuffer.m_SrvIndex;
+
+  D3D12_CPU_DESCRIPTOR_HANDLE cullingUavs[NumUAVDescriptors] = {
+      m_MeshCountBuffer.m_Uav,
+      m_MeshTaskIndirectEarlyCommands.m_Uav,
+      m_MeshTaskIndirectLateCommands.m_Uav,
+      m_MeshTaskIndirectCountLate.m_Uav,
+  };
+
+  auto cullMeshes = [&](const char* p_Name)
   {
-    D3D12_RESOURCE_BARRIER barriers[2] = {};
-    barriers[0].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-    barriers[0].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
-    barriers[0].Transition.pResource = m_MeshTaskIndirectCountEarly.resource();
-    barriers[0].Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
-    barriers[0].Transition.StateAfter = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
-    barriers[0].Transition.Subresource = 0;
+    PIXBeginEvent(p_CmdList, 0, p_Name);
 
-    barriers[1].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-    barriers[1].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
-    barriers[1].Transition.pResource = m_MeshCountBuffer.resource();
-    barriers[1].Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
-    barriers[1].Transition.StateAfter = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
-    barriers[1].Transition.Subresource = 0;
+    p_CmdList->SetComputeRootSignature(m_RootSig);
+    p_CmdList->SetPipelineState(m_PSOs[RenderPass_GpuCulling]);
 
-    //barriers[2].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-    //barriers[2].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
-    //barriers[2].Transition.pResource = m_MeshTaskIndirectEarlyCommands.resource();
-    //barriers[2].Transition.StateBefore = D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT;
-    //barriers[2].Transition.StateAfter = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
-    //barriers[2].Transition.Subresource = 0;
+    BindStandardDescriptorTable(p_CmdList, RootParam_StandardDescriptors, CmdListMode::Compute);
+    BindTempConstantBuffer(p_CmdList, cdata, RootParam_Cbuffer, CmdListMode::Compute);
+    AppSettings::bindCBufferCompute(p_CmdList, RootParam_AppSettings);
+    BindTempDescriptorTable(
+        p_CmdList,
+        cullingUavs,
+        arrayCount(cullingUavs),
+        RootParam_UAVDescriptors,
+        CmdListMode::Compute);
 
-    p_CmdList->ResourceBarrier(_countof(barriers), barriers);
-  }
+    p_CmdList->Dispatch(DispatchSize(numInstances, 64), 1, 1);
 
-  p_CmdList->SetComputeRootSignature(m_RootSig);
-  p_CmdList->SetPipelineState(m_PSOs[RenderPass_GpuCulling]);
+    PIXEndEvent(p_CmdList);
+  };
 
-  BindStandardDescriptorTable(p_CmdList, RootParam_StandardDescriptors, CmdListMode::Compute);
+  auto drawMeshes = [&](const char* p_Name,
+                        const StructuredBuffer& p_Commands,
+                        const StructuredBuffer& p_Count)
+  {
+    PIXBeginEvent(p_CmdList, 0, p_Name);
 
-  // Set constant buffers
-  Uniforms cdata = {};
-  cdata.meshBufferSrv = m_MeshesBuffer.m_SrvIndex;
-  BindTempConstantBuffer(p_CmdList, cdata, RootParam_Cbuffer, CmdListMode::Compute);
+    p_CmdList->SetGraphicsRootSignature(m_RootSig);
+    p_CmdList->SetPipelineState(m_PSOs[RenderPass_GbufferMeshlet]);
 
-  AppSettings::bindCBufferCompute(p_CmdList, RootParam_AppSettings);
+    BindStandardDescriptorTable(p_CmdList, RootParam_StandardDescriptors, CmdListMode::Graphics);
+    BindTempConstantBuffer(p_CmdList, cdata, RootParam_Cbuffer, CmdListMode::Graphics);
+    AppSettings::bindCBufferGfx(p_CmdList, RootParam_AppSettings);
 
-  D3D12_CPU_DESCRIPTOR_HANDLE uavs[] = {
-      m_MeshCountBuffer.m_Uav,
-      m_MeshTaskIndirectCountEarly.m_Uav,
-  };
-  BindTempDescriptorTable(
-      p_CmdList, uavs, arrayCount(uavs), RootParam_UAVDescriptors, CmdListMode::Compute);
+    // Draw count is the opaque visible count the culling pass appended with
+    p_CmdList->ExecuteIndirect(
+        m_CommandSignature,
+        numInstances,
+        p_Commands.resource(),
+        0,
+        p_Count.resource(),
+        offsetof(GpuMeshDrawCounts, opaqueMeshVisibleCount));
 
-  uint32_t groupX = static_cast<uint32_t>(ceil(m_MeshInstances.size() / 64.0f));
-  p_CmdList->Dispatch(groupX, 1, 1);
+    PIXEndEvent(p_CmdList);
+  };
 
-#if 0
-  // Sync back command buffer
+  // Leaves the depth buffer readable and the pyramid in NON_PIXEL_SHADER_RESOURCE
+  auto buildDepthPyramid = [&](const char* p_Name, const RenderTexture& p_Pyramid)
   {
-    D3D12_RESOURCE_BARRIER barriers[1] = {};
-    //barriers[0].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-    //barriers[0].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
-    //barriers[0].Transition.pResource = m_MeshTaskIndirectCountEarly.resource();
-    //barriers[0].Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
-    //barriers[0].Transition.StateAfter = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
-    //barriers[0].Transition.Subresource = 0;
+    PIXBeginEvent(p_CmdList, 0, p_Name);
 
-    barriers[0].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-    barriers[0].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
-    barriers[0].Transition.pResource = m_MeshTaskIndirectEarlyCommands.resource();
-    barriers[0].Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
-    barriers[0].Transition.StateAfter = D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT;
-    barriers[0].Transition.Subresource = 0;
+    {
+      D3D12_RESOURCE_BARRIER barriers[2] = {};
+      barriers[0].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+      barriers[0].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+      barriers[0].Transition.pResource = m_DepthBuffer.getResource();
+      barriers[0].Transition.StateBefore = D3D12_RESOURCE_STATE_DEPTH_WRITE;
+      barriers[0].Transition.StateAfter =
+          D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_DEPTH_READ;
+      barriers[0].Transition.Subresource = 0;
+
+      barriers[1].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+      barriers[1].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+      barriers[1].Transition.pResource = p_Pyramid.resource();
+      barriers[1].Transition.StateBefore = D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
+      barriers[1].Transition.StateAfter = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+      barriers[1].Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+
+      p_CmdList->ResourceBarrier(arrayCount32(barriers), barriers);
+    }
 
-    p_CmdList->ResourceBarrier(_countof(barriers), barriers);
-  }
-#endif
+    p_CmdList->SetComputeRootSignature(m_RootSig);
+    p_CmdList->SetPipelineState(m_PSOs[RenderPass_DepthPyramid]);
 
-  PIXEndEvent(p_CmdList);
+    BindStandardDescriptorTable(p_CmdList, RootParam_StandardDescriptors, CmdListMode::Compute);
+    BindTempConstantBuffer(p_CmdList, cdata, RootParam_Cbuffer, CmdListMode::Compute);
+    AppSettings::bindCBufferCompute(p_CmdList, RootParam_AppSettings);
 
-  // =========================================================================================
-  // Meshlet Gbuffer Pass
-  // =========================================================================================
+    // Each mip reads the one above, mip 0 reads the depth buffer
+    const uint32_t numMips = uint32_t(p_Pyramid.numMips());
+    for (uint32_t mip = 0; mip < numMips; ++mip)
+    {
+      const D3D12_CPU_DESCRIPTOR_HANDLE src = p_Pyramid.m_MipUAVs[mip > 0 ? mip - 1 : 0];
+      D3D12_CPU_DESCRIPTOR_HANDLE uavs[NumUAVDescriptors] = {
+          p_Pyramid.m_MipUAVs[mip],
+          src,
+          src,
+          src,
+      };
+      BindTempDescriptorTable(
+          p_CmdList, uavs, arrayCount(uavs), RootParam_UAVDescriptors, CmdListMode::Compute);
+      p_CmdList->SetComputeRoot32BitConstant(RootParam_DrawConstants, mip, 0);
 
-  /*
-        gpu_commands->bind_pipeline( meshlet_draw_pipeline );
+      const uint32_t mipWidth = std::max(uint32_t(p_Pyramid.width()) >> mip, 1u);
+      const uint32_t mipHeight = std::max(uint32_t(p_Pyramid.height()) >> mip, 1u);
+      p_CmdList->Dispatch(DispatchSize(mipWidth, 8), DispatchSize(mipHeight, 8), 1);
 
-        gpu_commands->bind_descriptor_set( &render_scene->mesh_shader_early_descriptor_set[ current_frame_index ], 1, nullptr, 0 );
+      p_Pyramid.uavBarrier(p_CmdList);
+    }
+
+    transitionResource(
+        p_CmdList,
+        p_Pyramid.resource(),
+        D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+        D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+
+    PIXEndEvent(p_CmdList);
+  };
 
-        gpu_commands->draw_mesh_task_indirect_count( render_scene->mesh_task_indirect_early_commands_sb[ current_frame_index ], offsetof( GpuMeshDrawCommand, indirectMS ), render_scene->mesh_task_indirect_count_early_sb[ current_frame_index ], 0, render_scene->mesh_instances.size, sizeof( GpuMeshDrawCommand ) );
+  // =========================================================================================
+  // Early Pass
+  // =========================================================================================
 
-        // TODO: Remember to put barriers for the gbuffers
+  cullMeshes("Gpu Culling Early");
 
-        // Don't forget to use the depthbuffer either as the depth render target in gbuffer pass or a prepass altogether
-  */
+  {
+    D3D12_RESOURCE_BARRIER barriers[6] = {};
+    barriers[0].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+    barriers[0].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+    barriers[0].Transition.pResource = m_MeshCountBuffer.resource();
+    barriers[0].Transition.StateBefore = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+    barriers[0].Transition.StateAfter = D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT;
+    barriers[0].Transition.Subresource = 0;
 
-  PIXBeginEvent(p_CmdList, 0, "Meshlet Gbuffer");
+    barriers[1].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+    barriers[1].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+    barriers[1].Transition.pResource = m_MeshTaskIndirectEarlyCommands.resource();
+    barriers[1].Transition.StateBefore = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+    barriers[1].Transition.StateAfter = D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT;
+    barriers[1].Transition.Subresource = 0;
 
-  //continue here...
-  /*
-    apparantly for task-mesh shader we need a fragment shader as well and create graphics pipeline
-    (see vkSample and nsight capture of it)
+    barriers[2].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+    barriers[2].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+    barriers[2].Transition.pResource = m_DepthBuffer.getResource();
+    barriers[2].Transition.StateBefore =
+        D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_DEPTH_READ;
+    barriers[2].Transition.StateAfter = D3D12_RESOURCE_STATE_DEPTH_WRITE;
+    barriers[2].Transition.Subresource = 0;
+
+    barriers[3].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+    barriers[3].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+    barriers[3].Transition.pResource = m_TangentFrameTarget.resource();
+    barriers[3].Transition.StateBefore = D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
+    barriers[3].Transition.StateAfter = D3D12_RESOURCE_STATE_RENDER_TARGET;
+    barriers[3].Transition.Subresource = 0;
+
+    barriers[4].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+    barriers[4].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+    barriers[4].Transition.pResource = m_UVTarget.resource();
+    barriers[4].Transition.StateBefore = D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
+    barriers[4].Transition.StateAfter = D3D12_RESOURCE_STATE_RENDER_TARGET;
+    barriers[4].Transition.Subresource = 0;
+
+    barriers[5].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+    barriers[5].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+    barriers[5].Transition.pResource = m_MaterialIDTarget.resource();
+    barriers[5].Transition.StateBefore = D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
+    barriers[5].Transition.StateAfter = D3D12_RESOURCE_STATE_RENDER_TARGET;
+    barriers[5].Transition.Subresource = 0;
+
+    p_CmdList->ResourceBarrier(arrayCount32(barriers), barriers);
+  }
 
-    the meshlet.hlsl shader currently is empty
-    need to figure out the meshlet.glsl shader to see what part of it gets exectuted in the gbuffer pass
+  // Set the G-Buffer render targets and clear them, the late pass draws on top
+  D3D12_CPU_DESCRIPTOR_HANDLE rtvHandles[] = {
+      m_TangentFrameTarget.m_RTV,
+      m_UVTarget.m_RTV,
+      m_MaterialIDTarget.m_RTV,
+  };
+  p_CmdList->OMSetRenderTargets(arrayCount32(rtvHandles), rtvHandles, false, &m_DepthBuffer.DSV);
+  const float clearColor[] = {0.0f, 0.0f, 0.0f, 0.0f};
+  for (uint64_t i = 0; i < arrayCount(rtvHandles); ++i)
+    p_CmdList->ClearRenderTargetView(rtvHandles[i], clearColor, 0, nullptr);
+  p_CmdList->ClearDepthStencilView(
+      m_DepthBuffer.DSV, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
+  setViewport(p_CmdList, m_Width, m_Height);
 
-    meshlet.json contains different flavours of this shader. maybe narrow it down to the specific shader
+  drawMeshes("Meshlet Gbuffer Early", m_MeshTaskIndirectEarlyCommands, m_MeshCountBuffer);
 
-    specially since most of them are used in "PointlightShadowPass::prepare_draws" I wonder what happens if we disable pointlight shadows
-    can we remove the unneeded parts easily (volFog style) ?
-  */
+  buildDepthPyramid("Early Depth Pyramid", m_EarlyDepthPyramid);
 
-  p_CmdList->SetComputeRootSignature(m_RootSig);
-  p_CmdList->SetPipelineState(m_PSOs[RenderPass_GbufferMeshlet]);
+  // =========================================================================================
+  // Late Pass
+  // =========================================================================================
 
-  PIXEndEvent(p_CmdList);
+  // The early buffers are bound again as UAVs, the late pass leaves them alone
+  m_MeshCountBuffer.transition(
+      p_CmdList, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+  m_MeshTaskIndirectEarlyCommands.transition(
+      p_CmdList, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 
+  cdata.LateFlag = 1;
+  cullMeshes("Gpu Culling Late");
 
-#if 0
-  // Then main draw call
-  if (true)
   {
-    PIXBeginEvent(p_CmdList, 0, "gbuffer_pass_early");
+    D3D12_RESOURCE_BARRIER barriers[3] = {};
+    barriers[0].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+    barriers[0].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+    barriers[0].Transition.pResource = m_MeshTaskIndirectCountLate.resource();
+    barriers[0].Transition.StateBefore = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+    barriers[0].Transition.StateAfter = D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT;
+    barriers[0].Transition.Subresource = 0;
 
-    p_CmdList->ExecuteIndirect(
-        m_CommandSignature,
-        int worstCaseScenarioTotalTriangleOrMeshCount,
-        ID3D12Resource * someBuffer,
-        0 or ifDoubleBuffer_FrameIndexByTotalSizeOfIndirectCommand,
-        nullptr or ID3D12Resource * sameOrSomeOtherBuffer,
-        0 or ifSameBuffer_Offset);
+    barriers[1].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+    barriers[1].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+    barriers[1].Transition.pResource = m_MeshTaskIndirectLateCommands.resource();
+    barriers[1].Transition.StateBefore = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+    barriers[1].Transition.StateAfter = D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT;
+    barriers[1].Transition.Subresource = 0;
 
-    PIXEndEvent(p_CmdList);
+    barriers[2].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+    barriers[2].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+    barriers[2].Transition.pResource = m_DepthBuffer.getResource();
+    barriers[2].Transition.StateBefore =
+        D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_DEPTH_READ;
+    barriers[2].Transition.StateAfter = D3D12_RESOURCE_STATE_DEPTH_WRITE;
+    barriers[2].Transition.Subresource = 0;
+
+    p_CmdList->ResourceBarrier(arrayCount32(barriers), barriers);
   }
-  else
+
+  p_CmdList->OMSetRenderTargets(arrayCount32(rtvHandles), rtvHandles, false, &m_DepthBuffer.DSV);
+  setViewport(p_CmdList, m_Width, m_Height);
+
+  drawMeshes("Meshlet Gbuffer Late", m_MeshTaskIndirectLateCommands, m_MeshTaskIndirectCountLate);
+
+  // Culls the early pass of the next frame
+  buildDepthPyramid("Depth Pyramid", m_DepthPyramid);
+  m_DepthPyramidValid = true;
+
+  // Back to the states the passes start from
   {
-    PIXBeginEvent(p_CmdList, 0, "Draw all triangles");
+    D3D12_RESOURCE_BARRIER barriers[5] = {};
+    barriers[0].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+    barriers[0].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+    barriers[0].Transition.pResource = m_MeshTaskIndirectCountLate.resource();
+    barriers[0].Transition.StateBefore = D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT;
+    barriers[0].Transition.StateAfter = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+    barriers[0].Transition.Subresource = 0;
 
-    int maxCount = 1;
-    p_CmdList->ExecuteIndirect(
-        m_CommandSignature,
-        maxCount,
-        m_EarlyDrawCommands.resource(),
-        0,
-        nullptr,
-        0);
+    barriers[1].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+    barriers[1].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+    barriers[1].Transition.pResource = m_MeshTaskIndirectLateCommands.resource();
+    barriers[1].Transition.StateBefore = D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT;
+    barriers[1].Transition.StateAfter = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+    barriers[1].Transition.Subresource = 0;
 
-    PIXEndEvent(p_CmdList);
+    barriers[2].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+    barriers[2].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+    barriers[2].Transition.pResource = m_TangentFrameTarget.resource();
+    barriers[2].Transition.StateBefore = D3D12_RESOURCE_STATE_RENDER_TARGET;
+    barriers[2].Transition.StateAfter = D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
+    barriers[2].Transition.Subresource = 0;
+
+    barriers[3].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+    barriers[3].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+    barriers[3].Transition.pResource = m_UVTarget.resource();
+    barriers[3].Transition.StateBefore = D3D12_RESOURCE_STATE_RENDER_TARGET;
+    barriers[3].Transition.StateAfter = D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
+    barriers[3].Transition.Subresource = 0;
+
+    barriers[4].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+    barriers[4].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+    barriers[4].Transition.pResource = m_MaterialIDTarget.resource();
+    barriers[4].Transition.StateBefore = D3D12_RESOURCE_STATE_RENDER_TARGET;
+    barriers[4].Transition.StateAfter = D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
+    barriers[4].Transition.Subresource = 0;
+
+    p_CmdList->ResourceBarrier(arrayCount32(barriers), barriers);
   }
-  #endif
 
   PIXEndEvent(p_CmdList);
 }
@@ -3,6 +3,7 @@
 #include "Common/D3D12Wrapper.hpp"
 #include <Camera.hpp>
 #include <Model.hpp>
+#include <SceneGraph.hpp>
 
 struct alignas(16) GpuMeshlet
 {
@@ -67,6 +68,7 @@ struct alignas(16) GpuMaterialData
 
 }; // struct GpuMaterialData
 
+// MeshInstanceData in OcclusionCulling.hlsl, the matrices are the scene graph's world matrices
 struct alignas(16) GpuMeshInstanceData
 {
   glm::mat4 world;
@@ -85,35 +87,16 @@ struct alignas(16) GpuMeshInstanceData
 //  D3D12_DISPATCH_ARGUMENTS drawArguments;
 //};
 
+// ExecuteIndirect reads drawId and drawFlags as root constants followed by the mesh dispatch, see
+// the command signature. The rest mirrors the draw indexed path for when mesh shaders are missing.
 struct alignas(16) GpuMeshDrawCommand
 {
   uint32_t drawId;
-  uint32_t firstTask;
-  D3D12_DRAW_INDEXED_ARGUMENTS drawArguments;
+  uint32_t drawFlags;
   D3D12_DISPATCH_MESH_ARGUMENTS taskMeshArguments;
 
-  //check vk sample mesh.h shader to add other stuff like mesh / task draw cmds
-  //also check dx12 execIndirect to see if need more draw paramteres
-    /*
-    
-  struct MeshDrawCommand
-{
-  uint        drawId;
-
-  // VkDrawIndexedIndirectCommand
-  uint        indexCount;
-  uint        instanceCount;
-  uint        firstIndex;
-  uint        vertexOffset;
-  uint        firstInstance;
-
-  // VkDrawMeshTasksIndirectCommandNV
-  uint        taskCount;
-  uint        firstTask;
-};
-
-    
-    */
+  uint32_t firstTask;
+  D3D12_DRAW_INDEXED_ARGUMENTS drawArguments;
 };
 
 struct alignas(16) GpuMeshDrawCounts
@@ -134,21 +117,45 @@ struct alignas(16) GpuMeshDrawCounts
   uint32_t pad001;
 };
 
+// Instances share the mesh, its meshlets and its bounds, they only add a scene graph node and a
+// GpuMeshInstanceData entry
 struct MeshInstance
 {
-  Mesh* mesh;
+  // Index into GpuDrivenRenderer::m_Meshes
+  uint32_t meshIndex = UINT32_MAX;
 
   uint32_t gpuMeshInstanceIndex = UINT32_MAX;
   uint32_t sceneGraphNodeIndex = UINT32_MAX;
 };
 
+//---------------------------------------------------------------------------//
+// Per mesh results of the meshlet builder, copied onto the Mesh fields of the same name
+struct MeshletMeshInfo
+{
+  glm::vec4 boundingSphere;
+  uint32_t meshletOffset;
+  uint32_t meshletCount;
+  uint32_t meshletIndexCount;
+  uint32_t padding;
+};
+//---------------------------------------------------------------------------//
+// CPU output of the meshlet builder, this is also what the meshlet cache stores
+struct MeshletBuildOutput
+{
+  std::vector<GpuMeshlet> meshlets;
+  std::vector<GpuMeshletVertexPosition> vertexPositions;
+  std::vector<GpuMeshletVertexData> vertexData;
+  std::vector<uint32_t> meshletsData;
+  std::vector<MeshletMeshInfo> meshInfos;
+  uint32_t meshletsIndexCount = 0;
+};
 //---------------------------------------------------------------------------//
 struct GpuDrivenRenderer
 {
   // Helper wrapper for rendering parameters
   struct RenderDesc
   {
-    //uint32_t DepthBufferSrv = UINT32_MAX;
+    const CameraBase* Camera = nullptr;
   };
 
   void init(ID3D12Device* p_Device, uint32_t p_Width, uint32_t p_Height);
@@ -156,10 +163,43 @@ struct GpuDrivenRenderer
 
   void uploadGpuData();
   void render(ID3D12GraphicsCommandList* p_CmdList, const RenderDesc& p_RenderDesc);
-
-  void addMeshes(std::vector<Mesh>&);
+  // Recreates the size dependent targets and drops last frame's depth pyramid, the GPU has to
+  // be idle
+  void onResize(uint32_t p_Width, uint32_t p_Height);
+
+  // p_CachePath is optional, when set the meshlets are loaded from there if the cached mesh
+  // hashes match and rebuilt and written back otherwise
+  void addMeshes(std::vector<Mesh>&, const wchar_t* p_CachePath = nullptr);
+  // Another instance of an added mesh under p_ParentNode of m_SceneGraph, InvalidNode puts it
+  // under the scene root. Instances have to be added before createResources().
+  uint32_t addInstance(
+      uint32_t p_MeshIndex,
+      uint32_t p_ParentNode,
+      const glm::vec3& p_Translation,
+      const glm::quat& p_Rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f),
+      const glm::vec3& p_Scale = glm::vec3(1.0f));
   void createResources(ID3D12Device2* p_Device);
 
+  // CPU-only meshlet building and caching, usable without a device. buildMeshlets() builds the
+  // meshes in parallel and then scatters them, the output is byte-identical to the serial builder
+  static void buildMeshlets(const std::vector<Mesh>& p_Meshes, MeshletBuildOutput& p_Output);
+  static void
+  buildMeshletsSerial(const std::vector<Mesh>& p_Meshes, MeshletBuildOutput& p_Output);
+  static bool validateMeshletBuild(const std::vector<Mesh>& p_Meshes);
+  // Builds meshlets for a p_GridSize x p_GridSize grid (32-bit indices past 256x256) and checks
+  // every triangle and vertex reference made it into the output
+  static bool validateWideIndexMeshlets(uint32_t p_GridSize = 1024);
+  static bool loadMeshletCache(
+      const wchar_t* p_CachePath, const std::vector<Mesh>& p_Meshes, MeshletBuildOutput& p_Output);
+  static bool saveMeshletCache(
+      const wchar_t* p_CachePath,
+      const std::vector<Mesh>& p_Meshes,
+      const MeshletBuildOutput& p_Output);
+  static void benchmarkMeshletCache(
+      const std::vector<Mesh>& p_Meshes, const wchar_t* p_CachePath, uint32_t p_NumIterations = 4);
+
+  // Depth buffer, gbuffers and depth pyramids at m_Width x m_Height
+  void createRenderTargets();
 
   ID3DBlobPtr m_DataShader = nullptr;
 
@@ -168,6 +208,7 @@ struct GpuDrivenRenderer
   ID3D12CommandSignature* m_CommandSignature = nullptr;
 
   ID3DBlobPtr m_CullingShader = nullptr;
+  ID3DBlobPtr m_DepthPyramidShader = nullptr;
   ID3DBlobPtr m_GbufferTaskShader = nullptr;
   ID3DBlobPtr m_GbufferMeshShader = nullptr;
   ID3DBlobPtr m_GbufferPixelShader = nullptr;
@@ -181,6 +222,10 @@ struct GpuDrivenRenderer
   // copy of meshes for gpu driven rendering
   std::vector<Mesh> m_Meshes{};
   std::vector<MeshInstance> m_MeshInstances{};
+  // Node transforms of the instances, updated and uploaded in uploadGpuData()
+  SceneGraph m_SceneGraph;
+  uint32_t m_SceneRootNode = SceneGraph::InvalidNode;
+  std::vector<GpuMeshInstanceData> m_GpuMeshInstances;
   std::vector<uint32_t> m_GltfMeshToMeshOffset;
 
   // Gpu resources
@@ -192,13 +237,12 @@ struct GpuDrivenRenderer
   StructuredBuffer m_MeshBoundsBuffer;
   StructuredBuffer m_MeshInstancesBuffer;
 
-  // Dynamic (multi frame resource)
+  // Indirect commands and counts, the culling passes fill them every frame
   StructuredBuffer m_MeshTaskIndirectEarlyCommands;
   StructuredBuffer m_MeshTaskIndirectCulledCommands;
   StructuredBuffer m_MeshTaskIndirectLateCommands;
   StructuredBuffer m_MeshCountBuffer;
   //StructuredBuffer m_MeshCountBufferCpuVisible;
-  StructuredBuffer m_MeshTaskIndirectCountEarly;
   StructuredBuffer m_MeshCountBufferCpuVisible;
   StructuredBuffer m_MeshTaskIndirectCountLate;
   StructuredBuffer m_MeshletInstancesIndirectCount;
@@ -230,6 +274,16 @@ struct GpuDrivenRenderer
 
   DepthBuffer m_DepthBuffer;
 
+  // Depth pyramids (HZB), see OcclusionCulling.hpp. m_DepthPyramid is built from the final depth
+  // and culls the next frame's early pass, m_EarlyDepthPyramid from the early pass depth for the
+  // late pass of the same frame.
+  RenderTexture m_DepthPyramid;
+  RenderTexture m_EarlyDepthPyramid;
+  bool m_DepthPyramidValid = false;
+
+  uint32_t m_Width = 0;
+  uint32_t m_Height = 0;
+
   static constexpr bool m_Enabled = true;
 };
 
@@ -3,6 +3,7 @@
 #include "FileWatcher.hpp"
 #include "RenderManager.hpp"
 #include "D3D12Wrapper.hpp"
+#include "SelfTest.hpp"
 
 RenderManager* g_Renderer;
 std::unique_ptr<FileWatcher> g_FileWatcher;
@@ -103,6 +104,18 @@ inline int appExec(HINSTANCE p_Instance, int p_CmdShow, CallBackRegistery* p_Cal
   g_Renderer->parseCmdArgs(argv, argc);
   LocalFree(argv);
 
+  // Headless runs exit before creating the window, the exit code is nonzero on failed checks
+  if (g_Renderer->m_Info.m_RunSelfTest || g_Renderer->m_Info.m_RunBenchmark)
+  {
+    const ModelLoadSettings sceneSettings = RenderManager::sceneLoadSettings();
+    bool passed = true;
+    if (g_Renderer->m_Info.m_RunSelfTest)
+      passed = SelfTest::runChecks(sceneSettings);
+    if (g_Renderer->m_Info.m_RunBenchmark)
+      SelfTest::runBenchmarks(sceneSettings);
+    return passed ? 0 : 1;
+  }
+
   // Initialize the window class.
   WNDCLASSEX windowClass = {0};
   windowClass.cbSize = sizeof(WNDCLASSEX);
@@ -5,6 +5,7 @@
 #include "Common/Input.hpp"
 #include "Common/Quaternion.hpp"
 #include "Common/Spectrum.hpp"
+#include "Common/WorkerPool.hpp"
 
 #define ENABLE_PARTICLE_EXPERIMENTAL 0
 #define ENABLE_GPU_BASED_VALIDATION 0
@@ -26,31 +27,6 @@ static bool pauseRendering = false;
 //---------------------------------------------------------------------------//
 // Local helpers
 //---------------------------------------------------------------------------//
-// Returns true if a sphere intersects a capped cone defined by a direction, height, and angle
-static bool _sphereConeIntersection(
-    const glm::vec3& coneTip,
-    const glm::vec3& coneDir,
-    float coneHeight,
-    float coneAngle,
-    const glm::vec3& sphereCenter,
-    float sphereRadius)
-{
-  if (glm::dot(sphereCenter - coneTip, coneDir) > coneHeight + sphereRadius)
-    return false;
-
-  float cosHalfAngle = std::cos(coneAngle * 0.5f);
-  float sinHalfAngle = std::sin(coneAngle * 0.5f);
-
-  glm::vec3 v = sphereCenter - coneTip;
-  float a = glm::dot(v, coneDir);
-  float b = a * sinHalfAngle / cosHalfAngle;
-  float c = std::sqrt(glm::dot(v, v) - a * a);
-  float d = c - b;
-  float e = d * cosHalfAngle;
-
-  return e < sphereRadius;
-}
-//---------------------------------------------------------------------------//
 // Cone-sphere intersection test using Bart Wronski modified version:
 // https://bartwronski.com/2017/04/13/cull-that-cone/
 static bool _sphereConeIntersectionBartWronski(
@@ -180,7 +156,6 @@ enum DeferredRootParams : uint32_t
   DeferredParams_PSCBuffer,
   DeferredParams_ShadowCBuffer,
   DeferredParams_DeferredCBuffer,
-  DeferredParams_LightCBuffer,
   DeferredParams_SRVIndices,
   DeferredParams_UAVDescriptors,
   DeferredParams_AppSettings,
@@ -195,6 +170,10 @@ struct MeshVSConstants
   glm::mat4x4 WorldViewProjection;
   float NearClip = 0.0f;
   float FarClip = 0.0f;
+  float Padding[2] = {};
+  // Dequantizes VertexFormat::Quantized positions per mesh, identity otherwise
+  glm::vec4 PositionScale = glm::vec4(1.0f);
+  glm::vec4 PositionOffset = glm::vec4(0.0f);
 };
 
 struct DeferredConstants
@@ -214,20 +193,6 @@ struct MaterialTextureIndices
   uint32_t Roughness;
   uint32_t Metallic;
 };
-struct LightConstants
-{
-  SpotLight Lights[AppSettings::MaxSpotLights];
-  glm::mat4x4 ShadowMatrices[AppSettings::MaxSpotLights];
-};
-
-struct ClusterBounds
-{
-  glm::vec3 Position;
-  Quaternion Orientation;
-  glm::vec3 Scale;
-  glm::uvec2 ZBounds;
-};
-
 struct ClusterConstants
 {
   glm::mat4 ViewProjection;
@@ -261,6 +226,9 @@ struct ClusterVisConstants
 
   uint32_t DecalClusterBufferIdx = uint32_t(-1); // TODO!
   uint32_t SpotLightClusterBufferIdx = uint32_t(-1);
+  uint32_t SpotLightElementsPerCluster = 0;
+  uint32_t PointLightClusterBufferIdx = uint32_t(-1);
+  uint32_t PointLightElementsPerCluster = 0;
 };
 
 //---------------------------------------------------------------------------//
@@ -277,9 +245,11 @@ bool RenderManager::compileShaders()
 #endif
   compileFlags |= D3DCOMPILE_ENABLE_UNBOUNDED_DESCRIPTOR_TABLES;
 
-  // Gbuffer shaders
+  // Gbuffer shaders, the vertex shader matches the vertex buffer layout of the scene
   {
-    const D3D_SHADER_MACRO defines[] = {{"GBUFFER_VS_DBG", "1"}, {NULL, NULL}};
+    const bool packedVertices = sceneModel.VertexBufferFormat() != VertexFormat::Standard;
+    const D3D_SHADER_MACRO defines[] = {
+        {"GBUFFER_VS_DBG", "1"}, {"PACKED_VERTICES", packedVertices ? "1" : "0"}, {NULL, NULL}};
     compileShader(
         "gbuffer vertex",
         getShaderPath(L"Mesh.hlsl").c_str(),
@@ -291,6 +261,17 @@ bool RenderManager::compileShaders()
         m_GBufferVS);
   }
 
+  // Depth-only vertex shader, reads the position stream
+  compileShader(
+      "depth vertex",
+      getShaderPath(L"Mesh.hlsl").c_str(),
+      0,
+      nullptr,
+      compileFlags,
+      ShaderType::Vertex,
+      "DepthVS",
+      m_DepthVS);
+
   {
     const D3D_SHADER_MACRO defines[] = {{"GBUFFER_PS_DBG", "1"}, {NULL, NULL}};
     compileShader(
@@ -600,42 +581,15 @@ bool RenderManager::createPSOs()
   // Load and compile shaders:
   ret = compileShaders();
   assert(
-      m_GBufferPS != nullptr && m_GBufferVS != nullptr && m_DeferredCS != nullptr &&
+      m_GBufferPS != nullptr && m_GBufferVS != nullptr && m_DepthVS != nullptr &&
+      m_DeferredCS != nullptr &&
       clusterVS != nullptr && clusterFrontFacePS != nullptr && clusterBackFacePS != nullptr &&
       clusterIntersectingPS != nullptr && clusterVisPS != nullptr && fullScreenTriVS != nullptr);
 
-  // Standard input elements
-  static const D3D12_INPUT_ELEMENT_DESC standardInputElements[5] = {
-      {"POSITION",
-       0,
-       DXGI_FORMAT_R32G32B32_FLOAT,
-       0,
-       0,
-       D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA,
-       0},
-      {"NORMAL",
-       0,
-       DXGI_FORMAT_R32G32B32_FLOAT,
-       0,
-       12,
-       D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA,
-       0},
-      {"UV", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0},
-      {"TANGENT",
-       0,
-       DXGI_FORMAT_R32G32B32_FLOAT,
-       0,
-       32,
-       D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA,
-       0},
-      {"BITANGENT",
-       0,
-       DXGI_FORMAT_R32G32B32_FLOAT,
-       0,
-       44,
-       D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA,
-       0},
-  };
+  // Vertex layout of the scene model, the gbuffer VS is compiled to match it
+  const D3D12_INPUT_ELEMENT_DESC* inputElements =
+      Model::InputElements(sceneModel.VertexBufferFormat());
+  const uint32_t numInputElements = Model::NumInputElements(sceneModel.VertexBufferFormat());
 
   // 1. Gbuffer pso:
   {
@@ -660,8 +614,8 @@ bool RenderManager::createPSOs()
     psoDesc.DSVFormat = depthBuffer.DSVFormat;
     psoDesc.SampleDesc.Count = 1;
     psoDesc.SampleDesc.Quality = 0;
-    psoDesc.InputLayout.NumElements = arrayCount32(standardInputElements);
-    psoDesc.InputLayout.pInputElementDescs = standardInputElements;
+    psoDesc.InputLayout.NumElements = numInputElements;
+    psoDesc.InputLayout.pInputElementDescs = inputElements;
 
     hr = m_Dev->CreateGraphicsPipelineState(&psoDesc, IID_PPV_ARGS(&gbufferPSO));
     gbufferPSO->SetName(L"Gbuffer PSO");
@@ -680,11 +634,11 @@ bool RenderManager::createPSOs()
       ret = false;
   }
 
-  // 3. depth only psos
+  // 3. depth only psos, these only fetch the position stream
   {
     D3D12_GRAPHICS_PIPELINE_STATE_DESC psoDesc = {};
     psoDesc.pRootSignature = depthRootSignature;
-    psoDesc.VS = CD3DX12_SHADER_BYTECODE(m_GBufferVS.GetInterfacePtr());
+    psoDesc.VS = CD3DX12_SHADER_BYTECODE(m_DepthVS.GetInterfacePtr());
     psoDesc.RasterizerState = GetRasterizerState(RasterizerState::BackFaceCull);
     psoDesc.BlendState = GetBlendState(BlendState::Disabled);
     psoDesc.DepthStencilState = GetDepthState(DepthState::WritesEnabled);
@@ -694,8 +648,8 @@ bool RenderManager::createPSOs()
     psoDesc.DSVFormat = depthBuffer.DSVFormat;
     psoDesc.SampleDesc.Count = 1;
     psoDesc.SampleDesc.Quality = 0;
-    psoDesc.InputLayout.NumElements = arrayCount32(standardInputElements);
-    psoDesc.InputLayout.pInputElementDescs = standardInputElements;
+    psoDesc.InputLayout.NumElements = Model::NumDepthInputElements();
+    psoDesc.InputLayout.pInputElementDescs = Model::DepthInputElements();
     hr = m_Dev->CreateGraphicsPipelineState(&psoDesc, IID_PPV_ARGS(&depthPSO));
     depthPSO->SetName(L"Depth-only PSO");
     if (FAILED(hr))
@@ -862,10 +816,39 @@ void RenderManager::createRenderTargets()
   // Spotlight cluster bitmask buffer
   {
     RawBufferInit rbInit;
-    rbInit.NumElements = numXYZTiles * AppSettings::SpotLightElementsPerCluster;
+    rbInit.NumElements = numXYZTiles * spotLightElementsPerCluster;
     rbInit.CreateUAV = true;
     spotLightClusterBuffer.init(rbInit);
     spotLightClusterBuffer.InternalBuffer.m_Resource->SetName(L"Spot Light Cluster Buffer");
+
+    // Masks binned on the CPU, uploaded every frame in place of the cluster passes
+    rbInit.CreateUAV = false;
+    rbInit.Dynamic = true;
+    rbInit.CPUAccessible = true;
+    spotLightClusterUploadBuffer.init(rbInit);
+    spotLightClusterUploadBuffer.InternalBuffer.m_Resource->SetName(
+        L"Spot Light Cluster Upload Buffer");
+
+    for (uint32_t i = 0; i < FRAME_COUNT; ++i)
+    {
+      spotLightClusterMasks[i].assign(rbInit.NumElements, 0);
+      spotLightClusterReadback[i].deinit();
+      spotLightClusterReadback[i].init(rbInit.NumElements * spotLightClusterBuffer.Stride);
+      spotLightClusterReadbackPending[i] = false;
+    }
+  }
+
+  // Point light cluster bitmask buffer, binned on the CPU and uploaded every frame
+  {
+    RawBufferInit rbInit;
+    rbInit.NumElements = std::max<uint64_t>(numXYZTiles * pointLightElementsPerCluster, 1);
+    rbInit.CreateUAV = false;
+    rbInit.Dynamic = true;
+    rbInit.CPUAccessible = true;
+    pointLightClusterBuffer.init(rbInit);
+    pointLightClusterBuffer.InternalBuffer.m_Resource->SetName(L"Point Light Cluster Buffer");
+
+    pointLightClusterMask.assign(numXYZTiles * pointLightElementsPerCluster, 0);
   }
 }
 //---------------------------------------------------------------------------//
@@ -899,23 +882,36 @@ void RenderManager::loadAssets()
   }
   */
 
-  // Model filename
-  static const wchar_t* ScenePath = L"..\\Content\\Models\\Sponza\\Sponza.fbx";
-
   // Load scene
-  static const float SceneScale = 0.01f;
-  ModelLoadSettings settings;
-  settings.FilePath = ScenePath;
-  settings.ForceSRGB = true;
-  settings.SceneScale = SceneScale;
-  settings.MergeMeshes = false;
-  sceneModel.CreateWithAssimp(m_Dev, settings);
+  sceneModel.CreateWithCache(m_Dev, sceneLoadSettings());
+  m_MeshBounds.init(sceneModel.Meshes());
+  m_MeshBvh.build(m_MeshBounds, &getWorkerPool());
+  m_VisibleMeshes.resize(sceneModel.Meshes().size());
+  m_OccluderMeshes.resize(sceneModel.Meshes().size());
+  m_SoftwareOcclusion.init(m_Info.m_Width / 4, m_Info.m_Height / 4);
 
   {
     // Initialize the spotlight data used for rendering
-    const uint64_t numSpotLights =
-        std::min<uint64_t>(AppSettings::MaxSpotLights, sceneModel.SpotLights().size());
+    const uint64_t numSpotLights = sceneModel.SpotLights().size();
     spotLights.resize(numSpotLights);
+    spotLightBounds.resize(uint32_t(numSpotLights));
+    spotLightClusterBounds.resize(numSpotLights);
+    spotLightIntersectsCamera.resize(numSpotLights);
+
+    // An additional scale factor that is needed to make sure that our polygonal bounding cone
+    // fully encloses the actual cone representing the light's area of influence
+    const float inRadius = std::cos(Pi / NumConeSides);
+    float scaleCorrection = 1.0f / inRadius;
+
+    // NOTE(OM): disabling scale correction for a visual bug 
+    /*
+      the bug can be reproduced by putting camera at the following position:
+
+      camera.SetPosition(glm::vec3(3.49f, 1.76f, 0.49f));
+      camera.SetXRotation(-3.14f / 12.0f);
+      camera.SetYRotation(1.5f * 3.14f);
+    */
+    scaleCorrection = 1.0f;
 
     for (uint64_t i = 0; i < numSpotLights; ++i)
     {
@@ -928,11 +924,44 @@ void RenderManager::loadAssets()
       spotLight.AngularAttenuationX = std::cos(srcLight.AngularAttenuation.x * 0.5f);
       spotLight.AngularAttenuationY = std::cos(srcLight.AngularAttenuation.y * 0.5f);
       spotLight.Range = 7.5f;
+
+      spotLightBounds.set(
+          uint32_t(i),
+          spotLight.Position,
+          srcLight.Direction,
+          srcLight.Orientation,
+          srcLight.AngularAttenuation.y,
+          spotLight.Range,
+          scaleCorrection);
     }
 
+    // One bit per light in each cluster
+    spotLightElementsPerCluster = std::max<uint32_t>(uint32_t(numSpotLights + 31) / 32, 1);
+
     AppSettings::MaxLightClamp = static_cast<uint32_t>(numSpotLights);
   }
 
+  {
+    // Point lights are bound by a sphere, there's nothing to correct
+    const uint64_t numPointLights = sceneModel.PointLights().size();
+    pointLights.resize(numPointLights);
+    pointLightSpheres.resize(numPointLights);
+    for (uint64_t i = 0; i < numPointLights; ++i)
+    {
+      const ModelPointLight& srcLight = sceneModel.PointLights()[i];
+
+      PointLight& pointLight = pointLights[i];
+      pointLight.Position = srcLight.Position;
+      pointLight.Range = AppSettings::PointLightRange;
+      pointLight.Intensity = srcLight.Intensity * SpotLightIntensityFactor;
+      pointLight.unused = 0.0f;
+
+      pointLightSpheres[i] = glm::vec4(pointLight.Position, pointLight.Range);
+    }
+
+    pointLightElementsPerCluster = uint32_t(numPointLights + 31) / 32;
+  }
+
   // Load blue noise texture
   static const wchar_t* noiseTexPath = L"..\\Content\\Textures\\blueNoiseTex128.png"; 
   loadTexture(m_Dev, m_BlueNoiseTexture, noiseTexPath, false);
@@ -950,7 +979,7 @@ void RenderManager::loadAssets()
   {
     StructuredBufferInit sbInit;
     sbInit.Stride = sizeof(ClusterBounds);
-    sbInit.NumElements = AppSettings::MaxSpotLights;
+    sbInit.NumElements = std::max<uint64_t>(spotLights.size(), 1);
     sbInit.Dynamic = true;
     sbInit.CPUAccessible = true;
     spotLightBoundsBuffer.init(sbInit);
@@ -982,10 +1011,12 @@ void RenderManager::loadAssets()
     dbInit.Height = SpotLightShadowMapSize;
     dbInit.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
     dbInit.MSAASamples = 1;
-    dbInit.ArraySize = sceneModel.SpotLights().size();
+    dbInit.ArraySize = std::min<uint64_t>(spotLights.size(), AppSettings::MaxSpotLightShadows);
     dbInit.InitialState = D3D12_RESOURCE_STATE_DEPTH_WRITE;
     dbInit.Name = L"Spot Light Shadow Map";
     spotLightShadowMap.init(dbInit);
+    m_SpotShadowCache.init(uint32_t(dbInit.ArraySize));
+    spotLightShadowMatrices.resize(dbInit.ArraySize, glm::mat4(1.0f));
   }
 
   // Create a structured buffer containing texture indices per-material:
@@ -1043,23 +1074,40 @@ void RenderManager::loadAssets()
     // Initialize gpu driven renderer
     m_GpuDrivenRenderer.init(m_Dev, m_Info.m_Width, m_Info.m_Height);
 
-    // Add meshes for gpu driven rendering
-    m_GpuDrivenRenderer.addMeshes(sceneModel.Meshes());
+    // Add meshes for gpu driven rendering, the meshlets are cached next to the scene file
+    const std::wstring meshletCachePath =
+        std::wstring(sceneLoadSettings().FilePath) + L".meshlets";
+    m_GpuDrivenRenderer.addMeshes(sceneModel.Meshes(), meshletCachePath.c_str());
 
     // Create resources
     m_GpuDrivenRenderer.createResources(m_Dev);
   }
 
   {
-    // Spot light and shadow bounds buffer
-    ConstantBufferInit cbInit;
-    cbInit.Size = sizeof(LightConstants);
-    cbInit.Dynamic = true;
-    cbInit.CPUAccessible = false;
-    cbInit.InitialState = D3D12_RESOURCE_STATE_COMMON;
-    cbInit.Name = L"Spot Light Buffer";
+    // Spot lights and the shadow matrices of the ones with a shadow map slice
+    StructuredBufferInit sbInit;
+    sbInit.Stride = sizeof(SpotLight);
+    sbInit.NumElements = std::max<uint64_t>(spotLights.size(), 1);
+    sbInit.Dynamic = true;
+    sbInit.CPUAccessible = false;
+    sbInit.InitialState = D3D12_RESOURCE_STATE_COMMON;
+    sbInit.Name = L"Spot Light Buffer";
+    spotLightBuffer.init(sbInit);
 
-    spotLightBuffer.init(cbInit);
+    sbInit.Stride = sizeof(glm::mat4);
+    sbInit.NumElements = std::max<uint64_t>(spotLightShadowMatrices.size(), 1);
+    sbInit.Name = L"Spot Light Shadow Matrix Buffer";
+    spotLightShadowMatrixBuffer.init(sbInit);
+  }
+  {
+    // Point lights don't change after loading
+    StructuredBufferInit sbInit;
+    sbInit.Stride = sizeof(PointLight);
+    sbInit.NumElements = std::max<uint64_t>(pointLights.size(), 1);
+    sbInit.Dynamic = false;
+    sbInit.InitData = pointLights.empty() ? nullptr : pointLights.data();
+    sbInit.Name = L"Point Light Buffer";
+    pointLightBuffer.init(sbInit);
   }
 
   // Gbuffer Root Sig
@@ -1154,14 +1202,6 @@ void RenderManager::loadAssets()
     rootParameters[DeferredParams_DeferredCBuffer].Descriptor.Flags =
         D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC;
 
-    // LightCBuffer
-    rootParameters[DeferredParams_LightCBuffer].ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV;
-    rootParameters[DeferredParams_LightCBuffer].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
-    rootParameters[DeferredParams_LightCBuffer].Descriptor.RegisterSpace = 0;
-    rootParameters[DeferredParams_LightCBuffer].Descriptor.ShaderRegister = 3;
-    rootParameters[DeferredParams_LightCBuffer].Descriptor.Flags =
-        D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC_WHILE_SET_AT_EXECUTE;
-
     // SRV Indices
     rootParameters[DeferredParams_SRVIndices].ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV;
     rootParameters[DeferredParams_SRVIndices].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
@@ -1320,12 +1360,13 @@ void RenderManager::renderDeferred()
 {
 #if 1
   // Gpu driven renderer
-  GpuDrivenRenderer::RenderDesc desc = {
-      //
-  };
+  GpuDrivenRenderer::RenderDesc desc = {};
+  desc.Camera = &camera;
   m_GpuDrivenRenderer.render(m_CmdList, desc);
 #endif
 
+  const SkyCache& skyCache = skyBaker.current();
+
   // Draw to Gbuffers
 #pragma region Gbuffer pass
   PIXBeginEvent(m_CmdList.GetInterfacePtr(), 0, "Render Gbuffers");
@@ -1394,40 +1435,58 @@ void RenderManager::renderDeferred()
   m_CmdList->SetGraphicsRootSignature(gbufferRootSignature);
   m_CmdList->SetPipelineState(gbufferPSO);
 
-  // Set constant buffers:
-  {
-    glm::mat4 world = glm::identity<glm::mat4>();
-    MeshVSConstants vsConstants;
-    vsConstants.World = world;
-    vsConstants.View = glm::transpose(camera.ViewMatrix());
-    vsConstants.WorldViewProjection = world * glm::transpose(camera.ViewProjectionMatrix());
-    vsConstants.NearClip = camera.NearClip();
-    vsConstants.FarClip = camera.FarClip();
+  // Set constant buffers, quantized vertices rebind them per mesh in the loop below
+  glm::mat4 world = glm::identity<glm::mat4>();
+  MeshVSConstants vsConstants;
+  vsConstants.World = world;
+  vsConstants.View = glm::transpose(camera.ViewMatrix());
+  vsConstants.WorldViewProjection = world * glm::transpose(camera.ViewProjectionMatrix());
+  vsConstants.NearClip = camera.NearClip();
+  vsConstants.FarClip = camera.FarClip();
+  const bool quantizedPositions = sceneModel.VertexBufferFormat() == VertexFormat::Quantized;
+  if (quantizedPositions == false)
     BindTempConstantBuffer(m_CmdList, vsConstants, 0, CmdListMode::Graphics);
-  }
 
-  // Bind vb and ib
+  // Bind vb, the ib view depends on the index width of each mesh and is bound in the loop
   D3D12_VERTEX_BUFFER_VIEW vbView = sceneModel.VertexBuffer().vbView();
-  D3D12_INDEX_BUFFER_VIEW ibView = sceneModel.IndexBuffer().IBView();
   m_CmdList->IASetVertexBuffers(0, 1, &vbView);
-  m_CmdList->IASetIndexBuffer(&ibView);
 
   m_CmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
   //
   // Draw geometries:
 
-  // TODO:
-  // Frustum culling
-  const uint64_t numVisible = sceneModel.Meshes().size();
+  const uint64_t numVisible = occlusionCullMeshes(camera, cullMeshes(camera));
 
   // Draw all visible meshes
+  const uint32_t vertexStride = Model::VertexStride(sceneModel.VertexBufferFormat());
+  VertexFetchStats& fetchStats = m_VertexFetchStats[uint32_t(MeshPass::GBuffer)];
   uint32_t currMaterial = uint32_t(-1);
+  bool ibBound = false;
+  IndexType currIndexType = IndexType::Index16Bit;
   for (uint64_t i = 0; i < numVisible; ++i)
   {
-    uint64_t meshIdx = i; // this should be just the visible mesh
+    const uint64_t meshIdx = m_VisibleMeshes[i];
     const Mesh& mesh = sceneModel.Meshes()[meshIdx];
 
+    if (ibBound == false || mesh.IndexBufferType() != currIndexType)
+    {
+      D3D12_INDEX_BUFFER_VIEW ibView = sceneModel.IndexBufferView(mesh.IndexBufferType());
+      m_CmdList->IASetIndexBuffer(&ibView);
+      currIndexType = mesh.IndexBufferType();
+      ibBound = true;
+    }
+
+    if (quantizedPositions)
+    {
+      glm::vec3 scale;
+      glm::vec3 offset;
+      Model::PositionQuantization(mesh, scale, offset);
+      vsConstants.PositionScale = glm::vec4(scale, 0.0f);
+      vsConstants.PositionOffset = glm::vec4(offset, 0.0f);
+      BindTempConstantBuffer(m_CmdList, vsConstants, 0, CmdListMode::Graphics);
+    }
+
     // Draw all parts
     for (uint64_t partIdx = 0; partIdx < mesh.NumMeshParts(); ++partIdx)
     {
@@ -1441,8 +1500,12 @@ void RenderManager::renderDeferred()
         currMaterial = part.MaterialIdx;
       }
       assert(part.IndexStart == 0); // just testing
+
+      const uint32_t lod =
+          mesh.SelectLod(partIdx, camera, float(m_Info.m_Height), AppSettings::LodPixelError);
+      fetchStats.addDraw(part.LodVertices(lod), vertexStride, vertexStride);
       m_CmdList->DrawIndexedInstanced(
-          part.IndexCount, 1, mesh.IndexOffset() + part.IndexStart, mesh.VertexOffset(), 0);
+          part.LodCount(lod), 1, mesh.IndexOffset() + part.LodStart(lod), mesh.VertexOffset(), 0);
     }
   }
 
@@ -1522,14 +1585,20 @@ void RenderManager::renderDeferred()
         //todo...meshRenderer.SunShadowMap().SRV(),
         spotLightShadowMap.getSrv(),
         materialTextureIndices.m_SrvIndex,
-        spotLightClusterBuffer.SRV,
+        spotLightClusterSrv(),
         materialIDTarget.srv(),
         uvTarget.srv(),
         depthBuffer.getSrv(),
         tangentFrameTarget.srv(),
         m_Fog.m_FinalVolume.getSRV(),
         m_BlueNoiseTexture.SRV,
-        skyTargetSRV
+        skyTargetSRV,
+        spotLightBuffer.m_SrvIndex,
+        spotLightShadowMatrixBuffer.m_SrvIndex,
+        spotLightElementsPerCluster,
+        pointLightClusterBuffer.SRV,
+        pointLightBuffer.m_SrvIndex,
+        pointLightElementsPerCluster
     };
     BindTempConstantBuffer(m_CmdList, srvIndices, DeferredParams_SRVIndices, CmdListMode::Compute);
   }
@@ -1552,8 +1621,6 @@ void RenderManager::renderDeferred()
         m_CmdList, shadingConstants, DeferredParams_PSCBuffer, CmdListMode::Compute);
   }
 
-  spotLightBuffer.setAsComputeRootParameter(m_CmdList, DeferredParams_LightCBuffer);
-
   AppSettings::bindCBufferCompute(m_CmdList, DeferredParams_AppSettings);
 
   D3D12_CPU_DESCRIPTOR_HANDLE uavs[] = {deferredTarget.m_UAV};
@@ -1635,45 +1702,127 @@ void RenderManager::renderParticles()
 #endif
 }
 //---------------------------------------------------------------------------//
-// Renders all meshes using depth-only rendering
+uint32_t RenderManager::cullMeshes(const CameraBase& p_Camera)
+{
+  if (AppSettings::EnableFrustumCulling == false)
+  {
+    for (uint32_t i = 0; i < m_MeshBounds.count(); ++i)
+      m_VisibleMeshes[i] = i;
+    return m_MeshBounds.count();
+  }
+
+  const Frustum frustum = FrustumCulling::extractFrustum(p_Camera.ViewProjectionMatrix());
+  if (AppSettings::UseMeshBvh)
+  {
+    // Same meshes in BVH order, sorted back so the draws keep the scene order
+    const uint32_t numVisible = m_MeshBvh.cullFrustum(frustum, m_VisibleMeshes.data());
+    std::sort(m_VisibleMeshes.begin(), m_VisibleMeshes.begin() + numVisible);
+    return numVisible;
+  }
+  return FrustumCulling::cull(m_MeshBounds, frustum, m_VisibleMeshes.data());
+}
+//---------------------------------------------------------------------------//
+uint32_t RenderManager::occlusionCullMeshes(const CameraBase& p_Camera, uint32_t p_NumVisible)
+{
+  AppSettings::SoftwareOccludedMeshes = 0;
+  AppSettings::SoftwareOcclusionMs = 0.0f;
+  if (AppSettings::EnableSoftwareOcclusion == false)
+    return p_NumVisible;
+
+  // Meshes covering less than this of the screen hide too little to be worth rasterizing
+  static const float MinOccluderScreenArea = 0.01f;
+
+  const glm::mat4& viewProjection = p_Camera.ViewProjectionMatrix();
+  if (AppSettings::AutoPickOccluders || m_Occluders.empty())
+    SoftwareOcclusion::selectOccluders(
+        m_MeshBounds,
+        m_VisibleMeshes.data(),
+        p_NumVisible,
+        viewProjection,
+        uint32_t(AppSettings::MaxOccluders),
+        MinOccluderScreenArea,
+        m_Occluders);
+
+  const OccluderMesh* occluders[64];
+  const uint32_t numOccluders = std::min(uint32_t(m_Occluders.size()), arrayCount32(occluders));
+  for (uint32_t i = 0; i < numOccluders; ++i)
+  {
+    OccluderMesh& occluder = m_OccluderMeshes[m_Occluders[i]];
+    if (occluder.indices.empty())
+      SoftwareOcclusion::makeOccluder(sceneModel.Meshes()[m_Occluders[i]], occluder);
+    occluders[i] = &occluder;
+  }
+
+  WorkerPool& pool = getWorkerPool();
+  m_SoftwareOcclusion.rasterize(viewProjection, occluders, numOccluders, &pool);
+
+  const uint32_t numLeft =
+      m_SoftwareOcclusion.cullBoxes(m_MeshBounds, m_VisibleMeshes.data(), p_NumVisible, &pool);
+
+  const SoftwareOcclusionStats& stats = m_SoftwareOcclusion.stats();
+  AppSettings::SoftwareOccludedMeshes = stats.NumOccluded;
+  AppSettings::SoftwareOcclusionMs = float(stats.RasterizeMilliseconds + stats.TestMilliseconds);
+  return numLeft;
+}
+//---------------------------------------------------------------------------//
+// Renders the given meshes using depth-only rendering
 void RenderManager::renderDepth(
     ID3D12GraphicsCommandList* p_CmdList,
     const CameraBase& p_Camera,
     ID3D12PipelineState* p_PSO,
-    uint64_t p_NumVisible)
+    const uint32_t* p_VisibleMeshes,
+    uint64_t p_NumVisible,
+    MeshPass p_Pass,
+    float p_ViewportHeight)
 {
-  // TODO:
-  // Frustum culling
-  p_NumVisible = sceneModel.Meshes().size();
-
   p_CmdList->SetGraphicsRootSignature(depthRootSignature);
   p_CmdList->SetPipelineState(p_PSO);
   p_CmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
   glm::mat4 world = glm::identity<glm::mat4>();
 
-  // Set constant buffers
+  // Set constant buffers, the position stream is never quantized so this is done once
   MeshVSConstants vsConstants;
   vsConstants.World = world;
   vsConstants.View = glm::transpose(p_Camera.ViewMatrix());
   vsConstants.WorldViewProjection = world * glm::transpose(p_Camera.ViewProjectionMatrix());
   BindTempConstantBuffer(p_CmdList, vsConstants, 0, CmdListMode::Graphics);
 
-  // Bind vertices and indices
-  D3D12_VERTEX_BUFFER_VIEW vbView = sceneModel.VertexBuffer().vbView();
-  D3D12_INDEX_BUFFER_VIEW ibView = sceneModel.IndexBuffer().IBView();
+  // Bind the position stream, indices are bound per index width
+  const StructuredBuffer& positionBuffer = sceneModel.PositionBuffer();
+  D3D12_VERTEX_BUFFER_VIEW vbView = positionBuffer.vbView();
   p_CmdList->IASetVertexBuffers(0, 1, &vbView);
-  p_CmdList->IASetIndexBuffer(&ibView);
 
-  // Draw all meshes
+  const uint32_t positionStride = uint32_t(positionBuffer.m_Stride);
+  const uint32_t vertexStride = Model::VertexStride(sceneModel.VertexBufferFormat());
+  VertexFetchStats& fetchStats = m_VertexFetchStats[uint32_t(p_Pass)];
+
+  // Draw all visible meshes
+  bool ibBound = false;
+  IndexType currIndexType = IndexType::Index16Bit;
   for (uint64_t i = 0; i < p_NumVisible; ++i)
   {
-    uint64_t meshIdx = i;
+    const uint64_t meshIdx = p_VisibleMeshes[i];
     const Mesh& mesh = sceneModel.Meshes()[meshIdx];
 
-    // Draw the whole mesh
-    p_CmdList->DrawIndexedInstanced(
-        mesh.NumIndices(), 1, mesh.IndexOffset(), mesh.VertexOffset(), 0);
+    if (ibBound == false || mesh.IndexBufferType() != currIndexType)
+    {
+      D3D12_INDEX_BUFFER_VIEW ibView = sceneModel.DepthIndexBufferView(mesh.IndexBufferType());
+      p_CmdList->IASetIndexBuffer(&ibView);
+      currIndexType = mesh.IndexBufferType();
+      ibBound = true;
+    }
+
+    // Draw every part at the level picked for this view
+    for (uint64_t partIdx = 0; partIdx < mesh.NumMeshParts(); ++partIdx)
+    {
+      const MeshPart& part = mesh.MeshParts()[partIdx];
+      const uint32_t lod =
+          mesh.SelectLod(partIdx, p_Camera, p_ViewportHeight, AppSettings::ShadowLodPixelError);
+      fetchStats.addDraw(part.LodVertices(lod), positionStride, vertexStride);
+      p_CmdList->DrawIndexedInstanced(
+          part.LodCount(lod), 1, mesh.IndexOffset() + part.LodStart(lod), mesh.VertexOffset(), 0);
+    }
   }
 }
 //---------------------------------------------------------------------------//
@@ -1681,10 +1830,15 @@ void RenderManager::renderDepth(
 void RenderManager::renderSpotLightShadowDepth(
     ID3D12GraphicsCommandList* p_CmdList, const CameraBase& p_Camera)
 {
-  // TODO:
-  // Frustum culling
-  const uint64_t numVisible = sceneModel.Meshes().size();
-  renderDepth(p_CmdList, p_Camera, spotLightShadowPSO, numVisible);
+  const uint64_t numVisible = cullMeshes(p_Camera);
+  renderDepth(
+      p_CmdList,
+      p_Camera,
+      spotLightShadowPSO,
+      m_VisibleMeshes.data(),
+      numVisible,
+      MeshPass::SpotShadow,
+      float(SpotLightShadowMapSize));
 }
 //---------------------------------------------------------------------------//
 // Render shadows for all spot lights
@@ -1695,8 +1849,47 @@ void RenderManager::renderSpotLightShadowMap(
 
   const std::vector<ModelSpotLight>& spotLights = sceneModel.SpotLights();
   const uint64_t numSpotLights = std::min<uint64_t>(spotLights.size(), AppSettings::MaxLightClamp);
-  for (uint64_t i = 0; i < numSpotLights; ++i)
+
+  // Everything the depth of every slice depends on besides the light itself
+  uint64_t settingsHash = hashValue(SpotLightShadowMapSize, 0);
+  settingsHash = hashValue(AppSettings::SpotShadowNearClip, settingsHash);
+  settingsHash = hashValue(AppSettings::SpotLightRange, settingsHash);
+  settingsHash = hashValue(AppSettings::ShadowLodPixelError, settingsHash);
+  m_SpotShadowCache.setSettingsHash(settingsHash);
+  if (AppSettings::EnableSpotShadowCache == false)
+    m_SpotShadowCache.invalidateAll();
+
+  // Lights past the shadow map slices are unshadowed
+  const uint64_t numShadowedLights =
+      std::min<uint64_t>(numSpotLights, spotLightShadowMatrices.size());
+  PerspectiveCamera shadowCameras[AppSettings::MaxSpotLightShadows];
+  for (uint64_t i = 0; i < numShadowedLights; ++i)
   {
+    const ModelSpotLight& light = spotLights[i];
+
+    PerspectiveCamera& shadowCamera = shadowCameras[i];
+    shadowCamera.Initialize(
+        1.0f,
+        light.AngularAttenuation.y,
+        AppSettings::SpotShadowNearClip,
+        AppSettings::SpotLightRange,
+        float(SpotLightShadowMapSize));
+    shadowCamera.SetPosition(light.Position);
+    shadowCamera.SetOrientation(light.Orientation);
+    m_SpotShadowCache.setSliceCamera(uint32_t(i), shadowCamera.ViewProjectionMatrix());
+  }
+
+  // Lights past the clamp aren't drawn, their slices stay invalid until they're back
+  m_SpotShadowCache.collectUpdates(
+      uint32_t(std::max(AppSettings::SpotShadowUpdateBudget, 0)), m_SpotShadowUpdates);
+  for (uint32_t i : m_SpotShadowUpdates)
+  {
+    if (i >= numShadowedLights)
+    {
+      m_SpotShadowCache.invalidate(i);
+      continue;
+    }
+
     PIXBeginEvent(p_CmdList, 0, "Rendering Spot Light Shadow  %u", i);
 
     // Set the viewport
@@ -1708,39 +1901,37 @@ void RenderManager::renderSpotLightShadowMap(
     p_CmdList->ClearDepthStencilView(
         dsv, D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.0f, 0, 0, nullptr);
 
-    const ModelSpotLight& light = spotLights[i];
-
     // Draw the mesh with depth only, using the new shadow camera
-    PerspectiveCamera shadowCamera;
-    shadowCamera.Initialize(
-        1.0f,
-        light.AngularAttenuation.y,
-        AppSettings::SpotShadowNearClip,
-        AppSettings::SpotLightRange,
-        float(SpotLightShadowMapSize));
-    shadowCamera.SetPosition(light.Position);
-    shadowCamera.SetOrientation(light.Orientation);
-    renderSpotLightShadowDepth(p_CmdList, shadowCamera);
-
-    // TODO: should the result get transposed?
-    glm::mat4 shadowMatrix =
-        shadowCamera.ViewProjectionMatrix() * ShadowHelper::ShadowScaleOffsetMatrix;
-    spotLightShadowMatrices[i] = shadowMatrix;
+    renderSpotLightShadowDepth(p_CmdList, shadowCameras[i]);
 
     PIXEndEvent(p_CmdList); // End spotlight shadow
   }
 
+  // Slices whose update got deferred are sampled with the matrix they were rendered with
+  for (uint64_t i = 0; i < numShadowedLights; ++i)
+  {
+    // TODO: should the result get transposed?
+    spotLightShadowMatrices[i] = m_SpotShadowCache.renderedViewProjection(uint32_t(i)) *
+                                 ShadowHelper::ShadowScaleOffsetMatrix;
+  }
+
   PIXEndEvent(p_CmdList); // End spotlight shadowmap
 }
 //---------------------------------------------------------------------------//
 // Renders all meshes using depth-only rendering for a sun shadow map
 void RenderManager::renderSunShadowDepth(
-    ID3D12GraphicsCommandList* cmdList, const OrthographicCamera& camera)
+    ID3D12GraphicsCommandList* cmdList,
+    const OrthographicCamera& camera,
+    const std::vector<uint32_t>& casters)
 {
-  // TODO: Frustum culls meshes for an orthographic projection
-
-  const uint64_t numVisible = sceneModel.Meshes().size();
-  renderDepth(cmdList, camera, sunShadowPSO, numVisible);
+  renderDepth(
+      cmdList,
+      camera,
+      sunShadowPSO,
+      casters.data(),
+      casters.size(),
+      MeshPass::SunShadow,
+      float(SunShadowMapSize));
 }
 //---------------------------------------------------------------------------//
 void RenderManager::renderSunShadowMap (
@@ -1757,6 +1948,36 @@ void RenderManager::renderSunShadowMap (
       sunShadowConstants.Base,
       cascadeCameras);
 
+  // Cull the casters of all cascades at once
+  if (AppSettings::EnableFrustumCulling)
+  {
+    ShadowHelper::cullCascadeCasters(
+        m_MeshBounds,
+        AppSettings::SunDirection,
+        SunShadowMapSize,
+        camera,
+        sunShadowConstants.Base,
+        cascadeCameras,
+        m_SunShadowCasters,
+        m_SunShadowCullingStats);
+  }
+  else
+  {
+    m_SunShadowCullingStats = SunShadowCullingStats();
+    m_SunShadowCullingStats.NumMeshes = m_MeshBounds.count();
+    for (uint64_t cascadeIdx = 0; cascadeIdx < NumCascades; ++cascadeIdx)
+    {
+      m_SunShadowCasters[cascadeIdx].resize(m_MeshBounds.count());
+      for (uint32_t i = 0; i < m_MeshBounds.count(); ++i)
+        m_SunShadowCasters[cascadeIdx][i] = i;
+      m_SunShadowCullingStats.NumCasters[cascadeIdx] = m_MeshBounds.count();
+    }
+  }
+
+  static_assert(arrayCount32(AppSettings::SunShadowCasters) == NumCascades);
+  for (uint64_t cascadeIdx = 0; cascadeIdx < NumCascades; ++cascadeIdx)
+    AppSettings::SunShadowCasters[cascadeIdx] = m_SunShadowCullingStats.NumCasters[cascadeIdx];
+
   // Render the meshes to each cascade
   for (uint64_t cascadeIdx = 0; cascadeIdx < NumCascades; ++cascadeIdx)
   {
@@ -1772,7 +1993,7 @@ void RenderManager::renderSunShadowMap (
         dsv, D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.0f, 0, 0, nullptr);
 
     // Draw the mesh with depth only, using the new shadow camera
-    renderSunShadowDepth(p_CmdList, cascadeCameras[cascadeIdx]);
+    renderSunShadowDepth(p_CmdList, cascadeCameras[cascadeIdx], m_SunShadowCasters[cascadeIdx]);
 
     PIXEndEvent(p_CmdList); // End cascade shadowmap
   }
@@ -1785,6 +2006,9 @@ void RenderManager::populateCommandList()
 {
   SetDescriptorHeaps(m_CmdList);
 
+  for (VertexFetchStats& stats : m_VertexFetchStats)
+    stats = VertexFetchStats();
+
   renderClusters();
 
   if (AppSettings::EnableSky)
@@ -1810,9 +2034,14 @@ void RenderManager::populateCommandList()
 
     VolumetricFog::RenderDesc desc =
     {
-        .ClusterBufferSrv = spotLightClusterBuffer.SRV,
+        .ClusterBufferSrv = spotLightClusterSrv(),
         .DepthBufferSrv = depthBuffer.getSrv(),
         .SpotLightShadowSrv = spotLightShadowMap.getSrv(),
+        .SpotLightBufferSrv = spotLightBuffer.m_SrvIndex,
+        .SpotLightShadowMatrixBufferSrv = spotLightShadowMatrixBuffer.m_SrvIndex,
+        .NumSpotLights =
+            uint32_t(std::min<uint64_t>(spotLights.size(), AppSettings::MaxLightClamp)),
+        .SpotLightElementsPerCluster = spotLightElementsPerCluster,
 
         .UVMapSrv = uvTarget.srv(),
         .TangentFrameSrv = tangentFrameTarget.srv(),
@@ -1827,7 +2056,6 @@ void RenderManager::populateCommandList()
 
         .Camera = camera,
         .PrevViewProj = prevViewProj,
-        .LightsBuffer = spotLightBuffer,
 
         .HaltonXY = jitterOffsetXY
     };
@@ -1836,6 +2064,11 @@ void RenderManager::populateCommandList()
 
   renderDeferred();
 
+  // Only the first frame is logged, the counts cover what that view drew after culling and LOD
+  // selection rather than the whole scene
+  if (g_CurrentCPUFrame == 0)
+    logVertexFetchStats();
+
   renderParticles();
 
   // prepare main render target for post processing
@@ -1947,6 +2180,8 @@ void RenderManager::OnInit(UINT p_Width, UINT p_Height, std::wstring p_Name)
   m_Info.m_Height = p_Height;
   m_Info.m_Title = p_Name;
   m_Info.m_UseWarpDevice = false;
+  m_Info.m_RunSelfTest = false;
+  m_Info.m_RunBenchmark = false;
 
   WCHAR assetsPath[512];
   getAssetsPath(assetsPath, _countof(assetsPath));
@@ -1957,6 +2192,17 @@ void RenderManager::OnInit(UINT p_Width, UINT p_Height, std::wstring p_Name)
   m_Info.m_IsInitialized = true;
 }
 //---------------------------------------------------------------------------//
+ModelLoadSettings RenderManager::sceneLoadSettings()
+{
+  ModelLoadSettings settings;
+  settings.FilePath = L"..\\Content\\Models\\Sponza\\Sponza.fbx";
+  settings.ForceSRGB = true;
+  settings.SceneScale = 0.01f;
+  settings.MergeMeshes = false;
+  settings.NumLods = MaxMeshLods;
+  return settings;
+}
+//---------------------------------------------------------------------------//
 void RenderManager::onLoad()
 {
   DEBUG_BREAK(m_Info.m_IsInitialized);
@@ -1982,6 +2228,11 @@ void RenderManager::onLoad()
   // init sampled spectrum
   SampledSpectrum::Init();
 
+  // Sky parameter table (built and saved on the first run) and background sky baker, both need
+  // the sampled spectrum
+  skyTable.init(L"..\\Content\\HosekSky.skytable", &getWorkerPool());
+  skyBaker.init(FRAME_COUNT, &skyTable);
+
   // Init volumetric fog
   m_Fog.init(m_Dev);
 
@@ -2051,8 +2302,14 @@ void RenderManager::onDestroy()
   deferredTarget.deinit();
 
   spotLightBuffer.deinit();
+  spotLightShadowMatrixBuffer.deinit();
   spotLightBoundsBuffer.deinit();
   spotLightClusterBuffer.deinit();
+  spotLightClusterUploadBuffer.deinit();
+  for (uint32_t i = 0; i < FRAME_COUNT; ++i)
+    spotLightClusterReadback[i].deinit();
+  pointLightBuffer.deinit();
+  pointLightClusterBuffer.deinit();
   spotLightInstanceBuffer.deinit();
 
   spotLightClusterVtxBuffer.deinit();
@@ -2090,7 +2347,8 @@ void RenderManager::onDestroy()
   ShadowHelper::deinit();
 
   skybox.Shutdown();
-  skyCache.Shutdown();
+  skyBaker.deinit();
+  skyTable.deinit();
 
   m_PostFx.deinit();
   AppSettings::deinit();
@@ -2218,21 +2476,21 @@ void RenderManager::onUpdate()
   // update light bound buffer for clustering
   updateLights();
 
-  // update sky cache
-  skyCache.Init(
-      AppSettings::SunDirection,
-      AppSettings::SunSize,
-      AppSettings::GroundAlbedo,
-      AppSettings::Turbidity,
-      true);
+  // update sky cache, baked in the background and swapped in once done
+  SkyParameters skyParameters;
+  skyParameters.SunDirection = AppSettings::SunDirection;
+  skyParameters.SunSize = AppSettings::SunSize;
+  skyParameters.GroundAlbedo = AppSettings::GroundAlbedo;
+  skyParameters.Turbidity = AppSettings::Turbidity;
+  skyBaker.request(skyParameters);
+  skyBaker.update(g_CurrentCPUFrame);
 
   // Update light uniforms
+  if (spotLights.empty() == false)
   {
-    const void* srcData[2] = {spotLights.data(), spotLightShadowMatrices};
-    uint64_t sizes[2] = {
-        spotLights.size() * sizeof(SpotLight), spotLights.size() * sizeof(glm::mat4)};
-    uint64_t offsets[2] = {0, AppSettings::MaxSpotLights * sizeof(SpotLight)};
-    spotLightBuffer.multiUpdateData(srcData, sizes, offsets, arrayCount(srcData));
+    spotLightBuffer.updateData(spotLights.data(), spotLights.size(), 0);
+    spotLightShadowMatrixBuffer.updateData(
+        spotLightShadowMatrices.data(), spotLightShadowMatrices.size(), 0);
   }
 
   // Update gpu mesh data
@@ -2440,6 +2698,7 @@ void RenderManager::onResize()
     camera.SetAspectRatio(aspect);
 
     createRenderTargets();
+    m_GpuDrivenRenderer.onResize(m_Info.m_Width, m_Info.m_Height);
 
     // Re-create psos:
     createPSOs();
@@ -2495,136 +2754,117 @@ void RenderManager::onShaderChange()
   pauseRendering = false;
 }
 //---------------------------------------------------------------------------//
-void RenderManager::updateLights()
+void RenderManager::logVertexFetchStats() const
 {
-  const uint64_t numSpotLights = std::min<uint64_t>(spotLights.size(), AppSettings::MaxLightClamp);
-
-  // An additional scale factor that is needed to make sure that our polygonal bounding cone fully
-  // encloses the actual cone representing the light's area of influence
-  const float inRadius = std::cos(Pi / NumConeSides);
-  float scaleCorrection = 1.0f / inRadius;
+  static const char* PassNames[] = {"GBuffer", "Spot shadows", "Sun shadows"};
+  static_assert(arrayCount32(PassNames) == uint32_t(MeshPass::Count));
 
-  // NOTE(OM): disabling scale correction for a visual bug 
-  /*
-    the bug can be reproduced by putting camera at the following position:
-
-    camera.SetPosition(glm::vec3(3.49f, 1.76f, 0.49f));
-    camera.SetXRotation(-3.14f / 12.0f);
-    camera.SetYRotation(1.5f * 3.14f);
-  */
-  scaleCorrection = 1.0f;
-
-  const glm::mat4 viewMatrix = camera.ViewMatrix();
-  const float nearClip = camera.NearClip();
-  const float farClip = camera.FarClip();
-  const float zRange = farClip - nearClip;
-  const glm::vec3 cameraPos = camera.Position();
-  const uint64_t numConeVerts = coneVertices.size();
-
-  // Come up with a bounding sphere that surrounds the near clipping plane. We'll test this sphere
-  // for intersection with the spotlight's bounding cone and use that to over-estimate if the
-  // bounding geometry will end up getting clipped by the camera's near clipping plane
-  glm::vec3 nearClipCenter = cameraPos + nearClip * camera.Forward();
-  glm::mat4 invViewProjection = glm::inverse(camera.ViewProjectionMatrix());
-  glm::vec3 nearTopRight = _transformVec3Mat4(glm::vec3(1.0f, 1.0f, 0.0f), invViewProjection);
-  float nearClipRadius = glm::length(nearTopRight - nearClipCenter);
-
-  ClusterBounds* boundsData = spotLightBoundsBuffer.map<ClusterBounds>();
-  bool intersectsCamera[AppSettings::MaxSpotLights] = {};
-
-  // Update the light bounds buffer
-  for (uint64_t spotLightIdx = 0; spotLightIdx < numSpotLights; ++spotLightIdx)
-  {
-    const SpotLight& spotLight = spotLights[spotLightIdx];
-    const ModelSpotLight& srcSpotLight = sceneModel.SpotLights()[spotLightIdx];
-    ClusterBounds bounds;
-    bounds.Position = spotLight.Position;
-    bounds.Orientation = srcSpotLight.Orientation;
-    bounds.Scale.x = bounds.Scale.y =
-        std::tan(srcSpotLight.AngularAttenuation.y / 2.0f) * spotLight.Range * scaleCorrection;
-    bounds.Scale.z = spotLight.Range;
-
-    // Compute conservative Z bounds for the light based on vertices of the bounding geometry
-    constexpr float FloatMax = std::numeric_limits<float>::max();
-    float minZ = FloatMax;
-    float maxZ = -FloatMax;
-    for (uint64_t i = 0; i < numConeVerts; ++i)
-    {
-      glm::vec3 coneVert = coneVertices[i] * bounds.Scale;
-      // coneVert = coneVert * bounds.Orientation.ToMat3(); // glm so mat * vec
-      coneVert = bounds.Orientation.ToMat3() * coneVert; // glm so mat * vec
-      coneVert += bounds.Position;
-
-      float vertZ = _transformVec3Mat4(coneVert, viewMatrix).z;
-      minZ = std::min(minZ, vertZ);
-      maxZ = std::max(maxZ, vertZ);
-    }
-
-    minZ = saturate((minZ - nearClip) / zRange);
-    maxZ = saturate((maxZ - nearClip) / zRange);
-
-    bounds.ZBounds.x = uint32_t(minZ * AppSettings::NumZTiles);
-    bounds.ZBounds.y =
-        std::min(uint32_t(maxZ * AppSettings::NumZTiles), uint32_t(AppSettings::NumZTiles - 1));
-
-    // Estimate if the light's bounding geometry intersects with the camera's near clip plane
-    boundsData[spotLightIdx] = bounds;
-    intersectsCamera[spotLightIdx] = _sphereConeIntersection(
-        spotLight.Position,
-        srcSpotLight.Direction,
-        spotLight.Range,
-        srcSpotLight.AngularAttenuation.y,
-        nearClipCenter,
-        nearClipRadius);
-
-    // there is a random cluster flickering bug with spotlight #17
-    //if (spotLightIdx == 17)
-    //  intersectsCamera[spotLightIdx] = true;
-
-    spotLights[spotLightIdx].Intensity = srcSpotLight.Intensity * SpotLightIntensityFactor;
-
-    //if (spotLightIdx == 17)
-    //  {
-    //    if (intersectsCamera[spotLightIdx] == true)
-    //    {
-    //        char msg[256]{};
-    //        sprintf_s<256>(msg, "spotlight %d intersected\n", uint32_t(spotLightIdx));
-    //        OutputDebugStringA(msg);
-    //    }
-    //    if (intersectsCamera[spotLightIdx] == false)
-    //    {
-    //      char msg[256]{};
-    //      sprintf_s<256>(msg, "spotlight %d not intersected\n", uint32_t(spotLightIdx));
-    //      OutputDebugStringA(msg);
-    //    }
-    //}
-
-
-    //if (spotLightIdx == 17)
-    //  spotLights[spotLightIdx].Intensity = glm::vec3(0.0f);
-  }
-
-  numIntersectingSpotLights = 0;
-  uint32_t* instanceData = spotLightInstanceBuffer.map<uint32_t>();
-
-  for (uint64_t spotLightIdx = 0; spotLightIdx < numSpotLights; ++spotLightIdx)
-    if (intersectsCamera[spotLightIdx])
-    {
-      instanceData[numIntersectingSpotLights++] = uint32_t(spotLightIdx);
+  for (uint32_t i = 0; i < uint32_t(MeshPass::Count); ++i)
+  {
+    const VertexFetchStats& stats = m_VertexFetchStats[i];
+    writeLog(
+        "Vertex fetch %s: %llu draws, %llu vertices, %.2f MB (%.2f MB with the full vertex layout)",
+        PassNames[i],
+        stats.Draws,
+        stats.Vertices,
+        stats.FetchedBytes / (1024.0 * 1024.0),
+        stats.InterleavedBytes / (1024.0 * 1024.0));
+  }
+}
+//---------------------------------------------------------------------------//
+void RenderManager::updateLights()
+{
+  const uint32_t numSpotLights =
+      uint32_t(std::min<uint64_t>(spotLights.size(), AppSettings::MaxLightClamp));
 
-      char msg[256]{};
-      sprintf_s<256>(msg, "active index = %d\n", uint32_t(spotLightIdx));
-      //OutputDebugStringA(msg);
-    }
+  for (uint32_t spotLightIdx = 0; spotLightIdx < numSpotLights; ++spotLightIdx)
+    spotLights[spotLightIdx].Intensity =
+        sceneModel.SpotLights()[spotLightIdx].Intensity * SpotLightIntensityFactor;
 
-  uint64_t offset = numIntersectingSpotLights;
-  for (uint64_t spotLightIdx = 0; spotLightIdx < numSpotLights; ++spotLightIdx)
-    if (intersectsCamera[spotLightIdx] == false)
-      instanceData[offset++] = uint32_t(spotLightIdx);
+  // Update the light bounds buffer, the lights are split into SIMD batches across the workers
+  const LightBoundsView view = LightBounds::makeView(camera, uint32_t(AppSettings::NumZTiles));
+  LightBounds::compute(
+      spotLightBounds,
+      view,
+      coneVertices,
+      numSpotLights,
+      spotLightClusterBounds.data(),
+      spotLightIntersectsCamera.data());
+  spotLightBoundsBuffer.mapAndSetData(spotLightClusterBounds.data(), numSpotLights);
+
+  // Lights whose bounding geometry may get clipped by the camera's near plane are drawn first
+  numIntersectingSpotLights = LightBounds::buildInstanceList(
+      spotLightIntersectsCamera.data(), numSpotLights, spotLightInstanceBuffer.map<uint32_t>());
+
+  // The GPU masks read back from the last frame with this index, moveToNextFrame() waited for it
+  if (spotLightClusterReadbackPending[m_FrameIndex])
+  {
+    ReadbackBuffer& readback = spotLightClusterReadback[m_FrameIndex];
+    const std::vector<uint32_t>& cpuMask = spotLightClusterMasks[m_FrameIndex];
+    const ClusterBinningStats stats =
+        ClusterBinner::compare(readback.map<uint32_t>(), cpuMask.data(), cpuMask.size());
+    readback.unmap();
+    spotLightClusterReadbackPending[m_FrameIndex] = false;
+
+    if (stats.NumMissing > 0)
+      writeLog(
+          "Cluster binning: %llu of the %llu light bits set by the GPU are missing on the CPU, "
+          "%llu set by the CPU only",
+          stats.NumMissing,
+          stats.NumReferenceBits,
+          stats.NumExtra);
+  }
+
+  // The mode is latched so the frame binds the masks it filled
+  spotLightBinningMode = AppSettings::ClusterBinningMode;
+  if (spotLightBinningMode != AppSettings::ClusterBinning_GPU)
+  {
+    const ClusterGrid grid = ClusterBinner::makeGrid(
+        camera,
+        uint32_t(AppSettings::NumXTiles),
+        uint32_t(AppSettings::NumYTiles),
+        uint32_t(AppSettings::NumZTiles),
+        spotLightElementsPerCluster);
+
+    std::vector<uint32_t>& mask = spotLightClusterMasks[m_FrameIndex];
+    spotLightBinner.bin(
+        grid,
+        coneVertices,
+        spotLightClusterBounds.data(),
+        spotLightIntersectsCamera.data(),
+        AppSettings::RenderLights ? numSpotLights : 0,
+        mask.data());
+
+    if (spotLightBinningMode == AppSettings::ClusterBinning_CPU)
+      spotLightClusterUploadBuffer.mapAndSetData(mask.data(), mask.size());
+  }
+
+  // Point lights have no cluster pass, their spheres are binned here every frame
+  if (pointLightElementsPerCluster > 0)
+  {
+    const ClusterGrid grid = ClusterBinner::makeGrid(
+        camera,
+        uint32_t(AppSettings::NumXTiles),
+        uint32_t(AppSettings::NumYTiles),
+        uint32_t(AppSettings::NumZTiles),
+        pointLightElementsPerCluster);
+
+    pointLightBinner.bin(
+        grid,
+        pointLightSpheres.data(),
+        AppSettings::RenderLights ? uint32_t(pointLightSpheres.size()) : 0,
+        pointLightClusterMask.data());
+    pointLightClusterBuffer.mapAndSetData(
+        pointLightClusterMask.data(), pointLightClusterMask.size());
+  }
 }
 //---------------------------------------------------------------------------//
 void RenderManager::renderClusters()
 {
+  // Uploaded in updateLights()
+  if (spotLightBinningMode == AppSettings::ClusterBinning_CPU)
+    return;
+
   PIXBeginEvent(m_CmdList.GetInterfacePtr(), 0, "Cluster Update");
 
   spotLightClusterBuffer.makeWritable(m_CmdList);
@@ -2676,7 +2916,7 @@ void RenderManager::renderClusters()
     D3D12_INDEX_BUFFER_VIEW ibView = spotLightClusterIdxBuffer.IBView();
     m_CmdList->IASetIndexBuffer(&ibView);
 
-    clusterConstants.ElementsPerCluster = uint32_t(AppSettings::SpotLightElementsPerCluster);
+    clusterConstants.ElementsPerCluster = spotLightElementsPerCluster;
     clusterConstants.InstanceOffset = 0;
     clusterConstants.BoundsBufferIdx = spotLightBoundsBuffer.m_SrvIndex;
     clusterConstants.VertexBufferIdx = spotLightClusterVtxBuffer.m_SrvIndex;
@@ -2726,9 +2966,24 @@ void RenderManager::renderClusters()
   // Sync back cluster buffer to be read
   spotLightClusterBuffer.makeReadable(m_CmdList);
 
+  if (spotLightBinningMode == AppSettings::ClusterBinning_GPUCheckedOnCPU)
+  {
+    const ReadbackBuffer& readback = spotLightClusterReadback[m_FrameIndex];
+    m_CmdList->CopyBufferRegion(
+        readback.Resource, 0, spotLightClusterBuffer.getResource(), 0, readback.Size);
+    spotLightClusterReadbackPending[m_FrameIndex] = true;
+  }
+
   PIXEndEvent(m_CmdList.GetInterfacePtr()); // End Cluster Update
 }
 //---------------------------------------------------------------------------//
+uint32_t RenderManager::spotLightClusterSrv() const
+{
+  return spotLightBinningMode == AppSettings::ClusterBinning_CPU
+             ? spotLightClusterUploadBuffer.SRV
+             : spotLightClusterBuffer.SRV;
+}
+//---------------------------------------------------------------------------//
 // Renders the 2D "overhead" visualizer that shows per-cluster light counts
 void RenderManager::renderClusterVisualizer()
 {
@@ -2780,7 +3035,10 @@ void RenderManager::renderClusterVisualizer()
   clusterVisConstants.NumXTiles = uint32_t(AppSettings::NumXTiles);
   clusterVisConstants.NumXYTiles = uint32_t(AppSettings::NumXTiles * AppSettings::NumYTiles);
   clusterVisConstants.DecalClusterBufferIdx = -1; // TODO: Decals
-  clusterVisConstants.SpotLightClusterBufferIdx = spotLightClusterBuffer.SRV;
+  clusterVisConstants.SpotLightClusterBufferIdx = spotLightClusterSrv();
+  clusterVisConstants.SpotLightElementsPerCluster = spotLightElementsPerCluster;
+  clusterVisConstants.PointLightClusterBufferIdx = pointLightClusterBuffer.SRV;
+  clusterVisConstants.PointLightElementsPerCluster = pointLightElementsPerCluster;
   BindTempConstantBuffer(
       m_CmdList, clusterVisConstants, ClusterVisParams_CBuffer, CmdListMode::Graphics);
 
@@ -14,7 +14,15 @@
 #include "TAA.hpp"
 #include "MotionVector.hpp"
 #include "SkyModels/AnalyticalSkyModel.hpp" // Skybox
+#include "SkyModels/SkyBaker.hpp"
+#include "SkyModels/SkyTable.hpp"
 #include "ShadowHelper.hpp"
+#include "FrustumCulling.hpp"
+#include "Bvh.hpp"
+#include "SoftwareOcclusion.hpp"
+#include "ShadowCache.hpp"
+#include "LightBounds.hpp"
+#include "ClusterBinning.hpp"
 #include "GpuDrivenRenderer.hpp"
 
 #define FRAME_COUNT 2
@@ -42,6 +50,10 @@ struct RendererSettings
   // State info
   bool m_IsInitialized;
 
+  // Run the headless checks or timings (see SelfTest.hpp) instead of opening the window
+  bool m_RunSelfTest;
+  bool m_RunBenchmark;
+
   // Additional data goes here:
   //
 };
@@ -59,6 +71,14 @@ struct SpotLight
   glm::vec3 Intensity;
   float Range;
 };
+struct PointLight
+{
+  glm::vec3 Position;
+  float Range;
+
+  glm::vec3 Intensity;
+  float unused;
+};
 struct ShadingConstants
 {
   Float4Align glm::vec3 SunDirectionWS;
@@ -78,6 +98,35 @@ struct ShadingConstants
   //float unused;
 };
 static_assert(sizeof(ShadingConstants) == 208);
+
+// Mesh passes that report their vertex fetch
+enum class MeshPass : uint32_t
+{
+  GBuffer,
+  SpotShadow,
+  SunShadow,
+
+  Count
+};
+
+// CPU-side tally of the vertex data a mesh pass pulls in a frame. Each draw counts its vertices
+// once, i.e. the fetch with a perfect post-transform cache.
+struct VertexFetchStats
+{
+  uint64_t Draws = 0;
+  uint64_t Vertices = 0;
+  // With the streams the pass binds, and with the full scene vertex layout for comparison
+  uint64_t FetchedBytes = 0;
+  uint64_t InterleavedBytes = 0;
+
+  void addDraw(uint32_t numVertices, uint32_t boundStride, uint32_t interleavedStride)
+  {
+    ++Draws;
+    Vertices += numVertices;
+    FetchedBytes += uint64_t(numVertices) * boundStride;
+    InterleavedBytes += uint64_t(numVertices) * interleavedStride;
+  }
+};
 //---------------------------------------------------------------------------//
 // RenderManager Manager:
 //---------------------------------------------------------------------------//
@@ -120,9 +169,21 @@ struct RenderManager
         m_Info.m_UseWarpDevice = true;
         m_Info.m_Title = m_Info.m_Title + L" (WARP)";
       }
+      else if (_wcsicmp(p_Argv[i], L"-selftest") == 0 || _wcsicmp(p_Argv[i], L"/selftest") == 0)
+      {
+        m_Info.m_RunSelfTest = true;
+      }
+      else if (
+          _wcsicmp(p_Argv[i], L"-benchmark") == 0 || _wcsicmp(p_Argv[i], L"/benchmark") == 0)
+      {
+        m_Info.m_RunBenchmark = true;
+      }
     }
   }
 
+  // The scene onLoad() renders, shared with the headless tools
+  static ModelLoadSettings sceneLoadSettings();
+
   //---------------------------------------------------------------------------//
 private:
   // Model loading
@@ -141,8 +202,10 @@ private:
 
   // Light stuff
   std::vector<SpotLight> spotLights;
-  ConstantBuffer spotLightBuffer;
-  glm::mat4 spotLightShadowMatrices[AppSettings::MaxSpotLights];
+  StructuredBuffer spotLightBuffer;
+  // One per shadow map slice, the lights past MaxSpotLightShadows are unshadowed
+  std::vector<glm::mat4> spotLightShadowMatrices;
+  StructuredBuffer spotLightShadowMatrixBuffer;
   DepthBuffer spotLightShadowMap;
 
   DepthBuffer sunShadowMap;
@@ -152,6 +215,30 @@ private:
   StructuredBuffer spotLightInstanceBuffer;
   RawBuffer spotLightClusterBuffer;
   uint64_t numIntersectingSpotLights = 0;
+  // 32 lights per 4-byte mask element
+  uint32_t spotLightElementsPerCluster = 1;
+  SpotLightBounds spotLightBounds;
+  std::vector<ClusterBounds> spotLightClusterBounds;
+  std::vector<uint8_t> spotLightIntersectsCamera;
+
+  // CPU binning, uploaded in place of the cluster passes or compared with their read back result
+  ClusterBinner spotLightBinner;
+  int32_t spotLightBinningMode = AppSettings::ClusterBinning_GPU;
+  std::vector<uint32_t> spotLightClusterMasks[FRAME_COUNT];
+  RawBuffer spotLightClusterUploadBuffer;
+  ReadbackBuffer spotLightClusterReadback[FRAME_COUNT];
+  bool spotLightClusterReadbackPending[FRAME_COUNT] = {};
+
+  // Point lights are binned on the CPU only, their masks follow the spot light ones
+  std::vector<PointLight> pointLights;
+  StructuredBuffer pointLightBuffer;
+  // World space center and range of each light
+  std::vector<glm::vec4> pointLightSpheres;
+  PointLightBinner pointLightBinner;
+  std::vector<uint32_t> pointLightClusterMask;
+  RawBuffer pointLightClusterBuffer;
+  // 0 without point lights, the shading passes then skip them
+  uint32_t pointLightElementsPerCluster = 0;
 
   ID3D12RootSignature* clusterRS = nullptr;
   ID3DBlobPtr clusterVS;
@@ -211,7 +298,8 @@ private:
   GpuDrivenRenderer m_GpuDrivenRenderer;
   
   Skybox skybox;
-  SkyCache skyCache;
+  SkyTable skyTable;
+  SkyBaker skyBaker;
 
   // Synchronization objects.
   HANDLE m_SwapChainEvent;
@@ -223,6 +311,7 @@ private:
 
   // Shaders blob
   ID3DBlobPtr m_GBufferVS = nullptr;
+  ID3DBlobPtr m_DepthVS = nullptr;
   ID3DBlobPtr m_GBufferPS = nullptr;
   ID3DBlobPtr m_DeferredCS = nullptr;
 
@@ -242,25 +331,55 @@ private:
   void renderParticles();
   void createRenderTargets();
 
-  // Renders all meshes using depth-only rendering
+  // Fills m_VisibleMeshes with the scene meshes inside the camera frustum, returns how many
+  uint32_t cullMeshes(const CameraBase& p_Camera);
+  CullingBounds m_MeshBounds;
+  Bvh m_MeshBvh;
+  std::vector<uint32_t> m_VisibleMeshes;
+
+  // Drops the first p_NumVisible m_VisibleMeshes hidden behind the largest meshes in view,
+  // rasterized on the CPU. Returns how many are left.
+  uint32_t occlusionCullMeshes(const CameraBase& p_Camera, uint32_t p_NumVisible);
+  SoftwareOcclusionBuffer m_SoftwareOcclusion;
+  // Built the first time a mesh is picked as an occluder, indexed like the scene meshes
+  std::vector<OccluderMesh> m_OccluderMeshes;
+  std::vector<uint32_t> m_Occluders;
+
+  // Renders the given meshes using depth-only rendering
   void renderDepth(
       ID3D12GraphicsCommandList* p_CmdList,
       const CameraBase& p_Camera,
       ID3D12PipelineState* p_PSO,
-      uint64_t p_NumVisible);
+      const uint32_t* p_VisibleMeshes,
+      uint64_t p_NumVisible,
+      MeshPass p_Pass,
+      float p_ViewportHeight);
 
   // Renders all meshes using depth-only rendering for spotlight shadowmap
   void renderSpotLightShadowDepth(ID3D12GraphicsCommandList* p_CmdList, const CameraBase& p_Camera);
 
-  // Render shadows for all spot lights
+  // Render shadows for the spot lights whose cached slice is stale
   void renderSpotLightShadowMap(ID3D12GraphicsCommandList* p_CmdList, const CameraBase& p_Camera);
+  ShadowCache m_SpotShadowCache;
+  std::vector<uint32_t> m_SpotShadowUpdates;
 
-  void renderSunShadowDepth(ID3D12GraphicsCommandList* cmdList, const OrthographicCamera& camera);
+  void renderSunShadowDepth(
+      ID3D12GraphicsCommandList* cmdList,
+      const OrthographicCamera& camera,
+      const std::vector<uint32_t>& casters);
   void renderSunShadowMap(ID3D12GraphicsCommandList* p_CmdList, const CameraBase& p_Camera);
+  std::vector<uint32_t> m_SunShadowCasters[NumCascades];
+  SunShadowCullingStats m_SunShadowCullingStats;
+
+  // Vertex fetch of the last recorded frame, written to the debug output
+  void logVertexFetchStats() const;
+  VertexFetchStats m_VertexFetchStats[uint32_t(MeshPass::Count)];
 
   // Clustered rendering
   void updateLights();
   void renderClusters();
+  // Cluster masks the shading passes read this frame
+  uint32_t spotLightClusterSrv() const;
   void renderClusterVisualizer();
 };
 
@@ -0,0 +1,108 @@
+#include "SelfTest.hpp"
+#include "GpuDrivenRenderer.hpp"
+#include "SkyModels/AnalyticalSkyModel.hpp"
+#include "SkyModels/SkyBaker.hpp"
+#include "SkyModels/SkyRadiance.hpp"
+#include "SkyModels/SkyTable.hpp"
+#include "Bvh.hpp"
+#include "ClusterBinning.hpp"
+#include "ClusterLod.hpp"
+#include "FrustumCulling.hpp"
+#include "IblBaker.hpp"
+#include "LightBounds.hpp"
+#include "OcclusionCulling.hpp"
+#include "SceneGraph.hpp"
+#include "ShadowCache.hpp"
+#include "ShadowHelper.hpp"
+#include "SoftwareOcclusion.hpp"
+#include "Spectrum.hpp"
+#include "SphericalHarmonics.hpp"
+
+namespace SelfTest
+{
+
+//---------------------------------------------------------------------------//
+bool runChecks(const ModelLoadSettings& p_SceneSettings)
+{
+  // The sky checks bake spectra
+  SampledSpectrum::Init();
+
+  uint32_t numFailed = 0;
+  uint32_t numChecks = 0;
+  auto run = [&](const char* p_Name, bool p_Passed) {
+    if (p_Passed == false)
+    {
+      writeLog("SelfTest: %s FAILED", p_Name);
+      ++numFailed;
+    }
+    ++numChecks;
+  };
+
+  // Culling and lights
+  run("FrustumCulling", FrustumCulling::validate());
+  run("Bvh", Bvh::validate());
+  run("OcclusionCulling", OcclusionCulling::validate());
+  run("SoftwareOcclusion", SoftwareOcclusion::validate());
+  run("LightBounds", LightBounds::validate());
+  run("ClusterBinner", ClusterBinner::validate());
+  run("PointLightBinner", PointLightBinner::validate());
+  run("Cascade caster culling", ShadowHelper::validateCascadeCulling());
+  run("ShadowCache", ShadowCache::validate());
+  run("SceneGraph", SceneGraph::validate());
+
+  // Geometry
+  run("Model vertex packing", Model::ValidateVertexPacking());
+  run("Model LODs", Model::ValidateLodGeneration());
+  run("Model wide indices", Model::ValidateWideIndices(L"SelfTestWideIndices.bakedscene"));
+  run("Meshlet wide indices", GpuDrivenRenderer::validateWideIndexMeshlets());
+  run("ClusterLod", ClusterLod::validate(L"SelfTestClusterLod.clusterlod"));
+
+  // Sky and environment lighting
+  run("SkyTable", SkyTable::validate());
+  run("SkyRadianceEvaluator", SkyRadianceEvaluator::validate());
+  run("SkyBaker", SkyBaker::validate());
+  run("IblBaker", IblBaker::validate());
+  run("ProjectCubemapToSH", ValidateProjectCubemapToSH());
+
+  // Scene
+  Model scene;
+  if (scene.LoadMeshData(p_SceneSettings))
+    run("Meshlet build", GpuDrivenRenderer::validateMeshletBuild(scene.Meshes()));
+  scene.Shutdown();
+
+  writeLog("SelfTest: %u of %u checks passed", numChecks - numFailed, numChecks);
+  return numFailed == 0;
+}
+//---------------------------------------------------------------------------//
+void runBenchmarks(const ModelLoadSettings& p_SceneSettings)
+{
+  SampledSpectrum::Init();
+
+  FrustumCulling::benchmark();
+  Bvh::benchmark();
+  OcclusionCulling::benchmark();
+  SoftwareOcclusion::benchmark();
+  LightBounds::benchmark();
+  ClusterBinner::benchmark();
+  PointLightBinner::benchmark();
+  SceneGraph::benchmark();
+
+  SkyCache::Benchmark();
+  SkyTable::benchmark();
+  SkyRadianceEvaluator::benchmark();
+  IblBaker::benchmark();
+
+  Model::BenchmarkLoad(p_SceneSettings);
+  Model::BenchmarkGeometryCodec(p_SceneSettings);
+  Model::ReportMeshOptimization(p_SceneSettings);
+
+  Model scene;
+  if (scene.LoadMeshData(p_SceneSettings))
+  {
+    GpuDrivenRenderer::benchmarkMeshletCache(scene.Meshes(), L"SelfTestMeshletCache.meshlets");
+  }
+  scene.Shutdown();
+}
+//---------------------------------------------------------------------------//
+
+} // namespace SelfTest
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "Model.hpp"
+
+//---------------------------------------------------------------------------//
+// Headless checks and timings of the CPU-side systems, run with -selftest and -benchmark on the
+// command line instead of opening the window. Each system's validate() / benchmark() reports to
+// the debug output, the scene ones use p_SceneSettings and are skipped when the scene is missing.
+//---------------------------------------------------------------------------//
+namespace SelfTest
+{
+
+// Returns false when any check failed
+bool runChecks(const ModelLoadSettings& p_SceneSettings);
+void runBenchmarks(const ModelLoadSettings& p_SceneSettings);
+
+} // namespace SelfTest
@@ -63,9 +63,7 @@ ConstantBuffer<AppSettingsCbuffer> AppSettings : register(b12);
 // Global settings
 static const uint ClusterTileSize = 16;
 static const uint NumZTiles = 16;
-static const uint MaxSpotLights = 32;
 static const float SpotShadowNearClip = 0.1000f;
-static const uint SpotLightElementsPerCluster = 1;
 
 
 // Max value that we can store in an fp16 buffer (actually a little less so that we have room for
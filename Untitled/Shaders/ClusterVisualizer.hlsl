@@ -21,6 +21,9 @@ struct ClusterVisConstants
 
     uint DecalClusterBufferIdx;
     uint SpotLightClusterBufferIdx;
+    uint SpotLightElementsPerCluster;
+    uint PointLightClusterBufferIdx;
+    uint PointLightElementsPerCluster;
 };
 
 ConstantBuffer<ClusterVisConstants> CBuffer : register(b0);
@@ -31,6 +34,7 @@ ConstantBuffer<ClusterVisConstants> CBuffer : register(b0);
 float4 ClusterVisualizerPS(in float4 PositionPS : SV_Position, in float2 TexCoord : TEXCOORD) : SV_Target0
 {
     ByteAddressBuffer spotLightClusterBuffer = RawBufferTable[CBuffer.SpotLightClusterBufferIdx];
+    ByteAddressBuffer pointLightClusterBuffer = RawBufferTable[CBuffer.PointLightClusterBufferIdx];
 
     float3 viewPos = lerp(CBuffer.ViewMin, CBuffer.ViewMax, float3(TexCoord.x, 0.5f, 1.0f - TexCoord.y));
     float4 projectedPos = mul(float4(viewPos, 1.0f), CBuffer.Projection);
@@ -50,15 +54,21 @@ float4 ClusterVisualizerPS(in float4 PositionPS : SV_Position, in float2 TexCoor
 
     {
         uint numLights = 0;
-        uint clusterOffset = clusterIdx * SpotLightElementsPerCluster;
+        uint clusterOffset = clusterIdx * CBuffer.SpotLightElementsPerCluster;
 
-        [unroll]
-        for (uint elemIdx = 0; elemIdx < SpotLightElementsPerCluster; ++elemIdx)
+        for (uint elemIdx = 0; elemIdx < CBuffer.SpotLightElementsPerCluster; ++elemIdx)
         {
             uint clusterElemMask = spotLightClusterBuffer.Load((clusterOffset + elemIdx) * 4);
             numLights += countbits(clusterElemMask);
         }
 
+        clusterOffset = clusterIdx * CBuffer.PointLightElementsPerCluster;
+        for (uint pointElemIdx = 0; pointElemIdx < CBuffer.PointLightElementsPerCluster; ++pointElemIdx)
+        {
+            uint clusterElemMask = pointLightClusterBuffer.Load((clusterOffset + pointElemIdx) * 4);
+            numLights += countbits(clusterElemMask);
+        }
+
         output.x += numLights / 10.0f;
     }
 
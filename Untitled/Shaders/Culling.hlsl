@@ -6,28 +6,23 @@
 #include "Shadows.hlsl"
 #include "LightingHelpers.hlsl"
 #include "Quaternion.hlsl"
-
-//=================================================================================================
-// Uniforms
-//=================================================================================================
-struct UniformConstants
-{
-  float Near;
-  float Far;
-  float Unused0;
-  float Unused1;
-
-  uint meshBufferSrv;
-};
-ConstantBuffer<UniformConstants> CBuffer : register(b0);
+#include "OcclusionCulling.hlsl"
 
 //=================================================================================================
 // Shader Types
 //=================================================================================================
 
+// GpuMeshDrawCommand, ExecuteIndirect reads the root constants and the dispatch arguments
 struct MeshDrawCommand
 {
     uint        drawId;
+    uint        drawFlags;
+
+    // D3D12_DISPATCH_MESH_ARGUMENTS
+    uint        threadGroupCountX;
+    uint        threadGroupCountY;
+    uint        threadGroupCountZ;
+
     uint        firstTask;
 
     // D3D12_DRAW_INDEXED_ARGUMENTS
@@ -37,10 +32,7 @@ struct MeshDrawCommand
     uint        vertexOffset;
     uint        firstInstance;
 
-    // D3D12_DISPATCH_MESH_ARGUMENTS
-    uint        threadGroupCountX;
-    uint        threadGroupCountY;
-    uint        threadGroupCountZ;
+    uint        pad000;
 };
 
 struct GpuMeshDrawCounts
@@ -106,48 +98,131 @@ SamplerComparisonState ShadowMapSampler : register(s4);
 #if (GPU_CULLING > 0)
   Texture2D<uint> MaterialIDMaps[] : register(t0, space104);
   StructuredBuffer<MeshDraw> MeshBuffers[] : register(t0, space100);
-  
+  StructuredBuffer<float4> MeshBoundsBuffers[] : register(t0, space101);
+
   RWStructuredBuffer<GpuMeshDrawCounts> MeshCountBuffer : register(u0);
-  RWStructuredBuffer<MeshDrawCommand> MeshTaskIndirectCountEarly : register(u1);
+  RWStructuredBuffer<MeshDrawCommand> MeshTaskIndirectEarlyCommands : register(u1);
+  RWStructuredBuffer<MeshDrawCommand> MeshTaskIndirectLateCommands : register(u2);
+  RWStructuredBuffer<GpuMeshDrawCounts> MeshTaskIndirectCountLate : register(u3);
+#endif
+
+#if (DEPTH_PYRAMID > 0)
+  struct DepthPyramidConstants
+  {
+    uint Mip;
+    uint Unused;
+  };
+  ConstantBuffer<DepthPyramidConstants> PyramidCBuffer : register(b1);
+
+  RWTexture2D<float> DepthPyramidDst : register(u0);
+  RWTexture2D<float> DepthPyramidSrc : register(u1);
 #endif
 
 //=================================================================================================
 // Gpu Culling
 //=================================================================================================
 #if (GPU_CULLING > 0)
+MeshDrawCommand MakeDrawCommand(uint meshInstanceIndex, uint drawFlags, MeshDraw meshDraw)
+{
+    MeshDrawCommand command;
+    command.drawId = meshInstanceIndex;
+    command.drawFlags = drawFlags;
+
+    // Every task group tests 32 meshlets, the meshlets of a mesh start on a multiple of 32
+    command.threadGroupCountX = (meshDraw.meshletCount + 31) / 32;
+    command.threadGroupCountY = 1;
+    command.threadGroupCountZ = 1;
+    command.firstTask = meshDraw.meshletOffset / 32;
+
+    command.indexCount = meshDraw.meshletIndexCount;
+    command.instanceCount = 1;
+    command.firstIndex = 0;
+    command.vertexOffset = meshDraw.vertexBufferOffset;
+    command.firstInstance = 0;
+    command.pad000 = 0;
+    return command;
+}
+
+// Runs twice a frame. The early pass draws the meshes visible in last frame's depth pyramid, the
+// late one the meshes visible in the pyramid of the early pass depth. Meshes drawn early are
+// drawn late again with DRAW_FLAG_DRAWN_EARLY so the task shader only adds the meshlets the early
+// pass culled.
 [numthreads(64, 1, 1)]
-void CullingCS(in uint3 dispatchID : SV_DispatchThreadID,
-                     in uint3 groupID : SV_GroupID) 
-{   
-    // TODO: Add actual instancing. Right now mesh instance index is same as mesh draw index
-    // which is not necessarily true for actual instanced drawing
+void CullingCS(in uint3 dispatchID : SV_DispatchThreadID)
+{
     const uint meshInstanceIndex = dispatchID.x;
-
-    // TODO: get total_count from a cbuffer or root constant like ExecIndirect sample
-    // meshDraw buffer in vk sample is meshes_sb on c++ side and is the buffer with all mesh data 
-
-
-    //uint meshDrawIndex = meshInstanceDraws[meshInstanceIndex].mesh_draw_index;
-
-    StructuredBuffer<MeshDraw> meshDraws = MeshBuffers[CBuffer.meshBufferSrv];
-    MeshDraw meshDraw = meshDraws[meshInstanceIndex];
-
-    uint drawIndex; // previous value
-    InterlockedAdd(MeshCountBuffer[0].opaqueMeshVisibleCount, 1 , drawIndex);
-
-
-    // Write draw commands
-    MeshTaskIndirectCountEarly[drawIndex].drawId = meshInstanceIndex;
-    MeshTaskIndirectCountEarly[drawIndex].indexCount = 0; // meshDraw.indexCount;
-    MeshTaskIndirectCountEarly[drawIndex].instanceCount = 1;
-    MeshTaskIndirectCountEarly[drawIndex].firstIndex = 0; //meshDraw.indexBufferOffset;
-    MeshTaskIndirectCountEarly[drawIndex].vertexOffset = meshDraw.vertexBufferOffset;
-    MeshTaskIndirectCountEarly[drawIndex].firstInstance = 0;
-
-    uint taskCount = (meshDraw.meshletCount + 31) / 32;
-    MeshTaskIndirectCountEarly[drawIndex].threadGroupCountX = taskCount;
-    MeshTaskIndirectCountEarly[drawIndex].firstTask = meshDraw.meshletOffset / 32;
-
-    MeshTaskIndirectCountEarly[drawIndex].indexCount = meshDraw.meshletIndexCount;
+    if (meshInstanceIndex >= CBuffer.MeshInstanceCount)
+        return;
+
+    MeshInstanceData instance = LoadMeshInstance(meshInstanceIndex);
+    MeshDraw meshDraw = MeshBuffers[CBuffer.meshBufferSrv][instance.meshIndex];
+    float4 sphere = TransformSphere(
+        MeshBoundsBuffers[CBuffer.meshBoundsBufferSrv][meshDraw.meshIndex], instance.world);
+
+    const bool drawnEarly = IsMeshVisible(sphere, false);
+    if (CBuffer.LateFlag != 0)
+    {
+        if (!IsMeshVisible(sphere, true))
+            return;
+
+        uint drawIndex;
+        InterlockedAdd(MeshTaskIndirectCountLate[0].opaqueMeshVisibleCount, 1, drawIndex);
+        MeshTaskIndirectLateCommands[drawIndex] =
+            MakeDrawCommand(meshInstanceIndex, drawnEarly ? DRAW_FLAG_DRAWN_EARLY : 0, meshDraw);
+    }
+    else if (drawnEarly)
+    {
+        uint drawIndex;
+        InterlockedAdd(MeshCountBuffer[0].opaqueMeshVisibleCount, 1, drawIndex);
+        MeshTaskIndirectEarlyCommands[drawIndex] = MakeDrawCommand(meshInstanceIndex, 0, meshDraw);
+    }
+    else if (IsSphereInFrustum(sphere))
+    {
+        // Occluded last frame, left to the late pass
+        InterlockedAdd(MeshCountBuffer[0].opaqueMeshCulledCount, 1);
+    }
 }
 #endif //(GPU_CULLING > 0)
+
+//=================================================================================================
+// Depth Pyramid
+//=================================================================================================
+#if (DEPTH_PYRAMID > 0)
+// One dispatch per mip. Every texel is the farthest depth of the 2x2 texels above it, mip 0 reads
+// the depth buffer and counts the pixels past its edges as 0.
+[numthreads(8, 8, 1)]
+void DepthPyramidCS(in uint3 dispatchID : SV_DispatchThreadID)
+{
+    const uint mip = PyramidCBuffer.Mip;
+    const uint2 pyramidSize = uint2(CBuffer.DepthPyramidWidth, CBuffer.DepthPyramidHeight);
+    const uint2 dstSize = max(pyramidSize >> mip, 1);
+    if (any(dispatchID.xy >= dstSize))
+        return;
+
+    float maxDepth = 0.0f;
+    if (mip == 0)
+    {
+        Texture2D<float> depthBuffer = DepthPyramidTable[CBuffer.depthBufferSrv];
+        const uint2 screenSize = uint2(CBuffer.ScreenWidth, CBuffer.ScreenHeight);
+        [unroll]
+        for (uint i = 0; i < 4; ++i)
+        {
+            const uint2 pixel = dispatchID.xy * 2 + uint2(i & 1, i >> 1);
+            if (all(pixel < screenSize))
+                maxDepth = max(maxDepth, depthBuffer[pixel]);
+        }
+    }
+    else
+    {
+        // Clamped once an axis is down to 1 texel
+        const uint2 srcSize = max(pyramidSize >> (mip - 1), 1);
+        const uint2 texel0 = dispatchID.xy * 2;
+        const uint2 texel1 = min(texel0 + 1, srcSize - 1);
+        maxDepth = max(
+            max(DepthPyramidSrc[texel0], DepthPyramidSrc[uint2(texel1.x, texel0.y)]),
+            max(DepthPyramidSrc[uint2(texel0.x, texel1.y)], DepthPyramidSrc[texel1]));
+    }
+
+    DepthPyramidDst[dispatchID.xy] = maxDepth;
+}
+#endif //(DEPTH_PYRAMID > 0)
@@ -25,11 +25,16 @@ struct SRVIndexConstants
   uint FogVolumeIdx;
   uint BlueNoiseTexIdx;
   uint SkyTargetIdx;
+  uint SpotLightBufferIdx;
+  uint SpotLightShadowMatrixBufferIdx;
+  uint SpotLightElementsPerCluster;
+  uint PointLightClusterBufferIdx;
+  uint PointLightBufferIdx;
+  uint PointLightElementsPerCluster;
 };
 
 ConstantBuffer<ShadingConstants> PSCBuffer : register(b0);
 ConstantBuffer<DeferredConstants> DeferredCBuffer : register(b2);
-ConstantBuffer<LightConstants> LightCBuffer : register(b3);
 ConstantBuffer<SRVIndexConstants> SRVIndices : register(b4);
 
 static const float DeferredUVScale = 2.0f;
@@ -51,6 +56,9 @@ struct MaterialTextureIndices
 };
 
 StructuredBuffer<MaterialTextureIndices> MaterialIndexBuffers[] : register(t0, space100);
+StructuredBuffer<SpotLight> SpotLightBuffers[] : register(t0, space101);
+StructuredBuffer<float4x4> MatrixBuffers[] : register(t0, space102);
+StructuredBuffer<PointLight> PointLightBuffers[] : register(t0, space103);
 Texture2D<uint> MaterialIDMaps[] : register(t0, space104);
 
 SamplerState AnisoSampler : register(s0);
@@ -79,6 +87,7 @@ void ShadeSample(in uint2 pixelPos)
       MaterialIndexBuffers[SRVIndices.MaterialIndicesBufferIdx];
 
   ByteAddressBuffer spotLightClusterBuffer = RawBufferTable[SRVIndices.SpotLightClusterBufferIdx];
+  ByteAddressBuffer pointLightClusterBuffer = RawBufferTable[SRVIndices.PointLightClusterBufferIdx];
 
   Texture2D tangentFrameMap = Tex2DTable[SRVIndices.TangentFrameMapIndex];
   Texture2D uvMap = Tex2DTable[SRVIndices.UVMapIdx];
@@ -190,6 +199,12 @@ void ShadeSample(in uint2 pixelPos)
   shadingInput.MetallicMap = MetallicMap.SampleGrad(AnisoSampler, uv, uvDX, uvDY).x;
 
   shadingInput.SpotLightClusterBuffer = spotLightClusterBuffer;
+  shadingInput.SpotLightElementsPerCluster = SRVIndices.SpotLightElementsPerCluster;
+  shadingInput.SpotLights = SpotLightBuffers[SRVIndices.SpotLightBufferIdx];
+  shadingInput.SpotLightShadowMatrices = MatrixBuffers[SRVIndices.SpotLightShadowMatrixBufferIdx];
+  shadingInput.PointLightClusterBuffer = pointLightClusterBuffer;
+  shadingInput.PointLightElementsPerCluster = SRVIndices.PointLightElementsPerCluster;
+  shadingInput.PointLights = PointLightBuffers[SRVIndices.PointLightBufferIdx];
   shadingInput.FogVolume = fogVolume;
   shadingInput.BlueNoiseTexture = blueNoiseTexture;
 
@@ -198,7 +213,6 @@ void ShadeSample(in uint2 pixelPos)
   shadingInput.LinearWrapSampler = LinearWrapSampler;
 
   shadingInput.ShadingCBuffer = PSCBuffer;
-  shadingInput.LightCBuffer = LightCBuffer;
 
   shadingInput.InvRTSize = invRTSize;
   shadingInput.CurrFrame = AppSettings.CurrentFrame;
@@ -15,10 +15,13 @@ struct SpotLight
   float Range;
 };
 //=================================================================================================
-struct LightConstants
+struct PointLight
 {
-  SpotLight Lights[MaxSpotLights];
-  float4x4 ShadowMatrices[MaxSpotLights];
+  float3 Position;
+  float Range;
+
+  float3 Intensity;
+  float Padding;
 };
 //=================================================================================================
 // Encoding/Decoding SRGB:
@@ -13,6 +13,9 @@ struct VSConstants
   row_major float4x4 WorldViewProjection;
   float NearClip;
   float FarClip;
+  // Quantized positions are PositionOffset + position * PositionScale, identity otherwise
+  float4 PositionScale;
+  float4 PositionOffset;
 };
 
 struct MatIndexConstants
@@ -26,6 +29,16 @@ ConstantBuffer<MatIndexConstants> MatIndexCBuffer : register(b2);
 //=================================================================================================
 // VS and PS structs
 //=================================================================================================
+#if PACKED_VERTICES
+// PackedMeshVertex and QuantizedMeshVertex, see Model.hpp
+struct VSInput
+{
+  float3 PositionOS : POSITION;
+  float2 NormalOct : NORMAL;
+  float4 TangentOct : TANGENT; // xy octahedral tangent, z bitangent sign
+  float2 UV : UV;
+};
+#else
 struct VSInput
 {
   float3 PositionOS : POSITION;
@@ -34,6 +47,13 @@ struct VSInput
   float3 TangentOS : TANGENT;
   float3 BitangentOS : BITANGENT;
 };
+#endif
+
+// Model::PositionBuffer(), used by the depth-only passes
+struct DepthVSInput
+{
+  float3 PositionOS : POSITION;
+};
 
 struct VSOutput
 {
@@ -66,6 +86,18 @@ struct PSOutputGBuffer
   uint MaterialID : SV_Target2;
 };
 
+//=================================================================================================
+// Helpers
+//=================================================================================================
+// Matches octDecode() in Model.hpp
+float3 OctDecode(float2 e)
+{
+  float3 n = float3(e.xy, 1.0f - abs(e.x) - abs(e.y));
+  float t = saturate(-n.z);
+  n.xy += select(n.xy >= 0.0f, -t, t);
+  return normalize(n);
+}
+
 //=================================================================================================
 // Gbuffer shaders entry-points
 //=================================================================================================
@@ -73,7 +105,17 @@ VSOutput VS(in VSInput input, in uint VertexID : SV_VertexID)
 {
   VSOutput output;
 
-  float3 positionOS = input.PositionOS;
+  float3 positionOS = input.PositionOS * VSCBuffer.PositionScale.xyz + VSCBuffer.PositionOffset.xyz;
+
+#if PACKED_VERTICES
+  float3 normalOS = OctDecode(input.NormalOct);
+  float3 tangentOS = OctDecode(input.TangentOct.xy);
+  float3 bitangentOS = cross(normalOS, tangentOS) * (input.TangentOct.z < 0.0f ? -1.0f : 1.0f);
+#else
+  float3 normalOS = input.NormalOS;
+  float3 tangentOS = input.TangentOS;
+  float3 bitangentOS = input.BitangentOS;
+#endif
 
   // Calc the world-space position
   output.PositionWS = mul(float4(positionOS, 1.0f), VSCBuffer.World).xyz;
@@ -83,11 +125,11 @@ VSOutput VS(in VSInput input, in uint VertexID : SV_VertexID)
   output.DepthVS = output.PositionCS.w;
 
   // Rotate the normal into world space
-  output.NormalWS = normalize(mul(float4(input.NormalOS, 0.0f), VSCBuffer.World)).xyz;
+  output.NormalWS = normalize(mul(float4(normalOS, 0.0f), VSCBuffer.World)).xyz;
 
   // Rotate the rest of the tangent frame into world space
-  output.TangentWS = normalize(mul(float4(input.TangentOS, 0.0f), VSCBuffer.World)).xyz;
-  output.BitangentWS = normalize(mul(float4(input.BitangentOS, 0.0f), VSCBuffer.World)).xyz;
+  output.TangentWS = normalize(mul(float4(tangentOS, 0.0f), VSCBuffer.World)).xyz;
+  output.BitangentWS = normalize(mul(float4(bitangentOS, 0.0f), VSCBuffer.World)).xyz;
 
   // Pass along the texture coordinates
   output.UV = input.UV;
@@ -119,4 +161,13 @@ PSOutputGBuffer PS(in PSInput input)
   result.UV.zw = sign(result.UV.zw) * pow(abs(result.UV.zw), 1 / 2.0f);
 
   return result;
-}
\ No newline at end of file
+}
+
+//=================================================================================================
+// Depth-only entry-point
+//=================================================================================================
+// Positions in the stream are always fp32 object-space, whatever the scene vertex format is
+float4 DepthVS(in DepthVSInput input) : SV_Position
+{
+  return mul(float4(input.PositionOS, 1.0f), VSCBuffer.WorldViewProjection);
+}
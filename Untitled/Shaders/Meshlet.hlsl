@@ -6,17 +6,18 @@
 #include "Shadows.hlsl"
 #include "LightingHelpers.hlsl"
 #include "Quaternion.hlsl"
+#include "OcclusionCulling.hlsl"
 
 //=================================================================================================
 // Uniforms
 //=================================================================================================
-struct UniformConstants
+// Root constants of the indirect draw, drawFlags holds DRAW_FLAG_* bits
+struct DrawConstants
 {
-  float Near;
-  float Far;
-
+  uint DrawId;
+  uint DrawFlags;
 };
-ConstantBuffer<UniformConstants> CBuffer : register(b0);
+ConstantBuffer<DrawConstants> DrawCBuffer : register(b1);
 
 //=================================================================================================
 // Shader Types
@@ -40,11 +41,17 @@ struct GpuMeshDrawCounts
   uint pad001;
 };
 
-struct GpuMeshDrawCommand
+// GpuMeshlet
+struct Meshlet
 {
-    uint drawId;
-    uint2 cbvAddress;
-    uint4 drawArguments;
+  float3 center;
+  float radius;
+
+  uint coneAxisAndCutoff;
+
+  uint dataOffset;
+  uint meshIndex;
+  uint vertexAndTriangleCount; // Vertex count in the low byte, triangle count in the next one
 };
 
 struct MeshDraw
@@ -95,8 +102,13 @@ SamplerComparisonState ShadowMapSampler : register(s4);
   Texture2D<uint> MaterialIDMaps[] : register(t0, space100);
   StructuredBuffer<MeshDraw> MeshBuffers[] : register(t0, space101);
   StructuredBuffer<GpuMeshDrawCounts> MeshCountBuffer : register(t0, space102);
+#endif
 
-  RWStructuredBuffer<GpuMeshDrawCommand> MeshTaskIndirectCountEarly : register(u1);
+#if (Gbuffer_Meshlet_TASK > 0) || (Gbuffer_Meshlet_MESH > 0)
+  StructuredBuffer<MeshDraw> MeshBuffers[] : register(t0, space101);
+  StructuredBuffer<Meshlet> MeshletBuffers[] : register(t0, space103);
+  StructuredBuffer<uint> MeshletDataBuffers[] : register(t0, space104);
+  StructuredBuffer<float4> VertexPositionBuffers[] : register(t0, space105);
 #endif
 
 // Payload data to export to dispatched mesh shader from task shaders
@@ -122,96 +134,89 @@ struct VertexOut
 // The groupshared payload data to export to dispatched mesh shader threadgroups
 groupshared Payload s_Payload;
 
+// Each group tests 32 meshlets of the draw's mesh against the frustum and the depth pyramids
+// and dispatches a mesh shader group per visible one. DrawId is the mesh instance.
 [NumThreads(32, 1, 1)]
-void GbufferMeshletTS(uint gtid : SV_GroupThreadID, uint dtid : SV_DispatchThreadID, uint gid : SV_GroupID)
+void GbufferMeshletTS(uint gtid : SV_GroupThreadID, uint gid : SV_GroupID)
 {
+    MeshInstanceData instance = LoadMeshInstance(DrawCBuffer.DrawId);
+    MeshDraw meshDraw = MeshBuffers[CBuffer.meshBufferSrv][instance.meshIndex];
+    uint meshletIndex = meshDraw.meshletOffset + gid * 32 + gtid;
 
-#if 0
     bool visible = false;
-
-    // Check bounds of meshlet cull data resource
-    if (dtid < MeshInfo.MeshletCount)
+    if (meshletIndex < meshDraw.meshletOffset + meshDraw.meshletCount)
     {
-        // Do visibility testing for this thread
-        visible = IsVisible(MeshletCullData[dtid], Instance.World, Instance.Scale, Constants.CullViewPosition);
+        Meshlet meshlet = MeshletBuffers[CBuffer.meshletBufferSrv][meshletIndex];
+        visible = IsMeshletVisible(
+            TransformSphere(float4(meshlet.center, meshlet.radius), instance.world),
+            CBuffer.LateFlag != 0,
+            (DrawCBuffer.DrawFlags & DRAW_FLAG_DRAWN_EARLY) != 0);
     }
 
     // Compact visible meshlets into the export payload array
     if (visible)
     {
         uint index = WavePrefixCountBits(visible);
-        s_Payload.MeshletIndices[index] = dtid;
+        s_Payload.MeshletIndices[index] = meshletIndex;
     }
 
     // Dispatch the required number of MS threadgroups to render the visible meshlets
     uint visibleCount = WaveActiveCountBits(visible);
     DispatchMesh(visibleCount, 1, 1, s_Payload);
-#endif
-
-  DispatchMesh(1, 1, 1, s_Payload);
-
 }
 
 #endif //(Gbuffer_Meshlet_TASK > 0)
 
 //=================================================================================================
-// Meshlets Gbuffer Pixel Shader
+// Meshlets Gbuffer Mesh Shader
 //=================================================================================================
 #if (Gbuffer_Meshlet_MESH > 0)
+// Triangle indices are bytes, packed 4 to a uint after the meshlet's vertex indices
+uint LoadMeshletIndex(StructuredBuffer<uint> meshletData, uint indexOffset, uint index)
+{
+    return (meshletData[indexOffset + index / 4] >> ((index % 4) * 8)) & 0xff;
+}
+
 [NumThreads(128, 1, 1)]
 [OutputTopology("triangle")]
 void GbufferMeshletMS(
-    uint dtid : SV_DispatchThreadID,
     uint gtid : SV_GroupThreadID,
     uint gid : SV_GroupID,
     in payload Payload payload,
     out vertices VertexOut verts[64],
     out indices uint3 tris[126])
 {
-
-#if 0
-    // // Load the meshlet from the AS payload data
-    // uint meshletIndex = payload.MeshletIndices[gid];
-
-    // // Catch any out-of-range indices (in case too many MS threadgroups were dispatched from AS)
-    // if (meshletIndex >= MeshInfo.MeshletCount)
-    //     return;
-
-    // // Load the meshlet
-    // Meshlet m = Meshlets[meshletIndex];
-
-    // // Our vertex and primitive counts come directly from the meshlet
-    // SetMeshOutputCounts(m.VertCount, m.PrimCount);
-
-    // //--------------------------------------------------------------------
-    // // Export Primitive & Vertex Data
-
-    // if (gtid < m.VertCount)
-    // {
-    //     uint vertexIndex = GetVertexIndex(m, gtid);
-    //     verts[gtid] = GetVertexAttributes(meshletIndex, vertexIndex);
-    // }
-
-    // if (gtid < m.PrimCount)
-    // {
-    //     tris[gtid] = GetPrimitive(m, gtid);
-    // }
-#endif
-
-    uint VertCount = 1;
-    uint PrimCount = 1;
-    SetMeshOutputCounts(VertCount, PrimCount);
-
     uint meshletIndex = payload.MeshletIndices[gid];
+    Meshlet meshlet = MeshletBuffers[CBuffer.meshletBufferSrv][meshletIndex];
 
-    VertexOut vout;
-    vout.PositionVS   = (float3)0;
-    vout.PositionHS   = (float4)0;
-    vout.Normal       = (float3)0;
-    vout.MeshletIndex = meshletIndex;
+    uint vertexCount = meshlet.vertexAndTriangleCount & 0xff;
+    uint triangleCount = (meshlet.vertexAndTriangleCount >> 8) & 0xff;
+    SetMeshOutputCounts(vertexCount, triangleCount);
 
-    verts[gtid] = vout;
+    StructuredBuffer<uint> meshletData = MeshletDataBuffers[CBuffer.meshletDataBufferSrv];
+    if (gtid < vertexCount)
+    {
+        uint vertexIndex = meshletData[meshlet.dataOffset + gtid];
+        float3 position =
+            VertexPositionBuffers[CBuffer.meshletVertexPositionBufferSrv][vertexIndex].xyz;
+        position = mul(float4(position, 1.0f), LoadMeshInstance(DrawCBuffer.DrawId).world).xyz;
+
+        VertexOut vout;
+        vout.PositionHS   = mul(float4(position, 1.0f), CBuffer.ViewProjection);
+        vout.PositionVS   = mul(float4(position, 1.0f), CBuffer.View).xyz;
+        vout.Normal       = (float3)0;
+        vout.MeshletIndex = meshletIndex;
+        verts[gtid] = vout;
+    }
 
+    if (gtid < triangleCount)
+    {
+        uint indexOffset = meshlet.dataOffset + vertexCount;
+        tris[gtid] = uint3(
+            LoadMeshletIndex(meshletData, indexOffset, gtid * 3 + 0),
+            LoadMeshletIndex(meshletData, indexOffset, gtid * 3 + 1),
+            LoadMeshletIndex(meshletData, indexOffset, gtid * 3 + 2));
+    }
 }
 
 #endif //(Gbuffer_Meshlet_MESH > 0)
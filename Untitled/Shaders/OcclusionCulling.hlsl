@@ -0,0 +1,189 @@
+//=================================================================================================
+// Frustum and depth pyramid (HZB) tests of the GPU driven renderer, shared by the culling compute
+// shader and the meshlet task shader. OcclusionCulling.cpp has the CPU reference, keep them in sync.
+//=================================================================================================
+
+//=================================================================================================
+// Uniforms
+//=================================================================================================
+struct UniformConstants
+{
+  row_major float4x4 ViewProjection;
+  row_major float4x4 View;
+  row_major float4x4 Projection;
+  float4 FrustumPlanes[6];
+
+  float Near;
+  float Far;
+  float ScreenWidth;
+  float ScreenHeight;
+
+  uint DepthPyramidWidth;
+  uint DepthPyramidHeight;
+  uint DepthPyramidNumMips;
+  uint LateFlag;
+
+  uint PreviousDepthPyramidValid;
+  uint OcclusionCullingEnabled;
+  uint MeshInstanceCount;
+  uint depthBufferSrv;
+
+  uint meshBufferSrv;
+  uint meshBoundsBufferSrv;
+  uint meshletBufferSrv;
+  uint meshletDataBufferSrv;
+
+  uint meshletVertexPositionBufferSrv;
+  uint previousDepthPyramidSrv;
+  uint currentDepthPyramidSrv;
+  uint meshInstanceBufferSrv;
+};
+ConstantBuffer<UniformConstants> CBuffer : register(b0);
+
+// Set on late pass draws of meshes the early pass drew too
+#define DRAW_FLAG_DRAWN_EARLY 1
+
+Texture2D<float> DepthPyramidTable[] : register(t0, space106);
+
+// GpuMeshInstanceData, the draws and the culling go by instance and read the mesh through it
+struct MeshInstanceData
+{
+  row_major float4x4 world;
+  row_major float4x4 inverseWorld;
+
+  uint meshIndex;
+  uint pad000;
+  uint pad001;
+  uint pad002;
+};
+StructuredBuffer<MeshInstanceData> MeshInstanceBuffers[] : register(t0, space107);
+
+MeshInstanceData LoadMeshInstance(uint instanceIndex)
+{
+  return MeshInstanceBuffers[CBuffer.meshInstanceBufferSrv][instanceIndex];
+}
+
+//=================================================================================================
+// Helpers
+//=================================================================================================
+float ViewDepthToDevice(float viewDepth)
+{
+  float4 clip = mul(float4(0.0f, 0.0f, viewDepth, 1.0f), CBuffer.Projection);
+  return clip.z / clip.w;
+}
+
+// Mesh space bounding sphere to world space, the radius grows with the largest axis scale
+float4 TransformSphere(float4 sphere, float4x4 world)
+{
+  float3 center = mul(float4(sphere.xyz, 1.0f), world).xyz;
+  float scale = max(max(length(world[0].xyz), length(world[1].xyz)), length(world[2].xyz));
+  return float4(center, sphere.w * scale);
+}
+
+// Lowest and highest x / z of the tangents of a view space circle in the plane of one screen axis
+float2 TangentSlopes(float c, float z, float r)
+{
+  float t = sqrt(max(c * c + z * z - r * r, 0.0f));
+  float slope0 = (c * t - z * r) / (z * t + c * r);
+  float slope1 = (c * t + z * r) / (z * t - c * r);
+  return float2(min(slope0, slope1), max(slope0, slope1));
+}
+
+bool IsSphereInFrustum(float4 sphere)
+{
+  [unroll]
+  for (uint i = 0; i < 6; ++i)
+  {
+    if (dot(CBuffer.FrustumPlanes[i].xyz, sphere.xyz) + CBuffer.FrustumPlanes[i].w < -sphere.w)
+      return false;
+  }
+  return true;
+}
+
+// Pixel rectangle of a world space sphere and the device depth of its nearest point, false when
+// the sphere reaches past the near plane
+bool ProjectSphere(float4 sphere, out float4 pixelRect, out float nearestDepth)
+{
+  pixelRect = 0.0f;
+  nearestDepth = 0.0f;
+
+  float3 center = mul(float4(sphere.xyz, 1.0f), CBuffer.View).xyz;
+  float radius = sphere.w;
+  if (center.z - radius < CBuffer.Near)
+    return false;
+
+  float2 slopesX = TangentSlopes(center.x, center.z, radius);
+  float2 slopesY = TangentSlopes(center.y, center.z, radius);
+  float4 clipMinX = mul(float4(slopesX.x, 0.0f, 1.0f, 1.0f), CBuffer.Projection);
+  float4 clipMaxX = mul(float4(slopesX.y, 0.0f, 1.0f, 1.0f), CBuffer.Projection);
+  float4 clipMinY = mul(float4(0.0f, slopesY.x, 1.0f, 1.0f), CBuffer.Projection);
+  float4 clipMaxY = mul(float4(0.0f, slopesY.y, 1.0f, 1.0f), CBuffer.Projection);
+
+  // NDC y points up, pixel rows go down
+  float2 screenSize = float2(CBuffer.ScreenWidth, CBuffer.ScreenHeight);
+  pixelRect.x = (clipMinX.x / clipMinX.w * 0.5f + 0.5f) * screenSize.x;
+  pixelRect.z = (clipMaxX.x / clipMaxX.w * 0.5f + 0.5f) * screenSize.x;
+  pixelRect.y = (0.5f - clipMaxY.y / clipMaxY.w * 0.5f) * screenSize.y;
+  pixelRect.w = (0.5f - clipMinY.y / clipMinY.w * 0.5f) * screenSize.y;
+  pixelRect = clamp(pixelRect, 0.0f, screenSize.xyxy);
+
+  nearestDepth = ViewDepthToDevice(center.z - radius);
+  return true;
+}
+
+// Texel x of pyramid mip m covers the pixels [x << (m + 1), (x + 1) << (m + 1)), the mip is picked
+// so the sphere's rectangle spans at most 2x2 texels
+bool IsSphereOccluded(uint pyramidSrv, float4 sphere)
+{
+  float4 rect;
+  float nearestDepth;
+  if (!ProjectSphere(sphere, rect, nearestDepth))
+    return false;
+
+  uint2 minPixel = uint2(floor(rect.xy));
+  uint2 maxPixel = uint2(ceil(rect.zw));
+  if (any(minPixel >= maxPixel))
+    return false;
+
+  uint span = max(maxPixel.x - minPixel.x, maxPixel.y - minPixel.y);
+  uint mip = min(span > 1 ? firstbithigh(span - 1) : 0, CBuffer.DepthPyramidNumMips - 1);
+  uint2 mipSize = max(uint2(CBuffer.DepthPyramidWidth, CBuffer.DepthPyramidHeight) >> mip, 1);
+  uint2 minTexel = min(minPixel >> (mip + 1), mipSize - 1);
+  uint2 maxTexel = min((maxPixel - 1) >> (mip + 1), mipSize - 1);
+
+  Texture2D<float> pyramid = DepthPyramidTable[pyramidSrv];
+  float maxDepth = max(
+      max(pyramid.Load(uint3(minTexel, mip)), pyramid.Load(uint3(maxTexel.x, minTexel.y, mip))),
+      max(pyramid.Load(uint3(minTexel.x, maxTexel.y, mip)), pyramid.Load(uint3(maxTexel, mip))));
+
+  return nearestDepth > maxDepth;
+}
+
+// Early pass: in the frustum and not occluded last frame. Late pass: in the frustum and not
+// occluded in the pyramid built from the early pass depth.
+bool IsMeshVisible(float4 sphere, bool late)
+{
+  if (!IsSphereInFrustum(sphere))
+    return false;
+
+  // Without occlusion culling the early pass draws everything
+  if (CBuffer.OcclusionCullingEnabled == 0)
+    return !late;
+
+  if (late)
+    return !IsSphereOccluded(CBuffer.currentDepthPyramidSrv, sphere);
+  return CBuffer.PreviousDepthPyramidValid == 0 ||
+         !IsSphereOccluded(CBuffer.previousDepthPyramidSrv, sphere);
+}
+
+// The late pass only draws the meshlets of meshes drawn early that the early pass culled
+bool IsMeshletVisible(float4 sphere, bool late, bool meshDrawnEarly)
+{
+  if (!IsMeshVisible(sphere, late))
+    return false;
+
+  if (late && meshDrawnEarly)
+    return CBuffer.PreviousDepthPyramidValid != 0 &&
+           IsSphereOccluded(CBuffer.previousDepthPyramidSrv, sphere);
+  return true;
+}
@@ -45,6 +45,12 @@ struct ShadingInput
   float MetallicMap;
 
   ByteAddressBuffer SpotLightClusterBuffer;
+  uint              SpotLightElementsPerCluster;
+  StructuredBuffer<SpotLight> SpotLights;
+  StructuredBuffer<float4x4>  SpotLightShadowMatrices;
+  ByteAddressBuffer PointLightClusterBuffer;
+  uint              PointLightElementsPerCluster;
+  StructuredBuffer<PointLight> PointLights;
   Texture3D         FogVolume;
   Texture2D         BlueNoiseTexture;
 
@@ -53,7 +59,6 @@ struct ShadingInput
   SamplerState LinearWrapSampler;
 
   ShadingConstants ShadingCBuffer;
-  LightConstants LightCBuffer;
 
   float2 InvRTSize;
   uint CurrFrame;
@@ -182,11 +187,10 @@ float3 ShadePixel(in ShadingInput input, in Texture2DArray spotLightShadowMap, i
       float numSlices;
       spotLightShadowMap.GetDimensions(shadowMapSize.x, shadowMapSize.y, numSlices);    
   
-      uint clusterOffset = clusterIdx * SpotLightElementsPerCluster;
+      uint clusterOffset = clusterIdx * input.SpotLightElementsPerCluster;
   
       // Loop over the number of 4-byte elements needed for each cluster
-      [unroll]
-      for (uint elemIdx = 0; elemIdx < SpotLightElementsPerCluster; ++elemIdx)
+      for (uint elemIdx = 0; elemIdx < input.SpotLightElementsPerCluster; ++elemIdx)
       {
         // Loop until we've processed every raised bit
         uint clusterElemMask = input.SpotLightClusterBuffer.Load((clusterOffset + elemIdx) * 4);
@@ -196,7 +200,7 @@ float3 ShadePixel(in ShadingInput input, in Texture2DArray spotLightShadowMap, i
           uint bitIdx = firstbitlow(clusterElemMask);
           clusterElemMask &= ~(1u << bitIdx);
           uint spotLightIdx = bitIdx + (elemIdx * 32);
-          SpotLight spotLight = input.LightCBuffer.Lights[spotLightIdx];
+          SpotLight spotLight = input.SpotLights[spotLightIdx];
         
           float3 surfaceToLight = spotLight.Position - positionWS;
           float distanceToLight = length(surfaceToLight);
@@ -212,13 +216,17 @@ float3 ShadePixel(in ShadingInput input, in Texture2DArray spotLightShadowMap, i
             falloff = (falloff * falloff) / (distanceToLight * distanceToLight + 1.0f);
             float3 intensity = spotLight.Intensity * angularAttenuation * falloff;
   
-            // Spotlight shadow visibility
-            const float3 shadowPosOffset = GetShadowPosOffset(saturate(dot(vtxNormalWS, surfaceToLight)), vtxNormalWS, shadowMapSize.x);
+            // Spotlight shadow visibility, only the first lights have a shadow map slice
+            float spotLightVisibility = 1.0f;
+            if (spotLightIdx < uint(numSlices))
+            {
+              const float3 shadowPosOffset = GetShadowPosOffset(saturate(dot(vtxNormalWS, surfaceToLight)), vtxNormalWS, shadowMapSize.x);
   
-            float spotLightVisibility = SpotLightShadowVisibility(positionWS, positionNeighborX, positionNeighborY,
-                                                                input.LightCBuffer.ShadowMatrices[spotLightIdx],
-                                                                spotLightIdx, shadowPosOffset, spotLightShadowMap, shadowSampler,
-                                                                float2(SpotShadowNearClip, spotLight.Range));
+              spotLightVisibility = SpotLightShadowVisibility(positionWS, positionNeighborX, positionNeighborY,
+                                                              input.SpotLightShadowMatrices[spotLightIdx],
+                                                              spotLightIdx, shadowPosOffset, spotLightShadowMap, shadowSampler,
+                                                              float2(SpotShadowNearClip, spotLight.Range));
+            }
   
             output += CalcLighting(
                 normalWS,
@@ -234,6 +242,40 @@ float3 ShadePixel(in ShadingInput input, in Texture2DArray spotLightShadowMap, i
           ++numLights;
         } // end of while(clusterElemMask)
       } // end of for(elemIdx : SpotLightElementsPerCluster)
+
+      // Point lights have their own masks and aren't shadowed
+      clusterOffset = clusterIdx * input.PointLightElementsPerCluster;
+      for (uint pointElemIdx = 0; pointElemIdx < input.PointLightElementsPerCluster; ++pointElemIdx)
+      {
+        uint clusterElemMask = input.PointLightClusterBuffer.Load((clusterOffset + pointElemIdx) * 4);
+
+        while(clusterElemMask)
+        {
+          uint bitIdx = firstbitlow(clusterElemMask);
+          clusterElemMask &= ~(1u << bitIdx);
+          PointLight pointLight = input.PointLights[bitIdx + (pointElemIdx * 32)];
+
+          float3 surfaceToLight = pointLight.Position - positionWS;
+          float distanceToLight = length(surfaceToLight);
+          surfaceToLight /= distanceToLight;
+
+          float d = distanceToLight / pointLight.Range;
+          float falloff = saturate(1.0f - (d * d * d * d));
+          falloff = (falloff * falloff) / (distanceToLight * distanceToLight + 1.0f);
+
+          output += CalcLighting(
+              normalWS,
+              surfaceToLight,
+              pointLight.Intensity * falloff,
+              diffuseAlbedo,
+              specularAlbedo,
+              roughness,
+              positionWS,
+              CBuffer.CameraPosWS) * AppSettings.LightColor;
+
+          ++numLights;
+        } // end of while(clusterElemMask)
+      } // end of for(pointElemIdx : PointLightElementsPerCluster)
     } // end of if(AppSettings.RenderLights)
 
   float3 ambient = 1.0f; // TODO!
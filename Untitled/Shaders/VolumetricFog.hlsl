@@ -37,18 +37,20 @@ struct UniformConstants
   uint ScatterVolumeIdx;
   uint PrevScatterVolumeIdx;
   uint FinalIntegrationVolumeIdx;
-  uint unused2;
+  uint SpotLightBufferIdx;
 
 
   float3 CameraPos;
-  uint unused3;
+  uint NumSpotLights;
 
   uint NumXTiles;
   uint NumXYTiles;
   float2 HaltonXY;
+
+  uint SpotLightShadowMatrixBufferIdx;
+  uint SpotLightElementsPerCluster;
 };
 ConstantBuffer<UniformConstants> CBuffer : register(b0);
-ConstantBuffer<LightConstants> LightsBuffer : register(b1);
 
 #define ubo_proj_matrix                         CBuffer.ProjMat
 #define ubo_inv_view_proj                       CBuffer.InvViewProj
@@ -80,6 +82,8 @@ ConstantBuffer<LightConstants> LightsBuffer : register(b1);
 // Resources
 //=================================================================================================
 
+StructuredBuffer<SpotLight> SpotLightBuffers[] : register(t0, space101);
+StructuredBuffer<float4x4> MatrixBuffers[] : register(t0, space102);
 Texture2D<uint> MaterialIDMaps[] : register(t0, space104);
 
 // Samplers:
@@ -335,6 +339,8 @@ void LightContributionCS(in uint3 DispatchID : SV_DispatchThreadID)
     float3 lighting = 1;
 
     ByteAddressBuffer spotLightClusterBuffer = RawBufferTable[CBuffer.ClusterBufferIdx];
+    StructuredBuffer<SpotLight> spotLightBuffer = SpotLightBuffers[CBuffer.SpotLightBufferIdx];
+    StructuredBuffer<float4x4> shadowMatrixBuffer = MatrixBuffers[CBuffer.SpotLightShadowMatrixBufferIdx];
 
     if (extinction >= 0.01f)
     {
@@ -350,9 +356,9 @@ void LightContributionCS(in uint3 DispatchID : SV_DispatchThreadID)
         if (false == AppSettings.FOG_UseClusteredLighting) 
         {
             // const uint numLights = 10;
-            [unroll] for (uint spotLightIdx = 0; spotLightIdx < MaxSpotLights; ++spotLightIdx)
+            for (uint spotLightIdx = 0; spotLightIdx < CBuffer.NumSpotLights; ++spotLightIdx)
             {
-                SpotLight spotLight = LightsBuffer.Lights[spotLightIdx];
+                SpotLight spotLight = spotLightBuffer[spotLightIdx];
                 float3 surfaceToLight = spotLight.Position - worldPos;
                 float distanceToLight = max(length(surfaceToLight), 0.01f);
                 surfaceToLight /= distanceToLight;
@@ -371,14 +377,14 @@ void LightContributionCS(in uint3 DispatchID : SV_DispatchThreadID)
                         uint(froxelCoord.y * 1.0f / ubo_grid_dimensions.y * ubo_screen_resolution.y));
 
                     float spotLightVisibility = 1.0f;
-                    if (AppSettings.FOG_EnableShadowMapSampling)
-                    {
-                        // Spotlight shadow
-                        Texture2DArray spotLightShadowMap = Tex2DArrayTable[CBuffer.SpotLightShadowIdx];
-                        float2 shadowMapSize;
-                        float numSlices;
-                        spotLightShadowMap.GetDimensions(shadowMapSize.x, shadowMapSize.y, numSlices);
+                    Texture2DArray spotLightShadowMap = Tex2DArrayTable[CBuffer.SpotLightShadowIdx];
+                    float2 shadowMapSize;
+                    float numSlices;
+                    spotLightShadowMap.GetDimensions(shadowMapSize.x, shadowMapSize.y, numSlices);
 
+                    // Only the first lights have a shadow map slice
+                    if (AppSettings.FOG_EnableShadowMapSampling && spotLightIdx < uint(numSlices))
+                    {
                         // Calculate vertex normal for shadow sampling
                         Texture2D tangentFrameMap = Tex2DTable[CBuffer.TangentFrameMapIndex];
                         Texture2D<uint> materialIDMap = MaterialIDMaps[CBuffer.MaterialIDMapIdx];
@@ -408,7 +414,7 @@ void LightContributionCS(in uint3 DispatchID : SV_DispatchThreadID)
                         // Calcualte spotlight shadow visibility
                         const float3 shadowPosOffset = GetShadowPosOffset(saturate(dot(vtxNormalWS, surfaceToLight)), vtxNormalWS, shadowMapSize.x);
                         spotLightVisibility = SpotLightShadowVisibility(worldPos, positionNeighborX, positionNeighborY,
-                                                                    LightsBuffer.ShadowMatrices[spotLightIdx],
+                                                                    shadowMatrixBuffer[spotLightIdx],
                                                                     spotLightIdx, shadowPosOffset, spotLightShadowMap, ShadowMapSampler,
                                                                     float2(SpotShadowNearClip, spotLight.Range));
                     } // end of shadow sampling
@@ -432,11 +438,10 @@ void LightContributionCS(in uint3 DispatchID : SV_DispatchThreadID)
             uint3 tileCoords = uint3(pixelPos / ClusterTileSize, zTile);
             uint clusterIdx = (tileCoords.z * ubo_num_tiles_xy) + (tileCoords.y * ubo_num_tiles_x) + tileCoords.x;
 
-            uint clusterOffset = clusterIdx * SpotLightElementsPerCluster;
+            uint clusterOffset = clusterIdx * CBuffer.SpotLightElementsPerCluster;
 
             // Loop over the number of 4-byte elements needed for each cluster
-            [unroll]
-            for (uint elemIdx = 0; elemIdx < SpotLightElementsPerCluster; ++elemIdx)
+            for (uint elemIdx = 0; elemIdx < CBuffer.SpotLightElementsPerCluster; ++elemIdx)
             {
                 // Loop until we've processed every raised bit
                 uint clusterElemMask = spotLightClusterBuffer.Load((clusterOffset + elemIdx) * 4);
@@ -446,7 +451,7 @@ void LightContributionCS(in uint3 DispatchID : SV_DispatchThreadID)
                     uint bitIdx = firstbitlow(clusterElemMask);
                     clusterElemMask &= ~(1u << bitIdx);
                     uint spotLightIdx = bitIdx + (elemIdx * 32);
-                    SpotLight spotLight = LightsBuffer.Lights[spotLightIdx];
+                    SpotLight spotLight = spotLightBuffer[spotLightIdx];
     
                     float3 surfaceToLight = spotLight.Position - worldPos;
                     float distanceToLight = length(surfaceToLight);
@@ -463,14 +468,14 @@ void LightContributionCS(in uint3 DispatchID : SV_DispatchThreadID)
                         float3 intensity = spotLight.Intensity * angularAttenuation * falloff;
   
                         float spotLightVisibility = 1.0f;
-                        if (AppSettings.FOG_EnableShadowMapSampling)
+                        Texture2DArray spotLightShadowMap = Tex2DArrayTable[CBuffer.SpotLightShadowIdx];
+                        float2 shadowMapSize;
+                        float numSlices;
+                        spotLightShadowMap.GetDimensions(shadowMapSize.x, shadowMapSize.y, numSlices);
+
+                        // Only the first lights have a shadow map slice
+                        if (AppSettings.FOG_EnableShadowMapSampling && spotLightIdx < uint(numSlices))
                         {
-                            // Spotlight shadow
-                            Texture2DArray spotLightShadowMap = Tex2DArrayTable[CBuffer.SpotLightShadowIdx];
-                            float2 shadowMapSize;
-                            float numSlices;
-                            spotLightShadowMap.GetDimensions(shadowMapSize.x, shadowMapSize.y, numSlices);
-    
                             // Calculate vertex normal for shadow sampling
                             Texture2D tangentFrameMap = Tex2DTable[CBuffer.TangentFrameMapIndex];
                             Texture2D<uint> materialIDMap = MaterialIDMaps[CBuffer.MaterialIDMapIdx];
@@ -505,7 +510,7 @@ void LightContributionCS(in uint3 DispatchID : SV_DispatchThreadID)
                             // Calcualte spotlight shadow visibility
                             const float3 shadowPosOffset = GetShadowPosOffset(saturate(dot(vtxNormalWS, surfaceToLight)), vtxNormalWS, shadowMapSize.x);
                             spotLightVisibility = SpotLightShadowVisibility(worldPos, positionNeighborX, positionNeighborY,
-                                                                        LightsBuffer.ShadowMatrices[spotLightIdx],
+                                                                        shadowMatrixBuffer[spotLightIdx],
                                                                         spotLightIdx, shadowPosOffset, spotLightShadowMap, ShadowMapSampler,
                                                                         float2(SpotShadowNearClip, spotLight.Range));
                         } // end of shadow sampling
@@ -16,6 +16,11 @@
 #include "pix3.h"
 #include "d3dx12.h"
 #include "../Common/Half.hpp"
+#include "SkyTable.hpp"
+#include "Timer.hpp"
+#include "WorkerPool.hpp"
+
+#include <immintrin.h>
 
 static const uint64_t NumIndices = 36;
 static const uint64_t NumVertices = 8;
@@ -59,51 +64,15 @@ static float IrradianceIntegral(float theta)
   return Pi * sinTheta * sinTheta;
 }
 
-void SkyCache::Init(
-    const glm::vec3& sunDirection_,
-    float sunSize,
-    const glm::vec3& groundAlbedo_,
-    float turbidity,
-    bool createCubemap)
+// Computes the irradiance of the sun for a surface perpendicular to the sun using monte carlo
+// integration. Note that the solar radiance function provided by the authors of this sky model
+// only works using spectral rendering, so we sample a range of wavelengths and then convert to
+// RGB.
+static glm::vec3 IntegrateSunIrradiance(
+    const glm::vec3& sunDirection, float thetaS, float turbidity, const glm::vec3& groundAlbedo)
 {
-  glm::vec3 sunDirection = sunDirection_;
-  glm::vec3 groundAlbedo = groundAlbedo_;
-  sunDirection.y = saturate(sunDirection.y);
-  sunDirection = glm::normalize(sunDirection);
-  turbidity = _clamp(turbidity, 1.0f, 32.0f);
-  groundAlbedo = saturate(groundAlbedo);
-  sunSize = std::max(sunSize, 0.01f);
-
-  // Do nothing if we're already up-to-date
-  if (Initialized() && sunDirection == SunDirection && groundAlbedo == Albedo &&
-      turbidity == Turbidity && SunSize == sunSize)
-    return;
-
-  Shutdown();
-
-  sunDirection.y = saturate(sunDirection.y);
-  sunDirection = glm::normalize(sunDirection);
-  turbidity = _clamp(turbidity, 1.0f, 32.0f);
-  groundAlbedo = saturate(groundAlbedo);
-
-  float thetaS = AngleBetween(sunDirection, glm::vec3(0, 1, 0));
-  float elevation = Pi_2 - thetaS;
-  StateR = arhosek_rgb_skymodelstate_alloc_init(turbidity, groundAlbedo.x, elevation);
-  StateG = arhosek_rgb_skymodelstate_alloc_init(turbidity, groundAlbedo.y, elevation);
-  StateB = arhosek_rgb_skymodelstate_alloc_init(turbidity, groundAlbedo.z, elevation);
-
-  Albedo = groundAlbedo;
-  Elevation = elevation;
-  SunDirection = sunDirection;
-  Turbidity = turbidity;
-  SunSize = sunSize;
-
-  // Compute the irradiance of the sun for a surface perpendicular to the sun using monte carlo
-  // integration. Note that the solar radiance function provided by the authors of this sky model
-  // only works using spectral rendering, so we sample a range of wavelengths and then convert to
-  // RGB.
   SampledSpectrum groundAlbedoSpectrum =
-      SampledSpectrum::FromRGB(Albedo, SpectrumType::Reflectance);
+      SampledSpectrum::FromRGB(groundAlbedo, SpectrumType::Reflectance);
   SampledSpectrum solarRadiance;
 
   // Init the Hosek solar radiance model for all wavelengths
@@ -111,7 +80,7 @@ void SkyCache::Init(
   for (int32_t i = 0; i < NumSpectralSamples; ++i)
     skyStates[i] = arhosekskymodelstate_alloc_init(thetaS, turbidity, groundAlbedoSpectrum[i]);
 
-  SunIrradiance = glm::vec3(0.0f);
+  glm::vec3 sunIrradiance = glm::vec3(0.0f);
 
   // Uniformly sample the solid area of the solar disc.
   // Note that we use the *actual* sun size here and not the passed in the sun direction, so that
@@ -149,16 +118,16 @@ void SkyCache::Init(
       // and have the resulting lighting still fit comfortably in an FP16 render target
       sampleRadiance *= FP16Scale;
 
-      SunIrradiance += sampleRadiance * saturate(glm::dot(sampleDir, sunDirection));
+      sunIrradiance += sampleRadiance * saturate(glm::dot(sampleDir, sunDirection));
     }
   }
 
   // Apply the monte carlo factor of 1 / (PDF * N)
   float pdf = SampleDirectionCone_PDF(CosPhysicalSunSize);
-  SunIrradiance *= (1.0f / NumSamples) * (1.0f / NumSamples) * (1.0f / pdf);
+  sunIrradiance *= (1.0f / NumSamples) * (1.0f / NumSamples) * (1.0f / pdf);
 
   // Account for luminous efficiency and coordinate system scaling
-  SunIrradiance *= 683.0f * 100.0f;
+  sunIrradiance *= 683.0f * 100.0f;
 
   // Clean up
   for (uint64_t i = 0; i < NumSpectralSamples; ++i)
@@ -167,60 +136,242 @@ void SkyCache::Init(
     skyStates[i] = nullptr;
   }
 
-  // Compute a uniform solar radiance value such that integrating this radiance over a disc with
-  // the provided angular radius
-  SunRadiance = SunIrradiance / IrradianceIntegral(degToRad(SunSize));
 
-  if (createCubemap)
+  return sunIrradiance;
+}
+
+// == Cubemap bake ================================================================================
+
+// Rows of the cubemap a bake job grabs at a time
+static const uint32_t BakeRowGranularity = 4;
+
+// Directions a bake row evaluates at a time
+static const uint32_t BakeChunkSize = 64;
+
+// Partial sums of one cubemap row
+struct SkyBakeRowSum
+{
+  SH9Color SH;
+  float WeightSum = 0.0f;
+};
+
+// SkyCache::Sample() as it was before SkyRadianceEvaluator, the double precision model
+static glm::vec3 SampleReference(const SkyCache& cache, const glm::vec3& sampleDir)
+{
+  float gamma = AngleBetween(sampleDir, cache.SunDirection);
+  float theta = AngleBetween(sampleDir, glm::vec3(0, 1, 0));
+
+  glm::vec3 radiance;
+
+  radiance.x = float(arhosek_tristim_skymodel_radiance(cache.StateR, theta, gamma, 0));
+  radiance.y = float(arhosek_tristim_skymodel_radiance(cache.StateG, theta, gamma, 1));
+  radiance.z = float(arhosek_tristim_skymodel_radiance(cache.StateB, theta, gamma, 2));
+
+  return radiance * 683.0f * FP16Scale;
+}
+
+// Bakes one row of one face and sums its texels' SH projections, weighted by the solid angle of
+// the texels
+static void BakeSkyRow(
+    const SkyRadianceEvaluator& evaluator,
+    uint64_t res,
+    uint32_t row,
+    Half4* texels,
+    SkyBakeRowSum& rowSum)
+{
+  const uint64_t s = row / res;
+  const uint64_t y = row % res;
+  const float v = ((y + 0.5f) / res) * 2.0f - 1.0f;
+
+  __m128 sh[9];
+  for (uint64_t i = 0; i < 9; ++i)
+    sh[i] = _mm_setzero_ps();
+  float weightSum = 0.0f;
+
+  for (uint64_t first = 0; first < res; first += BakeChunkSize)
   {
-    // Make a pre-computed cubemap with the sky radiance values, minus the sun.
-    // For this we again pre-scale by our FP16 scale factor so that we can use an FP16 format.
-    const uint64_t CubeMapRes = 128;
-    std::vector<Half4> texels;
-    texels.resize(CubeMapRes * CubeMapRes * 6);
+    const uint32_t count = uint32_t(std::min<uint64_t>(BakeChunkSize, res - first));
 
-    // We'll also project the sky onto SH coefficients for use during rendering
-    sh = SH9Color();
-    float weightSum = 0.0f;
+    float dirs[3][BakeChunkSize];
+    float radiances[3][BakeChunkSize];
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      const glm::vec3 dir = mapXYSToDirection(first + i, y, s, res, res);
+      dirs[0][i] = dir.x;
+      dirs[1][i] = dir.y;
+      dirs[2][i] = dir.z;
+    }
+    evaluator.evaluate(dirs[0], dirs[1], dirs[2], count, radiances[0], radiances[1], radiances[2]);
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      const uint64_t x = first + i;
+      texels[row * res + x] = Half4(radiances[0][i], radiances[1][i], radiances[2][i], 1.0f);
+
+      // Account for cubemap texel distribution
+      const float u = ((x + 0.5f) / res) * 2.0f - 1.0f;
+      const float temp = 1.0f + u * u + v * v;
+      const float weight = 4.0f / (std::sqrt(temp) * temp);
+      weightSum += weight;
+
+      const __m128 radiance = _mm_setr_ps(radiances[0][i], radiances[1][i], radiances[2][i], 0.0f);
+      const SH9 basis = ProjectOntoSH9(glm::vec3(dirs[0][i], dirs[1][i], dirs[2][i]));
+      for (uint64_t j = 0; j < 9; ++j)
+      {
+        sh[j] =
+            _mm_add_ps(sh[j], _mm_mul_ps(radiance, _mm_set1_ps(basis.Coefficients[j] * weight)));
+      }
+    }
+  }
+
+  for (uint64_t i = 0; i < 9; ++i)
+  {
+    alignas(16) float rgb[4];
+    _mm_store_ps(rgb, sh[i]);
+    rowSum.SH.Coefficients[i] = glm::vec3(rgb[0], rgb[1], rgb[2]);
+  }
+  rowSum.WeightSum = weightSum;
+}
+
+// The bake as it was before BakeCubeMap(): serial, in double through the Hosek model and with nine
+// projections per texel. Kept for the benchmark.
+static void BakeSkyReference(const SkyCache& cache, uint64_t res, Half4* texels, SH9Color& sh)
+{
+  sh = SH9Color();
+  float weightSum = 0.0f;
 
-    for (uint64_t s = 0; s < 6; ++s)
+  for (uint64_t s = 0; s < 6; ++s)
+  {
+    for (uint64_t y = 0; y < res; ++y)
     {
-      for (uint64_t y = 0; y < CubeMapRes; ++y)
+      for (uint64_t x = 0; x < res; ++x)
       {
-        for (uint64_t x = 0; x < CubeMapRes; ++x)
-        {
-          glm::vec3 dir = mapXYSToDirection(x, y, s, CubeMapRes, CubeMapRes);
-          glm::vec3 radiance = Sample(dir);
-
-          uint64_t idx = (s * CubeMapRes * CubeMapRes) + (y * CubeMapRes) + x;
-          texels[idx] = Half4(glm::vec4(radiance, 1.0f));
-
-          float u = (x + 0.5f) / CubeMapRes;
-          float v = (y + 0.5f) / CubeMapRes;
-
-          // Account for cubemap texel distribution
-          u = u * 2.0f - 1.0f;
-          v = v * 2.0f - 1.0f;
-          const float temp = 1.0f + u * u + v * v;
-          const float weight = 4.0f / (std::sqrt(temp) * temp);
-
-          SH9Color result;
-          for (uint64_t i = 0; i < 9; ++i)
-            result.Coefficients[i] = ProjectOntoSH9Color(dir, radiance).Coefficients[i] * weight;
-          sh += result;
-          weightSum += weight;
-        }
+        glm::vec3 dir = mapXYSToDirection(x, y, s, res, res);
+        glm::vec3 radiance = SampleReference(cache, dir);
+
+        uint64_t idx = (s * res * res) + (y * res) + x;
+        texels[idx] = Half4(glm::vec4(radiance, 1.0f));
+
+        float u = (x + 0.5f) / res;
+        float v = (y + 0.5f) / res;
+
+        // Account for cubemap texel distribution
+        u = u * 2.0f - 1.0f;
+        v = v * 2.0f - 1.0f;
+        const float temp = 1.0f + u * u + v * v;
+        const float weight = 4.0f / (std::sqrt(temp) * temp);
+
+        SH9Color result;
+        for (uint64_t i = 0; i < 9; ++i)
+          result.Coefficients[i] = ProjectOntoSH9Color(dir, radiance).Coefficients[i] * weight;
+        sh += result;
+        weightSum += weight;
       }
     }
+  }
 
-    for (uint64_t i = 0; i < 9; ++i)
-      sh.Coefficients[i] *= (4.0f * 3.14159f) / weightSum;
+  for (uint64_t i = 0; i < 9; ++i)
+    sh.Coefficients[i] *= (4.0f * 3.14159f) / weightSum;
+}
 
+void SkyCache::Init(
+    const glm::vec3& sunDirection_,
+    float sunSize,
+    const glm::vec3& groundAlbedo_,
+    float turbidity,
+    bool createCubemap)
+{
+  glm::vec3 sunDirection = sunDirection_;
+  glm::vec3 groundAlbedo = groundAlbedo_;
+  sunDirection.y = saturate(sunDirection.y);
+  sunDirection = glm::normalize(sunDirection);
+  turbidity = _clamp(turbidity, 1.0f, 32.0f);
+  groundAlbedo = saturate(groundAlbedo);
+  sunSize = std::max(sunSize, 0.01f);
+
+  // Do nothing if we're already up-to-date
+  if (Initialized() && sunDirection == SunDirection && groundAlbedo == Albedo &&
+      turbidity == Turbidity && SunSize == sunSize)
+    return;
+
+  Shutdown();
+
+  std::vector<Half4> texels;
+  Compute(
+      sunDirection,
+      sunSize,
+      groundAlbedo,
+      turbidity,
+      createCubemap ? &texels : nullptr,
+      &getWorkerPool());
+
+  if (createCubemap)
+  {
     create2DTexture(
         CubeMap, CubeMapRes, CubeMapRes, 1, 1, DXGI_FORMAT_R16G16B16A16_FLOAT, true, texels.data());
   }
 }
 
+void SkyCache::Compute(
+    const glm::vec3& sunDirection_,
+    float sunSize,
+    const glm::vec3& groundAlbedo_,
+    float turbidity,
+    std::vector<Half4>* cubeMapTexels,
+    WorkerPool* pool,
+    const SkyTable* table)
+{
+  assert(Initialized() == false);
+
+  glm::vec3 sunDirection = sunDirection_;
+  glm::vec3 groundAlbedo = groundAlbedo_;
+  sunDirection.y = saturate(sunDirection.y);
+  sunDirection = glm::normalize(sunDirection);
+  turbidity = _clamp(turbidity, 1.0f, 32.0f);
+  groundAlbedo = saturate(groundAlbedo);
+  sunSize = std::max(sunSize, 0.01f);
+
+  float thetaS = AngleBetween(sunDirection, glm::vec3(0, 1, 0));
+  float elevation = Pi_2 - thetaS;
+  StateR = arhosek_rgb_skymodelstate_alloc_init(turbidity, groundAlbedo.x, elevation);
+  StateG = arhosek_rgb_skymodelstate_alloc_init(turbidity, groundAlbedo.y, elevation);
+  StateB = arhosek_rgb_skymodelstate_alloc_init(turbidity, groundAlbedo.z, elevation);
+
+  // Multiply by standard luminous efficacy of 683 lm/W to bring us in line with the photometric
+  // units used during rendering, and pre-scale by our FP16 scale factor
+  Radiance.init(StateR, StateG, StateB, sunDirection, 683.0f * FP16Scale);
+
+  Albedo = groundAlbedo;
+  Elevation = elevation;
+  SunDirection = sunDirection;
+  Turbidity = turbidity;
+  SunSize = sunSize;
+
+  if (table != nullptr && table->valid())
+  {
+    // Interpolated from the precomputed table, the cube map bake below replaces the SH
+    table->lookup(sunDirection, groundAlbedo, turbidity, SunIrradiance, sh);
+  }
+  else
+  {
+    SunIrradiance = IntegrateSunIrradiance(sunDirection, thetaS, turbidity, groundAlbedo);
+  }
+
+  // Compute a uniform solar radiance value such that integrating this radiance over a disc with
+  // the provided angular radius
+  SunRadiance = SunIrradiance / IrradianceIntegral(degToRad(SunSize));
+
+  if (cubeMapTexels != nullptr)
+  {
+    // Make a pre-computed cubemap with the sky radiance values, minus the sun.
+    // For this we again pre-scale by our FP16 scale factor so that we can use an FP16 format.
+    cubeMapTexels->resize(CubeMapRes * CubeMapRes * 6);
+
+    // We'll also project the sky onto SH coefficients for use during rendering
+    BakeCubeMap(CubeMapRes, cubeMapTexels->data(), sh, pool);
+  }
+}
+
 void SkyCache::Shutdown()
 {
   if (StateR != nullptr)
@@ -249,6 +400,7 @@ void SkyCache::Shutdown()
   SunRadiance = glm::vec3(0.0f);
   SunIrradiance = glm::vec3(0.0f);
   sh = SH9Color();
+  Radiance = SkyRadianceEvaluator();
 }
 
 SkyCache::~SkyCache() { assert(Initialized() == false); }
@@ -256,21 +408,113 @@ SkyCache::~SkyCache() { assert(Initialized() == false); }
 glm::vec3 SkyCache::Sample(glm::vec3 sampleDir) const
 {
   assert(StateR != nullptr);
+  return Radiance.evaluate(sampleDir);
+}
 
-  float gamma = AngleBetween(sampleDir, SunDirection);
-  float theta = AngleBetween(sampleDir, glm::vec3(0, 1, 0));
+void SkyCache::Sample(
+    const float* dirX,
+    const float* dirY,
+    const float* dirZ,
+    uint32_t count,
+    float* radianceR,
+    float* radianceG,
+    float* radianceB) const
+{
+  assert(StateR != nullptr);
+  Radiance.evaluate(dirX, dirY, dirZ, count, radianceR, radianceG, radianceB);
+}
 
-  glm::vec3 radiance;
+void SkyCache::BakeCubeMap(uint64_t res, Half4* texels, SH9Color& shOut, WorkerPool* pool) const
+{
+  assert(StateR != nullptr);
 
-  radiance.x = float(arhosek_tristim_skymodel_radiance(StateR, theta, gamma, 0));
-  radiance.y = float(arhosek_tristim_skymodel_radiance(StateG, theta, gamma, 1));
-  radiance.z = float(arhosek_tristim_skymodel_radiance(StateB, theta, gamma, 2));
+  // One partial sum per row, added up in order so the result doesn't depend on the thread count
+  const uint32_t numRows = uint32_t(res * 6);
+  std::vector<SkyBakeRowSum> rowSums(numRows);
+  WorkerPool::JobFunction bakeRow = [&](uint32_t row) {
+    BakeSkyRow(Radiance, res, row, texels, rowSums[row]);
+  };
+  if (pool != nullptr)
+    pool->parallelFor(numRows, bakeRow, BakeRowGranularity);
+  else
+    for (uint32_t row = 0; row < numRows; ++row)
+      bakeRow(row);
 
-  // Multiply by standard luminous efficacy of 683 lm/W to bring us in line with the photometric
-  // units used during rendering
-  radiance *= 683.0f;
+  shOut = SH9Color();
+  float weightSum = 0.0f;
+  for (const SkyBakeRowSum& rowSum : rowSums)
+  {
+    shOut += rowSum.SH;
+    weightSum += rowSum.WeightSum;
+  }
+
+  for (uint64_t i = 0; i < 9; ++i)
+    shOut.Coefficients[i] *= (4.0f * 3.14159f) / weightSum;
+}
+
+void SkyCache::Benchmark()
+{
+  SkyCache cache;
+  cache.Init(glm::normalize(glm::vec3(0.3f, 0.4f, 0.6f)), 1.0f, glm::vec3(0.5f), 2.0f, false);
+
+  Timer timer;
+  timer.init();
+
+  const uint64_t resolutions[] = {64, 128, 256};
+  for (uint64_t res : resolutions)
+  {
+    std::vector<Half4> reference(res * res * 6);
+    std::vector<Half4> texels(res * res * 6);
+    SH9Color referenceSH;
+    SH9Color bakedSH;
+
+    timer.update();
+    BakeSkyReference(cache, res, reference.data(), referenceSH);
+    timer.update();
+    const double referenceTime = timer.m_DeltaMillisecondsD;
+
+    timer.update();
+    cache.BakeCubeMap(res, texels.data(), bakedSH, nullptr);
+    timer.update();
+    const double serialTime = timer.m_DeltaMillisecondsD;
+
+    timer.update();
+    cache.BakeCubeMap(res, texels.data(), bakedSH, &getWorkerPool());
+    timer.update();
+    const double threadedTime = timer.m_DeltaMillisecondsD;
+
+    // Relative to the brightest channel of the texel, the horizon texels are dim
+    float maxTexelError = 0.0f;
+    for (size_t i = 0; i < texels.size(); ++i)
+    {
+      const glm::vec3 expected = reference[i].ToFloat3();
+      const glm::vec3 error = glm::abs(texels[i].ToFloat3() - expected);
+      const float peak = std::max(std::max(expected.x, expected.y), std::max(expected.z, 1e-6f));
+      maxTexelError = std::max(maxTexelError, std::max(std::max(error.x, error.y), error.z) / peak);
+    }
+    float maxSHError = 0.0f;
+    const float shPeak = std::max(std::max(referenceSH[0].x, referenceSH[0].y), referenceSH[0].z);
+    for (uint64_t i = 0; i < 9; ++i)
+    {
+      const glm::vec3 error = glm::abs(bakedSH[i] - referenceSH[i]);
+      maxSHError = std::max(maxSHError, std::max(std::max(error.x, error.y), error.z) / shPeak);
+    }
+
+    writeLog(
+        "SkyCache::Benchmark: %llux%llu, scalar %.3f ms, SIMD %.3f ms, SIMD on %u threads %.3f "
+        "ms (%.1fx), max texel error %.5f, max SH error %.6f",
+        res,
+        res,
+        referenceTime,
+        serialTime,
+        getWorkerPool().numThreads(),
+        threadedTime,
+        referenceTime / threadedTime,
+        maxTexelError,
+        maxSHError);
+  }
 
-  return radiance * FP16Scale;
+  cache.Shutdown();
 }
 
 // == Skybox ======================================================================================
@@ -11,13 +11,19 @@
 
 #include "Utility.hpp"
 #include "SphericalHarmonics.hpp"
+#include "SkyRadiance.hpp"
 
 // HosekSky forward declares
 struct ArHosekSkyModelState;
+struct Half4;
+struct SkyTable;
+struct WorkerPool;
 
 // Cached data for the procedural sky model
 struct SkyCache
 {
+  static constexpr uint64_t CubeMapRes = 128;
+
   ArHosekSkyModelState* StateR = nullptr;
   ArHosekSkyModelState* StateG = nullptr;
   ArHosekSkyModelState* StateB = nullptr;
@@ -30,6 +36,8 @@ struct SkyCache
   float Elevation = 0.0f;
   Texture CubeMap;
   SH9Color sh;
+  // Float SIMD sky radiance of the three states, scaled like Sample()
+  SkyRadianceEvaluator Radiance;
 
   void Init(
       const glm::vec3& sunDirection,
@@ -37,12 +45,41 @@ struct SkyCache
       const glm::vec3& groundAlbedo,
       float turbidity,
       bool createCubemap);
+  // Everything Init() does except creating the cube map texture, on a shut down cache and without
+  // touching the device, so it can run off the render thread. The cube map texels go to
+  // cubeMapTexels when it isn't null, baked on the pool (null bakes on the calling thread).
+  // A valid table replaces the sun integration, and the SH projection without a cube map.
+  void Compute(
+      const glm::vec3& sunDirection,
+      float sunSize,
+      const glm::vec3& groundAlbedo,
+      float turbidity,
+      std::vector<Half4>* cubeMapTexels,
+      WorkerPool* pool,
+      const SkyTable* table = nullptr);
   void Shutdown();
   ~SkyCache();
 
   bool Initialized() const { return StateR != nullptr; }
 
   glm::vec3 Sample(glm::vec3 sampleDir) const;
+  // Sample() of count directions in structure-of-arrays layout
+  void Sample(
+      const float* dirX,
+      const float* dirY,
+      const float* dirZ,
+      uint32_t count,
+      float* radianceR,
+      float* radianceG,
+      float* radianceB) const;
+
+  // Bakes the sky radiance minus the sun into 6 res x res faces and projects it onto SH. Rows are
+  // baked in parallel on the pool, a null pool bakes on the calling thread.
+  void BakeCubeMap(uint64_t res, Half4* texels, SH9Color& shOut, WorkerPool* pool) const;
+
+  // Headless timings of the bake at 64, 128 and 256 against the scalar path, written to the
+  // debug output
+  static void Benchmark();
 };
 
 class Skybox
@@ -0,0 +1,270 @@
+#include "SkyBaker.hpp"
+#include "Timer.hpp"
+#include "WorkerPool.hpp"
+#include "../Common/Half.hpp"
+
+//---------------------------------------------------------------------------//
+// Internal
+//---------------------------------------------------------------------------//
+static void uploadCubeMap(SkyCache& p_Cache, const Half4* p_Texels, uint64_t p_Resolution)
+{
+  create2DTexture(
+      p_Cache.CubeMap,
+      p_Resolution,
+      p_Resolution,
+      1,
+      1,
+      DXGI_FORMAT_R16G16B16A16_FLOAT,
+      true,
+      p_Texels);
+}
+//---------------------------------------------------------------------------//
+// SkyBaker
+//---------------------------------------------------------------------------//
+void SkyBaker::init(
+    uint32_t p_RetireFrames, const SkyTable* p_Table, const UploadFunction& p_Upload)
+{
+  deinit();
+
+  m_RetireFrames = p_RetireFrames;
+  m_Table = p_Table;
+  m_Upload = p_Upload ? p_Upload : UploadFunction(uploadCubeMap);
+  m_Quit = false;
+  m_Worker = std::thread([this]() { workerLoop(); });
+}
+//---------------------------------------------------------------------------//
+void SkyBaker::deinit()
+{
+  if (m_Worker.joinable())
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      m_Quit = true;
+    }
+    m_WakeCondition.notify_all();
+    m_Worker.join();
+  }
+
+  for (Generation& generation : m_Generations)
+  {
+    generation.cache.Shutdown();
+    generation.texels.clear();
+  }
+  m_Current = 0;
+  m_ReuseFrame = 0;
+  m_HasPending = false;
+  m_HasRequested = false;
+  m_State = BakeState::Idle;
+  m_Stats = SkyBakerStats();
+}
+//---------------------------------------------------------------------------//
+void SkyBaker::request(const SkyParameters& p_Parameters)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+
+  if (m_HasRequested && p_Parameters == m_LastRequested)
+    return;
+
+  if (m_HasPending)
+    ++m_Stats.NumCoalesced;
+  ++m_Stats.NumRequests;
+  m_Pending = p_Parameters;
+  m_LastRequested = p_Parameters;
+  m_HasPending = true;
+  m_HasRequested = true;
+}
+//---------------------------------------------------------------------------//
+bool SkyBaker::update(uint64_t p_Frame)
+{
+  std::unique_lock<std::mutex> lock(m_Mutex);
+
+  startBake(p_Frame);
+
+  // Nothing to render with yet
+  const bool waitForBake = m_State == BakeState::Queued || m_State == BakeState::Baking;
+  if (current().Initialized() == false && waitForBake)
+    m_DoneCondition.wait(lock, [this]() { return m_State == BakeState::Baked; });
+
+  if (m_State != BakeState::Baked)
+    return false;
+
+  // The worker doesn't touch the generations until the next bake is queued
+  Generation& baked = m_Generations[1 - m_Current];
+  if (baked.texels.empty() == false)
+    m_Upload(baked.cache, baked.texels.data(), SkyCache::CubeMapRes);
+
+  m_Current = 1 - m_Current;
+  m_ReuseFrame = p_Frame + m_RetireFrames;
+  m_State = BakeState::Idle;
+  ++m_Stats.NumCommits;
+
+  startBake(p_Frame);
+  return true;
+}
+//---------------------------------------------------------------------------//
+void SkyBaker::wait()
+{
+  std::unique_lock<std::mutex> lock(m_Mutex);
+  m_DoneCondition.wait(lock, [this]() {
+    return m_State == BakeState::Idle || m_State == BakeState::Baked;
+  });
+}
+//---------------------------------------------------------------------------//
+SkyBakerStats SkyBaker::stats() const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_Stats;
+}
+//---------------------------------------------------------------------------//
+void SkyBaker::startBake(uint64_t p_Frame)
+{
+  if (m_State != BakeState::Idle || m_HasPending == false || p_Frame < m_ReuseFrame)
+    return;
+
+  // Frees the retired generation's texture and descriptor here on the render thread, the worker
+  // only computes
+  m_Generations[1 - m_Current].cache.Shutdown();
+
+  m_Baking = m_Pending;
+  m_HasPending = false;
+  m_State = BakeState::Queued;
+  m_WakeCondition.notify_one();
+}
+//---------------------------------------------------------------------------//
+void SkyBaker::workerLoop()
+{
+  Timer timer;
+  timer.init();
+
+  std::unique_lock<std::mutex> lock(m_Mutex);
+  while (true)
+  {
+    m_WakeCondition.wait(lock, [this]() { return m_Quit || m_State == BakeState::Queued; });
+    if (m_Quit)
+      return;
+
+    const SkyParameters parameters = m_Baking;
+    Generation& generation = m_Generations[1 - m_Current];
+    m_State = BakeState::Baking;
+    lock.unlock();
+
+    // Baked on this thread alone, the worker pool would block the render thread's parallel
+    // loops until the bake is done
+    timer.update();
+    generation.cache.Compute(
+        parameters.SunDirection,
+        parameters.SunSize,
+        parameters.GroundAlbedo,
+        parameters.Turbidity,
+        &generation.texels,
+        nullptr,
+        m_Table);
+    timer.update();
+
+    lock.lock();
+    m_State = BakeState::Baked;
+    m_Stats.LastBakeMilliseconds = timer.m_DeltaMillisecondsD;
+    ++m_Stats.NumBakes;
+    m_DoneCondition.notify_all();
+  }
+}
+//---------------------------------------------------------------------------//
+bool SkyBaker::validate()
+{
+  bool passed = true;
+  auto check = [&passed](bool p_Condition, const char* p_What) {
+    if (!p_Condition)
+    {
+      writeLog("SkyBaker::validate: %s failed", p_What);
+      passed = false;
+    }
+  };
+
+  uint32_t numUploads = 0;
+  bool uploadsValid = true;
+  auto fakeUpload = [&](SkyCache& p_Cache, const Half4* p_Texels, uint64_t p_Resolution) {
+    uploadsValid = uploadsValid && p_Cache.Initialized() && p_Texels != nullptr &&
+                   p_Resolution == SkyCache::CubeMapRes;
+    ++numUploads;
+  };
+
+  SkyParameters parameters[4];
+  for (uint32_t i = 0; i < 4; ++i)
+    parameters[i].SunDirection = glm::normalize(glm::vec3(0.2f * i, 0.3f + 0.1f * i, 0.6f));
+
+  // The cache holds the sanitized direction
+  auto isCurrent = [](const SkyBaker& p_Baker, const SkyParameters& p_Parameters) {
+    return glm::dot(p_Baker.current().SunDirection, p_Parameters.SunDirection) > 0.9999f;
+  };
+
+  const uint32_t retireFrames = 2;
+  SkyBaker baker;
+  baker.init(retireFrames, nullptr, fakeUpload);
+
+  // The first update waits for the bake
+  baker.request(parameters[0]);
+  check(baker.update(0), "first update commit");
+  check(isCurrent(baker, parameters[0]), "first generation");
+
+  // The generation swapped out at frame 0 is in flight until frame 0 + retireFrames
+  baker.request(parameters[1]);
+  baker.update(1);
+  check(baker.m_State == BakeState::Idle && baker.m_HasPending, "retired generation kept");
+  check(baker.update(2) == false, "no commit while baking");
+
+  // The fourth request replaces the third before its bake starts
+  baker.request(parameters[2]);
+  baker.request(parameters[3]);
+  baker.wait();
+  check(isCurrent(baker, parameters[0]), "no swap before update");
+  check(baker.update(3), "second commit");
+  check(isCurrent(baker, parameters[1]), "second generation");
+
+  baker.update(4);
+  check(baker.m_State == BakeState::Idle && baker.m_HasPending, "retired generation kept again");
+  baker.update(5);
+  baker.wait();
+  check(baker.update(6), "third commit");
+  check(isCurrent(baker, parameters[3]), "coalesced generation");
+
+  // Requesting what was last requested does nothing
+  baker.request(parameters[3]);
+  check(baker.m_HasPending == false, "repeated request ignored");
+
+  const SkyBakerStats stats = baker.stats();
+  check(stats.NumRequests == 4 && stats.NumCoalesced == 1, "request stats");
+  check(stats.NumBakes == 3 && stats.NumCommits == 3, "bake stats");
+  check(numUploads == 3 && uploadsValid, "uploads");
+
+  // Same cache as a bake on the calling thread with the worker pool
+  SkyCache reference;
+  std::vector<Half4> referenceTexels;
+  reference.Compute(
+      parameters[3].SunDirection,
+      parameters[3].SunSize,
+      parameters[3].GroundAlbedo,
+      parameters[3].Turbidity,
+      &referenceTexels,
+      &getWorkerPool());
+  const Generation& current = baker.m_Generations[baker.m_Current];
+  bool sameSH = true;
+  for (uint64_t i = 0; i < 9; ++i)
+    sameSH = sameSH && current.cache.sh[i] == reference.sh[i];
+  check(sameSH && current.cache.SunIrradiance == reference.SunIrradiance, "baked sky");
+  check(
+      current.texels.size() == referenceTexels.size() &&
+          memcmp(
+              current.texels.data(),
+              referenceTexels.data(),
+              referenceTexels.size() * sizeof(Half4)) == 0,
+      "baked texels");
+  reference.Shutdown();
+
+  baker.deinit();
+
+  writeLog(
+      "SkyBaker::validate: %s, last bake %.3f ms",
+      passed ? "passed" : "FAILED",
+      stats.LastBakeMilliseconds);
+  return passed;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "AnalyticalSkyModel.hpp"
+
+#include <condition_variable>
+#include <functional>
+
+//---------------------------------------------------------------------------//
+struct SkyParameters
+{
+  glm::vec3 SunDirection = glm::vec3(0.0f, 1.0f, 0.0f);
+  float SunSize = 1.0f;
+  glm::vec3 GroundAlbedo = glm::vec3(0.5f);
+  float Turbidity = 2.0f;
+
+  bool operator==(const SkyParameters& p_Other) const
+  {
+    return SunDirection == p_Other.SunDirection && SunSize == p_Other.SunSize &&
+           GroundAlbedo == p_Other.GroundAlbedo && Turbidity == p_Other.Turbidity;
+  }
+  bool operator!=(const SkyParameters& p_Other) const { return !(*this == p_Other); }
+};
+//---------------------------------------------------------------------------//
+struct SkyBakerStats
+{
+  uint32_t NumRequests = 0;
+  // Requests replaced by a newer one before their bake started
+  uint32_t NumCoalesced = 0;
+  uint32_t NumBakes = 0;
+  uint32_t NumCommits = 0;
+  double LastBakeMilliseconds = 0.0;
+};
+//---------------------------------------------------------------------------//
+// Keeps two SkyCache generations and bakes the next one on a background thread while the
+// renderer keeps using the current one, so an animated sun costs the render thread nothing but
+// the texture upload.
+//
+// request() only records the latest parameters, requests made while a bake is running are
+// coalesced into one. update() runs at the frame boundary on the render thread: it uploads and
+// swaps in a finished generation and starts the next bake. A retired generation's texture may
+// still be used by frames in flight, so it's only rebuilt p_RetireFrames frames after the swap.
+// The first update() waits for its bake, there's no sky to render before that.
+//---------------------------------------------------------------------------//
+struct SkyBaker
+{
+  // Creates the cube map of a finished generation on the render thread
+  using UploadFunction =
+      std::function<void(SkyCache& p_Cache, const Half4* p_Texels, uint64_t p_Resolution)>;
+
+  SkyBaker() {}
+  ~SkyBaker() { deinit(); }
+
+  SkyBaker(const SkyBaker&) = delete;
+  SkyBaker& operator=(const SkyBaker&) = delete;
+
+  // p_Table (optional) has to outlive the baker. An empty p_Upload creates the cube map texture
+  // with create2DTexture().
+  void init(
+      uint32_t p_RetireFrames,
+      const SkyTable* p_Table = nullptr,
+      const UploadFunction& p_Upload = {});
+  void deinit();
+
+  void request(const SkyParameters& p_Parameters);
+  // Returns true when a new generation became current
+  bool update(uint64_t p_Frame);
+  // Blocks until no bake is running
+  void wait();
+
+  // Valid after the first update() following a request()
+  const SkyCache& current() const { return m_Generations[m_Current].cache; }
+  SkyBakerStats stats() const;
+
+  // Headless checks of the request/commit logic with a fake uploader, and of the baked cache
+  // against SkyCache::Compute() on the calling thread. Results go to the debug output.
+  static bool validate();
+
+private:
+  enum class BakeState
+  {
+    Idle,
+    Queued,
+    Baking,
+    Baked
+  };
+
+  struct Generation
+  {
+    SkyCache cache;
+    std::vector<Half4> texels;
+  };
+
+  void workerLoop();
+  void startBake(uint64_t p_Frame);
+
+  Generation m_Generations[2];
+  uint32_t m_Current = 0;
+  UploadFunction m_Upload;
+  const SkyTable* m_Table = nullptr;
+  uint32_t m_RetireFrames = 0;
+  // First frame the retired generation may be rebuilt in
+  uint64_t m_ReuseFrame = 0;
+
+  SkyParameters m_Pending;
+  SkyParameters m_Baking;
+  SkyParameters m_LastRequested;
+  bool m_HasPending = false;
+  bool m_HasRequested = false;
+  BakeState m_State = BakeState::Idle;
+  SkyBakerStats m_Stats;
+
+  std::thread m_Worker;
+  mutable std::mutex m_Mutex;
+  std::condition_variable m_WakeCondition;
+  std::condition_variable m_DoneCondition;
+  bool m_Quit = false;
+};
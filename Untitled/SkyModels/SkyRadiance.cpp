@@ -0,0 +1,376 @@
+#include "SkyRadiance.hpp"
+#include "HosekSky/ArHosekSkyModel.h"
+#include "Sampling.hpp"
+#include "Timer.hpp"
+
+#include <immintrin.h>
+
+//---------------------------------------------------------------------------//
+// Internal
+//---------------------------------------------------------------------------//
+// Directions per SSE register
+static constexpr uint32_t LaneCount = 4;
+
+// e^x of every lane, range reduced to 2^n * e^r with |r| <= ln(2) / 2 and a degree 6 polynomial
+// for e^r (Cephes expf), about 1 ulp. Lanes are clamped to the float range.
+static __m128 expSSE(__m128 p_X)
+{
+  __m128 x = _mm_min_ps(_mm_max_ps(p_X, _mm_set1_ps(-87.3f)), _mm_set1_ps(88.3f));
+
+  const __m128i n = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.44269504f)));
+  const __m128 nf = _mm_cvtepi32_ps(n);
+  x = _mm_sub_ps(x, _mm_mul_ps(nf, _mm_set1_ps(0.693359375f)));
+  x = _mm_sub_ps(x, _mm_mul_ps(nf, _mm_set1_ps(-2.12194440e-4f)));
+
+  __m128 y = _mm_set1_ps(1.9875691500e-4f);
+  y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.3981999507e-3f));
+  y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(8.3334519073e-3f));
+  y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(4.1665795894e-2f));
+  y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.6666665459e-1f));
+  y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(5.0000001201e-1f));
+  y = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(y, x), x), _mm_add_ps(x, _mm_set1_ps(1.0f)));
+
+  const __m128i exponent = _mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23);
+  return _mm_mul_ps(y, _mm_castsi128_ps(exponent));
+}
+//---------------------------------------------------------------------------//
+// acos(x) of lanes in [0, 1] as sqrt(1 - x) times a degree 7 polynomial (Abramowitz and Stegun
+// 4.4.46), absolute error below 2e-8 before rounding. The sky clamps its cosines to 1e-5 and up.
+static __m128 acosSSE(__m128 p_X)
+{
+  __m128 y = _mm_set1_ps(-0.0012624911f);
+  y = _mm_add_ps(_mm_mul_ps(y, p_X), _mm_set1_ps(0.0066700901f));
+  y = _mm_add_ps(_mm_mul_ps(y, p_X), _mm_set1_ps(-0.0170881256f));
+  y = _mm_add_ps(_mm_mul_ps(y, p_X), _mm_set1_ps(0.0308918810f));
+  y = _mm_add_ps(_mm_mul_ps(y, p_X), _mm_set1_ps(-0.0501743046f));
+  y = _mm_add_ps(_mm_mul_ps(y, p_X), _mm_set1_ps(0.0889789874f));
+  y = _mm_add_ps(_mm_mul_ps(y, p_X), _mm_set1_ps(-0.2145988016f));
+  y = _mm_add_ps(_mm_mul_ps(y, p_X), _mm_set1_ps(1.5707963050f));
+  return _mm_mul_ps(y, _mm_sqrt_ps(_mm_sub_ps(_mm_set1_ps(1.0f), p_X)));
+}
+//---------------------------------------------------------------------------//
+// The double precision model the evaluator stands in for, at the same clamped angles. Unlike
+// SkyCache::Sample() used to, cos(gamma) is also clamped to 1.
+static glm::dvec3 referenceRadiance(
+    ArHosekSkyModelState* const* p_States,
+    const glm::vec3& p_SunDirection,
+    const glm::vec3& p_Direction,
+    double p_Scale)
+{
+  const glm::dvec3 direction = glm::dvec3(p_Direction);
+  const double theta = std::acos(std::max(direction.y, 0.00001));
+  const double cosGamma = glm::dot(direction, glm::dvec3(p_SunDirection));
+  const double gamma = std::acos(glm::clamp(cosGamma, 0.00001, 1.0));
+
+  glm::dvec3 radiance;
+  for (int channel = 0; channel < 3; ++channel)
+  {
+    radiance[channel] =
+        arhosek_tristim_skymodel_radiance(p_States[channel], theta, gamma, channel) * p_Scale;
+  }
+  return radiance;
+}
+//---------------------------------------------------------------------------//
+// SkyRadianceEvaluator
+//---------------------------------------------------------------------------//
+void SkyRadianceEvaluator::init(
+    const ArHosekSkyModelState* p_StateR,
+    const ArHosekSkyModelState* p_StateG,
+    const ArHosekSkyModelState* p_StateB,
+    const glm::vec3& p_SunDirection,
+    float p_Scale)
+{
+  assert(p_StateR != nullptr && p_StateG != nullptr && p_StateB != nullptr);
+
+  // Channel c of the sky comes from the c-th configuration of its own state
+  const ArHosekSkyModelState* states[3] = {p_StateR, p_StateG, p_StateB};
+  for (uint32_t channel = 0; channel < 3; ++channel)
+  {
+    const double* config = states[channel]->configs[channel];
+
+    float terms[NumTerms];
+    for (uint32_t i = 0; i < 8; ++i)
+      terms[TermA + i] = float(config[i]);
+    terms[TermMieBase] = float(1.0 + config[8] * config[8]);
+    terms[TermMieScale] = float(2.0 * config[8]);
+    terms[TermScale] = float(states[channel]->radiances[channel] * double(p_Scale));
+
+    for (uint32_t term = 0; term < NumTerms; ++term)
+      for (uint32_t lane = 0; lane < LaneCount; ++lane)
+        m_Terms[channel][term][lane] = terms[term];
+  }
+
+  m_SunDirection = p_SunDirection;
+}
+//---------------------------------------------------------------------------//
+void SkyRadianceEvaluator::evaluate(
+    const float* p_DirectionsX,
+    const float* p_DirectionsY,
+    const float* p_DirectionsZ,
+    uint32_t p_Count,
+    float* p_RadianceR,
+    float* p_RadianceG,
+    float* p_RadianceB) const
+{
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 minCosine = _mm_set1_ps(0.00001f);
+  const __m128 sunX = _mm_set1_ps(m_SunDirection.x);
+  const __m128 sunY = _mm_set1_ps(m_SunDirection.y);
+  const __m128 sunZ = _mm_set1_ps(m_SunDirection.z);
+  float* radiances[3] = {p_RadianceR, p_RadianceG, p_RadianceB};
+
+  for (uint32_t first = 0; first < p_Count; first += LaneCount)
+  {
+    const uint32_t count = std::min(LaneCount, p_Count - first);
+
+    __m128 x;
+    __m128 y;
+    __m128 z;
+    if (count == LaneCount)
+    {
+      x = _mm_loadu_ps(p_DirectionsX + first);
+      y = _mm_loadu_ps(p_DirectionsY + first);
+      z = _mm_loadu_ps(p_DirectionsZ + first);
+    }
+    else
+    {
+      // Tail, the unused lanes evaluate the zenith
+      alignas(16) float tail[3][LaneCount] = {{0.0f}, {1.0f, 1.0f, 1.0f, 1.0f}, {0.0f}};
+      for (uint32_t i = 0; i < count; ++i)
+      {
+        tail[0][i] = p_DirectionsX[first + i];
+        tail[1][i] = p_DirectionsY[first + i];
+        tail[2][i] = p_DirectionsZ[first + i];
+      }
+      x = _mm_load_ps(tail[0]);
+      y = _mm_load_ps(tail[1]);
+      z = _mm_load_ps(tail[2]);
+    }
+
+    // Angle terms shared by the three channels
+    const __m128 cosTheta = _mm_max_ps(y, minCosine);
+    __m128 cosGamma = _mm_add_ps(_mm_mul_ps(x, sunX), _mm_mul_ps(y, sunY));
+    cosGamma = _mm_max_ps(_mm_add_ps(cosGamma, _mm_mul_ps(z, sunZ)), minCosine);
+    // Rounding can take the sun's own direction past 1
+    cosGamma = _mm_min_ps(cosGamma, one);
+    const __m128 gamma = acosSSE(cosGamma);
+    const __m128 rayM = _mm_mul_ps(cosGamma, cosGamma);
+    const __m128 rayM1 = _mm_add_ps(one, rayM);
+    const __m128 zenith = _mm_sqrt_ps(cosTheta);
+    const __m128 invHorizon = _mm_div_ps(one, _mm_add_ps(cosTheta, _mm_set1_ps(0.01f)));
+
+    for (uint32_t channel = 0; channel < 3; ++channel)
+    {
+      const float(*terms)[LaneCount] = m_Terms[channel];
+
+      // ArHosekSkyModel_GetRadianceInternal()
+      const __m128 expM = expSSE(_mm_mul_ps(_mm_load_ps(terms[TermE]), gamma));
+      const __m128 horizon = expSSE(_mm_mul_ps(_mm_load_ps(terms[TermB]), invHorizon));
+      const __m128 mieBase = _mm_sub_ps(
+          _mm_load_ps(terms[TermMieBase]),
+          _mm_mul_ps(_mm_load_ps(terms[TermMieScale]), cosGamma));
+      const __m128 mieM = _mm_div_ps(rayM1, _mm_mul_ps(mieBase, _mm_sqrt_ps(mieBase)));
+
+      __m128 chi = _mm_mul_ps(_mm_load_ps(terms[TermD]), expM);
+      chi = _mm_add_ps(chi, _mm_load_ps(terms[TermC]));
+      chi = _mm_add_ps(chi, _mm_mul_ps(_mm_load_ps(terms[TermF]), rayM));
+      chi = _mm_add_ps(chi, _mm_mul_ps(_mm_load_ps(terms[TermG]), mieM));
+      chi = _mm_add_ps(chi, _mm_mul_ps(_mm_load_ps(terms[TermH]), zenith));
+      const __m128 falloff = _mm_add_ps(one, _mm_mul_ps(_mm_load_ps(terms[TermA]), horizon));
+      const __m128 radiance =
+          _mm_mul_ps(_mm_mul_ps(falloff, chi), _mm_load_ps(terms[TermScale]));
+
+      if (count == LaneCount)
+      {
+        _mm_storeu_ps(radiances[channel] + first, radiance);
+      }
+      else
+      {
+        alignas(16) float tail[LaneCount];
+        _mm_store_ps(tail, radiance);
+        for (uint32_t i = 0; i < count; ++i)
+          radiances[channel][first + i] = tail[i];
+      }
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+glm::vec3 SkyRadianceEvaluator::evaluate(const glm::vec3& p_Direction) const
+{
+  glm::vec3 radiance;
+  evaluate(
+      &p_Direction.x, &p_Direction.y, &p_Direction.z, 1, &radiance.x, &radiance.y, &radiance.z);
+  return radiance;
+}
+//---------------------------------------------------------------------------//
+// Validation
+//---------------------------------------------------------------------------//
+// Skies over the sun elevations, turbidities and ground albedos the renderer can ask for
+static constexpr uint32_t NumTestSkies = 64;
+static constexpr uint32_t NumTestDirections = 4099;
+
+struct TestSky
+{
+  ArHosekSkyModelState* States[3] = {};
+  glm::vec3 SunDirection;
+
+  void init(Random& p_Rng)
+  {
+    const float elevation = p_Rng.RandomFloat() * Pi_2;
+    const float azimuth = p_Rng.RandomFloat() * 2.0f * Pi;
+    const float turbidity = 1.0f + p_Rng.RandomFloat() * 9.0f;
+    const glm::vec3 albedo = glm::vec3(p_Rng.RandomFloat2(), p_Rng.RandomFloat());
+    for (uint32_t channel = 0; channel < 3; ++channel)
+      States[channel] = arhosek_rgb_skymodelstate_alloc_init(turbidity, albedo[channel], elevation);
+    SunDirection = glm::vec3(
+        std::cos(elevation) * std::cos(azimuth),
+        std::sin(elevation),
+        std::cos(elevation) * std::sin(azimuth));
+  }
+  void deinit()
+  {
+    for (ArHosekSkyModelState* state : States)
+      arhosekskymodelstate_free(state);
+  }
+};
+//---------------------------------------------------------------------------//
+static void makeTestDirections(Random& p_Rng, std::vector<float> (&p_Directions)[3])
+{
+  for (std::vector<float>& component : p_Directions)
+    component.resize(NumTestDirections);
+  for (uint32_t i = 0; i < NumTestDirections; ++i)
+  {
+    const glm::vec3 direction = SampleDirectionSphere(p_Rng.RandomFloat(), p_Rng.RandomFloat());
+    for (uint32_t axis = 0; axis < 3; ++axis)
+      p_Directions[axis][i] = direction[axis];
+  }
+}
+//---------------------------------------------------------------------------//
+bool SkyRadianceEvaluator::validate()
+{
+  Random rng;
+  rng.SetSeed(2468);
+
+  std::vector<float> directions[3];
+  std::vector<float> radiances[3];
+  for (std::vector<float>& radiance : radiances)
+    radiance.resize(NumTestDirections);
+
+  // Relative to the brightest channel of the direction, the blue sky near the horizon leaves
+  // little red
+  double maxError = 0.0;
+  double sumError = 0.0;
+  for (uint32_t skyIndex = 0; skyIndex < NumTestSkies; ++skyIndex)
+  {
+    TestSky sky;
+    sky.init(rng);
+    makeTestDirections(rng, directions);
+    // A few directions right at the sun and on the horizon
+    directions[0][0] = sky.SunDirection.x;
+    directions[1][0] = sky.SunDirection.y;
+    directions[2][0] = sky.SunDirection.z;
+    directions[0][1] = 1.0f;
+    directions[1][1] = 0.0f;
+    directions[2][1] = 0.0f;
+
+    SkyRadianceEvaluator evaluator;
+    evaluator.init(sky.States[0], sky.States[1], sky.States[2], sky.SunDirection, 1.0f);
+    evaluator.evaluate(
+        directions[0].data(),
+        directions[1].data(),
+        directions[2].data(),
+        NumTestDirections,
+        radiances[0].data(),
+        radiances[1].data(),
+        radiances[2].data());
+
+    for (uint32_t i = 0; i < NumTestDirections; ++i)
+    {
+      const glm::vec3 direction = glm::vec3(directions[0][i], directions[1][i], directions[2][i]);
+      const glm::dvec3 expected = referenceRadiance(sky.States, sky.SunDirection, direction, 1.0);
+      const double peak = std::max(std::max(expected.x, expected.y), expected.z);
+      for (uint32_t channel = 0; channel < 3; ++channel)
+      {
+        const double error = std::abs(radiances[channel][i] - expected[channel]) / peak;
+        maxError = std::max(maxError, error);
+        sumError += error;
+      }
+    }
+
+    sky.deinit();
+  }
+
+  // The largest errors are a few 1e-4 right at the sun, where the radiance changes fastest with
+  // gamma and the float cos(gamma) is coarsest
+  const bool passed = maxError < 1e-3;
+  writeLog(
+      "SkyRadianceEvaluator::validate: %s, %u skies x %u directions, relative error mean %.2e max "
+      "%.2e",
+      passed ? "passed" : "FAILED",
+      NumTestSkies,
+      NumTestDirections,
+      sumError / (double(NumTestSkies) * NumTestDirections * 3),
+      maxError);
+  return passed;
+}
+//---------------------------------------------------------------------------//
+void SkyRadianceEvaluator::benchmark()
+{
+  Random rng;
+  rng.SetSeed(1357);
+
+  TestSky sky;
+  sky.init(rng);
+  std::vector<float> directions[3];
+  makeTestDirections(rng, directions);
+  std::vector<float> radiances[3];
+  for (std::vector<float>& radiance : radiances)
+    radiance.resize(NumTestDirections);
+
+  SkyRadianceEvaluator evaluator;
+  evaluator.init(sky.States[0], sky.States[1], sky.States[2], sky.SunDirection, 1.0f);
+
+  Timer timer;
+  timer.init();
+
+  const uint32_t numPasses = 64;
+  double sum = 0.0;
+  timer.update();
+  for (uint32_t pass = 0; pass < numPasses; ++pass)
+  {
+    for (uint32_t i = 0; i < NumTestDirections; ++i)
+    {
+      const glm::vec3 direction = glm::vec3(directions[0][i], directions[1][i], directions[2][i]);
+      sum += referenceRadiance(sky.States, sky.SunDirection, direction, 1.0).x;
+    }
+  }
+  timer.update();
+  const double referenceTime = timer.m_DeltaMillisecondsD;
+
+  timer.update();
+  for (uint32_t pass = 0; pass < numPasses; ++pass)
+  {
+    evaluator.evaluate(
+        directions[0].data(),
+        directions[1].data(),
+        directions[2].data(),
+        NumTestDirections,
+        radiances[0].data(),
+        radiances[1].data(),
+        radiances[2].data());
+    sum += radiances[0][pass];
+  }
+  timer.update();
+  const double batchTime = timer.m_DeltaMillisecondsD;
+
+  sky.deinit();
+
+  const double numDirections = double(numPasses) * NumTestDirections;
+  writeLog(
+      "SkyRadianceEvaluator::benchmark: double %.1f M directions/s, SSE batch %.1f M directions/s "
+      "(%.1fx) [%f]",
+      numDirections / (referenceTime * 1000.0),
+      numDirections / (batchTime * 1000.0),
+      referenceTime / batchTime,
+      sum);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Utility.hpp"
+
+struct ArHosekSkyModelState;
+
+//---------------------------------------------------------------------------//
+// Hosek-Wilkie RGB sky radiance of many directions at once, the float SIMD counterpart of
+// arhosek_tristim_skymodel_radiance() for all three channels.
+//
+// init() turns the three channel states into per channel coefficients, evaluate() takes the
+// directions in structure-of-arrays layout and works on four of them per SSE register. The
+// angles come straight from the dot products, acos() and exp() are polynomial approximations
+// and the Mie term's pow(x, 1.5) is x * sqrt(x).
+//---------------------------------------------------------------------------//
+struct SkyRadianceEvaluator
+{
+  // p_Scale multiplies every radiance, e.g. the luminous efficacy and FP16Scale
+  void init(
+      const ArHosekSkyModelState* p_StateR,
+      const ArHosekSkyModelState* p_StateG,
+      const ArHosekSkyModelState* p_StateB,
+      const glm::vec3& p_SunDirection,
+      float p_Scale);
+
+  // p_Count normalized directions, any count
+  void evaluate(
+      const float* p_DirectionsX,
+      const float* p_DirectionsY,
+      const float* p_DirectionsZ,
+      uint32_t p_Count,
+      float* p_RadianceR,
+      float* p_RadianceG,
+      float* p_RadianceB) const;
+  glm::vec3 evaluate(const glm::vec3& p_Direction) const;
+
+  // Headless checks against the double precision model over the sky parameters, reporting the
+  // largest relative error. Results go to the debug output.
+  static bool validate();
+  // Headless throughput in directions per second next to the double precision model
+  static void benchmark();
+
+private:
+  enum Term
+  {
+    TermA,
+    TermB,
+    TermC,
+    TermD,
+    TermE,
+    TermF,
+    TermG,
+    TermH,
+    // 1 + I^2 and 2 * I, the Mie term's base is MieBase - MieScale * cos(gamma)
+    TermMieBase,
+    TermMieScale,
+    // Channel radiance times the scale
+    TermScale,
+
+    NumTerms
+  };
+
+  // Every coefficient repeated in four lanes
+  alignas(16) float m_Terms[3][NumTerms][4] = {};
+  glm::vec3 m_SunDirection = glm::vec3(0.0f, 1.0f, 0.0f);
+};
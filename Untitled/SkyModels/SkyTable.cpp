@@ -0,0 +1,399 @@
+#include "SkyTable.hpp"
+#include "MappedFile.hpp"
+#include "Sampling.hpp"
+#include "Timer.hpp"
+#include "WorkerPool.hpp"
+#include "../Common/Half.hpp"
+
+//---------------------------------------------------------------------------//
+// Internal
+//---------------------------------------------------------------------------//
+static constexpr uint32_t FileMagic = 0x54594B53; // 'SKYT'
+static constexpr uint32_t FileVersion = 1;
+
+struct SkyTableFileHeader
+{
+  uint32_t Magic;
+  uint32_t Version;
+  uint64_t FileSize;
+
+  uint32_t NumElevations;
+  uint32_t NumTurbidities;
+  uint32_t NumAlbedos;
+  uint32_t SHResolution;
+  uint64_t NumEntries;
+
+  uint64_t EntriesOffset;
+};
+//---------------------------------------------------------------------------//
+static constexpr uint32_t NumEntries =
+    SkyTable::NumElevations * SkyTable::NumTurbidities * SkyTable::NumAlbedos;
+
+// Lower grid index and fraction of p_Value in [0, 1] on p_Count evenly spaced samples
+static void gridCoordinate(float p_Value, uint32_t p_Count, uint32_t& p_Index, float& p_Fraction)
+{
+  const float x = saturate(p_Value) * float(p_Count - 1);
+  p_Index = std::min(uint32_t(x), p_Count - 2);
+  p_Fraction = x - float(p_Index);
+}
+//---------------------------------------------------------------------------//
+static void buildEntry(uint32_t p_Index, SkyTableEntry& p_Entry)
+{
+  const uint32_t elevationIndex = p_Index / (SkyTable::NumTurbidities * SkyTable::NumAlbedos);
+  const uint32_t turbidityIndex = (p_Index / SkyTable::NumAlbedos) % SkyTable::NumTurbidities;
+  const uint32_t albedoIndex = p_Index % SkyTable::NumAlbedos;
+
+  const float u = float(elevationIndex) / float(SkyTable::NumElevations - 1);
+  const float elevation = Pi_2 * u * u * u;
+  const float turbidity =
+      SkyTable::MinTurbidity + (SkyTable::MaxTurbidity - SkyTable::MinTurbidity) *
+                                   float(turbidityIndex) / float(SkyTable::NumTurbidities - 1);
+  const float albedo = float(albedoIndex) / float(SkyTable::NumAlbedos - 1);
+
+  SkyCache cache;
+  cache.Compute(
+      glm::vec3(std::cos(elevation), std::sin(elevation), 0.0f),
+      1.0f,
+      glm::vec3(albedo),
+      turbidity,
+      nullptr,
+      nullptr);
+
+  std::vector<Half4> texels(SkyTable::SHResolution * SkyTable::SHResolution * 6);
+  SH9Color sh;
+  cache.BakeCubeMap(SkyTable::SHResolution, texels.data(), sh, nullptr);
+
+  p_Entry.SunIrradiance = cache.SunIrradiance;
+  for (uint32_t i = 0; i < 9; ++i)
+    p_Entry.SH[i] = sh[i];
+
+  cache.Shutdown();
+}
+//---------------------------------------------------------------------------//
+// SkyTable
+//---------------------------------------------------------------------------//
+void SkyTable::init(const wchar_t* p_FilePath, WorkerPool* p_Pool)
+{
+  if (load(p_FilePath))
+    return;
+
+  Timer timer;
+  timer.init();
+  build(p_Pool);
+  timer.update();
+  writeLog("Built sky table '%ls' in %.1f ms", p_FilePath, timer.m_DeltaMillisecondsD);
+
+  save(p_FilePath);
+}
+//---------------------------------------------------------------------------//
+void SkyTable::build(WorkerPool* p_Pool)
+{
+  m_Entries.resize(NumEntries);
+
+  WorkerPool::JobFunction buildJob = [this](uint32_t p_Index) {
+    buildEntry(p_Index, m_Entries[p_Index]);
+  };
+  if (p_Pool != nullptr)
+    p_Pool->parallelFor(NumEntries, buildJob);
+  else
+    for (uint32_t i = 0; i < NumEntries; ++i)
+      buildJob(i);
+}
+//---------------------------------------------------------------------------//
+bool SkyTable::save(const wchar_t* p_FilePath) const
+{
+  assert(valid());
+
+  SkyTableFileHeader header = {};
+  header.Magic = FileMagic;
+  header.Version = FileVersion;
+  header.NumElevations = NumElevations;
+  header.NumTurbidities = NumTurbidities;
+  header.NumAlbedos = NumAlbedos;
+  header.SHResolution = uint32_t(SHResolution);
+  header.NumEntries = m_Entries.size();
+
+  std::vector<uint8_t> blob;
+  appendBlobSection(blob, &header, 1);
+  header.EntriesOffset = appendBlobSection(blob, m_Entries.data(), m_Entries.size());
+  blob.resize(alignUp<uint64_t>(blob.size(), BlobSectionAlignment));
+
+  header.FileSize = blob.size();
+  memcpy(blob.data(), &header, sizeof(header));
+
+  if (writeDataToFile(p_FilePath, blob.data(), blob.size()) == false)
+  {
+    writeLog("Failed to write sky table '%ls'", p_FilePath);
+    return false;
+  }
+  return true;
+}
+//---------------------------------------------------------------------------//
+bool SkyTable::load(const wchar_t* p_FilePath)
+{
+  MappedFile file;
+  if (file.init(p_FilePath) == false)
+    return false;
+
+  const SkyTableFileHeader& header = *file.at<SkyTableFileHeader>(0);
+  const bool valid = file.m_Size >= sizeof(SkyTableFileHeader) && header.Magic == FileMagic &&
+                     header.Version == FileVersion && header.FileSize == file.m_Size &&
+                     header.NumElevations == NumElevations &&
+                     header.NumTurbidities == NumTurbidities && header.NumAlbedos == NumAlbedos &&
+                     header.SHResolution == SHResolution && header.NumEntries == NumEntries &&
+                     file.containsSection(
+                         header.EntriesOffset, sizeof(SkyTableEntry), header.NumEntries);
+  if (valid == false)
+    return false;
+
+  const SkyTableEntry* entries = file.at<SkyTableEntry>(header.EntriesOffset);
+  m_Entries.assign(entries, entries + header.NumEntries);
+  return true;
+}
+//---------------------------------------------------------------------------//
+void SkyTable::lookup(
+    const glm::vec3& p_SunDirection,
+    const glm::vec3& p_GroundAlbedo,
+    float p_Turbidity,
+    glm::vec3& p_SunIrradiance,
+    SH9Color& p_SH) const
+{
+  assert(valid());
+
+  glm::vec3 sunDirection = p_SunDirection;
+  sunDirection.y = saturate(sunDirection.y);
+  sunDirection = glm::normalize(sunDirection);
+  const glm::vec3 groundAlbedo = saturate(p_GroundAlbedo);
+  const float turbidity = _clamp(p_Turbidity, MinTurbidity, MaxTurbidity);
+
+  // Same elevation as SkyCache
+  const float elevation = Pi_2 - std::acos(std::max(sunDirection.y, 0.00001f));
+
+  uint32_t elevationIndex;
+  float elevationFraction;
+  gridCoordinate(
+      std::cbrt(std::max(elevation, 0.0f) / Pi_2),
+      NumElevations,
+      elevationIndex,
+      elevationFraction);
+  uint32_t turbidityIndex;
+  float turbidityFraction;
+  gridCoordinate(
+      (turbidity - MinTurbidity) / (MaxTurbidity - MinTurbidity),
+      NumTurbidities,
+      turbidityIndex,
+      turbidityFraction);
+
+  p_SunIrradiance = glm::vec3(0.0f);
+  SH9Color sh;
+  for (uint32_t channel = 0; channel < 3; ++channel)
+  {
+    uint32_t albedoIndex;
+    float albedoFraction;
+    gridCoordinate(groundAlbedo[channel], NumAlbedos, albedoIndex, albedoFraction);
+
+    for (uint32_t corner = 0; corner < 8; ++corner)
+    {
+      const uint32_t e = corner & 1;
+      const uint32_t t = (corner >> 1) & 1;
+      const uint32_t a = corner >> 2;
+      const float weight = (e ? elevationFraction : 1.0f - elevationFraction) *
+                           (t ? turbidityFraction : 1.0f - turbidityFraction) *
+                           (a ? albedoFraction : 1.0f - albedoFraction);
+
+      const SkyTableEntry& corners =
+          entry(elevationIndex + e, turbidityIndex + t, albedoIndex + a);
+      p_SunIrradiance[channel] += weight * corners.SunIrradiance[channel];
+      for (uint32_t i = 0; i < 9; ++i)
+        sh.Coefficients[i][channel] += weight * corners.SH[i][channel];
+    }
+  }
+
+  // From azimuth 0 around the up axis to the sun's azimuth
+  const float horizontal = glm::length(glm::vec2(sunDirection.x, sunDirection.z));
+  const float cosAzimuth = horizontal > 1e-6f ? sunDirection.x / horizontal : 1.0f;
+  const float sinAzimuth = horizontal > 1e-6f ? sunDirection.z / horizontal : 0.0f;
+  const glm::mat3 rotation = glm::mat3(
+      glm::vec3(cosAzimuth, 0.0f, sinAzimuth),
+      glm::vec3(0.0f, 1.0f, 0.0f),
+      glm::vec3(-sinAzimuth, 0.0f, cosAzimuth));
+  p_SH = RotateSH9Color(sh, rotation);
+}
+//---------------------------------------------------------------------------//
+// Validation
+//---------------------------------------------------------------------------//
+static glm::vec3 randomSunDirection(Random& p_Rng)
+{
+  const float azimuth = p_Rng.RandomFloat() * 2.0f * Pi;
+  const float elevation = p_Rng.RandomFloat() * Pi_2;
+  return glm::vec3(
+      std::cos(elevation) * std::cos(azimuth),
+      std::sin(elevation),
+      std::cos(elevation) * std::sin(azimuth));
+}
+//---------------------------------------------------------------------------//
+bool SkyTable::validate()
+{
+  bool passed = true;
+  Random rng;
+  rng.SetSeed(8642);
+
+  // A projected direction rotated in SH is the projection of the rotated direction
+  float maxRotationError = 0.0f;
+  for (uint32_t i = 0; i < 256; ++i)
+  {
+    const glm::vec3 dir = glm::normalize(glm::vec3(rng.RandomFloat2(), rng.RandomFloat()) - 0.5f);
+    const glm::vec3 axis = glm::normalize(glm::vec3(rng.RandomFloat2(), rng.RandomFloat()) - 0.5f);
+    const glm::mat3 rotation = glm::mat3_cast(glm::angleAxis(rng.RandomFloat() * 2.0f * Pi, axis));
+
+    const SH9Color rotated = RotateSH9Color(ProjectOntoSH9Color(dir, glm::vec3(1.0f)), rotation);
+    const SH9Color expected = ProjectOntoSH9Color(rotation * dir, glm::vec3(1.0f));
+    for (uint32_t j = 0; j < 9; ++j)
+    {
+      const glm::vec3 error = glm::abs(rotated[j] - expected[j]);
+      maxRotationError =
+          std::max(maxRotationError, std::max(std::max(error.x, error.y), error.z));
+    }
+  }
+  if (maxRotationError > 1e-4f)
+  {
+    writeLog("SkyTable::validate: SH rotation off by %f", maxRotationError);
+    passed = false;
+  }
+
+  SkyTable table;
+  table.build(&getWorkerPool());
+
+  const wchar_t* filePath = L"SkyTableValidate.skytable";
+  SkyTable loaded;
+  const bool roundTrip = table.save(filePath) && loaded.load(filePath) &&
+                         memcmp(
+                             loaded.m_Entries.data(),
+                             table.m_Entries.data(),
+                             sizeof(SkyTableEntry) * NumEntries) == 0;
+  DeleteFileW(filePath);
+  if (roundTrip == false)
+  {
+    writeLog("SkyTable::validate: saved and loaded table differ");
+    passed = false;
+  }
+
+  // Against the full computation with a cube map at random parameters, relative to the brightest
+  // channel since the blue sun nearly vanishes at the horizon. SH errors are relative to the
+  // constant band.
+  const uint32_t numSamples = 64;
+  float maxSunError = 0.0f;
+  float maxSHError = 0.0f;
+  double sumSunError = 0.0;
+  double sumSHError = 0.0;
+  for (uint32_t i = 0; i < numSamples; ++i)
+  {
+    const glm::vec3 sunDirection = randomSunDirection(rng);
+    const glm::vec3 groundAlbedo = glm::vec3(rng.RandomFloat2(), rng.RandomFloat());
+    const float turbidity = MinTurbidity + (MaxTurbidity - MinTurbidity) * rng.RandomFloat();
+
+    SkyCache cache;
+    std::vector<Half4> texels;
+    cache.Compute(sunDirection, 1.0f, groundAlbedo, turbidity, &texels, &getWorkerPool());
+
+    glm::vec3 sunIrradiance;
+    SH9Color sh;
+    table.lookup(sunDirection, groundAlbedo, turbidity, sunIrradiance, sh);
+
+    const glm::vec3 sunPeak = cache.SunIrradiance;
+    const glm::vec3 shPeak = cache.sh[0];
+    const float sunScale = std::max(std::max(std::max(sunPeak.x, sunPeak.y), sunPeak.z), 1e-6f);
+    const float shScale = std::max(std::max(std::max(shPeak.x, shPeak.y), shPeak.z), 1e-6f);
+
+    float sunError = 0.0f;
+    float shError = 0.0f;
+    for (uint32_t channel = 0; channel < 3; ++channel)
+    {
+      sunError = std::max(
+          sunError, std::abs(sunIrradiance[channel] - cache.SunIrradiance[channel]) / sunScale);
+      for (uint32_t j = 0; j < 9; ++j)
+        shError = std::max(shError, std::abs(sh[j][channel] - cache.sh[j][channel]) / shScale);
+    }
+    maxSunError = std::max(maxSunError, sunError);
+    maxSHError = std::max(maxSHError, shError);
+    sumSunError += sunError;
+    sumSHError += shError;
+
+    cache.Shutdown();
+  }
+
+  // Interpolating the grid and the lower SH resolution cost a few percent at most
+  if (maxSunError > 0.05f || maxSHError > 0.05f)
+    passed = false;
+
+  writeLog(
+      "SkyTable::validate: %s, sun irradiance error mean %.4f max %.4f, SH error mean %.4f max "
+      "%.4f",
+      passed ? "passed" : "FAILED",
+      sumSunError / numSamples,
+      maxSunError,
+      sumSHError / numSamples,
+      maxSHError);
+  return passed;
+}
+//---------------------------------------------------------------------------//
+void SkyTable::benchmark()
+{
+  Random rng;
+  rng.SetSeed(1357);
+
+  Timer timer;
+  timer.init();
+
+  SkyTable table;
+  timer.update();
+  table.build(&getWorkerPool());
+  timer.update();
+  const double buildTime = timer.m_DeltaMillisecondsD;
+
+  const uint32_t numLookups = 10000;
+  std::vector<glm::vec3> sunDirections(numLookups);
+  for (glm::vec3& sunDirection : sunDirections)
+    sunDirection = randomSunDirection(rng);
+
+  glm::vec3 sum = glm::vec3(0.0f);
+  timer.update();
+  for (const glm::vec3& sunDirection : sunDirections)
+  {
+    glm::vec3 sunIrradiance;
+    SH9Color sh;
+    table.lookup(sunDirection, glm::vec3(0.3f), 3.0f, sunIrradiance, sh);
+    sum += sunIrradiance + sh[0];
+  }
+  timer.update();
+  const double lookupTime = timer.m_DeltaMillisecondsD / numLookups;
+
+  // The sun integration and the SH projection of a cube map at the table's resolution, what a
+  // lookup replaces
+  const uint32_t numDirect = 32;
+  std::vector<Half4> texels(SHResolution * SHResolution * 6);
+  timer.update();
+  for (uint32_t i = 0; i < numDirect; ++i)
+  {
+    SkyCache cache;
+    cache.Compute(sunDirections[i], 1.0f, glm::vec3(0.3f), 3.0f, nullptr, nullptr);
+    SH9Color sh;
+    cache.BakeCubeMap(SHResolution, texels.data(), sh, nullptr);
+    sum += cache.SunIrradiance + sh[0];
+    cache.Shutdown();
+  }
+  timer.update();
+  const double directTime = timer.m_DeltaMillisecondsD / numDirect;
+
+  writeLog(
+      "SkyTable::benchmark: %u entries built in %.1f ms on %u threads (%llu KB), lookup %.4f ms, "
+      "direct %.3f ms (%.0fx) [%f]",
+      NumEntries,
+      buildTime,
+      getWorkerPool().numThreads(),
+      uint64_t(sizeof(SkyTableEntry)) * NumEntries / 1024,
+      lookupTime,
+      directTime,
+      directTime / lookupTime,
+      sum.x);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "AnalyticalSkyModel.hpp"
+
+struct WorkerPool;
+
+//---------------------------------------------------------------------------//
+// Sun irradiance and sky SH of a grey ground albedo, for the sun at azimuth 0 (in the xy plane
+// towards +x). Colors are pre-scaled by FP16Scale like SkyCache.
+struct SkyTableEntry
+{
+  glm::vec3 SunIrradiance;
+  glm::vec3 SH[9];
+};
+static_assert(sizeof(SkyTableEntry) == 120);
+//---------------------------------------------------------------------------//
+// Precomputed SkyCache results over a grid of sun elevation, turbidity and ground albedo, so the
+// sun irradiance and the sky SH of any parameters are interpolated in microseconds instead of the
+// 60 spectral Hosek states and 3840 solar radiance evaluations of the sun integration.
+//
+// Elevations are spaced evenly in cbrt(elevation / (pi / 2)) like the Hosek model interpolates
+// its data, turbidities are the model's integer ones. Each RGB channel of the sky only depends on
+// the matching channel of the ground albedo, so a channel is interpolated at its own albedo, and
+// the SH is rotated from azimuth 0 to the sun's azimuth. The sun radiance follows from the
+// irradiance and the sun size.
+//
+// The table is a binary file of a header and the entries (elevation major, then turbidity, then
+// albedo), built on the worker pool when it's missing or stale.
+//---------------------------------------------------------------------------//
+struct SkyTable
+{
+  static constexpr uint32_t NumElevations = 24;
+  static constexpr uint32_t NumTurbidities = 10;
+  static constexpr uint32_t NumAlbedos = 5;
+  static constexpr float MinTurbidity = 1.0f;
+  static constexpr float MaxTurbidity = 10.0f;
+  // Cube map resolution the SH are projected from
+  static constexpr uint64_t SHResolution = 32;
+
+  // Loads p_FilePath, or builds the table and writes it there
+  void init(const wchar_t* p_FilePath, WorkerPool* p_Pool);
+  void deinit() { m_Entries.clear(); }
+
+  // p_Pool null builds on the calling thread
+  void build(WorkerPool* p_Pool);
+  bool save(const wchar_t* p_FilePath) const;
+  bool load(const wchar_t* p_FilePath);
+
+  bool valid() const { return m_Entries.empty() == false; }
+
+  // Same sanitizing of the parameters as SkyCache::Init(), turbidity is clamped to the table
+  void lookup(
+      const glm::vec3& p_SunDirection,
+      const glm::vec3& p_GroundAlbedo,
+      float p_Turbidity,
+      glm::vec3& p_SunIrradiance,
+      SH9Color& p_SH) const;
+
+  const SkyTableEntry& entry(uint32_t p_Elevation, uint32_t p_Turbidity, uint32_t p_Albedo) const
+  {
+    return m_Entries[(p_Elevation * NumTurbidities + p_Turbidity) * NumAlbedos + p_Albedo];
+  }
+
+  // Headless checks of the SH rotation, of a saved and loaded table and of lookups against the
+  // direct computation at random parameters. Results go to the debug output.
+  static bool validate();
+  // Headless timings of the table build and of lookups next to the direct computation
+  static void benchmark();
+
+private:
+  std::vector<SkyTableEntry> m_Entries;
+};
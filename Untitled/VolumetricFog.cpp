@@ -65,21 +65,23 @@ struct FogConstants
   uint32_t ScatteringVolumeIdx = uint32_t(-1);
   uint32_t PreviousScatteringVolumeIdx = uint32_t(-1);
   uint32_t FinalIntegrationVolumeIdx = uint32_t(-1);
-  uint32_t unused2 = uint32_t(-1);
+  uint32_t SpotLightBufferIdx = uint32_t(-1);
 
   glm::vec3 CameraPos;
-  uint32_t unused3 = uint32_t(-1);
+  uint32_t NumSpotLights = 0;
 
   uint32_t NumXTiles;
   uint32_t NumXYTiles;
   glm::vec2 HaltonXY;
+
+  uint32_t SpotLightShadowMatrixBufferIdx = uint32_t(-1);
+  uint32_t SpotLightElementsPerCluster = 0;
 };
 
 enum RootParams : uint32_t
 {
   RootParam_StandardDescriptors,
   RootParam_Cbuffer,
-  RootParam_LightsCbuffer,
   RootParam_UAVDescriptors,
   RootParam_AppSettings,
 
@@ -231,14 +233,6 @@ void VolumetricFog::init(ID3D12Device * p_Device)
     rootParameters[RootParam_Cbuffer].Descriptor.ShaderRegister = 0;
     rootParameters[RootParam_Cbuffer].Descriptor.Flags = D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC;
 
-    // Lights buffer
-    rootParameters[RootParam_LightsCbuffer].ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV;
-    rootParameters[RootParam_LightsCbuffer].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
-    rootParameters[RootParam_LightsCbuffer].Descriptor.RegisterSpace = 0;
-    rootParameters[RootParam_LightsCbuffer].Descriptor.ShaderRegister = 1;
-    rootParameters[RootParam_LightsCbuffer].Descriptor.Flags =
-        D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC_WHILE_SET_AT_EXECUTE;
-
     // AppSettings
     rootParameters[RootParam_AppSettings].ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV;
     rootParameters[RootParam_AppSettings].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
@@ -396,6 +390,10 @@ void VolumetricFog::render(ID3D12GraphicsCommandList* p_CmdList, const RenderDes
     uniforms.TangentFrameMapIndex = p_RenderDesc.TangentFrameSrv;
     uniforms.MaterialIDMapIdx = p_RenderDesc.MaterialIdMapSrv;
     uniforms.NoiseTextureIdx = p_RenderDesc.NoiseTexSrv;
+    uniforms.SpotLightBufferIdx = p_RenderDesc.SpotLightBufferSrv;
+    uniforms.SpotLightShadowMatrixBufferIdx = p_RenderDesc.SpotLightShadowMatrixBufferSrv;
+    uniforms.NumSpotLights = p_RenderDesc.NumSpotLights;
+    uniforms.SpotLightElementsPerCluster = p_RenderDesc.SpotLightElementsPerCluster;
 
     uniforms.Dimensions = m_Dimensions;
     uniforms.CurrFrame = static_cast<uint32_t>(p_RenderDesc.CurrentFrame);
@@ -431,8 +429,6 @@ void VolumetricFog::render(ID3D12GraphicsCommandList* p_CmdList, const RenderDes
     BindTempDescriptorTable(
         p_CmdList, uavs, arrayCount(uavs), RootParam_UAVDescriptors, CmdListMode::Compute);
 
-    p_RenderDesc.LightsBuffer.setAsComputeRootParameter(p_CmdList, RootParam_LightsCbuffer);
-
     p_CmdList->Dispatch(dispatchGroupX, dispatchGroupY, m_Dimensions.z);
 
     // Sync back volume buffer to be read
@@ -460,8 +456,6 @@ void VolumetricFog::render(ID3D12GraphicsCommandList* p_CmdList, const RenderDes
 
     AppSettings::bindCBufferCompute(p_CmdList, RootParam_AppSettings);
 
-    p_RenderDesc.LightsBuffer.setAsComputeRootParameter(p_CmdList, RootParam_LightsCbuffer);
-
     // NOTE: If temporal filter is active we must use another volume instead of
     // the default scattering volume as the rendertarget/UAV for this pass.
     // Reason being, the temporal pass samples current scattering volume but also
@@ -527,8 +521,6 @@ void VolumetricFog::render(ID3D12GraphicsCommandList* p_CmdList, const RenderDes
     BindTempDescriptorTable(
         p_CmdList, uavs, arrayCount(uavs), RootParam_UAVDescriptors, CmdListMode::Compute);
 
-    p_RenderDesc.LightsBuffer.setAsComputeRootParameter(p_CmdList, RootParam_LightsCbuffer);
-
     p_CmdList->Dispatch(dispatchGroupX, dispatchGroupY, m_Dimensions.z);
 
     m_ScatteringVolumes[m_CurrLightScatteringTextureIndex].makeReadable(p_CmdList);
@@ -564,8 +556,6 @@ void VolumetricFog::render(ID3D12GraphicsCommandList* p_CmdList, const RenderDes
     BindTempDescriptorTable(
         p_CmdList, uavs, arrayCount(uavs), RootParam_UAVDescriptors, CmdListMode::Compute);
 
-    p_RenderDesc.LightsBuffer.setAsComputeRootParameter(p_CmdList, RootParam_LightsCbuffer);
-
     // NOTE: Z = 1 as we integrate inside the shader.
     p_CmdList->Dispatch(dispatchGroupX, dispatchGroupY, 1);
 
@@ -14,6 +14,10 @@ struct VolumetricFog
     uint32_t ClusterBufferSrv;
     uint32_t DepthBufferSrv;
     uint32_t SpotLightShadowSrv;
+    uint32_t SpotLightBufferSrv;
+    uint32_t SpotLightShadowMatrixBufferSrv;
+    uint32_t NumSpotLights;
+    uint32_t SpotLightElementsPerCluster;
 
     uint32_t UVMapSrv;
     uint32_t TangentFrameSrv;
@@ -28,7 +32,6 @@ struct VolumetricFog
 
     FirstPersonCamera Camera;
     glm::mat4 PrevViewProj;
-    ConstantBuffer LightsBuffer;
 
     glm::vec2 HaltonXY;
   };